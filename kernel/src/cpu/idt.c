@@ -1,4 +1,5 @@
 #include "idt.h"
+#include "irq.h"
 #include <stddef.h>
 
 static struct idt_entry idt[256];
@@ -53,6 +54,8 @@ extern void isr45(void);
 extern void isr46(void);
 extern void isr47(void);
 extern void isr48(void);
+extern void isr253(void);
+extern const uint64_t isr_msi_table[IRQ_MSI_COUNT];
 extern void isr255(void);
 
 void idt_set_gate(uint8_t num, uint64_t base, uint16_t sel, uint8_t flags) {
@@ -128,6 +131,13 @@ void idt_init(void) {
   // LAPIC timer interrupt vector
   idt_set_gate(48, (uint64_t)isr48, sel, flags);
 
+  // MSI/MSI-X vectors
+  for (int i = 0; i < IRQ_MSI_COUNT; i++)
+    idt_set_gate(IRQ_MSI_BASE + i, isr_msi_table[i], sel, flags);
+
+  // TLB shootdown IPI vector
+  idt_set_gate(253, (uint64_t)isr253, sel, flags);
+
   // LAPIC spurious interrupt vector
   idt_set_gate(255, (uint64_t)isr255, sel, flags);
 
@@ -69,6 +69,16 @@ ISR_NOERRCODE 47
 ; LAPIC timer interrupt vector
 ISR_NOERRCODE 48
 
+; MSI/MSI-X vectors handed out by irq_alloc_msi_vector() (cpu/irq.h)
+%assign vec 96
+%rep 32
+ISR_NOERRCODE %[vec]
+%assign vec vec+1
+%endrep
+
+; TLB shootdown IPI vector (mm/tlb.h)
+ISR_NOERRCODE 253
+
 ; LAPIC spurious interrupt vector
 ISR_NOERRCODE 255
 
@@ -131,3 +141,12 @@ isr_common_stub:
 
     add rsp, 16 ; remove error code and int number
     iretq
+
+section .rodata
+global isr_msi_table
+isr_msi_table:
+%assign vec 96
+%rep 32
+    dq isr%[vec]
+%assign vec vec+1
+%endrep
@@ -142,3 +142,19 @@ void irq_test_trigger(uint8_t irq_no) {
   if (vector == 47) { __asm__ volatile("int $47"); }
   else if (vector == 33) { __asm__ volatile("int $33"); }
 }
+
+// ── MSI vector allocation ────────────────────────────────────────────────────
+
+static uint32_t msi_vectors_used = 0;
+
+int irq_alloc_msi_vector(isr_t handler) {
+    for (int i = 0; i < IRQ_MSI_COUNT; i++) {
+        uint32_t bit = 1u << i;
+        if (__atomic_fetch_or(&msi_vectors_used, bit, __ATOMIC_ACQ_REL) & bit)
+            continue;
+        register_interrupt_handler((uint8_t)(IRQ_MSI_BASE + i), handler);
+        return IRQ_MSI_BASE + i;
+    }
+    klog_puts("[IRQ] Out of MSI vectors\n");
+    return -1;
+}
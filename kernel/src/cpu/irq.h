@@ -33,6 +33,27 @@ bool irq_install_handler(uint8_t irq_no, isr_t handler, uint16_t flags);
  */
 bool irq_uninstall_handler(uint8_t irq_no, isr_t handler);
 
+// ── MSI / MSI-X ──────────────────────────────────────────────────────────────
+// Message-signalled interrupts bypass the I/O APIC: the device writes the
+// vector straight to a LAPIC. Vectors IRQ_MSI_BASE..+IRQ_MSI_COUNT-1 are
+// reserved for them (LAPIC EOI is sent by isr_handler as usual).
+#define IRQ_MSI_BASE 96
+#define IRQ_MSI_COUNT 32
+
+/**
+ * @brief Reserve an MSI vector and install its handler.
+ * @return The vector, or -1 if all are taken.
+ */
+int irq_alloc_msi_vector(isr_t handler);
+
+/**
+ * @brief Message address that delivers to the LAPIC with the given ID
+ * (fixed delivery, physical destination).
+ */
+static inline uint32_t irq_msi_address(uint32_t apic_id) {
+  return 0xFEE00000u | (apic_id << 12);
+}
+
 void irq_manager_sync(void);
 void irq_register_stats_dev(void);
 
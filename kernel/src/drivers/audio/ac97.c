@@ -254,7 +254,7 @@ void ac97_init(void) {
   klog_puts("[OK] AC97 Initialized.\n");
 }
 
-static uint32_t ac97_vfs_write(struct vfs_node *node, uint32_t offset,
+static uint32_t ac97_vfs_write(struct vfs_node *node, uint64_t offset,
                                uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
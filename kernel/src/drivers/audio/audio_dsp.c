@@ -51,7 +51,7 @@ static vfs_node_t *get_active_audio_node(void) {
 }
 
 // Dispatch write to active audio device
-static uint32_t dsp_vfs_write(struct vfs_node *node, uint32_t offset,
+static uint32_t dsp_vfs_write(struct vfs_node *node, uint64_t offset,
                               uint32_t size, uint8_t *buffer) {
   (void)node;
   vfs_node_t *audio = get_active_audio_node();
@@ -849,7 +849,7 @@ void hda_phase4_test(void) {
   klog_puts("[HDA] Playback stopped. Phase 4 Test complete.\n");
 }
 
-static uint32_t hda_vfs_write(struct vfs_node *node, uint32_t offset,
+static uint32_t hda_vfs_write(struct vfs_node *node, uint64_t offset,
                               uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -372,7 +372,7 @@ static void sb16_pump_audio(void) {
                   dsp_channels, dsp_bits);
 }
 
-static uint32_t dsp_vfs_write(struct vfs_node *node, uint32_t offset,
+static uint32_t dsp_vfs_write(struct vfs_node *node, uint64_t offset,
                               uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -73,7 +73,7 @@ void evdev_push_event(evdev_device_t *dev, uint16_t type, uint16_t code,
 // ── VFS read callback ───────────────────────────────────────────────────────
 // Returns one or more struct input_event records.
 // If the ring is empty, blocks until events arrive.
-static uint32_t evdev_vfs_read(struct vfs_node *node, uint32_t offset,
+static uint32_t evdev_vfs_read(struct vfs_node *node, uint64_t offset,
                                uint32_t size, uint8_t *buffer) {
   (void)offset;
   evdev_device_t *dev = (evdev_device_t *)node->device;
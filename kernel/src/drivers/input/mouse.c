@@ -194,7 +194,7 @@ mouse_state_t mouse_get_state(void) { return global_mouse_state; }
 
 // ── VFS Integration ──────────────────────────────────────────────────────────
 
-static uint32_t mouse_vfs_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+static uint32_t mouse_vfs_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                                uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -202,7 +202,7 @@ bool pty_slave_can_read(pty_pair_t *pty) {
 
 // ── /dev/ptmx (master) VFS operations ────────────────────────────────────────
 
-uint32_t ptmx_read(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t ptmx_read(struct vfs_node *node, uint64_t offset, uint32_t size,
                    uint8_t *buffer) {
   (void)offset;
 
@@ -252,7 +252,7 @@ uint32_t ptmx_read(struct vfs_node *node, uint32_t offset, uint32_t size,
   return read;
 }
 
-uint32_t ptmx_write(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t ptmx_write(struct vfs_node *node, uint64_t offset, uint32_t size,
                     uint8_t *buffer) {
   (void)offset;
 
@@ -537,7 +537,7 @@ void ptmx_close(struct vfs_node *node) {
 
 // ── /dev/pts/N (slave) VFS operations ────────────────────────────────────────
 
-uint32_t pty_slave_read(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t pty_slave_read(struct vfs_node *node, uint64_t offset, uint32_t size,
                         uint8_t *buffer) {
   (void)offset;
 
@@ -641,7 +641,7 @@ uint32_t pty_slave_read(struct vfs_node *node, uint32_t offset, uint32_t size,
   return read;
 }
 
-uint32_t pty_slave_write(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t pty_slave_write(struct vfs_node *node, uint64_t offset, uint32_t size,
                          uint8_t *buffer) {
   (void)offset;
 
@@ -74,9 +74,9 @@ int pty_alloc_pair(void);
 pty_pair_t *pty_get_pair(int index);
 
 // VFS operations for master device (/dev/ptmx)
-uint32_t ptmx_read(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t ptmx_read(struct vfs_node *node, uint64_t offset, uint32_t size,
                    uint8_t *buffer);
-uint32_t ptmx_write(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t ptmx_write(struct vfs_node *node, uint64_t offset, uint32_t size,
                     uint8_t *buffer);
 int ptmx_ioctl(struct vfs_node *node, uint32_t request, uint64_t arg);
 int ptmx_poll(struct vfs_node *node, int events);
@@ -85,9 +85,9 @@ uint64_t ptmx_mmap(struct vfs_node *node, uint64_t addr, uint64_t length,
                    uint64_t prot, uint64_t flags, uint64_t offset);
 
 // VFS operations for slave device (/dev/pts/N)
-uint32_t pty_slave_read(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t pty_slave_read(struct vfs_node *node, uint64_t offset, uint32_t size,
                         uint8_t *buffer);
-uint32_t pty_slave_write(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t pty_slave_write(struct vfs_node *node, uint64_t offset, uint32_t size,
                          uint8_t *buffer);
 int pty_slave_ioctl(struct vfs_node *node, uint32_t request, uint64_t arg);
 int pty_slave_poll(struct vfs_node *node, int events);
@@ -1,6 +1,8 @@
 #include "drivers/storage/ahci.h"
+#include "apic/lapic.h"
 #include "console/console.h"
 #include "console/klog.h"
+#include "cpu/irq.h"
 #include "drivers/pci/pci.h"
 #include "drivers/storage/block.h"
 #include "lib/string.h"
@@ -14,13 +16,27 @@
 
 #define ATA_CMD_READ_DMA_EX 0x25
 #define ATA_CMD_WRITE_DMA_EX 0x35
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
 #define ATA_CMD_IDENTIFY 0xEC
 
 // ── Private structures ──────────────────────────────────────────────────────
 
+// A command slot in flight.
+struct ahci_slot {
+  struct request *rq;
+  void *bounce; // Physical copy buffer if rq could not be mapped
+  size_t bounce_pages;
+};
+
 struct ahci_drive {
   ahci_port_t *port;
   bool present;
+  bool ncq;           // READ/WRITE FPDMA QUEUED, one command per slot
+  uint32_t nr_slots;  // Commands that may be outstanding at once
+  uint32_t slot_mask; // Slots this drive may use
+  uint32_t issued;    // Slots with a command in flight
+  struct ahci_slot slots[32];
   uint64_t total_sectors;
   char model[41];
   struct block_device blkdev;
@@ -30,6 +46,8 @@ struct ahci_drive {
 static ahci_hba_mem_t *hba;
 static struct ahci_drive ahci_drives[32];
 static int ahci_drive_count = 0;
+static struct ahci_drive *port_drives[32]; // Port number -> drive
+static bool ahci_irq_enabled = false;
 
 // ── Helpers ─────────────────────────────────────────────────────────────────
 
@@ -104,17 +122,17 @@ static void port_rebase(ahci_port_t *port) {
   port->fb = (uint32_t)phys_fb;
   port->fbu = (uint32_t)(phys_fb >> 32);
 
-  // Command table offset: 256 bytes per command table, 32 commands
-  // We need 256 * 32 = 8K per port. Alloc 2 pages.
-  void *phys_ctba_base = pmm_alloc_blocks(2);
-  memset((void *)((uint64_t)phys_ctba_base + pmm_get_hhdm_offset()), 0, 8192);
+  // Command tables: AHCI_CMD_TABLE_SIZE (1K) each, 32 commands = 8 pages
+  size_t ctba_pages = (AHCI_CMD_TABLE_SIZE * 32 + 4095) / 4096;
+  void *phys_ctba_base = pmm_alloc_blocks(ctba_pages);
+  memset((void *)((uint64_t)phys_ctba_base + pmm_get_hhdm_offset()), 0,
+         ctba_pages * 4096);
 
   ahci_command_header_t *cmdheader =
       (ahci_command_header_t *)((uint64_t)phys_clb + pmm_get_hhdm_offset());
   for (int i = 0; i < 32; i++) {
-    cmdheader[i].prdtl =
-        8; // Max 8 PRDT entries per command slot for our static struct size
-    uint64_t phys_ctba = (uint64_t)phys_ctba_base + (256 * i);
+    cmdheader[i].prdtl = 0; // Set per command
+    uint64_t phys_ctba = (uint64_t)phys_ctba_base + (AHCI_CMD_TABLE_SIZE * i);
     cmdheader[i].ctba = (uint32_t)phys_ctba;
     cmdheader[i].ctbau = (uint32_t)(phys_ctba >> 32);
   }
@@ -124,29 +142,12 @@ static void port_rebase(ahci_port_t *port) {
 
 // ── AHCI Command IO ─────────────────────────────────────────────────────────
 
-static int ahci_io(ahci_port_t *port, uint64_t lba, uint32_t count, void *buf,
-                   int is_write) {
-  // Find the drive associated with this port to get its lock
-  struct ahci_drive *drive = NULL;
-  for (int i = 0; i < 32; i++) {
-    if (ahci_drives[i].port == port) {
-      drive = &ahci_drives[i];
-      break;
-    }
-  }
-
-  if (drive)
-    spinlock_acquire(&drive->lock);
-
-  // Clear pending interrupts
-  port->is = port->is;
-
-  int slot = find_cmdslot(port);
-  if (slot == -1) {
-    if (drive)
-      spinlock_release(&drive->lock);
-    return -1;
-  }
+// Fill the command table of slot for a transfer over the given physical
+// segments. Called with drive->lock held.
+static void ahci_build_cmd(struct ahci_drive *drive, int slot, uint64_t lba,
+                           uint32_t count, const struct blk_sg *sg, int nsg,
+                           int is_write) {
+  ahci_port_t *port = drive->port;
 
   // Get HHDM VA of command list
   uint64_t clb_addr = ((uint64_t)port->clbu << 32) | port->clb;
@@ -156,45 +157,27 @@ static int ahci_io(ahci_port_t *port, uint64_t lba, uint32_t count, void *buf,
   // Command size (5 dwords in FIS)
   cmdheader[slot].cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
   cmdheader[slot].w = is_write ? 1 : 0;
-
-  // One PRDT entry per page
-  cmdheader[slot].prdtl = 1;
+  cmdheader[slot].prdtl = (uint16_t)nsg;
+  cmdheader[slot].prdbc = 0;
 
   // Get HHDM VA of command table
   uint64_t ctba_addr =
       ((uint64_t)cmdheader[slot].ctbau << 32) | cmdheader[slot].ctba;
   ahci_command_table_t *cmdtbl =
       (ahci_command_table_t *)(ctba_addr + pmm_get_hhdm_offset());
-  memset(cmdtbl, 0, sizeof(ahci_command_table_t));
-
-  // Use a DMA bounce buffer in physical memory. The syscall/file layer may
-  // pass user virtual addresses which are NOT in HHDM and are not guaranteed
-  // physically contiguous.
-  uint64_t bytes = (uint64_t)count * 512;
-  uint64_t pages = (bytes + 4095) / 4096;
-  void *bounce_phys = pmm_alloc_blocks(pages);
-  if (!bounce_phys) {
-    console_puts("[ERR] AHCI OOM: bounce buffer alloc failed\n");
-    return -1;
-  }
-  void *bounce_virt = (void *)((uint64_t)bounce_phys + pmm_get_hhdm_offset());
+  memset(cmdtbl, 0, 128 + nsg * sizeof(ahci_prdt_entry_t));
 
-  if (is_write) {
-    memcpy(bounce_virt, buf, (size_t)bytes);
-  } else {
-    memset(bounce_virt, 0, (size_t)bytes);
+  // One PRDT entry per segment
+  for (int i = 0; i < nsg; i++) {
+    cmdtbl->prdt_entry[i].dba = (uint32_t)sg[i].phys;
+    cmdtbl->prdt_entry[i].dbau = (uint32_t)(sg[i].phys >> 32);
+    cmdtbl->prdt_entry[i].dbc = sg[i].len - 1; // Byte count - 1
   }
 
-  cmdtbl->prdt_entry[0].dba = (uint32_t)(uint64_t)bounce_phys;
-  cmdtbl->prdt_entry[0].dbau = (uint32_t)((uint64_t)bounce_phys >> 32);
-  cmdtbl->prdt_entry[0].dbc = bytes - 1; // Byte count - 1
-  cmdtbl->prdt_entry[0].i = 1;           // Interrupt on completion
-
   // Setup FIS
   fis_reg_h2d_t *cmdfis = (fis_reg_h2d_t *)(&cmdtbl->cfis);
   cmdfis->fis_type = FIS_TYPE_REG_H2D;
   cmdfis->c = 1; // Command
-  cmdfis->command = is_write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX;
 
   cmdfis->lba0 = (uint8_t)(lba & 0xFF);
   cmdfis->lba1 = (uint8_t)((lba >> 8) & 0xFF);
@@ -205,49 +188,183 @@ static int ahci_io(ahci_port_t *port, uint64_t lba, uint32_t count, void *buf,
   cmdfis->lba4 = (uint8_t)((lba >> 32) & 0xFF);
   cmdfis->lba5 = (uint8_t)((lba >> 40) & 0xFF);
 
-  cmdfis->countl = count & 0xFF;
-  cmdfis->counth = (count >> 8) & 0xFF;
+  if (drive->ncq) {
+    // FPDMA QUEUED: sector count in the feature registers, tag in count
+    cmdfis->command =
+        is_write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    cmdfis->featurel = count & 0xFF;
+    cmdfis->featureh = (count >> 8) & 0xFF;
+    cmdfis->countl = (uint8_t)(slot << 3);
+  } else {
+    cmdfis->command = is_write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX;
+    cmdfis->countl = count & 0xFF;
+    cmdfis->counth = (count >> 8) & 0xFF;
+  }
+}
 
-  // Issue command
-  while (port->tfd & (0x80 | 0x08))
-    ; // Wait until drive not busy or drq
+// Segments the HBA can take as they are: word aligned, even lengths, no
+// more than 4 MiB each.
+static int ahci_map_sg(struct request *rq, struct blk_sg *sg) {
+  int nsg = blk_rq_map_sg(rq, sg, AHCI_MAX_PRDT);
+  for (int i = 0; i < nsg; i++) {
+    if ((sg[i].phys & 1) || (sg[i].len & 1) || sg[i].len > AHCI_PRD_MAX_BYTES)
+      return -1;
+  }
+  return nsg;
+}
 
-  port->ci = 1 << slot;
+// Copy through one contiguous buffer for requests that cannot be mapped.
+static void *ahci_alloc_bounce(struct request *rq, size_t *pages_out) {
+  size_t bytes = (size_t)rq->count * 512;
+  size_t pages = (bytes + 4095) / 4096;
+  void *bounce_phys = pmm_alloc_blocks(pages);
+  if (!bounce_phys) {
+    console_puts("[ERR] AHCI OOM: bounce buffer alloc failed\n");
+    return NULL;
+  }
+  *pages_out = pages;
+
+  if (rq->op == BIO_WRITE) {
+    uint8_t *virt = (uint8_t *)((uint64_t)bounce_phys + pmm_get_hhdm_offset());
+    struct bio *bio;
+    rq_for_each_bio(bio, rq) {
+      memcpy(virt, bio->buf, (size_t)bio->count * 512);
+      virt += (size_t)bio->count * 512;
+    }
+  }
+  return bounce_phys;
+}
 
-  // Wait for completion
-  while (1) {
-    // If the command issue bit clears, it's done
-    if ((port->ci & (1 << slot)) == 0)
-      break;
-    if (port->is & (1 << 30)) { // Error (TFES - Task File Error Status)
-      console_puts("[ERR] AHCI Disk Error during wait: IS=");
-      // Note: we'd ideally dump more regs here
-      pmm_free_blocks(bounce_phys, pages);
-      return -1;
+static void ahci_free_bounce(struct ahci_slot *s, int status) {
+  if (status == 0 && s->rq->op == BIO_READ) {
+    uint8_t *virt = (uint8_t *)((uint64_t)s->bounce + pmm_get_hhdm_offset());
+    struct bio *bio;
+    rq_for_each_bio(bio, s->rq) {
+      memcpy(bio->buf, virt, (size_t)bio->count * 512);
+      virt += (size_t)bio->count * 512;
     }
   }
+  pmm_free_blocks(s->bounce, s->bounce_pages);
+}
 
-  if (!is_write) {
-    memcpy(buf, bounce_virt, (size_t)bytes);
+// A task file or bus error stops the port. Without NCQ error recovery (READ
+// LOG EXT) the failing tag is unknown: restart the port and fail everything
+// that was outstanding.
+static void ahci_port_recover(ahci_port_t *port) {
+  stop_cmd(port);
+  port->serr = port->serr;
+  port->is = port->is;
+  start_cmd(port);
+}
+
+// Retire the slots the HBA has finished with. Safe from the IRQ handler and
+// from pollers at the same time: slots are claimed under the drive lock.
+static void ahci_port_complete(struct ahci_drive *drive) {
+  ahci_port_t *port = drive->port;
+  struct ahci_slot done[32];
+  uint32_t n = 0;
+  int status = 0;
+
+  spinlock_acquire(&drive->lock);
+  uint32_t pis = port->is;
+  port->is = pis; // Write 1 to clear
+  uint32_t finished;
+  if (pis & AHCI_PxIS_ERROR) {
+    console_puts("[ERR] AHCI Disk Error, failing outstanding commands\n");
+    ahci_port_recover(port);
+    finished = drive->issued;
+    status = -1;
+  } else {
+    finished = drive->issued & ~(port->sact | port->ci);
+  }
+  drive->issued &= ~finished;
+  while (finished) {
+    int slot = __builtin_ctz(finished);
+    finished &= finished - 1;
+    done[n++] = drive->slots[slot];
+    drive->slots[slot].rq = NULL;
   }
-  pmm_free_blocks(bounce_phys, pages);
+  spinlock_release(&drive->lock);
 
-  if (drive)
+  for (uint32_t i = 0; i < n; i++) {
+    if (done[i].bounce)
+      ahci_free_bounce(&done[i], status);
+    blk_end_request(done[i].rq, status);
+  }
+}
+
+// Block layer entry point: the request's pages go straight into the PRDT
+// and the command is queued in a free slot. Completion comes from the port
+// interrupt (or ahci_poll()).
+static int ahci_submit(struct block_device *dev, struct request *rq) {
+  struct ahci_drive *drive = (struct ahci_drive *)dev->driver_data;
+  ahci_port_t *port = drive->port;
+  if (rq->count == 0 || rq->count > AHCI_MAX_SECTORS)
+    return -1;
+
+  struct blk_sg sg[AHCI_MAX_PRDT];
+  void *bounce = NULL;
+  size_t bounce_pages = 0;
+  int nsg = ahci_map_sg(rq, sg);
+  if (nsg <= 0) {
+    bounce = ahci_alloc_bounce(rq, &bounce_pages);
+    if (!bounce)
+      return -1;
+    sg[0].phys = (uint64_t)bounce;
+    sg[0].len = rq->count * 512;
+    nsg = 1;
+  }
+
+  spinlock_acquire(&drive->lock);
+  uint32_t free = drive->slot_mask & ~drive->issued & ~(port->sact | port->ci);
+  if (!free) {
     spinlock_release(&drive->lock);
+    if (bounce)
+      pmm_free_blocks(bounce, bounce_pages);
+    return -1;
+  }
+  int slot = __builtin_ctz(free);
+  drive->slots[slot].rq = rq;
+  drive->slots[slot].bounce = bounce;
+  drive->slots[slot].bounce_pages = bounce_pages;
+  drive->issued |= 1u << slot;
+
+  ahci_build_cmd(drive, slot, rq->lba, rq->count, sg, nsg, rq->op == BIO_WRITE);
+  if (drive->ncq)
+    port->sact = 1u << slot;
+  port->ci = 1u << slot;
+  spinlock_release(&drive->lock);
+
+  if (!ahci_irq_enabled) {
+    // No interrupt line: wait for this command right here
+    while (__atomic_load_n(&drive->issued, __ATOMIC_ACQUIRE) & (1u << slot)) {
+      ahci_port_complete(drive);
+      __asm__ volatile("pause");
+    }
+  }
   return 0;
 }
 
-static int ahci_read(struct block_device *dev, uint64_t lba, uint32_t count,
-                     void *buf) {
-  struct ahci_drive *drive = (struct ahci_drive *)dev->driver_data;
-  return ahci_io(drive->port, lba, count, buf, 0);
+static void ahci_poll(struct block_device *dev) {
+  ahci_port_complete((struct ahci_drive *)dev->driver_data);
 }
 
-static int ahci_write(struct block_device *dev, uint64_t lba, uint32_t count,
-                      const void *buf) {
-  struct ahci_drive *drive = (struct ahci_drive *)dev->driver_data;
-  // Cast away const for our naive physical address calculation
-  return ahci_io(drive->port, lba, count, (void *)buf, 1);
+static void ahci_irq_handler(struct registers *regs) {
+  (void)regs;
+  if (!hba)
+    return;
+  uint32_t is = hba->is;
+  if (!is)
+    return; // Shared INTx line, not ours
+
+  for (uint32_t pending = is; pending; pending &= pending - 1) {
+    int portno = __builtin_ctz(pending);
+    if (port_drives[portno])
+      ahci_port_complete(port_drives[portno]);
+    else
+      hba->ports[portno].is = hba->ports[portno].is;
+  }
+  hba->is = is;
 }
 
 // ── Identify & Setup ────────────────────────────────────────────────────────
@@ -310,6 +427,18 @@ static bool ahci_identify(ahci_port_t *port, struct ahci_drive *drive) {
 
   drive->total_sectors = lba48_sectors ? lba48_sectors : lba28_sectors;
 
+  // NCQ needs both the HBA and the drive; the drive's queue depth may be
+  // below the HBA's slot count.
+  uint32_t hba_slots = (hba->cap & AHCI_CAP_NCS) + 1;
+  drive->ncq = (hba->cap & AHCI_CAP_SNCQ) && (identify_data[76] & (1 << 8));
+  drive->nr_slots = 1;
+  if (drive->ncq) {
+    uint32_t depth = (identify_data[75] & 0x1F) + 1;
+    drive->nr_slots = depth < hba_slots ? depth : hba_slots;
+  }
+  drive->slot_mask = drive->nr_slots == 32 ? 0xFFFFFFFFu
+                                           : (1u << drive->nr_slots) - 1;
+
   for (int i = 0; i < 20; i++) {
     drive->model[i * 2] = (char)(identify_data[27 + i] >> 8);
     drive->model[i * 2 + 1] = (char)(identify_data[27 + i] & 0xFF);
@@ -378,10 +507,27 @@ static void probe_port(ahci_port_t *port, int portno) {
       blk->name[5] = '\0';
       blk->sector_size = 512;
       blk->total_sectors = drive->total_sectors;
-      blk->read_sectors = ahci_read;
-      blk->write_sectors = ahci_write;
+      blk->submit = ahci_submit;
+      blk->poll = ahci_poll;
+      // Without an interrupt each command is polled to completion
+      blk->queue_depth = ahci_irq_enabled ? drive->nr_slots : 1;
+      // Merged requests of scattered pages still fit in one PRDT
+      blk->max_sectors = AHCI_MAX_PRDT * (4096 / 512);
+      blk->max_segments = AHCI_MAX_PRDT;
       blk->driver_data = drive;
 
+      console_puts("     sata");
+      console_putchar('0' + ahci_drive_count);
+      console_puts(drive->ncq ? ": NCQ, " : ": no NCQ, ");
+      print_uint64(blk->queue_depth);
+      console_puts(" command slot(s)\n");
+
+      port_drives[portno] = drive;
+      port->is = port->is;
+      if (ahci_irq_enabled)
+        port->ie = AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_SDBS |
+                   AHCI_PxIS_DPS | AHCI_PxIS_ERROR;
+
       block_register(blk);
       ahci_drive_count++;
     }
@@ -390,6 +536,51 @@ static void probe_port(ahci_port_t *port, int portno) {
 
 // ── Initialization ──────────────────────────────────────────────────────────
 
+// One interrupt for the whole HBA: MSI if the controller has it, else the
+// (possibly shared) INTx line. Returns false if completions must be polled.
+static bool ahci_setup_irq(struct pci_device *pdev) {
+  uint8_t cap = pci_find_capability(pdev, 0x05); // MSI
+  if (cap) {
+    int vector = irq_alloc_msi_vector(ahci_irq_handler);
+    if (vector >= 0) {
+      uint16_t ctrl =
+          pci_config_read16(pdev->bus, pdev->slot, pdev->func, cap + 2);
+      pci_config_write32(pdev->bus, pdev->slot, pdev->func, cap + 4,
+                         irq_msi_address(lapic_get_id()));
+      if (ctrl & 0x80) { // 64-bit message address
+        pci_config_write32(pdev->bus, pdev->slot, pdev->func, cap + 8, 0);
+        pci_config_write16(pdev->bus, pdev->slot, pdev->func, cap + 12,
+                           (uint16_t)vector);
+      } else {
+        pci_config_write16(pdev->bus, pdev->slot, pdev->func, cap + 8,
+                           (uint16_t)vector);
+      }
+      // Single message, enabled; INTx off
+      pci_config_write16(pdev->bus, pdev->slot, pdev->func, cap + 2,
+                         (ctrl & ~0x70) | 1);
+      uint32_t pci_cmd =
+          pci_config_read32(pdev->bus, pdev->slot, pdev->func, 0x04);
+      pci_config_write32(pdev->bus, pdev->slot, pdev->func, 0x04,
+                         pci_cmd | (1 << 10));
+      klog_puts("[AHCI] MSI on vector ");
+      klog_uint64(vector);
+      klog_puts("\n");
+      return true;
+    }
+  }
+
+  if (pdev->irq_line && pdev->irq_line != 0xFF &&
+      irq_install_handler(pdev->irq_line, ahci_irq_handler, 0x000F)) {
+    klog_puts("[AHCI] Using IRQ ");
+    klog_uint64(pdev->irq_line);
+    klog_puts("\n");
+    return true;
+  }
+
+  klog_puts("[AHCI] No interrupt available, polling for completions\n");
+  return false;
+}
+
 static int ahci_probe(struct device *dev) {
   uint32_t abar = 0;
   // Get ABAR from BAR5
@@ -408,7 +599,14 @@ static int ahci_probe(struct device *dev) {
   vmm_map_page(vmm_get_active_pml4(), virt_abar + 0x1000, phys_abar + 0x1000, PAGE_FLAG_RW | PAGE_FLAG_PRESENT);
 
   hba = (ahci_hba_mem_t *)virt_abar;
-  hba->ghc |= (1 << 31); // AHCI Enable
+  hba->ghc |= AHCI_GHC_AE; // AHCI Enable
+
+  // Ports enable their own interrupts once their drive is set up
+  ahci_irq_enabled = ahci_setup_irq(pci_dev);
+  if (ahci_irq_enabled) {
+    hba->is = hba->is;
+    hba->ghc |= AHCI_GHC_IE;
+  }
 
   uint32_t pi = hba->pi;
   for (int i = 0; i < 32; i++) {
@@ -12,6 +12,24 @@
 #define AHCI_PORT_DET_PRESENT    3
 #define AHCI_PORT_IPM_ACTIVE     1
 
+#define AHCI_CAP_NCS   0x1F      // Command slots - 1
+#define AHCI_CAP_SNCQ  (1u << 30) // Native command queuing
+
+#define AHCI_GHC_IE    (1u << 1)  // Interrupt enable
+#define AHCI_GHC_AE    (1u << 31) // AHCI enable
+
+// Port interrupt status / enable bits
+#define AHCI_PxIS_DHRS (1u << 0)  // Device to host register FIS
+#define AHCI_PxIS_PSS  (1u << 1)  // PIO setup FIS
+#define AHCI_PxIS_SDBS (1u << 3)  // Set device bits FIS (NCQ completion)
+#define AHCI_PxIS_DPS  (1u << 5)  // Descriptor processed
+#define AHCI_PxIS_IFS  (1u << 27) // Interface fatal error
+#define AHCI_PxIS_HBDS (1u << 28) // Host bus data error
+#define AHCI_PxIS_HBFS (1u << 29) // Host bus fatal error
+#define AHCI_PxIS_TFES (1u << 30) // Task file error
+#define AHCI_PxIS_ERROR \
+    (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
 #define AHCI_CMD_ST   (1 << 0)
 #define AHCI_CMD_FRE  (1 << 4)
 #define AHCI_CMD_FR   (1 << 14)
@@ -80,12 +98,18 @@ typedef struct {
     uint32_t i:1;       // Interrupt on completion
 } __attribute__((packed)) ahci_prdt_entry_t;
 
+// PRDT entries per command: the table of each slot is 1 KiB
+#define AHCI_MAX_PRDT       56
+#define AHCI_CMD_TABLE_SIZE (128 + AHCI_MAX_PRDT * 16)
+#define AHCI_MAX_SECTORS    0xFFFF // READ/WRITE DMA EXT sector count
+#define AHCI_PRD_MAX_BYTES  (4u << 20)
+
 // AHCI Command Table
 typedef struct {
     uint8_t  cfis[64];  // Command FIS
     uint8_t  acmd[16];  // ATAPI command, 12 or 16 bytes
     uint8_t  rsv[48];   // Reserved
-    ahci_prdt_entry_t prdt_entry[1]; // PRDT entries (minimum 1, dynamically sized in practice)
+    ahci_prdt_entry_t prdt_entry[1]; // PRDT entries (AHCI_MAX_PRDT in practice)
 } __attribute__((packed)) ahci_command_table_t;
 
 // AHCI Port Registers
@@ -1,19 +1,56 @@
 #include "drivers/storage/ata.h"
 #include "io/io.h"
 #include "drivers/storage/block.h"
+#include "drivers/pci/pci.h"
 #include "console/console.h"
+#include "cpu/irq.h"
 #include "lib/string.h"
+#include "lock/spinlock.h"
+#include "mm/pmm.h"
+#include "mm/vmm.h"
 #include <stddef.h>
 
 // ── Internal data ───────────────────────────────────────────────────────────
+// Drives on a channel share its registers and its bus-master engine, so the
+// channel runs one command at a time. A DMA request that finds the channel
+// busy waits on the channel's list and is started from the completion
+// interrupt of the one before it; PIO commands claim the channel and spin
+// until it is free.
+
+struct ata_channel {
+    uint16_t io_base;
+    uint16_t ctrl_base;
+    uint16_t bmide;            // Bus-master registers, 0 if no DMA
+    uint8_t  irq;
+    bool     native;           // PCI native mode: shared, level-triggered IRQ
+    spinlock_t lock;
+    bool     busy;             // A command owns the registers
+    struct ata_prd *prdt;      // One page below 4 GiB
+    uint32_t prdt_phys;
+    void    *bounce;           // Physical, ATA_MAX_SECTORS, below 4 GiB
+    // DMA request in flight and its progress
+    struct request *active;
+    struct ata_drive *active_drive;
+    bool     direct;           // PRDs point at the request's own pages
+    uint32_t done_sectors;
+    uint32_t xfer_sectors;
+    struct request *wait_head; // Linked through driver_data
+    struct request *wait_tail;
+    uint64_t dma_commands;
+    uint64_t interrupts;
+    uint64_t bounced;
+};
 
 struct ata_drive {
     uint16_t io_base;
     uint16_t ctrl_base;
     uint8_t  slave;            // 0 = master, 1 = slave
     bool     present;
+    bool     lba48;            // 48-bit addressing (IDENTIFY word 83 bit 10)
+    bool     dma;              // Driven by bus-master DMA
     uint64_t total_sectors;
     char     model[41];
+    struct ata_channel *chan;
     struct block_device blkdev;
 };
 
@@ -21,6 +58,8 @@ struct ata_drive {
 static struct ata_drive ata_drives[MAX_ATA_DRIVES];
 static int ata_drive_count = 0;
 
+static struct ata_channel ata_channels[2];
+
 // ── Helpers ─────────────────────────────────────────────────────────────────
 
 static void print_uint64(uint64_t num) {
@@ -106,7 +145,11 @@ static bool ata_identify(struct ata_drive *drive) {
     uint32_t lba28_sectors = (uint32_t)identify_data[60]
                            | ((uint32_t)identify_data[61] << 16);
 
-    drive->total_sectors = lba48_sectors ? lba48_sectors : lba28_sectors;
+    drive->lba48 = (identify_data[83] & (1 << 10)) && lba48_sectors;
+    drive->total_sectors = drive->lba48 ? lba48_sectors : lba28_sectors;
+
+    // DMA supported (word 49 bit 8); the channel decides if it is used
+    drive->dma = (identify_data[49] & (1 << 8)) != 0;
 
     // Extract model string (words 27-46, byte-swapped)
     for (int i = 0; i < 20; i++) {
@@ -125,85 +168,417 @@ static bool ata_identify(struct ata_drive *drive) {
     return true;
 }
 
-// ── PIO Read ────────────────────────────────────────────────────────────────
-
-static int ata_pio_read(struct block_device *dev, uint64_t lba, uint32_t count, void *buf) {
-    struct ata_drive *drive = (struct ata_drive *)dev->driver_data;
-    uint16_t io = drive->io_base;
+// ── Channel ownership ───────────────────────────────────────────────────────
 
-    uint8_t *ptr = (uint8_t *)buf;
+static void ata_dma_start(struct ata_channel *chan);
+static bool ata_chan_service(struct ata_channel *chan);
 
-    for (uint32_t s = 0; s < count; s++) {
-        uint64_t sector = lba + s;
+static bool ata_irqs_enabled(void) {
+    uint64_t rflags;
+    __asm__ volatile("pushfq; pop %0" : "=r"(rflags));
+    return rflags & 0x200;
+}
 
-        // Wait for drive to be ready
-        if (ata_wait_bsy(io) < 0) return -1;
+// Take the channel for a PIO or non-data command. With interrupts off the
+// DMA command holding it can only finish if we reap it ourselves.
+static void ata_chan_claim(struct ata_channel *chan) {
+    while (1) {
+        spinlock_acquire(&chan->lock);
+        if (!chan->busy) {
+            chan->busy = true;
+            spinlock_release(&chan->lock);
+            return;
+        }
+        spinlock_release(&chan->lock);
+        if (!ata_irqs_enabled()) ata_chan_service(chan);
+        __asm__ volatile("pause");
+    }
+}
 
-        // Select drive + LBA mode + top 4 bits of LBA
-        outb(io + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4) | ((sector >> 24) & 0x0F));
-        outb(io + ATA_REG_SECCOUNT, 1);
-        outb(io + ATA_REG_LBA_LO,  (uint8_t)(sector & 0xFF));
-        outb(io + ATA_REG_LBA_MID, (uint8_t)((sector >> 8) & 0xFF));
-        outb(io + ATA_REG_LBA_HI,  (uint8_t)((sector >> 16) & 0xFF));
-        outb(io + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
+// Hand the channel to the next waiting DMA request, if any. Called with
+// chan->lock held.
+static void ata_chan_next(struct ata_channel *chan) {
+    struct request *rq = chan->wait_head;
+    if (!rq) {
+        chan->busy = false;
+        return;
+    }
+    chan->wait_head = (struct request *)rq->driver_data;
+    if (!chan->wait_head) chan->wait_tail = NULL;
+    chan->active = rq;
+    chan->active_drive = (struct ata_drive *)rq->dev->driver_data;
+    ata_dma_start(chan);
+}
 
-        // Wait for data
-        if (ata_wait_drq(io) < 0) return -1;
+static void ata_chan_release(struct ata_channel *chan) {
+    spinlock_acquire(&chan->lock);
+    ata_chan_next(chan);
+    spinlock_release(&chan->lock);
+}
 
-        // Read 256 words (512 bytes)
-        insw(io + ATA_REG_DATA, ptr, 256);
-        ptr += 512;
+// Select the drive and load LBA and sector count (count 256 is written as 0)
+static int ata_setup_command(struct ata_drive *drive, uint64_t lba, uint32_t count) {
+    uint16_t io = drive->io_base;
+    if (ata_wait_bsy(io) < 0) return -1;
+
+    if (drive->lba48) {
+        outb(io + ATA_REG_DRIVE, 0x40 | (drive->slave << 4));
+        ata_400ns_delay(drive->ctrl_base);
+        outb(io + ATA_REG_SECCOUNT, (uint8_t)(count >> 8));
+        outb(io + ATA_REG_LBA_LO,  (uint8_t)(lba >> 24));
+        outb(io + ATA_REG_LBA_MID, (uint8_t)(lba >> 32));
+        outb(io + ATA_REG_LBA_HI,  (uint8_t)(lba >> 40));
+    } else {
+        outb(io + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+        ata_400ns_delay(drive->ctrl_base);
     }
-
+    outb(io + ATA_REG_SECCOUNT, (uint8_t)count);
+    outb(io + ATA_REG_LBA_LO,  (uint8_t)(lba & 0xFF));
+    outb(io + ATA_REG_LBA_MID, (uint8_t)((lba >> 8) & 0xFF));
+    outb(io + ATA_REG_LBA_HI,  (uint8_t)((lba >> 16) & 0xFF));
     return 0;
 }
 
+// ── PIO Read ────────────────────────────────────────────────────────────────
+
+static int ata_pio_read(struct block_device *dev, uint64_t lba, uint32_t count, void *buf) {
+    struct ata_drive *drive = (struct ata_drive *)dev->driver_data;
+    uint16_t io = drive->io_base;
+    uint8_t *ptr = (uint8_t *)buf;
+    int ret = 0;
+
+    ata_chan_claim(drive->chan);
+    while (count > 0 && ret == 0) {
+        uint32_t n = count < ATA_MAX_SECTORS ? count : ATA_MAX_SECTORS;
+        if (ata_setup_command(drive, lba, n) < 0) {
+            ret = -1;
+            break;
+        }
+        outb(io + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
+
+        // One DRQ block per sector
+        for (uint32_t s = 0; s < n; s++) {
+            ata_400ns_delay(drive->ctrl_base);
+            if (ata_wait_drq(io) < 0) {
+                ret = -1;
+                break;
+            }
+            insw(io + ATA_REG_DATA, ptr, 256);
+            ptr += 512;
+        }
+        lba += n;
+        count -= n;
+    }
+    ata_chan_release(drive->chan);
+    return ret;
+}
+
 // ── PIO Write ───────────────────────────────────────────────────────────────
 
 static int ata_pio_write(struct block_device *dev, uint64_t lba, uint32_t count, const void *buf) {
     struct ata_drive *drive = (struct ata_drive *)dev->driver_data;
     uint16_t io = drive->io_base;
-
     const uint8_t *ptr = (const uint8_t *)buf;
+    int ret = 0;
+
+    ata_chan_claim(drive->chan);
+    while (count > 0 && ret == 0) {
+        uint32_t n = count < ATA_MAX_SECTORS ? count : ATA_MAX_SECTORS;
+        if (ata_setup_command(drive, lba, n) < 0) {
+            ret = -1;
+            break;
+        }
+        outb(io + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO);
+
+        for (uint32_t s = 0; s < n; s++) {
+            ata_400ns_delay(drive->ctrl_base);
+            if (ata_wait_drq(io) < 0) {
+                ret = -1;
+                break;
+            }
+            outsw(io + ATA_REG_DATA, ptr, 256);
+            ptr += 512;
+        }
+        if (ret == 0 && ata_wait_bsy(io) < 0) ret = -1;
+        lba += n;
+        count -= n;
+    }
+    ata_chan_release(drive->chan);
+    return ret;
+}
+
+// ── Cache flush ─────────────────────────────────────────────────────────────
+// Writes complete into the drive's write cache; block_flush() (fsync, sync)
+// makes them durable instead of a FLUSH CACHE after every sector.
+
+static int ata_flush(struct block_device *dev) {
+    struct ata_drive *drive = (struct ata_drive *)dev->driver_data;
+    uint16_t io = drive->io_base;
+    int ret = 0;
+
+    ata_chan_claim(drive->chan);
+    if (ata_wait_bsy(io) < 0) {
+        ret = -1;
+    } else {
+        outb(io + ATA_REG_DRIVE, 0xA0 | (drive->slave << 4));
+        ata_400ns_delay(drive->ctrl_base);
+        outb(io + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+        ata_400ns_delay(drive->ctrl_base);
+        // A flush may take a while to write out a large cache
+        for (int i = 0; i < 100 && ata_wait_bsy(io) < 0; i++)
+            ;
+        uint8_t status = inb(io + ATA_REG_STATUS);
+        if (status & (ATA_SR_BSY | ATA_SR_ERR | ATA_SR_DF)) ret = -1;
+    }
+    ata_chan_release(drive->chan);
+    return ret;
+}
+
+// ── Bus-master DMA ──────────────────────────────────────────────────────────
+// A request whose pages lie below 4 GiB and fit in ATA_PRD_MAX regions is
+// transferred straight into them; everything else (and requests larger than
+// one command) goes through the channel's bounce buffer, ATA_MAX_SECTORS at
+// a time.
+
+// Append [phys, phys + len) to the PRD table, split at 64 KiB boundaries.
+// Returns the new entry count, or -1 if it does not fit or is not reachable.
+static int ata_prd_add(struct ata_prd *prdt, int n, uint64_t phys, uint32_t len) {
+    if (phys + len > 0x100000000ULL) return -1;
+    while (len > 0) {
+        if (n >= ATA_PRD_MAX) return -1;
+        uint32_t boundary = 0x10000 - (uint32_t)(phys & 0xFFFF);
+        uint32_t piece = len < boundary ? len : boundary;
+        prdt[n].phys = (uint32_t)phys;
+        prdt[n].byte_count = (uint16_t)piece; // 0x10000 wraps to 0 = 64 KiB
+        prdt[n].flags = 0;
+        n++;
+        phys += piece;
+        len -= piece;
+    }
+    return n;
+}
+
+static bool ata_map_direct(struct ata_channel *chan, struct request *rq) {
+    if (rq->count > ATA_MAX_SECTORS) return false;
+
+    struct blk_sg_iter it;
+    struct blk_sg sg;
+    int n = 0;
+    blk_sg_iter_init(&it, rq);
+    while (blk_sg_next(&it, &sg)) {
+        n = ata_prd_add(chan->prdt, n, sg.phys, sg.len);
+        if (n < 0) return false;
+    }
+    if (it.error || n == 0) return false;
+    chan->prdt[n - 1].flags = ATA_PRD_EOT;
+    return true;
+}
 
-    for (uint32_t s = 0; s < count; s++) {
-        uint64_t sector = lba + s;
+// Copy count sectors of rq's data, starting skip sectors in, between its
+// bios and the bounce buffer.
+static void ata_rq_copy(struct request *rq, uint32_t skip, uint32_t count,
+                        uint8_t *bounce, bool to_dev) {
+    struct bio *bio;
+    rq_for_each_bio(bio, rq) {
+        if (count == 0) break;
+        if (skip >= bio->count) {
+            skip -= bio->count;
+            continue;
+        }
+        uint32_t n = bio->count - skip;
+        if (n > count) n = count;
+        uint8_t *p = (uint8_t *)bio->buf + (size_t)skip * 512;
+        if (to_dev) memcpy(bounce, p, (size_t)n * 512);
+        else memcpy(p, bounce, (size_t)n * 512);
+        bounce += (size_t)n * 512;
+        count -= n;
+        skip = 0;
+    }
+}
 
-        if (ata_wait_bsy(io) < 0) return -1;
+// Program the bus master and issue the next chunk of chan->active. Called
+// with chan->lock held and the channel owned.
+static void ata_dma_start(struct ata_channel *chan) {
+    struct request *rq = chan->active;
+    struct ata_drive *drive = chan->active_drive;
+    bool write = rq->op == BIO_WRITE;
+    uint32_t count = rq->count - chan->done_sectors;
+
+    if (chan->done_sectors == 0)
+        chan->direct = ata_map_direct(chan, rq);
+    if (!chan->direct) {
+        if (count > ATA_MAX_SECTORS) count = ATA_MAX_SECTORS;
+        uint8_t *virt = (uint8_t *)((uintptr_t)chan->bounce + pmm_get_hhdm_offset());
+        if (write) ata_rq_copy(rq, chan->done_sectors, count, virt, true);
+        int n = ata_prd_add(chan->prdt, 0, (uint64_t)chan->bounce, count * 512);
+        chan->prdt[n - 1].flags = ATA_PRD_EOT;
+        if (chan->done_sectors == 0) chan->bounced++;
+    }
+    chan->xfer_sectors = count;
+
+    uint16_t bm = chan->bmide;
+    outb(bm + ATA_BM_COMMAND, 0);
+    outl(bm + ATA_BM_PRDT, chan->prdt_phys);
+    outb(bm + ATA_BM_STATUS, inb(bm + ATA_BM_STATUS) | ATA_BM_SR_IRQ | ATA_BM_SR_ERR);
+    outb(bm + ATA_BM_COMMAND, write ? 0 : ATA_BM_CMD_READ);
+
+    uint8_t cmd;
+    if (drive->lba48) cmd = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    else cmd = write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+    ata_setup_command(drive, rq->lba + chan->done_sectors, count);
+    outb(drive->io_base + ATA_REG_COMMAND, cmd);
+    outb(bm + ATA_BM_COMMAND, (write ? 0 : ATA_BM_CMD_READ) | ATA_BM_CMD_START);
+    chan->dma_commands++;
+}
 
-        outb(io + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4) | ((sector >> 24) & 0x0F));
-        outb(io + ATA_REG_SECCOUNT, 1);
-        outb(io + ATA_REG_LBA_LO,  (uint8_t)(sector & 0xFF));
-        outb(io + ATA_REG_LBA_MID, (uint8_t)((sector >> 8) & 0xFF));
-        outb(io + ATA_REG_LBA_HI,  (uint8_t)((sector >> 16) & 0xFF));
-        outb(io + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
+// Finish the DMA command in flight if the channel raised its interrupt.
+// Returns false if it did not. Safe from IRQ context and from pollers on
+// other CPUs.
+static bool ata_chan_service(struct ata_channel *chan) {
+    if (!chan->bmide) return false;
+
+    spinlock_acquire(&chan->lock);
+    uint16_t bm = chan->bmide;
+    uint8_t bm_status = inb(bm + ATA_BM_STATUS);
+    if (!(bm_status & ATA_BM_SR_IRQ)) {
+        spinlock_release(&chan->lock);
+        return false;
+    }
 
-        if (ata_wait_drq(io) < 0) return -1;
+    // Stop the engine; reading STATUS acknowledges INTRQ
+    outb(bm + ATA_BM_COMMAND, 0);
+    uint8_t status = inb(chan->io_base + ATA_REG_STATUS);
+    outb(bm + ATA_BM_STATUS, bm_status | ATA_BM_SR_IRQ | ATA_BM_SR_ERR);
 
-        // Write 256 words (512 bytes)
-        outsw(io + ATA_REG_DATA, ptr, 256);
-        ptr += 512;
+    struct request *rq = chan->active;
+    if (!rq) {
+        // A PIO command's interrupt; the PIO loop polls on its own
+        spinlock_release(&chan->lock);
+        return true;
+    }
 
-        // Flush the write cache
-        outb(io + ATA_REG_COMMAND, ATA_CMD_FLUSH);
-        if (ata_wait_bsy(io) < 0) return -1;
+    int err = (bm_status & ATA_BM_SR_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF)) ? -1 : 0;
+    if (!err) {
+        if (!chan->direct && rq->op == BIO_READ) {
+            uint8_t *virt = (uint8_t *)((uintptr_t)chan->bounce + pmm_get_hhdm_offset());
+            ata_rq_copy(rq, chan->done_sectors, chan->xfer_sectors, virt, false);
+        }
+        chan->done_sectors += chan->xfer_sectors;
+        if (chan->done_sectors < rq->count) {
+            ata_dma_start(chan);
+            spinlock_release(&chan->lock);
+            return true;
+        }
     }
 
+    chan->active = NULL;
+    chan->active_drive = NULL;
+    chan->done_sectors = 0;
+    ata_chan_next(chan);
+    spinlock_release(&chan->lock);
+    blk_end_request(rq, err);
+    return true;
+}
+
+static int ata_dma_submit(struct block_device *dev, struct request *rq) {
+    struct ata_drive *drive = (struct ata_drive *)dev->driver_data;
+    struct ata_channel *chan = drive->chan;
+
+    rq->driver_data = NULL;
+    spinlock_acquire(&chan->lock);
+    if (chan->busy) {
+        // The other drive of the channel is at work
+        if (chan->wait_tail) chan->wait_tail->driver_data = rq;
+        else chan->wait_head = rq;
+        chan->wait_tail = rq;
+    } else {
+        chan->busy = true;
+        chan->active = rq;
+        chan->active_drive = drive;
+        chan->done_sectors = 0;
+        ata_dma_start(chan);
+    }
+    spinlock_release(&chan->lock);
     return 0;
 }
 
+static void ata_poll(struct block_device *dev) {
+    struct ata_drive *drive = (struct ata_drive *)dev->driver_data;
+    ata_chan_service(drive->chan);
+}
+
+static void ata_irq_handler(struct registers *regs) {
+    (void)regs;
+    for (int i = 0; i < 2; i++) {
+        struct ata_channel *chan = &ata_channels[i];
+        if (!chan->bmide) {
+            // No bus master to ask: just acknowledge INTRQ
+            if (chan->io_base) inb(chan->io_base + ATA_REG_STATUS);
+            continue;
+        }
+        if (ata_chan_service(chan)) chan->interrupts++;
+    }
+}
+
 // ── Initialization ──────────────────────────────────────────────────────────
 
-static void ata_probe_channel(uint16_t io_base, uint16_t ctrl_base, int drive_index_start) {
+// Legacy ports and IRQs unless the IDE controller runs a channel in native
+// PCI mode; bus-master registers if it has them.
+static void ata_setup_channels(struct pci_device *pci) {
+    static const uint16_t io[2]   = { ATA_PRIMARY_IO, ATA_SECONDARY_IO };
+    static const uint16_t ctrl[2] = { ATA_PRIMARY_CTRL, ATA_SECONDARY_CTRL };
+
+    for (int i = 0; i < 2; i++) {
+        struct ata_channel *chan = &ata_channels[i];
+        memset(chan, 0, sizeof(struct ata_channel));
+        spinlock_init(&chan->lock);
+        chan->io_base   = io[i];
+        chan->ctrl_base = ctrl[i];
+        chan->irq       = 14 + i;
+        if (pci && (pci->prog_if & (1 << (2 * i)))) {
+            chan->io_base   = pci->bar[2 * i] & 0xFFFC;
+            chan->ctrl_base = (pci->bar[2 * i + 1] & 0xFFFC) + 2;
+            chan->irq       = pci->irq_line;
+            chan->native    = true;
+        }
+    }
+
+    if (!pci || !(pci->prog_if & 0x80) || !(pci->bar[4] & 1)) return;
+    uint16_t bmide = pci->bar[4] & 0xFFFC;
+    pci_enable_bus_mastering(pci);
+
+    for (int i = 0; i < 2; i++) {
+        struct ata_channel *chan = &ata_channels[i];
+        // A simplex controller runs DMA on one channel only
+        if (i == 1 && (inb(bmide + ATA_BM_STATUS) & ATA_BM_SR_SIMPLEX)) break;
+
+        void *prdt = pmm_alloc_pages_constrained(1, 0xFFFFFFFF);
+        void *bounce = pmm_alloc_pages_constrained(ATA_MAX_SECTORS * 512 / 4096, 0xFFFFFFFF);
+        if (!prdt || !bounce) {
+            if (prdt) pmm_free_page(prdt);
+            if (bounce) pmm_free_pages(bounce, ATA_MAX_SECTORS * 512 / 4096);
+            continue;
+        }
+        chan->prdt = (struct ata_prd *)((uintptr_t)prdt + pmm_get_hhdm_offset());
+        chan->prdt_phys = (uint32_t)(uintptr_t)prdt;
+        chan->bounce = bounce;
+        chan->bmide = bmide + 8 * i;
+    }
+}
+
+static void ata_probe_channel(struct ata_channel *chan, int drive_index_start) {
+    bool any_dma = false;
     for (int slave = 0; slave <= 1; slave++) {
         struct ata_drive *drive = &ata_drives[drive_index_start + slave];
-        drive->io_base   = io_base;
-        drive->ctrl_base = ctrl_base;
+        drive->io_base   = chan->io_base;
+        drive->ctrl_base = chan->ctrl_base;
         drive->slave     = (uint8_t)slave;
         drive->present   = false;
+        drive->chan      = chan;
 
         if (ata_identify(drive)) {
             uint64_t size_mb = (drive->total_sectors * 512) / (1024 * 1024);
+            drive->dma = drive->dma && chan->bmide;
 
             console_puts("     ata");
             console_putchar('0' + ata_drive_count);
@@ -213,7 +588,8 @@ static void ata_probe_channel(uint16_t io_base, uint16_t ctrl_base, int drive_in
             print_uint64(size_mb);
             console_puts(" MB, ");
             print_uint64(drive->total_sectors);
-            console_puts(" sectors)\n");
+            console_puts(drive->lba48 ? " sectors, LBA48, " : " sectors, LBA28, ");
+            console_puts(drive->dma ? "DMA)\n" : "PIO)\n");
 
             // Set up block device
             struct block_device *blk = &drive->blkdev;
@@ -224,23 +600,48 @@ static void ata_probe_channel(uint16_t io_base, uint16_t ctrl_base, int drive_in
             blk->total_sectors = drive->total_sectors;
             blk->read_sectors  = ata_pio_read;
             blk->write_sectors = ata_pio_write;
+            blk->flush         = ata_flush;
             blk->driver_data   = drive;
+            blk->max_sectors   = ATA_MAX_SECTORS;
+            if (drive->dma) {
+                // One command per channel at a time, completed by IRQ
+                blk->submit       = ata_dma_submit;
+                blk->poll         = ata_poll;
+                blk->queue_depth  = 1;
+                blk->max_segments = ATA_PRD_MAX;
+                outb(chan->bmide + ATA_BM_STATUS,
+                     inb(chan->bmide + ATA_BM_STATUS) |
+                     (slave ? ATA_BM_SR_DRV1_DMA : ATA_BM_SR_DRV0_DMA));
+                any_dma = true;
+            }
 
             block_register(blk);
             ata_drive_count++;
         }
     }
+
+    // INTRQ only matters when a DMA completion waits for it
+    outb(chan->ctrl_base, any_dma ? 0 : ATA_CTRL_NIEN);
+    if (!any_dma) {
+        chan->bmide = 0;
+        return;
+    }
+    struct ata_channel *other = (chan == &ata_channels[0]) ? &ata_channels[1] : &ata_channels[0];
+    bool shared = other->bmide && other->irq == chan->irq && other < chan;
+    if (!shared) irq_install_handler(chan->irq, ata_irq_handler, chan->native ? 0x000F : 0);
 }
 
 int ata_init(void) {
     ata_drive_count = 0;
     console_puts("[INFO] Probing ATA drives...\n");
 
+    ata_setup_channels(pci_find_device(0x01, 0x01));
+
     // Probe primary channel (master + slave)
-    ata_probe_channel(ATA_PRIMARY_IO, ATA_PRIMARY_CTRL, 0);
+    ata_probe_channel(&ata_channels[0], 0);
 
     // Probe secondary channel (master + slave)
-    ata_probe_channel(ATA_SECONDARY_IO, ATA_SECONDARY_CTRL, 2);
+    ata_probe_channel(&ata_channels[1], 2);
 
     if (ata_drive_count == 0) {
         console_puts("[WARN] No ATA drives detected.\n");
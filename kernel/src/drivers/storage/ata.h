@@ -35,11 +35,51 @@
 #define ATA_SR_IDX   0x02   // Index
 #define ATA_SR_ERR   0x01   // Error
 
+// Device control register bits
+#define ATA_CTRL_NIEN 0x02  // Mask INTRQ
+
 // ATA Commands
 #define ATA_CMD_READ_PIO       0x20
+#define ATA_CMD_READ_PIO_EXT   0x24
+#define ATA_CMD_READ_DMA_EXT   0x25
 #define ATA_CMD_WRITE_PIO      0x30
+#define ATA_CMD_WRITE_PIO_EXT  0x34
+#define ATA_CMD_WRITE_DMA_EXT  0x35
+#define ATA_CMD_READ_DMA       0xC8
+#define ATA_CMD_WRITE_DMA      0xCA
 #define ATA_CMD_IDENTIFY       0xEC
 #define ATA_CMD_FLUSH          0xE7
+#define ATA_CMD_FLUSH_EXT      0xEA
+
+// ── PCI Bus-Master IDE (SFF-8038i) ──────────────────────────────────────────
+// BAR4 of the IDE controller: 8 ports per channel (secondary at +8).
+
+#define ATA_BM_COMMAND 0x00
+#define ATA_BM_STATUS  0x02
+#define ATA_BM_PRDT    0x04
+
+#define ATA_BM_CMD_START 0x01
+#define ATA_BM_CMD_READ  0x08   // Bus master writes to memory (device read)
+
+#define ATA_BM_SR_ACTIVE  0x01
+#define ATA_BM_SR_ERR     0x02
+#define ATA_BM_SR_IRQ     0x04
+#define ATA_BM_SR_DRV0_DMA 0x20
+#define ATA_BM_SR_DRV1_DMA 0x40
+#define ATA_BM_SR_SIMPLEX 0x80
+
+// Physical Region Descriptor: a buffer below 4 GiB that does not cross a
+// 64 KiB boundary. byte_count 0 means 64 KiB.
+struct ata_prd {
+    uint32_t phys;
+    uint16_t byte_count;
+    uint16_t flags;             // Bit 15: last entry of the table
+} __attribute__((packed));
+
+#define ATA_PRD_EOT 0x8000
+
+#define ATA_MAX_SECTORS 256     // Per command, PIO and DMA
+#define ATA_PRD_MAX 64          // Entries per table (direct requests)
 
 // Initialize ATA subsystem: detect drives and register them as block devices
 int ata_init(void);
@@ -0,0 +1,468 @@
+#include "drivers/storage/block.h"
+#include "apic/lapic_timer.h"
+#include "console/klog.h"
+#include "lib/string.h"
+#include "lock/spinlock.h"
+#include "mm/heap.h"
+#include "mm/vmm.h"
+#include "sched/sched.h"
+#include "sched/wait.h"
+#include <stddef.h>
+
+// ── Request queue ────────────────────────────────────────────────────────────
+// Bios are merged into requests while they wait; whoever finds the queue
+// idle dispatches (the submitter, or the completion path of the previous
+// request). Drivers with a submit op complete requests from their IRQ
+// handler and may hold up to queue_depth of them. Drivers without one are
+// called synchronously from the dispatching thread, one request at a time.
+//
+// There is no ordering between overlapping bios that are in the queue at the
+// same time; callers that care wait for the first one.
+
+struct request_queue {
+    spinlock_t lock;
+    struct block_device *dev;
+    uint32_t sector_size;
+    uint32_t depth;
+    uint32_t max_sectors;
+    uint32_t max_segments;
+    // The driver's own synchronous entry points
+    int (*read)(struct block_device *dev, uint64_t lba, uint32_t count, void *buf);
+    int (*write)(struct block_device *dev, uint64_t lba, uint32_t count, const void *buf);
+    struct list_head sorted;    // Waiting requests by LBA
+    struct list_head fifo;      // Waiting requests by arrival
+    uint64_t head_lba;          // End of the last dispatched request
+    bool running;               // Someone is dispatching
+    uint64_t busy_since_ms;
+    struct blk_stats stats;
+};
+
+void bio_init(struct bio *bio, struct block_device *dev, int op, uint64_t lba,
+              uint32_t count, void *buf) {
+    bio->dev = dev;
+    bio->op = op;
+    bio->lba = lba;
+    bio->count = count;
+    bio->buf = buf;
+    bio->status = 0;
+    bio->end_io = NULL;
+    bio->private = NULL;
+    bio->next = NULL;
+}
+
+static void bio_endio(struct bio *bio, int status) {
+    bio->status = status;
+    if (bio->end_io) bio->end_io(bio); // May free bio
+}
+
+// Does b's buffer start where a's ends?
+static bool bio_buf_follows(struct request_queue *q, struct bio *a, struct bio *b) {
+    return (uint8_t *)a->buf + (size_t)a->count * q->sector_size == (uint8_t *)b->buf;
+}
+
+// ── Elevator ─────────────────────────────────────────────────────────────────
+
+static void blk_sort_insert(struct request_queue *q, struct request *rq) {
+    struct list_head *pos;
+    list_for_each(pos, &q->sorted) {
+        struct request *r = list_entry(pos, struct request, sort);
+        if (r->lba > rq->lba) break;
+    }
+    list_add_tail(&rq->sort, pos); // Before the first request above rq
+}
+
+// Append or prepend bio to a waiting request it is adjacent to.
+static bool blk_try_merge(struct request_queue *q, struct bio *bio) {
+    struct list_head *pos;
+    list_for_each(pos, &q->sorted) {
+        struct request *rq = list_entry(pos, struct request, sort);
+        if (rq->op != bio->op || rq->count + bio->count > q->max_sectors) continue;
+
+        if (rq->lba + rq->count == bio->lba) {
+            uint32_t segs = rq->nr_segments + !bio_buf_follows(q, rq->biotail, bio);
+            if (segs > q->max_segments) continue;
+            rq->biotail->next = bio;
+            rq->biotail = bio;
+            rq->count += bio->count;
+            rq->nr_segments = segs;
+            return true;
+        }
+
+        if (bio->lba + bio->count == rq->lba) {
+            uint32_t segs = rq->nr_segments + !bio_buf_follows(q, bio, rq->bio);
+            if (segs > q->max_segments) continue;
+            bio->next = rq->bio;
+            rq->bio = bio;
+            rq->lba = bio->lba;
+            rq->count += bio->count;
+            rq->nr_segments = segs;
+            list_del(&rq->sort);
+            blk_sort_insert(q, rq);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Oldest request if its deadline passed, otherwise the next one in the
+// current upward sweep (wrapping to the lowest LBA).
+static struct request *blk_next_request(struct request_queue *q) {
+    if (list_empty(&q->fifo)) return NULL;
+
+    struct request *rq = list_first_entry(&q->fifo, struct request, fifo);
+    if (lapic_timer_get_ms() >= rq->deadline_ms) {
+        q->stats.expired++;
+    } else {
+        rq = NULL;
+        struct list_head *pos;
+        list_for_each(pos, &q->sorted) {
+            struct request *r = list_entry(pos, struct request, sort);
+            if (r->lba >= q->head_lba) {
+                rq = r;
+                break;
+            }
+        }
+        if (!rq) rq = list_first_entry(&q->sorted, struct request, sort);
+    }
+
+    list_del(&rq->sort);
+    list_del(&rq->fifo);
+    q->head_lba = rq->lba + rq->count;
+    q->stats.queued--;
+    return rq;
+}
+
+static void blk_queue_bio(struct request_queue *q, struct bio *bio) {
+    // Allocated up front: the heap must not be entered under q->lock
+    struct request *rq = kmalloc(sizeof(struct request));
+
+    spinlock_acquire(&q->lock);
+    if (blk_try_merge(q, bio)) {
+        if (bio->op == BIO_WRITE) q->stats.write_merges++;
+        else q->stats.read_merges++;
+        spinlock_release(&q->lock);
+        kfree(rq);
+        return;
+    }
+    if (!rq) {
+        q->stats.errors++;
+        spinlock_release(&q->lock);
+        bio_endio(bio, -1);
+        return;
+    }
+
+    rq->q = q;
+    rq->dev = q->dev;
+    rq->op = bio->op;
+    rq->lba = bio->lba;
+    rq->count = bio->count;
+    rq->nr_segments = 1;
+    rq->bio = bio;
+    rq->biotail = bio;
+    rq->deadline_ms = lapic_timer_get_ms() +
+        (bio->op == BIO_WRITE ? BLOCK_WRITE_EXPIRE_MS : BLOCK_READ_EXPIRE_MS);
+    rq->driver_data = NULL;
+    list_add_tail(&rq->fifo, &q->fifo);
+    blk_sort_insert(q, rq);
+    q->stats.queued++;
+    spinlock_release(&q->lock);
+}
+
+// ── Dispatch ─────────────────────────────────────────────────────────────────
+
+static void blk_dispatch(struct request_queue *q, struct request *rq) {
+    struct block_device *dev = q->dev;
+    if (dev->submit) {
+        if (dev->submit(dev, rq) != 0) blk_end_request(rq, -1);
+        return;
+    }
+
+    // One driver call per run of bios with contiguous buffers
+    int status = 0;
+    struct bio *bio = rq->bio;
+    while (bio && status == 0) {
+        uint32_t count = bio->count;
+        struct bio *last = bio;
+        while (last->next && bio_buf_follows(q, last, last->next)) {
+            last = last->next;
+            count += last->count;
+        }
+        if (rq->op == BIO_WRITE)
+            status = q->write ? q->write(dev, bio->lba, count, bio->buf) : -1;
+        else
+            status = q->read(dev, bio->lba, count, bio->buf);
+        bio = last->next;
+    }
+    blk_end_request(rq, status);
+}
+
+static void blk_run_queue(struct request_queue *q) {
+    spinlock_acquire(&q->lock);
+    if (q->running) {
+        // The dispatcher re-checks the queue after each request
+        spinlock_release(&q->lock);
+        return;
+    }
+    q->running = true;
+    while (q->stats.in_flight < q->depth) {
+        struct request *rq = blk_next_request(q);
+        if (!rq) break;
+        if (q->stats.in_flight++ == 0) q->busy_since_ms = lapic_timer_get_ms();
+        q->stats.requests++;
+        spinlock_release(&q->lock);
+        blk_dispatch(q, rq);
+        spinlock_acquire(&q->lock);
+    }
+    q->running = false;
+    spinlock_release(&q->lock);
+}
+
+void blk_end_request(struct request *rq, int status) {
+    struct request_queue *q = rq->q;
+    if (status) status = -1;
+
+    spinlock_acquire(&q->lock);
+    if (--q->stats.in_flight == 0)
+        q->stats.busy_ms += lapic_timer_get_ms() - q->busy_since_ms;
+    struct bio *bio;
+    rq_for_each_bio(bio, rq) {
+        if (rq->op == BIO_WRITE) {
+            q->stats.writes++;
+            q->stats.write_sectors += bio->count;
+        } else {
+            q->stats.reads++;
+            q->stats.read_sectors += bio->count;
+        }
+    }
+    if (status) q->stats.errors++;
+    spinlock_release(&q->lock);
+
+    bio = rq->bio;
+    while (bio) {
+        struct bio *next = bio->next;
+        bio->next = NULL;
+        bio_endio(bio, status);
+        bio = next;
+    }
+    kfree(rq);
+
+    blk_run_queue(q);
+}
+
+// ── Submission ───────────────────────────────────────────────────────────────
+
+static void blk_flush_plug(struct blk_plug *plug) {
+    struct request_queue *touched[BLOCK_MAX_DEVICES];
+    uint32_t nr_touched = 0;
+
+    struct bio *bio = plug->head;
+    plug->head = NULL;
+    plug->count = 0;
+    while (bio) {
+        struct bio *next = bio->next;
+        bio->next = NULL;
+        struct request_queue *q = bio->dev->queue;
+        blk_queue_bio(q, bio);
+
+        uint32_t i = 0;
+        while (i < nr_touched && touched[i] != q) i++;
+        if (i == nr_touched && nr_touched < BLOCK_MAX_DEVICES) touched[nr_touched++] = q;
+        bio = next;
+    }
+
+    for (uint32_t i = 0; i < nr_touched; i++)
+        blk_run_queue(touched[i]);
+}
+
+void submit_bio(struct bio *bio) {
+    bio->status = 0;
+    bio->next = NULL;
+    bio->dev = block_remap(bio->dev, &bio->lba);
+
+    struct request_queue *q = bio->dev->queue;
+    if (!q) {
+        // Not registered (yet): straight to the driver
+        struct block_device *dev = bio->dev;
+        int err = -1;
+        if (bio->op == BIO_WRITE && dev->write_sectors)
+            err = dev->write_sectors(dev, bio->lba, bio->count, bio->buf);
+        else if (bio->op == BIO_READ && dev->read_sectors)
+            err = dev->read_sectors(dev, bio->lba, bio->count, bio->buf);
+        bio_endio(bio, err ? -1 : 0);
+        return;
+    }
+
+    struct thread *t = sched_get_current();
+    struct blk_plug *plug = t ? t->plug : NULL;
+    if (plug) {
+        // Keep the plug sorted by (queue, LBA); it is short
+        struct bio **link = &plug->head;
+        while (*link && ((*link)->dev->queue < q ||
+                         ((*link)->dev->queue == q && (*link)->lba <= bio->lba)))
+            link = &(*link)->next;
+        bio->next = *link;
+        *link = bio;
+        if (++plug->count >= BLOCK_PLUG_MAX) blk_flush_plug(plug);
+        return;
+    }
+
+    blk_queue_bio(q, bio);
+    blk_run_queue(q);
+}
+
+static void bio_wake(struct bio *bio) {
+    complete((completion_t *)bio->private);
+}
+
+static bool blk_irqs_enabled(void) {
+    uint64_t rflags;
+    __asm__ volatile("pushfq; pop %0" : "=r"(rflags));
+    return rflags & 0x200;
+}
+
+int submit_bio_wait(struct bio *bio) {
+    completion_t done;
+    completion_init(&done);
+    bio->end_io = bio_wake;
+    bio->private = &done;
+    submit_bio(bio);
+
+    // Sleeping on a bio that is still held back would never end
+    struct thread *t = sched_get_current();
+    if (t && t->plug) blk_flush_plug(t->plug);
+
+    // With interrupts off no completion IRQ can reach us: reap by hand
+    struct block_device *dev = bio->dev;
+    if (!blk_irqs_enabled() && dev->poll) {
+        while (!__atomic_load_n(&done.done, __ATOMIC_ACQUIRE)) {
+            dev->poll(dev);
+            __asm__ volatile("pause");
+        }
+    }
+
+    wait_for_completion(&done);
+    return bio->status;
+}
+
+void blk_start_plug(struct blk_plug *plug) {
+    plug->head = NULL;
+    plug->count = 0;
+    struct thread *t = sched_get_current();
+    if (t && !t->plug) t->plug = plug;
+}
+
+void blk_finish_plug(struct blk_plug *plug) {
+    struct thread *t = sched_get_current();
+    if (t && t->plug == plug) t->plug = NULL;
+    blk_flush_plug(plug);
+}
+
+// ── Scatter-gather ───────────────────────────────────────────────────────────
+
+void blk_sg_iter_init(struct blk_sg_iter *it, struct request *rq) {
+    it->bio = rq->bio;
+    it->offset = 0;
+    it->sector_size = rq->q->sector_size;
+    it->error = false;
+}
+
+bool blk_sg_next(struct blk_sg_iter *it, struct blk_sg *sg) {
+    // Bio buffers are kernel addresses, mapped the same in every page table
+    uint64_t *pml4 = vmm_get_active_pml4();
+    sg->len = 0;
+    while (it->bio) {
+        uint32_t bio_bytes = it->bio->count * it->sector_size;
+        if (it->offset == bio_bytes) {
+            it->bio = it->bio->next;
+            it->offset = 0;
+            continue;
+        }
+
+        uint64_t va = (uint64_t)it->bio->buf + it->offset;
+        uint32_t chunk = 4096 - (va & 0xFFF);
+        if (chunk > bio_bytes - it->offset) chunk = bio_bytes - it->offset;
+        uint64_t phys = vmm_virt_to_phys(pml4, va);
+        if (!phys) {
+            it->error = true;
+            return false;
+        }
+        if (sg->len == 0) {
+            sg->phys = phys;
+        } else if (phys != sg->phys + sg->len || sg->len + chunk > BLOCK_SG_MAX_LEN) {
+            break;
+        }
+        sg->len += chunk;
+        it->offset += chunk;
+    }
+    return sg->len > 0;
+}
+
+int blk_rq_map_sg(struct request *rq, struct blk_sg *sg, int max) {
+    struct blk_sg_iter it;
+    blk_sg_iter_init(&it, rq);
+    int n = 0;
+    struct blk_sg seg;
+    while (blk_sg_next(&it, &seg)) {
+        if (n == max) return -1;
+        sg[n++] = seg;
+    }
+    return it.error ? -1 : n;
+}
+
+// ── Synchronous wrappers ─────────────────────────────────────────────────────
+
+static int blk_sync_io(struct block_device *dev, int op, uint64_t lba,
+                       uint32_t count, void *buf) {
+    if (count == 0) return 0;
+    struct bio bio;
+    bio_init(&bio, dev, op, lba, count, buf);
+    return submit_bio_wait(&bio);
+}
+
+static int blk_read_sectors(struct block_device *dev, uint64_t lba, uint32_t count, void *buf) {
+    return blk_sync_io(dev, BIO_READ, lba, count, buf);
+}
+
+static int blk_write_sectors(struct block_device *dev, uint64_t lba, uint32_t count, const void *buf) {
+    return blk_sync_io(dev, BIO_WRITE, lba, count, (void *)buf);
+}
+
+int blk_queue_attach(struct block_device *dev) {
+    if (dev->queue) return 0;
+    if (!dev->read_sectors && !dev->submit) return -1;
+
+    struct request_queue *q = kmalloc(sizeof(struct request_queue));
+    if (!q) {
+        klog_puts("[BLOCK] No memory for the request queue of ");
+        klog_puts(dev->name);
+        klog_puts(", using the driver directly\n");
+        return -1;
+    }
+    memset(q, 0, sizeof(struct request_queue));
+    spinlock_init(&q->lock);
+    q->dev = dev;
+    q->sector_size = dev->sector_size ? dev->sector_size : BLOCK_SECTOR_SIZE;
+    q->depth = dev->submit && dev->queue_depth ? dev->queue_depth : 1;
+    q->max_sectors = dev->max_sectors ? dev->max_sectors : BLOCK_DEFAULT_MAX_SECTORS;
+    q->max_segments = dev->max_segments ? dev->max_segments : 1;
+    q->read = dev->read_sectors;
+    q->write = dev->write_sectors;
+    INIT_LIST_HEAD(&q->sorted);
+    INIT_LIST_HEAD(&q->fifo);
+
+    dev->queue = q;
+    dev->read_sectors = blk_read_sectors;
+    if (dev->write_sectors || dev->submit) dev->write_sectors = blk_write_sectors;
+    return 0;
+}
+
+bool blk_get_stats(struct block_device *dev, struct blk_stats *out) {
+    struct request_queue *q = dev->queue;
+    if (!q) return false;
+    spinlock_acquire(&q->lock);
+    memcpy(out, &q->stats, sizeof(struct blk_stats));
+    if (q->stats.in_flight)
+        out->busy_ms += lapic_timer_get_ms() - q->busy_since_ms;
+    spinlock_release(&q->lock);
+    return true;
+}
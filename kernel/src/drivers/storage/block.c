@@ -9,19 +9,36 @@ static int num_devices = 0;
 #include "mm/heap.h"
 #include "lib/string.h"
 
-static uint32_t block_vfs_read(struct vfs_node *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
+#define BLOCK_VFS_BOUNCE_SIZE (64 * 1024)
+
+static uint32_t block_vfs_read(struct vfs_node *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
     struct block_device *dev = (struct block_device *)node->device;
     if (!dev || !dev->read_sectors) return 0;
     
     uint32_t sector_size = dev->sector_size ? dev->sector_size : 512;
-    uint32_t sector = offset / sector_size;
+    uint64_t sector = offset / sector_size;
     uint32_t count = size / sector_size;
     
     if (size % sector_size != 0) return 0; // Enforce sector aligned logical reads for now
-    
-    int err = dev->read_sectors(dev, sector, count, buffer);
-    if (err) return 0;
-    return size;
+
+    // buffer may be a user address; the request can complete in an IRQ under
+    // another address space, so bounce through the kernel heap.
+    uint32_t chunk_sectors = BLOCK_VFS_BOUNCE_SIZE / sector_size;
+    if (chunk_sectors == 0) chunk_sectors = 1;
+    if (chunk_sectors > count) chunk_sectors = count;
+    uint8_t *bounce = kmalloc((size_t)chunk_sectors * sector_size);
+    if (!bounce) return 0;
+
+    uint32_t done = 0;
+    while (done < count) {
+        uint32_t n = count - done;
+        if (n > chunk_sectors) n = chunk_sectors;
+        if (dev->read_sectors(dev, sector + done, n, bounce) != 0) break;
+        memcpy(buffer + (size_t)done * sector_size, bounce, (size_t)n * sector_size);
+        done += n;
+    }
+    kfree(bounce);
+    return done * sector_size;
 }
 
 // ── Partition Wrapper ────────────────────────────────────────────────────────
@@ -42,6 +59,22 @@ static int partition_write(struct block_device *dev, uint64_t lba, uint32_t coun
     return wrap->parent->write_sectors(wrap->parent, lba + wrap->start_lba, count, buf);
 }
 
+struct block_device *block_remap(struct block_device *dev, uint64_t *lba) {
+    while (dev->read_sectors == partition_read) {
+        struct partition_wrapper *wrap = (struct partition_wrapper *)dev->driver_data;
+        *lba += wrap->start_lba;
+        dev = wrap->parent;
+    }
+    return dev;
+}
+
+int block_flush(struct block_device *dev) {
+    uint64_t lba = 0;
+    dev = block_remap(dev, &lba);
+    if (!dev->flush) return 0;
+    return dev->flush(dev);
+}
+
 // ── MBR Structures ───────────────────────────────────────────────────────────
 
 struct mbr_partition {
@@ -114,6 +147,11 @@ void block_scan_partitions(struct block_device *dev) {
 int block_register(struct block_device *dev) {
     if (num_devices >= BLOCK_MAX_DEVICES) return -1;
     registered[num_devices++] = dev;
+
+    // Partitions share the queue of their disk
+    if (dev->read_sectors != partition_read) {
+        blk_queue_attach(dev);
+    }
     
     // Register to VFS if root exists
     if (fs_root) {
@@ -171,7 +209,7 @@ void block_repopulate_devices(void) {
         
         // Use vfs_create if available (ext2), otherwise ramfs_mount_node
         if (dev_dir->create) {
-            dev_dir->create(dev_dir, dev->name, 0600);
+            vfs_create(dev_dir, dev->name, 0600);
             vfs_node_t *new_node = vfs_finddir(dev_dir, dev->name);
             if (new_node) {
                 new_node->flags = FS_BLOCKDEV;
@@ -185,3 +223,521 @@ void block_repopulate_devices(void) {
         }
     }
 }
+
+// ── Buffer cache ─────────────────────────────────────────────────────────────
+
+#include "apic/lapic_timer.h"
+#include "console/klog.h"
+#include "lock/spinlock.h"
+#include "mm/pmm.h"
+#include "sched/sched.h"
+#include "sched/wait.h"
+
+#define BCACHE_HASH_BUCKETS 512
+#define BCACHE_FLUSH_BATCH 32   // Dirty buffers written per pass
+#define BCACHE_RECLAIM_WRITES 16 // Dirty buffers reclaim may write per call
+
+static spinlock_t bcache_lock = SPINLOCK_INIT;
+static struct buffer_head *bcache_hash[BCACHE_HASH_BUCKETS];
+static struct list_head bcache_lru = {&bcache_lru, &bcache_lru};
+static uint64_t bcache_max_bytes = 0;
+static struct block_cache_stats bstats;
+static wait_queue_t bcache_fill_wait = {SPINLOCK_INIT, NULL};
+
+static uint32_t bcache_bucket(struct block_device *dev, uint64_t block) {
+    uint64_t k = (uint64_t)dev ^ (block * 0x9E3779B97F4A7C15ULL);
+    return (uint32_t)((k >> 32) ^ k) & (BCACHE_HASH_BUCKETS - 1);
+}
+
+static struct buffer_head *bcache_find(struct block_device *dev, uint64_t block,
+                                       uint32_t size) {
+    struct buffer_head *bh = bcache_hash[bcache_bucket(dev, block)];
+    while (bh && (bh->dev != dev || bh->block != block || bh->size != size))
+        bh = bh->hash_next;
+    return bh;
+}
+
+static void bcache_unhash(struct buffer_head *bh) {
+    struct buffer_head **pp = &bcache_hash[bcache_bucket(bh->dev, bh->block)];
+    while (*pp && *pp != bh)
+        pp = &(*pp)->hash_next;
+    if (*pp)
+        *pp = bh->hash_next;
+    bh->hashed = false;
+    list_del(&bh->lru);
+    bstats.buffers--;
+    bstats.bytes -= bh->size;
+    if (bh->dirty) {
+        bh->dirty = false;
+        bstats.dirty--;
+    }
+}
+
+static void bcache_free(struct buffer_head *bh) {
+    kfree(bh->data);
+    kfree(bh);
+}
+
+static int bcache_io(struct buffer_head *bh, bool write) {
+    struct block_device *dev = bh->dev;
+    uint32_t ss = dev->sector_size ? dev->sector_size : BLOCK_SECTOR_SIZE;
+    uint32_t count = bh->size / ss;
+    uint64_t lba = bh->block * count;
+    if (write) {
+        if (!dev->write_sectors) return -1;
+        return dev->write_sectors(dev, lba, count, bh->data);
+    }
+    return dev->read_sectors(dev, lba, count, bh->data);
+}
+
+// Claim a dirty buffer for writing. Returns false if it is clean.
+static bool bcache_writeback_begin(struct buffer_head *bh) {
+    spinlock_acquire(&bcache_lock);
+    if (!bh->dirty) {
+        spinlock_release(&bcache_lock);
+        return false;
+    }
+    bh->dirty = false;
+    bh->writing++;
+    bstats.dirty--;
+    spinlock_release(&bcache_lock);
+    return true;
+}
+
+static void bcache_writeback_end(struct buffer_head *bh, int err) {
+    spinlock_acquire(&bcache_lock);
+    bh->writing--;
+    if (err) {
+        if (!bh->dirty && bh->hashed) {
+            bh->dirty = true;
+            bstats.dirty++;
+        }
+    } else {
+        bstats.writebacks++;
+    }
+    spinlock_release(&bcache_lock);
+}
+
+// Write one buffer the caller holds a reference to. The dirty bit is
+// cleared before the I/O so that a concurrent modification re-dirties it.
+static int bcache_writeback(struct buffer_head *bh) {
+    if (!bcache_writeback_begin(bh)) return 0;
+    int err = bcache_io(bh, true);
+    bcache_writeback_end(bh, err);
+    return err;
+}
+
+// Shrink the cache below its limit, oldest buffers first. Clean buffers are
+// simply dropped; dirty ones are written first.
+static void bcache_reclaim(void) {
+    if (bcache_max_bytes == 0) {
+        bcache_max_bytes = pmm_get_usable_memory() / 16;
+        if (bcache_max_bytes < 1024 * 1024)
+            bcache_max_bytes = 1024 * 1024;
+    }
+
+    int writes = 0;
+    spinlock_acquire(&bcache_lock);
+    struct list_head *pos = bcache_lru.prev;
+    while (bstats.bytes > bcache_max_bytes && pos != &bcache_lru) {
+        struct buffer_head *bh = list_entry(pos, struct buffer_head, lru);
+        pos = pos->prev;
+        if (bh->refcount > 0)
+            continue;
+
+        if (bh->dirty) {
+            if (writes++ >= BCACHE_RECLAIM_WRITES)
+                break;
+            bh->refcount++;
+            spinlock_release(&bcache_lock);
+            int err = bcache_writeback(bh);
+            spinlock_acquire(&bcache_lock);
+            bh->refcount--;
+            if (err || bh->dirty || bh->refcount > 0 || !bh->hashed) {
+                if (bh->hashed) {
+                    list_del(&bh->lru);
+                    list_add(&bh->lru, &bcache_lru);
+                } else if (bh->refcount == 0) {
+                    bcache_free(bh);
+                }
+                // The list may have changed while unlocked: restart from
+                // the tail, now that bh is off it or at its head
+                pos = bcache_lru.prev;
+                continue;
+            }
+            bcache_unhash(bh);
+            bcache_free(bh);
+            bstats.evictions++;
+            pos = bcache_lru.prev;
+            continue;
+        }
+
+        bcache_unhash(bh);
+        bcache_free(bh);
+        bstats.evictions++;
+    }
+    spinlock_release(&bcache_lock);
+}
+
+// Sleep once on bcache_fill_wait, which is woken when a fill ends or a
+// getblk() buffer gets its contents. Called and returns with bcache_lock
+// held; callers recheck what they were waiting for.
+static void bcache_sleep(struct buffer_head *bh) {
+    struct thread *self = sched_get_current();
+    bh->waiters++;
+    if (!self || self->is_idle) {
+        spinlock_release(&bcache_lock);
+        __asm__ volatile("pause");
+        spinlock_acquire(&bcache_lock);
+    } else {
+        // BLOCKED is published under bcache_lock, which the filler needs to
+        // mark the buffer: its wakeup cannot be missed.
+        wait_queue_entry_t entry = {.thread = self, .next = NULL};
+        wait_queue_add(&bcache_fill_wait, &entry);
+        self->state = THREAD_BLOCKED;
+        spinlock_release(&bcache_lock);
+        sched_yield();
+        wait_queue_remove(&bcache_fill_wait, &entry);
+        spinlock_acquire(&bcache_lock);
+    }
+    bh->waiters--;
+}
+
+// A new buffer is hashed before its data is read, so that concurrent
+// bread()s of the block find it and wait for the one fill instead of
+// reading the block again.
+static struct buffer_head *bcache_get(struct block_device *dev, uint64_t block,
+                                      uint32_t size, bool read) {
+    if (!dev || !dev->read_sectors || size == 0)
+        return NULL;
+
+    struct buffer_head *nb = NULL;
+    spinlock_acquire(&bcache_lock);
+    struct buffer_head *bh = bcache_find(dev, block, size);
+    if (bh) {
+        bh->refcount++;
+        list_del(&bh->lru);
+        list_add(&bh->lru, &bcache_lru);
+        bstats.hits++;
+    } else {
+        bstats.misses++;
+        spinlock_release(&bcache_lock);
+
+        bcache_reclaim();
+
+        nb = kmalloc(sizeof(struct buffer_head));
+        if (!nb)
+            return NULL;
+        memset(nb, 0, sizeof(struct buffer_head));
+        nb->data = kmalloc(size);
+        if (!nb->data) {
+            kfree(nb);
+            return NULL;
+        }
+        memset(nb->data, 0, size);
+        nb->dev = dev;
+        nb->block = block;
+        nb->size = size;
+        nb->refcount = 1;
+
+        spinlock_acquire(&bcache_lock);
+        bh = bcache_find(dev, block, size);
+        if (bh) {
+            // Someone else cached it meanwhile; theirs may be newer.
+            bh->refcount++;
+        } else {
+            uint32_t b = bcache_bucket(dev, block);
+            nb->hash_next = bcache_hash[b];
+            bcache_hash[b] = nb;
+            nb->hashed = true;
+            list_add(&nb->lru, &bcache_lru);
+            bstats.buffers++;
+            bstats.bytes += size;
+            bh = nb;
+            nb = NULL;
+        }
+    }
+
+    if (!read) {
+        // The caller overwrites the whole buffer; a fill finishing after
+        // that would clobber it.
+        while (bh->filling)
+            bcache_sleep(bh);
+        if (!bh->uptodate)
+            bh->fresh = true;
+    }
+    while (read && !bh->uptodate) {
+        if (bh->filling || bh->fresh) {
+            bcache_sleep(bh);
+            continue;
+        }
+        bh->filling = true;
+        spinlock_release(&bcache_lock);
+        int err = bcache_io(bh, false);
+        spinlock_acquire(&bcache_lock);
+        bh->filling = false;
+        if (!err)
+            bh->uptodate = true;
+        wait_queue_wake_all(&bcache_fill_wait);
+        if (err) {
+            spinlock_release(&bcache_lock);
+            if (nb)
+                bcache_free(nb);
+            brelse(bh);
+            return NULL;
+        }
+    }
+    spinlock_release(&bcache_lock);
+    if (nb)
+        bcache_free(nb);
+    return bh;
+}
+
+struct buffer_head *bread(struct block_device *dev, uint64_t block, uint32_t size) {
+    return bcache_get(dev, block, size, true);
+}
+
+struct buffer_head *getblk(struct block_device *dev, uint64_t block, uint32_t size) {
+    return bcache_get(dev, block, size, false);
+}
+
+struct buffer_head *find_get_block(struct block_device *dev, uint64_t block, uint32_t size) {
+    spinlock_acquire(&bcache_lock);
+    struct buffer_head *bh = bcache_find(dev, block, size);
+    if (bh)
+        bh->refcount++;
+    spinlock_release(&bcache_lock);
+    return bh;
+}
+
+void brelse(struct buffer_head *bh) {
+    if (!bh) return;
+    spinlock_acquire(&bcache_lock);
+    bh->refcount--;
+    bool orphan = bh->refcount == 0 && !bh->hashed;
+    // A getblk() holder let go without writing it: waiters may fill it now
+    bool wake = bh->fresh && bh->refcount == bh->waiters;
+    if (wake)
+        bh->fresh = false;
+    spinlock_release(&bcache_lock);
+    if (wake)
+        wait_queue_wake_all(&bcache_fill_wait);
+    if (orphan)
+        bcache_free(bh); // Forgotten while we held it
+}
+
+void mark_buffer_dirty(struct buffer_head *bh) {
+    if (!bh) return;
+    spinlock_acquire(&bcache_lock);
+    bh->uptodate = true;
+    bool wake = bh->fresh;
+    bh->fresh = false;
+    if (!bh->dirty && bh->hashed) {
+        bh->dirty = true;
+        bh->dirty_ms = lapic_timer_get_ms();
+        bstats.dirty++;
+    }
+    spinlock_release(&bcache_lock);
+    if (wake)
+        wait_queue_wake_all(&bcache_fill_wait);
+}
+
+int sync_dirty_buffer(struct buffer_head *bh) {
+    if (!bh) return -1;
+    return bcache_writeback(bh);
+}
+
+void set_buffer_uptodate(struct buffer_head *bh) {
+    spinlock_acquire(&bcache_lock);
+    bh->uptodate = true;
+    bool wake = bh->fresh;
+    bh->fresh = false;
+    spinlock_release(&bcache_lock);
+    if (wake)
+        wait_queue_wake_all(&bcache_fill_wait);
+}
+
+bool clear_buffer_dirty(struct buffer_head *bh) {
+    spinlock_acquire(&bcache_lock);
+    bool was = bh->dirty;
+    if (was) {
+        bh->dirty = false;
+        bstats.dirty--;
+    }
+    spinlock_release(&bcache_lock);
+    return was;
+}
+
+bool buffer_busy(struct buffer_head *bh) {
+    spinlock_acquire(&bcache_lock);
+    bool busy = bh->dirty || bh->writing;
+    spinlock_release(&bcache_lock);
+    return busy;
+}
+
+void bforget(struct block_device *dev, uint64_t block, uint32_t size) {
+    spinlock_acquire(&bcache_lock);
+    struct buffer_head *bh = bcache_find(dev, block, size);
+    if (bh) {
+        bcache_unhash(bh);
+        if (bh->refcount == 0)
+            bcache_free(bh);
+    }
+    spinlock_release(&bcache_lock);
+}
+
+// One pass of bcache_flush(): every buffer is submitted before any is
+// waited for, so the queue can merge neighbours and keep the disk busy.
+struct bcache_flush_io {
+    struct bio bios[BCACHE_FLUSH_BATCH];
+    struct buffer_head *bhs[BCACHE_FLUSH_BATCH];
+    uint32_t pending;
+    completion_t done;
+};
+
+static void bcache_flush_end_io(struct bio *bio) {
+    struct bcache_flush_io *io = (struct bcache_flush_io *)bio->private;
+    if (__atomic_sub_fetch(&io->pending, 1, __ATOMIC_ACQ_REL) == 0)
+        complete(&io->done);
+}
+
+static int bcache_write_batch(struct bcache_flush_io *io, struct buffer_head **batch, int n) {
+    int nr = 0;
+    for (int i = 0; i < n; i++) {
+        struct buffer_head *bh = batch[i];
+        struct block_device *dev = bh->dev;
+        if (!dev->write_sectors || !bcache_writeback_begin(bh)) continue;
+        uint32_t ss = dev->sector_size ? dev->sector_size : BLOCK_SECTOR_SIZE;
+        uint32_t count = bh->size / ss;
+        bio_init(&io->bios[nr], dev, BIO_WRITE, bh->block * count, count, bh->data);
+        io->bios[nr].end_io = bcache_flush_end_io;
+        io->bios[nr].private = io;
+        io->bhs[nr++] = bh;
+    }
+    if (nr == 0) return 0;
+
+    completion_init(&io->done);
+    io->pending = nr;
+    struct blk_plug plug;
+    blk_start_plug(&plug);
+    for (int i = 0; i < nr; i++)
+        submit_bio(&io->bios[i]);
+    blk_finish_plug(&plug);
+    wait_for_completion(&io->done);
+
+    int failed = 0;
+    for (int i = 0; i < nr; i++) {
+        bcache_writeback_end(io->bhs[i], io->bios[i].status);
+        if (io->bios[i].status) failed++;
+    }
+    return failed;
+}
+
+// Write back dirty buffers of dev (any device if NULL) that were dirtied at
+// or before cutoff_ms, a batch at a time in block order.
+static int bcache_flush(struct block_device *dev, uint64_t cutoff_ms) {
+    struct bcache_flush_io *io = kmalloc(sizeof(struct bcache_flush_io));
+    int result = 0;
+    while (1) {
+        struct buffer_head *batch[BCACHE_FLUSH_BATCH];
+        int n = 0;
+
+        spinlock_acquire(&bcache_lock);
+        struct list_head *pos;
+        list_for_each(pos, &bcache_lru) {
+            struct buffer_head *bh = list_entry(pos, struct buffer_head, lru);
+            if (!bh->dirty || (dev && bh->dev != dev) || bh->dirty_ms > cutoff_ms)
+                continue;
+            bh->refcount++;
+            batch[n++] = bh;
+            if (n == BCACHE_FLUSH_BATCH) break;
+        }
+        spinlock_release(&bcache_lock);
+
+        if (n == 0) break;
+
+        // Sort by (device, block) so the disk sees ascending LBAs
+        for (int i = 1; i < n; i++) {
+            struct buffer_head *key = batch[i];
+            int j = i - 1;
+            while (j >= 0 && (batch[j]->dev > key->dev ||
+                              (batch[j]->dev == key->dev && batch[j]->block > key->block))) {
+                batch[j + 1] = batch[j];
+                j--;
+            }
+            batch[j + 1] = key;
+        }
+
+        int failed = 0;
+        if (io) {
+            failed = bcache_write_batch(io, batch, n);
+        } else {
+            for (int i = 0; i < n; i++)
+                if (bcache_writeback(batch[i]) != 0) failed++;
+        }
+        for (int i = 0; i < n; i++)
+            brelse(batch[i]);
+        if (failed) {
+            result = -1;
+            if (failed == n) break; // Nothing is making progress
+        }
+    }
+    kfree(io);
+    return result;
+}
+
+int block_sync(struct block_device *dev) {
+    int ret = bcache_flush(dev, ~0ULL);
+    if (dev) {
+        if (block_flush(dev) != 0) ret = -1;
+        return ret;
+    }
+    // Partitions reach their disk's flush too; only ask each disk once
+    for (int i = 0; i < num_devices; i++) {
+        if (registered[i]->flush && registered[i]->flush(registered[i]) != 0)
+            ret = -1;
+    }
+    return ret;
+}
+
+void block_invalidate(struct block_device *dev) {
+    spinlock_acquire(&bcache_lock);
+    struct list_head *pos, *n;
+    list_for_each_safe(pos, n, &bcache_lru) {
+        struct buffer_head *bh = list_entry(pos, struct buffer_head, lru);
+        if (bh->dev != dev || bh->dirty || bh->refcount > 0)
+            continue;
+        bcache_unhash(bh);
+        bcache_free(bh);
+    }
+    spinlock_release(&bcache_lock);
+}
+
+static void block_writeback_entry(void) {
+    struct thread *self = sched_get_current();
+    while (1) {
+        self->wakeup_ticks = lapic_timer_get_ticks() + BLOCK_WRITEBACK_MS / 2;
+        self->state = THREAD_BLOCKED;
+        sched_yield();
+
+        uint64_t now = lapic_timer_get_ms();
+        if (now >= BLOCK_WRITEBACK_MS)
+            bcache_flush(NULL, now - BLOCK_WRITEBACK_MS);
+    }
+}
+
+void block_cache_init(void) {
+    if (!sched_create_kernel_thread(block_writeback_entry, NULL, true)) {
+        klog_puts("[BCACHE] Failed to start writeback thread\n");
+        return;
+    }
+    klog_puts("[BCACHE] Buffer cache writeback every ");
+    klog_uint64(BLOCK_WRITEBACK_MS / 2);
+    klog_puts(" ms\n");
+}
+
+void block_cache_get_stats(struct block_cache_stats *out) {
+    spinlock_acquire(&bcache_lock);
+    memcpy(out, &bstats, sizeof(bstats));
+    spinlock_release(&bcache_lock);
+}
@@ -1,18 +1,42 @@
 #ifndef BLOCK_BLOCK_H
 #define BLOCK_BLOCK_H
 
+#include "lib/list.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #define BLOCK_MAX_DEVICES 16
 #define BLOCK_SECTOR_SIZE 512
 
+struct request;
+struct request_queue;
+
 struct block_device {
     char name[16];              // e.g. "ata0", "ata1"
     uint32_t sector_size;       // Usually 512
     uint64_t total_sectors;     // Total number of sectors on the device
+    // Synchronous I/O. After block_register() these go through the request
+    // queue; the driver's own functions are only called by the queue.
     int (*read_sectors)(struct block_device *dev, uint64_t lba, uint32_t count, void *buf);
     int (*write_sectors)(struct block_device *dev, uint64_t lba, uint32_t count, const void *buf);
     void *driver_data;          // Opaque pointer for the specific driver
+
+    // Optional asynchronous entry point. The driver owns rq until it calls
+    // blk_end_request(), possibly from its IRQ handler. Returns non-zero if
+    // the request could not be started (it is then failed by the queue).
+    // Drivers without it are driven through their read/write_sectors by
+    // whichever thread runs the queue.
+    int (*submit)(struct block_device *dev, struct request *rq);
+    // Reap finished requests without waiting for an interrupt. Used by
+    // submit_bio_wait() when the caller runs with interrupts disabled.
+    void (*poll)(struct block_device *dev);
+    uint32_t queue_depth;       // Requests the driver accepts at once (0: 1)
+    uint32_t max_sectors;       // Merge limit per request (0: BLOCK_DEFAULT_MAX_SECTORS)
+    uint32_t max_segments;      // Discontiguous buffers per request (0: 1)
+    // Optional: make every completed write durable by draining the device's
+    // volatile write cache. May sleep. Reached through block_flush().
+    int (*flush)(struct block_device *dev);
+    struct request_queue *queue; // Set up by block_register()
 };
 
 // Register a block device. Returns 0 on success, -1 if full.
@@ -31,4 +55,237 @@ void block_scan_partitions(struct block_device *dev);
 // Call this after mounting a new root filesystem.
 void block_repopulate_devices(void);
 
+// If dev is a partition, return the whole disk and translate *lba to it.
+// Otherwise return dev unchanged.
+struct block_device *block_remap(struct block_device *dev, uint64_t *lba);
+
+// Flush the write cache of dev's disk. Returns 0 on success or when the
+// driver has no cache to flush.
+int block_flush(struct block_device *dev);
+
+// ── Request queue ────────────────────────────────────────────────────────────
+// I/O is described by bios (one contiguous buffer, one LBA range) and
+// submitted asynchronously. Each whole-disk device has a queue that merges
+// bios touching adjacent sectors into requests and hands them to the driver
+// in elevator order (ascending LBA, one sweep at a time), unless the oldest
+// request has waited past its deadline. At most queue_depth requests are
+// with the driver at once.
+//
+// A single bio is never split: max_sectors only bounds merging, and drivers
+// must accept any bio a caller hands them.
+//
+// Bio buffers must be kernel addresses (heap, HHDM): a request may be
+// dispatched by another thread and completed from an interrupt, under any
+// address space.
+
+#define BIO_READ 0
+#define BIO_WRITE 1
+
+#define BLOCK_DEFAULT_MAX_SECTORS 256
+#define BLOCK_READ_EXPIRE_MS 250    // Reads are served at most this late
+#define BLOCK_WRITE_EXPIRE_MS 2500  // Writes may wait longer behind reads
+#define BLOCK_PLUG_MAX 32           // Bios held by a plug before it flushes
+
+struct bio;
+typedef void (*bio_end_io_t)(struct bio *bio);
+
+struct bio {
+    struct block_device *dev;
+    int op;                     // BIO_READ or BIO_WRITE
+    uint64_t lba;
+    uint32_t count;             // Sectors
+    void *buf;                  // count * sector_size bytes
+    int status;                 // 0 on success, -1 on error; valid in end_io
+    bio_end_io_t end_io;        // Called once, possibly from IRQ context
+    void *private;              // For the submitter
+    struct bio *next;           // Next bio of the same request or plug
+};
+
+struct request {
+    struct request_queue *q;
+    struct block_device *dev;
+    int op;
+    uint64_t lba;
+    uint32_t count;             // Sectors, all bios together
+    uint32_t nr_segments;       // Runs of bios with contiguous buffers
+    struct bio *bio;            // Bios in LBA order
+    struct bio *biotail;
+    uint64_t deadline_ms;
+    struct list_head sort;      // Queue position by LBA
+    struct list_head fifo;      // Queue position by arrival
+    void *driver_data;          // Free for the driver while it owns rq
+};
+
+// Walk the bios of a request.
+#define rq_for_each_bio(b, rq) for ((b) = (rq)->bio; (b); (b) = (b)->next)
+
+// ── Scatter-gather ───────────────────────────────────────────────────────────
+// DMA drivers describe a request as physically contiguous segments and hand
+// those to the device, so data lands in its final pages (page cache, buffer
+// heads) without a bounce buffer. Pages are merged across bio boundaries
+// when they happen to be physically adjacent.
+
+#define BLOCK_SG_MAX_LEN (4u << 20) // Longest segment handed out
+
+struct blk_sg {
+    uint64_t phys;
+    uint32_t len;               // Bytes
+};
+
+struct blk_sg_iter {
+    struct bio *bio;
+    uint32_t offset;            // Bytes of bio already handed out
+    uint32_t sector_size;
+    bool error;                 // Hit a buffer page that is not mapped
+};
+
+void blk_sg_iter_init(struct blk_sg_iter *it, struct request *rq);
+
+// Next segment of the request. Returns false at the end (or on error).
+bool blk_sg_next(struct blk_sg_iter *it, struct blk_sg *sg);
+
+// Fill sg with up to max segments of rq. Returns the number of segments, or
+// -1 if rq needs more than max or a buffer is not mapped.
+int blk_rq_map_sg(struct request *rq, struct blk_sg *sg, int max);
+
+// Batches the bios a thread submits until blk_finish_plug(), so that they
+// reach the queue sorted and merged. Plugs do not nest.
+struct blk_plug {
+    struct bio *head;
+    uint32_t count;
+};
+
+// Per-device I/O statistics (reported in /proc/diskstats)
+struct blk_stats {
+    uint64_t reads;             // Bios completed
+    uint64_t writes;
+    uint64_t read_sectors;
+    uint64_t write_sectors;
+    uint64_t read_merges;       // Bios merged into an existing request
+    uint64_t write_merges;
+    uint64_t requests;          // Requests handed to the driver
+    uint64_t expired;           // Dispatched because of their deadline
+    uint64_t errors;
+    uint32_t queued;            // Requests waiting in the queue now
+    uint32_t in_flight;         // Requests owned by the driver now
+    uint64_t busy_ms;           // Time with at least one request in flight
+};
+
+void bio_init(struct bio *bio, struct block_device *dev, int op, uint64_t lba,
+              uint32_t count, void *buf);
+
+// Queue bio; bio->end_io runs when it is done. Partition bios are remapped
+// to the whole disk (bio->dev and bio->lba change).
+void submit_bio(struct bio *bio);
+
+// Submit bio and sleep until it completes. Returns bio->status.
+int submit_bio_wait(struct bio *bio);
+
+void blk_start_plug(struct blk_plug *plug);
+void blk_finish_plug(struct blk_plug *plug);
+
+// Called by drivers when they are done with rq. rq must not be touched
+// afterwards.
+void blk_end_request(struct request *rq, int status);
+
+// Create dev's queue and route read_sectors/write_sectors through it.
+// Called by block_register().
+int blk_queue_attach(struct block_device *dev);
+
+// Snapshot dev's queue statistics. Returns false if dev has no queue.
+bool blk_get_stats(struct block_device *dev, struct blk_stats *out);
+
+// ── Buffer cache ─────────────────────────────────────────────────────────────
+// Filesystem metadata blocks (inode tables, bitmaps, indirect blocks,
+// directories, FAT sectors) are cached in buffer heads keyed by
+// (device, block number, block size). A buffer is pinned while its refcount
+// is non-zero; unpinned buffers sit on an LRU and are reclaimed when the
+// cache is full. Dirty buffers are written back by the writeback thread,
+// on reclaim, or by block_sync().
+
+#define BLOCK_WRITEBACK_MS 5000 // Age at which the writeback thread flushes
+
+struct buffer_head {
+    struct block_device *dev;
+    uint64_t block;             // Block number in units of size
+    uint32_t size;              // Bytes; a multiple of the sector size
+    uint8_t *data;
+    uint32_t refcount;
+    bool uptodate;              // data matches (or is newer than) the disk
+    bool dirty;                 // data must be written back
+    bool hashed;                // Still findable; cleared by bforget()
+    uint32_t writing;           // Writebacks in flight
+    bool filling;               // A bread() is reading it from disk
+    bool fresh;                 // Handed out by getblk() and not written
+                                // yet: bread() must not fill it
+    uint32_t waiters;           // bread()s sleeping until it is filled
+    uint64_t dirty_ms;          // When the buffer first became dirty
+    struct buffer_head *hash_next;
+    struct list_head lru;       // Most recently used at the head
+};
+
+// Buffer cache statistics (reported in /proc/meminfo and /proc/vmstat)
+struct block_cache_stats {
+    uint64_t buffers;           // Buffers currently cached
+    uint64_t bytes;             // Data bytes held by those buffers
+    uint64_t dirty;             // Buffers waiting for writeback
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writebacks;        // Buffers written back
+    uint64_t evictions;         // Buffers dropped by LRU reclaim
+};
+
+// Return the buffer for block, reading it from the device if it is not
+// cached. Returns NULL on I/O error or OOM. Release with brelse().
+struct buffer_head *bread(struct block_device *dev, uint64_t block, uint32_t size);
+
+// Like bread() but never reads: for blocks the caller is about to overwrite
+// completely (e.g. freshly allocated directory blocks).
+struct buffer_head *getblk(struct block_device *dev, uint64_t block, uint32_t size);
+
+// The cached buffer for block, or NULL if it is not cached. Never reads or
+// allocates.
+struct buffer_head *find_get_block(struct block_device *dev, uint64_t block, uint32_t size);
+
+// Drop a reference taken by bread()/getblk()/find_get_block(). NULL is
+// ignored.
+void brelse(struct buffer_head *bh);
+
+// The caller modified bh->data; schedule it for writeback.
+void mark_buffer_dirty(struct buffer_head *bh);
+
+// The caller filled bh->data without dirtying it (e.g. a getblk() buffer
+// whose writeback a journal holds back until its commit).
+void set_buffer_uptodate(struct buffer_head *bh);
+
+// Write bh now if it is dirty. Returns 0 on success.
+int sync_dirty_buffer(struct buffer_head *bh);
+
+// Cancel the pending writeback of bh: its owner will dirty it again once
+// the contents may reach the disk (e.g. after a journal commit). Returns
+// true if it was dirty.
+bool clear_buffer_dirty(struct buffer_head *bh);
+
+// True while bh is dirty or a write of it has not completed.
+bool buffer_busy(struct buffer_head *bh);
+
+// The block was freed by the filesystem: drop any cached copy, discarding
+// unwritten changes so that they cannot land on the block's next owner.
+void bforget(struct block_device *dev, uint64_t block, uint32_t size);
+
+// Write back every dirty buffer of dev (all devices if NULL), then flush the
+// disks' write caches.
+int block_sync(struct block_device *dev);
+
+// Forget every clean, unpinned buffer of dev after it was written behind
+// the cache's back (e.g. by journal recovery).
+void block_invalidate(struct block_device *dev);
+
+// Start the writeback thread. Until then dirty buffers are only written on
+// reclaim or block_sync().
+void block_cache_init(void);
+
+// Snapshot the buffer cache statistics.
+void block_cache_get_stats(struct block_cache_stats *out);
+
 #endif
@@ -3,14 +3,20 @@
 #include "../../cpu/irq.h"
 #include "../../cpu/isr.h"
 #include "../../lib/string.h"
+#include "../../lock/spinlock.h"
+#include "../../mm/heap.h"
 #include "../../mm/pmm.h"
 #include "../../mm/vmm.h"
+#include "../../smp/cpu.h"
 #include "../manager/device.h"
 #include "../pci/pci.h"
 #include "block.h"
 #include <stddef.h>
 
 #define NVME_MAX_CONTROLLERS 4
+#define NVME_SECTOR_SIZE 512
+#define NVME_CQ_BATCH 32 // Completions reaped per lock hold
+#define NVME_POLL_SPINS 10000000
 
 typedef struct msix_table_entry {
   uint32_t addr_lo;
@@ -23,10 +29,8 @@ typedef struct msix_table_entry {
 static int nvme_init_controller(struct nvme_controller *nvme);
 static int nvme_identify(struct nvme_controller *nvme);
 static int nvme_create_io_queues(struct nvme_controller *nvme);
-static int nvme_block_read(struct block_device *dev, uint64_t lba,
-                           uint32_t count, void *buf);
-static int nvme_block_write(struct block_device *dev, uint64_t lba,
-                            uint32_t count, const void *buf);
+static int nvme_submit_rq(struct block_device *dev, struct request *rq);
+static void nvme_poll(struct block_device *dev);
 static void nvme_irq_handler(struct registers *regs);
 static int nvme_setup_msix(struct nvme_controller *nvme,
                            struct pci_device *pdev);
@@ -34,6 +38,9 @@ static int nvme_setup_msix(struct nvme_controller *nvme,
 static struct nvme_controller controllers[NVME_MAX_CONTROLLERS];
 static int nvme_count = 0;
 
+// Queue whose completions arrive on each MSI vector
+static struct nvme_queue *msi_queues[IRQ_MSI_COUNT];
+
 static int nvme_probe(struct device *dev) {
   if (nvme_count >= NVME_MAX_CONTROLLERS)
     return -1;
@@ -128,10 +135,18 @@ static int nvme_probe(struct device *dev) {
 
   // 5. Register Block Device (Phase 5)
   nvme->bdev.driver_data = nvme;
-  nvme->bdev.read_sectors = nvme_block_read;
-  nvme->bdev.write_sectors = nvme_block_write;
-  nvme->bdev.sector_size = 512;
+  nvme->bdev.submit = nvme_submit_rq;
+  nvme->bdev.poll = nvme_poll;
+  nvme->bdev.sector_size = NVME_SECTOR_SIZE;
   nvme->bdev.total_sectors = nvme->capacity_sectors;
+  nvme->bdev.max_sectors = nvme->max_xfer_sectors;
+  // PRP lists take any number of page-aligned buffers; the rest is bounced
+  nvme->bdev.max_segments = nvme->max_xfer_sectors;
+  if (nvme->io_queues[0]->vector >= 0)
+    nvme->bdev.queue_depth =
+        nvme->nr_io_queues * (nvme->io_queues[0]->entries - 1);
+  else
+    nvme->bdev.queue_depth = 1; // Polled to completion in submit
 
   // Name it nvmeX
   memcpy(nvme->bdev.name, "nvme", 4);
@@ -290,6 +305,13 @@ static int nvme_identify(struct nvme_controller *nvme) {
   klog_puts(serial);
   klog_puts("\n");
 
+  // MDTS: largest transfer as a power of two of the minimum page size (4K)
+  uint8_t mdts = *((uint8_t *)virt_buf + 77);
+  uint32_t max_pages = NVME_MAX_XFER_PAGES;
+  if (mdts && mdts < 16 && (1u << mdts) < max_pages)
+    max_pages = 1u << mdts;
+  nvme->max_xfer_sectors = max_pages * (4096 / NVME_SECTOR_SIZE);
+
   // Identify Namespace 1
   memset(virt_buf, 0, 4096);
   cmd.nsid = 1;
@@ -319,149 +341,494 @@ static int nvme_identify(struct nvme_controller *nvme) {
   return 0;
 }
 
+// ── I/O queues ──────────────────────────────────────────────────────────────
+// One submission/completion queue pair per CPU (as many as the controller
+// and its MSI-X table allow). Each CQ interrupts the CPU that owns it, so a
+// request normally completes where it was submitted. Commands are tracked
+// by tag; the command ID is the tag index in its queue.
+
+static int nvme_set_queue_count(struct nvme_controller *nvme, uint16_t want) {
+  nvme_cmd_t cmd = {0};
+  nvme_completion_t res = {0};
+  cmd.cd0 = 0x09;  // Opcode: Set Features
+  cmd.cd10 = 0x07; // FID: Number of Queues
+  cmd.cd11 = ((uint32_t)(want - 1) << 16) | (want - 1);
+
+  if (nvme_submit_admin_cmd(nvme, &cmd, &res) != 0 || (res.status >> 1) != 0)
+    return 1; // Queue 1 always exists
+
+  uint16_t nsq = (res.result & 0xFFFF) + 1;
+  uint16_t ncq = (res.result >> 16) + 1;
+  uint16_t n = nsq < ncq ? nsq : ncq;
+  return n < want ? n : want;
+}
+
+static struct nvme_queue *nvme_alloc_queue(struct nvme_controller *nvme,
+                                           uint16_t qid, uint16_t entries) {
+  struct nvme_queue *q = kmalloc(sizeof(struct nvme_queue));
+  if (!q)
+    return NULL;
+  memset(q, 0, sizeof(struct nvme_queue));
+
+  uintptr_t hhdm = pmm_get_hhdm_offset();
+  q->ctrl = nvme;
+  spinlock_init(&q->lock);
+  q->qid = qid;
+  q->entries = entries;
+  q->cq_phase = 1;
+  q->vector = -1;
+
+  q->sq_pages = (entries * sizeof(nvme_cmd_t) + 4095) / 4096;
+  q->sq_phys = pmm_alloc_blocks(q->sq_pages);
+  q->cq_phys = pmm_alloc(); // 256 entries of 16 bytes
+  q->tags = kmalloc((entries - 1) * sizeof(struct nvme_tag));
+  q->free_tags = kmalloc((entries - 1) * sizeof(uint16_t));
+  if (!q->sq_phys || !q->cq_phys || !q->tags || !q->free_tags) {
+    if (q->sq_phys)
+      pmm_free_blocks(q->sq_phys, q->sq_pages);
+    if (q->cq_phys)
+      pmm_free(q->cq_phys);
+    kfree(q->tags);
+    kfree(q->free_tags);
+    kfree(q);
+    return NULL;
+  }
+
+  q->sq = (nvme_cmd_t *)((uintptr_t)q->sq_phys + hhdm);
+  q->cq = (nvme_completion_t *)((uintptr_t)q->cq_phys + hhdm);
+  memset(q->sq, 0, q->sq_pages * 4096);
+  memset(q->cq, 0, 4096);
+
+  uintptr_t db = (uintptr_t)nvme->regs + 0x1000;
+  q->sq_db = (volatile uint32_t *)(db + (2 * qid) * nvme->db_stride);
+  q->cq_db = (volatile uint32_t *)(db + (2 * qid + 1) * nvme->db_stride);
+
+  memset(q->tags, 0, (entries - 1) * sizeof(struct nvme_tag));
+  q->nr_free = entries - 1;
+  for (uint16_t i = 0; i < q->nr_free; i++)
+    q->free_tags[i] = q->nr_free - 1 - i; // Hand out tag 0 first
+
+  // PRP list pages for large transfers; more are allocated if this runs dry
+  for (q->nr_prp_free = 0; q->nr_prp_free < NVME_PRP_POOL_PAGES;
+       q->nr_prp_free++) {
+    void *page = pmm_alloc();
+    if (!page)
+      break;
+    q->prp_pool[q->nr_prp_free] = page;
+  }
+  return q;
+}
+
 static int nvme_create_io_queues(struct nvme_controller *nvme) {
   klog_puts("[NVME]   Creating IO Queues...\n");
 
-  // 1. Allocate Memory
-  uint64_t sq_phys, cq_phys;
-  nvme->io_sq = pmm_alloc();
-  sq_phys = (uint64_t)nvme->io_sq;
-  nvme->io_cq = pmm_alloc();
-  cq_phys = (uint64_t)nvme->io_cq;
+  // One queue per CPU; MSI-X entry 0 stays with the (polled) admin queue
+  uint16_t want = (uint16_t)cpu_get_count();
+  if (want == 0)
+    want = 1;
+  if (want > NVME_MAX_IO_QUEUES)
+    want = NVME_MAX_IO_QUEUES;
+  bool use_msix = nvme->msix_entries > 1;
+  if (!use_msix)
+    want = 1;
+  else if (want > nvme->msix_entries - 1)
+    want = nvme->msix_entries - 1;
+  uint16_t nr = nvme_set_queue_count(nvme, want);
+
+  // Doorbells past the two pages mapped at probe time
+  uintptr_t hhdm = pmm_get_hhdm_offset();
+  uintptr_t regs_phys = (uintptr_t)nvme->regs - hhdm;
+  uintptr_t db_end = 0x1000 + (2 * nr + 2) * nvme->db_stride;
+  for (uintptr_t off = 0x2000; off < db_end; off += 0x1000)
+    vmm_map_page(vmm_get_active_pml4(), (uintptr_t)nvme->regs + off,
+                 regs_phys + off, PAGE_FLAG_RW | PAGE_FLAG_PRESENT);
+
+  uint32_t mqes = (uint32_t)(nvme->regs->cap & 0xFFFF) + 1;
+  uint16_t entries = mqes < NVME_IO_QUEUE_ENTRIES ? (uint16_t)mqes
+                                                  : NVME_IO_QUEUE_ENTRIES;
+
+  msix_table_entry_t *msix = (msix_table_entry_t *)nvme->msix_table_virt;
+  nvme->nr_io_queues = 0;
+  for (uint16_t i = 0; i < nr; i++) {
+    uint16_t qid = i + 1;
+    struct nvme_queue *q = nvme_alloc_queue(nvme, qid, entries);
+    if (!q)
+      break;
+    q->cpu = i;
+
+    if (use_msix) {
+      q->vector = irq_alloc_msi_vector(nvme_irq_handler);
+      if (q->vector >= 0) {
+        msi_queues[q->vector - IRQ_MSI_BASE] = q;
+        struct cpu_info *cpu = cpu_get_info(i);
+        uint32_t apic_id = cpu ? cpu->apic_id : lapic_get_id();
+        msix[qid].addr_lo = irq_msi_address(apic_id);
+        msix[qid].addr_hi = 0;
+        msix[qid].data = (uint32_t)q->vector;
+        msix[qid].vec_ctrl = 0; // Unmask
+      }
+    }
+
+    // Create Completion Queue (Opcode 0x05)
+    nvme_cmd_t cmd = {0};
+    cmd.cd0 = 0x05;
+    cmd.prp1 = (uint64_t)q->cq_phys;
+    cmd.cd10 = ((uint32_t)(entries - 1) << 16) | qid;
+    cmd.cd11 = 1; // PC=1 (Physically Contiguous)
+    if (q->vector >= 0)
+      cmd.cd11 |= ((uint32_t)qid << 16) | 2; // IV = MSI-X entry, IEN=1
+
+    if (nvme_submit_admin_cmd(nvme, &cmd, NULL) != 0) {
+      klog_puts("[ERR] NVMe: Create IO CQ failed.\n");
+      break;
+    }
 
-  memset((void *)(sq_phys + pmm_get_hhdm_offset()), 0, 4096);
-  memset((void *)(cq_phys + pmm_get_hhdm_offset()), 0, 4096);
+    // Create Submission Queue (Opcode 0x01)
+    memset(&cmd, 0, sizeof(nvme_cmd_t));
+    cmd.cd0 = 0x01;
+    cmd.prp1 = (uint64_t)q->sq_phys;
+    cmd.cd10 = ((uint32_t)(entries - 1) << 16) | qid;
+    cmd.cd11 = ((uint32_t)qid << 16) | 1; // CQID, PC=1
 
-  // 2. Create Completion Queue (Opcode 0x05)
-  nvme_cmd_t cmd = {0};
-  cmd.cd0 = 0x05;
-  cmd.prp1 = cq_phys;
-  cmd.cd10 = (255 << 16) | 1; // QID=1, Size=256 (255)
-  cmd.cd11 = 1;               // PC=1 (Physically Contiguous)
+    if (nvme_submit_admin_cmd(nvme, &cmd, NULL) != 0) {
+      klog_puts("[ERR] NVMe: Create IO SQ failed.\n");
+      break;
+    }
 
-  if (nvme_submit_admin_cmd(nvme, &cmd, NULL) != 0) {
-    klog_puts("[ERR] NVMe: Create IO CQ failed.\n");
-    return -1;
+    nvme->io_queues[nvme->nr_io_queues++] = q;
   }
 
-  // 3. Create Submission Queue (Opcode 0x01)
-  memset(&cmd, 0, sizeof(nvme_cmd_t));
-  cmd.cd0 = 0x01;
-  cmd.prp1 = sq_phys;
-  cmd.cd10 = (63 << 16) | 1; // QID=1, Size=64 (63)
-  cmd.cd11 = (1 << 16) | 1;  // CQID=1, PC=1
-
-  if (nvme_submit_admin_cmd(nvme, &cmd, NULL) != 0) {
-    klog_puts("[ERR] NVMe: Create IO SQ failed.\n");
+  if (nvme->nr_io_queues == 0)
     return -1;
-  }
 
-  nvme->io_sq_tail = 0;
-  nvme->io_cq_head = 0;
+  // Without MSI-X (or with only some vectors) everything is polled
+  for (uint16_t i = 0; i < nvme->nr_io_queues; i++) {
+    if (nvme->io_queues[i]->vector < 0) {
+      nvme->io_queues[0] = nvme->io_queues[i];
+      nvme->nr_io_queues = 1;
+      break;
+    }
+  }
 
+  klog_puts("[NVME]   ");
+  klog_uint64(nvme->nr_io_queues);
+  klog_puts(" IO queue pair(s), ");
+  klog_uint64(entries);
+  klog_puts(" entries, ");
+  klog_puts(nvme->io_queues[0]->vector >= 0 ? "MSI-X completions\n"
+                                            : "polled completions\n");
   return 0;
 }
 
-static int nvme_submit_io_cmd(struct nvme_controller *nvme, nvme_cmd_t *cmd,
-                              nvme_completion_t *res) {
-  uintptr_t sq_virt = (uintptr_t)nvme->io_sq + pmm_get_hhdm_offset();
-  uintptr_t cq_virt = (uintptr_t)nvme->io_cq + pmm_get_hhdm_offset();
-
-  nvme_cmd_t *sq = (nvme_cmd_t *)sq_virt;
-  nvme_completion_t *cq = (nvme_completion_t *)cq_virt;
-
-  memcpy(&sq[nvme->io_sq_tail], cmd, sizeof(nvme_cmd_t));
+// Copy count sectors of rq's data, starting skip sectors in, between its
+// bios and the bounce buffer.
+static void nvme_rq_copy(struct request *rq, uint32_t skip, uint32_t count,
+                         uint8_t *bounce, bool to_dev) {
+  struct bio *bio;
+  rq_for_each_bio(bio, rq) {
+    if (count == 0)
+      break;
+    if (skip >= bio->count) {
+      skip -= bio->count;
+      continue;
+    }
+    uint32_t n = bio->count - skip;
+    if (n > count)
+      n = count;
+    uint8_t *p = (uint8_t *)bio->buf + (size_t)skip * NVME_SECTOR_SIZE;
+    size_t bytes = (size_t)n * NVME_SECTOR_SIZE;
+    if (to_dev)
+      memcpy(bounce, p, bytes);
+    else
+      memcpy(p, bounce, bytes);
+    bounce += bytes;
+    count -= n;
+    skip = 0;
+  }
+}
 
-  nvme->io_sq_tail = (nvme->io_sq_tail + 1) % 64;
-  // IO SQ1 Tail Doorbell is at 1000h + (2 * 1 * stride)
-  volatile uint32_t *sq_db =
-      (volatile uint32_t *)((uintptr_t)nvme->regs + 0x1000 +
-                            (2 * nvme->db_stride));
-  *sq_db = nvme->io_sq_tail;
+// ── Data mapping ────────────────────────────────────────────────────────────
+// Requests whose segments start and end on page boundaries (apart from the
+// start of the first and the end of the last) are described by PRPs that
+// point straight at their pages. Anything else is copied through a
+// contiguous bounce buffer.
+
+static uint64_t *nvme_get_prp_list(struct nvme_queue *q,
+                                   struct nvme_tag *tag) {
+  void *page = NULL;
+  spinlock_acquire(&q->lock);
+  if (q->nr_prp_free)
+    page = q->prp_pool[--q->nr_prp_free];
+  spinlock_release(&q->lock);
+
+  tag->prp_pooled = page != NULL;
+  if (!page)
+    page = pmm_alloc();
+  tag->prp_list = page;
+  return page ? (uint64_t *)((uintptr_t)page + pmm_get_hhdm_offset()) : NULL;
+}
 
-  int timeout = 1000000;
-  while (timeout--) {
-    uint16_t status = cq[nvme->io_cq_head].status;
-    if ((status & 0x1) == 1) { // Phase bit 1 = New entry
-      if (res)
-        memcpy(res, &cq[nvme->io_cq_head], sizeof(nvme_completion_t));
+static void nvme_put_prp_list(struct nvme_queue *q, struct nvme_tag *tag) {
+  if (!tag->prp_list)
+    return;
+  if (tag->prp_pooled) {
+    spinlock_acquire(&q->lock);
+    q->prp_pool[q->nr_prp_free++] = tag->prp_list;
+    spinlock_release(&q->lock);
+  } else {
+    pmm_free(tag->prp_list);
+  }
+  tag->prp_list = NULL;
+}
 
-      nvme->io_cq_head = (nvme->io_cq_head + 1) % 256;
-      // IO CQ1 Head Doorbell is at 1000h + (3 * stride)
-      volatile uint32_t *cq_db =
-          (volatile uint32_t *)((uintptr_t)nvme->regs + 0x1000 +
-                                (3 * nvme->db_stride));
-      *cq_db = nvme->io_cq_head;
-      return 0;
+static bool nvme_map_direct(struct nvme_queue *q, struct nvme_tag *tag,
+                            struct request *rq) {
+  struct blk_sg_iter it;
+  struct blk_sg sg;
+  uint64_t *list = NULL;
+  uint32_t n = 0;   // PRP entries so far
+  uint64_t end = 0; // End of the previous segment
+
+  blk_sg_iter_init(&it, rq);
+  while (blk_sg_next(&it, &sg)) {
+    if (n == 0 ? (sg.phys & 3) : ((end & 0xFFF) || (sg.phys & 0xFFF)))
+      goto fail;
+    for (uint64_t p = sg.phys; p < sg.phys + sg.len;
+         p = (p & ~0xFFFULL) + 4096) {
+      if (n == 0) {
+        tag->prp1 = p;
+      } else if (n == 1) {
+        tag->prp2 = p;
+      } else {
+        if (!list) {
+          list = nvme_get_prp_list(q, tag);
+          if (!list)
+            goto fail;
+          list[0] = tag->prp2;
+        }
+        if (n - 1 >= 4096 / sizeof(uint64_t))
+          goto fail; // Would need a chained list
+        list[n - 1] = p;
+      }
+      n++;
     }
-    for (int i = 0; i < 10; i++)
-      __asm__ volatile("pause");
+    end = sg.phys + sg.len;
   }
-  return -1;
-}
+  if (it.error || n == 0)
+    goto fail;
 
-static int nvme_io(struct nvme_controller *nvme, uint64_t lba, uint32_t count,
-                   void *buf, int write) {
-  size_t bytes = (size_t)count * 512;
-  size_t pages = (bytes + 4095) / 4096;
+  if (list)
+    tag->prp2 = (uint64_t)tag->prp_list;
+  tag->direct = true;
+  return true;
 
-  // Allocate physically contiguous buffer for DMA
-  void *phys_buf = pmm_alloc_blocks(pages);
-  void *virt_buf = (void *)((uintptr_t)phys_buf + pmm_get_hhdm_offset());
+fail:
+  nvme_put_prp_list(q, tag);
+  return false;
+}
+
+static int nvme_map_bounce(struct nvme_queue *q, struct nvme_tag *tag,
+                           struct request *rq) {
+  uint32_t max = q->ctrl->max_xfer_sectors;
+  uint32_t first = rq->count < max ? rq->count : max;
+  size_t pages = ((size_t)first * NVME_SECTOR_SIZE + 4095) / 4096;
+  tag->bounce = pmm_alloc_blocks(pages);
+  if (!tag->bounce)
+    return -1;
+  tag->bounce_pages = pages;
+  if (pages > 2 && !nvme_get_prp_list(q, tag)) {
+    pmm_free_blocks(tag->bounce, pages);
+    tag->bounce = NULL;
+    return -1;
+  }
+  q->bounced++;
+  return 0;
+}
 
-  if (write)
-    memcpy(virt_buf, buf, bytes);
+// Send the next chunk of the tag's request (all of it when direct, at most
+// max_xfer_sectors through the bounce buffer).
+static void nvme_issue(struct nvme_queue *q, uint16_t cid) {
+  struct nvme_tag *tag = &q->tags[cid];
+  struct request *rq = tag->rq;
+  uint32_t count = rq->count - tag->done_sectors;
 
   nvme_cmd_t cmd = {0};
-  cmd.cd0 = write ? 0x01 : 0x02; // Opcode: Write / Read
+  cmd.cd0 = (rq->op == BIO_WRITE ? 0x01 : 0x02) | ((uint32_t)cid << 16);
   cmd.nsid = 1;
-  cmd.prp1 = (uint64_t)phys_buf;
 
-  // Simple PRP handling: if it spans multiple pages, we need a PRP list
-  // For now, if > 2 pages, we'll limit to 1 page or implement list.
-  // Given pmm_alloc_blocks gives contiguous, we can just point prp2 to the
-  // second page but ONLY if exactly 2 pages. For > 2, we need a list.
-  if (pages == 2) {
-    cmd.prp2 = (uint64_t)phys_buf + 4096;
-  } else if (pages > 2) {
-    // Create a PRP list
-    uint64_t *prp_list =
-        (uint64_t *)((uintptr_t)pmm_alloc() + pmm_get_hhdm_offset());
-    for (size_t i = 0; i < pages - 1; i++) {
-      prp_list[i] = (uint64_t)phys_buf + 4096 * (i + 1);
+  if (tag->direct) {
+    cmd.prp1 = tag->prp1;
+    cmd.prp2 = tag->prp2;
+  } else {
+    if (count > q->ctrl->max_xfer_sectors)
+      count = q->ctrl->max_xfer_sectors;
+    uintptr_t hhdm = pmm_get_hhdm_offset();
+    uint64_t phys = (uint64_t)tag->bounce;
+    if (rq->op == BIO_WRITE)
+      nvme_rq_copy(rq, tag->done_sectors, count, (uint8_t *)(phys + hhdm),
+                   true);
+    cmd.prp1 = phys;
+
+    // The bounce buffer is contiguous: PRP2 is the second page, or a list
+    // of every page after the first.
+    size_t pages = ((size_t)count * NVME_SECTOR_SIZE + 4095) / 4096;
+    if (pages == 2) {
+      cmd.prp2 = phys + 4096;
+    } else if (pages > 2) {
+      uint64_t *prp_list = (uint64_t *)((uintptr_t)tag->prp_list + hhdm);
+      for (size_t i = 0; i < pages - 1; i++)
+        prp_list[i] = phys + 4096 * (i + 1);
+      cmd.prp2 = (uint64_t)tag->prp_list;
     }
-    cmd.prp2 = (uint64_t)pmm_get_hhdm_offset()
-                   ? (uint64_t)((uintptr_t)prp_list - pmm_get_hhdm_offset())
-                   : (uint64_t)prp_list;
-    // Optimization: since it's contiguous, it's easier.
   }
+  tag->xfer_sectors = count;
 
+  uint64_t lba = rq->lba + tag->done_sectors;
   cmd.cd10 = (uint32_t)lba;
   cmd.cd11 = (uint32_t)(lba >> 32);
   cmd.cd12 = (count - 1) & 0xFFFF; // NLB is 0-based
 
-  if (nvme_submit_io_cmd(nvme, &cmd, NULL) != 0) {
-    pmm_free_blocks(phys_buf, pages);
-    return -1;
+  spinlock_acquire(&q->lock);
+  memcpy(&q->sq[q->sq_tail], &cmd, sizeof(nvme_cmd_t));
+  q->sq_tail = (q->sq_tail + 1) % q->entries;
+  *q->sq_db = q->sq_tail;
+  q->commands++;
+  spinlock_release(&q->lock);
+}
+
+static void nvme_put_tag(struct nvme_queue *q, uint16_t cid) {
+  struct nvme_tag *tag = &q->tags[cid];
+  if (tag->bounce)
+    pmm_free_blocks(tag->bounce, tag->bounce_pages);
+  tag->bounce = NULL;
+  nvme_put_prp_list(q, tag);
+
+  spinlock_acquire(&q->lock);
+  tag->rq = NULL;
+  q->free_tags[q->nr_free++] = cid;
+  spinlock_release(&q->lock);
+}
+
+static void nvme_complete_cmd(struct nvme_queue *q, uint16_t cid,
+                              uint16_t status) {
+  if (cid >= q->entries - 1)
+    return;
+  struct nvme_tag *tag = &q->tags[cid];
+  struct request *rq = tag->rq;
+  if (!rq)
+    return; // Abandoned after a polling timeout
+
+  if (status == 0) {
+    if (!tag->direct && rq->op == BIO_READ) {
+      uint8_t *virt =
+          (uint8_t *)((uintptr_t)tag->bounce + pmm_get_hhdm_offset());
+      nvme_rq_copy(rq, tag->done_sectors, tag->xfer_sectors, virt, false);
+    }
+    tag->done_sectors += tag->xfer_sectors;
+    if (tag->done_sectors < rq->count) {
+      nvme_issue(q, cid);
+      return;
+    }
   }
 
-  if (!write)
-    memcpy(buf, virt_buf, bytes);
+  nvme_put_tag(q, cid);
+  blk_end_request(rq, status ? -1 : 0);
+}
 
-  pmm_free_blocks(phys_buf, pages);
-  return 0;
+// Reap every posted completion of q. Safe from IRQ context and concurrently
+// with other CPUs: entries are claimed under the queue lock.
+static void nvme_process_cq(struct nvme_queue *q) {
+  struct {
+    uint16_t cid;
+    uint16_t status;
+  } done[NVME_CQ_BATCH];
+
+  for (;;) {
+    uint32_t n = 0;
+    spinlock_acquire(&q->lock);
+    while (n < NVME_CQ_BATCH) {
+      volatile nvme_completion_t *c = &q->cq[q->cq_head];
+      uint16_t status = c->status;
+      if ((status & 1) != q->cq_phase)
+        break;
+      done[n].cid = c->cid;
+      done[n].status = (status >> 1) & 0x7FFF;
+      n++;
+      if (++q->cq_head == q->entries) {
+        q->cq_head = 0;
+        q->cq_phase ^= 1;
+      }
+    }
+    if (n)
+      *q->cq_db = q->cq_head;
+    spinlock_release(&q->lock);
+
+    for (uint32_t i = 0; i < n; i++)
+      nvme_complete_cmd(q, done[i].cid, done[i].status);
+    if (n < NVME_CQ_BATCH)
+      return;
+  }
 }
 
-static int nvme_block_read(struct block_device *dev, uint64_t lba,
-                           uint32_t count, void *buf) {
+// Queue without an interrupt: spin until the command (and any follow-up
+// chunks) is done.
+static int nvme_poll_tag(struct nvme_queue *q, uint16_t cid) {
+  struct nvme_tag *tag = &q->tags[cid];
+  for (uint32_t spins = 0; spins < NVME_POLL_SPINS; spins++) {
+    nvme_process_cq(q);
+    if (!__atomic_load_n(&tag->rq, __ATOMIC_ACQUIRE))
+      return 0;
+    __asm__ volatile("pause");
+  }
+
+  // The controller may still DMA into the buffers: leak them and the tag
+  klog_puts("[ERR] NVMe: I/O command timeout.\n");
+  spinlock_acquire(&q->lock);
+  tag->rq = NULL;
+  spinlock_release(&q->lock);
+  return -1;
+}
+
+static int nvme_submit_rq(struct block_device *dev, struct request *rq) {
   struct nvme_controller *nvme = (struct nvme_controller *)dev->driver_data;
-  return nvme_io(nvme, lba, count, buf, 0);
+
+  // This CPU's queue, or any queue with a free tag
+  uint32_t start = cpu_get_current()->cpu_id % nvme->nr_io_queues;
+  struct nvme_queue *q = NULL;
+  int cid = -1;
+  for (uint16_t i = 0; i < nvme->nr_io_queues && cid < 0; i++) {
+    q = nvme->io_queues[(start + i) % nvme->nr_io_queues];
+    spinlock_acquire(&q->lock);
+    if (q->nr_free) {
+      cid = q->free_tags[--q->nr_free];
+      q->tags[cid].rq = rq;
+    }
+    spinlock_release(&q->lock);
+  }
+  if (cid < 0)
+    return -1;
+
+  struct nvme_tag *tag = &q->tags[cid];
+  tag->done_sectors = 0;
+  tag->direct = false;
+  tag->bounce = NULL;
+  tag->prp_list = NULL;
+  if (!(rq->count <= nvme->max_xfer_sectors && nvme_map_direct(q, tag, rq)) &&
+      nvme_map_bounce(q, tag, rq) != 0) {
+    nvme_put_tag(q, (uint16_t)cid);
+    return -1;
+  }
+  nvme_issue(q, (uint16_t)cid);
+
+  if (q->vector < 0)
+    return nvme_poll_tag(q, (uint16_t)cid);
+  return 0;
 }
 
-static int nvme_block_write(struct block_device *dev, uint64_t lba,
-                            uint32_t count, const void *buf) {
+static void nvme_poll(struct block_device *dev) {
   struct nvme_controller *nvme = (struct nvme_controller *)dev->driver_data;
-  return nvme_io(nvme, lba, count, (void *)buf, 1);
+  for (uint16_t i = 0; i < nvme->nr_io_queues; i++)
+    nvme_process_cq(nvme->io_queues[i]);
 }
 
 static struct device_id nvme_ids[] = {{.type = ID_PCI,
@@ -479,48 +846,38 @@ void nvme_init(void) {
 }
 
 void nvme_self_test(void) {
-  klog_puts("[TEST] NVMe Phase 6: MSI-X Interrupts\n");
+  klog_puts("[TEST] NVMe: multi-queue I/O\n");
   if (nvme_count == 0) {
     klog_puts("       No NVMe controllers detected. FAIL.\n");
     return;
   }
 
+  uint8_t *buffer = kmalloc(NVME_SECTOR_SIZE);
+  if (!buffer)
+    return;
   for (int i = 0; i < nvme_count; i++) {
     struct nvme_controller *nvme = &controllers[i];
-    if (nvme_init_controller(nvme) == 0) {
-      if (nvme_identify(nvme) == 0) {
-        if (nvme_create_io_queues(nvme) == 0) {
-          klog_puts("       Controller ");
-          klog_uint64(i);
-          klog_puts(": IO Queues established. SUCCESS.\n");
-
-          // Final Test: Read LBA 0
-          uint8_t buffer[512];
-          if (nvme_block_read(&nvme->bdev, 0, 1, buffer) == 0) {
-            klog_puts("       LBA 0 Read Test: SUCCESS. Signature: ");
-            klog_hex32(
-                *(uint32_t *)&buffer[510]); // Should be 0xAA55 if partitioned
-            klog_puts("\n");
-          } else {
-            klog_puts("       LBA 0 Read Test: FAILED.\n");
-          }
-        } else {
-          klog_puts("       Controller ");
-          klog_uint64(i);
-          klog_puts(": IO Queue setup FAILED.\n");
-        }
-      } else {
-        klog_puts("       Controller ");
-        klog_uint64(i);
-        klog_puts(": Identification FAILED.\n");
-      }
+    klog_puts("       Controller ");
+    klog_uint64(i);
+    if (nvme->nr_io_queues == 0) {
+      klog_puts(": IO Queue setup FAILED.\n");
+      continue;
+    }
+    klog_puts(": ");
+    klog_uint64(nvme->nr_io_queues);
+    klog_puts(" IO queue pair(s). SUCCESS.\n");
+
+    // Read LBA 0 through the block layer
+    if (nvme->bdev.read_sectors(&nvme->bdev, 0, 1, buffer) == 0) {
+      klog_puts("       LBA 0 Read Test: SUCCESS. Signature: ");
+      klog_hex32(*(uint16_t *)&buffer[510]); // 0xAA55 if partitioned
+      klog_puts("\n");
     } else {
-      klog_puts("       Controller ");
-      klog_uint64(i);
-      klog_puts(": Initialization FAILED.\n");
+      klog_puts("       LBA 0 Read Test: FAILED.\n");
     }
   }
-  klog_puts("[TEST] NVMe Phase 6 complete.\n\n");
+  kfree(buffer);
+  klog_puts("[TEST] NVMe multi-queue I/O complete.\n\n");
 }
 
 static int nvme_setup_msix(struct nvme_controller *nvme,
@@ -544,31 +901,41 @@ static int nvme_setup_msix(struct nvme_controller *nvme,
     phys_base |= ((uint64_t)pdev->bar[bir + 1] << 32);
   }
 
-  uintptr_t table_virt = (phys_base + offset) + pmm_get_hhdm_offset();
-  vmm_map_page(vmm_get_active_pml4(), table_virt, phys_base + offset,
-               PAGE_FLAG_RW | PAGE_FLAG_PRESENT);
+  // Enough of the table for the admin entry and every I/O queue
+  uint64_t table_phys = phys_base + offset;
+  uintptr_t table_virt = table_phys + pmm_get_hhdm_offset();
+  size_t table_bytes = (NVME_MAX_IO_QUEUES + 1) * sizeof(msix_table_entry_t);
+  for (uint64_t off = 0; off < (table_phys & 0xFFF) + table_bytes;
+       off += 0x1000)
+    vmm_map_page(vmm_get_active_pml4(), (table_virt & ~0xFFFULL) + off,
+                 (table_phys & ~0xFFFULL) + off,
+                 PAGE_FLAG_RW | PAGE_FLAG_PRESENT);
   nvme->msix_table_virt = (void *)table_virt;
+  nvme->msix_entries = (msg_ctrl & 0x7FF) + 1;
 
-  nvme->irq_vector = 0x2E; // Using a vector already in the IDT (46)
-  register_interrupt_handler(nvme->irq_vector, nvme_irq_handler);
-
+  // Everything masked until an I/O queue claims its entry
   msix_table_entry_t *entry = (msix_table_entry_t *)table_virt;
-  entry->addr_lo = 0xFEE00000 | (lapic_get_id() << 12);
-  entry->addr_hi = 0;
-  entry->data = nvme->irq_vector;
-  entry->vec_ctrl = 0;
+  uint16_t used = nvme->msix_entries < NVME_MAX_IO_QUEUES + 1
+                      ? nvme->msix_entries
+                      : NVME_MAX_IO_QUEUES + 1;
+  for (uint16_t i = 0; i < used; i++)
+    entry[i].vec_ctrl = 1;
 
   pci_config_write16(pdev->bus, pdev->slot, pdev->func, cap_ptr + 2,
                      msg_ctrl | 0x8000);
 
-  klog_puts("[NVME]   MSI-X Enabled (Vector ");
-  klog_hex32(nvme->irq_vector);
-  klog_puts(")\n");
+  klog_puts("[NVME]   MSI-X Enabled (");
+  klog_uint64(nvme->msix_entries);
+  klog_puts(" entries)\n");
 
   return 0;
 }
 
 static void nvme_irq_handler(struct registers *regs) {
-  (void)regs;
-  klog_puts("[NVME] Interrupt received!\n");
+  uint64_t slot = regs->int_no - IRQ_MSI_BASE;
+  if (slot >= IRQ_MSI_COUNT || !msi_queues[slot])
+    return;
+  struct nvme_queue *q = msi_queues[slot];
+  q->interrupts++;
+  nvme_process_cq(q);
 }
@@ -3,9 +3,15 @@
 
 #include <stdint.h>
 #include "../manager/device.h"
+#include "../../lock/spinlock.h"
 #include "block.h"
 #include <stdbool.h>
 
+#define NVME_MAX_IO_QUEUES 16     // One per CPU, up to the controller's limit
+#define NVME_IO_QUEUE_ENTRIES 256 // Per SQ/CQ, capped by CAP.MQES
+#define NVME_MAX_XFER_PAGES 256   // Largest single command (1 MiB)
+#define NVME_PRP_POOL_PAGES 32    // PRP list pages kept per queue
+
 // NVMe Controller Registers (BAR0)
 typedef struct nvme_regs {
     uint64_t cap;       // Controller Capabilities
@@ -51,6 +57,50 @@ typedef struct nvme_completion {
     uint16_t status;    // Status
 } __attribute__((packed)) nvme_completion_t;
 
+struct nvme_controller;
+
+// A command slot. The command ID is the tag's index in its queue.
+struct nvme_tag {
+    struct request *rq;     // NULL while free
+    uint32_t done_sectors;  // Sectors of rq already transferred
+    uint32_t xfer_sectors;  // Sectors moved by the command in flight
+    bool direct;            // PRPs point at the bio pages themselves
+    uint64_t prp1;          // Direct mapping
+    uint64_t prp2;
+    void *bounce;           // Physical DMA buffer when not direct
+    size_t bounce_pages;
+    void *prp_list;         // Physical PRP list page, if the data needs one
+    bool prp_pooled;        // prp_list came from the queue's pool
+};
+
+// One I/O submission/completion queue pair, bound to a CPU.
+struct nvme_queue {
+    struct nvme_controller *ctrl;
+    spinlock_t lock;
+    uint16_t qid;
+    uint16_t entries;
+    nvme_cmd_t *sq;
+    nvme_completion_t *cq;
+    void *sq_phys;
+    size_t sq_pages;
+    void *cq_phys;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint8_t cq_phase;       // Phase tag of entries not yet consumed
+    volatile uint32_t *sq_db;
+    volatile uint32_t *cq_db;
+    int vector;             // MSI-X vector, -1 if completions are polled
+    uint32_t cpu;
+    struct nvme_tag *tags;  // entries - 1 of them
+    uint16_t *free_tags;
+    uint16_t nr_free;
+    void *prp_pool[NVME_PRP_POOL_PAGES]; // Free PRP list pages (physical)
+    uint16_t nr_prp_free;
+    uint64_t commands;
+    uint64_t interrupts;
+    uint64_t bounced;       // Commands that had to copy through a bounce
+};
+
 struct nvme_controller {
     nvme_regs_t *regs;
     uint32_t db_stride; // Doorbell stride
@@ -65,17 +115,16 @@ struct nvme_controller {
     bool present;
 
     // Phase 4+ fields
-    void *io_sq;
-    void *io_cq;
-    uint16_t io_sq_tail;
-    uint16_t io_cq_head;
+    struct nvme_queue *io_queues[NVME_MAX_IO_QUEUES];
+    uint16_t nr_io_queues;
+    uint32_t max_xfer_sectors;
     uint64_t capacity_sectors;
 
     struct block_device bdev;
 
     // Phase 6: MSI-X
     void *msix_table_virt;
-    uint8_t irq_vector;
+    uint16_t msix_entries;
 };
 
 void nvme_init(void);
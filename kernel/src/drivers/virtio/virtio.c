@@ -143,6 +143,48 @@ int virtq_add_buf_chain(struct virtqueue *vq,
   return head;
 }
 
+int virtq_add_indirect(struct virtqueue *vq, uint64_t table_phys,
+                       uint16_t count) {
+  int idx = alloc_desc(vq);
+  if (idx < 0) return -1;
+
+  vq->desc[idx].addr  = table_phys;
+  vq->desc[idx].len   = (uint32_t)count * sizeof(struct virtq_desc);
+  vq->desc[idx].flags = VIRTQ_DESC_F_INDIRECT;
+  vq->desc[idx].next  = 0;
+
+  return idx;
+}
+
+int virtq_add_descs(struct virtqueue *vq, const struct virtq_desc *descs,
+                    uint16_t count) {
+  if (count == 0 || vq->num_free < count)
+    return -1;
+
+  // Fill back to front so each descriptor knows its successor
+  int next = -1;
+  for (int i = count - 1; i >= 0; i--) {
+    int idx = alloc_desc(vq);
+    vq->desc[idx].addr  = descs[i].addr;
+    vq->desc[idx].len   = descs[i].len;
+    vq->desc[idx].flags = descs[i].flags & VIRTQ_DESC_F_WRITE;
+    vq->desc[idx].next  = 0;
+    if (next >= 0) {
+      vq->desc[idx].flags |= VIRTQ_DESC_F_NEXT;
+      vq->desc[idx].next = (uint16_t)next;
+    }
+    next = idx;
+  }
+  return next;
+}
+
+void virtq_publish(struct virtqueue *vq, uint16_t head) {
+  vq->avail->ring[vq->avail->idx % vq->num] = head;
+  __asm__ volatile("mfence" ::: "memory"); // Descriptors before the index
+  vq->avail->idx++;
+  __asm__ volatile("mfence" ::: "memory"); // Index before the notification
+}
+
 void virtq_kick(struct virtqueue *vq) {
   __asm__ volatile("" ::: "memory"); // Write barrier
 
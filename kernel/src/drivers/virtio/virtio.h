@@ -14,6 +14,7 @@
 #define VIRTIO_STATUS_FAILED            128
 
 // ── VirtIO Feature Bits ─────────────────────────────────────────────────────
+#define VIRTIO_F_RING_INDIRECT_DESC     (1ULL << 28)  // Indirect descriptor tables
 #define VIRTIO_F_VERSION_1              (1ULL << 32)  // VirtIO 1.0+
 
 // ── Virtqueue Descriptor Flags ──────────────────────────────────────────────
@@ -98,6 +99,22 @@ int virtq_add_buf_chain(struct virtqueue *vq,
                         uint64_t req_phys, uint32_t req_len,
                         uint64_t resp_phys, uint32_t resp_len);
 
+// Add a single descriptor pointing at an indirect table of count
+// descriptors (needs VIRTIO_F_RING_INDIRECT_DESC). Returns the descriptor
+// index, or -1 on failure.
+int virtq_add_indirect(struct virtqueue *vq, uint64_t table_phys,
+                       uint16_t count);
+
+// Add count descriptors as one chain. Only the WRITE flag of each entry is
+// used; the chaining is filled in. Returns the head index, or -1 if the ring
+// has fewer than count free descriptors.
+int virtq_add_descs(struct virtqueue *vq, const struct virtq_desc *descs,
+                    uint16_t count);
+
+// Put the chain starting at head on the available ring. The caller notifies
+// the device afterwards (virtio_pci_notify).
+void virtq_publish(struct virtqueue *vq, uint16_t head);
+
 // Make the descriptors visible to the device (update avail ring).
 void virtq_kick(struct virtqueue *vq);
 
@@ -0,0 +1,663 @@
+#include "drivers/virtio/virtio_blk.h"
+#include "apic/lapic.h"
+#include "console/klog.h"
+#include "cpu/irq.h"
+#include "cpu/isr.h"
+#include "lib/string.h"
+#include "mm/heap.h"
+#include "mm/pmm.h"
+#include "smp/cpu.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// ── VirtIO block device ─────────────────────────────────────────────────────
+// One virtqueue per CPU (VIRTIO_BLK_F_MQ), each with its own MSI-X vector
+// steered to that CPU, sits behind the block request queue. A request takes
+// a slot of its queue: the slot's DMA area holds the request header, the
+// status byte and, with VIRTIO_F_RING_INDIRECT_DESC, the descriptor table,
+// so every request occupies a single ring descriptor however many segments
+// it has. Data descriptors point straight at the request's pages; requests
+// that cannot be described that way go through a bounce buffer.
+
+#define VIRTIO_BLK_BATCH 32              // Completions reaped per lock hold
+#define VIRTIO_BLK_BOUNCE_MAX (256 * 1024) // Bytes per bounced chunk
+#define VIRTIO_BLK_POLL_SPINS 10000000
+
+static struct virtio_blk_device *devices[VIRTIO_BLK_MAX_DEVICES];
+static int vblk_count = 0;
+
+// MSI vector -> queue
+static struct virtio_blk_queue *msi_queues[IRQ_MSI_COUNT];
+
+static void vblk_irq_handler(struct registers *regs);
+
+static bool vblk_irqs_enabled(void) {
+  uint64_t rflags;
+  __asm__ volatile("pushfq; pop %0" : "=r"(rflags));
+  return rflags & 0x200;
+}
+
+static inline uint64_t vblk_dma_phys(struct virtio_blk_queue *q, uint16_t s) {
+  return q->dma_phys + (uint64_t)s * sizeof(struct virtio_blk_dma);
+}
+
+// ── Queue setup ─────────────────────────────────────────────────────────────
+
+static struct virtio_blk_queue *vblk_alloc_queue(struct virtio_blk_device *blk,
+                                                 uint16_t index,
+                                                 bool use_msix) {
+  struct virtio_blk_queue *q = kmalloc(sizeof(struct virtio_blk_queue));
+  if (!q)
+    return NULL;
+  memset(q, 0, sizeof(struct virtio_blk_queue));
+  q->blk = blk;
+  q->index = index;
+  q->vector = -1;
+  q->cpu = index;
+  spinlock_init(&q->lock);
+
+  // Route MSI-X entry 'index' before the queue is enabled
+  uint16_t entry = VIRTIO_MSI_NO_VECTOR;
+  if (use_msix && index < blk->vdev.msix_entries) {
+    q->vector = irq_alloc_msi_vector(vblk_irq_handler);
+    if (q->vector >= 0) {
+      struct cpu_info *cpu = cpu_get_info(index);
+      uint32_t apic_id = cpu ? cpu->apic_id : lapic_get_id();
+      msi_queues[q->vector - IRQ_MSI_BASE] = q;
+      virtio_pci_route_msix(&blk->vdev, index, (uint8_t)q->vector, apic_id);
+      entry = index;
+    }
+  }
+
+  if (!virtio_pci_setup_queue_msix(&blk->vdev, index, &q->vq, &entry)) {
+    if (q->vector >= 0)
+      msi_queues[q->vector - IRQ_MSI_BASE] = NULL;
+    kfree(q);
+    return NULL;
+  }
+  if (q->vector >= 0 && entry == VIRTIO_MSI_NO_VECTOR) {
+    msi_queues[q->vector - IRQ_MSI_BASE] = NULL;
+    q->vector = -1;
+  }
+
+  // Without indirect tables every request chains max_segs + 2 descriptors
+  // through the ring; size the queue so that a full one always fits.
+  uint16_t depth = VIRTIO_BLK_QUEUE_DEPTH;
+  uint16_t fit = blk->indirect ? q->vq.num
+                               : q->vq.num / (uint16_t)(blk->max_segs + 2);
+  if (depth > fit)
+    depth = fit;
+  if (depth == 0)
+    depth = 1;
+  q->depth = depth;
+
+  size_t pages = ((size_t)depth * sizeof(struct virtio_blk_dma) + 4095) / 4096;
+  void *phys = pmm_alloc_blocks(pages);
+  if (!phys) {
+    klog_puts("[VIRTIO-BLK] Out of memory for request area\n");
+    return NULL; // The device keeps the ring; nothing to hand it back to
+  }
+  q->dma_phys = (uint64_t)phys;
+  q->dma = (struct virtio_blk_dma *)((uintptr_t)phys + pmm_get_hhdm_offset());
+  memset(q->dma, 0, pages * 4096);
+
+  for (uint16_t i = 0; i < depth; i++)
+    q->free_slots[i] = depth - 1 - i;
+  q->nr_free = depth;
+  return q;
+}
+
+// ── Data mapping ────────────────────────────────────────────────────────────
+
+// Copy count sectors of rq's data, starting skip sectors in, between its
+// bios and the bounce buffer.
+static void vblk_rq_copy(struct request *rq, uint32_t skip, uint32_t count,
+                         uint8_t *bounce, bool to_dev) {
+  struct bio *bio;
+  rq_for_each_bio(bio, rq) {
+    if (count == 0)
+      break;
+    if (skip >= bio->count) {
+      skip -= bio->count;
+      continue;
+    }
+    uint32_t n = bio->count - skip;
+    if (n > count)
+      n = count;
+    uint8_t *p = (uint8_t *)bio->buf + (size_t)skip * VIRTIO_BLK_SECTOR_SIZE;
+    size_t bytes = (size_t)n * VIRTIO_BLK_SECTOR_SIZE;
+    if (to_dev)
+      memcpy(bounce, p, bytes);
+    else
+      memcpy(p, bounce, bytes);
+    bounce += bytes;
+    count -= n;
+    skip = 0;
+  }
+}
+
+// Append data descriptors for [phys, phys + len) after the n already in
+// table (which start at table[1]), split at size_max. Returns the new count,
+// or -1 if the request would need more than max_segs.
+static int vblk_add_data(struct virtio_blk_device *blk,
+                         struct virtq_desc *table, int n, uint64_t phys,
+                         uint32_t len, bool to_dev) {
+  while (len) {
+    if (n >= (int)blk->max_segs)
+      return -1;
+    uint32_t piece = len;
+    if (blk->size_max && piece > blk->size_max)
+      piece = blk->size_max;
+    table[1 + n].addr = phys;
+    table[1 + n].len = piece;
+    table[1 + n].flags = to_dev ? 0 : VIRTQ_DESC_F_WRITE;
+    n++;
+    phys += piece;
+    len -= piece;
+  }
+  return n;
+}
+
+static bool vblk_map_direct(struct virtio_blk_queue *q, uint16_t s,
+                            struct request *rq) {
+  struct virtio_blk_slot *slot = &q->slots[s];
+  struct virtq_desc *table = q->dma[s].table;
+  struct blk_sg_iter it;
+  struct blk_sg sg;
+  int n = 0;
+
+  blk_sg_iter_init(&it, rq);
+  while (blk_sg_next(&it, &sg)) {
+    n = vblk_add_data(q->blk, table, n, sg.phys, sg.len, rq->op == BIO_WRITE);
+    if (n < 0)
+      return false;
+  }
+  if (it.error || n == 0)
+    return false;
+
+  slot->direct = true;
+  slot->nr_data = (uint16_t)n;
+  return true;
+}
+
+static int vblk_map_bounce(struct virtio_blk_queue *q, uint16_t s,
+                           struct request *rq) {
+  struct virtio_blk_slot *slot = &q->slots[s];
+  uint32_t first = rq->count < q->blk->bounce_sectors ? rq->count
+                                                      : q->blk->bounce_sectors;
+  size_t pages = ((size_t)first * VIRTIO_BLK_SECTOR_SIZE + 4095) / 4096;
+  slot->bounce = pmm_alloc_blocks(pages);
+  if (!slot->bounce)
+    return -1;
+  slot->bounce_pages = pages;
+  slot->direct = false;
+  q->bounced++;
+  return 0;
+}
+
+// ── Submission and completion ───────────────────────────────────────────────
+
+// Claim a free slot on this CPU's queue, or on any queue with one free.
+static int vblk_get_slot(struct virtio_blk_device *blk,
+                         struct virtio_blk_queue **out, struct request *rq,
+                         completion_t *done, int *result) {
+  uint32_t start = cpu_get_current()->cpu_id % blk->nr_queues;
+  for (uint16_t i = 0; i < blk->nr_queues; i++) {
+    struct virtio_blk_queue *q = blk->queues[(start + i) % blk->nr_queues];
+    int s = -1;
+    spinlock_acquire(&q->lock);
+    if (q->nr_free) {
+      s = q->free_slots[--q->nr_free];
+      q->slots[s].rq = rq;
+      q->slots[s].done = done;
+      q->slots[s].result = result;
+    }
+    spinlock_release(&q->lock);
+    if (s >= 0) {
+      *out = q;
+      return s;
+    }
+  }
+  return -1;
+}
+
+static void vblk_put_slot(struct virtio_blk_queue *q, uint16_t s) {
+  struct virtio_blk_slot *slot = &q->slots[s];
+  if (slot->bounce)
+    pmm_free_blocks(slot->bounce, slot->bounce_pages);
+  slot->bounce = NULL;
+
+  spinlock_acquire(&q->lock);
+  slot->rq = NULL;
+  slot->done = NULL;
+  slot->result = NULL;
+  q->free_slots[q->nr_free++] = s;
+  spinlock_release(&q->lock);
+}
+
+// Build the descriptors for the slot's next chunk (all of it when direct,
+// at most bounce_sectors when bounced; nothing for a flush) and put them on
+// the ring.
+static int vblk_issue(struct virtio_blk_queue *q, uint16_t s) {
+  struct virtio_blk_device *blk = q->blk;
+  struct virtio_blk_slot *slot = &q->slots[s];
+  struct virtio_blk_dma *dma = &q->dma[s];
+  uint64_t dma_phys = vblk_dma_phys(q, s);
+  struct request *rq = slot->rq;
+  int n = 0;
+
+  if (!rq) {
+    dma->hdr.type = VIRTIO_BLK_T_FLUSH;
+    dma->hdr.sector = 0;
+  } else {
+    bool write = rq->op == BIO_WRITE;
+    dma->hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    dma->hdr.sector = rq->lba + slot->done_sectors;
+    if (slot->direct) {
+      n = slot->nr_data;
+      slot->xfer_sectors = rq->count;
+    } else {
+      uint32_t count = rq->count - slot->done_sectors;
+      if (count > blk->bounce_sectors)
+        count = blk->bounce_sectors;
+      uint64_t phys = (uint64_t)slot->bounce;
+      if (write)
+        vblk_rq_copy(rq, slot->done_sectors, count,
+                     (uint8_t *)(phys + pmm_get_hhdm_offset()), true);
+      n = vblk_add_data(blk, dma->table, 0, phys,
+                        count * VIRTIO_BLK_SECTOR_SIZE, write);
+      if (n < 0)
+        return -1;
+      slot->xfer_sectors = count;
+    }
+  }
+  dma->hdr.reserved = 0;
+  dma->status = 0xFF;
+
+  // header -> data... -> status, chained through the table
+  dma->table[0].addr = dma_phys + offsetof(struct virtio_blk_dma, hdr);
+  dma->table[0].len = sizeof(struct virtio_blk_outhdr);
+  dma->table[0].flags = 0;
+  dma->table[n + 1].addr = dma_phys + offsetof(struct virtio_blk_dma, status);
+  dma->table[n + 1].len = 1;
+  dma->table[n + 1].flags = VIRTQ_DESC_F_WRITE;
+  dma->table[n + 1].next = 0;
+  for (int i = 0; i <= n; i++) {
+    dma->table[i].flags |= VIRTQ_DESC_F_NEXT;
+    dma->table[i].next = (uint16_t)(i + 1);
+  }
+
+  spinlock_acquire(&q->lock);
+  int head = blk->indirect
+                 ? virtq_add_indirect(&q->vq, dma_phys, (uint16_t)(n + 2))
+                 : virtq_add_descs(&q->vq, dma->table, (uint16_t)(n + 2));
+  if (head < 0) {
+    spinlock_release(&q->lock);
+    return -1;
+  }
+  q->head_slot[head] = (uint8_t)s;
+  virtq_publish(&q->vq, (uint16_t)head);
+  virtio_pci_notify(&blk->vdev, q->index, &q->vq);
+  q->requests++;
+  spinlock_release(&q->lock);
+  return 0;
+}
+
+static void vblk_complete(struct virtio_blk_queue *q, uint16_t s,
+                          uint8_t status) {
+  struct virtio_blk_slot *slot = &q->slots[s];
+  struct request *rq = slot->rq;
+
+  if (!rq) {
+    completion_t *done = slot->done;
+    if (!done)
+      return; // Abandoned after a polling timeout
+    *slot->result = status == VIRTIO_BLK_S_OK ? 0 : -1;
+    vblk_put_slot(q, s);
+    complete(done);
+    return;
+  }
+
+  if (status == VIRTIO_BLK_S_OK) {
+    if (!slot->direct && rq->op == BIO_READ) {
+      uint8_t *virt =
+          (uint8_t *)((uintptr_t)slot->bounce + pmm_get_hhdm_offset());
+      vblk_rq_copy(rq, slot->done_sectors, slot->xfer_sectors, virt, false);
+    }
+    slot->done_sectors += slot->xfer_sectors;
+    if (slot->done_sectors < rq->count) {
+      if (vblk_issue(q, s) == 0)
+        return;
+      status = VIRTIO_BLK_S_IOERR;
+    }
+  }
+
+  vblk_put_slot(q, s);
+  blk_end_request(rq, status == VIRTIO_BLK_S_OK ? 0 : -1);
+}
+
+// Reap every used element of q. Safe from IRQ context and concurrently with
+// other CPUs: elements are claimed under the queue lock.
+static void vblk_process_queue(struct virtio_blk_queue *q) {
+  struct {
+    uint16_t slot;
+    uint8_t status;
+  } done[VIRTIO_BLK_BATCH];
+
+  for (;;) {
+    uint32_t n = 0;
+    uint32_t id, len;
+    spinlock_acquire(&q->lock);
+    while (n < VIRTIO_BLK_BATCH && virtq_poll(&q->vq, &id, &len)) {
+      if (id >= q->vq.num)
+        continue;
+      uint16_t s = q->head_slot[id];
+      virtq_free_desc(&q->vq, (uint16_t)id);
+      done[n].slot = s;
+      done[n].status = q->dma[s].status;
+      n++;
+    }
+    spinlock_release(&q->lock);
+
+    for (uint32_t i = 0; i < n; i++)
+      vblk_complete(q, done[i].slot, done[i].status);
+    if (n < VIRTIO_BLK_BATCH)
+      return;
+  }
+}
+
+// Queue without an interrupt (or caller with interrupts off): spin until
+// the slot is done.
+static int vblk_poll_slot(struct virtio_blk_queue *q, uint16_t s) {
+  struct virtio_blk_slot *slot = &q->slots[s];
+  for (uint32_t spins = 0; spins < VIRTIO_BLK_POLL_SPINS; spins++) {
+    vblk_process_queue(q);
+    if (!__atomic_load_n(&slot->rq, __ATOMIC_ACQUIRE) &&
+        !__atomic_load_n(&slot->done, __ATOMIC_ACQUIRE))
+      return 0;
+    __asm__ volatile("pause");
+  }
+
+  // The device may still DMA into the buffers: leak them and the slot
+  klog_puts("[ERR] VirtIO-blk: request timeout.\n");
+  spinlock_acquire(&q->lock);
+  slot->rq = NULL;
+  slot->done = NULL;
+  spinlock_release(&q->lock);
+  return -1;
+}
+
+static int vblk_submit(struct block_device *dev, struct request *rq) {
+  struct virtio_blk_device *blk = (struct virtio_blk_device *)dev->driver_data;
+  struct virtio_blk_queue *q = NULL;
+  int s = vblk_get_slot(blk, &q, rq, NULL, NULL);
+  if (s < 0)
+    return -1;
+
+  struct virtio_blk_slot *slot = &q->slots[s];
+  slot->done_sectors = 0;
+  slot->bounce = NULL;
+  if (!vblk_map_direct(q, (uint16_t)s, rq) &&
+      vblk_map_bounce(q, (uint16_t)s, rq) != 0) {
+    vblk_put_slot(q, (uint16_t)s);
+    return -1;
+  }
+  if (vblk_issue(q, (uint16_t)s) != 0) {
+    vblk_put_slot(q, (uint16_t)s);
+    return -1;
+  }
+
+  if (q->vector < 0)
+    return vblk_poll_slot(q, (uint16_t)s);
+  return 0;
+}
+
+static void vblk_poll(struct block_device *dev) {
+  struct virtio_blk_device *blk = (struct virtio_blk_device *)dev->driver_data;
+  for (uint16_t i = 0; i < blk->nr_queues; i++)
+    vblk_process_queue(blk->queues[i]);
+}
+
+// VIRTIO_BLK_T_FLUSH: everything the device completed before it is on
+// stable storage once it completes.
+static int vblk_flush(struct block_device *dev) {
+  struct virtio_blk_device *blk = (struct virtio_blk_device *)dev->driver_data;
+  completion_t done;
+  completion_init(&done);
+  int result = -1;
+
+  struct virtio_blk_queue *q = NULL;
+  int s;
+  while ((s = vblk_get_slot(blk, &q, NULL, &done, &result)) < 0) {
+    vblk_poll(dev);
+    __asm__ volatile("pause");
+  }
+  q->slots[s].bounce = NULL;
+  if (vblk_issue(q, (uint16_t)s) != 0) {
+    vblk_put_slot(q, (uint16_t)s);
+    return -1;
+  }
+
+  if (q->vector < 0 || !vblk_irqs_enabled()) {
+    if (vblk_poll_slot(q, (uint16_t)s) != 0)
+      return -1;
+  }
+  wait_for_completion(&done);
+  return result;
+}
+
+static void vblk_irq_handler(struct registers *regs) {
+  uint64_t slot = regs->int_no - IRQ_MSI_BASE;
+  if (slot >= IRQ_MSI_COUNT || !msi_queues[slot])
+    return;
+  struct virtio_blk_queue *q = msi_queues[slot];
+  q->interrupts++;
+  vblk_process_queue(q);
+}
+
+// ── Probe ───────────────────────────────────────────────────────────────────
+
+static bool vblk_probe(struct pci_device *pci) {
+  struct virtio_blk_device *blk = kmalloc(sizeof(struct virtio_blk_device));
+  if (!blk)
+    return false;
+  memset(blk, 0, sizeof(struct virtio_blk_device));
+
+  if (!virtio_pci_init(&blk->vdev, pci)) {
+    klog_puts("[VIRTIO-BLK] Failed to initialize PCI transport\n");
+    kfree(blk);
+    return false;
+  }
+
+  // Standard initialization sequence (§3.1.1)
+  struct virtio_pci_device *vdev = &blk->vdev;
+  virtio_pci_reset(vdev);
+  virtio_pci_set_status(vdev, VIRTIO_STATUS_ACKNOWLEDGE);
+  virtio_pci_set_status(vdev, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+  uint64_t device_features = virtio_pci_read_features(vdev);
+  uint64_t wanted = VIRTIO_F_VERSION_1 | VIRTIO_F_RING_INDIRECT_DESC |
+                    VIRTIO_BLK_F_MQ | VIRTIO_BLK_F_FLUSH |
+                    VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX;
+  blk->features = device_features & wanted;
+  if (!(blk->features & VIRTIO_F_VERSION_1)) {
+    klog_puts("[VIRTIO-BLK] Legacy-only device, skipping\n");
+    virtio_pci_set_status(vdev, VIRTIO_STATUS_FAILED);
+    kfree(blk);
+    return false;
+  }
+  virtio_pci_write_features(vdev, blk->features);
+  virtio_pci_set_status(vdev, VIRTIO_STATUS_ACKNOWLEDGE |
+                                  VIRTIO_STATUS_DRIVER |
+                                  VIRTIO_STATUS_FEATURES_OK);
+  if (!(virtio_pci_get_status(vdev) & VIRTIO_STATUS_FEATURES_OK)) {
+    klog_puts("[VIRTIO-BLK] Device did not accept features\n");
+    virtio_pci_set_status(vdev, VIRTIO_STATUS_FAILED);
+    kfree(blk);
+    return false;
+  }
+
+  volatile struct virtio_blk_config *cfg =
+      (volatile struct virtio_blk_config *)vdev->device_cfg;
+  uint64_t capacity = cfg->capacity;
+
+  blk->indirect = (blk->features & VIRTIO_F_RING_INDIRECT_DESC) != 0;
+  blk->max_segs = blk->indirect ? VIRTIO_BLK_MAX_SEGS : VIRTIO_BLK_DIRECT_SEGS;
+  if ((blk->features & VIRTIO_BLK_F_SEG_MAX) && cfg->seg_max &&
+      cfg->seg_max < blk->max_segs)
+    blk->max_segs = cfg->seg_max;
+  if (blk->features & VIRTIO_BLK_F_SIZE_MAX)
+    blk->size_max = cfg->size_max & ~(uint32_t)(VIRTIO_BLK_SECTOR_SIZE - 1);
+
+  // Bounce chunks must still fit in max_segs descriptors
+  uint64_t bounce = VIRTIO_BLK_BOUNCE_MAX;
+  if (blk->size_max && (uint64_t)blk->size_max * blk->max_segs < bounce)
+    bounce = (uint64_t)blk->size_max * blk->max_segs;
+  blk->bounce_sectors = (uint32_t)(bounce / VIRTIO_BLK_SECTOR_SIZE);
+  if (blk->bounce_sectors == 0)
+    blk->bounce_sectors = 1;
+
+  // One queue per CPU, as many as the device offers and MSI-X can route
+  uint16_t want = (uint16_t)cpu_get_count();
+  if (want == 0)
+    want = 1;
+  if (want > VIRTIO_BLK_MAX_QUEUES)
+    want = VIRTIO_BLK_MAX_QUEUES;
+  uint16_t offered = 1;
+  if ((blk->features & VIRTIO_BLK_F_MQ) && cfg->num_queues)
+    offered = cfg->num_queues;
+  if (want > offered)
+    want = offered;
+  uint16_t msix = virtio_pci_enable_msix(vdev);
+  if (msix && want > msix)
+    want = msix;
+
+  for (uint16_t i = 0; i < want; i++) {
+    struct virtio_blk_queue *q = vblk_alloc_queue(blk, i, msix > 0);
+    if (!q)
+      break;
+    blk->queues[blk->nr_queues++] = q;
+  }
+  if (blk->nr_queues == 0) {
+    klog_puts("[VIRTIO-BLK] No usable request queue\n");
+    virtio_pci_set_status(vdev, VIRTIO_STATUS_FAILED);
+    return false;
+  }
+
+  virtio_pci_set_status(vdev, VIRTIO_STATUS_ACKNOWLEDGE |
+                                  VIRTIO_STATUS_DRIVER |
+                                  VIRTIO_STATUS_FEATURES_OK |
+                                  VIRTIO_STATUS_DRIVER_OK);
+
+  int idx = vblk_count++;
+  devices[idx] = blk;
+
+  blk->bdev.driver_data = blk;
+  blk->bdev.submit = vblk_submit;
+  blk->bdev.poll = vblk_poll;
+  if (blk->features & VIRTIO_BLK_F_FLUSH)
+    blk->bdev.flush = vblk_flush;
+  blk->bdev.sector_size = VIRTIO_BLK_SECTOR_SIZE;
+  blk->bdev.total_sectors = capacity;
+  blk->bdev.max_segments = blk->max_segs;
+  blk->bdev.max_sectors = blk->max_segs * (4096 / VIRTIO_BLK_SECTOR_SIZE);
+  if (blk->queues[0]->vector >= 0) {
+    uint32_t depth = 0;
+    for (uint16_t i = 0; i < blk->nr_queues; i++)
+      depth += blk->queues[i]->depth;
+    blk->bdev.queue_depth = depth;
+  } else {
+    blk->bdev.queue_depth = 1; // Polled to completion in submit
+  }
+  memcpy(blk->bdev.name, "vd", 2);
+  blk->bdev.name[2] = 'a' + idx;
+  blk->bdev.name[3] = '\0';
+
+  klog_puts("[VIRTIO-BLK] ");
+  klog_puts(blk->bdev.name);
+  klog_puts(": ");
+  klog_uint64(capacity / 2048);
+  klog_puts(" MiB, ");
+  klog_uint64(blk->nr_queues);
+  klog_puts(blk->queues[0]->vector >= 0 ? " queue(s) with MSI-X"
+                                        : " polled queue(s)");
+  klog_puts(blk->indirect ? ", indirect" : ", direct");
+  klog_puts(" descriptors, ");
+  klog_uint64(blk->max_segs);
+  klog_puts(" segs");
+  if (blk->bdev.flush)
+    klog_puts(", flush");
+  klog_puts("\n");
+
+  block_register(&blk->bdev);
+  return true;
+}
+
+int virtio_blk_init(void) {
+  vblk_count = 0;
+  for (uint32_t i = 0; i < pci_get_device_count(); i++) {
+    struct pci_device *pci = pci_get_device(i);
+    if (pci->vendor_id != VIRTIO_PCI_VENDOR_ID)
+      continue;
+    if (pci->device_id != VIRTIO_PCI_DEVICE_BLK &&
+        pci->device_id != VIRTIO_PCI_DEVICE_BLK_MODERN)
+      continue;
+    if (vblk_count >= VIRTIO_BLK_MAX_DEVICES)
+      break;
+
+    klog_puts("[VIRTIO-BLK] PCI ");
+    klog_uint64(pci->bus);
+    klog_puts(":");
+    klog_uint64(pci->slot);
+    klog_puts(".");
+    klog_uint64(pci->func);
+    klog_puts(" device=");
+    klog_hex32(pci->device_id);
+    klog_puts("\n");
+    vblk_probe(pci);
+  }
+  return vblk_count;
+}
+
+// ── Self-test ───────────────────────────────────────────────────────────────
+
+void virtio_blk_self_test(void) {
+  if (vblk_count == 0)
+    return;
+  klog_puts("[TEST] VirtIO-blk: read and flush\n");
+
+  for (int d = 0; d < vblk_count; d++) {
+    struct virtio_blk_device *blk = devices[d];
+    struct block_device *dev = &blk->bdev;
+
+    // A page-aligned buffer and one straddling an extra page boundary give
+    // different descriptor lists: both must return the same data.
+    uint8_t *direct = pmm_alloc_page();
+    uint8_t *odd = kmalloc(4096 + 1);
+    bool ok = direct && odd;
+    if (ok) {
+      direct = (uint8_t *)((uintptr_t)direct + pmm_get_hhdm_offset());
+      ok = dev->read_sectors(dev, 0, 8, direct) == 0 &&
+           dev->read_sectors(dev, 0, 8, odd + 1) == 0 &&
+           memcmp(direct, odd + 1, 4096) == 0;
+    }
+    if (direct)
+      pmm_free_page((void *)((uintptr_t)direct - pmm_get_hhdm_offset()));
+    if (odd)
+      kfree(odd);
+
+    int flushed = block_flush(dev);
+
+    klog_puts("       ");
+    klog_puts(dev->name);
+    klog_puts(ok ? ": read OK" : ": read FAIL");
+    if (dev->flush)
+      klog_puts(flushed == 0 ? ", flush OK" : ", flush FAIL");
+    klog_puts(", bounced ");
+    uint64_t bounced = 0;
+    for (uint16_t i = 0; i < blk->nr_queues; i++)
+      bounced += blk->queues[i]->bounced;
+    klog_uint64(bounced);
+    klog_puts("\n");
+  }
+}
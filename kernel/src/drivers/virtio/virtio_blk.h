@@ -0,0 +1,132 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include "drivers/storage/block.h"
+#include "drivers/virtio/virtio.h"
+#include "drivers/virtio/virtio_pci.h"
+#include "lock/spinlock.h"
+#include "sched/wait.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// ── VirtIO Block Feature Bits (§5.2.3) ──────────────────────────────────────
+#define VIRTIO_BLK_F_SIZE_MAX (1ULL << 1) // size_max is valid
+#define VIRTIO_BLK_F_SEG_MAX (1ULL << 2)  // seg_max is valid
+#define VIRTIO_BLK_F_RO (1ULL << 5)       // Device is read-only
+#define VIRTIO_BLK_F_BLK_SIZE (1ULL << 6) // blk_size is valid
+#define VIRTIO_BLK_F_FLUSH (1ULL << 9)    // Cache flush command
+#define VIRTIO_BLK_F_MQ (1ULL << 12)      // num_queues is valid
+
+// ── Request Types and Status (§5.2.6) ───────────────────────────────────────
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+// ── Device Configuration Layout (§5.2.4) ────────────────────────────────────
+struct virtio_blk_config {
+  uint64_t capacity; // In 512-byte sectors
+  uint32_t size_max; // Largest single segment (F_SIZE_MAX)
+  uint32_t seg_max;  // Segments per request (F_SEG_MAX)
+  struct {
+    uint16_t cylinders;
+    uint8_t heads;
+    uint8_t sectors;
+  } geometry;
+  uint32_t blk_size; // Optimal logical block size (F_BLK_SIZE)
+  struct {
+    uint8_t physical_block_exp;
+    uint8_t alignment_offset;
+    uint16_t min_io_size;
+    uint32_t opt_io_size;
+  } topology;
+  uint8_t writeback;
+  uint8_t unused0;
+  uint16_t num_queues; // Request queues (F_MQ)
+} __attribute__((packed));
+
+// Device-readable header in front of every request
+struct virtio_blk_outhdr {
+  uint32_t type; // VIRTIO_BLK_T_*
+  uint32_t reserved;
+  uint64_t sector;
+} __attribute__((packed));
+
+// ── Driver limits ───────────────────────────────────────────────────────────
+#define VIRTIO_BLK_MAX_DEVICES 4
+#define VIRTIO_BLK_MAX_QUEUES 16
+#define VIRTIO_BLK_QUEUE_DEPTH 64  // Requests in flight per queue
+#define VIRTIO_BLK_SECTOR_SIZE 512 // Request sectors are always 512 bytes
+
+// Data descriptors per request. With indirect descriptors the header, data
+// and status descriptors of a request share one 1 KiB table and take a
+// single ring slot; without, they are chained in the ring itself and the
+// request gets fewer segments so that a full queue still fits.
+#define VIRTIO_BLK_MAX_SEGS 60
+#define VIRTIO_BLK_DIRECT_SEGS 6
+
+// Per-request DMA area: indirect table, header and status byte
+struct virtio_blk_dma {
+  struct virtq_desc table[VIRTIO_BLK_MAX_SEGS + 2];
+  struct virtio_blk_outhdr hdr;
+  volatile uint8_t status;
+  uint8_t pad[15];
+} __attribute__((packed, aligned(16)));
+
+// A slot is busy while it has an rq or a flush waiter (done)
+struct virtio_blk_slot {
+  struct request *rq;     // NULL for flushes
+  completion_t *done;     // Flush waiter
+  int *result;            // Flush status out
+  bool direct;            // Data descriptors point at the request's pages
+  uint16_t nr_data;       // Data descriptors (direct)
+  void *bounce;           // Physical; used when the data was not mappable
+  size_t bounce_pages;
+  uint32_t done_sectors;  // Bounced requests go out in chunks
+  uint32_t xfer_sectors;  // Sectors of the chunk in flight
+};
+
+struct virtio_blk_device;
+
+struct virtio_blk_queue {
+  struct virtio_blk_device *blk;
+  spinlock_t lock;
+  uint16_t index;      // Device queue number
+  struct virtqueue vq;
+  int vector;          // MSI vector, -1 if completions are polled
+  uint32_t cpu;
+  uint16_t depth;
+  struct virtio_blk_slot slots[VIRTIO_BLK_QUEUE_DEPTH];
+  uint16_t free_slots[VIRTIO_BLK_QUEUE_DEPTH];
+  uint16_t nr_free;
+  uint8_t head_slot[VIRTQ_MAX_SIZE]; // Ring head -> slot
+  struct virtio_blk_dma *dma;        // depth entries (virtual)
+  uint64_t dma_phys;
+  uint64_t requests;
+  uint64_t interrupts;
+  uint64_t bounced;
+};
+
+struct virtio_blk_device {
+  struct virtio_pci_device vdev;
+  struct block_device bdev;
+  uint64_t features;     // Negotiated
+  bool indirect;
+  uint32_t max_segs;     // Data segments per request
+  uint32_t size_max;     // Bytes per segment, 0: no limit
+  uint32_t bounce_sectors; // Largest chunk sent through a bounce buffer
+  uint16_t nr_queues;
+  struct virtio_blk_queue *queues[VIRTIO_BLK_MAX_QUEUES];
+};
+
+// Find every virtio-blk PCI function and register it as vda, vdb, ...
+// Returns the number of devices brought up.
+int virtio_blk_init(void);
+
+// Read-back and flush test on each device (non-destructive).
+void virtio_blk_self_test(void);
+
+#endif
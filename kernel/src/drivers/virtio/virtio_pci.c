@@ -1,6 +1,7 @@
 #include "drivers/virtio/virtio_pci.h"
 #include "drivers/virtio/virtio.h"
 #include "drivers/pci/pci.h"
+#include "cpu/irq.h"
 #include "mm/pmm.h"
 #include "mm/vmm.h"
 #include "mm/heap.h"
@@ -295,6 +296,14 @@ void virtio_pci_reset(struct virtio_pci_device *vdev) {
 bool virtio_pci_setup_queue(struct virtio_pci_device *vdev,
                             uint16_t queue_index,
                             struct virtqueue *vq) {
+  uint16_t entry = VIRTIO_MSI_NO_VECTOR; // Use ISR polling
+  return virtio_pci_setup_queue_msix(vdev, queue_index, vq, &entry);
+}
+
+bool virtio_pci_setup_queue_msix(struct virtio_pci_device *vdev,
+                                 uint16_t queue_index,
+                                 struct virtqueue *vq,
+                                 uint16_t *msix_entry) {
   volatile struct virtio_pci_common_cfg *cfg = vdev->common;
 
   // Select the queue
@@ -338,9 +347,15 @@ bool virtio_pci_setup_queue(struct virtio_pci_device *vdev,
                                            notify_off *
                                                vdev->notify_off_multiplier);
 
-  // Disable MSI-X for this queue (use ISR polling)
-  cfg->queue_msix_vector = 0xFFFF;
+  // Route the queue to its MSI-X entry. The device answers a vector it
+  // cannot allocate by reading back NO_VECTOR.
+  cfg->queue_msix_vector = *msix_entry;
   __asm__ volatile("" ::: "memory");
+  if (*msix_entry != VIRTIO_MSI_NO_VECTOR) {
+    *msix_entry = cfg->queue_msix_vector;
+    if (*msix_entry == VIRTIO_MSI_NO_VECTOR)
+      klog_puts("[VIRTIO-PCI] Device refused MSI-X vector, queue polled\n");
+  }
 
   // Enable the queue
   cfg->queue_enable = 1;
@@ -357,6 +372,62 @@ bool virtio_pci_setup_queue(struct virtio_pci_device *vdev,
   return true;
 }
 
+// ── MSI-X ───────────────────────────────────────────────────────────────────
+// Table entries are 16 bytes: address low/high, data, vector control.
+
+uint16_t virtio_pci_enable_msix(struct virtio_pci_device *vdev) {
+  struct pci_device *pci = vdev->pci;
+  uint8_t cap = pci_find_capability(pci, 0x11); // MSI-X
+  if (!cap)
+    return 0;
+
+  uint16_t msg_ctrl = pci_config_read16(pci->bus, pci->slot, pci->func,
+                                        cap + 2);
+  uint32_t table_reg = pci_config_read32(pci->bus, pci->slot, pci->func,
+                                         cap + 4);
+  uint8_t bir = table_reg & 0x7;
+  uint32_t bar_lo = pci->bar[bir];
+  if (bar_lo & 1)
+    return 0; // I/O BAR: not usable for the table
+
+  uint64_t bar_phys = bar_lo & 0xFFFFFFF0;
+  if (((bar_lo >> 1) & 3) == 2 && bir < 5)
+    bar_phys |= ((uint64_t)pci->bar[bir + 1] << 32);
+
+  uint16_t entries = (msg_ctrl & 0x7FF) + 1;
+  uint64_t table_phys = bar_phys + (table_reg & ~0x7U);
+  uint64_t hhdm = pmm_get_hhdm_offset();
+  uint64_t end = table_phys + (uint64_t)entries * 16;
+  for (uint64_t page = table_phys & ~0xFFFULL; page < end; page += 0x1000)
+    vmm_map_page(vmm_get_active_pml4(), page + hhdm, page,
+                 PAGE_FLAG_PRESENT | PAGE_FLAG_RW | (1ULL << 3) | (1ULL << 4));
+
+  vdev->msix_table = (volatile uint32_t *)(table_phys + hhdm);
+  vdev->msix_entries = entries;
+  for (uint16_t i = 0; i < entries; i++)
+    vdev->msix_table[i * 4 + 3] = 1; // Masked until routed
+
+  pci_config_write16(pci->bus, pci->slot, pci->func, cap + 2,
+                     msg_ctrl | 0x8000);
+
+  // Configuration change interrupts are not used
+  vdev->common->msix_config = VIRTIO_MSI_NO_VECTOR;
+  __asm__ volatile("" ::: "memory");
+  return entries;
+}
+
+void virtio_pci_route_msix(struct virtio_pci_device *vdev, uint16_t entry,
+                           uint8_t vector, uint32_t apic_id) {
+  if (!vdev->msix_table || entry >= vdev->msix_entries)
+    return;
+  volatile uint32_t *e = &vdev->msix_table[entry * 4];
+  e[0] = irq_msi_address(apic_id);
+  e[1] = 0;
+  e[2] = vector;
+  __asm__ volatile("" ::: "memory");
+  e[3] = 0; // Unmask
+}
+
 void virtio_pci_notify(struct virtio_pci_device *vdev, uint16_t queue_index,
                        struct virtqueue *vq) {
   (void)vdev;
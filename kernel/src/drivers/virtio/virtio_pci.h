@@ -14,6 +14,7 @@
 #define VIRTIO_PCI_DEVICE_GPU_LEGACY    0x1010
 
 // Modern (non-transitional) device IDs (0x1040+)
+#define VIRTIO_PCI_DEVICE_BLK_MODERN    0x1042
 #define VIRTIO_PCI_DEVICE_GPU           0x1050
 
 // ── PCI Capability Types (§4.1.4) ───────────────────────────────────────────
@@ -46,6 +47,10 @@ struct virtio_pci_common_cfg {
   uint64_t queue_used;              // RW — physical address
 } __attribute__((packed));
 
+// Written to msix_config / queue_msix_vector: no interrupt for this source.
+// The device also reads it back there when it could not allocate a vector.
+#define VIRTIO_MSI_NO_VECTOR            0xFFFF
+
 // ── Notify Configuration (§4.1.4.4) ────────────────────────────────────────
 // The notify_off_multiplier comes from the capability itself (extra field).
 // The actual notify address for queue q = notify_base + queue_notify_off * multiplier.
@@ -80,6 +85,10 @@ struct virtio_pci_device {
   // BAR virtual base addresses (cached for offset calculations)
   uint64_t bar_virt[6];
   uint64_t bar_size[6];
+
+  // MSI-X table, once virtio_pci_enable_msix() succeeded
+  volatile uint32_t *msix_table;
+  uint16_t msix_entries;
 };
 
 // ── VirtIO PCI Transport API ────────────────────────────────────────────────
@@ -107,6 +116,24 @@ bool virtio_pci_setup_queue(struct virtio_pci_device *vdev,
                             uint16_t queue_index,
                             struct virtqueue *vq);
 
+// Same, but route the queue's interrupts to MSI-X table entry *msix_entry
+// (VIRTIO_MSI_NO_VECTOR for none). On return *msix_entry holds what the
+// device accepted, which is VIRTIO_MSI_NO_VECTOR if it ran out of vectors.
+bool virtio_pci_setup_queue_msix(struct virtio_pci_device *vdev,
+                                 uint16_t queue_index,
+                                 struct virtqueue *vq,
+                                 uint16_t *msix_entry);
+
+// Map the MSI-X table, mask every entry and enable MSI-X. Must be called
+// before queues are given vectors. Returns the number of table entries, or
+// 0 if the device has no MSI-X capability.
+uint16_t virtio_pci_enable_msix(struct virtio_pci_device *vdev);
+
+// Deliver MSI-X table entry 'entry' as 'vector' to the CPU with apic_id,
+// and unmask it.
+void virtio_pci_route_msix(struct virtio_pci_device *vdev, uint16_t entry,
+                           uint8_t vector, uint32_t apic_id);
+
 // Notify the device that new buffers are available on queue queue_index.
 void virtio_pci_notify(struct virtio_pci_device *vdev, uint16_t queue_index,
                        struct virtqueue *vq);
@@ -257,7 +257,7 @@ void fb_copy_to_backbuffer(void) {
 
 // ── /dev/fb0 VFS node ────────────────────────────────────────────────────────
 
-static uint32_t fb_vfs_write(struct vfs_node *node, uint32_t offset,
+static uint32_t fb_vfs_write(struct vfs_node *node, uint64_t offset,
                              uint32_t size, uint8_t *buffer) {
   (void)node;
   if (!fb || !backbuffer)
@@ -403,7 +403,7 @@ static uint64_t fb_vfs_mmap(struct vfs_node *node, uint64_t addr,
   return vaddr + phys_offset;
 }
 
-static uint32_t fb_vfs_read(struct vfs_node *node, uint32_t offset,
+static uint32_t fb_vfs_read(struct vfs_node *node, uint64_t offset,
                             uint32_t size, uint8_t *buffer) {
   (void)node;
   if (!fb || !backbuffer)
@@ -438,7 +438,7 @@ static void console_vfs_open(vfs_node_t *node) {
 }
 static void console_vfs_close(vfs_node_t *node) { (void)node; }
 
-static uint32_t console_vfs_read(struct vfs_node *node, uint32_t offset,
+static uint32_t console_vfs_read(struct vfs_node *node, uint64_t offset,
                                  uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -558,7 +558,7 @@ static int console_vfs_poll(struct vfs_node *node, int events) {
 
 // Use console_write_batch so that each VFS write() call results in exactly
 // ONE backbuffer swap — eliminating per-character flicker for apps like kilo.
-static uint32_t console_vfs_write(struct vfs_node *node, uint32_t offset,
+static uint32_t console_vfs_write(struct vfs_node *node, uint64_t offset,
                                   uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -581,7 +581,7 @@ static uint32_t console_vfs_write(struct vfs_node *node, uint32_t offset,
 }
 
 // /dev/null - discard all writes, return EOF on read
-static uint32_t null_vfs_read(struct vfs_node *node, uint32_t offset,
+static uint32_t null_vfs_read(struct vfs_node *node, uint64_t offset,
                               uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -590,7 +590,7 @@ static uint32_t null_vfs_read(struct vfs_node *node, uint32_t offset,
   return 0; // EOF
 }
 
-static uint32_t null_vfs_write(struct vfs_node *node, uint32_t offset,
+static uint32_t null_vfs_write(struct vfs_node *node, uint64_t offset,
                                uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -599,7 +599,7 @@ static uint32_t null_vfs_write(struct vfs_node *node, uint32_t offset,
 }
 
 // /dev/zero - return zeros on read, discard writes
-static uint32_t zero_vfs_read(struct vfs_node *node, uint32_t offset,
+static uint32_t zero_vfs_read(struct vfs_node *node, uint64_t offset,
                               uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -607,7 +607,7 @@ static uint32_t zero_vfs_read(struct vfs_node *node, uint32_t offset,
   return size;
 }
 
-static uint32_t zero_vfs_write(struct vfs_node *node, uint32_t offset,
+static uint32_t zero_vfs_write(struct vfs_node *node, uint64_t offset,
                                uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -620,14 +620,14 @@ static uint32_t zero_vfs_write(struct vfs_node *node, uint32_t offset,
 // persisted to ext2
 static void setup_chardev(
     vfs_node_t *dev_dir, const char *name,
-    uint32_t (*read_fn)(struct vfs_node *, uint32_t, uint32_t, uint8_t *),
-    uint32_t (*write_fn)(struct vfs_node *, uint32_t, uint32_t, uint8_t *),
+    uint32_t (*read_fn)(struct vfs_node *, uint64_t, uint32_t, uint8_t *),
+    uint32_t (*write_fn)(struct vfs_node *, uint64_t, uint32_t, uint8_t *),
     void (*open_fn)(struct vfs_node *), void (*close_fn)(struct vfs_node *),
     int (*poll_fn)(struct vfs_node *, int),
     int (*ioctl_fn)(struct vfs_node *, uint32_t, uint64_t),
     uint64_t (*mmap_fn)(struct vfs_node *, uint64_t, uint64_t, uint64_t,
                         uint64_t, uint64_t),
-    void *device, uint32_t length) {
+    void *device, uint64_t length) {
 
   // Create virtual device node
   vfs_node_t *node = kmalloc(sizeof(vfs_node_t));
@@ -0,0 +1,276 @@
+#include "dcache.h"
+#include "../lib/list.h"
+#include "../lib/string.h"
+#include "../lock/spinlock.h"
+#include "../mm/heap.h"
+#include <stdbool.h>
+
+// ── Dentry cache ────────────────────────────────────────────────────────────
+// A dentry owns the node its lookup returned (a template that is never
+// handed out: callers get a copy from dcache_clone()), except for
+// persistent nodes, which are shared as they are. Path walks use the
+// template of each intermediate directory directly while holding a
+// reference on its dentry, so a warm walk neither allocates nor reads the
+// disk.
+//
+// All hashed dentries sit on one LRU list; reclaim skips the ones a walk
+// still holds. An invalidated dentry that is in use is unhashed and freed
+// by its last dcache_put(). Every invalidation bumps dcache_seq: a lookup
+// that raced with one does not insert its (possibly stale) result.
+
+#define DCACHE_HASH_BUCKETS 512
+#define DCACHE_MAX 1024
+
+struct dentry {
+  void *dir_fs; // Parent directory: filesystem and inode
+  uint32_t dir_ino;
+  uint32_t hash;
+  char name[DCACHE_NAME_LEN];
+  vfs_node_t *node; // NULL: negative entry
+  uint32_t refs;    // Walks using node right now
+  bool hashed;
+  struct dentry *hash_next;
+  struct list_head lru;
+};
+
+static spinlock_t dcache_lock = SPINLOCK_INIT;
+static struct dentry *dcache_hash[DCACHE_HASH_BUCKETS];
+static struct list_head dcache_lru = {&dcache_lru, &dcache_lru};
+static uint64_t dcache_seq = 0;
+static struct dcache_stats stats;
+
+static uint32_t dcache_hash_key(void *fs, uint32_t ino, const char *name) {
+  // FNV-1a over the name, seeded with the parent
+  uint32_t h = 2166136261u ^ ino ^ (uint32_t)((uint64_t)fs >> 4);
+  while (*name) {
+    h ^= (uint8_t)*name++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static struct dentry *dcache_find(void *fs, uint32_t ino, const char *name,
+                                  uint32_t hash) {
+  struct dentry *d = dcache_hash[hash % DCACHE_HASH_BUCKETS];
+  while (d) {
+    if (d->hash == hash && d->dir_ino == ino && d->dir_fs == fs &&
+        strcmp(d->name, name) == 0)
+      return d;
+    d = d->hash_next;
+  }
+  return NULL;
+}
+
+// Remove d from the hash and the LRU. Caller holds dcache_lock.
+static void dcache_unhash(struct dentry *d) {
+  struct dentry **pp = &dcache_hash[d->hash % DCACHE_HASH_BUCKETS];
+  while (*pp && *pp != d)
+    pp = &(*pp)->hash_next;
+  if (*pp)
+    *pp = d->hash_next;
+  d->hash_next = NULL;
+  d->hashed = false;
+  list_del(&d->lru);
+  stats.entries--;
+}
+
+// Releasing the node may call into the filesystem: never under dcache_lock.
+static void dcache_free(struct dentry *d) {
+  vfs_node_t *node = d->node;
+  if (node && !(node->flags & FS_PERSISTENT)) {
+    if (node->close)
+      node->close(node);
+    kfree(node);
+  }
+  kfree(d);
+}
+
+static void dcache_free_list(struct dentry *list) {
+  while (list) {
+    struct dentry *next = list->hash_next;
+    dcache_free(list);
+    list = next;
+  }
+}
+
+// Unhash d. Returns true if nobody holds it and the caller must free it;
+// otherwise the last dcache_put() does. Caller holds dcache_lock.
+static bool dcache_kill(struct dentry *d) {
+  dcache_unhash(d);
+  return d->refs == 0;
+}
+
+// Trim the cache back under DCACHE_MAX from the cold end of the LRU.
+// Returns the unhashed dentries, chained through hash_next.
+static struct dentry *dcache_shrink_locked(void) {
+  struct dentry *victims = NULL;
+  struct list_head *pos, *n;
+  list_for_each_safe(pos, n, &dcache_lru) {
+    if (stats.entries <= DCACHE_MAX)
+      break;
+    struct dentry *d = list_entry(pos, struct dentry, lru);
+    if (d->refs)
+      continue;
+    dcache_unhash(d);
+    d->hash_next = victims;
+    victims = d;
+    stats.evictions++;
+  }
+  return victims;
+}
+
+vfs_node_t *dcache_lookup(vfs_node_t *dir, char *name, struct dentry **dp) {
+  *dp = NULL;
+  if (!dir->revalidate || (dir->flags & FS_TYPE_MASK) != FS_DIRECTORY ||
+      strlen(name) >= DCACHE_NAME_LEN)
+    return vfs_finddir(dir, name);
+
+  uint32_t hash = dcache_hash_key(dir->device, dir->inode, name);
+
+  spinlock_acquire(&dcache_lock);
+  struct dentry *d = dcache_find(dir->device, dir->inode, name, hash);
+  if (d) {
+    list_del(&d->lru);
+    list_add_tail(&d->lru, &dcache_lru);
+    if (!d->node) {
+      stats.negative_hits++;
+      spinlock_release(&dcache_lock);
+      return NULL;
+    }
+    d->refs++;
+    stats.hits++;
+    spinlock_release(&dcache_lock);
+    *dp = d;
+    return d->node;
+  }
+  stats.misses++;
+  uint64_t seq = dcache_seq;
+  spinlock_release(&dcache_lock);
+
+  vfs_node_t *node = vfs_finddir(dir, name);
+
+  d = kmalloc(sizeof(struct dentry));
+  if (!d)
+    return node;
+  memset(d, 0, sizeof(struct dentry));
+  d->dir_fs = dir->device;
+  d->dir_ino = dir->inode;
+  d->hash = hash;
+  strcpy(d->name, name);
+  d->node = node;
+  d->refs = node ? 1 : 0;
+
+  spinlock_acquire(&dcache_lock);
+  if (seq != dcache_seq ||
+      dcache_find(dir->device, dir->inode, name, hash)) {
+    // Invalidated meanwhile, or another walk got here first: the result
+    // stays uncached and the caller keeps the node.
+    spinlock_release(&dcache_lock);
+    kfree(d);
+    return node;
+  }
+  struct dentry **bucket = &dcache_hash[hash % DCACHE_HASH_BUCKETS];
+  d->hash_next = *bucket;
+  *bucket = d;
+  d->hashed = true;
+  list_add_tail(&d->lru, &dcache_lru);
+  stats.entries++;
+  struct dentry *victims = NULL;
+  if (stats.entries > DCACHE_MAX)
+    victims = dcache_shrink_locked();
+  spinlock_release(&dcache_lock);
+
+  dcache_free_list(victims);
+  if (!node)
+    return NULL;
+  *dp = d;
+  return node;
+}
+
+void dcache_put(struct dentry *d) {
+  if (!d)
+    return;
+  spinlock_acquire(&dcache_lock);
+  bool dead = --d->refs == 0 && !d->hashed;
+  spinlock_release(&dcache_lock);
+  if (dead)
+    dcache_free(d);
+}
+
+vfs_node_t *dcache_clone(struct dentry *d) {
+  vfs_node_t *src = d->node;
+  if (src->flags & FS_PERSISTENT)
+    return src;
+
+  vfs_node_t *node = kmalloc(sizeof(vfs_node_t));
+  if (!node)
+    return NULL;
+  memcpy(node, src, sizeof(vfs_node_t));
+  // The copy takes its own in-core inode reference when it needs one
+  node->fs_inode = NULL;
+  node->refcount = 0;
+  INIT_LIST_HEAD(&node->ep_watchers);
+  spinlock_init(&node->ep_lock);
+  memset(&node->ra, 0, sizeof(node->ra));
+
+  if (node->revalidate && node->revalidate(node) != 0) {
+    kfree(node);
+    // Stale: the file went away behind the VFS's back. The caller still
+    // holds d, its dcache_put() frees it.
+    spinlock_acquire(&dcache_lock);
+    if (d->hashed)
+      dcache_unhash(d);
+    dcache_seq++;
+    spinlock_release(&dcache_lock);
+    return NULL;
+  }
+  return node;
+}
+
+void dcache_invalidate(vfs_node_t *dir, const char *name) {
+  if (!dir || !dir->revalidate || strlen(name) >= DCACHE_NAME_LEN)
+    return;
+  uint32_t hash = dcache_hash_key(dir->device, dir->inode, name);
+
+  spinlock_acquire(&dcache_lock);
+  dcache_seq++;
+  struct dentry *d = dcache_find(dir->device, dir->inode, name, hash);
+  bool free_it = d && dcache_kill(d);
+  spinlock_release(&dcache_lock);
+  if (free_it)
+    dcache_free(d);
+}
+
+// Unhash every entry of fs (all entries if fs is NULL).
+static void dcache_prune(void *fs) {
+  struct dentry *victims = NULL;
+
+  spinlock_acquire(&dcache_lock);
+  dcache_seq++;
+  struct list_head *pos, *n;
+  list_for_each_safe(pos, n, &dcache_lru) {
+    struct dentry *d = list_entry(pos, struct dentry, lru);
+    if (fs && d->dir_fs != fs)
+      continue;
+    if (dcache_kill(d)) {
+      d->hash_next = victims;
+      victims = d;
+    }
+  }
+  spinlock_release(&dcache_lock);
+
+  dcache_free_list(victims);
+}
+
+void dcache_invalidate_fs(void *fs) {
+  if (fs)
+    dcache_prune(fs);
+}
+
+void dcache_invalidate_all(void) { dcache_prune(NULL); }
+
+void dcache_get_stats(struct dcache_stats *out) {
+  spinlock_acquire(&dcache_lock);
+  *out = stats;
+  spinlock_release(&dcache_lock);
+}
@@ -0,0 +1,52 @@
+#ifndef FS_DCACHE_H
+#define FS_DCACHE_H
+
+#include "vfs.h"
+#include <stdint.h>
+
+// ── Dentry cache ────────────────────────────────────────────────────────────
+// Remembers the result of finddir(dir, name) for directories whose
+// filesystem provides a revalidate op, so that path walks stop reading
+// directory blocks for every component. Entries are keyed by the parent's
+// (filesystem, inode) pair and the name; a lookup that found nothing is
+// kept as a negative entry. The vfs_* namespace wrappers invalidate the
+// affected entries.
+
+#define DCACHE_NAME_LEN 64 // Longer names are never cached
+
+struct dentry;
+
+struct dcache_stats {
+  uint64_t entries;       // Dentries currently hashed
+  uint64_t hits;          // Lookups answered with a cached node
+  uint64_t negative_hits; // Lookups answered with a cached "no such file"
+  uint64_t misses;        // Lookups that went to the filesystem
+  uint64_t evictions;     // Dentries dropped by LRU reclaim
+};
+
+// Look up name in dir. Returns the child, or NULL if it does not exist.
+// When *dp is set the node belongs to the cache and stays valid until
+// dcache_put(*dp); otherwise the lookup was not cached and the node is the
+// same the filesystem's finddir returned.
+vfs_node_t *dcache_lookup(vfs_node_t *dir, char *name, struct dentry **dp);
+
+// Drop a reference taken by dcache_lookup(). NULL is ignored.
+void dcache_put(struct dentry *d);
+
+// A node the caller may keep for a cached lookup result: a refreshed copy,
+// or the node itself if it is persistent. NULL if the file is gone.
+vfs_node_t *dcache_clone(struct dentry *d);
+
+// Forget name in dir (it was created or removed).
+void dcache_invalidate(vfs_node_t *dir, const char *name);
+
+// Forget every entry below directories of filesystem fs (rename, rmdir).
+void dcache_invalidate_fs(void *fs);
+
+// Forget everything (mount).
+void dcache_invalidate_all(void);
+
+// Snapshot the dentry cache statistics.
+void dcache_get_stats(struct dcache_stats *out);
+
+#endif
@@ -4,18 +4,29 @@
 #include "ext3.h"
 #include "lib/string.h"
 #include "mm/heap.h"
+#include "mm/page_cache.h"
 #include "mm/pmm.h"
 #include "mm/vmm.h"
+#include "sched/wait.h"
 #include "syscalls/syscall.h"
 
 // ── Forward declarations ────────────────────────────────────────────────────
 
-static uint32_t ext2_read_impl(vfs_node_t *node, uint32_t offset, uint32_t size,
+static uint32_t ext2_read_impl(vfs_node_t *node, uint64_t offset, uint32_t size,
                                uint8_t *buffer);
-static uint32_t ext2_write_impl(vfs_node_t *node, uint32_t offset,
+static uint32_t ext2_write_impl(vfs_node_t *node, uint64_t offset,
                                 uint32_t size, uint8_t *buffer);
-static int ext2_truncate_impl(vfs_node_t *node, uint32_t new_len);
-static struct dirent *ext2_readdir_impl(vfs_node_t *node, uint32_t index);
+static int ext2_truncate_impl(vfs_node_t *node, uint64_t new_len);
+static int ext2_readpage_impl(vfs_node_t *node, uint32_t index, uint8_t *page);
+static int ext2_readpages_impl(vfs_node_t *node, uint32_t index, uint32_t nr,
+                               uint8_t **pages);
+static int ext2_writepages_impl(vfs_node_t *node, uint32_t index, uint32_t nr,
+                                uint8_t **pages);
+static int ext2_reserve_impl(vfs_node_t *node, uint32_t index);
+static void ext2_unreserve_impl(vfs_node_t *node, uint32_t nr);
+static int ext2_fsync_impl(vfs_node_t *node, bool datasync);
+static int ext2_readdir_impl(vfs_node_t *node, uint64_t *pos,
+                             struct dirent *buf, uint32_t count);
 static vfs_node_t *ext2_finddir_impl(vfs_node_t *node, char *name);
 static int ext2_create_impl(vfs_node_t *node, char *name, uint16_t permission);
 static int ext2_mkdir_impl(vfs_node_t *node, char *name, uint16_t permission);
@@ -65,42 +76,75 @@ int ext2_write_block(ext2_mount_t *mnt, uint32_t block_num,
 
 // ── Superblock / BGD persistence ────────────────────────────────────────────
 
+// Write the superblock through the buffer cache (logged in the running
+// ext3 transaction). It sits at byte offset 1024 whatever the block size.
 static int ext2_write_superblock(ext2_mount_t *mnt) {
-  // Superblock is always at byte offset 1024, spanning 1024 bytes.
-  uint8_t buf[1024];
-  // Read the sector(s) containing the superblock
-  int err = mnt->dev->read_sectors(mnt->dev, 2, 2, buf);
-  if (err)
-    return -1;
-  memcpy(buf, &mnt->sb, sizeof(ext2_superblock_t));
-  return ext3_journal_block(
-      mnt, 1, buf); // Superblock is at logical block 1 (offset 1024)
+  struct buffer_head *bh =
+      bread(mnt->dev, 1024 / mnt->block_size, mnt->block_size);
+  if (!bh)
+    return -1;
+  memcpy(bh->data + 1024 % mnt->block_size, &mnt->sb,
+         sizeof(ext2_superblock_t));
+  ext3_journal_dirty(mnt, bh);
+  brelse(bh);
+  return 0;
 }
 
-static int ext2_write_bgdt(ext2_mount_t *mnt) {
-  uint32_t bgdt_block = mnt->sb.s_first_data_block + 1;
-  uint32_t bgdt_size = mnt->groups_count * sizeof(ext2_bgd_t);
-  uint32_t blocks_needed = (bgdt_size + mnt->block_size - 1) / mnt->block_size;
-  uint8_t *tmp = kmalloc(blocks_needed * mnt->block_size);
-  if (!tmp)
-    return -1;
-  memset(tmp, 0, blocks_needed * mnt->block_size);
-  memcpy(tmp, mnt->bgdt, bgdt_size);
-  for (uint32_t i = 0; i < blocks_needed; i++) {
-    int err =
-        ext3_journal_block(mnt, bgdt_block + i, tmp + i * mnt->block_size);
-    if (err) {
-      kfree(tmp);
-      return -1;
-    }
-  }
-  kfree(tmp);
+// Write the descriptor of group through the buffer cache (logged in the
+// running ext3 transaction).
+static int ext2_write_group_desc(ext2_mount_t *mnt, uint32_t group) {
+  uint32_t per_block = mnt->block_size / sizeof(ext2_bgd_t);
+  uint32_t block = mnt->sb.s_first_data_block + 1 + group / per_block;
+  struct buffer_head *bh = bread(mnt->dev, block, mnt->block_size);
+  if (!bh)
+    return -1;
+  memcpy(bh->data + (group % per_block) * sizeof(ext2_bgd_t),
+         &mnt->bgdt[group], sizeof(ext2_bgd_t));
+  ext3_journal_dirty(mnt, bh);
+  brelse(bh);
   return 0;
 }
 
+// ── Metadata buffers ────────────────────────────────────────────────────────
+// Inode tables, bitmaps, indirect blocks and directory blocks live in the
+// block buffer cache. File data does not: it goes through the page cache and
+// ext2_read_block()/ext2_write_block().
+
+static struct buffer_head *ext2_bread(ext2_mount_t *mnt, uint32_t block_num) {
+  if (block_num == 0)
+    return NULL;
+  return bread(mnt->dev, block_num, mnt->block_size);
+}
+
+// For blocks that are about to be overwritten completely (fresh allocations).
+static struct buffer_head *ext2_getblk(ext2_mount_t *mnt, uint32_t block_num) {
+  if (block_num == 0)
+    return NULL;
+  return getblk(mnt->dev, block_num, mnt->block_size);
+}
+
+// Persist a modified metadata buffer: logged in the running ext3
+// transaction, otherwise left dirty for writeback.
+static void ext2_dirty_block(ext2_mount_t *mnt, struct buffer_head *bh) {
+  ext3_journal_dirty(mnt, bh);
+}
+
+// Allocate a block for metadata and return its zeroed buffer.
+static struct buffer_head *ext2_new_zero_block(ext2_mount_t *mnt,
+                                               uint32_t block_num) {
+  struct buffer_head *bh = ext2_getblk(mnt, block_num);
+  if (!bh)
+    return NULL;
+  memset(bh->data, 0, mnt->block_size);
+  ext2_dirty_block(mnt, bh);
+  return bh;
+}
+
 // ── Inode I/O ───────────────────────────────────────────────────────────────
 
-int ext2_read_inode(ext2_mount_t *mnt, uint32_t inode_num, ext2_inode_t *out) {
+// Locate the inode-table block holding inode_num and the byte offset in it.
+static int ext2_inode_location(ext2_mount_t *mnt, uint32_t inode_num,
+                               uint32_t *block, uint32_t *offset) {
   if (inode_num == 0)
     return -1;
   uint32_t group = (inode_num - 1) / mnt->inodes_per_group;
@@ -111,140 +155,704 @@ int ext2_read_inode(ext2_mount_t *mnt, uint32_t inode_num, ext2_inode_t *out) {
 
   uint32_t inode_table_block = mnt->bgdt[group].bg_inode_table;
   uint32_t byte_offset_in_table = index * mnt->inode_size;
-  uint32_t block_offset = byte_offset_in_table / mnt->block_size;
-  uint32_t offset_within_block = byte_offset_in_table % mnt->block_size;
+  *block = inode_table_block + byte_offset_in_table / mnt->block_size;
+  *offset = byte_offset_in_table % mnt->block_size;
+  return 0;
+}
 
-  uint8_t *block_buf = kmalloc(mnt->block_size);
-  if (!block_buf)
+// Copy inode_num out of the inode table (buffer cache).
+static int ext2_inode_fetch(ext2_mount_t *mnt, uint32_t inode_num,
+                            ext2_inode_t *out) {
+  uint32_t block, offset;
+  if (ext2_inode_location(mnt, inode_num, &block, &offset))
     return -1;
 
-  int err = ext2_read_block(mnt, inode_table_block + block_offset, block_buf);
-  if (err) {
-    kfree(block_buf);
+  struct buffer_head *bh = ext2_bread(mnt, block);
+  if (!bh)
     return -1;
-  }
-
-  memcpy(out, block_buf + offset_within_block, sizeof(ext2_inode_t));
-  kfree(block_buf);
+  memcpy(out, bh->data + offset, sizeof(ext2_inode_t));
+  brelse(bh);
   return 0;
 }
 
-static int ext2_write_inode(ext2_mount_t *mnt, uint32_t inode_num,
+static int ext2_inode_store(ext2_mount_t *mnt, uint32_t inode_num,
                             const ext2_inode_t *inode) {
-  if (inode_num == 0)
+  uint32_t block, offset;
+  if (ext2_inode_location(mnt, inode_num, &block, &offset))
     return -1;
-  uint32_t group = (inode_num - 1) / mnt->inodes_per_group;
-  uint32_t index = (inode_num - 1) % mnt->inodes_per_group;
 
-  if (group >= mnt->groups_count)
+  struct buffer_head *bh = ext2_bread(mnt, block);
+  if (!bh)
     return -1;
+  memcpy(bh->data + offset, inode, sizeof(ext2_inode_t));
+  ext2_dirty_block(mnt, bh);
+  brelse(bh);
+  return 0;
+}
 
-  uint32_t inode_table_block = mnt->bgdt[group].bg_inode_table;
-  uint32_t byte_offset_in_table = index * mnt->inode_size;
-  uint32_t block_offset = byte_offset_in_table / mnt->block_size;
-  uint32_t offset_within_block = byte_offset_in_table % mnt->block_size;
+// Regular files keep the upper 32 bits of their size in i_dir_acl
+// (i_size_high); directories and symlinks never reach 4 GiB.
+static uint64_t ext2_isize(const ext2_inode_t *inode) {
+  uint64_t size = inode->i_size;
+  if ((inode->i_mode & 0xF000) == EXT2_S_IFREG)
+    size |= (uint64_t)inode->i_dir_acl << 32;
+  return size;
+}
 
-  uint8_t *block_buf = kmalloc(mnt->block_size);
-  if (!block_buf)
-    return -1;
+// Largest regular file: what the block map addresses, no more than i_blocks
+// (32 bits of 512-byte sectors, indirect blocks included) can count, and
+// 2 GiB - 1 on revision 0 filesystems, which cannot record LARGE_FILE.
+static uint64_t ext2_max_size(ext2_mount_t *mnt) {
+  if (mnt->sb.s_rev_level == 0)
+    return 0x7FFFFFFFULL;
+  uint64_t bs = mnt->block_size;
+  uint64_t ptrs = bs / 4;
+  uint64_t mapped = EXT2_DIRECT_BLOCKS + ptrs + ptrs * ptrs;
+  mapped += ptrs * ptrs * ptrs;
+  uint64_t counted =
+      (0xFFFFFFFFULL / (bs / 512) - 3) * ptrs * ptrs / (ptrs * ptrs + ptrs + 1);
+  return (mapped < counted ? mapped : counted) * bs;
+}
 
-  int err = ext2_read_block(mnt, inode_table_block + block_offset, block_buf);
-  if (err) {
-    kfree(block_buf);
-    return -1;
+static void ext2_set_isize(ext2_mount_t *mnt, ext2_inode_t *inode,
+                           uint64_t size) {
+  inode->i_size = (uint32_t)size;
+  if ((inode->i_mode & 0xF000) != EXT2_S_IFREG)
+    return;
+  inode->i_dir_acl = (uint32_t)(size >> 32);
+  if (size > 0x7FFFFFFFULL &&
+      !(mnt->sb.s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+    spinlock_acquire(&mnt->alloc_lock);
+    mnt->sb.s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+    mnt->sb_dirty = true;
+    spinlock_release(&mnt->alloc_lock);
   }
+}
 
-  memcpy(block_buf + offset_within_block, inode, sizeof(ext2_inode_t));
+// ── Inode cache ─────────────────────────────────────────────────────────────
+// In-core inodes are hashed by number per mount. A VFS node references its
+// inode (node->fs_inode) until it is closed; unreferenced inodes stay cached
+// on an LRU list, up to EXT2_ICACHE_MAX per mount.
+//
+// Updates through an open file (size, block map, times) are only made in
+// core and reach the inode table when the last reference goes or at sync.
+// ext2_write_inode() stays write-through for the metadata operations.
+
+static void ext2_icache_init(ext2_mount_t *mnt) {
+  spinlock_init(&mnt->icache_lock);
+  INIT_LIST_HEAD(&mnt->icache_lru);
+}
 
-  err = ext2_write_block(mnt, inode_table_block + block_offset, block_buf);
-  kfree(block_buf);
+static ext2_inode_info_t *ext2_icache_find(ext2_mount_t *mnt,
+                                           uint32_t inode_num) {
+  ext2_inode_info_t *ei = mnt->icache[inode_num & (EXT2_ICACHE_BUCKETS - 1)];
+  while (ei && ei->ino != inode_num)
+    ei = ei->hash_next;
+  return ei;
+}
+
+// Reference a cached inode (icache_lock held).
+static void ext2_icache_grab(ext2_mount_t *mnt, ext2_inode_info_t *ei) {
+  if (ei->refcount++ == 0) {
+    list_del(&ei->lru);
+    mnt->icache_unused--;
+  }
+}
+
+// Free the coldest unreferenced inodes beyond the cap (icache_lock held).
+// They are clean: the last iput wrote them back.
+static void ext2_icache_trim(ext2_mount_t *mnt) {
+  while (mnt->icache_unused > EXT2_ICACHE_MAX) {
+    ext2_inode_info_t *ei =
+        list_entry(mnt->icache_lru.prev, ext2_inode_info_t, lru);
+    ext2_inode_info_t **pp =
+        &mnt->icache[ei->ino & (EXT2_ICACHE_BUCKETS - 1)];
+    while (*pp && *pp != ei)
+      pp = &(*pp)->hash_next;
+    if (*pp)
+      *pp = ei->hash_next;
+    list_del(&ei->lru);
+    mnt->icache_unused--;
+    kfree(ei->extents);
+    kfree(ei);
+  }
+}
+
+ext2_inode_info_t *ext2_iget(ext2_mount_t *mnt, uint32_t inode_num) {
+  spinlock_acquire(&mnt->icache_lock);
+  ext2_inode_info_t *ei = ext2_icache_find(mnt, inode_num);
+  if (ei) {
+    ext2_icache_grab(mnt, ei);
+    spinlock_release(&mnt->icache_lock);
+    return ei;
+  }
+  spinlock_release(&mnt->icache_lock);
+
+  ext2_inode_info_t *fresh = kmalloc(sizeof(ext2_inode_info_t));
+  if (!fresh)
+    return NULL;
+  if (ext2_inode_fetch(mnt, inode_num, &fresh->raw)) {
+    kfree(fresh);
+    return NULL;
+  }
+  fresh->ino = inode_num;
+  fresh->refcount = 1;
+  fresh->dirty = false;
+  fresh->alloc_goal = 0;
+  spinlock_init(&fresh->map_lock);
+  fresh->extents = NULL;
+  fresh->nr_extents = 0;
+  fresh->extents_cap = 0;
+  fresh->map_seq = 0;
+  INIT_LIST_HEAD(&fresh->lru);
+
+  spinlock_acquire(&mnt->icache_lock);
+  ei = ext2_icache_find(mnt, inode_num);
+  if (ei) {
+    // Someone else read it meanwhile; theirs may already be newer
+    ext2_icache_grab(mnt, ei);
+    spinlock_release(&mnt->icache_lock);
+    kfree(fresh);
+    return ei;
+  }
+  uint32_t b = inode_num & (EXT2_ICACHE_BUCKETS - 1);
+  fresh->hash_next = mnt->icache[b];
+  mnt->icache[b] = fresh;
+  spinlock_release(&mnt->icache_lock);
+  return fresh;
+}
+
+void ext2_mark_inode_dirty(ext2_inode_info_t *ei) {
+  ei->dirty = true;
+}
+
+// Write ei (referenced by the caller) to the inode table, in a transaction
+// of its own unless one is already running.
+static int ext2_inode_writeback(ext2_mount_t *mnt, ext2_inode_info_t *ei) {
+  ext2_inode_t snap;
+  spinlock_acquire(&mnt->icache_lock);
+  memcpy(&snap, &ei->raw, sizeof(ext2_inode_t));
+  ei->dirty = false;
+  bool data_dirty = ei->data_dirty;
+  ei->data_dirty = false;
+  spinlock_release(&mnt->icache_lock);
+
+  bool own = ext3_journal_start(mnt) == 0;
+  int err = ext2_inode_store(mnt, ei->ino, &snap);
+  if (own)
+    ext3_journal_stop(mnt);
+  if (err) {
+    ei->dirty = true;
+    ei->data_dirty |= data_dirty;
+  }
   return err;
 }
 
-// ── Block Allocation / Deallocation ─────────────────────────────────────────
+void ext2_iput(ext2_mount_t *mnt, ext2_inode_info_t *ei) {
+  if (!ei)
+    return;
+  if (ei->dirty && ei->refcount == 1)
+    ext2_inode_writeback(mnt, ei);
+
+  spinlock_acquire(&mnt->icache_lock);
+  if (--ei->refcount == 0) {
+    list_add(&ei->lru, &mnt->icache_lru);
+    mnt->icache_unused++;
+    ext2_icache_trim(mnt);
+  }
+  spinlock_release(&mnt->icache_lock);
+}
+
+int ext2_sync_inodes(ext2_mount_t *mnt) {
+  int ret = 0;
+  if (mnt->sb_dirty) {
+    mnt->sb_dirty = false;
+    bool own = ext3_journal_start(mnt) == 0;
+    if (ext2_write_superblock(mnt)) {
+      mnt->sb_dirty = true;
+      ret = -1;
+    }
+    if (own)
+      ext3_journal_stop(mnt);
+  }
+  for (uint32_t b = 0; b < EXT2_ICACHE_BUCKETS; b++) {
+    while (1) {
+      spinlock_acquire(&mnt->icache_lock);
+      ext2_inode_info_t *ei = mnt->icache[b];
+      while (ei && !ei->dirty)
+        ei = ei->hash_next;
+      if (ei)
+        ext2_icache_grab(mnt, ei);
+      spinlock_release(&mnt->icache_lock);
+      if (!ei)
+        break;
+      int err = ext2_inode_writeback(mnt, ei);
+      ext2_iput(mnt, ei);
+      if (err) {
+        ret = -1;
+        break; // It stays dirty and would come up again
+      }
+    }
+  }
+  return ret;
+}
+
+// ── Block-map cache ─────────────────────────────────────────────────────────
+// Regular files remember where their blocks are as a sorted array of runs
+// (logical start, disk start, length). A sequential reader binary-searches
+// that array instead of walking up to three indirect blocks per data block.
+// A miss walks the tree once and records the longest run it finds from
+// there. Newly allocated blocks are added to the run they extend. Truncate,
+// and anything else that replaces the block map, drops the runs.
+
+static void ext2_map_clear(ext2_inode_info_t *ei) {
+  spinlock_acquire(&ei->map_lock);
+  kfree(ei->extents);
+  ei->extents = NULL;
+  ei->nr_extents = 0;
+  ei->extents_cap = 0;
+  ei->map_seq++;
+  spinlock_release(&ei->map_lock);
+}
+
+// Index of the first run that starts after logical (map_lock held).
+static uint32_t ext2_map_upper(ext2_inode_info_t *ei, uint32_t logical) {
+  uint32_t lo = 0, hi = ei->nr_extents;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (ei->extents[mid].logical <= logical)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Record [logical, logical + len) -> physical (map_lock held). Ranges that
+// overlap a known run are left alone; so is a full map.
+static void ext2_map_insert_locked(ext2_inode_info_t *ei, uint32_t logical,
+                                   uint32_t physical, uint32_t len) {
+  uint32_t pos = ext2_map_upper(ei, logical);
+  ext2_extent_t *prev = pos > 0 ? &ei->extents[pos - 1] : NULL;
+  ext2_extent_t *next = pos < ei->nr_extents ? &ei->extents[pos] : NULL;
+  if (prev && prev->logical + prev->len > logical)
+    return;
+  if (next && next->logical < logical + len)
+    return;
+
+  bool joins_prev = prev && prev->logical + prev->len == logical &&
+                    prev->physical + prev->len == physical;
+  bool joins_next = next && next->logical == logical + len &&
+                    next->physical == physical + len;
+  if (joins_prev) {
+    prev->len += len;
+    if (joins_next) {
+      prev->len += next->len;
+      memmove(next, next + 1,
+              (ei->nr_extents - pos - 1) * sizeof(ext2_extent_t));
+      ei->nr_extents--;
+    }
+    return;
+  }
+  if (joins_next) {
+    next->logical = logical;
+    next->physical = physical;
+    next->len += len;
+    return;
+  }
+
+  if (ei->nr_extents == ei->extents_cap) {
+    if (ei->extents_cap >= EXT2_EXTENT_MAX)
+      return;
+    uint32_t cap = ei->extents_cap ? ei->extents_cap * 2 : 8;
+    ext2_extent_t *grown = kmalloc(cap * sizeof(ext2_extent_t));
+    if (!grown)
+      return;
+    if (ei->nr_extents)
+      memcpy(grown, ei->extents, ei->nr_extents * sizeof(ext2_extent_t));
+    kfree(ei->extents);
+    ei->extents = grown;
+    ei->extents_cap = cap;
+  }
+  memmove(&ei->extents[pos + 1], &ei->extents[pos],
+          (ei->nr_extents - pos) * sizeof(ext2_extent_t));
+  ei->extents[pos].logical = logical;
+  ei->extents[pos].physical = physical;
+  ei->extents[pos].len = len;
+  ei->nr_extents++;
+}
+
+// A block was just mapped at logical.
+static void ext2_map_add(ext2_inode_info_t *ei, uint32_t logical,
+                         uint32_t physical) {
+  spinlock_acquire(&ei->map_lock);
+  ext2_map_insert_locked(ei, logical, physical, 1);
+  spinlock_release(&ei->map_lock);
+}
 
-// Allocate a free block from the filesystem. Returns block number or 0 on
-// failure.
-static uint32_t ext2_alloc_block(ext2_mount_t *mnt) {
-  ext3_journal_start(mnt);
-  uint8_t *bitmap = kmalloc(mnt->block_size);
-  if (!bitmap)
+// Disk block of logical block of ei's file, 0 for a hole. *run, if given,
+// is set to the number of blocks from logical on that follow it on disk.
+static uint32_t ext2_bmap(ext2_mount_t *mnt, ext2_inode_info_t *ei,
+                          uint32_t logical, uint32_t *run) {
+  spinlock_acquire(&ei->map_lock);
+  uint32_t pos = ext2_map_upper(ei, logical);
+  if (pos > 0) {
+    ext2_extent_t *e = &ei->extents[pos - 1];
+    if (logical < e->logical + e->len) {
+      uint32_t phys = e->physical + (logical - e->logical);
+      if (run)
+        *run = e->len - (logical - e->logical);
+      spinlock_release(&ei->map_lock);
+      return phys;
+    }
+  }
+  // Do not scan into the next known run
+  uint32_t limit = EXT2_EXTENT_SCAN;
+  if (pos < ei->nr_extents && ei->extents[pos].logical - logical < limit)
+    limit = ei->extents[pos].logical - logical;
+  uint32_t seq = ei->map_seq;
+  spinlock_release(&ei->map_lock);
+
+  uint32_t phys = ext2_get_block_num(mnt, &ei->raw, logical);
+  if (!phys) {
+    if (run)
+      *run = 0;
     return 0;
+  }
+  uint32_t file_blocks = (uint32_t)(
+      (ext2_isize(&ei->raw) + mnt->block_size - 1) / mnt->block_size);
+  uint32_t len = 1;
+  while (len < limit && logical + len < file_blocks &&
+         ext2_get_block_num(mnt, &ei->raw, logical + len) == phys + len)
+    len++;
+
+  spinlock_acquire(&ei->map_lock);
+  if (seq == ei->map_seq)
+    ext2_map_insert_locked(ei, logical, phys, len);
+  spinlock_release(&ei->map_lock);
+  if (run)
+    *run = len;
+  return phys;
+}
 
-  for (uint32_t g = 0; g < mnt->groups_count; g++) {
+// Inode ino was just allocated: a cached copy of its previous owner must
+// not pass on its allocation goal or block map.
+static void ext2_forget_layout(ext2_mount_t *mnt, uint32_t ino) {
+  spinlock_acquire(&mnt->icache_lock);
+  ext2_inode_info_t *ei = ext2_icache_find(mnt, ino);
+  if (ei) {
+    ei->alloc_goal = 0;
+    ext2_map_clear(ei);
+  }
+  spinlock_release(&mnt->icache_lock);
+}
+
+int ext2_read_inode(ext2_mount_t *mnt, uint32_t inode_num, ext2_inode_t *out) {
+  ext2_inode_info_t *ei = ext2_iget(mnt, inode_num);
+  if (!ei)
+    return -1;
+  memcpy(out, &ei->raw, sizeof(ext2_inode_t));
+  ext2_iput(mnt, ei);
+  return 0;
+}
+
+static int ext2_write_inode(ext2_mount_t *mnt, uint32_t inode_num,
+                            const ext2_inode_t *inode) {
+  ext2_inode_info_t *ei = ext2_iget(mnt, inode_num);
+  if (!ei)
+    return -1;
+  // A new block map (freed blocks, fresh inode) invalidates the runs
+  if (memcmp(ei->raw.i_block, inode->i_block, sizeof(inode->i_block)) != 0)
+    ext2_map_clear(ei);
+  memcpy(&ei->raw, inode, sizeof(ext2_inode_t));
+  int err = ext2_inode_store(mnt, inode_num, inode);
+  if (err == 0)
+    ei->dirty = false;
+  ext2_iput(mnt, ei);
+  return err;
+}
+
+// ── Block / Inode Allocation ────────────────────────────────────────────────
+// Both allocators search the group bitmaps a 64-bit word at a time. Blocks
+// go next to a goal (the block after the inode's previous one, else the
+// start of the inode's group) so that files stay contiguous. New inodes go
+// to their parent's group; directories are spread the Orlov way: top-level
+// ones over groups with plenty of free space, deeper ones near their
+// parent until that group holds more than its share of directories.
+//
+// Free counts reach the group descriptor with each change; the superblock
+// copy is only written by ext2_sync_inodes().
+
+// Number of blocks in group (the last group may be short).
+static uint32_t ext2_group_blocks(ext2_mount_t *mnt, uint32_t group) {
+  uint32_t blocks = mnt->sb.s_blocks_per_group;
+  if (group == mnt->groups_count - 1) {
+    uint32_t remaining = mnt->sb.s_blocks_count - mnt->sb.s_first_data_block -
+                         group * mnt->sb.s_blocks_per_group;
+    if (remaining < blocks)
+      blocks = remaining;
+  }
+  return blocks;
+}
+
+// First clear bit in [start, nbits) of map, or nbits if there is none.
+static uint32_t ext2_find_zero_bit(const uint8_t *map, uint32_t nbits,
+                                   uint32_t start) {
+  if (start >= nbits)
+    return nbits;
+  const uint64_t *words = (const uint64_t *)map;
+  uint32_t nwords = (nbits + 63) / 64;
+  uint32_t w = start / 64;
+  uint64_t free = ~words[w] & (~0ULL << (start % 64));
+  while (!free) {
+    if (++w >= nwords)
+      return nbits;
+    free = ~words[w];
+  }
+  uint32_t bit = w * 64 + (uint32_t)__builtin_ctzll(free);
+  return bit < nbits ? bit : nbits;
+}
+
+// The bitmap buffer of group, read and pinned on first use.
+static struct buffer_head *ext2_group_bitmap(ext2_mount_t *mnt, uint32_t group,
+                                             bool inodes) {
+  ext2_group_info_t *gi = &mnt->groups[group];
+  struct buffer_head **slot = inodes ? &gi->inode_bitmap : &gi->block_bitmap;
+  if (*slot)
+    return *slot;
+
+  uint32_t block = inodes ? mnt->bgdt[group].bg_inode_bitmap
+                          : mnt->bgdt[group].bg_block_bitmap;
+  struct buffer_head *bh = bread(mnt->dev, block, mnt->block_size);
+  if (!bh)
+    return NULL;
+
+  spinlock_acquire(&mnt->alloc_lock);
+  if (*slot) {
+    // Raced with another allocator: keep its pin
+    spinlock_release(&mnt->alloc_lock);
+    brelse(bh);
+    return *slot;
+  }
+  *slot = bh;
+  spinlock_release(&mnt->alloc_lock);
+  return bh;
+}
+
+// Allocate a free block, as close after goal as possible. Returns the block
+// number or 0 if the filesystem is full. Blocks held for dirty delalloc
+// pages (reserved_blocks) count as full unless reserved is set, which only
+// writeback of those pages does.
+static uint32_t ext2_alloc_block_from(ext2_mount_t *mnt, uint32_t goal,
+                                      bool reserved) {
+  uint32_t first = mnt->sb.s_first_data_block;
+  if (goal < first || goal >= mnt->sb.s_blocks_count)
+    goal = first;
+  uint32_t goal_group = (goal - first) / mnt->sb.s_blocks_per_group;
+  uint32_t goal_bit = (goal - first) % mnt->sb.s_blocks_per_group;
+
+  bool own = ext3_journal_start(mnt) == 0;
+
+  // Goal group from the goal on, the other groups, then the goal group's
+  // blocks before the goal.
+  for (uint32_t i = 0; i <= mnt->groups_count; i++) {
+    uint32_t g = (goal_group + i) % mnt->groups_count;
     if (mnt->bgdt[g].bg_free_blocks_count == 0)
       continue;
+    struct buffer_head *bh = ext2_group_bitmap(mnt, g, false);
+    if (!bh)
+      continue;
 
-    ext2_read_block(mnt, mnt->bgdt[g].bg_block_bitmap, bitmap);
-
-    uint32_t blocks_in_group = mnt->sb.s_blocks_per_group;
-    // Last group may have fewer blocks
-    if (g == mnt->groups_count - 1) {
-      uint32_t remaining =
-          mnt->sb.s_blocks_count - (g * mnt->sb.s_blocks_per_group);
-      if (remaining < blocks_in_group)
-        blocks_in_group = remaining;
+    uint32_t nbits = ext2_group_blocks(mnt, g);
+    uint32_t from = i == 0 ? goal_bit : 0;
+    spinlock_acquire(&mnt->alloc_lock);
+    if (!reserved && mnt->sb.s_free_blocks_count <= mnt->reserved_blocks) {
+      spinlock_release(&mnt->alloc_lock);
+      break; // The rest is promised to dirty pages
     }
-
-    for (uint32_t b = 0; b < blocks_in_group; b++) {
-      uint32_t byte_idx = b / 8;
-      uint8_t bit_mask = 1 << (b % 8);
-      if (!(bitmap[byte_idx] & bit_mask)) {
-        // Found a free block — mark it used
-        bitmap[byte_idx] |= bit_mask;
-        ext3_journal_block(mnt, mnt->bgdt[g].bg_block_bitmap, bitmap);
-
-        mnt->bgdt[g].bg_free_blocks_count--;
-        mnt->sb.s_free_blocks_count--;
-        ext2_write_bgdt(mnt);
-        ext2_write_superblock(mnt);
-
-        ext3_journal_stop(mnt);
-        kfree(bitmap);
-        return g * mnt->sb.s_blocks_per_group + b + mnt->sb.s_first_data_block;
-      }
+    uint32_t bit = ext2_find_zero_bit(bh->data, nbits, from);
+    if (bit == nbits) {
+      spinlock_release(&mnt->alloc_lock);
+      continue;
     }
+    bh->data[bit / 8] |= 1 << (bit % 8);
+    mnt->bgdt[g].bg_free_blocks_count--;
+    mnt->sb.s_free_blocks_count--;
+    mnt->sb_dirty = true;
+    spinlock_release(&mnt->alloc_lock);
+
+    ext3_journal_dirty(mnt, bh);
+    ext2_write_group_desc(mnt, g);
+    if (own)
+      ext3_journal_stop(mnt);
+    return first + g * mnt->sb.s_blocks_per_group + bit;
   }
 
-  ext3_journal_stop(mnt);
-  kfree(bitmap);
+  if (own)
+    ext3_journal_stop(mnt);
   return 0; // No free blocks
 }
 
-// Allocate a free inode. Returns inode number or 0 on failure.
-static uint32_t ext2_alloc_inode(ext2_mount_t *mnt) {
-  ext3_journal_start(mnt);
-  uint8_t *bitmap = kmalloc(mnt->block_size);
-  if (!bitmap)
-    return 0;
+static uint32_t ext2_alloc_block(ext2_mount_t *mnt, uint32_t goal) {
+  return ext2_alloc_block_from(mnt, goal, false);
+}
 
-  for (uint32_t g = 0; g < mnt->groups_count; g++) {
-    if (mnt->bgdt[g].bg_free_inodes_count == 0)
-      continue;
+// Where the next block of inode ino goes: after the block mapped at
+// logical_block - 1 if there is one, else at the start of the inode's group.
+static uint32_t ext2_block_goal(ext2_mount_t *mnt, uint32_t ino,
+                                ext2_inode_t *inode, uint32_t logical_block) {
+  if (inode && logical_block > 0) {
+    uint32_t prev = ext2_get_block_num(mnt, inode, logical_block - 1);
+    if (prev)
+      return prev + 1;
+  }
+  uint32_t group = (ino - 1) / mnt->inodes_per_group;
+  return mnt->sb.s_first_data_block + group * mnt->sb.s_blocks_per_group;
+}
+
+// Group for a new non-directory inode: the parent's if it has room, then a
+// quadratic hash from it (to find space quickly), then any group.
+static int ext2_find_group_other(ext2_mount_t *mnt, uint32_t parent_group) {
+  uint32_t ngroups = mnt->groups_count;
+  ext2_bgd_t *bgdt = mnt->bgdt;
+
+  if (bgdt[parent_group].bg_free_inodes_count &&
+      bgdt[parent_group].bg_free_blocks_count)
+    return (int)parent_group;
+
+  uint32_t g = parent_group;
+  for (uint32_t i = 1; i < ngroups; i <<= 1) {
+    g = (g + i) % ngroups;
+    if (bgdt[g].bg_free_inodes_count && bgdt[g].bg_free_blocks_count)
+      return (int)g;
+  }
 
-    ext2_read_block(mnt, mnt->bgdt[g].bg_inode_bitmap, bitmap);
+  for (uint32_t i = 0; i < ngroups; i++) {
+    g = (parent_group + i) % ngroups;
+    if (bgdt[g].bg_free_inodes_count)
+      return (int)g;
+  }
+  return -1;
+}
+
+// Group for a new directory (Orlov).
+static int ext2_find_group_orlov(ext2_mount_t *mnt, uint32_t parent_ino) {
+  uint32_t ngroups = mnt->groups_count;
+  ext2_bgd_t *bgdt = mnt->bgdt;
+  uint32_t parent_group = (parent_ino - 1) / mnt->inodes_per_group;
+
+  uint32_t avefreei = mnt->sb.s_free_inodes_count / ngroups;
+  uint32_t avefreeb = mnt->sb.s_free_blocks_count / ngroups;
+  uint32_t ndirs = 0;
+  for (uint32_t g = 0; g < ngroups; g++)
+    ndirs += bgdt[g].bg_used_dirs_count;
+
+  if (parent_ino == EXT2_ROOT_INODE) {
+    // Top-level directory: the group with the fewest directories among
+    // those with at least average free inodes and blocks. Start after the
+    // previous pick so that equal groups take turns.
+    int best = -1;
+    uint32_t best_dirs = 0xFFFFFFFF;
+    uint32_t start = mnt->orlov_rotor;
+    for (uint32_t i = 0; i < ngroups; i++) {
+      uint32_t g = (start + i) % ngroups;
+      if (bgdt[g].bg_used_dirs_count >= best_dirs)
+        continue;
+      if (bgdt[g].bg_free_inodes_count < avefreei ||
+          !bgdt[g].bg_free_inodes_count)
+        continue;
+      if (bgdt[g].bg_free_blocks_count < avefreeb)
+        continue;
+      best = (int)g;
+      best_dirs = bgdt[g].bg_used_dirs_count;
+    }
+    if (best >= 0) {
+      mnt->orlov_rotor = ((uint32_t)best + 1) % ngroups;
+      return best;
+    }
+  } else {
+    // Stay near the parent while its neighbourhood has room and does not
+    // already hold more than its share of directories.
+    uint32_t max_dirs = ndirs / ngroups + mnt->inodes_per_group / 16;
+    uint32_t min_inodes = avefreei > mnt->inodes_per_group / 4
+                              ? avefreei - mnt->inodes_per_group / 4
+                              : 1;
+    uint32_t min_blocks = avefreeb > mnt->sb.s_blocks_per_group / 4
+                              ? avefreeb - mnt->sb.s_blocks_per_group / 4
+                              : 0;
+    for (uint32_t i = 0; i < ngroups; i++) {
+      uint32_t g = (parent_group + i) % ngroups;
+      if (bgdt[g].bg_used_dirs_count >= max_dirs)
+        continue;
+      if (bgdt[g].bg_free_inodes_count < min_inodes)
+        continue;
+      if (bgdt[g].bg_free_blocks_count < min_blocks)
+        continue;
+      return (int)g;
+    }
+  }
 
-    for (uint32_t i = 0; i < mnt->inodes_per_group; i++) {
-      uint32_t byte_idx = i / 8;
-      uint8_t bit_mask = 1 << (i % 8);
-      if (!(bitmap[byte_idx] & bit_mask)) {
-        bitmap[byte_idx] |= bit_mask;
-        ext3_journal_block(mnt, mnt->bgdt[g].bg_inode_bitmap, bitmap);
+  // Fallback: any group with an average share of free inodes, then any
+  // group with a free inode at all
+  for (uint32_t i = 0; i < ngroups; i++) {
+    uint32_t g = (parent_group + i) % ngroups;
+    if (bgdt[g].bg_free_inodes_count &&
+        bgdt[g].bg_free_inodes_count >= avefreei)
+      return (int)g;
+  }
+  for (uint32_t i = 0; i < ngroups; i++) {
+    uint32_t g = (parent_group + i) % ngroups;
+    if (bgdt[g].bg_free_inodes_count)
+      return (int)g;
+  }
+  return -1;
+}
 
-        mnt->bgdt[g].bg_free_inodes_count--;
-        mnt->sb.s_free_inodes_count--;
-        ext2_write_bgdt(mnt);
-        ext2_write_superblock(mnt);
+// Allocate an inode for a new child of parent_ino. Returns the inode
+// number or 0 on failure.
+static uint32_t ext2_alloc_inode(ext2_mount_t *mnt, uint32_t parent_ino,
+                                 bool is_dir) {
+  bool own = ext3_journal_start(mnt) == 0;
 
-        ext3_journal_stop(mnt);
-        kfree(bitmap);
-        return g * mnt->inodes_per_group + i + 1; // Inodes are 1-indexed
-      }
+  int group = is_dir ? ext2_find_group_orlov(mnt, parent_ino)
+                     : ext2_find_group_other(
+                           mnt, (parent_ino - 1) / mnt->inodes_per_group);
+
+  // The chosen group may have filled up meanwhile: carry on from it
+  for (uint32_t i = 0; group >= 0 && i < mnt->groups_count; i++) {
+    uint32_t g = ((uint32_t)group + i) % mnt->groups_count;
+    if (mnt->bgdt[g].bg_free_inodes_count == 0)
+      continue;
+    struct buffer_head *bh = ext2_group_bitmap(mnt, g, true);
+    if (!bh)
+      continue;
+
+    spinlock_acquire(&mnt->alloc_lock);
+    uint32_t bit = ext2_find_zero_bit(bh->data, mnt->inodes_per_group, 0);
+    if (bit == mnt->inodes_per_group) {
+      spinlock_release(&mnt->alloc_lock);
+      continue;
     }
+    bh->data[bit / 8] |= 1 << (bit % 8);
+    mnt->bgdt[g].bg_free_inodes_count--;
+    if (is_dir)
+      mnt->bgdt[g].bg_used_dirs_count++;
+    mnt->sb.s_free_inodes_count--;
+    mnt->sb_dirty = true;
+    spinlock_release(&mnt->alloc_lock);
+
+    ext3_journal_dirty(mnt, bh);
+    ext2_write_group_desc(mnt, g);
+    if (own)
+      ext3_journal_stop(mnt);
+
+    uint32_t ino = g * mnt->inodes_per_group + bit + 1; // 1-indexed
+    ext2_forget_layout(mnt, ino);
+    return ino;
   }
 
-  ext3_journal_stop(mnt);
-  kfree(bitmap);
+  if (own)
+    ext3_journal_stop(mnt);
   return 0;
 }
 
@@ -252,7 +860,7 @@ static uint32_t ext2_alloc_inode(ext2_mount_t *mnt) {
 
 // Free a previously allocated block. Returns 0 on success.
 static int ext2_free_block(ext2_mount_t *mnt, uint32_t block_num) {
-  if (block_num == 0)
+  if (block_num == 0 || block_num < mnt->sb.s_first_data_block)
     return -1;
 
   uint32_t adjusted = block_num - mnt->sb.s_first_data_block;
@@ -262,28 +870,36 @@ static int ext2_free_block(ext2_mount_t *mnt, uint32_t block_num) {
   if (group >= mnt->groups_count)
     return -1;
 
-  uint8_t *bitmap = kmalloc(mnt->block_size);
-  if (!bitmap)
+  struct buffer_head *bh = ext2_group_bitmap(mnt, group, false);
+  if (!bh)
     return -1;
 
-  ext2_read_block(mnt, mnt->bgdt[group].bg_block_bitmap, bitmap);
-
-  uint32_t byte_idx = index / 8;
+  spinlock_acquire(&mnt->alloc_lock);
   uint8_t bit_mask = 1 << (index % 8);
-  bitmap[byte_idx] &= ~bit_mask; // Clear the bit
-
-  ext3_journal_block(mnt, mnt->bgdt[group].bg_block_bitmap, bitmap);
-  kfree(bitmap);
-
+  if (!(bh->data[index / 8] & bit_mask)) {
+    spinlock_release(&mnt->alloc_lock);
+    return -1; // Already free
+  }
+  bh->data[index / 8] &= ~bit_mask;
   mnt->bgdt[group].bg_free_blocks_count++;
   mnt->sb.s_free_blocks_count++;
-  ext2_write_bgdt(mnt);
-  ext2_write_superblock(mnt);
+  mnt->sb_dirty = true;
+  spinlock_release(&mnt->alloc_lock);
+
+  ext3_journal_dirty(mnt, bh);
+
+  // If it held metadata, neither a pending writeback nor journal replay
+  // may hit its next owner.
+  ext3_journal_revoke(mnt, block_num);
+  bforget(mnt->dev, block_num, mnt->block_size);
+
+  ext2_write_group_desc(mnt, group);
   return 0;
 }
 
 // Free a previously allocated inode. Returns 0 on success.
-static int ext2_free_inode(ext2_mount_t *mnt, uint32_t inode_num) {
+static int ext2_free_inode(ext2_mount_t *mnt, uint32_t inode_num,
+                           bool is_dir) {
   if (inode_num == 0)
     return -1;
 
@@ -293,28 +909,62 @@ static int ext2_free_inode(ext2_mount_t *mnt, uint32_t inode_num) {
   if (group >= mnt->groups_count)
     return -1;
 
-  uint8_t *bitmap = kmalloc(mnt->block_size);
-  if (!bitmap)
+  struct buffer_head *bh = ext2_group_bitmap(mnt, group, true);
+  if (!bh)
     return -1;
 
-  ext2_read_block(mnt, mnt->bgdt[group].bg_inode_bitmap, bitmap);
-
-  uint32_t byte_idx = index / 8;
+  spinlock_acquire(&mnt->alloc_lock);
   uint8_t bit_mask = 1 << (index % 8);
-  bitmap[byte_idx] &= ~bit_mask; // Clear the bit
-
-  ext3_journal_block(mnt, mnt->bgdt[group].bg_inode_bitmap, bitmap);
-  kfree(bitmap);
-
+  if (!(bh->data[index / 8] & bit_mask)) {
+    spinlock_release(&mnt->alloc_lock);
+    return -1; // Already free
+  }
+  bh->data[index / 8] &= ~bit_mask;
   mnt->bgdt[group].bg_free_inodes_count++;
+  if (is_dir && mnt->bgdt[group].bg_used_dirs_count > 0)
+    mnt->bgdt[group].bg_used_dirs_count--;
   mnt->sb.s_free_inodes_count++;
-  ext2_write_bgdt(mnt);
-  ext2_write_superblock(mnt);
+  mnt->sb_dirty = true;
+  spinlock_release(&mnt->alloc_lock);
+
+  ext3_journal_dirty(mnt, bh);
+  ext2_write_group_desc(mnt, group);
+  return 0;
+}
+
+// Set up the allocators of a freshly read mount. The superblock's free
+// counts are only written at sync, so they are recomputed from the group
+// descriptors here.
+static int ext2_alloc_init(ext2_mount_t *mnt) {
+  spinlock_init(&mnt->alloc_lock);
+  mnt->groups = kmalloc(mnt->groups_count * sizeof(ext2_group_info_t));
+  if (!mnt->groups)
+    return -1;
+  memset(mnt->groups, 0, mnt->groups_count * sizeof(ext2_group_info_t));
+
+  uint32_t free_blocks = 0, free_inodes = 0;
+  for (uint32_t g = 0; g < mnt->groups_count; g++) {
+    free_blocks += mnt->bgdt[g].bg_free_blocks_count;
+    free_inodes += mnt->bgdt[g].bg_free_inodes_count;
+  }
+  mnt->sb.s_free_blocks_count = free_blocks;
+  mnt->sb.s_free_inodes_count = free_inodes;
   return 0;
 }
 
 // ── File data block resolution ──────────────────────────────────────────────
 
+// Read entry idx of the indirect block block_num (0 if it is a hole).
+static uint32_t ext2_indirect_entry(ext2_mount_t *mnt, uint32_t block_num,
+                                    uint32_t idx) {
+  struct buffer_head *bh = ext2_bread(mnt, block_num);
+  if (!bh)
+    return 0;
+  uint32_t result = ((uint32_t *)bh->data)[idx];
+  brelse(bh);
+  return result;
+}
+
 // Get the disk block number for a given logical block index in an inode.
 // Supports direct, singly-indirect, and doubly-indirect blocks.
 uint32_t ext2_get_block_num(ext2_mount_t *mnt, ext2_inode_t *inode,
@@ -330,38 +980,17 @@ uint32_t ext2_get_block_num(ext2_mount_t *mnt, ext2_inode_t *inode,
 
   // Singly indirect (12..12+ptrs_per_block-1)
   if (logical_block < ptrs_per_block) {
-    if (inode->i_block[12] == 0)
-      return 0;
-    uint32_t *indirect = kmalloc(mnt->block_size);
-    if (!indirect)
-      return 0;
-    ext2_read_block(mnt, inode->i_block[12], indirect);
-    uint32_t result = indirect[logical_block];
-    kfree(indirect);
-    return result;
+    return ext2_indirect_entry(mnt, inode->i_block[12], logical_block);
   }
 
   logical_block -= ptrs_per_block;
 
   // Doubly indirect
   if (logical_block < ptrs_per_block * ptrs_per_block) {
-    if (inode->i_block[13] == 0)
-      return 0;
-    uint32_t *dindirect = kmalloc(mnt->block_size);
-    if (!dindirect)
-      return 0;
-    ext2_read_block(mnt, inode->i_block[13], dindirect);
-    uint32_t indirect_block = dindirect[logical_block / ptrs_per_block];
-    kfree(dindirect);
-    if (indirect_block == 0)
-      return 0;
-    uint32_t *indirect = kmalloc(mnt->block_size);
-    if (!indirect)
-      return 0;
-    ext2_read_block(mnt, indirect_block, indirect);
-    uint32_t result = indirect[logical_block % ptrs_per_block];
-    kfree(indirect);
-    return result;
+    uint32_t indirect_block = ext2_indirect_entry(
+        mnt, inode->i_block[13], logical_block / ptrs_per_block);
+    return ext2_indirect_entry(mnt, indirect_block,
+                               logical_block % ptrs_per_block);
   }
 
   logical_block -= ptrs_per_block * ptrs_per_block;
@@ -369,47 +998,50 @@ uint32_t ext2_get_block_num(ext2_mount_t *mnt, ext2_inode_t *inode,
   // Triply indirect
   if (logical_block <
       (uint64_t)ptrs_per_block * ptrs_per_block * ptrs_per_block) {
-    if (inode->i_block[14] == 0)
-      return 0;
-    uint32_t *tindirect = kmalloc(mnt->block_size);
-    if (!tindirect)
-      return 0;
-    ext2_read_block(mnt, inode->i_block[14], tindirect);
-
     uint32_t idx1 = logical_block / (ptrs_per_block * ptrs_per_block);
     uint32_t rem = logical_block % (ptrs_per_block * ptrs_per_block);
-    uint32_t dindirect_block = tindirect[idx1];
-    kfree(tindirect);
-    if (dindirect_block == 0)
-      return 0;
-
-    uint32_t *dindirect = kmalloc(mnt->block_size);
-    if (!dindirect)
-      return 0;
-    ext2_read_block(mnt, dindirect_block, dindirect);
-
-    uint32_t idx2 = rem / ptrs_per_block;
-    uint32_t indirect_block = dindirect[idx2];
-    kfree(dindirect);
-    if (indirect_block == 0)
-      return 0;
-
-    uint32_t *indirect = kmalloc(mnt->block_size);
-    if (!indirect)
-      return 0;
-    ext2_read_block(mnt, indirect_block, indirect);
-    uint32_t result = indirect[rem % ptrs_per_block];
-    kfree(indirect);
-    return result;
+    uint32_t dindirect_block =
+        ext2_indirect_entry(mnt, inode->i_block[14], idx1);
+    uint32_t indirect_block =
+        ext2_indirect_entry(mnt, dindirect_block, rem / ptrs_per_block);
+    return ext2_indirect_entry(mnt, indirect_block, rem % ptrs_per_block);
   }
 
   return 0; // Beyond addressable range
 }
 
+// Return the block referenced by *slot in parent (an inode's i_block array
+// when parent is NULL), allocating (near goal) and zeroing it first if it is
+// a hole. A new block is counted in the i_blocks of inode.
+static uint32_t ext2_indirect_get_or_alloc(ext2_mount_t *mnt,
+                                           ext2_inode_t *inode,
+                                           struct buffer_head *parent,
+                                           uint32_t *slot, uint32_t goal,
+                                           bool reserved) {
+  if (*slot != 0)
+    return *slot;
+
+  uint32_t new_block = ext2_alloc_block_from(mnt, goal, reserved);
+  if (!new_block)
+    return 0;
+  struct buffer_head *bh = ext2_new_zero_block(mnt, new_block);
+  if (!bh)
+    return 0;
+  brelse(bh);
+
+  *slot = new_block;
+  inode->i_blocks += mnt->block_size / 512;
+  if (parent)
+    ext2_dirty_block(mnt, parent);
+  return new_block;
+}
+
 // Set a disk block number for a given logical block index, allocating indirect
-// blocks as needed. Returns 0 on success, -1 on failure.
+// blocks as needed (from the delalloc reservation if reserved). Returns 0 on
+// success, -1 on failure.
 static int ext2_set_block_num(ext2_mount_t *mnt, ext2_inode_t *inode,
-                              uint32_t logical_block, uint32_t disk_block) {
+                              uint32_t logical_block, uint32_t disk_block,
+                              bool reserved) {
   uint32_t ptrs_per_block = mnt->block_size / 4;
 
   // Direct blocks
@@ -420,158 +1052,96 @@ static int ext2_set_block_num(ext2_mount_t *mnt, ext2_inode_t *inode,
 
   logical_block -= EXT2_DIRECT_BLOCKS;
 
-  // Singly indirect
+  // Walk from the inode down to the singly-indirect block that holds the
+  // entry, allocating missing levels on the way.
+  uint32_t path[3];
+  uint32_t depth;
+  uint32_t top;
   if (logical_block < ptrs_per_block) {
-    if (inode->i_block[12] == 0) {
-      uint32_t new_block = ext2_alloc_block(mnt);
-      if (!new_block)
-        return -1;
-      inode->i_block[12] = new_block;
-      // Zero out the new indirect block
-      uint8_t *zero = kcalloc(1, mnt->block_size);
-      ext2_write_block(mnt, new_block, zero);
-      kfree(zero);
-    }
-    uint32_t *indirect = kmalloc(mnt->block_size);
-    if (!indirect)
-      return -1;
-    ext2_read_block(mnt, inode->i_block[12], indirect);
-    indirect[logical_block] = disk_block;
-    ext2_write_block(mnt, inode->i_block[12], indirect);
-    kfree(indirect);
-    return 0;
+    top = 12;
+    depth = 1;
+    path[0] = logical_block;
+  } else if ((logical_block -= ptrs_per_block) <
+             ptrs_per_block * ptrs_per_block) {
+    top = 13;
+    depth = 2;
+    path[0] = logical_block / ptrs_per_block;
+    path[1] = logical_block % ptrs_per_block;
+  } else if ((logical_block -= ptrs_per_block * ptrs_per_block) <
+             (uint64_t)ptrs_per_block * ptrs_per_block * ptrs_per_block) {
+    top = 14;
+    depth = 3;
+    path[0] = logical_block / (ptrs_per_block * ptrs_per_block);
+    path[1] = (logical_block / ptrs_per_block) % ptrs_per_block;
+    path[2] = logical_block % ptrs_per_block;
+  } else {
+    return -1; // Beyond addressable range
   }
 
-  logical_block -= ptrs_per_block;
+  uint32_t top_block = inode->i_block[top]; // i_block is a packed member
+  uint32_t block =
+      ext2_indirect_get_or_alloc(mnt, inode, NULL, &top_block, disk_block,
+                                 reserved);
+  if (!block)
+    return -1;
+  inode->i_block[top] = top_block;
 
-  // Doubly indirect
-  if (logical_block < ptrs_per_block * ptrs_per_block) {
-    if (inode->i_block[13] == 0) {
-      uint32_t new_block = ext2_alloc_block(mnt);
-      if (!new_block)
-        return -1;
-      inode->i_block[13] = new_block;
-      uint8_t *zero = kcalloc(1, mnt->block_size);
-      ext2_write_block(mnt, new_block, zero);
-      kfree(zero);
-    }
-    uint32_t *dindirect = kmalloc(mnt->block_size);
-    if (!dindirect)
+  for (uint32_t level = 0; level < depth; level++) {
+    struct buffer_head *bh = ext2_bread(mnt, block);
+    if (!bh)
       return -1;
-    ext2_read_block(mnt, inode->i_block[13], dindirect);
-
-    uint32_t idx1 = logical_block / ptrs_per_block;
-    uint32_t idx2 = logical_block % ptrs_per_block;
+    uint32_t *ptrs = (uint32_t *)bh->data;
 
-    if (dindirect[idx1] == 0) {
-      uint32_t new_block = ext2_alloc_block(mnt);
-      if (!new_block) {
-        kfree(dindirect);
-        return -1;
-      }
-      dindirect[idx1] = new_block;
-      ext2_write_block(mnt, inode->i_block[13], dindirect);
-      uint8_t *zero = kcalloc(1, mnt->block_size);
-      ext2_write_block(mnt, new_block, zero);
-      kfree(zero);
+    if (level == depth - 1) {
+      ptrs[path[level]] = disk_block;
+      ext2_dirty_block(mnt, bh);
+      brelse(bh);
+      return 0;
     }
 
-    uint32_t *indirect = kmalloc(mnt->block_size);
-    if (!indirect) {
-      kfree(dindirect);
+    block = ext2_indirect_get_or_alloc(mnt, inode, bh, &ptrs[path[level]],
+                                       disk_block, reserved);
+    brelse(bh);
+    if (!block)
       return -1;
-    }
-    ext2_read_block(mnt, dindirect[idx1], indirect);
-    indirect[idx2] = disk_block;
-    ext2_write_block(mnt, dindirect[idx1], indirect);
-    kfree(indirect);
-    kfree(dindirect);
-    return 0;
   }
 
-  logical_block -= ptrs_per_block * ptrs_per_block;
-
-  // Triply indirect
-  if (logical_block <
-      (uint64_t)ptrs_per_block * ptrs_per_block * ptrs_per_block) {
-    // Allocate top-level triple indirect block if needed
-    if (inode->i_block[14] == 0) {
-      uint32_t new_block = ext2_alloc_block(mnt);
-      if (!new_block)
-        return -1;
-      inode->i_block[14] = new_block;
-      uint8_t *zero = kcalloc(1, mnt->block_size);
-      ext2_write_block(mnt, new_block, zero);
-      kfree(zero);
-    }
-
-    uint32_t *tindirect = kmalloc(mnt->block_size);
-    if (!tindirect)
-      return -1;
-    ext2_read_block(mnt, inode->i_block[14], tindirect);
-
-    uint32_t idx1 = logical_block / (ptrs_per_block * ptrs_per_block);
-    uint32_t rem = logical_block % (ptrs_per_block * ptrs_per_block);
-
-    // Allocate doubly-indirect block if needed
-    if (tindirect[idx1] == 0) {
-      uint32_t new_block = ext2_alloc_block(mnt);
-      if (!new_block) {
-        kfree(tindirect);
-        return -1;
-      }
-      tindirect[idx1] = new_block;
-      ext2_write_block(mnt, inode->i_block[14], tindirect);
-      uint8_t *zero = kcalloc(1, mnt->block_size);
-      ext2_write_block(mnt, new_block, zero);
-      kfree(zero);
-    }
-
-    uint32_t *dindirect = kmalloc(mnt->block_size);
-    if (!dindirect) {
-      kfree(tindirect);
-      return -1;
-    }
-    ext2_read_block(mnt, tindirect[idx1], dindirect);
-
-    uint32_t idx2 = rem / ptrs_per_block;
-    uint32_t idx3 = rem % ptrs_per_block;
-
-    // Allocate singly-indirect block if needed
-    if (dindirect[idx2] == 0) {
-      uint32_t new_block = ext2_alloc_block(mnt);
-      if (!new_block) {
-        kfree(dindirect);
-        kfree(tindirect);
-        return -1;
-      }
-      dindirect[idx2] = new_block;
-      ext2_write_block(mnt, tindirect[idx1], dindirect);
-      uint8_t *zero = kcalloc(1, mnt->block_size);
-      ext2_write_block(mnt, new_block, zero);
-      kfree(zero);
-    }
+  return -1;
+}
 
-    uint32_t *indirect = kmalloc(mnt->block_size);
-    if (!indirect) {
-      kfree(dindirect);
-      kfree(tindirect);
-      return -1;
-    }
-    ext2_read_block(mnt, dindirect[idx2], indirect);
-    indirect[idx3] = disk_block;
-    ext2_write_block(mnt, dindirect[idx2], indirect);
+// ── VFS Node Creation ───────────────────────────────────────────────────────
 
-    kfree(indirect);
-    kfree(dindirect);
-    kfree(tindirect);
-    return 0;
-  }
+static void ext2_close_impl(vfs_node_t *node) {
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  if (mnt && node->fs_inode)
+    ext2_iput(mnt, (ext2_inode_info_t *)node->fs_inode);
+  node->fs_inode = NULL;
+}
 
-  return -1; // Beyond addressable range
+// The in-core inode of a live node. Persistent nodes (the root) outlive
+// their last close and take a new reference here.
+static ext2_inode_info_t *ext2_node_inode(vfs_node_t *node) {
+  if (!node->fs_inode)
+    node->fs_inode = ext2_iget((ext2_mount_t *)node->device, node->inode);
+  return (ext2_inode_info_t *)node->fs_inode;
 }
 
-// ── VFS Node Creation ───────────────────────────────────────────────────────
+// Refresh a node the dentry cache kept from the in-core inode.
+static int ext2_revalidate_impl(vfs_node_t *node) {
+  ext2_inode_t inode;
+  if (ext2_read_inode((ext2_mount_t *)node->device, node->inode, &inode))
+    return -1;
+  if (inode.i_links_count == 0)
+    return -1;
+  node->mask = inode.i_mode & 0x0FFF;
+  node->uid = inode.i_uid;
+  node->gid = inode.i_gid;
+  node->length = ext2_isize(&inode);
+  node->atime = inode.i_atime;
+  node->mtime = inode.i_mtime;
+  node->ctime = inode.i_ctime;
+  return 0;
+}
 
 static vfs_node_t *ext2_make_vfs_node(ext2_mount_t *mnt, uint32_t inode_num,
                                       ext2_inode_t *inode) {
@@ -580,11 +1150,18 @@ static vfs_node_t *ext2_make_vfs_node(ext2_mount_t *mnt, uint32_t inode_num,
     return NULL;
   vfs_node_init(node);
 
+  node->fs_inode = ext2_iget(mnt, inode_num);
+  if (!node->fs_inode) {
+    kfree(node);
+    return NULL;
+  }
+  node->close = ext2_close_impl;
+  node->revalidate = ext2_revalidate_impl;
   node->inode = inode_num;
   node->mask = inode->i_mode & 0x0FFF;
   node->uid = inode->i_uid;
   node->gid = inode->i_gid;
-  node->length = inode->i_size;
+  node->length = ext2_isize(inode);
   node->device = mnt; // Store mount context
   node->atime = inode->i_atime;
   node->mtime = inode->i_mtime;
@@ -608,6 +1185,14 @@ static vfs_node_t *ext2_make_vfs_node(ext2_mount_t *mnt, uint32_t inode_num,
     node->read = ext2_read_impl;
     node->write = ext2_write_impl;
     node->truncate = ext2_truncate_impl;
+    node->readpage = ext2_readpage_impl;
+    node->readpages = ext2_readpages_impl;
+    if (mnt->block_size <= PAGE_CACHE_SIZE) {
+      node->writepages = ext2_writepages_impl;
+      node->reserve = ext2_reserve_impl;
+      node->unreserve = ext2_unreserve_impl;
+    }
+    node->fsync = ext2_fsync_impl;
     node->mmap = ext2_mmap_impl;
     node->chmod = ext2_chmod_impl;
     node->chown = ext2_chown_impl;
@@ -629,37 +1214,40 @@ static vfs_node_t *ext2_make_vfs_node(ext2_mount_t *mnt, uint32_t inode_num,
 
 // ── VFS Read Implementation ─────────────────────────────────────────────────
 
-static uint32_t ext2_read_impl(vfs_node_t *node, uint32_t offset, uint32_t size,
+static uint32_t ext2_read_impl(vfs_node_t *node, uint64_t offset, uint32_t size,
                                uint8_t *buffer) {
   ext2_mount_t *mnt = (ext2_mount_t *)node->device;
   if (!mnt)
     return 0;
 
-  ext2_inode_t inode;
-  if (ext2_read_inode(mnt, node->inode, &inode))
+  ext2_inode_info_t *ei = ext2_iget(mnt, node->inode);
+  if (!ei)
     return 0;
 
-  if (offset >= inode.i_size)
+  uint64_t i_size = ext2_isize(&ei->raw);
+  uint8_t *block_buf = NULL;
+  if (offset < i_size)
+    block_buf = kmalloc(mnt->block_size);
+  if (!block_buf) {
+    ext2_iput(mnt, ei);
     return 0;
-  if (offset + size > inode.i_size) {
-    size = inode.i_size - offset;
+  }
+  if (size > i_size - offset) {
+    size = (uint32_t)(i_size - offset);
   }
 
   uint32_t bytes_read = 0;
-  uint8_t *block_buf = kmalloc(mnt->block_size);
-  if (!block_buf)
-    return 0;
 
   while (bytes_read < size) {
-    uint32_t current_offset = offset + bytes_read;
-    uint32_t logical_block = current_offset / mnt->block_size;
+    uint64_t current_offset = offset + bytes_read;
+    uint32_t logical_block = (uint32_t)(current_offset / mnt->block_size);
     uint32_t offset_in_block = current_offset % mnt->block_size;
     uint32_t to_copy = mnt->block_size - offset_in_block;
     if (to_copy > size - bytes_read) {
       to_copy = size - bytes_read;
     }
 
-    uint32_t disk_block = ext2_get_block_num(mnt, &inode, logical_block);
+    uint32_t disk_block = ext2_bmap(mnt, ei, logical_block, NULL);
     if (disk_block == 0) {
       memset(buffer + bytes_read, 0, to_copy);
     } else {
@@ -671,60 +1259,239 @@ static uint32_t ext2_read_impl(vfs_node_t *node, uint32_t offset, uint32_t size,
   }
 
   kfree(block_buf);
+  ext2_iput(mnt, ei);
   return bytes_read;
 }
 
-static int ext2_truncate_impl(vfs_node_t *node, uint32_t new_len) {
-  if (!node || node->flags != FS_FILE || !node->device)
-    return -1;
+// Read run blocks starting at disk_block into buf.
+static int ext2_read_blocks(ext2_mount_t *mnt, uint32_t disk_block,
+                            uint32_t run, void *buf) {
+  uint64_t lba = (uint64_t)disk_block * mnt->block_size / 512;
+  uint32_t sectors = run * (mnt->block_size / 512);
+  return mnt->dev->read_sectors(mnt->dev, lba, sectors, buf);
+}
 
+// Page cache fill: one 4 KiB page, zero past EOF. Blocks are read straight
+// into the page (no intermediate block buffer), so DMA drivers fill it in
+// place; physically adjacent blocks go out as one request.
+static int ext2_readpage_impl(vfs_node_t *node, uint32_t index, uint8_t *page) {
   ext2_mount_t *mnt = (ext2_mount_t *)node->device;
-  ext2_inode_t inode;
-  if (ext2_read_inode(mnt, node->inode, &inode) != 0)
+  if (!mnt)
     return -1;
+  if (mnt->block_size > PAGE_CACHE_SIZE) {
+    uint32_t got = ext2_read_impl(node, (uint64_t)index * PAGE_CACHE_SIZE,
+                                  PAGE_CACHE_SIZE, page);
+    if (got < PAGE_CACHE_SIZE)
+      memset(page + got, 0, PAGE_CACHE_SIZE - got);
+    return 0;
+  }
 
-  inode.i_size = new_len;
-  node->length = new_len;
+  ext2_inode_info_t *ei = ext2_iget(mnt, node->inode);
+  if (!ei)
+    return -1;
 
-  // We just update the size and rewrite the inode.
-  // Blocks are intentionally not freed here for simplicity,
-  // they will be naturally reused if the file grows again.
-  return ext2_write_inode(mnt, node->inode, &inode);
+  uint32_t bs = mnt->block_size;
+  uint32_t per_page = PAGE_CACHE_SIZE / bs;
+  uint32_t first = index * per_page;
+  uint64_t i_size = ext2_isize(&ei->raw);
+  uint32_t file_blocks = (uint32_t)((i_size + bs - 1) / bs);
+
+  uint32_t run_start = 0, run_disk = 0, run_len = 0;
+  for (uint32_t i = 0; i <= per_page; i++) {
+    uint32_t disk = 0;
+    if (i < per_page && first + i < file_blocks)
+      disk = ext2_bmap(mnt, ei, first + i, NULL);
+    if (disk && run_len && disk == run_disk + run_len) {
+      run_len++;
+      continue;
+    }
+    if (run_len &&
+        ext2_read_blocks(mnt, run_disk, run_len, page + run_start * bs) != 0) {
+      ext2_iput(mnt, ei);
+      return -1;
+    }
+    run_len = 0;
+    if (i == per_page)
+      break;
+    if (disk) {
+      run_start = i;
+      run_disk = disk;
+      run_len = 1;
+    } else {
+      memset(page + i * bs, 0, bs); // Hole or past EOF
+    }
+  }
+
+  ext2_iput(mnt, ei);
+
+  // The last block may extend past EOF
+  uint64_t page_start = (uint64_t)index * PAGE_CACHE_SIZE;
+  if (i_size < page_start + PAGE_CACHE_SIZE) {
+    uint32_t valid = i_size > page_start ? (uint32_t)(i_size - page_start) : 0;
+    memset(page + valid, 0, PAGE_CACHE_SIZE - valid);
+  }
+  return 0;
 }
 
-static uint32_t ext2_write_impl(vfs_node_t *node, uint32_t offset,
-                                uint32_t size, uint8_t *buffer) {
+struct ext2_readpages_io {
+  uint32_t pending;
+  int status;
+  completion_t done;
+};
+
+static void ext2_readpages_end_io(struct bio *bio) {
+  struct ext2_readpages_io *io = (struct ext2_readpages_io *)bio->private;
+  if (bio->status)
+    io->status = -1;
+  if (__atomic_sub_fetch(&io->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    complete(&io->done);
+}
+
+// Readahead fill of nr consecutive pages. Each run of adjacent blocks
+// inside a page becomes one bio, and all of them are submitted under one
+// plug before any is waited for: the queue merges neighbouring pages into
+// large requests, and DMA drivers scatter them straight into the pages.
+static int ext2_readpages_impl(vfs_node_t *node, uint32_t index, uint32_t nr,
+                               uint8_t **pages) {
   ext2_mount_t *mnt = (ext2_mount_t *)node->device;
   if (!mnt)
+    return -1;
+  uint32_t bs = mnt->block_size;
+  uint32_t per_page = PAGE_CACHE_SIZE / bs;
+  struct bio *bios = NULL;
+  if (bs <= PAGE_CACHE_SIZE)
+    bios = kmalloc(nr * per_page * sizeof(struct bio));
+  if (!bios) {
+    for (uint32_t p = 0; p < nr; p++) {
+      if (ext2_readpage_impl(node, index + p, pages[p]) != 0)
+        return -1;
+    }
     return 0;
+  }
 
-  ext2_inode_t inode;
-  if (ext2_read_inode(mnt, node->inode, &inode))
-    return 0;
+  ext2_inode_info_t *ei = ext2_iget(mnt, node->inode);
+  if (!ei) {
+    kfree(bios);
+    return -1;
+  }
+  uint64_t i_size = ext2_isize(&ei->raw);
+  uint32_t file_blocks = (uint32_t)((i_size + bs - 1) / bs);
+  uint32_t nr_bios = 0;
+
+  for (uint32_t p = 0; p < nr; p++) {
+    uint8_t *page = pages[p];
+    uint32_t first = (index + p) * per_page;
+    uint32_t run_start = 0, run_disk = 0, run_len = 0;
+    for (uint32_t i = 0; i <= per_page; i++) {
+      uint32_t disk = 0;
+      if (i < per_page && first + i < file_blocks)
+        disk = ext2_bmap(mnt, ei, first + i, NULL);
+      if (disk && run_len && disk == run_disk + run_len) {
+        run_len++;
+        continue;
+      }
+      if (run_len)
+        bio_init(&bios[nr_bios++], mnt->dev, BIO_READ,
+                 (uint64_t)run_disk * bs / 512, run_len * (bs / 512),
+                 page + run_start * bs);
+      run_len = 0;
+      if (i == per_page)
+        break;
+      if (disk) {
+        run_start = i;
+        run_disk = disk;
+        run_len = 1;
+      } else {
+        memset(page + i * bs, 0, bs); // Hole or past EOF
+      }
+    }
+  }
+  ext2_iput(mnt, ei);
+
+  struct ext2_readpages_io io;
+  io.pending = nr_bios;
+  io.status = 0;
+  completion_init(&io.done);
+  if (nr_bios) {
+    struct blk_plug plug;
+    blk_start_plug(&plug);
+    for (uint32_t b = 0; b < nr_bios; b++) {
+      bios[b].end_io = ext2_readpages_end_io;
+      bios[b].private = &io;
+      submit_bio(&bios[b]);
+    }
+    blk_finish_plug(&plug);
+    wait_for_completion(&io.done);
+  }
+  kfree(bios);
+
+  // The last block may extend past EOF
+  for (uint32_t p = 0; p < nr; p++) {
+    uint64_t page_start = (uint64_t)(index + p) * PAGE_CACHE_SIZE;
+    if (i_size >= page_start + PAGE_CACHE_SIZE)
+      continue;
+    uint32_t valid = i_size > page_start ? (uint32_t)(i_size - page_start) : 0;
+    memset(pages[p] + valid, 0, PAGE_CACHE_SIZE - valid);
+  }
+  return io.status;
+}
+
+static int ext2_truncate_impl(vfs_node_t *node, uint64_t new_len) {
+  if (!node || node->flags != FS_FILE || !node->device)
+    return -1;
+
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  ext2_inode_info_t *ei = ext2_node_inode(node);
+  if (!ei || new_len > ext2_max_size(mnt))
+    return -1;
 
+  ext2_set_isize(mnt, &ei->raw, new_len);
+  node->length = new_len;
+  ext2_map_clear(ei);
+
+  // We just update the size; the inode is written back with the file's
+  // other changes. Blocks are intentionally not freed here for simplicity,
+  // they will be naturally reused if the file grows again.
+  ext2_mark_inode_dirty(ei);
+  return 0;
+}
+
+// Write straight to the disk, allocating blocks as they are reached: the
+// path for filesystems whose writes the page cache cannot buffer, and for
+// what it could not (no space to reserve, out of memory).
+static uint32_t ext2_write_direct(ext2_mount_t *mnt, vfs_node_t *node,
+                                  ext2_inode_info_t *ei, uint64_t offset,
+                                  uint32_t size, uint8_t *buffer) {
+  ext2_inode_t *inode = &ei->raw;
   uint32_t bytes_written = 0;
   uint8_t *block_buf = kmalloc(mnt->block_size);
   if (!block_buf)
     return 0;
 
   while (bytes_written < size) {
-    uint32_t current_offset = offset + bytes_written;
-    uint32_t logical_block = current_offset / mnt->block_size;
+    uint64_t current_offset = offset + bytes_written;
+    uint32_t logical_block = (uint32_t)(current_offset / mnt->block_size);
     uint32_t offset_in_block = current_offset % mnt->block_size;
     uint32_t to_write = mnt->block_size - offset_in_block;
     if (to_write > size - bytes_written) {
       to_write = size - bytes_written;
     }
 
-    uint32_t disk_block = ext2_get_block_num(mnt, &inode, logical_block);
+    uint32_t disk_block = ext2_bmap(mnt, ei, logical_block, NULL);
 
     // Allocate a new block if needed
     if (disk_block == 0) {
-      disk_block = ext2_alloc_block(mnt);
+      uint32_t goal = ei->alloc_goal;
+      if (!goal)
+        goal = ext2_block_goal(mnt, node->inode, inode, logical_block);
+      disk_block = ext2_alloc_block(mnt, goal);
       if (disk_block == 0)
         break; // Out of space
-      ext2_set_block_num(mnt, &inode, logical_block, disk_block);
-      inode.i_blocks += mnt->block_size / 512;
+      ei->alloc_goal = disk_block + 1;
+      if (ext2_set_block_num(mnt, inode, logical_block, disk_block, false) == 0)
+        ext2_map_add(ei, logical_block, disk_block);
+      inode->i_blocks += mnt->block_size / 512;
+      ei->data_dirty = true;
       // Zero the new block first
       memset(block_buf, 0, mnt->block_size);
     } else if (offset_in_block != 0 || to_write < mnt->block_size) {
@@ -735,84 +1502,1068 @@ static uint32_t ext2_write_impl(vfs_node_t *node, uint32_t offset,
     memcpy(block_buf + offset_in_block, buffer + bytes_written, to_write);
     ext2_write_block(mnt, disk_block, block_buf);
 
-    bytes_written += to_write;
+    bytes_written += to_write;
+  }
+
+  kfree(block_buf);
+  return bytes_written;
+}
+
+static uint32_t ext2_write_impl(vfs_node_t *node, uint64_t offset,
+                                uint32_t size, uint8_t *buffer) {
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  if (!mnt)
+    return 0;
+
+  ext2_inode_info_t *ei = ext2_node_inode(node);
+  if (!ei)
+    return 0;
+  ext2_inode_t *inode = &ei->raw;
+  uint64_t max = ext2_max_size(mnt);
+  if (offset >= max)
+    return 0; // File too large
+  if (size > max - offset)
+    size = (uint32_t)(max - offset);
+  uint64_t old_size = ext2_isize(inode);
+  uint64_t new_size = old_size;
+  uint32_t bytes_written = 0;
+
+  if (node->writepages) {
+    // Writeback only allocates blocks inside i_size: the new size must be
+    // in place before the flusher can see the pages dirty.
+    if (offset + size > new_size) {
+      new_size = offset + size;
+      ext2_set_isize(mnt, inode, new_size);
+    }
+    bytes_written = page_cache_write_buffered(node, offset, size, buffer);
+    if (new_size > old_size && offset + bytes_written < new_size) {
+      new_size =
+          offset + bytes_written > old_size ? offset + bytes_written : old_size;
+      ext2_set_isize(mnt, inode, new_size);
+    }
+  }
+
+  if (bytes_written < size) {
+    uint32_t n = ext2_write_direct(mnt, node, ei, offset + bytes_written,
+                                   size - bytes_written,
+                                   buffer + bytes_written);
+    if (offset + bytes_written + n > new_size) {
+      new_size = offset + bytes_written + n;
+      ext2_set_isize(mnt, inode, new_size);
+    }
+    node->length = new_size;
+    // vfs_write() leaves the cache to filesystems with buffered writes
+    if (n && node->writepages)
+      page_cache_write(node, offset + bytes_written, n,
+                       buffer + bytes_written);
+    bytes_written += n;
+  }
+
+  if (new_size != old_size)
+    ei->data_dirty = true;
+
+  // Update modification timestamp
+  uint32_t now = ext2_current_time();
+  inode->i_mtime = now;
+  inode->i_ctime = now;
+
+  // Written back when the file is closed (or synced)
+  ext2_mark_inode_dirty(ei);
+  node->length = new_size;
+  return bytes_written;
+}
+
+// ── Delayed allocation ──────────────────────────────────────────────────────
+// Buffered writes only reserve space for pages without blocks: a page may
+// need up to one indirect block on top of its data blocks. Writeback then
+// allocates every page of a run in one sweep from the inode's goal, so a
+// file written in small pieces still ends up in long extents, and the data
+// goes to disk before the transaction that maps it is committed.
+
+static uint32_t ext2_page_reserve(ext2_mount_t *mnt) {
+  return PAGE_CACHE_SIZE / mnt->block_size + 1;
+}
+
+static int ext2_reserve_impl(vfs_node_t *node, uint32_t index) {
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  ext2_inode_info_t *ei = ext2_node_inode(node);
+  if (!mnt || !ei)
+    return -1;
+
+  uint32_t per_page = PAGE_CACHE_SIZE / mnt->block_size;
+  uint32_t i = 0;
+  while (i < per_page && ext2_bmap(mnt, ei, index * per_page + i, NULL))
+    i++;
+  if (i == per_page)
+    return 0; // Fully mapped already
+
+  uint32_t need = ext2_page_reserve(mnt);
+  spinlock_acquire(&mnt->alloc_lock);
+  bool ok = mnt->sb.s_free_blocks_count >= mnt->reserved_blocks + need;
+  if (ok)
+    mnt->reserved_blocks += need;
+  spinlock_release(&mnt->alloc_lock);
+  return ok ? 1 : -1;
+}
+
+static void ext2_unreserve_impl(vfs_node_t *node, uint32_t nr) {
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  if (!mnt)
+    return;
+  uint32_t blocks = nr * ext2_page_reserve(mnt);
+  spinlock_acquire(&mnt->alloc_lock);
+  mnt->reserved_blocks -=
+      blocks < mnt->reserved_blocks ? blocks : mnt->reserved_blocks;
+  spinlock_release(&mnt->alloc_lock);
+}
+
+// Write back nr consecutive pages, allocating the blocks they lack. Only
+// blocks inside i_size are written. Like readpages, every run of adjacent
+// blocks inside a page is one bio and all of them go out under one plug.
+static int ext2_writepages_impl(vfs_node_t *node, uint32_t index, uint32_t nr,
+                                uint8_t **pages) {
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  if (!mnt)
+    return -1;
+  uint32_t bs = mnt->block_size;
+  uint32_t per_page = PAGE_CACHE_SIZE / bs;
+  struct bio *bios = kmalloc(nr * per_page * sizeof(struct bio));
+  if (!bios)
+    return -1;
+  ext2_inode_info_t *ei = ext2_iget(mnt, node->inode);
+  if (!ei) {
+    kfree(bios);
+    return -1;
+  }
+  ext2_inode_t *inode = &ei->raw;
+  uint32_t file_blocks = (uint32_t)((ext2_isize(inode) + bs - 1) / bs);
+  uint32_t nr_bios = 0;
+  bool allocated = false;
+  int err = 0;
+
+  bool own = ext3_journal_start(mnt) == 0;
+  for (uint32_t p = 0; p < nr && !err; p++) {
+    uint32_t first = (index + p) * per_page;
+    uint32_t run_start = 0, run_disk = 0, run_len = 0;
+    for (uint32_t i = 0; i <= per_page; i++) {
+      uint32_t disk = 0;
+      if (i < per_page && first + i < file_blocks) {
+        disk = ext2_bmap(mnt, ei, first + i, NULL);
+        if (!disk) {
+          uint32_t goal = ei->alloc_goal;
+          if (!goal)
+            goal = ext2_block_goal(mnt, node->inode, inode, first + i);
+          disk = ext2_alloc_block_from(mnt, goal, true);
+          if (!disk) {
+            err = -1; // Reservations are estimates: this should be rare
+          } else {
+            ei->alloc_goal = disk + 1;
+            if (ext2_set_block_num(mnt, inode, first + i, disk, true) == 0)
+              ext2_map_add(ei, first + i, disk);
+            inode->i_blocks += bs / 512;
+            allocated = true;
+          }
+        }
+      }
+      if (disk && run_len && disk == run_disk + run_len) {
+        run_len++;
+        continue;
+      }
+      if (run_len)
+        bio_init(&bios[nr_bios++], mnt->dev, BIO_WRITE,
+                 (uint64_t)run_disk * bs / 512, run_len * (bs / 512),
+                 pages[p] + run_start * bs);
+      run_len = 0;
+      if (i == per_page || err)
+        break;
+      if (disk) {
+        run_start = i;
+        run_disk = disk;
+        run_len = 1;
+      }
+    }
+  }
+  if (allocated) {
+    ei->data_dirty = true;
+    ext2_mark_inode_dirty(ei);
+  }
+
+  struct ext2_readpages_io io;
+  io.pending = nr_bios;
+  io.status = 0;
+  completion_init(&io.done);
+  if (nr_bios) {
+    struct blk_plug plug;
+    blk_start_plug(&plug);
+    for (uint32_t b = 0; b < nr_bios; b++) {
+      bios[b].end_io = ext2_readpages_end_io;
+      bios[b].private = &io;
+      submit_bio(&bios[b]);
+    }
+    blk_finish_plug(&plug);
+    wait_for_completion(&io.done);
+  }
+  // Ordered: the new mappings commit after the data they point at is written
+  if (own)
+    ext3_journal_stop(mnt);
+  kfree(bios);
+  ext2_iput(mnt, ei);
+  return err ? err : io.status;
+}
+
+static int ext2_fsync_impl(vfs_node_t *node, bool datasync) {
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  ext2_inode_info_t *ei = ext2_node_inode(node);
+  if (!mnt || !ei)
+    return -1;
+  int err = 0;
+  // fdatasync skips an inode whose only changes are timestamps
+  if (ei->dirty && (!datasync || ei->data_dirty))
+    err = ext2_inode_writeback(mnt, ei);
+  // With a journal the metadata is durable once it is in the log: one
+  // commit instead of writing every dirty buffer home
+  if (mnt->journal) {
+    if (ext3_journal_force_commit(mnt) != 0)
+      err = -1;
+  } else if (block_sync(mnt->dev) != 0) {
+    err = -1;
+  }
+  return err;
+}
+
+// Flusher callback: push dirty inodes and the superblock into the buffer
+// cache; for sync() and syncfs() also commit the journal and write and
+// flush the disk.
+static int ext2_sync_fs(void *fs, bool wait) {
+  ext2_mount_t *mnt = (ext2_mount_t *)fs;
+  int err = ext2_sync_inodes(mnt);
+  if (wait && ext3_journal_force_commit(mnt) != 0)
+    err = -1;
+  if (wait && block_sync(mnt->dev) != 0)
+    err = -1;
+  return err;
+}
+
+// ── Directory blocks ────────────────────────────────────────────────────────
+
+// Space a directory entry with a name of name_len bytes takes up
+#define EXT2_DIR_REC_LEN(name_len) ((8 + (name_len) + 3) & ~3u)
+
+// Where a directory entry was found. bh stays referenced until brelse().
+typedef struct {
+  struct buffer_head *bh;
+  uint32_t offset; // Of the entry within the block
+  uint32_t prev;   // Of the entry before it; equal to offset if first
+} ext2_dir_slot_t;
+
+// Look for name among the live entries of one directory block.
+static bool ext2_dir_block_find(ext2_mount_t *mnt, struct buffer_head *bh,
+                                const char *name, uint32_t name_len,
+                                ext2_dir_slot_t *slot) {
+  uint32_t pos = 0, prev = 0;
+  while (pos + 8 <= mnt->block_size) {
+    ext2_dirent_t *entry = (ext2_dirent_t *)(bh->data + pos);
+    if (entry->rec_len < 8 || pos + entry->rec_len > mnt->block_size)
+      break; // Malformed
+    if (entry->inode != 0 && entry->name_len == name_len &&
+        memcmp(entry->name, name, name_len) == 0) {
+      slot->bh = bh;
+      slot->offset = pos;
+      slot->prev = prev;
+      return true;
+    }
+    prev = pos;
+    pos += entry->rec_len;
+  }
+  return false;
+}
+
+// Put a new entry into one directory block if it has room for it: in a
+// free entry, or in the slack after a live one.
+static bool ext2_dir_block_insert(ext2_mount_t *mnt, uint8_t *block,
+                                  const char *name, uint32_t name_len,
+                                  uint32_t child_ino, uint8_t file_type) {
+  uint32_t needed = EXT2_DIR_REC_LEN(name_len);
+  uint32_t pos = 0;
+  while (pos + 8 <= mnt->block_size) {
+    ext2_dirent_t *entry = (ext2_dirent_t *)(block + pos);
+    if (entry->rec_len < 8 || pos + entry->rec_len > mnt->block_size)
+      return false; // Malformed
+    uint32_t used = entry->inode ? EXT2_DIR_REC_LEN(entry->name_len) : 0;
+    if (entry->rec_len >= used + needed) {
+      ext2_dirent_t *new_entry = entry;
+      if (used) {
+        // Split: the new entry lives right after this one
+        new_entry = (ext2_dirent_t *)(block + pos + used);
+        new_entry->rec_len = (uint16_t)(entry->rec_len - used);
+        entry->rec_len = (uint16_t)used;
+      }
+      new_entry->inode = child_ino;
+      new_entry->name_len = (uint8_t)name_len;
+      new_entry->file_type = file_type;
+      memcpy(new_entry->name, name, name_len);
+      return true;
+    }
+    pos += entry->rec_len;
+  }
+  return false;
+}
+
+// Grow a directory by one zeroed block, returned with its logical number.
+// dir is the caller's copy of the inode and has to be written back.
+static struct buffer_head *ext2_dir_append_block(ext2_mount_t *mnt,
+                                                 uint32_t dir_ino,
+                                                 ext2_inode_t *dir,
+                                                 uint32_t *logical) {
+  uint32_t lblk = dir->i_size / mnt->block_size;
+  uint32_t block =
+      ext2_alloc_block(mnt, ext2_block_goal(mnt, dir_ino, dir, lblk));
+  if (!block)
+    return NULL;
+  if (ext2_set_block_num(mnt, dir, lblk, block, false) != 0) {
+    ext2_free_block(mnt, block);
+    return NULL;
+  }
+  dir->i_size += mnt->block_size;
+  dir->i_blocks += mnt->block_size / 512;
+  *logical = lblk;
+  return ext2_new_zero_block(mnt, block);
+}
+
+// ── Hashed directory index (htree) ──────────────────────────────────────────
+// A directory with EXT2_INDEX_FL keeps a tree of name hashes: the root sits
+// in its first block behind the "." and ".." entries and, for big
+// directories, one level of index nodes hangs below it (blocks that look
+// like a single free entry to a linear reader). The leaves are ordinary
+// directory blocks, each holding the names of one hash range, so a lookup
+// reads a root, perhaps a node, and one leaf. A full leaf is split in two
+// by hash; a one-block directory gets an index when it fills up. Linear
+// scans (readdir, the rmdir emptiness check) work on either layout.
+
+#define EXT2_DX_MAX_LEVELS 2    // Root plus one level of nodes
+#define EXT2_DX_BAD (-2)        // Index unusable: treat as a linear directory
+#define EXT2_DX_ROOT_ENTRIES 32 // Offset of the root's entries
+#define EXT2_DX_NODE_ENTRIES 8  // Offset of a node's entries
+#define EXT2_HTREE_EOF 0x7FFFFFFFu
+
+typedef struct {
+  struct buffer_head *bh;
+  ext2_dx_entry_t *entries; // entries[0] starts with the count and limit
+  uint32_t at;              // Entry followed down to the next level
+} ext2_dx_frame_t;
+
+static ext2_dx_countlimit_t *ext2_dx_countlimit(ext2_dx_entry_t *entries) {
+  return (ext2_dx_countlimit_t *)entries;
+}
+
+static uint32_t ext2_dx_entry_block(ext2_dx_entry_t *entry) {
+  return entry->block & 0x0FFFFFFF;
+}
+
+static bool ext2_dir_indexed(ext2_mount_t *mnt, const ext2_inode_t *dir) {
+  return (mnt->sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) &&
+         (dir->i_flags & EXT2_INDEX_FL);
+}
+
+static uint32_t ext2_rol32(uint32_t x, uint32_t s) {
+  return (x << s) | (x >> (32 - s));
+}
+
+static uint32_t ext2_dx_hack_hash(const char *name, uint32_t len,
+                                  bool unsigned_chars) {
+  uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  for (uint32_t i = 0; i < len; i++) {
+    int c = unsigned_chars ? (int)(uint8_t)name[i] : (int)(int8_t)name[i];
+    hash = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+    if (hash & 0x80000000)
+      hash -= 0x7fffffff;
+    hash1 = hash0;
+    hash0 = hash;
+  }
+  return hash0 << 1;
+}
+
+// Pack up to num * 4 bytes of msg into num words, padded with the length.
+static void ext2_dx_str2hashbuf(const char *msg, int len, uint32_t *buf,
+                                int num, bool unsigned_chars) {
+  uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+  pad |= pad << 16;
+  uint32_t val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (int i = 0; i < len; i++) {
+    int c = unsigned_chars ? (int)(uint8_t)msg[i] : (int)(int8_t)msg[i];
+    val = (uint32_t)c + (val << 8);
+    if ((i % 4) == 3) {
+      *buf++ = val;
+      val = pad;
+      num--;
+    }
+  }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+#define EXT2_MD4_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define EXT2_MD4_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT2_MD4_H(x, y, z) ((x) ^ (y) ^ (z))
+#define EXT2_MD4_ROUND(f, a, b, c, d, x, s)                                    \
+  (a += f(b, c, d) + (x), a = ext2_rol32(a, s))
+#define EXT2_MD4_K2 013240474631u
+#define EXT2_MD4_K3 015666365641u
+
+// Cut-down MD4, as used by ext3's directory index.
+static void ext2_dx_half_md4(uint32_t buf[4], const uint32_t in[8]) {
+  uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  EXT2_MD4_ROUND(EXT2_MD4_F, a, b, c, d, in[0], 3);
+  EXT2_MD4_ROUND(EXT2_MD4_F, d, a, b, c, in[1], 7);
+  EXT2_MD4_ROUND(EXT2_MD4_F, c, d, a, b, in[2], 11);
+  EXT2_MD4_ROUND(EXT2_MD4_F, b, c, d, a, in[3], 19);
+  EXT2_MD4_ROUND(EXT2_MD4_F, a, b, c, d, in[4], 3);
+  EXT2_MD4_ROUND(EXT2_MD4_F, d, a, b, c, in[5], 7);
+  EXT2_MD4_ROUND(EXT2_MD4_F, c, d, a, b, in[6], 11);
+  EXT2_MD4_ROUND(EXT2_MD4_F, b, c, d, a, in[7], 19);
+
+  EXT2_MD4_ROUND(EXT2_MD4_G, a, b, c, d, in[1] + EXT2_MD4_K2, 3);
+  EXT2_MD4_ROUND(EXT2_MD4_G, d, a, b, c, in[3] + EXT2_MD4_K2, 5);
+  EXT2_MD4_ROUND(EXT2_MD4_G, c, d, a, b, in[5] + EXT2_MD4_K2, 9);
+  EXT2_MD4_ROUND(EXT2_MD4_G, b, c, d, a, in[7] + EXT2_MD4_K2, 13);
+  EXT2_MD4_ROUND(EXT2_MD4_G, a, b, c, d, in[0] + EXT2_MD4_K2, 3);
+  EXT2_MD4_ROUND(EXT2_MD4_G, d, a, b, c, in[2] + EXT2_MD4_K2, 5);
+  EXT2_MD4_ROUND(EXT2_MD4_G, c, d, a, b, in[4] + EXT2_MD4_K2, 9);
+  EXT2_MD4_ROUND(EXT2_MD4_G, b, c, d, a, in[6] + EXT2_MD4_K2, 13);
+
+  EXT2_MD4_ROUND(EXT2_MD4_H, a, b, c, d, in[3] + EXT2_MD4_K3, 3);
+  EXT2_MD4_ROUND(EXT2_MD4_H, d, a, b, c, in[7] + EXT2_MD4_K3, 9);
+  EXT2_MD4_ROUND(EXT2_MD4_H, c, d, a, b, in[2] + EXT2_MD4_K3, 11);
+  EXT2_MD4_ROUND(EXT2_MD4_H, b, c, d, a, in[6] + EXT2_MD4_K3, 15);
+  EXT2_MD4_ROUND(EXT2_MD4_H, a, b, c, d, in[1] + EXT2_MD4_K3, 3);
+  EXT2_MD4_ROUND(EXT2_MD4_H, d, a, b, c, in[5] + EXT2_MD4_K3, 9);
+  EXT2_MD4_ROUND(EXT2_MD4_H, c, d, a, b, in[0] + EXT2_MD4_K3, 11);
+  EXT2_MD4_ROUND(EXT2_MD4_H, b, c, d, a, in[4] + EXT2_MD4_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+static void ext2_dx_tea(uint32_t buf[4], const uint32_t in[4]) {
+  uint32_t sum = 0;
+  uint32_t b0 = buf[0], b1 = buf[1];
+  uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+  for (int n = 0; n < 16; n++) {
+    sum += 0x9E3779B9;
+    b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+    b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+  }
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+// Hash of a name under hash function version, bit 0 clear.
+static uint32_t ext2_dx_hash(ext2_mount_t *mnt, uint8_t version,
+                             const char *name, uint32_t len) {
+  uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  for (int i = 0; i < 4; i++) {
+    if (mnt->sb.s_hash_seed[i]) {
+      for (int j = 0; j < 4; j++)
+        buf[j] = mnt->sb.s_hash_seed[j];
+      break;
+    }
+  }
+  if (version <= EXT2_HASH_TEA &&
+      (mnt->sb.s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+    version += EXT2_HASH_LEGACY_UNSIGNED;
+  bool unsigned_chars = version >= EXT2_HASH_LEGACY_UNSIGNED;
+
+  uint32_t in[8];
+  uint32_t hash;
+  const char *p = name;
+  int left = (int)len;
+  switch (version) {
+  case EXT2_HASH_HALF_MD4:
+  case EXT2_HASH_HALF_MD4_UNSIGNED:
+    do {
+      ext2_dx_str2hashbuf(p, left, in, 8, unsigned_chars);
+      ext2_dx_half_md4(buf, in);
+      left -= 32;
+      p += 32;
+    } while (left > 0);
+    hash = buf[1];
+    break;
+  case EXT2_HASH_TEA:
+  case EXT2_HASH_TEA_UNSIGNED:
+    do {
+      ext2_dx_str2hashbuf(p, left, in, 4, unsigned_chars);
+      ext2_dx_tea(buf, in);
+      left -= 16;
+      p += 16;
+    } while (left > 0);
+    hash = buf[0];
+    break;
+  default:
+    hash = ext2_dx_hack_hash(name, len, unsigned_chars);
+    break;
+  }
+
+  hash &= ~1u;
+  if (hash == (EXT2_HTREE_EOF << 1))
+    hash = (EXT2_HTREE_EOF - 1) << 1;
+  return hash;
+}
+
+static ext2_dx_root_info_t *ext2_dx_root_info(struct buffer_head *root) {
+  return (ext2_dx_root_info_t *)(root->data + 24);
+}
+
+static void ext2_dx_release(ext2_dx_frame_t *frames, int levels) {
+  for (int i = 0; i <= levels; i++)
+    brelse(frames[i].bh);
+}
+
+// Walk the index of dir down to the entry that covers name. frames[0] is
+// the root. Returns the number of index levels below the root, or
+// EXT2_DX_BAD if the index cannot be used.
+static int ext2_dx_probe(ext2_mount_t *mnt, ext2_inode_t *dir,
+                         const char *name, uint32_t name_len,
+                         uint32_t *hash_out, ext2_dx_frame_t *frames) {
+  struct buffer_head *bh = ext2_bread(mnt, ext2_get_block_num(mnt, dir, 0));
+  if (!bh)
+    return EXT2_DX_BAD;
+  ext2_dx_root_info_t *info = ext2_dx_root_info(bh);
+  if (info->reserved_zero != 0 || info->info_length != 8 ||
+      info->hash_version > EXT2_HASH_TEA_UNSIGNED ||
+      info->indirect_levels >= EXT2_DX_MAX_LEVELS) {
+    brelse(bh);
+    return EXT2_DX_BAD;
+  }
+  int levels = info->indirect_levels;
+  uint32_t hash = ext2_dx_hash(mnt, info->hash_version, name, name_len);
+
+  ext2_dx_entry_t *entries =
+      (ext2_dx_entry_t *)(bh->data + EXT2_DX_ROOT_ENTRIES);
+  uint32_t limit = (mnt->block_size - EXT2_DX_ROOT_ENTRIES) / 8;
+  for (int level = 0;; level++) {
+    ext2_dx_countlimit_t *cl = ext2_dx_countlimit(entries);
+    if (cl->limit != limit || cl->count == 0 || cl->count > limit) {
+      brelse(bh);
+      ext2_dx_release(frames, level - 1);
+      return EXT2_DX_BAD;
+    }
+    // Last entry whose hash is <= hash; entries[0] stands for hash 0
+    uint32_t lo = 1, hi = cl->count;
+    while (lo < hi) {
+      uint32_t mid = (lo + hi) / 2;
+      if (entries[mid].hash > hash)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+    frames[level].bh = bh;
+    frames[level].entries = entries;
+    frames[level].at = lo - 1;
+    if (level == levels)
+      break;
+
+    bh = ext2_bread(mnt, ext2_get_block_num(
+                             mnt, dir, ext2_dx_entry_block(&entries[lo - 1])));
+    if (!bh) {
+      ext2_dx_release(frames, level);
+      return EXT2_DX_BAD;
+    }
+    entries = (ext2_dx_entry_t *)(bh->data + EXT2_DX_NODE_ENTRIES);
+    limit = (mnt->block_size - EXT2_DX_NODE_ENTRIES) / 8;
+  }
+  *hash_out = hash;
+  return levels;
+}
+
+// The leaf block the bottom frame points at.
+static struct buffer_head *ext2_dx_leaf(ext2_mount_t *mnt, ext2_inode_t *dir,
+                                        ext2_dx_frame_t *frame) {
+  return ext2_bread(mnt, ext2_get_block_num(
+                             mnt, dir,
+                             ext2_dx_entry_block(&frame->entries[frame->at])));
+}
+
+// After a miss in the current leaf: move the frames on to the next leaf if
+// it may hold more names with the same hash (a run of equal hashes that
+// was split across leaves). Returns 1 if it did, 0 if not, -1 on error.
+static int ext2_dx_next_leaf(ext2_mount_t *mnt, ext2_inode_t *dir,
+                             ext2_dx_frame_t *frames, int levels,
+                             uint32_t hash) {
+  int level = levels;
+  while (frames[level].at + 1 >=
+         ext2_dx_countlimit(frames[level].entries)->count) {
+    if (level == 0)
+      return 0;
+    level--;
+  }
+  frames[level].at++;
+  if ((frames[level].entries[frames[level].at].hash & ~1u) != hash)
+    return 0;
+
+  // Descend to the leftmost leaf below the new position
+  while (level < levels) {
+    ext2_dx_frame_t *f = &frames[level];
+    struct buffer_head *bh = ext2_bread(
+        mnt, ext2_get_block_num(mnt, dir,
+                                ext2_dx_entry_block(&f->entries[f->at])));
+    if (!bh)
+      return -1;
+    level++;
+    brelse(frames[level].bh);
+    frames[level].bh = bh;
+    frames[level].entries =
+        (ext2_dx_entry_t *)(bh->data + EXT2_DX_NODE_ENTRIES);
+    frames[level].at = 0;
+  }
+  return 1;
+}
+
+// Insert (hash, block) into an index block right after the entry at.
+static void ext2_dx_insert(ext2_dx_frame_t *frame, uint32_t hash,
+                           uint32_t block) {
+  ext2_dx_countlimit_t *cl = ext2_dx_countlimit(frame->entries);
+  ext2_dx_entry_t *pos = &frame->entries[frame->at + 1];
+  memmove(pos + 1, pos, (cl->count - frame->at - 1) * sizeof(ext2_dx_entry_t));
+  pos->hash = hash;
+  pos->block = block;
+  cl->count++;
+}
+
+// Format a fresh block as an empty index node; returns its entries.
+static ext2_dx_entry_t *ext2_dx_init_node(ext2_mount_t *mnt,
+                                          struct buffer_head *bh) {
+  ext2_dirent_t *fake = (ext2_dirent_t *)bh->data;
+  fake->inode = 0;
+  fake->rec_len = (uint16_t)mnt->block_size;
+  ext2_dx_entry_t *entries =
+      (ext2_dx_entry_t *)(bh->data + EXT2_DX_NODE_ENTRIES);
+  ext2_dx_countlimit(entries)->limit =
+      (uint16_t)((mnt->block_size - EXT2_DX_NODE_ENTRIES) / 8);
+  return entries;
+}
+
+// The index block above a full leaf is full as well. If it is the root,
+// its entries move down into a new node (the tree grows a level);
+// otherwise the node is split and its upper half entered into the root.
+// Returns the new number of levels, or -1 if the index cannot grow.
+static int ext2_dx_make_room(ext2_mount_t *mnt, uint32_t dir_ino,
+                             ext2_inode_t *dir, ext2_dx_frame_t *frames,
+                             int levels) {
+  uint32_t logical;
+  if (levels == 0) {
+    struct buffer_head *nbh =
+        ext2_dir_append_block(mnt, dir_ino, dir, &logical);
+    if (!nbh)
+      return -1;
+    ext2_dx_entry_t *entries = ext2_dx_init_node(mnt, nbh);
+    ext2_dx_countlimit_t *root_cl = ext2_dx_countlimit(frames[0].entries);
+    uint16_t limit = ext2_dx_countlimit(entries)->limit;
+    memcpy(entries, frames[0].entries,
+           root_cl->count * sizeof(ext2_dx_entry_t));
+    ext2_dx_countlimit(entries)->limit = limit;
+
+    root_cl->count = 1;
+    frames[0].entries[0].block = logical;
+    ext2_dx_root_info(frames[0].bh)->indirect_levels = 1;
+    frames[1].bh = nbh;
+    frames[1].entries = entries;
+    frames[1].at = frames[0].at;
+    frames[0].at = 0;
+    ext2_dirty_block(mnt, frames[0].bh);
+    ext2_dirty_block(mnt, nbh);
+    return 1;
+  }
+
+  ext2_dx_countlimit_t *root_cl = ext2_dx_countlimit(frames[0].entries);
+  if (root_cl->count >= root_cl->limit) {
+    klog_puts("[EXT2] Directory index full\n");
+    return -1;
+  }
+  struct buffer_head *nbh = ext2_dir_append_block(mnt, dir_ino, dir, &logical);
+  if (!nbh)
+    return -1;
+  ext2_dx_entry_t *entries = ext2_dx_init_node(mnt, nbh);
+  ext2_dx_countlimit_t *cl = ext2_dx_countlimit(frames[1].entries);
+  uint32_t half = cl->count / 2;
+  uint32_t moved = cl->count - half;
+  uint16_t limit = ext2_dx_countlimit(entries)->limit;
+  uint32_t hash = frames[1].entries[half].hash;
+  memcpy(entries, &frames[1].entries[half], moved * sizeof(ext2_dx_entry_t));
+  ext2_dx_countlimit(entries)->limit = limit;
+  ext2_dx_countlimit(entries)->count = (uint16_t)moved;
+  cl->count = (uint16_t)half;
+  ext2_dx_insert(&frames[0], hash, logical);
+  ext2_dirty_block(mnt, frames[0].bh);
+  ext2_dirty_block(mnt, frames[1].bh);
+  ext2_dirty_block(mnt, nbh);
+
+  if (frames[1].at >= half) {
+    brelse(frames[1].bh);
+    frames[1].bh = nbh;
+    frames[1].entries = entries;
+    frames[1].at -= half;
+    frames[0].at++;
+  } else {
+    brelse(nbh);
+  }
+  return 1;
+}
+
+// A live entry of a leaf being reorganised
+typedef struct {
+  uint32_t hash;
+  uint16_t offset;
+  uint16_t size;
+} ext2_dx_map_t;
+
+// Collect the live entries of a directory block from byte start on.
+static uint32_t ext2_dx_map_block(ext2_mount_t *mnt, const uint8_t *block,
+                                  uint32_t start, uint8_t version,
+                                  ext2_dx_map_t *map) {
+  uint32_t count = 0;
+  uint32_t pos = start;
+  while (pos + 8 <= mnt->block_size) {
+    ext2_dirent_t *entry = (ext2_dirent_t *)(block + pos);
+    if (entry->rec_len < 8 || pos + entry->rec_len > mnt->block_size)
+      break;
+    if (entry->inode) {
+      map[count].hash =
+          ext2_dx_hash(mnt, version, entry->name, entry->name_len);
+      map[count].offset = (uint16_t)pos;
+      map[count].size = (uint16_t)EXT2_DIR_REC_LEN(entry->name_len);
+      count++;
+    }
+    pos += entry->rec_len;
+  }
+  return count;
+}
+
+// Copy the entries in map from src to dst back to back; the last one
+// takes up the rest of the block.
+static void ext2_dx_pack(ext2_mount_t *mnt, const uint8_t *src,
+                         const ext2_dx_map_t *map, uint32_t count,
+                         uint8_t *dst) {
+  uint32_t pos = 0;
+  ext2_dirent_t *last = NULL;
+  for (uint32_t i = 0; i < count; i++) {
+    memcpy(dst + pos, src + map[i].offset, map[i].size);
+    last = (ext2_dirent_t *)(dst + pos);
+    last->rec_len = map[i].size;
+    pos += map[i].size;
+  }
+  if (last) {
+    last->rec_len += (uint16_t)(mnt->block_size - pos);
+  } else {
+    last = (ext2_dirent_t *)dst;
+    last->inode = 0;
+    last->rec_len = (uint16_t)mnt->block_size;
+  }
+}
+
+// Split the full leaf bh under frame by hash: the upper half of its names,
+// by size, moves to a new block that is entered into the index after it.
+// Returns whichever of the two now covers hash; the other is released.
+static struct buffer_head *ext2_dx_split_leaf(ext2_mount_t *mnt,
+                                              uint32_t dir_ino,
+                                              ext2_inode_t *dir,
+                                              uint8_t version,
+                                              ext2_dx_frame_t *frame,
+                                              struct buffer_head *bh,
+                                              uint32_t hash) {
+  uint32_t bs = mnt->block_size;
+  ext2_dx_map_t *map = kmalloc((bs / 12 + 1) * sizeof(ext2_dx_map_t));
+  uint8_t *tmp = kmalloc(bs);
+  struct buffer_head *nbh = NULL;
+  if (!map || !tmp)
+    goto fail;
+
+  uint32_t count = ext2_dx_map_block(mnt, bh->data, 0, version, map);
+  if (count < 2)
+    goto fail;
+  // Sort by hash (a block holds a few hundred names at most)
+  for (uint32_t i = 1; i < count; i++) {
+    ext2_dx_map_t m = map[i];
+    uint32_t j = i;
+    while (j > 0 && map[j - 1].hash > m.hash) {
+      map[j] = map[j - 1];
+      j--;
+    }
+    map[j] = m;
+  }
+
+  // Move names from the top until half the block would be gone
+  uint32_t size = 0, move = 0;
+  for (uint32_t i = count - 1; i > 0; i--) {
+    if (size + map[i].size / 2 > bs / 2)
+      break;
+    size += map[i].size;
+    move++;
+  }
+  if (move == 0)
+    move = 1;
+  uint32_t split = count - move;
+  uint32_t hash2 = map[split].hash;
+  uint32_t continued = hash2 == map[split - 1].hash;
+
+  uint32_t logical;
+  nbh = ext2_dir_append_block(mnt, dir_ino, dir, &logical);
+  if (!nbh)
+    goto fail;
+  ext2_dx_pack(mnt, bh->data, map + split, move, nbh->data);
+  ext2_dx_pack(mnt, bh->data, map, split, tmp);
+  memcpy(bh->data, tmp, bs);
+  ext2_dx_insert(frame, hash2 | continued, logical);
+  ext2_dirty_block(mnt, frame->bh);
+  ext2_dirty_block(mnt, bh);
+  ext2_dirty_block(mnt, nbh);
+  kfree(map);
+  kfree(tmp);
+
+  if (hash >= hash2) {
+    brelse(bh);
+    return nbh;
+  }
+  brelse(nbh);
+  return bh;
+
+fail:
+  kfree(map);
+  kfree(tmp);
+  brelse(bh);
+  return NULL;
+}
+
+// Insert into an indexed directory. Returns 0 or -1, or EXT2_DX_BAD if the
+// index is unusable and the caller should insert linearly.
+static int ext2_dx_add_entry(ext2_mount_t *mnt, uint32_t dir_ino,
+                             ext2_inode_t *dir, const char *name,
+                             uint32_t name_len, uint32_t child_ino,
+                             uint8_t file_type) {
+  ext2_dx_frame_t frames[EXT2_DX_MAX_LEVELS];
+  uint32_t hash;
+  int levels = ext2_dx_probe(mnt, dir, name, name_len, &hash, frames);
+  if (levels < 0)
+    return EXT2_DX_BAD;
+
+  int err = -1;
+  struct buffer_head *bh = ext2_dx_leaf(mnt, dir, &frames[levels]);
+  if (!bh)
+    goto out;
+  if (!ext2_dir_block_insert(mnt, bh->data, name, name_len, child_ino,
+                             file_type)) {
+    ext2_dx_countlimit_t *cl = ext2_dx_countlimit(frames[levels].entries);
+    if (cl->count >= cl->limit) {
+      int grown = ext2_dx_make_room(mnt, dir_ino, dir, frames, levels);
+      if (grown < 0)
+        goto out;
+      levels = grown;
+    }
+    uint8_t version = ext2_dx_root_info(frames[0].bh)->hash_version;
+    bh = ext2_dx_split_leaf(mnt, dir_ino, dir, version, &frames[levels], bh,
+                            hash);
+    if (!bh || !ext2_dir_block_insert(mnt, bh->data, name, name_len,
+                                      child_ino, file_type))
+      goto out;
+  }
+  ext2_dirty_block(mnt, bh);
+  err = 0;
+
+out:
+  brelse(bh);
+  ext2_dx_release(frames, levels);
+  return err;
+}
+
+// Give a full one-block directory an index: its entries move to a new leaf
+// and the first block becomes the root. Returns -1 (and changes nothing)
+// if the block does not start with "." and "..".
+static int ext2_dx_make_indexed(ext2_mount_t *mnt, uint32_t dir_ino,
+                                ext2_inode_t *dir) {
+  uint32_t bs = mnt->block_size;
+  struct buffer_head *bh = ext2_bread(mnt, ext2_get_block_num(mnt, dir, 0));
+  if (!bh)
+    return -1;
+  ext2_dirent_t *dot = (ext2_dirent_t *)bh->data;
+  ext2_dirent_t *dotdot = (ext2_dirent_t *)(bh->data + 12);
+  if (dot->rec_len != 12 || dot->name_len != 1 || dot->name[0] != '.' ||
+      dotdot->rec_len < 12 || 12u + dotdot->rec_len > bs ||
+      dotdot->name_len != 2 || dotdot->name[0] != '.' ||
+      dotdot->name[1] != '.') {
+    brelse(bh);
+    return -1;
   }
 
-  // Update size if we wrote past the end
-  if (offset + bytes_written > inode.i_size) {
-    inode.i_size = offset + bytes_written;
+  uint8_t version = mnt->sb.s_def_hash_version;
+  if (version > EXT2_HASH_TEA_UNSIGNED)
+    version = EXT2_HASH_HALF_MD4;
+  ext2_dx_map_t *map = kmalloc((bs / 12 + 1) * sizeof(ext2_dx_map_t));
+  uint32_t logical;
+  struct buffer_head *leaf =
+      map ? ext2_dir_append_block(mnt, dir_ino, dir, &logical) : NULL;
+  if (!leaf) {
+    kfree(map);
+    brelse(bh);
+    return -1;
   }
+  uint32_t count =
+      ext2_dx_map_block(mnt, bh->data, 12 + dotdot->rec_len, version, map);
+  ext2_dx_pack(mnt, bh->data, map, count, leaf->data);
+  kfree(map);
+
+  dotdot->rec_len = (uint16_t)(bs - 12);
+  memset(bh->data + 24, 0, bs - 24);
+  ext2_dx_root_info_t *info = ext2_dx_root_info(bh);
+  info->hash_version = version;
+  info->info_length = 8;
+  ext2_dx_entry_t *entries =
+      (ext2_dx_entry_t *)(bh->data + EXT2_DX_ROOT_ENTRIES);
+  ext2_dx_countlimit(entries)->limit =
+      (uint16_t)((bs - EXT2_DX_ROOT_ENTRIES) / 8);
+  ext2_dx_countlimit(entries)->count = 1;
+  entries[0].block = logical;
+  dir->i_flags |= EXT2_INDEX_FL;
+
+  ext2_dirty_block(mnt, bh);
+  ext2_dirty_block(mnt, leaf);
+  brelse(leaf);
+  brelse(bh);
+  return 0;
+}
 
-  // Update modification timestamp
-  uint32_t now = ext2_current_time();
-  inode.i_mtime = now;
-  inode.i_ctime = now;
-
-  ext3_journal_start(mnt);
-  ext2_write_inode(mnt, node->inode, &inode);
-  ext3_journal_stop(mnt);
-  node->length = inode.i_size;
+// Find name in dir: through the index if it has one, else block by block.
+// On success slot->bh holds the block with the entry.
+static int ext2_dir_find(ext2_mount_t *mnt, ext2_inode_t *dir,
+                         const char *name, ext2_dir_slot_t *slot) {
+  uint32_t name_len = strlen(name);
+  if (name_len > 255)
+    return -1;
+
+  if (ext2_dir_indexed(mnt, dir)) {
+    ext2_dx_frame_t frames[EXT2_DX_MAX_LEVELS];
+    uint32_t hash;
+    int levels = ext2_dx_probe(mnt, dir, name, name_len, &hash, frames);
+    if (levels >= 0) {
+      int more = 1;
+      while (more > 0) {
+        struct buffer_head *bh = ext2_dx_leaf(mnt, dir, &frames[levels]);
+        if (bh && ext2_dir_block_find(mnt, bh, name, name_len, slot)) {
+          ext2_dx_release(frames, levels);
+          return 0;
+        }
+        brelse(bh);
+        more = ext2_dx_next_leaf(mnt, dir, frames, levels, hash);
+      }
+      ext2_dx_release(frames, levels);
+      return -1;
+    }
+    // Damaged index: the leaves are still ordinary directory blocks
+  }
 
-  kfree(block_buf);
-  return bytes_written;
+  uint32_t nblocks = dir->i_size / mnt->block_size;
+  for (uint32_t lblk = 0; lblk < nblocks; lblk++) {
+    struct buffer_head *bh =
+        ext2_bread(mnt, ext2_get_block_num(mnt, dir, lblk));
+    if (!bh)
+      break;
+    if (ext2_dir_block_find(mnt, bh, name, name_len, slot))
+      return 0;
+    brelse(bh);
+  }
+  return -1;
 }
 
 // ── Directory Operations ────────────────────────────────────────────────────
 
-static struct dirent *ext2_readdir_impl(vfs_node_t *node, uint32_t index) {
+// The VFS type of a directory entry's file_type (0 without the feature).
+static uint32_t ext2_dirent_type(uint8_t file_type) {
+  switch (file_type) {
+  case EXT2_FT_REG_FILE:
+    return FS_FILE;
+  case EXT2_FT_DIR:
+    return FS_DIRECTORY;
+  case EXT2_FT_CHRDEV:
+    return FS_CHARDEV;
+  case EXT2_FT_BLKDEV:
+    return FS_BLOCKDEV;
+  case EXT2_FT_FIFO:
+    return FS_PIPE;
+  case EXT2_FT_SOCK:
+    return FS_SOCKET;
+  case EXT2_FT_SYMLINK:
+    return FS_SYMLINK;
+  default:
+    return 0;
+  }
+}
+
+// The position cookie is a byte offset into the directory. Entries never
+// move within a block, but one may be merged into its predecessor by an
+// unlink, so a resume rescans its block from the start and continues with
+// the first entry at or after the cookie.
+static int ext2_readdir_impl(vfs_node_t *node, uint64_t *pos,
+                             struct dirent *buf, uint32_t count) {
   ext2_mount_t *mnt = (ext2_mount_t *)node->device;
   if (!mnt)
-    return NULL;
-
-  ext2_inode_t inode;
-  if (ext2_read_inode(mnt, node->inode, &inode))
-    return NULL;
-
-  static struct dirent d;
-  memset(&d, 0, sizeof(d));
-
-  uint8_t *block_buf = kmalloc(mnt->block_size);
-  if (!block_buf)
-    return NULL;
+    return -1;
 
-  uint32_t dir_size = inode.i_size;
-  uint32_t byte_pos = 0;
-  uint32_t entry_index = 0;
+  ext2_inode_info_t *ei = ext2_node_inode(node);
+  if (!ei)
+    return -1;
 
-  while (byte_pos < dir_size) {
-    uint32_t logical_block = byte_pos / mnt->block_size;
-    uint32_t offset_in_block = byte_pos % mnt->block_size;
+  uint32_t bs = mnt->block_size;
+  uint64_t p = *pos;
+  uint32_t n = 0;
 
-    if (offset_in_block == 0) {
-      uint32_t disk_block = ext2_get_block_num(mnt, &inode, logical_block);
-      if (disk_block == 0)
-        break;
-      ext2_read_block(mnt, disk_block, block_buf);
+  while (n < count && p < ei->raw.i_size) {
+    uint32_t lblk = (uint32_t)(p / bs);
+    uint32_t want = (uint32_t)(p % bs);
+    uint32_t disk_block = ext2_bmap(mnt, ei, lblk, NULL);
+    if (disk_block == 0) {
+      p = (uint64_t)(lblk + 1) * bs; // Hole
+      continue;
+    }
+    struct buffer_head *bh = ext2_bread(mnt, disk_block);
+    if (!bh) {
+      if (n == 0)
+        return -1;
+      break;
     }
 
-    ext2_dirent_t *entry = (ext2_dirent_t *)(block_buf + offset_in_block);
-
-    if (entry->inode != 0 && entry->rec_len > 0) {
-      if (entry_index == index) {
+    uint32_t off = 0;
+    while (off < bs) {
+      ext2_dirent_t *entry = (ext2_dirent_t *)(bh->data + off);
+      if (entry->rec_len < 8 || off + entry->rec_len > bs) {
+        off = bs; // Malformed: skip the rest of the block
+        break;
+      }
+      if (off >= want && entry->inode != 0) {
+        if (n == count)
+          break;
+        struct dirent *d = &buf[n++];
         uint32_t name_len = entry->name_len;
         if (name_len > 127)
           name_len = 127;
-        memcpy(d.name, entry->name, name_len);
-        d.name[name_len] = '\0';
-        d.ino = entry->inode;
-        kfree(block_buf);
-        return &d;
+        memcpy(d->name, entry->name, name_len);
+        d->name[name_len] = '\0';
+        d->ino = entry->inode;
+        d->type = ext2_dirent_type(entry->file_type);
+        d->next = (uint64_t)lblk * bs + off + entry->rec_len;
       }
-      entry_index++;
+      off += entry->rec_len;
     }
-
-    if (entry->rec_len == 0)
-      break; // Malformed
-    byte_pos += entry->rec_len;
+    brelse(bh);
+    p = (uint64_t)lblk * bs + off;
   }
 
-  kfree(block_buf);
-  return NULL;
+  *pos = p;
+  return (int)n;
 }
 
 static vfs_node_t *ext2_finddir_impl(vfs_node_t *node, char *name) {
@@ -820,68 +2571,31 @@ static vfs_node_t *ext2_finddir_impl(vfs_node_t *node, char *name) {
   if (!mnt)
     return NULL;
 
-  ext2_inode_t dir_inode;
-  if (ext2_read_inode(mnt, node->inode, &dir_inode))
+  ext2_inode_info_t *ei = ext2_node_inode(node);
+  if (!ei)
     return NULL;
 
-  uint8_t *block_buf = kmalloc(mnt->block_size);
-  if (!block_buf)
+  ext2_dir_slot_t slot;
+  if (ext2_dir_find(mnt, &ei->raw, name, &slot))
     return NULL;
+  uint32_t found_ino = ((ext2_dirent_t *)(slot.bh->data + slot.offset))->inode;
+  brelse(slot.bh);
 
-  uint32_t dir_size = dir_inode.i_size;
-  uint32_t byte_pos = 0;
-  uint32_t name_len = strlen(name);
-
-  while (byte_pos < dir_size) {
-    uint32_t logical_block = byte_pos / mnt->block_size;
-    uint32_t offset_in_block = byte_pos % mnt->block_size;
-
-    if (offset_in_block == 0) {
-      uint32_t disk_block = ext2_get_block_num(mnt, &dir_inode, logical_block);
-      if (disk_block == 0)
-        break;
-      ext2_read_block(mnt, disk_block, block_buf);
-    }
-
-    ext2_dirent_t *entry = (ext2_dirent_t *)(block_buf + offset_in_block);
-
-    if (entry->inode != 0 && entry->name_len == name_len) {
-      // Compare name (entry->name is not null-terminated on disk)
-      bool match = true;
-      for (uint32_t i = 0; i < name_len; i++) {
-        if (entry->name[i] != name[i]) {
-          match = false;
-          break;
-        }
-      }
-      if (match) {
-        uint32_t found_ino = entry->inode;
-        kfree(block_buf);
-
-        // Read the target inode and create a VFS node
-        ext2_inode_t target_inode;
-        if (ext2_read_inode(mnt, found_ino, &target_inode))
-          return NULL;
-
-        vfs_node_t *result = ext2_make_vfs_node(mnt, found_ino, &target_inode);
-        if (result) {
-          // Copy the name for display
-          if (name_len > 127)
-            name_len = 127;
-          memcpy(result->name, name, name_len);
-          result->name[name_len] = '\0';
-        }
-        return result;
-      }
-    }
+  // Read the target inode and create a VFS node
+  ext2_inode_t target_inode;
+  if (ext2_read_inode(mnt, found_ino, &target_inode))
+    return NULL;
 
-    if (entry->rec_len == 0)
-      break;
-    byte_pos += entry->rec_len;
+  vfs_node_t *result = ext2_make_vfs_node(mnt, found_ino, &target_inode);
+  if (result) {
+    // Copy the name for display
+    uint32_t name_len = strlen(name);
+    if (name_len > 127)
+      name_len = 127;
+    memcpy(result->name, name, name_len);
+    result->name[name_len] = '\0';
   }
-
-  kfree(block_buf);
-  return NULL;
+  return result;
 }
 
 // ── Write: Add a directory entry ────────────────────────────────────────────
@@ -895,101 +2609,87 @@ static int ext2_add_dir_entry(ext2_mount_t *mnt, uint32_t dir_inode_num,
     return -1;
 
   uint32_t name_len = strlen(name);
-  // Minimum entry size: 8 bytes header + name, rounded up to 4-byte boundary
-  uint32_t needed = ((8 + name_len) + 3) & ~3;
-
-  uint8_t *block_buf = kmalloc(mnt->block_size);
-  if (!block_buf)
-    return -1;
-
-  uint32_t dir_size = dir_inode.i_size;
-  uint32_t byte_pos = 0;
-
-  // Try to find space in existing directory blocks
-  while (byte_pos < dir_size) {
-    uint32_t logical_block = byte_pos / mnt->block_size;
-    uint32_t offset_in_block = byte_pos % mnt->block_size;
-
-    if (offset_in_block == 0) {
-      uint32_t disk_block = ext2_get_block_num(mnt, &dir_inode, logical_block);
-      if (disk_block == 0)
-        break;
-      ext2_read_block(mnt, disk_block, block_buf);
+  if (name_len == 0 || name_len > 255)
+    return -1;
+  bool inode_changed = false;
+
+  if (ext2_dir_indexed(mnt, &dir_inode)) {
+    uint32_t old_size = dir_inode.i_size;
+    int err = ext2_dx_add_entry(mnt, dir_inode_num, &dir_inode, name,
+                                name_len, child_inode_num, file_type);
+    if (err != EXT2_DX_BAD) {
+      if (dir_inode.i_size != old_size)
+        ext2_write_inode(mnt, dir_inode_num, &dir_inode);
+      return err;
     }
+  }
+  if (dir_inode.i_flags & EXT2_INDEX_FL) {
+    // Damaged or unsupported index: drop it, the leaves still make up a
+    // valid linear directory
+    dir_inode.i_flags &= ~EXT2_INDEX_FL;
+    inode_changed = true;
+  }
 
-    ext2_dirent_t *entry = (ext2_dirent_t *)(block_buf + offset_in_block);
-    if (entry->rec_len == 0)
+  // Try to find space in existing directory blocks
+  uint32_t nblocks = dir_inode.i_size / mnt->block_size;
+  for (uint32_t lblk = 0; lblk < nblocks; lblk++) {
+    struct buffer_head *bh =
+        ext2_bread(mnt, ext2_get_block_num(mnt, &dir_inode, lblk));
+    if (!bh)
       break;
-
-    // Calculate real size of this entry
-    uint32_t real_size = ((8 + entry->name_len) + 3) & ~3;
-    uint32_t slack = entry->rec_len - real_size;
-
-    if (slack >= needed) {
-      // Enough room — split this entry
-      uint32_t old_rec_len = entry->rec_len;
-      entry->rec_len = (uint16_t)real_size;
-
-      // New entry lives right after
-      ext2_dirent_t *new_entry =
-          (ext2_dirent_t *)(block_buf + offset_in_block + real_size);
-      new_entry->inode = child_inode_num;
-      new_entry->rec_len = (uint16_t)(old_rec_len - real_size);
-      new_entry->name_len = (uint8_t)name_len;
-      new_entry->file_type = file_type;
-      memcpy(new_entry->name, name, name_len);
-
-      uint32_t disk_block =
-          ext2_get_block_num(mnt, &dir_inode, byte_pos / mnt->block_size);
-      ext2_write_block(mnt, disk_block, block_buf);
-      kfree(block_buf);
+    bool done = ext2_dir_block_insert(mnt, bh->data, name, name_len,
+                                      child_inode_num, file_type);
+    if (done)
+      ext2_dirty_block(mnt, bh);
+    brelse(bh);
+    if (done) {
+      if (inode_changed)
+        ext2_write_inode(mnt, dir_inode_num, &dir_inode);
       return 0;
     }
+  }
 
-    byte_pos += entry->rec_len;
+  // A full one-block directory gets an index rather than a second block
+  if (nblocks == 1 &&
+      (mnt->sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) &&
+      ext2_dx_make_indexed(mnt, dir_inode_num, &dir_inode) == 0) {
+    int err = ext2_dx_add_entry(mnt, dir_inode_num, &dir_inode, name,
+                                name_len, child_inode_num, file_type);
+    ext2_write_inode(mnt, dir_inode_num, &dir_inode);
+    return err == 0 ? 0 : -1;
   }
 
   // No space in existing blocks — allocate a new directory block
-  uint32_t new_block = ext2_alloc_block(mnt);
-  if (!new_block) {
-    kfree(block_buf);
+  uint32_t logical_block;
+  struct buffer_head *bh = ext2_dir_append_block(mnt, dir_inode_num,
+                                                 &dir_inode, &logical_block);
+  if (!bh)
     return -1;
-  }
-
-  uint32_t logical_block = dir_size / mnt->block_size;
-  ext2_set_block_num(mnt, &dir_inode, logical_block, new_block);
-  dir_inode.i_size += mnt->block_size;
-  dir_inode.i_blocks += mnt->block_size / 512;
 
   // Fill the new block with our entry
-  memset(block_buf, 0, mnt->block_size);
-  ext2_dirent_t *new_entry = (ext2_dirent_t *)block_buf;
+  ext2_dirent_t *new_entry = (ext2_dirent_t *)bh->data;
   new_entry->inode = child_inode_num;
   new_entry->rec_len = (uint16_t)mnt->block_size; // Takes up entire block
   new_entry->name_len = (uint8_t)name_len;
   new_entry->file_type = file_type;
   memcpy(new_entry->name, name, name_len);
 
-  ext2_write_block(mnt, new_block, block_buf);
+  ext2_dirty_block(mnt, bh);
+  brelse(bh);
   ext2_write_inode(mnt, dir_inode_num, &dir_inode);
-
-  kfree(block_buf);
   return 0;
 }
 
 // ── VFS create (new file) ───────────────────────────────────────────────────
 
-static int ext2_create_impl(vfs_node_t *node, char *name, uint16_t permission) {
-  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
-  if (!mnt)
-    return -1;
-
+static int ext2_do_create(ext2_mount_t *mnt, vfs_node_t *node, char *name,
+                          uint16_t permission) {
   // Don't create if it already exists
   if (ext2_finddir_impl(node, name) != NULL)
     return -1;
 
   // Allocate a new inode
-  uint32_t new_ino = ext2_alloc_inode(mnt);
+  uint32_t new_ino = ext2_alloc_inode(mnt, node->inode, false);
   if (!new_ino)
     return -1;
 
@@ -1017,22 +2717,33 @@ static int ext2_create_impl(vfs_node_t *node, char *name, uint16_t permission) {
   return 0;
 }
 
-// ── VFS mkdir (new directory) ───────────────────────────────────────────────
-
-static int ext2_mkdir_impl(vfs_node_t *node, char *name, uint16_t permission) {
+// Create, mkdir, symlink, rename, unlink and rmdir each commit as one
+// transaction.
+static int ext2_create_impl(vfs_node_t *node, char *name, uint16_t permission) {
   ext2_mount_t *mnt = (ext2_mount_t *)node->device;
   if (!mnt)
     return -1;
+  bool own = ext3_journal_start(mnt) == 0;
+  int err = ext2_do_create(mnt, node, name, permission);
+  if (own)
+    ext3_journal_stop(mnt);
+  return err;
+}
+
+// ── VFS mkdir (new directory) ───────────────────────────────────────────────
 
+static int ext2_do_mkdir(ext2_mount_t *mnt, vfs_node_t *node, char *name,
+                         uint16_t permission) {
   if (ext2_finddir_impl(node, name) != NULL)
     return -1;
 
-  uint32_t new_ino = ext2_alloc_inode(mnt);
+  uint32_t new_ino = ext2_alloc_inode(mnt, node->inode, true);
   if (!new_ino)
     return -1;
 
   // Allocate a data block for . and .. entries
-  uint32_t data_block = ext2_alloc_block(mnt);
+  uint32_t data_block =
+      ext2_alloc_block(mnt, ext2_block_goal(mnt, new_ino, NULL, 0));
   if (!data_block)
     return -1;
 
@@ -1052,9 +2763,10 @@ static int ext2_mkdir_impl(vfs_node_t *node, char *name, uint16_t permission) {
   new_inode.i_mtime = now;
 
   // Build directory block with . and .. entries
-  uint8_t *block_buf = kcalloc(1, mnt->block_size);
-  if (!block_buf)
+  struct buffer_head *bh = ext2_new_zero_block(mnt, data_block);
+  if (!bh)
     return -1;
+  uint8_t *block_buf = bh->data;
 
   // "." entry
   ext2_dirent_t *dot = (ext2_dirent_t *)block_buf;
@@ -1073,8 +2785,8 @@ static int ext2_mkdir_impl(vfs_node_t *node, char *name, uint16_t permission) {
   dotdot->name[0] = '.';
   dotdot->name[1] = '.';
 
-  ext2_write_block(mnt, data_block, block_buf);
-  kfree(block_buf);
+  ext2_dirty_block(mnt, bh);
+  brelse(bh);
 
   if (ext2_write_inode(mnt, new_ino, &new_inode))
     return -1;
@@ -1090,14 +2802,20 @@ static int ext2_mkdir_impl(vfs_node_t *node, char *name, uint16_t permission) {
     ext2_write_inode(mnt, node->inode, &parent_inode);
   }
 
-  // Update BGD used_dirs_count
-  uint32_t group = (new_ino - 1) / mnt->inodes_per_group;
-  mnt->bgdt[group].bg_used_dirs_count++;
-  ext2_write_bgdt(mnt);
-
   return 0;
 }
 
+static int ext2_mkdir_impl(vfs_node_t *node, char *name, uint16_t permission) {
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  if (!mnt)
+    return -1;
+  bool own = ext3_journal_start(mnt) == 0;
+  int err = ext2_do_mkdir(mnt, node, name, permission);
+  if (own)
+    ext3_journal_stop(mnt);
+  return err;
+}
+
 // ── Symlink Operations ──────────────────────────────────────────────────────
 
 // Read the target path of a symbolic link.
@@ -1136,17 +2854,14 @@ static int ext2_readlink_impl(vfs_node_t *node, char *buf, uint32_t size) {
 }
 
 // Create a new symbolic link in a directory.
-static int ext2_symlink_impl(vfs_node_t *node, char *name, char *target) {
-  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
-  if (!mnt)
-    return -1;
-
+static int ext2_do_symlink(ext2_mount_t *mnt, vfs_node_t *node, char *name,
+                           char *target) {
   // Don't create if it already exists
   if (ext2_finddir_impl(node, name) != NULL)
     return -1;
 
   // Allocate a new inode
-  uint32_t new_ino = ext2_alloc_inode(mnt);
+  uint32_t new_ino = ext2_alloc_inode(mnt, node->inode, false);
   if (!new_ino)
     return -1;
 
@@ -1172,7 +2887,8 @@ static int ext2_symlink_impl(vfs_node_t *node, char *name, char *target) {
     new_inode.i_blocks = 0; // No data blocks used
   } else {
     // Slow symlink: allocate a data block and write the target there
-    uint32_t data_block = ext2_alloc_block(mnt);
+    uint32_t data_block =
+        ext2_alloc_block(mnt, ext2_block_goal(mnt, new_ino, NULL, 0));
     if (!data_block)
       return -1;
 
@@ -1197,6 +2913,17 @@ static int ext2_symlink_impl(vfs_node_t *node, char *name, char *target) {
   return 0;
 }
 
+static int ext2_symlink_impl(vfs_node_t *node, char *name, char *target) {
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  if (!mnt)
+    return -1;
+  bool own = ext3_journal_start(mnt) == 0;
+  int err = ext2_do_symlink(mnt, node, name, target);
+  if (own)
+    ext3_journal_stop(mnt);
+  return err;
+}
+
 // ── Rename, Chmod, Chown ────────────────────────────────────────────────────
 
 static int ext2_remove_dir_entry(ext2_mount_t *mnt, uint32_t dir_inode_num,
@@ -1242,13 +2969,16 @@ static int ext2_rename_impl(vfs_node_t *node, char *old_name, char *new_name) {
 
   kfree(src_node); // We only needed the info
 
-  // 1. Add the new directory entry
+  bool own = ext3_journal_start(mnt) == 0;
+  // 1. Add the new directory entry, 2. remove the old one
+  int err = -1;
   if (ext2_add_dir_entry(mnt, node->inode, target_inode_num, new_name,
-                         file_type))
-    return -1;
-
-  // 2. Remove the old directory entry
-  if (ext2_remove_dir_entry(mnt, node->inode, old_name))
+                         file_type) == 0 &&
+      ext2_remove_dir_entry(mnt, node->inode, old_name) == 0)
+    err = 0;
+  if (own)
+    ext3_journal_stop(mnt);
+  if (err)
     return -1;
 
   // File rename complete (timestamps inside the moved inode are technically
@@ -1306,16 +3036,16 @@ static int ext2_chown_impl(vfs_node_t *node, uint32_t uid, uint32_t gid) {
 static void ext2_free_indirect(ext2_mount_t *mnt, uint32_t indirect_block) {
   if (indirect_block == 0)
     return;
-  uint32_t *ptrs = kmalloc(mnt->block_size);
-  if (!ptrs)
+  struct buffer_head *bh = ext2_bread(mnt, indirect_block);
+  if (!bh)
     return;
-  ext2_read_block(mnt, indirect_block, ptrs);
+  uint32_t *ptrs = (uint32_t *)bh->data;
   uint32_t ptrs_per_block = mnt->block_size / 4;
   for (uint32_t i = 0; i < ptrs_per_block; i++) {
     if (ptrs[i])
       ext2_free_block(mnt, ptrs[i]);
   }
-  kfree(ptrs);
+  brelse(bh);
   ext2_free_block(mnt, indirect_block);
 }
 
@@ -1323,16 +3053,16 @@ static void ext2_free_indirect(ext2_mount_t *mnt, uint32_t indirect_block) {
 static void ext2_free_dindirect(ext2_mount_t *mnt, uint32_t dindirect_block) {
   if (dindirect_block == 0)
     return;
-  uint32_t *ptrs = kmalloc(mnt->block_size);
-  if (!ptrs)
+  struct buffer_head *bh = ext2_bread(mnt, dindirect_block);
+  if (!bh)
     return;
-  ext2_read_block(mnt, dindirect_block, ptrs);
+  uint32_t *ptrs = (uint32_t *)bh->data;
   uint32_t ptrs_per_block = mnt->block_size / 4;
   for (uint32_t i = 0; i < ptrs_per_block; i++) {
     if (ptrs[i])
       ext2_free_indirect(mnt, ptrs[i]);
   }
-  kfree(ptrs);
+  brelse(bh);
   ext2_free_block(mnt, dindirect_block);
 }
 
@@ -1340,16 +3070,16 @@ static void ext2_free_dindirect(ext2_mount_t *mnt, uint32_t dindirect_block) {
 static void ext2_free_tindirect(ext2_mount_t *mnt, uint32_t tindirect_block) {
   if (tindirect_block == 0)
     return;
-  uint32_t *ptrs = kmalloc(mnt->block_size);
-  if (!ptrs)
+  struct buffer_head *bh = ext2_bread(mnt, tindirect_block);
+  if (!bh)
     return;
-  ext2_read_block(mnt, tindirect_block, ptrs);
+  uint32_t *ptrs = (uint32_t *)bh->data;
   uint32_t ptrs_per_block = mnt->block_size / 4;
   for (uint32_t i = 0; i < ptrs_per_block; i++) {
     if (ptrs[i])
       ext2_free_dindirect(mnt, ptrs[i]);
   }
-  kfree(ptrs);
+  brelse(bh);
   ext2_free_block(mnt, tindirect_block);
 }
 
@@ -1379,6 +3109,8 @@ static void ext2_free_all_blocks(ext2_mount_t *mnt, ext2_inode_t *inode) {
   }
   inode->i_blocks = 0;
   inode->i_size = 0;
+  if ((inode->i_mode & 0xF000) == EXT2_S_IFREG)
+    inode->i_dir_acl = 0;
 }
 
 // ── Remove a directory entry by name ────────────────────────────────────────
@@ -1389,68 +3121,22 @@ static int ext2_remove_dir_entry(ext2_mount_t *mnt, uint32_t dir_inode_num,
   if (ext2_read_inode(mnt, dir_inode_num, &dir_inode))
     return -1;
 
-  uint32_t name_len = strlen(name);
-  uint8_t *block_buf = kmalloc(mnt->block_size);
-  if (!block_buf)
-    return -1;
-
-  uint32_t dir_size = dir_inode.i_size;
-  uint32_t byte_pos = 0;
-  uint32_t prev_offset =
-      0;                   // Byte offset of the previous entry in current block
-  bool prev_valid = false; // Whether we have a valid previous entry
-  uint32_t current_block_start =
-      0; // Byte offset where the current block starts
-
-  while (byte_pos < dir_size) {
-    uint32_t logical_block = byte_pos / mnt->block_size;
-    uint32_t offset_in_block = byte_pos % mnt->block_size;
-
-    if (offset_in_block == 0) {
-      uint32_t disk_block = ext2_get_block_num(mnt, &dir_inode, logical_block);
-      if (disk_block == 0)
-        break;
-      ext2_read_block(mnt, disk_block, block_buf);
-      prev_valid = false;
-      current_block_start = byte_pos;
-    }
-
-    ext2_dirent_t *entry = (ext2_dirent_t *)(block_buf + offset_in_block);
-    if (entry->rec_len == 0)
-      break;
-
-    if (entry->inode != 0 && entry->name_len == name_len) {
-      bool match = true;
-      for (uint32_t i = 0; i < name_len; i++) {
-        if (entry->name[i] != name[i]) {
-          match = false;
-          break;
-        }
-      }
-      if (match) {
-        if (prev_valid) {
-          // Merge this entry's rec_len into the previous entry
-          ext2_dirent_t *prev = (ext2_dirent_t *)(block_buf + prev_offset);
-          prev->rec_len += entry->rec_len;
-        } else {
-          // First entry in block — just zero out the inode
-          entry->inode = 0;
-        }
-        uint32_t disk_block = ext2_get_block_num(
-            mnt, &dir_inode, current_block_start / mnt->block_size);
-        ext2_write_block(mnt, disk_block, block_buf);
-        kfree(block_buf);
-        return 0;
-      }
-    }
+  ext2_dir_slot_t slot;
+  if (ext2_dir_find(mnt, &dir_inode, name, &slot))
+    return -1; // Not found
 
-    prev_offset = offset_in_block;
-    prev_valid = (entry->inode != 0);
-    byte_pos += entry->rec_len;
+  ext2_dirent_t *entry = (ext2_dirent_t *)(slot.bh->data + slot.offset);
+  if (slot.prev != slot.offset) {
+    // Merge this entry's rec_len into the previous entry
+    ext2_dirent_t *prev = (ext2_dirent_t *)(slot.bh->data + slot.prev);
+    prev->rec_len += entry->rec_len;
+  } else {
+    // First entry in block — just zero out the inode
+    entry->inode = 0;
   }
-
-  kfree(block_buf);
-  return -1; // Not found
+  ext2_dirty_block(mnt, slot.bh);
+  brelse(slot.bh);
+  return 0;
 }
 
 // ── Check if a directory is empty (only . and ..) ───────────────────────────
@@ -1460,9 +3146,8 @@ static bool ext2_dir_is_empty(ext2_mount_t *mnt, uint32_t inode_num) {
   if (ext2_read_inode(mnt, inode_num, &inode))
     return false;
 
-  uint8_t *block_buf = kmalloc(mnt->block_size);
-  if (!block_buf)
-    return false;
+  struct buffer_head *bh = NULL;
+  uint8_t *block_buf = NULL;
 
   uint32_t dir_size = inode.i_size;
   uint32_t byte_pos = 0;
@@ -1475,7 +3160,11 @@ static bool ext2_dir_is_empty(ext2_mount_t *mnt, uint32_t inode_num) {
       uint32_t disk_block = ext2_get_block_num(mnt, &inode, logical_block);
       if (disk_block == 0)
         break;
-      ext2_read_block(mnt, disk_block, block_buf);
+      brelse(bh);
+      bh = ext2_bread(mnt, disk_block);
+      if (!bh)
+        break;
+      block_buf = bh->data;
     }
 
     ext2_dirent_t *entry = (ext2_dirent_t *)(block_buf + offset_in_block);
@@ -1488,7 +3177,7 @@ static bool ext2_dir_is_empty(ext2_mount_t *mnt, uint32_t inode_num) {
       bool is_dotdot = (entry->name_len == 2 && entry->name[0] == '.' &&
                         entry->name[1] == '.');
       if (!is_dot && !is_dotdot) {
-        kfree(block_buf);
+        brelse(bh);
         return false; // Has real entries
       }
     }
@@ -1496,7 +3185,7 @@ static bool ext2_dir_is_empty(ext2_mount_t *mnt, uint32_t inode_num) {
     byte_pos += entry->rec_len;
   }
 
-  kfree(block_buf);
+  brelse(bh);
   return true;
 }
 
@@ -1507,8 +3196,6 @@ static int ext2_unlink_impl(vfs_node_t *node, char *name) {
   if (!mnt)
     return -1;
 
-  ext3_journal_start(mnt);
-
   // Find the target to get its inode number
   vfs_node_t *target = ext2_finddir_impl(node, name);
   if (!target)
@@ -1526,34 +3213,41 @@ static int ext2_unlink_impl(vfs_node_t *node, char *name) {
   if ((inode.i_mode & 0xF000) == EXT2_S_IFDIR)
     return -1;
 
-  // Remove the directory entry from the parent
-  if (ext2_remove_dir_entry(mnt, node->inode, name))
-    return -1;
-
-  // Decrement link count
-  inode.i_links_count--;
-
-  if (inode.i_links_count == 0) {
-    // No more links — free all data blocks and the inode itself
-    ext2_free_all_blocks(mnt, &inode);
-    inode.i_dtime = 1; // Mark as deleted (non-zero)
-    ext2_write_inode(mnt, target_ino, &inode);
-    ext2_free_inode(mnt, target_ino);
-  } else {
-    ext2_write_inode(mnt, target_ino, &inode);
+  // The last link goes: dirty pages go first. Writeback must not allocate
+  // into a freed inode, and as it opens handles of its own it cannot be
+  // waited for inside ours.
+  if (inode.i_links_count <= 1)
+    page_cache_invalidate(mnt, target_ino);
+
+  bool own = ext3_journal_start(mnt) == 0;
+  int err = -1;
+  // The copy read above may predate the last allocation of writeback.
+  // Remove the directory entry from the parent.
+  if (ext2_read_inode(mnt, target_ino, &inode) == 0 &&
+      ext2_remove_dir_entry(mnt, node->inode, name) == 0) {
+    err = 0;
+    // Decrement link count
+    if (inode.i_links_count)
+      inode.i_links_count--;
+
+    if (inode.i_links_count == 0) {
+      // No more links — free all data blocks and the inode itself
+      ext2_free_all_blocks(mnt, &inode);
+      inode.i_dtime = 1; // Mark as deleted (non-zero)
+      ext2_write_inode(mnt, target_ino, &inode);
+      ext2_free_inode(mnt, target_ino, false);
+    } else {
+      ext2_write_inode(mnt, target_ino, &inode);
+    }
   }
-
-  ext3_journal_stop(mnt);
-  return 0;
+  if (own)
+    ext3_journal_stop(mnt);
+  return err;
 }
 
 // ── VFS rmdir (delete empty directory) ──────────────────────────────────────
 
-static int ext2_rmdir_impl(vfs_node_t *node, char *name) {
-  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
-  if (!mnt)
-    return -1;
-
+static int ext2_do_rmdir(ext2_mount_t *mnt, vfs_node_t *node, char *name) {
   // Prevent removing . or ..
   if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
     return -1;
@@ -1587,7 +3281,7 @@ static int ext2_rmdir_impl(vfs_node_t *node, char *name) {
   inode.i_links_count = 0;
   inode.i_dtime = 1;
   ext2_write_inode(mnt, target_ino, &inode);
-  ext2_free_inode(mnt, target_ino);
+  ext2_free_inode(mnt, target_ino, true);
 
   // Decrement parent's link count (the ".." entry pointed to it)
   ext2_inode_t parent_inode;
@@ -1597,18 +3291,51 @@ static int ext2_rmdir_impl(vfs_node_t *node, char *name) {
     ext2_write_inode(mnt, node->inode, &parent_inode);
   }
 
-  // Update BGD used_dirs_count
-  uint32_t group = (target_ino - 1) / mnt->inodes_per_group;
-  if (mnt->bgdt[group].bg_used_dirs_count > 0) {
-    mnt->bgdt[group].bg_used_dirs_count--;
-  }
-  ext2_write_bgdt(mnt);
-
   return 0;
 }
 
+static int ext2_rmdir_impl(vfs_node_t *node, char *name) {
+  ext2_mount_t *mnt = (ext2_mount_t *)node->device;
+  if (!mnt)
+    return -1;
+  bool own = ext3_journal_start(mnt) == 0;
+  int err = ext2_do_rmdir(mnt, node, name);
+  if (own)
+    ext3_journal_stop(mnt);
+  return err;
+}
+
 // ── Mount ───────────────────────────────────────────────────────────────────
 
+// Read the superblock and group descriptors again, after journal replay
+// rewrote them underneath the mount.
+static int ext2_reload_super(ext2_mount_t *mnt) {
+  uint8_t sb_buf[1024];
+  if (mnt->dev->read_sectors(mnt->dev, 2, 2, sb_buf))
+    return -1;
+  memcpy(&mnt->sb, sb_buf, sizeof(ext2_superblock_t));
+
+  uint32_t bgdt_block = mnt->sb.s_first_data_block + 1;
+  uint32_t bgdt_size = mnt->groups_count * sizeof(ext2_bgd_t);
+  uint32_t bgdt_blocks = (bgdt_size + mnt->block_size - 1) / mnt->block_size;
+  for (uint32_t i = 0; i < bgdt_blocks; i++) {
+    if (ext2_read_block(mnt, bgdt_block + i,
+                        (uint8_t *)mnt->bgdt + i * mnt->block_size))
+      return -1;
+  }
+  return 0;
+}
+
+// Flag a journaled filesystem as possibly needing recovery while it is
+// mounted, so that fsck and other systems replay what the log holds.
+static void ext2_mark_recover(ext2_mount_t *mnt) {
+  if (!mnt->journal)
+    return;
+  mnt->sb.s_feature_incompat |= EXT3_FEATURE_INCOMPAT_RECOVER;
+  if (ext2_write_superblock(mnt) == 0)
+    block_sync(mnt->dev);
+}
+
 int ext2_mount(struct block_device *dev, vfs_node_t *mountpoint) {
   if (!dev || !mountpoint)
     return -1;
@@ -1637,6 +3364,7 @@ int ext2_mount(struct block_device *dev, vfs_node_t *mountpoint) {
   if (!mnt)
     return -1;
   memset(mnt, 0, sizeof(ext2_mount_t));
+  ext2_icache_init(mnt);
 
   mnt->dev = dev;
   memcpy(&mnt->sb, sb, sizeof(ext2_superblock_t));
@@ -1689,11 +3417,22 @@ int ext2_mount(struct block_device *dev, vfs_node_t *mountpoint) {
 
   klog_puts("[EXT2] Block Group Descriptor Table loaded.\n");
 
+  // Replay the journal before anything is read through the caches
+  if (ext3_init_journal(mnt) == 1 && ext2_reload_super(mnt) != 0)
+    klog_puts("[EXT2] Failed to reread metadata after journal replay.\n");
+
+  if (ext2_alloc_init(mnt)) {
+    kfree(mnt->bgdt);
+    kfree(mnt);
+    return -1;
+  }
+
   // ── Read the root inode (always inode 2) ────────────────────────────
   ext2_inode_t root_inode;
   err = ext2_read_inode(mnt, EXT2_ROOT_INODE, &root_inode);
   if (err) {
     klog_puts("[EXT2] Failed to read root inode.\n");
+    kfree(mnt->groups);
     kfree(mnt->bgdt);
     kfree(mnt);
     return -1;
@@ -1701,6 +3440,7 @@ int ext2_mount(struct block_device *dev, vfs_node_t *mountpoint) {
 
   if ((root_inode.i_mode & 0xF000) != EXT2_S_IFDIR) {
     klog_puts("[EXT2] Root inode is not a directory!\n");
+    kfree(mnt->groups);
     kfree(mnt->bgdt);
     kfree(mnt);
     return -1;
@@ -1709,6 +3449,7 @@ int ext2_mount(struct block_device *dev, vfs_node_t *mountpoint) {
   // ── Wire up the mountpoint ──────────────────────────────────────────
   vfs_node_t *root_vfs = ext2_make_vfs_node(mnt, EXT2_ROOT_INODE, &root_inode);
   if (!root_vfs) {
+    kfree(mnt->groups);
     kfree(mnt->bgdt);
     kfree(mnt);
     return -1;
@@ -1732,8 +3473,10 @@ int ext2_mount(struct block_device *dev, vfs_node_t *mountpoint) {
   mountpoint->rename = ext2_rename_impl;
   mountpoint->chmod = ext2_chmod_impl;
   mountpoint->chown = ext2_chown_impl;
+  mountpoint->revalidate = ext2_revalidate_impl;
 
-  ext3_init_journal(mnt);
+  ext2_mark_recover(mnt);
+  page_cache_register_fs(mnt, "ext2 /mnt", ext2_sync_fs);
 
   klog_puts("[OK] Ext2/3 filesystem mounted on /mnt\n");
   return 0;
@@ -1768,6 +3511,7 @@ int ext2_mount_root(struct block_device *dev) {
   if (!mnt)
     return -1;
   memset(mnt, 0, sizeof(ext2_mount_t));
+  ext2_icache_init(mnt);
 
   mnt->dev = dev;
   memcpy(&mnt->sb, sb, sizeof(ext2_superblock_t));
@@ -1820,11 +3564,22 @@ int ext2_mount_root(struct block_device *dev) {
 
   klog_puts("[EXT2] Block Group Descriptor Table loaded.\n");
 
+  // Replay the journal before anything is read through the caches
+  if (ext3_init_journal(mnt) == 1 && ext2_reload_super(mnt) != 0)
+    klog_puts("[EXT2] Failed to reread metadata after journal replay.\n");
+
+  if (ext2_alloc_init(mnt)) {
+    kfree(mnt->bgdt);
+    kfree(mnt);
+    return -1;
+  }
+
   // Read the root inode (always inode 2)
   ext2_inode_t root_inode;
   err = ext2_read_inode(mnt, EXT2_ROOT_INODE, &root_inode);
   if (err) {
     klog_puts("[EXT2] Failed to read root inode.\n");
+    kfree(mnt->groups);
     kfree(mnt->bgdt);
     kfree(mnt);
     return -1;
@@ -1832,6 +3587,7 @@ int ext2_mount_root(struct block_device *dev) {
 
   if ((root_inode.i_mode & 0xF000) != EXT2_S_IFDIR) {
     klog_puts("[EXT2] Root inode is not a directory!\n");
+    kfree(mnt->groups);
     kfree(mnt->bgdt);
     kfree(mnt);
     return -1;
@@ -1840,6 +3596,7 @@ int ext2_mount_root(struct block_device *dev) {
   // Create the VFS root node
   vfs_node_t *root_vfs = ext2_make_vfs_node(mnt, EXT2_ROOT_INODE, &root_inode);
   if (!root_vfs) {
+    kfree(mnt->groups);
     kfree(mnt->bgdt);
     kfree(mnt);
     return -1;
@@ -1851,7 +3608,8 @@ int ext2_mount_root(struct block_device *dev) {
   // Replace fs_root with the ext2 root
   fs_root = root_vfs;
 
-  ext3_init_journal(mnt);
+  ext2_mark_recover(mnt);
+  page_cache_register_fs(mnt, "ext2 /", ext2_sync_fs);
 
   klog_puts("[OK] Ext2/3 filesystem mounted as root (/)\n");
   return 0;
@@ -1941,8 +3699,8 @@ static uint64_t ext2_mmap_impl(vfs_node_t *node, uint64_t addr, uint64_t length,
       if (file_off + to_read > node->length) {
         to_read = node->length - file_off;
       }
-      ext2_read_impl(node, (uint32_t)file_off, to_read,
-                     (uint8_t *)(phys_page + hhdm));
+      vfs_read(node, file_off, to_read,
+               (uint8_t *)(phys_page + hhdm));
     }
 
     if (!vmm_map_page(pml4, virt_page, phys_page, page_flags)) {
@@ -30,6 +30,22 @@
 #define EXT2_FT_SOCK 6
 #define EXT2_FT_SYMLINK 7
 
+// Files of 2 GiB and more (i_size_high in i_dir_acl); needs revision 1
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002
+
+// Features and flags of the hashed directory index (htree)
+#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x0020
+#define EXT2_INDEX_FL 0x00001000         // i_flags: directory has an htree
+#define EXT2_FLAGS_UNSIGNED_HASH 0x0002  // s_flags: hash names as unsigned
+
+// Directory hash functions (dx_root_info.hash_version)
+#define EXT2_HASH_LEGACY 0
+#define EXT2_HASH_HALF_MD4 1
+#define EXT2_HASH_TEA 2
+#define EXT2_HASH_LEGACY_UNSIGNED 3
+#define EXT2_HASH_HALF_MD4_UNSIGNED 4
+#define EXT2_HASH_TEA_UNSIGNED 5
+
 // ── On-Disk Structures ─────────────────────────────────────────────────────
 
 typedef struct {
@@ -84,8 +100,14 @@ typedef struct {
   uint32_t s_first_meta_bg;  // First metablock block group
   uint32_t s_mkfs_time;      // When the filesystem was created
   uint32_t s_jnl_blocks[17]; // Backup of the journal inode
-  // Padding to 1024 bytes (1024 - 360 = 664)
-  uint8_t s_padding[664];
+  uint32_t s_blocks_count_hi;
+  uint32_t s_r_blocks_count_hi;
+  uint32_t s_free_blocks_hi;
+  uint16_t s_min_extra_isize;
+  uint16_t s_want_extra_isize;
+  uint32_t s_flags; // Miscellaneous flags (hash signedness)
+  // Padding to 1024 bytes (1024 - 356 = 668)
+  uint8_t s_padding[668];
 } __attribute__((packed)) ext2_superblock_t;
 
 // Block Group Descriptor (32 bytes)
@@ -133,8 +155,78 @@ typedef struct {
   char name[];       // Filename (NOT null-terminated on disk)
 } __attribute__((packed)) ext2_dirent_t;
 
+// Htree root, stored in the first directory block after the "." and ".."
+// entries (the ".." entry's rec_len covers the rest of the block).
+typedef struct {
+  uint32_t reserved_zero;
+  uint8_t hash_version;    // EXT2_HASH_*
+  uint8_t info_length;     // 8
+  uint8_t indirect_levels; // Levels of index nodes below the root
+  uint8_t unused_flags;
+} __attribute__((packed)) ext2_dx_root_info_t;
+
+// Header of an array of index entries; overlays the first entry's hash
+typedef struct {
+  uint16_t limit; // Entries that fit in the block
+  uint16_t count; // Entries in use, including this header's
+} __attribute__((packed)) ext2_dx_countlimit_t;
+
+// Index entry: names hashing to >= hash live under directory block block.
+// Bit 0 of hash marks a leaf continuing the previous one's last hash.
+typedef struct {
+  uint32_t hash;
+  uint32_t block; // Logical block within the directory
+} __attribute__((packed)) ext2_dx_entry_t;
+
+// ── In-core Inodes ──────────────────────────────────────────────────────────
+
+#define EXT2_ICACHE_BUCKETS 256
+#define EXT2_ICACHE_MAX 1024 // Unreferenced inodes kept in memory per mount
+
+// A run of blocks that are contiguous both in the file and on disk
+typedef struct {
+  uint32_t logical;
+  uint32_t physical;
+  uint32_t len;
+} ext2_extent_t;
+
+#define EXT2_EXTENT_MAX 512   // Runs cached per inode
+#define EXT2_EXTENT_SCAN 1024 // Blocks a block-map miss looks ahead
+
+// One per (mount, inode number). VFS nodes hold a reference for their
+// lifetime; the last reference parks the inode on the mount's LRU list.
+typedef struct ext2_inode_info {
+  uint32_t ino;
+  uint32_t refcount;
+  bool dirty;           // raw is newer than the inode table
+  bool data_dirty;      // Among the changes: size or block map (fdatasync)
+  uint32_t alloc_goal;  // Block after the last one allocated, 0: none yet
+  ext2_inode_t raw;
+
+  // Block map of a regular file, filled lazily from the indirect blocks
+  spinlock_t map_lock;
+  ext2_extent_t *extents; // Sorted by logical block, never overlapping
+  uint32_t nr_extents;
+  uint32_t extents_cap;
+  uint32_t map_seq;       // Bumped whenever the runs are dropped
+
+  struct ext2_inode_info *hash_next;
+  struct list_head lru; // Unreferenced inodes, coldest last
+} ext2_inode_info_t;
+
+// ── Block Group Allocation State ────────────────────────────────────────────
+
+// The allocators search a group's bitmaps in place: they are read on first
+// use and then stay pinned in the buffer cache for the life of the mount.
+typedef struct {
+  struct buffer_head *block_bitmap; // NULL until first used
+  struct buffer_head *inode_bitmap;
+} ext2_group_info_t;
+
 // ── Mount Context ───────────────────────────────────────────────────────────
 
+struct ext3_journal;
+
 typedef struct {
   struct block_device *dev;  // Underlying block device
   ext2_superblock_t sb;      // Cached superblock
@@ -144,6 +236,18 @@ typedef struct {
   uint32_t inodes_per_group; // Inodes per group
   uint32_t inode_size;       // Size of an inode on disk
   vfs_node_t *root_node;     // VFS node for the ext2 root directory
+
+  spinlock_t alloc_lock;     // Bitmaps, group and superblock free counts
+  ext2_group_info_t *groups;
+  uint32_t orlov_rotor;      // Where top-level directory spreading resumes
+  bool sb_dirty;             // Superblock free counts not yet written
+  uint32_t reserved_blocks;  // Held for dirty pages not allocated yet
+  struct ext3_journal *journal; // NULL: no journal (plain ext2)
+
+  spinlock_t icache_lock;
+  ext2_inode_info_t *icache[EXT2_ICACHE_BUCKETS];
+  struct list_head icache_lru;
+  uint32_t icache_unused;    // Inodes on icache_lru
 } ext2_mount_t;
 
 // ── Public API ──────────────────────────────────────────────────────────────
@@ -160,6 +264,20 @@ int ext2_mount_root(struct block_device *dev);
 int ext2_read_block(ext2_mount_t *mnt, uint32_t block_num, void *buffer);
 int ext2_write_block(ext2_mount_t *mnt, uint32_t block_num, const void *buffer);
 int ext2_read_inode(ext2_mount_t *mnt, uint32_t inode_num, ext2_inode_t *out);
+
+// Look up (reading it on a miss) and reference the in-core inode.
+ext2_inode_info_t *ext2_iget(ext2_mount_t *mnt, uint32_t inode_num);
+
+// Drop a reference. A dirty inode is written to the inode table when its
+// last reference goes.
+void ext2_iput(ext2_mount_t *mnt, ext2_inode_info_t *ei);
+
+// ei->raw was changed: write it back later (last iput or sync).
+void ext2_mark_inode_dirty(ext2_inode_info_t *ei);
+
+// Write every dirty in-core inode of mnt to the inode table, and the
+// superblock if its free counts changed.
+int ext2_sync_inodes(ext2_mount_t *mnt);
 uint32_t ext2_get_block_num(ext2_mount_t *mnt, ext2_inode_t *inode,
                             uint32_t logical_block);
 
@@ -1,284 +1,1167 @@
 #include "ext3.h"
+#include "apic/lapic_timer.h"
 #include "console/klog.h"
+#include "drivers/storage/block.h"
+#include "lib/list.h"
 #include "lib/string.h"
+#include "lock/spinlock.h"
 #include "mm/heap.h"
+#include "sched/sched.h"
+#include "sched/wait.h"
 #include <stdbool.h>
 
-static int ext3_recover_journal(ext2_mount_t *mnt, jbd_superblock_t *jsb,
-                                ext2_inode_t *j_inode);
+// ── Journal state ───────────────────────────────────────────────────────────
+// Handles are per thread (thread->journal_info) and nest. A transaction is
+// RUNNING while it takes handles; the commit closes it (LOCKED), waits for
+// its handles to finish and copies its buffers into the log image; new
+// handles then open the next transaction, which fills up while this one is
+// on its way to the disk.
+//
+// A buffer logged by a transaction is only marked dirty in the buffer cache
+// once that transaction has committed; the buffer cache then writes it home
+// whenever it writes back. The transaction stays in the log until all its
+// buffers are home (or logged again by a newer committed transaction), and
+// only then does the tail move past it. Until then the journal keeps track
+// of its blocks, so that freeing one of them can revoke the logged copies.
 
-// Internal state for the current active transaction
-static struct {
-  bool active;
-  uint32_t sequence;
-  uint32_t start_block; // Current write position in journal
-  ext2_inode_t journal_inode;
-  uint8_t *desc_block_buf;
-  uint32_t blocks_in_trans;
-} current_trans = {0};
+#define JBD_MAX_JOURNALS 4
+#define JBD_HASH_BUCKETS 256
+#define JBD_CHUNK 32     // Log blocks per commit I/O buffer
+#define JBD_WAKE_MS 1000 // Commit thread period
+#define JBD_UUID_SIZE 16
 
-void ext3_init_journal(ext2_mount_t *mnt) {
-  if (!(mnt->sb.s_feature_compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL)) {
-    return; // No journal
-  }
+#define T_RUNNING 0  // Takes new handles
+#define T_LOCKED 1   // Closed, waiting for its handles to finish
+#define T_COMMIT 2   // Being written to the log
+#define T_FINISHED 3 // Committed, buffers on their way home
 
-  uint32_t journal_ino = mnt->sb.s_journal_inum;
-  if (journal_ino == 0) {
-    klog_puts("[EXT3] Journal feature enabled but journal inode is 0\n");
-    return;
-  }
+typedef struct ext3_transaction ext3_transaction_t;
 
-  if (ext2_read_inode(mnt, journal_ino, &current_trans.journal_inode) != 0) {
-    klog_puts("[EXT3] Failed to read journal inode\n");
+// A metadata buffer the journal tracks. Holds a reference on bh.
+typedef struct ext3_jbuf {
+  struct buffer_head *bh;
+  ext3_transaction_t *trans;    // Uncommitted transaction logging it
+  ext3_transaction_t *cp_trans; // Newest committed transaction holding it
+  bool logging;                 // In the log image of a commit in flight
+  struct list_head t_list;      // On trans->buffers
+  struct list_head cp_list;     // On cp_trans->checkpoint
+  struct ext3_jbuf *hash_next;
+} ext3_jbuf_t;
+
+struct ext3_transaction {
+  uint32_t tid;
+  int state;
+  uint32_t updates; // Open handles
+  uint32_t handles; // Handles it collected
+  uint32_t nr_buffers;
+  struct list_head buffers;
+  uint32_t *revokes; // Logged blocks it freed
+  uint32_t nr_revokes;
+  uint32_t revokes_cap;
+  struct list_head checkpoint; // Buffers whose newest logged copy it holds
+  uint32_t log_start;          // Where it sits in the log, once committed
+  uint32_t log_blocks;
+  uint64_t start_ms;
+  struct list_head link; // On journal->log
+};
+
+typedef struct {
+  struct ext3_journal *journal;
+  ext3_transaction_t *trans;
+  uint32_t depth;
+} ext3_handle_t;
+
+struct ext3_journal {
+  ext2_mount_t *mnt;
+  spinlock_t lock;
+  uint32_t *map;   // Log block -> disk block
+  uint8_t *sb_buf; // Journal superblock
+  uint32_t first;  // The log is blocks [first, last)
+  uint32_t last;
+  uint32_t head;        // Next log block to write
+  uint32_t free;        // Log blocks not held by live transactions
+  uint32_t max_buffers; // Largest transaction, in buffers and in revokes
+  uint32_t sb_start;    // Tail as recorded on disk (0: log empty)
+  uint32_t next_tid;
+  uint32_t commit_tid; // Last transaction committed
+  uint8_t uuid[JBD_UUID_SIZE];
+  ext3_transaction_t *running;
+  struct list_head log; // Committed transactions still in the log, oldest
+                        // first
+  bool commit_busy;
+  bool sb_busy;
+  bool commit_request;
+  bool aborted; // A commit failed: stop journaling
+  struct thread *thread;
+  ext3_jbuf_t *hash[JBD_HASH_BUCKETS];
+  struct ext3_journal_stats stats;
+};
+
+static spinlock_t jbd_table_lock = SPINLOCK_INIT;
+static struct ext3_journal *jbd_table[JBD_MAX_JOURNALS];
+static uint32_t jbd_count = 0;
+
+// Handle of code running before the scheduler
+static void *boot_journal_info = NULL;
+
+static void **jbd_handle_slot(void) {
+  struct thread *self = sched_get_current();
+  return self ? &self->journal_info : &boot_journal_info;
+}
+
+// Boot code runs on the idle thread, which must not block
+static bool jbd_can_sleep(void) {
+  struct thread *self = sched_get_current();
+  return self && !self->is_idle;
+}
+
+static void jbd_sleep(uint32_t ms) {
+  struct thread *self = sched_get_current();
+  if (!jbd_can_sleep()) {
+    __asm__ volatile("pause");
     return;
   }
+  self->wakeup_ticks = lapic_timer_get_ticks() + ms;
+  self->state = THREAD_BLOCKED;
+  sched_yield();
+}
 
-  uint32_t disk_block =
-      ext2_get_block_num(mnt, &current_trans.journal_inode, 0);
-  if (!disk_block) {
-    klog_puts("[EXT3] Journal inode has no blocks\n");
-    return;
+static uint32_t jbd_next(struct ext3_journal *j, uint32_t pos, uint32_t n) {
+  uint32_t len = j->last - j->first;
+  return j->first + (pos - j->first + n) % len;
+}
+
+// Tags in a descriptor block: the first one is followed by the UUID
+static uint32_t jbd_tags_per_desc(uint32_t block_size) {
+  return (block_size - sizeof(jbd_header_t) - JBD_UUID_SIZE) /
+         sizeof(jbd_block_tag_t);
+}
+
+// Entries in a revoke block, after its header and byte count
+static uint32_t jbd_revokes_per_block(uint32_t block_size) {
+  return (block_size - sizeof(jbd_header_t) - 4) / 4;
+}
+
+// Log blocks a transaction of nr buffers and nrev revokes takes:
+// descriptors, data, revoke blocks, commit
+static uint32_t jbd_log_size(struct ext3_journal *j, uint32_t nr,
+                             uint32_t nrev) {
+  uint32_t per_desc = jbd_tags_per_desc(j->mnt->block_size);
+  uint32_t per_rev = jbd_revokes_per_block(j->mnt->block_size);
+  return nr + (nr + per_desc - 1) / per_desc + (nrev + per_rev - 1) / per_rev +
+         1;
+}
+
+// Whether t should commit now instead of taking more handles
+static bool jbd_trans_full(struct ext3_journal *j, ext3_transaction_t *t) {
+  return t->nr_buffers >= j->max_buffers / 2 ||
+         t->nr_revokes >= j->max_buffers / 2;
+}
+
+static void jbd_free_trans(ext3_transaction_t *t) {
+  kfree(t->revokes);
+  kfree(t);
+}
+
+static void jbd_header(void *buf, uint32_t type, uint32_t tid) {
+  jbd_header_t *h = (jbd_header_t *)buf;
+  h->h_magic = __builtin_bswap32(EXT3_JOURNAL_MAGIC_NUMBER);
+  h->h_blocktype = __builtin_bswap32(type);
+  h->h_sequence = __builtin_bswap32(tid);
+}
+
+// ── Journaled buffers ───────────────────────────────────────────────────────
+
+static uint32_t jbd_hash(struct buffer_head *bh) {
+  return (uint32_t)(((uint64_t)bh >> 4) * 2654435761u) % JBD_HASH_BUCKETS;
+}
+
+// Caller holds j->lock.
+static ext3_jbuf_t *jbd_find(struct ext3_journal *j, struct buffer_head *bh) {
+  ext3_jbuf_t *jb = j->hash[jbd_hash(bh)];
+  while (jb && jb->bh != bh)
+    jb = jb->hash_next;
+  return jb;
+}
+
+// Forget a buffer no transaction needs any more. Caller holds j->lock.
+static void jbd_drop(struct ext3_journal *j, ext3_jbuf_t *jb) {
+  ext3_jbuf_t **pp = &j->hash[jbd_hash(jb->bh)];
+  while (*pp && *pp != jb)
+    pp = &(*pp)->hash_next;
+  if (*pp)
+    *pp = jb->hash_next;
+  brelse(jb->bh);
+  kfree(jb);
+}
+
+// Track bh, which the caller references. Returns with j->lock held, NULL
+// if bh cannot be tracked (out of memory, or the block was freed).
+static ext3_jbuf_t *jbd_get(struct ext3_journal *j, struct buffer_head *bh) {
+  spinlock_acquire(&j->lock);
+  ext3_jbuf_t *jb = jbd_find(j, bh);
+  if (jb)
+    return jb;
+  spinlock_release(&j->lock);
+
+  struct buffer_head *ref = find_get_block(bh->dev, bh->block, bh->size);
+  ext3_jbuf_t *fresh = ref == bh ? kmalloc(sizeof(ext3_jbuf_t)) : NULL;
+  if (!fresh) {
+    brelse(ref);
+    spinlock_acquire(&j->lock);
+    return NULL;
   }
+  memset(fresh, 0, sizeof(ext3_jbuf_t));
+  fresh->bh = bh;
 
-  uint8_t *buf = kmalloc(mnt->block_size);
-  if (!buf) {
-    klog_puts("[EXT3] Out of memory for journal read\n");
-    return;
+  spinlock_acquire(&j->lock);
+  jb = jbd_find(j, bh);
+  if (jb) {
+    brelse(bh);
+    kfree(fresh);
+    return jb;
   }
+  uint32_t b = jbd_hash(bh);
+  fresh->hash_next = j->hash[b];
+  j->hash[b] = fresh;
+  return fresh;
+}
 
-  if (ext2_read_block(mnt, disk_block, buf) != 0) {
-    klog_puts("[EXT3] Failed to read journal block\n");
-    kfree(buf);
+// ── Journal superblock ──────────────────────────────────────────────────────
+
+// Record the current log tail on disk. Moving the tail forward releases
+// log blocks, so whatever was checkpointed must be durable first.
+static void jbd_update_sb(struct ext3_journal *j) {
+  spinlock_acquire(&j->lock);
+  while (j->sb_busy) {
+    spinlock_release(&j->lock);
+    jbd_sleep(1);
+    spinlock_acquire(&j->lock);
+  }
+  uint32_t start = 0, seq = j->commit_tid + 1;
+  if (!list_empty(&j->log)) {
+    ext3_transaction_t *t = list_entry(j->log.next, ext3_transaction_t, link);
+    start = t->log_start;
+    seq = t->tid;
+  }
+  if (start == j->sb_start) {
+    spinlock_release(&j->lock);
     return;
   }
+  bool flush_first = j->sb_start != 0;
+  j->sb_busy = true;
+  spinlock_release(&j->lock);
 
-  jbd_superblock_t *jsb = (jbd_superblock_t *)buf;
+  struct block_device *dev = j->mnt->dev;
+  if (flush_first)
+    block_flush(dev);
+  jbd_superblock_t *jsb = (jbd_superblock_t *)j->sb_buf;
+  jsb->s_start = __builtin_bswap32(start);
+  jsb->s_sequence = __builtin_bswap32(seq);
+  int err = ext2_write_block(j->mnt, j->map[0], j->sb_buf);
+  if (err == 0)
+    err = block_flush(dev);
 
-  uint32_t magic = __builtin_bswap32(jsb->s_header.h_magic);
-  if (magic != EXT3_JOURNAL_MAGIC_NUMBER) {
-    klog_puts("[EXT3] Invalid journal magic\n");
-    kfree(buf);
-    return;
+  spinlock_acquire(&j->lock);
+  if (err == 0)
+    j->sb_start = start;
+  j->sb_busy = false;
+  spinlock_release(&j->lock);
+}
+
+// ── Checkpoint ──────────────────────────────────────────────────────────────
+
+// Release the committed transactions, oldest first, whose buffers have all
+// reached their home blocks, and move the tail past them.
+static void jbd_cleanup(struct ext3_journal *j) {
+  bool moved = false;
+  spinlock_acquire(&j->lock);
+  while (!list_empty(&j->log)) {
+    ext3_transaction_t *t = list_entry(j->log.next, ext3_transaction_t, link);
+    bool home = true;
+    struct list_head *pos, *n;
+    list_for_each(pos, &t->checkpoint) {
+      ext3_jbuf_t *jb = list_entry(pos, ext3_jbuf_t, cp_list);
+      if (jb->trans || jb->logging || buffer_busy(jb->bh)) {
+        home = false;
+        break;
+      }
+    }
+    if (!home)
+      break;
+    list_for_each_safe(pos, n, &t->checkpoint) {
+      ext3_jbuf_t *jb = list_entry(pos, ext3_jbuf_t, cp_list);
+      list_del(&jb->cp_list);
+      jbd_drop(j, jb);
+    }
+    list_del(&t->link);
+    j->free += t->log_blocks;
+    jbd_free_trans(t);
+    moved = true;
   }
+  spinlock_release(&j->lock);
+  if (moved)
+    jbd_update_sb(j);
+}
 
-  current_trans.sequence = __builtin_bswap32(jsb->s_sequence);
-  uint32_t start = __builtin_bswap32(jsb->s_start);
+static int jbd_commit(struct ext3_journal *j);
 
-  klog_puts("[EXT3] Found valid JBD journal!\n");
-  klog_puts("       Sequence:  ");
-  klog_uint64(current_trans.sequence);
-  klog_puts("\n");
-  klog_puts("       Start:     ");
-  klog_uint64(start);
-  klog_puts("\n");
+// Make room in the log for a transaction of the largest size, by writing
+// the oldest transactions' buffers home. Caller holds no handle.
+static void jbd_wait_space(struct ext3_journal *j) {
+  uint32_t need = jbd_log_size(j, j->max_buffers, j->max_buffers);
+  bool counted = false;
+  while (1) {
+    spinlock_acquire(&j->lock);
+    if (j->free >= need || j->aborted) {
+      spinlock_release(&j->lock);
+      return;
+    }
+    if (!counted) {
+      j->stats.checkpoints++;
+      counted = true;
+    }
+    // Buffers a newer transaction logged again leave the oldest one when
+    // that transaction commits; the others just need writing.
+    bool relogged = false;
+    if (!list_empty(&j->log)) {
+      ext3_transaction_t *t = list_entry(j->log.next, ext3_transaction_t, link);
+      struct list_head *pos;
+      list_for_each(pos, &t->checkpoint) {
+        if (list_entry(pos, ext3_jbuf_t, cp_list)->trans) {
+          relogged = true;
+          break;
+        }
+      }
+    }
+    uint32_t before = j->free;
+    spinlock_release(&j->lock);
 
-  if (start != 0) {
-    klog_puts("[EXT3] Journal requires recovery!\n");
-    ext3_recover_journal(mnt, jsb, &current_trans.journal_inode);
-  } else {
-    klog_puts("[EXT3] Journal is clean.\n");
+    if (relogged)
+      jbd_commit(j);
+    else
+      block_sync(j->mnt->dev);
+    jbd_cleanup(j);
+
+    spinlock_acquire(&j->lock);
+    bool stuck = j->free == before;
+    spinlock_release(&j->lock);
+    if (stuck)
+      jbd_sleep(1); // Writes of another thread still in flight
   }
+}
 
-  kfree(buf);
+// ── Commit ──────────────────────────────────────────────────────────────────
+
+struct jbd_commit_io {
+  uint32_t pending;
+  int status;
+  completion_t done;
+};
+
+static void jbd_end_io(struct bio *bio) {
+  struct jbd_commit_io *io = (struct jbd_commit_io *)bio->private;
+  if (bio->status)
+    io->status = -1;
+  if (__atomic_sub_fetch(&io->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    complete(&io->done);
 }
 
-int ext3_journal_start(ext2_mount_t *mnt) {
-  if (!(mnt->sb.s_feature_compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL))
-    return 0;
-  if (current_trans.active)
+// Write total log blocks starting at log block start, taken from chunks,
+// as one batch: one bio per physically contiguous run.
+static int jbd_write_log(struct ext3_journal *j, uint32_t start,
+                         uint8_t **chunks, uint32_t total) {
+  uint32_t bs = j->mnt->block_size;
+  uint32_t spb = bs / 512;
+  struct bio *bios = kmalloc(total * sizeof(struct bio));
+  if (!bios)
     return -1;
 
-  current_trans.active = true;
-  current_trans.blocks_in_trans = 0;
-
-  // Simple impl: start at block 1 of journal for each txn
-  current_trans.start_block = 1;
+  uint32_t nr = 0;
+  for (uint32_t k = 0; k < total; k++) {
+    uint32_t disk = j->map[jbd_next(j, start, k)];
+    struct bio *prev = nr ? &bios[nr - 1] : NULL;
+    if (prev && k % JBD_CHUNK != 0 &&
+        prev->lba + prev->count == (uint64_t)disk * spb) {
+      prev->count += spb;
+      continue;
+    }
+    bio_init(&bios[nr++], j->mnt->dev, BIO_WRITE, (uint64_t)disk * spb, spb,
+             chunks[k / JBD_CHUNK] + (k % JBD_CHUNK) * bs);
+  }
 
-  // Setup descriptor block buffer
-  if (!current_trans.desc_block_buf)
-    current_trans.desc_block_buf = kmalloc(mnt->block_size);
-  memset(current_trans.desc_block_buf, 0, mnt->block_size);
+  struct jbd_commit_io io;
+  io.pending = nr;
+  io.status = 0;
+  completion_init(&io.done);
+  struct blk_plug plug;
+  blk_start_plug(&plug);
+  for (uint32_t b = 0; b < nr; b++) {
+    bios[b].end_io = jbd_end_io;
+    bios[b].private = &io;
+    submit_bio(&bios[b]);
+  }
+  blk_finish_plug(&plug);
+  wait_for_completion(&io.done);
+  kfree(bios);
+  return io.status;
+}
 
-  jbd_header_t *h = (jbd_header_t *)current_trans.desc_block_buf;
-  h->h_magic = __builtin_bswap32(EXT3_JOURNAL_MAGIC_NUMBER);
-  h->h_blocktype = __builtin_bswap32(JBD_DESCRIPTOR_BLOCK);
-  h->h_sequence = __builtin_bswap32(current_trans.sequence);
+static void jbd_free_chunks(uint8_t **chunks, uint32_t nr) {
+  if (!chunks)
+    return;
+  for (uint32_t i = 0; i < nr; i++)
+    kfree(chunks[i]);
+  kfree(chunks);
+}
 
-  return 0;
+static uint8_t *jbd_log_buf(uint8_t **chunks, uint32_t k, uint32_t bs) {
+  return chunks[k / JBD_CHUNK] + (k % JBD_CHUNK) * bs;
 }
 
-int ext3_journal_block(ext2_mount_t *mnt, uint32_t block_nr, const void *data) {
-  if (!current_trans.active)
-    return ext2_write_block(mnt, block_nr, data);
+// Commit the running transaction and wait for it. Commits are serialized;
+// a caller that finds one in progress waits for it and then commits what
+// accumulated meanwhile. Caller holds no handle. Returns 1 if a transaction
+// was committed, 0 if there was nothing to commit, -1 on error.
+static int jbd_commit(struct ext3_journal *j) {
+  ext2_mount_t *mnt = j->mnt;
+  uint32_t bs = mnt->block_size;
 
-  // 1. Add tag to descriptor block
-  uint32_t tag_offset = sizeof(jbd_header_t) + (current_trans.blocks_in_trans *
-                                                sizeof(jbd_block_tag_t));
-  if (tag_offset + sizeof(jbd_block_tag_t) > mnt->block_size) {
+  spinlock_acquire(&j->lock);
+  while (j->commit_busy) {
+    spinlock_release(&j->lock);
+    jbd_sleep(1);
+    spinlock_acquire(&j->lock);
+  }
+  ext3_transaction_t *t = j->running;
+  if (!t) {
+    spinlock_release(&j->lock);
+    return j->aborted ? -1 : 0;
+  }
+  j->commit_busy = true;
+  j->commit_request = false;
+  t->state = T_LOCKED;
+  while (t->updates) {
+    spinlock_release(&j->lock);
+    jbd_sleep(1);
+    spinlock_acquire(&j->lock);
+  }
+
+  // No handle can touch t now. Buffers freed since they were logged are
+  // left out: their old contents must not be replayed.
+  uint32_t nr = 0;
+  ext3_jbuf_t **jbs = t->nr_buffers ? kmalloc(t->nr_buffers * sizeof(*jbs))
+                                    : NULL;
+  struct list_head *pos, *n;
+  list_for_each_safe(pos, n, &t->buffers) {
+    ext3_jbuf_t *jb = list_entry(pos, ext3_jbuf_t, t_list);
+    if (jbs && jb->bh->hashed) {
+      jbs[nr++] = jb;
+      continue;
+    }
+    list_del(&jb->t_list);
+    jb->trans = NULL;
+    if (!jbs)
+      mark_buffer_dirty(jb->bh); // Out of memory: write it home unlogged
+    if (!jb->cp_trans)
+      jbd_drop(j, jb);
+  }
+  uint32_t nrev = t->nr_revokes;
+  spinlock_release(&j->lock);
+
+  uint32_t total = nr || nrev ? jbd_log_size(j, nr, nrev) - 1 : 0; // No commit
+  uint32_t nr_chunks = (total + JBD_CHUNK - 1) / JBD_CHUNK;
+  uint8_t **chunks = nr_chunks ? kmalloc(nr_chunks * sizeof(uint8_t *)) : NULL;
+  bool oom = nr_chunks && !chunks;
+  for (uint32_t c = 0; chunks && c < nr_chunks; c++) {
+    chunks[c] = kmalloc(JBD_CHUNK * bs);
+    if (!chunks[c]) {
+      jbd_free_chunks(chunks, c);
+      chunks = NULL;
+      oom = true;
+    }
+  }
+
+  // Build the log image: each descriptor block followed by the copies of
+  // the buffers it tags, then the revoke blocks.
+  uint32_t per_desc = jbd_tags_per_desc(bs);
+  uint32_t k = 0;
+  uint8_t *desc = NULL;
+  for (uint32_t i = 0; chunks && i < nr; i++) {
+    uint32_t slot = i % per_desc;
+    if (slot == 0) {
+      desc = jbd_log_buf(chunks, k++, bs);
+      memset(desc, 0, bs);
+      jbd_header(desc, JBD_DESCRIPTOR_BLOCK, t->tid);
+    }
+    uint8_t *copy = jbd_log_buf(chunks, k++, bs);
+    memcpy(copy, jbs[i]->bh->data, bs);
+
+    uint32_t off = sizeof(jbd_header_t) + slot * sizeof(jbd_block_tag_t) +
+                   (slot ? JBD_UUID_SIZE : 0);
+    jbd_block_tag_t *tag = (jbd_block_tag_t *)(desc + off);
+    tag->t_blocknr = __builtin_bswap32((uint32_t)jbs[i]->bh->block);
+    uint32_t flags = slot ? JBD_FLAG_SAME_UUID : 0;
+    if (!slot)
+      memcpy(desc + off + sizeof(jbd_block_tag_t), j->uuid, JBD_UUID_SIZE);
+    // A copy that looks like a journal block is escaped in the log
+    if (*(uint32_t *)copy == __builtin_bswap32(EXT3_JOURNAL_MAGIC_NUMBER)) {
+      flags |= JBD_FLAG_ESCAPE;
+      memset(copy, 0, 4);
+    }
+    if (slot == per_desc - 1 || i == nr - 1)
+      flags |= JBD_FLAG_LAST_TAG;
+    tag->t_flags = __builtin_bswap32(flags);
+  }
+  uint32_t per_rev = jbd_revokes_per_block(bs);
+  for (uint32_t r = 0; chunks && r < nrev; r += per_rev) {
+    uint8_t *rb = jbd_log_buf(chunks, k++, bs);
+    uint32_t cnt = nrev - r < per_rev ? nrev - r : per_rev;
+    memset(rb, 0, bs);
+    jbd_header(rb, JBD_REVOKE_BLOCK, t->tid);
+    uint32_t *entry = (uint32_t *)(rb + sizeof(jbd_header_t));
+    entry[0] = __builtin_bswap32(sizeof(jbd_header_t) + 4 + cnt * 4);
+    for (uint32_t i = 0; i < cnt; i++)
+      entry[1 + i] = __builtin_bswap32(t->revokes[r + i]);
+  }
+
+  spinlock_acquire(&j->lock);
+  t->log_blocks = total ? total + 1 : 0;
+  // Handles only join a transaction while the log has room for the largest
+  if (!oom && !j->aborted && t->log_blocks > j->free) {
+    klog_puts("[EXT3] Journal full, journaling stopped\n");
+    j->aborted = true;
+  }
+  int err = oom || j->aborted ? -1 : 0;
+  if (err) {
+    // Write the buffers home unlogged rather than not at all
+    for (uint32_t i = 0; i < nr; i++) {
+      list_del(&jbs[i]->t_list);
+      jbs[i]->trans = NULL;
+      mark_buffer_dirty(jbs[i]->bh);
+      if (!jbs[i]->cp_trans)
+        jbd_drop(j, jbs[i]);
+    }
+    nr = 0;
+    total = 0;
+    t->log_blocks = 0;
+  }
+  // The log image is complete: later handles may change the buffers.
+  for (uint32_t i = 0; i < nr; i++) {
+    list_del(&jbs[i]->t_list);
+    jbs[i]->trans = NULL;
+    jbs[i]->logging = true;
+  }
+  j->running = NULL;
+  t->state = T_COMMIT;
+  t->log_start = j->head;
+  j->head = jbd_next(j, j->head, t->log_blocks);
+  j->free -= t->log_blocks;
+  spinlock_release(&j->lock);
+
+  if (total && !err) {
+    // Ordered after the blocks it seals: only a commit block that reaches
+    // the disk behind its transaction may make it replayable.
+    err = jbd_write_log(j, t->log_start, chunks, total);
+    if (err == 0)
+      err = block_flush(mnt->dev);
+    if (err == 0) {
+      uint8_t *commit = chunks[0];
+      memset(commit, 0, bs);
+      jbd_header(commit, JBD_COMMIT_BLOCK, t->tid);
+      err = jbd_write_log(j, jbd_next(j, t->log_start, total), chunks, 1);
+    }
+    if (err == 0)
+      err = block_flush(mnt->dev);
+  }
+  jbd_free_chunks(chunks, nr_chunks);
+
+  spinlock_acquire(&j->lock);
+  if (err && !j->aborted && !oom) {
+    klog_puts("[EXT3] Journal commit failed, journaling stopped\n");
+    j->aborted = true;
+  }
+  for (uint32_t i = 0; i < nr; i++) {
+    ext3_jbuf_t *jb = jbs[i];
+    jb->logging = false;
+    if (jb->cp_trans)
+      list_del(&jb->cp_list);
+    jb->cp_trans = t;
+    list_add_tail(&jb->cp_list, &t->checkpoint);
+    // A newer transaction logged it again: that one dirties it
+    if (!jb->trans)
+      mark_buffer_dirty(jb->bh);
+  }
+  t->state = T_FINISHED;
+  j->commit_tid = t->tid;
+  j->stats.handles += t->handles;
+  j->commit_busy = false;
+  if (!t->log_blocks) {
+    // Nothing reached the log; the id is used up all the same
+    spinlock_release(&j->lock);
+    kfree(jbs);
+    jbd_free_trans(t);
+    return err;
+  }
+  if (err) {
+    // Its log space is held until its buffers are home, like any other's
+    list_add_tail(&t->link, &j->log);
+    spinlock_release(&j->lock);
+    kfree(jbs);
     return -1;
   }
+  list_add_tail(&t->link, &j->log);
+  j->stats.commits++;
+  j->stats.logged += nr;
+  spinlock_release(&j->lock);
+  kfree(jbs);
 
-  jbd_block_tag_t *tag =
-      (jbd_block_tag_t *)(current_trans.desc_block_buf + tag_offset);
-  tag->t_blocknr = __builtin_bswap32(block_nr);
-  tag->t_flags = 0;
+  // The first transaction in an empty log must be made findable
+  jbd_update_sb(j);
+  return 1;
+}
 
-  // 2. Write data block to journal
-  uint32_t journal_data_pos =
-      current_trans.start_block + 1 + current_trans.blocks_in_trans;
-  uint32_t phys_pos =
-      ext2_get_block_num(mnt, &current_trans.journal_inode, journal_data_pos);
+// ── Commit thread ───────────────────────────────────────────────────────────
 
-  // Handle Escaping
-  uint8_t *safe_data = (uint8_t *)data;
-  if (*(const uint32_t *)data == __builtin_bswap32(EXT3_JOURNAL_MAGIC_NUMBER)) {
-    tag->t_flags |= __builtin_bswap32(JBD_FLAG_ESCAPE);
+static void jbd_thread_entry(void) {
+  struct thread *self = sched_get_current();
+  struct ext3_journal *j = NULL;
+  spinlock_acquire(&jbd_table_lock);
+  for (uint32_t i = 0; i < jbd_count; i++) {
+    if (jbd_table[i]->thread == self)
+      j = jbd_table[i];
   }
+  spinlock_release(&jbd_table_lock);
 
-  ext2_write_block(mnt, phys_pos, safe_data);
+  while (1) {
+    self->wakeup_ticks = lapic_timer_get_ticks() + JBD_WAKE_MS;
+    self->state = THREAD_BLOCKED;
+    sched_yield();
+    if (!j)
+      continue;
 
-  current_trans.blocks_in_trans++;
-  return 0;
+    spinlock_acquire(&j->lock);
+    ext3_transaction_t *t = j->running;
+    bool due = t && (j->commit_request ||
+                     lapic_timer_get_ms() - t->start_ms >= JBD_COMMIT_MS ||
+                     jbd_trans_full(j, t));
+    spinlock_release(&j->lock);
+    if (due)
+      jbd_commit(j);
+    jbd_cleanup(j);
+  }
 }
 
-int ext3_journal_stop(ext2_mount_t *mnt) {
-  if (!current_trans.active)
+// Get the running transaction committed soon. Caller holds no handle.
+static void jbd_commit_soon(struct ext3_journal *j) {
+  spinlock_acquire(&j->lock);
+  struct thread *t = j->thread;
+  j->commit_request = true;
+  if (t && t->state == THREAD_BLOCKED)
+    t->state = THREAD_READY;
+  spinlock_release(&j->lock);
+  if (!t || !jbd_can_sleep())
+    jbd_commit(j);
+}
+
+// ── Handles ─────────────────────────────────────────────────────────────────
+
+int ext3_journal_start(ext2_mount_t *mnt) {
+  struct ext3_journal *j = mnt->journal;
+  if (!j)
+    return 0;
+  void **slot = jbd_handle_slot();
+  ext3_handle_t *h = *slot;
+  if (h) {
+    if (h->journal != j)
+      return -1; // One filesystem at a time
+    h->depth++;
     return 0;
+  }
 
-  // 1. Mark last tag
-  if (current_trans.blocks_in_trans > 0) {
-    uint32_t last_tag_off =
-        sizeof(jbd_header_t) +
-        ((current_trans.blocks_in_trans - 1) * sizeof(jbd_block_tag_t));
-    jbd_block_tag_t *tag =
-        (jbd_block_tag_t *)(current_trans.desc_block_buf + last_tag_off);
-    tag->t_flags |= __builtin_bswap32(JBD_FLAG_LAST_TAG);
-  }
-
-  // 2. Write descriptor block
-  uint32_t desc_phys = ext2_get_block_num(mnt, &current_trans.journal_inode,
-                                          current_trans.start_block);
-  ext2_write_block(mnt, desc_phys, current_trans.desc_block_buf);
-
-  // 3. Write commit block
-  uint8_t *commit_buf = kmalloc(mnt->block_size);
-  memset(commit_buf, 0, mnt->block_size);
-  jbd_header_t *ch = (jbd_header_t *)commit_buf;
-  ch->h_magic = __builtin_bswap32(EXT3_JOURNAL_MAGIC_NUMBER);
-  ch->h_blocktype = __builtin_bswap32(JBD_COMMIT_BLOCK);
-  ch->h_sequence = __builtin_bswap32(current_trans.sequence);
-
-  uint32_t commit_pos =
-      current_trans.start_block + 1 + current_trans.blocks_in_trans;
-  uint32_t commit_phys =
-      ext2_get_block_num(mnt, &current_trans.journal_inode, commit_pos);
-  ext2_write_block(mnt, commit_phys, commit_buf);
-  kfree(commit_buf);
-
-  // 4. Update journal superblock to mark "Start" (simulating a crash window
-  // here)
-  uint8_t *sb_buf = kmalloc(mnt->block_size);
-  uint32_t sb_phys = ext2_get_block_num(mnt, &current_trans.journal_inode, 0);
-  ext2_read_block(mnt, sb_phys, sb_buf);
-  jbd_superblock_t *jsb = (jbd_superblock_t *)sb_buf;
-  jsb->s_start = __builtin_bswap32(current_trans.start_block);
-  ext2_write_block(mnt, sb_phys, sb_buf);
-
-  // 5. Commit to real file system
-  for (uint32_t i = 0; i < current_trans.blocks_in_trans; i++) {
-    uint32_t tag_off = sizeof(jbd_header_t) + (i * sizeof(jbd_block_tag_t));
-    jbd_block_tag_t *tag =
-        (jbd_block_tag_t *)(current_trans.desc_block_buf + tag_off);
-    uint32_t target_nr = __builtin_bswap32(tag->t_blocknr);
-
-    uint32_t j_data_pos = current_trans.start_block + 1 + i;
-    uint32_t j_phys =
-        ext2_get_block_num(mnt, &current_trans.journal_inode, j_data_pos);
-
-    uint8_t *tmp = kmalloc(mnt->block_size);
-    ext2_read_block(mnt, j_phys, tmp);
-    ext2_write_block(mnt, target_nr, tmp);
-    kfree(tmp);
-  }
-
-  current_trans.sequence++;
-  current_trans.active = false;
-
-  // 6. Finalize journal superblock (mark clean)
-  jsb->s_sequence = __builtin_bswap32(current_trans.sequence);
-  jsb->s_start = 0;
-  ext2_write_block(mnt, sb_phys, sb_buf);
-  kfree(sb_buf);
+  h = kmalloc(sizeof(ext3_handle_t));
+  ext3_transaction_t *fresh = kmalloc(sizeof(ext3_transaction_t));
+  if (!h || !fresh) {
+    kfree(h);
+    kfree(fresh);
+    return -1;
+  }
+  uint32_t need = jbd_log_size(j, j->max_buffers, j->max_buffers);
+  ext3_transaction_t *t;
+  while (1) {
+    jbd_wait_space(j);
+    spinlock_acquire(&j->lock);
+    if (j->aborted) {
+      spinlock_release(&j->lock);
+      kfree(h);
+      kfree(fresh);
+      return -1;
+    }
+    t = j->running;
+    // A transaction that is closing or full takes no new handles
+    if (t && t->state != T_RUNNING) {
+      spinlock_release(&j->lock);
+      jbd_sleep(1);
+      continue;
+    }
+    if (t && jbd_trans_full(j, t)) {
+      spinlock_release(&j->lock);
+      jbd_commit_soon(j);
+      continue;
+    }
+    if (j->free >= need)
+      break;
+    spinlock_release(&j->lock); // A commit took the room meanwhile
+  }
+  if (!t) {
+    t = fresh;
+    fresh = NULL;
+    memset(t, 0, sizeof(ext3_transaction_t));
+    t->tid = j->next_tid++;
+    t->state = T_RUNNING;
+    t->start_ms = lapic_timer_get_ms();
+    INIT_LIST_HEAD(&t->buffers);
+    INIT_LIST_HEAD(&t->checkpoint);
+    j->running = t;
+  }
+  t->updates++;
+  t->handles++;
+  spinlock_release(&j->lock);
+  kfree(fresh);
 
+  h->journal = j;
+  h->trans = t;
+  h->depth = 1;
+  *slot = h;
   return 0;
 }
 
-static int ext3_recover_journal(ext2_mount_t *mnt, jbd_superblock_t *jsb,
-                                ext2_inode_t *j_inode) {
-  uint32_t block_size = mnt->block_size;
-  uint32_t start_block = __builtin_bswap32(jsb->s_start);
-  uint32_t sequence = __builtin_bswap32(jsb->s_sequence);
-  uint32_t journal_blocks = __builtin_bswap32(jsb->s_maxlen);
+int ext3_journal_stop(ext2_mount_t *mnt) {
+  struct ext3_journal *j = mnt->journal;
+  if (!j)
+    return 0;
+  void **slot = jbd_handle_slot();
+  ext3_handle_t *h = *slot;
+  if (!h || h->journal != j)
+    return -1;
+  if (--h->depth)
+    return 0;
+  *slot = NULL;
+  ext3_transaction_t *t = h->trans;
+  kfree(h);
 
-  klog_puts("[EXT3] Starting journal recovery...\n");
+  spinlock_acquire(&j->lock);
+  t->updates--;
+  bool full = t->state == T_RUNNING && jbd_trans_full(j, t);
+  spinlock_release(&j->lock);
+  if (full)
+    jbd_commit_soon(j);
+  return 0;
+}
 
-  uint8_t *desc_buf = kmalloc(block_size);
-  uint8_t *data_buf = kmalloc(block_size);
-  if (!desc_buf || !data_buf)
-    return -1;
+void ext3_journal_dirty(ext2_mount_t *mnt, struct buffer_head *bh) {
+  struct ext3_journal *j = mnt->journal;
+  if (!j) {
+    mark_buffer_dirty(bh);
+    return;
+  }
+  set_buffer_uptodate(bh);
+  ext3_handle_t *h = *jbd_handle_slot();
+  if (!h || h->journal != j || j->aborted) {
+    // Unlogged. A buffer an uncommitted transaction holds still waits for
+    // that commit, the change goes along with it.
+    spinlock_acquire(&j->lock);
+    ext3_jbuf_t *jb = jbd_find(j, bh);
+    bool held = jb && (jb->trans || jb->logging);
+    spinlock_release(&j->lock);
+    if (!held)
+      mark_buffer_dirty(bh);
+    return;
+  }
 
-  uint32_t curr_journal_block = start_block;
-  while (1) {
-    uint32_t phys_block = ext2_get_block_num(mnt, j_inode, curr_journal_block);
-    if (ext2_read_block(mnt, phys_block, desc_buf) != 0)
+  ext3_transaction_t *t = h->trans;
+  ext3_jbuf_t *jb = jbd_get(j, bh);
+  if (jb && jb->trans == t) {
+    spinlock_release(&j->lock);
+    return;
+  }
+  if (!jb || t->nr_buffers >= j->max_buffers) {
+    // Untrackable, or the transaction is as large as the log allows
+    spinlock_release(&j->lock);
+    mark_buffer_dirty(bh);
+    return;
+  }
+  jb->trans = t;
+  list_add_tail(&jb->t_list, &t->buffers);
+  t->nr_buffers++;
+  // A block freed and reused within the transaction is not revoked
+  for (uint32_t i = 0; i < t->nr_revokes; i++) {
+    if (t->revokes[i] == (uint32_t)bh->block) {
+      t->revokes[i] = t->revokes[--t->nr_revokes];
       break;
+    }
+  }
+  // Committed contents only: the commit marks it dirty again
+  clear_buffer_dirty(bh);
+  spinlock_release(&j->lock);
+}
 
-    jbd_header_t *header = (jbd_header_t *)desc_buf;
-    if (__builtin_bswap32(header->h_magic) != EXT3_JOURNAL_MAGIC_NUMBER)
-      break;
-    if (__builtin_bswap32(header->h_sequence) != sequence)
-      break;
+void ext3_journal_revoke(ext2_mount_t *mnt, uint32_t block) {
+  struct ext3_journal *j = mnt->journal;
+  ext3_handle_t *h = j ? *jbd_handle_slot() : NULL;
+  if (!h || h->journal != j || j->aborted)
+    return;
+  // The log can only hold a copy of a block the journal still tracks, and
+  // a tracked buffer is referenced, hence cached
+  struct buffer_head *bh = find_get_block(mnt->dev, block, mnt->block_size);
+  if (!bh)
+    return;
+  ext3_transaction_t *t = h->trans;
+  spinlock_acquire(&j->lock);
+  ext3_jbuf_t *jb = jbd_find(j, bh);
+  if (jb && (jb->cp_trans || jb->logging)) {
+    if (t->nr_revokes == t->revokes_cap && t->revokes_cap < j->max_buffers) {
+      uint32_t cap = t->revokes_cap ? t->revokes_cap * 2 : 16;
+      if (cap > j->max_buffers)
+        cap = j->max_buffers;
+      uint32_t *grown = kmalloc(cap * sizeof(uint32_t));
+      if (grown) {
+        if (t->revokes) {
+          memcpy(grown, t->revokes, t->nr_revokes * sizeof(uint32_t));
+          kfree(t->revokes);
+        }
+        t->revokes = grown;
+        t->revokes_cap = cap;
+      }
+    }
+    if (t->nr_revokes < t->revokes_cap)
+      t->revokes[t->nr_revokes++] = block;
+    else
+      klog_puts("[EXT3] Revoke table full, block may be replayed\n");
+  }
+  spinlock_release(&j->lock);
+  brelse(bh);
+}
+
+int ext3_journal_force_commit(ext2_mount_t *mnt) {
+  struct ext3_journal *j = mnt->journal;
+  if (!j)
+    return 0;
+  if (*jbd_handle_slot())
+    return -1; // Would wait for our own handle
+  int ret = jbd_commit(j);
+  if (ret == 0)
+    return block_flush(mnt->dev); // Nothing logged: data writes only
+  return ret < 0 ? -1 : 0;
+}
+
+void ext3_journal_get_stats(struct ext3_journal_stats *out) {
+  memset(out, 0, sizeof(*out));
+  spinlock_acquire(&jbd_table_lock);
+  for (uint32_t i = 0; i < jbd_count; i++) {
+    struct ext3_journal *j = jbd_table[i];
+    spinlock_acquire(&j->lock);
+    out->commits += j->stats.commits;
+    out->handles += j->stats.handles;
+    out->logged += j->stats.logged;
+    out->checkpoints += j->stats.checkpoints;
+    spinlock_release(&j->lock);
+  }
+  spinlock_release(&jbd_table_lock);
+}
+
+// ── Recovery ────────────────────────────────────────────────────────────────
+
+typedef struct {
+  uint32_t block;
+  uint32_t tid; // Newest transaction that revoked it
+} jbd_revoke_t;
+
+typedef struct {
+  jbd_revoke_t *list;
+  uint32_t count;
+  uint32_t cap;
+} jbd_revoke_table_t;
 
-    uint32_t type = __builtin_bswap32(header->h_blocktype);
-    if (type == JBD_DESCRIPTOR_BLOCK) {
-      uint32_t tag_offset = sizeof(jbd_header_t);
-      while (tag_offset < block_size) {
-        jbd_block_tag_t *tag = (jbd_block_tag_t *)(desc_buf + tag_offset);
-        uint32_t target_block = __builtin_bswap32(tag->t_blocknr);
-        uint32_t flags = __builtin_bswap32(tag->t_flags);
+static void jbd_revoke_add(jbd_revoke_table_t *rt, uint32_t block,
+                           uint32_t tid) {
+  for (uint32_t i = 0; i < rt->count; i++) {
+    if (rt->list[i].block == block) {
+      if ((int32_t)(tid - rt->list[i].tid) > 0)
+        rt->list[i].tid = tid;
+      return;
+    }
+  }
+  if (rt->count == rt->cap) {
+    uint32_t cap = rt->cap ? rt->cap * 2 : 64;
+    jbd_revoke_t *grown = kmalloc(cap * sizeof(jbd_revoke_t));
+    if (!grown)
+      return;
+    if (rt->list) {
+      memcpy(grown, rt->list, rt->count * sizeof(jbd_revoke_t));
+      kfree(rt->list);
+    }
+    rt->list = grown;
+    rt->cap = cap;
+  }
+  rt->list[rt->count].block = block;
+  rt->list[rt->count].tid = tid;
+  rt->count++;
+}
 
-        curr_journal_block = (curr_journal_block % (journal_blocks - 1)) + 1;
-        uint32_t data_phys =
-            ext2_get_block_num(mnt, j_inode, curr_journal_block);
-        ext2_read_block(mnt, data_phys, data_buf);
+// A block logged by transaction tid is not replayed if it was revoked by
+// tid or a later transaction.
+static bool jbd_revoked(jbd_revoke_table_t *rt, uint32_t block,
+                        uint32_t tid) {
+  for (uint32_t i = 0; i < rt->count; i++) {
+    if (rt->list[i].block == block)
+      return (int32_t)(rt->list[i].tid - tid) >= 0;
+  }
+  return false;
+}
 
-        if (__builtin_bswap32(flags) & JBD_FLAG_ESCAPE) {
+// Walk the tags of descriptor block desc. Returns how many there are; with
+// replay set, also writes the blocks following it home.
+static uint32_t jbd_replay_desc(struct ext3_journal *j, uint8_t *desc,
+                                uint32_t pos, uint32_t tid, bool replay,
+                                jbd_revoke_table_t *rt, uint8_t *data) {
+  uint32_t bs = j->mnt->block_size;
+  uint32_t off = sizeof(jbd_header_t);
+  uint32_t nr = 0;
+  while (off + sizeof(jbd_block_tag_t) <= bs) {
+    jbd_block_tag_t *tag = (jbd_block_tag_t *)(desc + off);
+    uint32_t target = __builtin_bswap32(tag->t_blocknr);
+    uint32_t flags = __builtin_bswap32(tag->t_flags);
+    nr++;
+    if (replay && !jbd_revoked(rt, target, tid)) {
+      uint32_t log = jbd_next(j, pos, nr);
+      if (ext2_read_block(j->mnt, j->map[log], data) == 0) {
+        if (flags & JBD_FLAG_ESCAPE) {
           uint32_t magic = __builtin_bswap32(EXT3_JOURNAL_MAGIC_NUMBER);
-          memcpy(data_buf, &magic, 4);
+          memcpy(data, &magic, 4);
         }
+        ext2_write_block(j->mnt, target, data);
+      }
+    }
+    off += sizeof(jbd_block_tag_t);
+    if (!(flags & JBD_FLAG_SAME_UUID))
+      off += JBD_UUID_SIZE;
+    if (flags & JBD_FLAG_LAST_TAG)
+      break;
+  }
+  return nr;
+}
 
-        klog_puts("       Recovering block: ");
-        klog_uint64(target_block);
-        klog_puts("\n");
-        ext2_write_block(mnt, target_block, data_buf);
+// Replay the transactions that committed after the tail. The first pass
+// finds where the committed log ends and collects revocations, the second
+// writes the logged blocks home. Returns the next transaction id.
+static uint32_t ext3_recover_journal(struct ext3_journal *j, uint32_t start,
+                                     uint32_t tid) {
+  uint32_t bs = j->mnt->block_size;
+  uint32_t len = j->last - j->first;
+  uint8_t *buf = kmalloc(bs);
+  uint8_t *data = kmalloc(bs);
+  jbd_revoke_table_t rt = {NULL, 0, 0};
+  if (!buf || !data) {
+    kfree(buf);
+    kfree(data);
+    return tid;
+  }
 
-        if (__builtin_bswap32(flags) & JBD_FLAG_LAST_TAG)
-          break;
-        tag_offset += sizeof(jbd_block_tag_t);
+  klog_puts("[EXT3] Starting journal recovery...\n");
+  uint32_t end_tid = tid;
+  for (int pass = 0; pass < 2; pass++) {
+    uint32_t pos = start, cur = tid, scanned = 0;
+    while (scanned < len && (pass == 0 || cur != end_tid)) {
+      if (ext2_read_block(j->mnt, j->map[pos], buf) != 0)
+        break;
+      jbd_header_t *h = (jbd_header_t *)buf;
+      if (__builtin_bswap32(h->h_magic) != EXT3_JOURNAL_MAGIC_NUMBER ||
+          __builtin_bswap32(h->h_sequence) != cur)
+        break;
+      uint32_t type = __builtin_bswap32(h->h_blocktype);
+      uint32_t used = 1;
+      if (type == JBD_DESCRIPTOR_BLOCK) {
+        used += jbd_replay_desc(j, buf, pos, cur, pass == 1, &rt, data);
+      } else if (type == JBD_COMMIT_BLOCK) {
+        cur++;
+        if (pass == 0)
+          end_tid = cur;
+      } else if (type == JBD_REVOKE_BLOCK) {
+        uint32_t count = __builtin_bswap32(*(uint32_t *)(buf + 12));
+        for (uint32_t off = 16; pass == 0 && off + 4 <= count && off + 4 <= bs;
+             off += 4)
+          jbd_revoke_add(&rt, __builtin_bswap32(*(uint32_t *)(buf + off)),
+                         cur);
+      } else {
+        break;
       }
-    } else if (type == JBD_COMMIT_BLOCK) {
-      sequence++;
-    } else {
-      break;
+      pos = jbd_next(j, pos, used);
+      scanned += used;
+    }
+    if (pass == 0 && end_tid != tid) {
+      // Only revocations by committed transactions count
+      uint32_t keep = 0;
+      for (uint32_t i = 0; i < rt.count; i++) {
+        if ((int32_t)(end_tid - rt.list[i].tid) > 0)
+          rt.list[keep++] = rt.list[i];
+      }
+      rt.count = keep;
     }
+  }
 
-    curr_journal_block = (curr_journal_block % (journal_blocks - 1)) + 1;
-    if (curr_journal_block == start_block)
-      break;
+  klog_puts("[EXT3] Replayed ");
+  klog_uint64(end_tid - tid);
+  klog_puts(" transaction(s).\n");
+  kfree(rt.list);
+  kfree(buf);
+  kfree(data);
+  return end_tid;
+}
+
+// ── Setup ───────────────────────────────────────────────────────────────────
+
+int ext3_init_journal(ext2_mount_t *mnt) {
+  if (!(mnt->sb.s_feature_compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL)) {
+    return 0; // No journal
+  }
+
+  uint32_t journal_ino = mnt->sb.s_journal_inum;
+  if (journal_ino == 0) {
+    klog_puts("[EXT3] Journal feature enabled but journal inode is 0\n");
+    return 0;
+  }
+
+  ext2_inode_t j_inode;
+  if (ext2_read_inode(mnt, journal_ino, &j_inode) != 0) {
+    klog_puts("[EXT3] Failed to read journal inode\n");
+    return 0;
+  }
+
+  uint32_t bs = mnt->block_size;
+  struct ext3_journal *j = kmalloc(sizeof(struct ext3_journal));
+  uint8_t *buf = kmalloc(bs);
+  if (!j || !buf) {
+    klog_puts("[EXT3] Out of memory for journal\n");
+    kfree(j);
+    kfree(buf);
+    return 0;
+  }
+  memset(j, 0, sizeof(struct ext3_journal));
+  j->mnt = mnt;
+  j->sb_buf = buf;
+
+  uint32_t disk_block = ext2_get_block_num(mnt, &j_inode, 0);
+  if (!disk_block || ext2_read_block(mnt, disk_block, buf) != 0) {
+    klog_puts("[EXT3] Failed to read journal superblock\n");
+    goto fail;
+  }
+
+  jbd_superblock_t *jsb = (jbd_superblock_t *)buf;
+  uint32_t magic = __builtin_bswap32(jsb->s_header.h_magic);
+  if (magic != EXT3_JOURNAL_MAGIC_NUMBER) {
+    klog_puts("[EXT3] Invalid journal magic\n");
+    goto fail;
+  }
+  uint32_t type = __builtin_bswap32(jsb->s_header.h_blocktype);
+  if (type == JBD_SUPERBLOCK_V2 &&
+      (__builtin_bswap32(jsb->s_feature_incompat) &
+       ~JBD_FEATURE_INCOMPAT_REVOKE)) {
+    klog_puts("[EXT3] Journal uses unsupported features, not journaling\n");
+    goto fail;
+  }
+  j->first = __builtin_bswap32(jsb->s_first);
+  j->last = __builtin_bswap32(jsb->s_maxlen);
+  if (__builtin_bswap32(jsb->s_blocksize) != bs || j->first == 0 ||
+      j->last <= j->first + 16 || j->last * (uint64_t)bs > j_inode.i_size) {
+    klog_puts("[EXT3] Journal geometry is invalid\n");
+    goto fail;
+  }
+  memcpy(j->uuid, jsb->s_uuid, JBD_UUID_SIZE);
+
+  // Map the whole log once: commits write it by disk block
+  j->map = kmalloc(j->last * sizeof(uint32_t));
+  if (!j->map) {
+    klog_puts("[EXT3] Out of memory for journal\n");
+    goto fail;
+  }
+  for (uint32_t i = 0; i < j->last; i++) {
+    j->map[i] = ext2_get_block_num(mnt, &j_inode, i);
+    if (!j->map[i]) {
+      klog_puts("[EXT3] Journal inode has holes\n");
+      goto fail;
+    }
+  }
+
+  uint32_t tid = __builtin_bswap32(jsb->s_sequence);
+  uint32_t start = __builtin_bswap32(jsb->s_start);
+
+  klog_puts("[EXT3] Found valid JBD journal!\n");
+  klog_puts("       Sequence:  ");
+  klog_uint64(tid);
+  klog_puts("\n");
+  klog_puts("       Start:     ");
+  klog_uint64(start);
+  klog_puts("\n");
+  klog_puts("       Blocks:    ");
+  klog_uint64(j->last - j->first);
+  klog_puts("\n");
+
+  int replayed = 0;
+  if (start != 0) {
+    klog_puts("[EXT3] Journal requires recovery!\n");
+    tid = ext3_recover_journal(j, start, tid);
+    block_flush(mnt->dev);
+    // Replay wrote behind the buffer cache's back.
+    block_invalidate(mnt->dev);
+    jsb->s_start = 0;
+    jsb->s_sequence = __builtin_bswap32(tid);
+    ext2_write_block(mnt, disk_block, buf);
+    block_flush(mnt->dev);
+    replayed = 1;
+  } else {
+    klog_puts("[EXT3] Journal is clean.\n");
+  }
+
+  spinlock_init(&j->lock);
+  INIT_LIST_HEAD(&j->log);
+  j->head = j->first;
+  j->free = j->last - j->first;
+  j->next_tid = tid;
+  j->commit_tid = tid - 1;
+  // The largest transaction takes a quarter of the log at most, so one can
+  // commit while the next fills up and checkpointing never has to wait for
+  // the running one
+  j->max_buffers = JBD_MAX_BUFFERS;
+  while (j->max_buffers > 1 &&
+         jbd_log_size(j, j->max_buffers, j->max_buffers) > j->free / 4)
+    j->max_buffers--;
+
+  spinlock_acquire(&jbd_table_lock);
+  if (jbd_count == JBD_MAX_JOURNALS) {
+    spinlock_release(&jbd_table_lock);
+    klog_puts("[EXT3] Too many journals, not journaling\n");
+    goto fail;
+  }
+  jbd_table[jbd_count++] = j;
+  spinlock_release(&jbd_table_lock);
+  mnt->journal = j;
+
+  // Not enqueued before j->thread is set: the thread looks itself up
+  struct thread *t = sched_create_kernel_thread(jbd_thread_entry, NULL, false);
+  if (t) {
+    spinlock_acquire(&j->lock);
+    j->thread = t;
+    spinlock_release(&j->lock);
+    sched_enqueue_thread(t, NULL);
+  } else {
+    klog_puts("[EXT3] Failed to start commit thread, committing inline\n");
   }
+  return replayed;
 
-  klog_puts("[EXT3] Journal recovery complete.\n");
-  kfree(desc_buf);
-  kfree(data_buf);
+fail:
+  kfree(j->map);
+  kfree(j->sb_buf);
+  kfree(j);
   return 0;
 }
@@ -53,13 +53,55 @@ typedef struct {
   uint8_t s_users[16 * 48];
 } __attribute__((packed)) jbd_superblock_t;
 
-// Checks the Ext2 mount context for Ext3 journal capability and parses the
-// journal.
-void ext3_init_journal(ext2_mount_t *mnt);
+// ── Journal ─────────────────────────────────────────────────────────────────
+// The log is circular: committed transactions sit between the tail recorded
+// in the journal superblock and the head, and their blocks reach their home
+// locations lazily, through buffer cache writeback. A transaction collects
+// the handles of any number of callers and commits when it gets old, grows
+// too large, or someone waits for it (fsync, sync); the next one already
+// takes handles while it is being written.
 
-// Transactional write API
+#define EXT3_FEATURE_INCOMPAT_RECOVER 0x0004 // Journal may need replaying
+
+#define JBD_FEATURE_INCOMPAT_REVOKE 0x0001
+
+#define JBD_COMMIT_MS 5000   // A running transaction commits at this age
+#define JBD_MAX_BUFFERS 1024 // ... or when it logs this many buffers
+
+// Journal statistics (reported in /proc/vmstat)
+struct ext3_journal_stats {
+  uint64_t commits;     // Transactions written to the log
+  uint64_t handles;     // Handles those transactions collected
+  uint64_t logged;      // Metadata blocks written to the log
+  uint64_t checkpoints; // Times a writer had to wait for log space
+};
+
+// Checks the Ext2 mount context for Ext3 journal capability, replays the
+// journal if needed and attaches it to mnt (mnt->journal stays NULL
+// otherwise). Returns 1 if the journal was replayed: the superblock and
+// group descriptors read before must be read again.
+int ext3_init_journal(ext2_mount_t *mnt);
+
+// Open a handle: buffers dirtied through ext3_journal_dirty() until the
+// matching ext3_journal_stop() commit atomically. Handles nest within a
+// thread. Returns 0 if a handle was opened (always, without a journal),
+// -1 if not; the caller then must not call ext3_journal_stop().
 int ext3_journal_start(ext2_mount_t *mnt);
 int ext3_journal_stop(ext2_mount_t *mnt);
-int ext3_journal_block(ext2_mount_t *mnt, uint32_t block_nr, const void *data);
+
+// A cached metadata buffer was modified: log it in the caller's
+// transaction, or leave it dirty in the buffer cache when there is none.
+void ext3_journal_dirty(ext2_mount_t *mnt, struct buffer_head *bh);
+
+// The caller's transaction frees block: logged copies of it must not be
+// replayed over whatever it holds next. Call before bforget().
+void ext3_journal_revoke(ext2_mount_t *mnt, uint32_t block);
+
+// Commit the running transaction and wait until it is on disk. Returns 0
+// on success or when there is no journal.
+int ext3_journal_force_commit(ext2_mount_t *mnt);
+
+// Snapshot the journal statistics, summed over all journals.
+void ext3_journal_get_stats(struct ext3_journal_stats *out);
 
 #endif
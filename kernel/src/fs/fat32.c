@@ -3,20 +3,24 @@
 #include "drivers/storage/block.h"
 #include "lib/string.h"
 #include "mm/heap.h"
+#include "mm/page_cache.h"
 #include "vfs.h"
 #include <stddef.h>
 
 // ── Forward Declarations ─────────────────────────────────────────────────────
 
-static struct dirent *fat32_readdir_impl(vfs_node_t *node, uint32_t index);
+static int fat32_readdir_impl(vfs_node_t *node, uint64_t *pos,
+                              struct dirent *buf, uint32_t count);
 static vfs_node_t *fat32_finddir_impl(vfs_node_t *node, char *name);
-static uint32_t fat32_read_impl(vfs_node_t *node, uint32_t offset,
+static uint32_t fat32_read_impl(vfs_node_t *node, uint64_t offset,
                                 uint32_t size, uint8_t *buffer);
-static uint32_t fat32_write_impl(vfs_node_t *node, uint32_t offset,
+static uint32_t fat32_write_impl(vfs_node_t *node, uint64_t offset,
                                  uint32_t size, uint8_t *buffer);
 static int fat32_unlink_impl(vfs_node_t *parent, char *name);
 static int fat32_rmdir_impl(vfs_node_t *parent, char *name);
-static int fat32_truncate_impl(vfs_node_t *node, uint32_t new_size);
+static int fat32_truncate_impl(vfs_node_t *node, uint64_t new_size);
+static int fat32_readpage_impl(vfs_node_t *node, uint32_t index, uint8_t *page);
+static int fat32_fsync_impl(vfs_node_t *node, bool datasync);
 
 // ── Internal Helpers ─────────────────────────────────────────────────────────
 
@@ -51,6 +55,13 @@ static bool is_lfn_entry(fat32_dir_entry_t *entry) {
 
 // ── FAT Access ───────────────────────────────────────────────────────────────
 
+// FAT sectors are small and hot (every chain walk touches them), so they
+// live in the block buffer cache. Cluster data does not.
+static struct buffer_head *fat32_bread_fat(fat32_mount_t *mnt,
+                                           uint32_t sector) {
+  return bread(mnt->dev, sector, mnt->bytes_per_sector);
+}
+
 // Read a FAT entry to get the next cluster in a chain
 uint32_t fat32_get_next_cluster(fat32_mount_t *mnt, uint32_t cluster) {
   if (!FAT32_IS_VALID(cluster)) {
@@ -63,20 +74,14 @@ uint32_t fat32_get_next_cluster(fat32_mount_t *mnt, uint32_t cluster) {
       mnt->fat_start_sector + (fat_offset / mnt->bytes_per_sector);
   uint32_t offset_in_sector = fat_offset % mnt->bytes_per_sector;
 
-  uint8_t *buffer = kmalloc(mnt->bytes_per_sector);
-  if (!buffer)
+  struct buffer_head *bh = fat32_bread_fat(mnt, fat_sector);
+  if (!bh)
     return 0;
 
-  int err = mnt->dev->read_sectors(mnt->dev, fat_sector, 1, buffer);
-  if (err) {
-    kfree(buffer);
-    return 0;
-  }
-
-  uint32_t next_cluster = *(uint32_t *)(buffer + offset_in_sector);
+  uint32_t next_cluster = *(uint32_t *)(bh->data + offset_in_sector);
   next_cluster &= 0x0FFFFFFF; // FAT32 uses only 28 bits
 
-  kfree(buffer);
+  brelse(bh);
   return next_cluster;
 }
 
@@ -95,81 +100,206 @@ int fat32_read_cluster(fat32_mount_t *mnt, uint32_t cluster, void *buffer) {
   return err;
 }
 
-// ── Write Support (Phase 5) ──────────────────────────────────────────────────
-
-// Write a FAT entry (set next cluster in chain)
-static int fat32_set_fat_entry(fat32_mount_t *mnt, uint32_t cluster,
-                               uint32_t value) {
-  if (!FAT32_IS_VALID(cluster) || cluster >= mnt->total_clusters + 2)
-    return -1;
+// ── Free Cluster Map ─────────────────────────────────────────────────────────
 
-  uint32_t fat_offset = cluster * 4;
-  uint32_t fat_sector =
-      mnt->fat_start_sector + (fat_offset / mnt->bytes_per_sector);
-  uint32_t offset_in_sector = fat_offset % mnt->bytes_per_sector;
+static bool fat32_cluster_used(fat32_mount_t *mnt, uint32_t cluster) {
+  uint32_t bit = cluster - 2;
+  return mnt->used_map[bit / 8] & (1u << (bit % 8));
+}
 
-  uint8_t *buffer = kmalloc(mnt->bytes_per_sector);
-  if (!buffer)
-    return -1;
+static void fat32_mark_cluster(fat32_mount_t *mnt, uint32_t cluster,
+                               bool used) {
+  uint32_t bit = cluster - 2;
+  if (used)
+    mnt->used_map[bit / 8] |= (uint8_t)(1u << (bit % 8));
+  else
+    mnt->used_map[bit / 8] &= (uint8_t) ~(1u << (bit % 8));
+}
 
-  // Read the FAT sector
-  int err = mnt->dev->read_sectors(mnt->dev, fat_sector, 1, buffer);
-  if (err) {
-    kfree(buffer);
+// Build the map of clusters in use from the first FAT, FAT32_SCAN_SECTORS
+// at a time. A sector the buffer cache holds may be newer than the disk
+// and is taken from there.
+static int fat32_load_used_map(fat32_mount_t *mnt) {
+  mnt->used_map = kcalloc((mnt->total_clusters + 7) / 8, 1);
+  mnt->fat_dirty = kcalloc((mnt->fat_size_sectors + 7) / 8, 1);
+  uint32_t bps = mnt->bytes_per_sector;
+  uint8_t *buf = kmalloc(FAT32_SCAN_SECTORS * bps);
+  if (!mnt->used_map || !mnt->fat_dirty || !buf) {
+    kfree(buf);
     return -1;
   }
 
-  // Modify the entry (keep upper 4 bits)
-  uint32_t *entry = (uint32_t *)(buffer + offset_in_sector);
-  *entry = (*entry & 0xF0000000) | (value & 0x0FFFFFFF);
-
-  // Write back to all FAT copies
-  for (uint32_t fat_num = 0; fat_num < mnt->boot.bpb.num_fats; fat_num++) {
-    uint32_t sector = fat_sector + fat_num * mnt->fat_size_sectors;
-    err = mnt->dev->write_sectors(mnt->dev, sector, 1, buffer);
-    if (err) {
-      kfree(buffer);
+  uint32_t per_sector = bps / 4;
+  uint32_t end = mnt->total_clusters + 2;
+  uint32_t sectors = (end + per_sector - 1) / per_sector;
+  if (sectors > mnt->fat_size_sectors)
+    sectors = mnt->fat_size_sectors;
+
+  uint32_t free = 0;
+  for (uint32_t s = 0; s < sectors; s += FAT32_SCAN_SECTORS) {
+    uint32_t n = sectors - s;
+    if (n > FAT32_SCAN_SECTORS)
+      n = FAT32_SCAN_SECTORS;
+    if (mnt->dev->read_sectors(mnt->dev, mnt->fat_start_sector + s, n, buf) !=
+        0) {
+      kfree(buf);
       return -1;
     }
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t *entries = (uint32_t *)(buf + i * bps);
+      struct buffer_head *bh =
+          find_get_block(mnt->dev, mnt->fat_start_sector + s + i, bps);
+      if (bh && bh->uptodate)
+        entries = (uint32_t *)bh->data;
+      for (uint32_t e = 0; e < per_sector; e++) {
+        uint32_t cluster = (s + i) * per_sector + e;
+        if (cluster < 2 || cluster >= end)
+          continue;
+        if (entries[e] & 0x0FFFFFFF)
+          fat32_mark_cluster(mnt, cluster, true);
+        else
+          free++;
+      }
+      brelse(bh);
+    }
   }
+  kfree(buf);
 
-  kfree(buffer);
+  // Clusters past the end of a short FAT have no entry to allocate them by
+  for (uint32_t cluster = sectors * per_sector; cluster < end; cluster++) {
+    if (cluster >= 2)
+      fat32_mark_cluster(mnt, cluster, true);
+  }
+  mnt->free_count = free;
   return 0;
 }
 
-// Find a free cluster in the FAT
-static uint32_t fat32_find_free_cluster(fat32_mount_t *mnt) {
-  // Start from cluster 2 (first data cluster)
-  for (uint32_t cluster = 2; cluster < mnt->total_clusters + 2; cluster++) {
-    uint32_t fat_offset = cluster * 4;
-    uint32_t fat_sector =
-        mnt->fat_start_sector + (fat_offset / mnt->bytes_per_sector);
-    uint32_t offset_in_sector = fat_offset % mnt->bytes_per_sector;
-
-    // Read FAT sector if needed
-    static uint8_t *fat_buf = NULL;
-    static uint32_t last_sector = 0xFFFFFFFF;
-
-    if (!fat_buf) {
-      fat_buf = kmalloc(mnt->bytes_per_sector);
-      if (!fat_buf)
-        return 0;
-    }
+// Seed the allocation hint from FSInfo. Its free count is a hint as well:
+// the map just built is authoritative, and a stale count is corrected at
+// the next sync.
+static void fat32_read_fsinfo(fat32_mount_t *mnt) {
+  mnt->next_free = 2;
+  uint16_t sector = mnt->boot.ebpb.fs_info_sector;
+  if (sector == 0 || sector == 0xFFFF)
+    return;
+  struct buffer_head *bh = bread(mnt->dev, sector, mnt->bytes_per_sector);
+  if (!bh)
+    return;
+  fat32_fsinfo_t *fsi = (fat32_fsinfo_t *)bh->data;
+  if (fsi->lead_signature == FAT32_FSINFO_LEAD_SIG &&
+      fsi->struct_signature == FAT32_FSINFO_STRUCT_SIG) {
+    if (fsi->next_free >= 2 && fsi->next_free < mnt->total_clusters + 2)
+      mnt->next_free = fsi->next_free;
+    if (fsi->free_clusters != mnt->free_count)
+      mnt->fsinfo_dirty = true;
+  }
+  brelse(bh);
+}
 
-    if (fat_sector != last_sector) {
-      if (mnt->dev->read_sectors(mnt->dev, fat_sector, 1, fat_buf) != 0) {
-        continue;
+// Store the free count and next-free hint into FSInfo, if the volume has a
+// valid one.
+static int fat32_write_fsinfo(fat32_mount_t *mnt, uint32_t free_count,
+                              uint32_t next_free) {
+  uint16_t sector = mnt->boot.ebpb.fs_info_sector;
+  if (sector == 0 || sector == 0xFFFF)
+    return 0;
+  struct buffer_head *bh = bread(mnt->dev, sector, mnt->bytes_per_sector);
+  if (!bh)
+    return -1;
+  fat32_fsinfo_t *fsi = (fat32_fsinfo_t *)bh->data;
+  if (fsi->lead_signature == FAT32_FSINFO_LEAD_SIG &&
+      fsi->struct_signature == FAT32_FSINFO_STRUCT_SIG) {
+    fsi->free_clusters = free_count;
+    fsi->next_free = next_free;
+    mark_buffer_dirty(bh);
+  }
+  brelse(bh);
+  return 0;
+}
+
+// Claim a free cluster, searching the map from the next-free hint so that
+// a growing file gets consecutive clusters. Returns 0 if the volume is
+// full. The caller links the cluster into the FAT.
+static uint32_t fat32_find_free_cluster(fat32_mount_t *mnt) {
+  uint32_t end = mnt->total_clusters + 2;
+  uint32_t found = 0;
+
+  spinlock_acquire(&mnt->lock);
+  if (mnt->free_count > 0) {
+    uint32_t cluster = mnt->next_free;
+    if (cluster < 2 || cluster >= end)
+      cluster = 2;
+    uint32_t left = mnt->total_clusters;
+    while (left > 0) {
+      uint32_t bit = cluster - 2;
+      if (bit % 8 == 0 && left >= 8 && cluster + 8 <= end &&
+          mnt->used_map[bit / 8] == 0xFF) {
+        // Eight clusters in use: skip the byte
+        cluster += 8;
+        left -= 8;
+      } else if (!fat32_cluster_used(mnt, cluster)) {
+        found = cluster;
+        break;
+      } else {
+        cluster++;
+        left--;
       }
-      last_sector = fat_sector;
+      if (cluster >= end)
+        cluster = 2;
     }
+  }
+  if (found) {
+    fat32_mark_cluster(mnt, found, true);
+    mnt->free_count--;
+    mnt->next_free = found + 1;
+    mnt->fsinfo_dirty = true;
+  }
+  spinlock_release(&mnt->lock);
+  return found;
+}
 
-    uint32_t entry = *(uint32_t *)(fat_buf + offset_in_sector);
-    if ((entry & 0x0FFFFFFF) == 0) {
-      return cluster; // Free cluster found
-    }
+// Give a cluster back to the map: it was freed in the FAT, or claimed and
+// then not linked.
+static void fat32_release_cluster(fat32_mount_t *mnt, uint32_t cluster) {
+  spinlock_acquire(&mnt->lock);
+  if (fat32_cluster_used(mnt, cluster)) {
+    fat32_mark_cluster(mnt, cluster, false);
+    mnt->free_count++;
+    mnt->fsinfo_dirty = true;
   }
+  spinlock_release(&mnt->lock);
+}
+
+// ── Write Support (Phase 5) ──────────────────────────────────────────────────
 
-  return 0; // No free clusters
+// Write a FAT entry (set next cluster in chain)
+static int fat32_set_fat_entry(fat32_mount_t *mnt, uint32_t cluster,
+                               uint32_t value) {
+  if (!FAT32_IS_VALID(cluster) || cluster >= mnt->total_clusters + 2)
+    return -1;
+
+  uint32_t fat_offset = cluster * 4;
+  uint32_t fat_sector =
+      mnt->fat_start_sector + (fat_offset / mnt->bytes_per_sector);
+  uint32_t offset_in_sector = fat_offset % mnt->bytes_per_sector;
+
+  // Read the FAT sector
+  struct buffer_head *bh = fat32_bread_fat(mnt, fat_sector);
+  if (!bh)
+    return -1;
+
+  // Modify the entry (keep upper 4 bits)
+  uint32_t *entry = (uint32_t *)(bh->data + offset_in_sector);
+  *entry = (*entry & 0xF0000000) | (value & 0x0FFFFFFF);
+  mark_buffer_dirty(bh);
+  brelse(bh);
+
+  // The other FAT copies catch up at the next sync
+  uint32_t index = fat_sector - mnt->fat_start_sector;
+  spinlock_acquire(&mnt->lock);
+  mnt->fat_dirty[index / 8] |= (uint8_t)(1u << (index % 8));
+  spinlock_release(&mnt->lock);
+  return 0;
 }
 
 // Allocate a new cluster and link it to the chain
@@ -180,6 +310,7 @@ static uint32_t fat32_alloc_cluster(fat32_mount_t *mnt, uint32_t prev_cluster) {
 
   // Mark new cluster as EOF
   if (fat32_set_fat_entry(mnt, new_cluster, FAT32_EOF_MARKER) != 0) {
+    fat32_release_cluster(mnt, new_cluster);
     return 0;
   }
 
@@ -187,7 +318,8 @@ static uint32_t fat32_alloc_cluster(fat32_mount_t *mnt, uint32_t prev_cluster) {
   if (prev_cluster != 0) {
     if (fat32_set_fat_entry(mnt, prev_cluster, new_cluster) != 0) {
       // Try to free the allocated cluster
-      fat32_set_fat_entry(mnt, new_cluster, 0);
+      if (fat32_set_fat_entry(mnt, new_cluster, 0) == 0)
+        fat32_release_cluster(mnt, new_cluster);
       return 0;
     }
   }
@@ -207,6 +339,151 @@ int fat32_write_cluster(fat32_mount_t *mnt, uint32_t cluster, void *buffer) {
                                  mnt->sectors_per_cluster, buffer);
 }
 
+// ── Cluster Chain Cache ──────────────────────────────────────────────────────
+
+// Slot of the chain starting at first. With create, a missing chain takes
+// over the least recently used slot. Called with mnt->lock held.
+static fat32_chain_t *fat32_chain_slot(fat32_mount_t *mnt, uint32_t first,
+                                       bool create) {
+  fat32_chain_t *victim = NULL;
+  uint32_t victim_age = 0xFFFFFFFF;
+  for (uint32_t i = 0; i < FAT32_CHAIN_SLOTS; i++) {
+    fat32_chain_t *c = &mnt->chains[i];
+    if (c->first == first) {
+      c->last_used = ++mnt->chain_clock;
+      return c;
+    }
+    uint32_t age = c->first ? c->last_used : 0;
+    if (age < victim_age) {
+      victim = c;
+      victim_age = age;
+    }
+  }
+  if (!create)
+    return NULL;
+  victim->first = first;
+  victim->length = 0;
+  victim->nr_extents = 0;
+  victim->seq++;
+  victim->last_used = ++mnt->chain_clock;
+  return victim;
+}
+
+// Map cluster c->length of the chain to physical. Past FAT32_EXTENT_MAX
+// runs the map stops growing and later clusters are walked to from its
+// end. Called with mnt->lock held.
+static void fat32_chain_add(fat32_chain_t *c, uint32_t physical) {
+  if (c->nr_extents > 0) {
+    fat32_extent_t *last = &c->extents[c->nr_extents - 1];
+    if (last->physical + last->len == physical) {
+      last->len++;
+      c->length++;
+      return;
+    }
+  }
+  if (c->nr_extents == FAT32_EXTENT_MAX)
+    return;
+  if (c->nr_extents == c->extents_cap) {
+    uint32_t cap = c->extents_cap ? c->extents_cap * 2 : 8;
+    fat32_extent_t *grown =
+        krealloc(c->extents, cap * sizeof(fat32_extent_t));
+    if (!grown)
+      return;
+    c->extents = grown;
+    c->extents_cap = cap;
+  }
+  fat32_extent_t *e = &c->extents[c->nr_extents++];
+  e->logical = c->length;
+  e->physical = physical;
+  e->len = 1;
+  c->length++;
+}
+
+// Drop the runs of the chain starting at first: it was freed or cut short.
+static void fat32_chain_forget(fat32_mount_t *mnt, uint32_t first) {
+  spinlock_acquire(&mnt->lock);
+  fat32_chain_t *c = fat32_chain_slot(mnt, first, false);
+  if (c) {
+    c->first = 0;
+    c->length = 0;
+    c->nr_extents = 0;
+    c->seq++;
+  }
+  spinlock_release(&mnt->lock);
+}
+
+// Disk cluster holding cluster index of the chain starting at first, or 0
+// if the chain is shorter; then *len (if not NULL) is set to its length.
+// The FAT is only walked from the end of the cached runs.
+static uint32_t fat32_bmap(fat32_mount_t *mnt, uint32_t first, uint32_t index,
+                           uint32_t *len) {
+  if (len)
+    *len = 0;
+  if (!FAT32_IS_VALID(first))
+    return 0;
+
+  spinlock_acquire(&mnt->lock);
+  fat32_chain_t *c = fat32_chain_slot(mnt, first, true);
+  if (index < c->length) {
+    uint32_t lo = 0, hi = c->nr_extents - 1;
+    while (lo < hi) {
+      uint32_t mid = (lo + hi + 1) / 2;
+      if (c->extents[mid].logical <= index)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    fat32_extent_t *e = &c->extents[lo];
+    uint32_t physical = e->physical + (index - e->logical);
+    spinlock_release(&mnt->lock);
+    return physical;
+  }
+  if (c->length == 0)
+    fat32_chain_add(c, first);
+  uint32_t seq = c->seq;
+  uint32_t pos = 0, cluster = first;
+  if (c->length > 0) {
+    fat32_extent_t *e = &c->extents[c->nr_extents - 1];
+    pos = c->length - 1;
+    cluster = e->physical + e->len - 1;
+  }
+  spinlock_release(&mnt->lock);
+
+  uint32_t end = mnt->total_clusters + 2;
+  while (pos < index) {
+    uint32_t next = fat32_get_next_cluster(mnt, cluster);
+    if (!FAT32_IS_VALID(next) || next >= end) {
+      if (len)
+        *len = pos + 1;
+      return 0;
+    }
+    cluster = next;
+    pos++;
+
+    spinlock_acquire(&mnt->lock);
+    if (c->first == first && c->seq == seq && c->length == pos)
+      fat32_chain_add(c, cluster);
+    spinlock_release(&mnt->lock);
+  }
+  return cluster;
+}
+
+// Like fat32_bmap(), but a chain shorter than index + 1 clusters is grown
+// to that length. Returns 0 if the volume is full.
+static uint32_t fat32_bmap_alloc(fat32_mount_t *mnt, uint32_t first,
+                                 uint32_t index) {
+  uint32_t len;
+  uint32_t cluster = fat32_bmap(mnt, first, index, &len);
+  if (cluster || len == 0)
+    return cluster;
+  cluster = fat32_bmap(mnt, first, len - 1, NULL);
+  while (cluster && len <= index) {
+    cluster = fat32_alloc_cluster(mnt, cluster);
+    len++;
+  }
+  return cluster;
+}
+
 // ── Deletion Support (Phase 6) ───────────────────────────────────────────────
 
 // Free all clusters in a chain starting from the given cluster
@@ -215,6 +492,8 @@ static int fat32_free_cluster_chain(fat32_mount_t *mnt,
   if (!FAT32_IS_VALID(start_cluster))
     return -1;
 
+  fat32_chain_forget(mnt, start_cluster);
+
   uint32_t cluster = start_cluster;
   while (FAT32_IS_VALID(cluster)) {
     uint32_t next = fat32_get_next_cluster(mnt, cluster);
@@ -223,6 +502,7 @@ static int fat32_free_cluster_chain(fat32_mount_t *mnt,
     if (fat32_set_fat_entry(mnt, cluster, 0) != 0) {
       return -1; // Failed to free
     }
+    fat32_release_cluster(mnt, cluster);
 
     cluster = next;
   }
@@ -338,9 +618,9 @@ static int fat32_rmdir_impl(vfs_node_t *parent, char *name) {
 
   // Check if directory is empty (only . and ..)
   uint32_t count = 0;
-  struct dirent *dent;
-  while ((dent = fat32_readdir_impl(dir_node, count)) != NULL) {
-    kfree(dent);
+  struct dirent dent;
+  uint64_t pos = 0;
+  while (fat32_readdir_impl(dir_node, &pos, &dent, 1) == 1) {
     count++;
   }
 
@@ -410,7 +690,7 @@ static int fat32_rmdir_impl(vfs_node_t *parent, char *name) {
 }
 
 // Truncate a file to a smaller size
-static int fat32_truncate_impl(vfs_node_t *node, uint32_t new_size) {
+static int fat32_truncate_impl(vfs_node_t *node, uint64_t new_size) {
   fat32_mount_t *mnt = (fat32_mount_t *)node->device;
   if (!mnt)
     return -1;
@@ -427,20 +707,19 @@ static int fat32_truncate_impl(vfs_node_t *node, uint32_t new_size) {
       node->impl = 0;
     }
     node->length = 0;
+    // The page cache keys this file by its first cluster, which was just
+    // released and may go to another file: stop caching through this node.
+    if (node->readpage) {
+      page_cache_invalidate(mnt, node->inode);
+      node->readpage = NULL;
+    }
     return 0;
   }
 
   // Find the cluster containing the new end
   uint32_t cluster_size = mnt->bytes_per_cluster;
-  uint32_t cluster = node->impl;
-  uint32_t current_offset = 0;
-  uint32_t prev_cluster = 0;
-
-  while (FAT32_IS_VALID(cluster) && current_offset + cluster_size <= new_size) {
-    prev_cluster = cluster;
-    cluster = fat32_get_next_cluster(mnt, cluster);
-    current_offset += cluster_size;
-  }
+  uint32_t keep = (new_size + cluster_size - 1) / cluster_size;
+  uint32_t cluster = fat32_bmap(mnt, node->impl, keep - 1, NULL);
 
   // Free all clusters after this one
   if (FAT32_IS_VALID(cluster)) {
@@ -452,17 +731,20 @@ static int fat32_truncate_impl(vfs_node_t *node, uint32_t new_size) {
     // Mark current cluster as EOF
     fat32_set_fat_entry(mnt, cluster, FAT32_EOF_MARKER);
   }
+  fat32_chain_forget(mnt, node->impl);
 
   node->length = new_size;
   return 0;
 }
 
 // Write to a file
-static uint32_t fat32_write_impl(vfs_node_t *node, uint32_t offset,
+static uint32_t fat32_write_impl(vfs_node_t *node, uint64_t offset,
                                  uint32_t size, uint8_t *buffer) {
   fat32_mount_t *mnt = (fat32_mount_t *)node->device;
-  if (!mnt)
+  if (!mnt || offset >= FAT32_MAX_FILE_SIZE)
     return 0;
+  if (size > FAT32_MAX_FILE_SIZE - offset)
+    size = (uint32_t)(FAT32_MAX_FILE_SIZE - offset);
 
   uint32_t cluster_size = mnt->bytes_per_cluster;
   uint32_t cluster = node->impl;
@@ -481,41 +763,31 @@ static uint32_t fat32_write_impl(vfs_node_t *node, uint32_t offset,
     return 0;
 
   uint32_t bytes_written = 0;
-  uint32_t current_offset = 0;
-  uint32_t prev_cluster = 0;
-
-  // Walk to the correct cluster, allocating as needed
-  while (current_offset + cluster_size <= offset) {
-    prev_cluster = cluster;
-    uint32_t next = fat32_get_next_cluster(mnt, cluster);
-
-    if (!FAT32_IS_VALID(next)) {
-      // Need to allocate new cluster
-      next = fat32_alloc_cluster(mnt, cluster);
-      if (next == 0) {
-        kfree(cluster_buf);
-        return bytes_written;
-      }
-    }
-
-    cluster = next;
-    current_offset += cluster_size;
-  }
+  // Clusters from here on hold nothing of the file yet
+  uint32_t old_clusters = (node->length + cluster_size - 1) / cluster_size;
 
-  // Now write the data
   while (bytes_written < size) {
-    // Read existing cluster content (to preserve data before/after write)
-    if (fat32_read_cluster(mnt, cluster, cluster_buf) != 0) {
-      // For new clusters, zero the buffer
-      memset(cluster_buf, 0, cluster_size);
-    }
+    // Find the cluster, growing the chain up to it as needed
+    uint32_t pos = offset + bytes_written;
+    uint32_t index = pos / cluster_size;
+    cluster = fat32_bmap_alloc(mnt, node->impl, index);
+    if (cluster == 0)
+      break;
 
-    uint32_t cluster_offset = (offset + bytes_written) - current_offset;
+    uint32_t cluster_offset = pos % cluster_size;
     uint32_t to_copy = cluster_size - cluster_offset;
     if (to_copy > size - bytes_written) {
       to_copy = size - bytes_written;
     }
 
+    // Preserve the data before/after the write; a whole cluster or one past
+    // the old end of file has nothing to preserve
+    if (to_copy < cluster_size &&
+        (index >= old_clusters ||
+         fat32_read_cluster(mnt, cluster, cluster_buf) != 0)) {
+      memset(cluster_buf, 0, cluster_size);
+    }
+
     memcpy(cluster_buf + cluster_offset, buffer + bytes_written, to_copy);
 
     // Write cluster back
@@ -524,18 +796,6 @@ static uint32_t fat32_write_impl(vfs_node_t *node, uint32_t offset,
     }
 
     bytes_written += to_copy;
-    current_offset += cluster_size;
-
-    // Get next cluster or allocate
-    if (bytes_written < size) {
-      uint32_t next = fat32_get_next_cluster(mnt, cluster);
-      if (!FAT32_IS_VALID(next)) {
-        next = fat32_alloc_cluster(mnt, cluster);
-        if (next == 0)
-          break;
-      }
-      cluster = next;
-    }
   }
 
   kfree(cluster_buf);
@@ -730,7 +990,7 @@ static int fat32_create_impl(vfs_node_t *parent, char *name,
 // ── VFS Operations ───────────────────────────────────────────────────────────
 
 // Read from a file
-static uint32_t fat32_read_impl(vfs_node_t *node, uint32_t offset,
+static uint32_t fat32_read_impl(vfs_node_t *node, uint64_t offset,
                                 uint32_t size, uint8_t *buffer) {
   fat32_mount_t *mnt = (fat32_mount_t *)node->device;
   if (!mnt)
@@ -739,11 +999,10 @@ static uint32_t fat32_read_impl(vfs_node_t *node, uint32_t offset,
   uint32_t file_size = node->length;
   if (offset >= file_size)
     return 0;
-  if (offset + size > file_size) {
-    size = file_size - offset;
+  if (size > file_size - offset) {
+    size = file_size - (uint32_t)offset;
   }
 
-  uint32_t cluster = node->impl; // First cluster stored in impl
   uint32_t cluster_size = mnt->bytes_per_cluster;
 
   // Allocate a cluster buffer
@@ -752,21 +1011,16 @@ static uint32_t fat32_read_impl(vfs_node_t *node, uint32_t offset,
     return 0;
 
   uint32_t bytes_read = 0;
-  uint32_t current_offset = 0;
 
-  // Walk to the correct cluster
-  while (cluster && current_offset + cluster_size <= offset) {
-    cluster = fat32_get_next_cluster(mnt, cluster);
-    current_offset += cluster_size;
-  }
-
-  // Now read the data
-  while (cluster && bytes_read < size) {
-    if (fat32_read_cluster(mnt, cluster, cluster_buf) != 0) {
+  while (bytes_read < size) {
+    // First cluster stored in impl; the chain cache finds the rest
+    uint32_t pos = offset + bytes_read;
+    uint32_t cluster = fat32_bmap(mnt, node->impl, pos / cluster_size, NULL);
+    if (cluster == 0 || fat32_read_cluster(mnt, cluster, cluster_buf) != 0) {
       break;
     }
 
-    uint32_t cluster_offset = (offset + bytes_read) - current_offset;
+    uint32_t cluster_offset = pos % cluster_size;
     uint32_t to_copy = cluster_size - cluster_offset;
     if (to_copy > size - bytes_read) {
       to_copy = size - bytes_read;
@@ -774,17 +1028,105 @@ static uint32_t fat32_read_impl(vfs_node_t *node, uint32_t offset,
 
     memcpy(buffer + bytes_read, cluster_buf + cluster_offset, to_copy);
     bytes_read += to_copy;
-    current_offset += cluster_size;
-
-    cluster = fat32_get_next_cluster(mnt, cluster);
   }
 
   kfree(cluster_buf);
   return bytes_read;
 }
 
+// Page cache fill: one 4 KiB page, zero past EOF.
+static int fat32_readpage_impl(vfs_node_t *node, uint32_t index,
+                               uint8_t *page) {
+  uint32_t got = fat32_read_impl(node, (uint64_t)index * PAGE_CACHE_SIZE,
+                                 PAGE_CACHE_SIZE, page);
+  if (got < PAGE_CACHE_SIZE)
+    memset(page + got, 0, PAGE_CACHE_SIZE - got);
+  return 0;
+}
+
+// ── Sync ─────────────────────────────────────────────────────────────────────
+
+// Copy FAT sector index of the first FAT into the others.
+static int fat32_mirror_fat_sector(fat32_mount_t *mnt, uint32_t index) {
+  struct buffer_head *bh =
+      fat32_bread_fat(mnt, mnt->fat_start_sector + index);
+  if (!bh)
+    return -1;
+  int err = 0;
+  for (uint32_t fat_num = 1; fat_num < mnt->boot.bpb.num_fats; fat_num++) {
+    uint32_t sector =
+        mnt->fat_start_sector + fat_num * mnt->fat_size_sectors + index;
+    struct buffer_head *copy = getblk(mnt->dev, sector, mnt->bytes_per_sector);
+    if (!copy) {
+      err = -1;
+      continue;
+    }
+    memcpy(copy->data, bh->data, mnt->bytes_per_sector);
+    mark_buffer_dirty(copy);
+    brelse(copy);
+  }
+  brelse(bh);
+  return err;
+}
+
+int fat32_sync(fat32_mount_t *mnt, bool wait) {
+  int err = 0;
+  uint32_t bytes = (mnt->fat_size_sectors + 7) / 8;
+  for (uint32_t i = 0; i < bytes; i++) {
+    if (!mnt->fat_dirty[i])
+      continue;
+    spinlock_acquire(&mnt->lock);
+    uint8_t bits = mnt->fat_dirty[i];
+    mnt->fat_dirty[i] = 0;
+    spinlock_release(&mnt->lock);
+
+    for (uint32_t b = 0; b < 8; b++) {
+      if (!(bits & (1u << b)) || fat32_mirror_fat_sector(mnt, i * 8 + b) == 0)
+        continue;
+      // Retried at the next sync
+      spinlock_acquire(&mnt->lock);
+      mnt->fat_dirty[i] |= (uint8_t)(1u << b);
+      spinlock_release(&mnt->lock);
+      err = -1;
+    }
+  }
+
+  spinlock_acquire(&mnt->lock);
+  bool fsinfo = mnt->fsinfo_dirty;
+  uint32_t free_count = mnt->free_count;
+  uint32_t next_free = mnt->next_free;
+  mnt->fsinfo_dirty = false;
+  spinlock_release(&mnt->lock);
+  if (fsinfo && fat32_write_fsinfo(mnt, free_count, next_free) != 0) {
+    spinlock_acquire(&mnt->lock);
+    mnt->fsinfo_dirty = true;
+    spinlock_release(&mnt->lock);
+    err = -1;
+  }
+
+  if (wait && block_sync(mnt->dev) != 0)
+    err = -1;
+  return err;
+}
+
+// Flusher callback (see page_cache_register_fs())
+static int fat32_sync_fs(void *fs, bool wait) {
+  return fat32_sync((fat32_mount_t *)fs, wait);
+}
+
+// The file data is written through; what fsync() adds is the FAT copies,
+// FSInfo and the FAT sectors still in the buffer cache.
+static int fat32_fsync_impl(vfs_node_t *node, bool datasync) {
+  (void)datasync;
+  fat32_mount_t *mnt = (fat32_mount_t *)node->device;
+  if (!mnt)
+    return -1;
+  return fat32_sync(mnt, true);
+}
+
 // Forward declarations
-static struct dirent *fat32_readdir_impl(vfs_node_t *node, uint32_t index);
+static int fat32_readdir_impl(vfs_node_t *node, uint64_t *pos,
+                              struct dirent *buf, uint32_t count);
 static vfs_node_t *fat32_finddir_impl(vfs_node_t *node, char *name);
 
 // Create a VFS node from a directory entry
@@ -822,6 +1164,7 @@ static vfs_node_t *fat32_make_vfs_node(fat32_mount_t *mnt,
   node->length = entry->file_size;
   node->device = mnt;
   node->inode = cluster; // Use cluster as inode number
+  node->fsync = fat32_fsync_impl;
 
   // Parse times
   node->atime = fat_date_to_unix(entry->last_access_date, 0);
@@ -842,6 +1185,9 @@ static vfs_node_t *fat32_make_vfs_node(fat32_mount_t *mnt,
     node->write = fat32_write_impl;
     node->unlink = fat32_unlink_impl;
     node->truncate = fat32_truncate_impl;
+    // Empty files have no first cluster yet and so no stable cache key
+    if (cluster != 0)
+      node->readpage = fat32_readpage_impl;
   }
 
   // Set permissions (FAT doesn't have Unix permissions, use defaults)
@@ -946,6 +1292,25 @@ static void dir_iter_free(dir_iter_t *iter) {
   }
 }
 
+// Initialize a directory iterator at entry slot of the directory: the
+// cluster chain is followed to the slot's cluster without reading the ones
+// before it.
+static int dir_iter_init_at(dir_iter_t *iter, fat32_mount_t *mnt,
+                            uint32_t cluster, uint32_t slot) {
+  uint32_t entries_per_cluster =
+      mnt->bytes_per_cluster / sizeof(fat32_dir_entry_t);
+  for (uint32_t i = 0; i < slot / entries_per_cluster; i++) {
+    cluster = fat32_get_next_cluster(mnt, cluster);
+    if (!FAT32_IS_VALID(cluster))
+      return -1; // Past the end of the directory
+  }
+  if (dir_iter_init(iter, mnt, cluster) != 0)
+    return -1;
+  iter->entry_index = slot;
+  iter->cluster_offset = slot % entries_per_cluster;
+  return 0;
+}
+
 // Get the next directory entry
 static fat32_dir_entry_t *dir_iter_next(dir_iter_t *iter) {
   uint32_t entries_per_cluster =
@@ -986,25 +1351,26 @@ static fat32_dir_entry_t *dir_iter_next(dir_iter_t *iter) {
   }
 }
 
-// Read a directory entry
-static struct dirent *fat32_readdir_impl(vfs_node_t *node, uint32_t index) {
+// Read directory entries. The position cookie is the index of the 32-byte
+// slot following the last entry returned.
+static int fat32_readdir_impl(vfs_node_t *node, uint64_t *pos,
+                              struct dirent *buf, uint32_t count) {
   fat32_mount_t *mnt = (fat32_mount_t *)node->device;
   if (!mnt)
-    return NULL;
+    return -1;
 
   uint32_t cluster = node->impl;
   if (cluster == 0)
     cluster = mnt->root_cluster;
 
   dir_iter_t iter;
-  if (dir_iter_init(&iter, mnt, cluster) != 0) {
-    return NULL;
+  if (dir_iter_init_at(&iter, mnt, cluster, (uint32_t)*pos) != 0) {
+    return 0;
   }
 
-  struct dirent *dirent = NULL;
-  uint32_t current_index = 0;
+  uint32_t n = 0;
 
-  while (true) {
+  while (n < count) {
     fat32_dir_entry_t *entry = dir_iter_next(&iter);
     if (!entry)
       break;
@@ -1030,50 +1396,48 @@ static struct dirent *fat32_readdir_impl(vfs_node_t *node, uint32_t index) {
       continue;
     }
 
-    if (current_index == index) {
-      dirent = kmalloc(sizeof(struct dirent));
-      if (dirent) {
-        // Decode LFN if present
-        char lfn_name[256] = {0};
-        if (iter.lfn_count > 0) {
-          decode_lfn(iter.lfn_entries, iter.lfn_count, lfn_name, entry->name);
-        }
+    struct dirent *dirent = &buf[n++];
 
-        // Set name
-        if (lfn_name[0]) {
-          int _lfn_len = strlen(lfn_name);
-          if (_lfn_len > 127)
-            _lfn_len = 127;
-          memcpy(dirent->name, lfn_name, _lfn_len);
-          dirent->name[_lfn_len] = '\0';
-        } else {
-          // Convert 8.3 name
-          int j = 0;
-          for (int i = 0; i < 8 && entry->name[i] != ' '; i++) {
-            dirent->name[j++] = entry->name[i];
-          }
-          if (entry->name[8] != ' ') {
-            dirent->name[j++] = '.';
-            for (int i = 8; i < 11 && entry->name[i] != ' '; i++) {
-              dirent->name[j++] = entry->name[i];
-            }
-          }
-          dirent->name[j] = '\0';
-        }
+    // Decode LFN if present
+    char lfn_name[256] = {0};
+    if (iter.lfn_count > 0) {
+      decode_lfn(iter.lfn_entries, iter.lfn_count, lfn_name, entry->name);
+    }
 
-        uint32_t entry_cluster =
-            entry->cluster_low | (entry->cluster_high << 16);
-        dirent->ino = entry_cluster ? entry_cluster : mnt->root_cluster;
+    // Set name
+    if (lfn_name[0]) {
+      int _lfn_len = strlen(lfn_name);
+      if (_lfn_len > 127)
+        _lfn_len = 127;
+      memcpy(dirent->name, lfn_name, _lfn_len);
+      dirent->name[_lfn_len] = '\0';
+    } else {
+      // Convert 8.3 name
+      int j = 0;
+      for (int i = 0; i < 8 && entry->name[i] != ' '; i++) {
+        dirent->name[j++] = entry->name[i];
       }
-      break;
+      if (entry->name[8] != ' ') {
+        dirent->name[j++] = '.';
+        for (int i = 8; i < 11 && entry->name[i] != ' '; i++) {
+          dirent->name[j++] = entry->name[i];
+        }
+      }
+      dirent->name[j] = '\0';
     }
 
-    current_index++;
+    uint32_t entry_cluster = entry->cluster_low | (entry->cluster_high << 16);
+    dirent->ino = entry_cluster ? entry_cluster : mnt->root_cluster;
+    dirent->type =
+        (entry->attr & FAT32_ATTR_DIRECTORY) ? FS_DIRECTORY : FS_FILE;
+    dirent->next = iter.entry_index;
+    *pos = dirent->next;
+
     iter.lfn_count = 0;
   }
 
   dir_iter_free(&iter);
-  return dirent;
+  return (int)n;
 }
 
 // Find a file in a directory
@@ -1163,7 +1527,21 @@ static vfs_node_t *fat32_finddir_impl(vfs_node_t *node, char *name) {
 // ── Mount Operations
 // ──────────────────────────────────────────────────────────
 
-int fat32_mount(struct block_device *dev, vfs_node_t *mountpoint) {
+// Free mnt with its caches. Nothing may use it any more.
+static void fat32_free_mount(fat32_mount_t *mnt) {
+  for (uint32_t i = 0; i < FAT32_CHAIN_SLOTS; i++)
+    kfree(mnt->chains[i].extents);
+  kfree(mnt->used_map);
+  kfree(mnt->fat_dirty);
+  if (mnt->root_node)
+    kfree(mnt->root_node);
+  kfree(mnt);
+}
+
+// With flusher, the page cache's flusher for mnt syncs it in the
+// background; such a mount can never be freed again.
+static int fat32_mount_common(struct block_device *dev,
+                              vfs_node_t *mountpoint, bool flusher) {
   if (!dev || !mountpoint)
     return -1;
 
@@ -1220,6 +1598,7 @@ int fat32_mount(struct block_device *dev, vfs_node_t *mountpoint) {
   if (!mnt)
     return -1;
   memset(mnt, 0, sizeof(fat32_mount_t));
+  spinlock_init(&mnt->lock);
 
   mnt->dev = dev;
   memcpy(&mnt->boot, boot, sizeof(fat32_boot_sector_t));
@@ -1248,6 +1627,13 @@ int fat32_mount(struct block_device *dev, vfs_node_t *mountpoint) {
     return -1;
   }
 
+  if (fat32_load_used_map(mnt) != 0) {
+    klog_puts("[FAT32] Failed to read the FAT.\n");
+    fat32_free_mount(mnt);
+    return -1;
+  }
+  fat32_read_fsinfo(mnt);
+
   klog_puts("[FAT32] Superblock validated:\n");
   klog_puts("       Sector size:   ");
   klog_uint64(mnt->bytes_per_sector);
@@ -1258,6 +1644,9 @@ int fat32_mount(struct block_device *dev, vfs_node_t *mountpoint) {
   klog_puts("       Total clusters: ");
   klog_uint64(mnt->total_clusters);
   klog_puts("\n");
+  klog_puts("       Free clusters:  ");
+  klog_uint64(mnt->free_count);
+  klog_puts("\n");
   klog_puts("       Root cluster:   ");
   klog_uint64(mnt->root_cluster);
   klog_puts("\n");
@@ -1271,7 +1660,7 @@ int fat32_mount(struct block_device *dev, vfs_node_t *mountpoint) {
   // Create VFS node for root directory
   vfs_node_t *root_vfs = kmalloc(sizeof(vfs_node_t));
   if (!root_vfs) {
-    kfree(mnt);
+    fat32_free_mount(mnt);
     return -1;
   }
   memset(root_vfs, 0, sizeof(vfs_node_t));
@@ -1285,6 +1674,7 @@ int fat32_mount(struct block_device *dev, vfs_node_t *mountpoint) {
   root_vfs->create = fat32_create_impl;
   root_vfs->unlink = fat32_unlink_impl;
   root_vfs->rmdir = fat32_rmdir_impl;
+  root_vfs->fsync = fat32_fsync_impl;
   root_vfs->mask = 0755;
   root_vfs->inode = mnt->root_cluster;
 
@@ -1299,11 +1689,20 @@ int fat32_mount(struct block_device *dev, vfs_node_t *mountpoint) {
   mountpoint->create = fat32_create_impl;
   mountpoint->unlink = fat32_unlink_impl;
   mountpoint->rmdir = fat32_rmdir_impl;
+  mountpoint->fsync = fat32_fsync_impl;
+
+  // The other FAT copies and FSInfo are brought up to date in the background
+  if (flusher)
+    page_cache_register_fs(mnt, "fat32", fat32_sync_fs);
 
   klog_puts("[OK] FAT32 filesystem mounted.\n");
   return 0;
 }
 
+int fat32_mount(struct block_device *dev, vfs_node_t *mountpoint) {
+  return fat32_mount_common(dev, mountpoint, true);
+}
+
 int fat32_mount_root(struct block_device *dev) {
   if (!dev)
     return -1;
@@ -1359,7 +1758,8 @@ void fat32_self_test(void) {
   memset(mountpoint, 0, sizeof(vfs_node_t));
   memcpy(mountpoint->name, "test", 5);
 
-  int mount_result = fat32_mount(dev, mountpoint);
+  // Without a flusher, so that the mount can be freed at the end
+  int mount_result = fat32_mount_common(dev, mountpoint, false);
   if (mount_result == 0) {
     klog_puts("[FAT32] TEST PASS: Mount succeeded\n");
     passed++;
@@ -1373,12 +1773,12 @@ void fat32_self_test(void) {
   // Test 2: Read root directory
   klog_puts("\n[FAT32] Test 2: Read root directory\n");
   uint32_t entry_count = 0;
-  struct dirent *dent;
-  while ((dent = fat32_readdir_impl(mountpoint, entry_count)) != NULL) {
+  struct dirent dent;
+  uint64_t pos = 0;
+  while (fat32_readdir_impl(mountpoint, &pos, &dent, 1) == 1) {
     klog_puts("  - ");
-    klog_puts(dent->name);
+    klog_puts(dent.name);
     klog_puts("\n");
-    kfree(dent);
     entry_count++;
   }
 
@@ -1458,12 +1858,12 @@ void fat32_self_test(void) {
     klog_puts("\n");
 
     uint32_t sub_count = 0;
-    struct dirent *sub_dent;
-    while ((sub_dent = fat32_readdir_impl(subdir, sub_count)) != NULL) {
+    struct dirent sub_dent;
+    uint64_t sub_pos = 0;
+    while (fat32_readdir_impl(subdir, &sub_pos, &sub_dent, 1) == 1) {
       klog_puts("  - ");
-      klog_puts(sub_dent->name);
+      klog_puts(sub_dent.name);
       klog_puts("\n");
-      kfree(sub_dent);
       sub_count++;
     }
 
@@ -1485,6 +1885,8 @@ void fat32_self_test(void) {
   klog_puts("\n[FAT32] Test 6: Create new file 'testfile.txt'\n");
   // Delete if it exists from previous test run
   fat32_unlink_impl(mountpoint, "testfile.txt");
+  fat32_mount_t *mnt = (fat32_mount_t *)mountpoint->device;
+  uint32_t free_before = mnt->free_count;
   int create_result = fat32_create_impl(mountpoint, "testfile.txt", 0644);
   if (create_result == 0) {
     klog_puts("[FAT32] TEST PASS: File creation succeeded\n");
@@ -1596,13 +1998,25 @@ void fat32_self_test(void) {
     failed++;
   }
 
-  // Cleanup
-  fat32_mount_t *mnt = (fat32_mount_t *)mountpoint->device;
-  if (mnt) {
-    if (mnt->root_node)
-      kfree(mnt->root_node);
-    kfree(mnt);
+  // Test 12: The freed clusters are back in the free map, and the FAT
+  // copies and FSInfo can be written
+  klog_puts("\n[FAT32] Test 12: Free cluster map and sync\n");
+  if (mnt->free_count == free_before && fat32_sync(mnt, true) == 0) {
+    klog_puts("[FAT32] TEST PASS: ");
+    klog_uint64(mnt->free_count);
+    klog_puts(" clusters free, FAT copies synced\n");
+    passed++;
+  } else {
+    klog_puts("[FAT32] TEST FAIL: Free count ");
+    klog_uint64(mnt->free_count);
+    klog_puts(", expected ");
+    klog_uint64(free_before);
+    klog_puts("\n");
+    failed++;
   }
+
+  // Cleanup
+  fat32_free_mount(mnt);
   kfree(mountpoint);
 
 summary:
@@ -123,6 +123,48 @@ typedef struct __attribute__((packed)) {
 #define FAT32_IS_EOF(c) ((c) >= FAT32_EOF_CLUSTER_MIN)
 #define FAT32_IS_VALID(c) ((c) >= 2 && (c) < FAT32_EOF_CLUSTER_MIN)
 
+// Directory entries record file sizes in 32 bits
+#define FAT32_MAX_FILE_SIZE 0xFFFFFFFFULL
+
+#define FAT32_FSINFO_LEAD_SIG 0x41615252
+#define FAT32_FSINFO_STRUCT_SIG 0x61417272
+#define FAT32_FSINFO_TRAIL_SIG 0xAA550000
+#define FAT32_FSINFO_UNKNOWN 0xFFFFFFFF // free_clusters/next_free not set
+
+// ── FAT Cache ────────────────────────────────────────────────────────────────
+
+// FAT sectors live in the block buffer cache. Next to them each mount keeps
+// a bitmap of the clusters in use, built from the FAT at mount time, so
+// that allocation never reads the FAT, and the cluster chains of recently
+// used files as runs, so that a seek does not walk the chain link by link.
+//
+// Allocation and freeing only change the first FAT. The sectors they dirty
+// are copied into the other FATs, and the free count and next-free hint
+// into FSInfo, when the filesystem is synced: by its flusher every few
+// seconds, by fsync() and by sync().
+
+// A run of clusters that are contiguous both in the file and on disk
+typedef struct {
+  uint32_t logical;
+  uint32_t physical;
+  uint32_t len;
+} fat32_extent_t;
+
+#define FAT32_CHAIN_SLOTS 16   // Files whose cluster chains are cached
+#define FAT32_EXTENT_MAX 512   // Runs cached per chain
+#define FAT32_SCAN_SECTORS 64  // FAT sectors read per request at mount
+
+// The runs cover the first length clusters of the chain starting at first.
+typedef struct {
+  uint32_t first;  // 0: slot unused
+  uint32_t length; // Clusters mapped by the runs
+  uint32_t seq;    // Bumped whenever the slot is dropped or reused
+  uint32_t last_used;
+  fat32_extent_t *extents; // Sorted by logical cluster
+  uint32_t nr_extents;
+  uint32_t extents_cap;
+} fat32_chain_t;
+
 // ── FAT32 Mount Context
 // ───────────────────────────────────────────────────────
 
@@ -139,6 +181,15 @@ typedef struct {
   uint32_t total_clusters;      // Total data clusters
   uint32_t cluster_count;       // Number of clusters
   vfs_node_t *root_node;        // VFS node for root directory
+
+  spinlock_t lock;              // Everything below
+  uint8_t *used_map;            // One bit per cluster from 2, set: in use
+  uint32_t free_count;          // Free clusters
+  uint32_t next_free;           // Where the next allocation search starts
+  bool fsinfo_dirty;            // free_count/next_free not yet in FSInfo
+  uint8_t *fat_dirty;           // One bit per FAT sector: mirrors are stale
+  fat32_chain_t chains[FAT32_CHAIN_SLOTS];
+  uint32_t chain_clock;         // LRU stamp for chains
 } fat32_mount_t;
 
 // ── Public API ───────────────────────────────────────────────────────────────
@@ -159,6 +210,11 @@ int fat32_read_cluster(fat32_mount_t *mnt, uint32_t cluster, void *buffer);
 // Returns the next cluster number, or 0 on error/EOF.
 uint32_t fat32_get_next_cluster(fat32_mount_t *mnt, uint32_t cluster);
 
+// Copy the FAT sectors changed since the last call into the other FATs and
+// bring FSInfo up to date; with wait, also write the buffer cache out to
+// the disk. Returns 0 on success.
+int fat32_sync(fat32_mount_t *mnt, bool wait);
+
 // Self-test function for FAT32 driver (phases 1-4)
 void fat32_self_test(void);
 
@@ -1,11 +1,16 @@
 #include "fs/procfs.h"
 #include "apic/lapic_timer.h"
 #include "drivers/storage/block.h"
+#include "fs/dcache.h"
+#include "fs/ext3.h"
 #include "fs/ramfs.h"
 #include "fs/vfs.h"
 #include "lib/string.h"
 #include "mm/heap.h"
+#include "mm/page_cache.h"
 #include "mm/pmm.h"
+#include "mm/reaper.h"
+#include "mm/tlb.h"
 #include "sched/sched.h"
 #include "smp/cpu.h"
 
@@ -29,7 +34,7 @@ static void u64_to_str(uint64_t val, char *buf) {
   buf[j] = '\0';
 }
 
-uint32_t procfs_meminfo_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t procfs_meminfo_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                              uint8_t *buffer) {
   char buf[512];
   buf[0] = '\0';
@@ -53,14 +58,48 @@ uint32_t procfs_meminfo_read(vfs_node_t *node, uint32_t offset, uint32_t size,
   strcat(buf, num_buf);
   strcat(buf, " kB\n");
 
-  // MemAvailable
+  struct page_cache_stats pcs;
+  page_cache_get_stats(&pcs);
+  uint64_t cached_val = pcs.pages * PAGE_CACHE_SIZE;
+  uint64_t dirty_val = pcs.dirty * PAGE_CACHE_SIZE;
+
+  // MemAvailable (clean page cache pages can be dropped at any time)
   strcat(buf, "MemAvailable:   ");
-  u64_to_str(free_mem_val / 1024, num_buf);
+  u64_to_str((free_mem_val + cached_val - dirty_val) / 1024, num_buf);
+  strcat(buf, num_buf);
+  strcat(buf, " kB\n");
+
+  struct block_cache_stats bcs;
+  block_cache_get_stats(&bcs);
+
+  // Buffers (cached filesystem metadata blocks)
+  strcat(buf, "Buffers:        ");
+  u64_to_str(bcs.bytes / 1024, num_buf);
+  strcat(buf, num_buf);
+  strcat(buf, " kB\n");
+
+  // Cached
+  strcat(buf, "Cached:         ");
+  u64_to_str(cached_val / 1024, num_buf);
+  strcat(buf, num_buf);
+  strcat(buf, " kB\n");
+
+  // Dirty (cached file data not yet written back)
+  strcat(buf, "Dirty:          ");
+  u64_to_str(dirty_val / 1024, num_buf);
   strcat(buf, num_buf);
   strcat(buf, " kB\n");
 
-  strcat(buf, "Buffers:        0 kB\n");
-  strcat(buf, "Cached:         0 kB\n");
+  // Page cache lookups
+  strcat(buf, "CacheHits:      ");
+  u64_to_str(pcs.hits, num_buf);
+  strcat(buf, num_buf);
+  strcat(buf, "\n");
+
+  strcat(buf, "CacheMisses:    ");
+  u64_to_str(pcs.misses, num_buf);
+  strcat(buf, num_buf);
+  strcat(buf, "\n");
 
   // MemUsable
   strcat(buf, "MemUsable:      ");
@@ -80,7 +119,7 @@ uint32_t procfs_meminfo_read(vfs_node_t *node, uint32_t offset, uint32_t size,
   return size;
 }
 
-uint32_t procfs_cpuinfo_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t procfs_cpuinfo_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                              uint8_t *buffer) {
   // 16KB is plenty for 64 cores
   char *buf = kmalloc(16384);
@@ -187,7 +226,7 @@ uint32_t procfs_cpuinfo_read(vfs_node_t *node, uint32_t offset, uint32_t size,
   return size;
 }
 
-uint32_t procfs_partitions_read(vfs_node_t *node, uint32_t offset,
+uint32_t procfs_partitions_read(vfs_node_t *node, uint64_t offset,
                                 uint32_t size, uint8_t *buffer) {
   char *buf = kmalloc(4096);
   if (!buf)
@@ -241,7 +280,60 @@ uint32_t procfs_partitions_read(vfs_node_t *node, uint32_t offset,
   return size;
 }
 
-uint32_t procfs_mounts_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+// One line per disk with a request queue, in the /proc/diskstats layout:
+// reads, merged reads, sectors read, ms reading, the same for writes, I/Os
+// in flight, ms busy, weighted ms. Per-direction and weighted times are not
+// tracked and read as 0.
+uint32_t procfs_diskstats_read(vfs_node_t *node, uint64_t offset,
+                               uint32_t size, uint8_t *buffer) {
+  char *buf = kmalloc(4096);
+  if (!buf)
+    return 0;
+  buf[0] = '\0';
+
+  int count = block_count();
+  char num_buf[32];
+
+  for (int i = 0; i < count; i++) {
+    struct block_device *dev = block_get(i);
+    struct blk_stats st;
+    if (!dev || !blk_get_stats(dev, &st))
+      continue;
+
+    strcat(buf, "   1 ");
+    u64_to_str(i, num_buf);
+    strcat(buf, num_buf);
+    strcat(buf, " ");
+    strcat(buf, dev->name);
+
+    uint64_t fields[11] = {st.reads,         st.read_merges, st.read_sectors,
+                           0,                st.writes,      st.write_merges,
+                           st.write_sectors, 0,              st.in_flight,
+                           st.busy_ms,       0};
+    for (int f = 0; f < 11; f++) {
+      strcat(buf, " ");
+      u64_to_str(fields[f], num_buf);
+      strcat(buf, num_buf);
+    }
+    strcat(buf, "\n");
+  }
+
+  uint32_t len = strlen(buf);
+  node->length = len;
+
+  if (offset >= len) {
+    kfree(buf);
+    return 0;
+  }
+  if (offset + size > len) {
+    size = len - offset;
+  }
+  memcpy(buffer, buf + offset, size);
+  kfree(buf);
+  return size;
+}
+
+uint32_t procfs_mounts_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                             uint8_t *buffer) {
   char *buf = kmalloc(512);
   if (!buf)
@@ -266,7 +358,7 @@ uint32_t procfs_mounts_read(vfs_node_t *node, uint32_t offset, uint32_t size,
   return size;
 }
 
-uint32_t procfs_uptime_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t procfs_uptime_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                             uint8_t *buffer) {
   char buf[64];
   uint64_t ms = lapic_timer_get_ms();
@@ -292,7 +384,7 @@ uint32_t procfs_uptime_read(vfs_node_t *node, uint32_t offset, uint32_t size,
   return size;
 }
 
-uint32_t procfs_stat_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t procfs_stat_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                           uint8_t *buffer) {
   char *buf = kmalloc(1024);
   if (!buf)
@@ -316,7 +408,100 @@ uint32_t procfs_stat_read(vfs_node_t *node, uint32_t offset, uint32_t size,
   return size;
 }
 
-uint32_t procfs_heapinfo_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+static void vmstat_line(char *buf, const char *key, uint64_t val) {
+  char num_buf[32];
+  strcat(buf, key);
+  strcat(buf, " ");
+  u64_to_str(val, num_buf);
+  strcat(buf, num_buf);
+  strcat(buf, "\n");
+}
+
+uint32_t procfs_vmstat_read(vfs_node_t *node, uint64_t offset, uint32_t size,
+                            uint8_t *buffer) {
+  char *buf = kmalloc(2048);
+  if (!buf)
+    return 0;
+  buf[0] = '\0';
+
+  struct mm_exit_stats es;
+  mm_reaper_get_stats(&es);
+  vmstat_line(buf, "mm_exit", es.exits);
+  vmstat_line(buf, "mm_teardown_deferred", es.deferred);
+  vmstat_line(buf, "mm_teardown_inline", es.inline_teardowns);
+  vmstat_line(buf, "mm_teardown_pages", es.pages_freed);
+  vmstat_line(buf, "mm_teardown_us", es.teardown_us);
+  vmstat_line(buf, "mm_teardown_max_us", es.teardown_max_us);
+  vmstat_line(buf, "mm_teardown_queue_us", es.queue_us);
+
+  struct tlb_stats ts;
+  tlb_get_stats(&ts);
+  vmstat_line(buf, "tlb_shootdown", ts.shootdowns);
+  vmstat_line(buf, "tlb_shootdown_ipis", ts.ipis);
+  vmstat_line(buf, "tlb_shootdown_full", ts.full_flushes);
+  vmstat_line(buf, "tlb_shootdown_pages", ts.pages);
+  vmstat_line(buf, "tlb_shootdown_skipped_cpus", ts.skipped);
+  vmstat_line(buf, "tlb_local_only", ts.local_only);
+  vmstat_line(buf, "tlb_shootdown_ns", ts.ns_total);
+  vmstat_line(buf, "tlb_shootdown_max_ns", ts.ns_max);
+
+  struct page_cache_stats pcs;
+  page_cache_get_stats(&pcs);
+  vmstat_line(buf, "nr_file_pages", pcs.pages);
+  vmstat_line(buf, "pgcache_hit", pcs.hits);
+  vmstat_line(buf, "pgcache_miss", pcs.misses);
+  vmstat_line(buf, "pgcache_evict", pcs.evictions);
+  vmstat_line(buf, "pgcache_readahead", pcs.readahead);
+  vmstat_line(buf, "nr_dirty", pcs.dirty);
+  vmstat_line(buf, "pgcache_writeback", pcs.writeback);
+  vmstat_line(buf, "pgcache_throttled", pcs.throttled);
+
+  struct dcache_stats ds;
+  dcache_get_stats(&ds);
+  vmstat_line(buf, "nr_dentry", ds.entries);
+  vmstat_line(buf, "dcache_hit", ds.hits);
+  vmstat_line(buf, "dcache_negative_hit", ds.negative_hits);
+  vmstat_line(buf, "dcache_miss", ds.misses);
+  vmstat_line(buf, "dcache_evict", ds.evictions);
+
+  struct block_cache_stats bcs;
+  block_cache_get_stats(&bcs);
+  vmstat_line(buf, "nr_buffers", bcs.buffers);
+  vmstat_line(buf, "nr_dirty_buffers", bcs.dirty);
+  vmstat_line(buf, "bcache_hit", bcs.hits);
+  vmstat_line(buf, "bcache_miss", bcs.misses);
+  vmstat_line(buf, "bcache_writeback", bcs.writebacks);
+  vmstat_line(buf, "bcache_evict", bcs.evictions);
+
+  struct ext3_journal_stats js;
+  ext3_journal_get_stats(&js);
+  vmstat_line(buf, "jbd_commits", js.commits);
+  vmstat_line(buf, "jbd_handles", js.handles);
+  vmstat_line(buf, "jbd_logged_blocks", js.logged);
+  vmstat_line(buf, "jbd_checkpoints", js.checkpoints);
+
+  struct ramfs_stats rs;
+  ramfs_get_stats(&rs);
+  vmstat_line(buf, "nr_shmem", rs.pages);
+  vmstat_line(buf, "shmem_mapped", rs.mapped);
+  vmstat_line(buf, "shmem_limit_hits", rs.limit_hits);
+
+  uint32_t len = strlen(buf);
+  node->length = len;
+
+  if (offset >= len) {
+    kfree(buf);
+    return 0;
+  }
+  if (offset + size > len) {
+    size = len - offset;
+  }
+  memcpy(buffer, buf + offset, size);
+  kfree(buf);
+  return size;
+}
+
+uint32_t procfs_heapinfo_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                               uint8_t *buffer) {
   // 4KB should be plenty for heap info
   char *buf = kmalloc(4096);
@@ -340,7 +525,7 @@ uint32_t procfs_heapinfo_read(vfs_node_t *node, uint32_t offset, uint32_t size,
   return size;
 }
 
-uint32_t procfs_cmdline_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t procfs_cmdline_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                              uint8_t *buffer) {
   (void)node;
   const char *cmd = "Xfbdev\n";
@@ -363,7 +548,7 @@ void procfs_init(void) {
   // root->mkdir)
   vfs_node_t *proc_dir = vfs_finddir(fs_root, "proc");
   if (!proc_dir && fs_root->mkdir) {
-    fs_root->mkdir(fs_root, "proc", 0755);
+    vfs_mkdir(fs_root, "proc", 0755);
     proc_dir = vfs_finddir(fs_root, "proc");
   }
 
@@ -416,6 +601,17 @@ void procfs_init(void) {
       ramfs_mount_node(procfs_root, part_node);
     }
 
+    // Add /proc/diskstats
+    vfs_node_t *diskstats_node = kmalloc(sizeof(vfs_node_t));
+    if (diskstats_node) {
+      vfs_node_init(diskstats_node);
+      strncpy(diskstats_node->name, "diskstats", 127);
+      diskstats_node->flags = FS_FILE | FS_PERSISTENT;
+      diskstats_node->mask = 0444;
+      diskstats_node->read = procfs_diskstats_read;
+      ramfs_mount_node(procfs_root, diskstats_node);
+    }
+
     // Add /proc/mounts
     vfs_node_t *mounts_node = kmalloc(sizeof(vfs_node_t));
     if (mounts_node) {
@@ -449,6 +645,17 @@ void procfs_init(void) {
       ramfs_mount_node(procfs_root, static_node);
     }
 
+    // Add /proc/vmstat
+    vfs_node_t *vmstat_node = kmalloc(sizeof(vfs_node_t));
+    if (vmstat_node) {
+      vfs_node_init(vmstat_node);
+      strncpy(vmstat_node->name, "vmstat", 127);
+      vmstat_node->flags = FS_FILE | FS_PERSISTENT;
+      vmstat_node->mask = 0444;
+      vmstat_node->read = procfs_vmstat_read;
+      ramfs_mount_node(procfs_root, vmstat_node);
+    }
+
     // Add /proc/heapinfo
     vfs_node_t *heapinfo_node = kmalloc(sizeof(vfs_node_t));
     if (heapinfo_node) {
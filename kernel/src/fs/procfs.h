@@ -6,17 +6,21 @@
 struct vfs_node;
 
 void procfs_init(void);
-uint32_t procfs_meminfo_read(struct vfs_node *node, uint32_t offset,
+uint32_t procfs_meminfo_read(struct vfs_node *node, uint64_t offset,
                              uint32_t size, uint8_t *buffer);
-uint32_t procfs_cpuinfo_read(struct vfs_node *node, uint32_t offset,
+uint32_t procfs_cpuinfo_read(struct vfs_node *node, uint64_t offset,
                              uint32_t size, uint8_t *buffer);
-uint32_t procfs_partitions_read(struct vfs_node *node, uint32_t offset,
+uint32_t procfs_partitions_read(struct vfs_node *node, uint64_t offset,
                                 uint32_t size, uint8_t *buffer);
-uint32_t procfs_mounts_read(struct vfs_node *node, uint32_t offset,
+uint32_t procfs_diskstats_read(struct vfs_node *node, uint64_t offset,
+                               uint32_t size, uint8_t *buffer);
+uint32_t procfs_mounts_read(struct vfs_node *node, uint64_t offset,
                             uint32_t size, uint8_t *buffer);
-uint32_t procfs_uptime_read(struct vfs_node *node, uint32_t offset,
+uint32_t procfs_uptime_read(struct vfs_node *node, uint64_t offset,
                             uint32_t size, uint8_t *buffer);
-uint32_t procfs_stat_read(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t procfs_stat_read(struct vfs_node *node, uint64_t offset, uint32_t size,
                           uint8_t *buffer);
+uint32_t procfs_vmstat_read(struct vfs_node *node, uint64_t offset,
+                            uint32_t size, uint8_t *buffer);
 
 #endif
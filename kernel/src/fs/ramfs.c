@@ -1,30 +1,277 @@
 #include "ramfs.h"
+#include "../console/klog.h"
 #include "../lib/string.h"
+#include "../lock/spinlock.h"
 #include "../mm/heap.h"
+#include "../mm/pmm.h"
+#include "../mm/tlb.h"
+#include "../mm/vmm.h"
+#include "../syscalls/syscall.h"
 
 // ── Internal Structures ─────────────────────────────────────────────────────
 
+#define RAMFS_PAGE_SIZE 4096
+#define RAMFS_MAP_SHIFT 6
+#define RAMFS_MAP_SLOTS (1U << RAMFS_MAP_SHIFT)
+#define RAMFS_MAP_MASK (RAMFS_MAP_SLOTS - 1)
+#define RAMFS_FREE_BATCH 64
+#define RAMFS_HASH_MIN 16 // Buckets of a directory's first hash table
+
+// Page indices are 32-bit
+#define RAMFS_MAX_FILE_SIZE ((uint64_t)RAMFS_PAGE_SIZE << 32)
+
+// A mounted instance. Its files' pages count against max_pages.
+typedef struct {
+  uint64_t max_pages; // 0 = no limit
+  uint64_t nr_pages;
+  spinlock_t lock;
+} ramfs_sb_t;
+
+// Radix tree node. Interior slots point to nodes, leaf slots hold the
+// physical address of a page; an empty slot is a hole.
+struct ramfs_map_node {
+  void *slots[RAMFS_MAP_SLOTS];
+  uint32_t count; // Non-NULL slots
+};
+
+// For files, device points to this. Each page holds one reference for the
+// file; readers, writers and shared mappings take their own.
+typedef struct {
+  ramfs_sb_t *sb;
+  struct ramfs_map_node *root;
+  uint32_t height; // 0 = no pages
+  uint64_t nr_pages;
+  spinlock_t lock; // Tree and nr_pages
+} ramfs_file_t;
+
 typedef struct child_node {
   vfs_node_t *node;
+  uint32_t seq;  // Order of insertion, the readdir position
+  uint32_t hash; // ramfs_name_hash() of the node's name
   struct child_node *next;
+  struct child_node *prev;
+  struct child_node *hash_next;
 } child_node_t;
 
-// For files, device points to this
-typedef struct {
-  uint8_t *data;
-  uint32_t capacity;
-} ramfs_file_t;
-
-// For directories, device points to this
+// For directories, device points to this. Children are kept in insertion
+// order so that a readdir position stays valid across creates and unlinks,
+// and in a hash table for lookups by name.
 typedef struct {
+  ramfs_sb_t *sb;
   child_node_t *children;
+  child_node_t *tail;
+  child_node_t *resume; // Where the last readdir stopped, NULL if unknown
+  child_node_t **buckets;
+  uint32_t nr_buckets; // Power of two; 0 until the first child
+  uint32_t count;
+  uint32_t next_seq;
 } ramfs_dir_t;
 
 static uint32_t next_inode = 1;
+static ramfs_sb_t ramfs_root_sb = {0, 0, SPINLOCK_INIT}; // Not limited
+static struct ramfs_stats stats;
+
+static inline uint8_t *ramfs_page_data(uint64_t phys) {
+  return (uint8_t *)(phys + pmm_get_hhdm_offset());
+}
+
+// ── Size limit ──────────────────────────────────────────────────────────────
+
+static int ramfs_charge(ramfs_sb_t *sb, uint64_t pages) {
+  spinlock_acquire(&sb->lock);
+  if (sb->max_pages && sb->nr_pages + pages > sb->max_pages) {
+    spinlock_release(&sb->lock);
+    __atomic_fetch_add(&stats.limit_hits, 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+  sb->nr_pages += pages;
+  spinlock_release(&sb->lock);
+  __atomic_fetch_add(&stats.pages, pages, __ATOMIC_RELAXED);
+  return 0;
+}
+
+static void ramfs_uncharge(ramfs_sb_t *sb, uint64_t pages) {
+  if (pages == 0)
+    return;
+  spinlock_acquire(&sb->lock);
+  sb->nr_pages -= pages;
+  spinlock_release(&sb->lock);
+  __atomic_fetch_sub(&stats.pages, pages, __ATOMIC_RELAXED);
+}
+
+// ── Page tree ───────────────────────────────────────────────────────────────
+
+static inline uint64_t ramfs_map_capacity(uint32_t height) {
+  return 1ULL << (RAMFS_MAP_SHIFT * height);
+}
+
+static uint64_t ramfs_map_lookup(ramfs_file_t *file, uint32_t index) {
+  if (file->height == 0 || index >= ramfs_map_capacity(file->height))
+    return 0;
+
+  struct ramfs_map_node *n = file->root;
+  for (uint32_t h = file->height; h > 1 && n; h--)
+    n = n->slots[(index >> (RAMFS_MAP_SHIFT * (h - 1))) & RAMFS_MAP_MASK];
+  if (!n)
+    return 0;
+  return (uint64_t)n->slots[index & RAMFS_MAP_MASK];
+}
+
+static struct ramfs_map_node *ramfs_map_node_alloc(void) {
+  struct ramfs_map_node *n = kmalloc(sizeof(struct ramfs_map_node));
+  if (n)
+    memset(n, 0, sizeof(*n));
+  return n;
+}
+
+// Returns -1 if a node could not be allocated. Nodes added on the way stay
+// in the tree and are freed with it.
+static int ramfs_map_insert(ramfs_file_t *file, uint32_t index,
+                            uint64_t phys) {
+  if (!file->root) {
+    file->root = ramfs_map_node_alloc();
+    if (!file->root)
+      return -1;
+    file->height = 1;
+  }
+
+  // Grow upwards until index fits; the old root becomes slot 0.
+  while (index >= ramfs_map_capacity(file->height)) {
+    struct ramfs_map_node *top = ramfs_map_node_alloc();
+    if (!top)
+      return -1;
+    top->slots[0] = file->root;
+    top->count = 1;
+    file->root = top;
+    file->height++;
+  }
+
+  struct ramfs_map_node *n = file->root;
+  for (uint32_t h = file->height; h > 1; h--) {
+    uint32_t slot = (index >> (RAMFS_MAP_SHIFT * (h - 1))) & RAMFS_MAP_MASK;
+    if (!n->slots[slot]) {
+      n->slots[slot] = ramfs_map_node_alloc();
+      if (!n->slots[slot])
+        return -1;
+      n->count++;
+    }
+    n = n->slots[slot];
+  }
+
+  n->slots[index & RAMFS_MAP_MASK] = (void *)phys;
+  n->count++;
+  return 0;
+}
+
+struct ramfs_free_batch {
+  void *pages[RAMFS_FREE_BATCH];
+  uint32_t count;
+  uint64_t total;
+};
+
+static void ramfs_free_batch_add(struct ramfs_free_batch *b, uint64_t phys) {
+  b->pages[b->count++] = (void *)phys;
+  b->total++;
+  if (b->count == RAMFS_FREE_BATCH) {
+    pmm_free_page_batch(b->pages, b->count);
+    b->count = 0;
+  }
+}
+
+// Drop the file's reference to every page at or past index first in the
+// subtree n (whose first index is base), freeing nodes that end up empty.
+static void ramfs_map_trim_node(struct ramfs_map_node *n, uint32_t height,
+                                uint64_t base, uint64_t first,
+                                struct ramfs_free_batch *b) {
+  uint64_t span = ramfs_map_capacity(height - 1);
+  for (uint32_t i = 0; i < RAMFS_MAP_SLOTS && n->count; i++) {
+    uint64_t lo = base + i * span;
+    if (!n->slots[i] || lo + span <= first)
+      continue;
+    if (height > 1) {
+      struct ramfs_map_node *child = n->slots[i];
+      ramfs_map_trim_node(child, height - 1, lo, first, b);
+      if (child->count != 0)
+        continue;
+      kfree(child);
+    } else {
+      ramfs_free_batch_add(b, (uint64_t)n->slots[i]);
+    }
+    n->slots[i] = NULL;
+    n->count--;
+  }
+}
+
+// Returns how many pages were dropped. Caller holds file->lock.
+static uint64_t ramfs_map_trim(ramfs_file_t *file, uint64_t first) {
+  if (!file->root)
+    return 0;
+
+  struct ramfs_free_batch b = {.count = 0, .total = 0};
+  ramfs_map_trim_node(file->root, file->height, 0, first, &b);
+  if (b.count)
+    pmm_free_page_batch(b.pages, b.count);
+  if (file->root->count == 0) {
+    kfree(file->root);
+    file->root = NULL;
+    file->height = 0;
+  }
+  file->nr_pages -= b.total;
+  return b.total;
+}
+
+// The page at index with an extra reference for the caller, who drops it
+// with pmm_decref(). A hole is filled with a zeroed page if alloc is set,
+// else (or when the mount is full or memory runs out) 0 is returned.
+static uint64_t ramfs_get_page(ramfs_file_t *file, uint32_t index,
+                               bool alloc) {
+  spinlock_acquire(&file->lock);
+  uint64_t phys = ramfs_map_lookup(file, index);
+  if (phys)
+    pmm_incref((void *)phys);
+  spinlock_release(&file->lock);
+  if (phys || !alloc)
+    return phys;
+
+  if (ramfs_charge(file->sb, 1) != 0)
+    return 0;
+  void *page = pmm_alloc_page();
+  if (!page) {
+    ramfs_uncharge(file->sb, 1);
+    return 0;
+  }
+  memset(ramfs_page_data((uint64_t)page), 0, RAMFS_PAGE_SIZE);
+
+  spinlock_acquire(&file->lock);
+  phys = ramfs_map_lookup(file, index);
+  if (!phys && ramfs_map_insert(file, index, (uint64_t)page) == 0) {
+    file->nr_pages++;
+    pmm_incref(page);
+    spinlock_release(&file->lock);
+    return (uint64_t)page;
+  }
+  // Lost a race with another writer, or out of memory for tree nodes
+  if (phys)
+    pmm_incref((void *)phys);
+  spinlock_release(&file->lock);
+  pmm_free_page(page);
+  ramfs_uncharge(file->sb, 1);
+  return phys;
+}
+
+static ramfs_file_t *ramfs_file_new(ramfs_sb_t *sb) {
+  ramfs_file_t *file = kmalloc(sizeof(ramfs_file_t));
+  if (!file)
+    return NULL;
+  memset(file, 0, sizeof(*file));
+  file->sb = sb;
+  spinlock_init(&file->lock);
+  return file;
+}
 
 // ── VFS Implementations ─────────────────────────────────────────────────────
 
-uint32_t ramfs_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t ramfs_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                     uint8_t *buffer) {
   if (!node || !node->device)
     return 0;
@@ -34,120 +281,292 @@ uint32_t ramfs_read(vfs_node_t *node, uint32_t offset, uint32_t size,
     return 0;
 
   if (offset + size > node->length) {
-    size = node->length - offset;
+    size = (uint32_t)(node->length - offset);
   }
 
-  memcpy(buffer, file->data + offset, size);
+  uint32_t done = 0;
+  while (done < size) {
+    uint64_t pos = offset + done;
+    uint32_t in_page = (uint32_t)(pos & (RAMFS_PAGE_SIZE - 1));
+    uint32_t chunk = RAMFS_PAGE_SIZE - in_page;
+    if (chunk > size - done)
+      chunk = size - done;
+
+    uint64_t phys = ramfs_get_page(file, (uint32_t)(pos / RAMFS_PAGE_SIZE),
+                                   false);
+    if (phys) {
+      memcpy(buffer + done, ramfs_page_data(phys) + in_page, chunk);
+      pmm_decref((void *)phys);
+    } else {
+      memset(buffer + done, 0, chunk); // Hole
+    }
+    done += chunk;
+  }
   return size;
 }
 
-uint32_t ramfs_write(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t ramfs_write(vfs_node_t *node, uint64_t offset, uint32_t size,
                      uint8_t *buffer) {
   if (!node || !node->device)
     return 0;
 
   ramfs_file_t *file = (ramfs_file_t *)node->device;
+  if (offset >= RAMFS_MAX_FILE_SIZE)
+    return 0; // File too large
+  if (size > RAMFS_MAX_FILE_SIZE - offset)
+    size = (uint32_t)(RAMFS_MAX_FILE_SIZE - offset);
+
+  uint32_t done = 0;
+  while (done < size) {
+    uint64_t pos = offset + done;
+    uint32_t in_page = (uint32_t)(pos & (RAMFS_PAGE_SIZE - 1));
+    uint32_t chunk = RAMFS_PAGE_SIZE - in_page;
+    if (chunk > size - done)
+      chunk = size - done;
+
+    uint64_t phys = ramfs_get_page(file, (uint32_t)(pos / RAMFS_PAGE_SIZE),
+                                   true);
+    if (!phys)
+      break; // Mount full or out of memory: short write
+    memcpy(ramfs_page_data(phys) + in_page, buffer + done, chunk);
+    pmm_decref((void *)phys);
+    done += chunk;
+  }
 
-  // Auto-resize buffer if needed
-  if (offset + size > file->capacity) {
-    uint32_t new_cap = (offset + size) * 2; // Double the required size
-    if (new_cap < 512)
-      new_cap = 512;
+  spinlock_acquire(&file->lock);
+  if (offset + done > node->length) {
+    node->length = offset + done;
+  }
+  spinlock_release(&file->lock);
 
-    uint8_t *new_data = kmalloc(new_cap);
-    if (!new_data)
-      return 0; // OOM
+  return done;
+}
 
-    if (file->data) {
-      memcpy(new_data, file->data, node->length);
-      kfree(file->data);
-    }
-    file->data = new_data;
-    file->capacity = new_cap;
-  }
+static int ramfs_truncate(vfs_node_t *node, uint64_t new_len) {
+  if (!node || (node->flags & FS_TYPE_MASK) != FS_FILE || !node->device)
+    return -1;
+  if (new_len > RAMFS_MAX_FILE_SIZE)
+    return -1; // EFBIG
 
-  memcpy(file->data + offset, buffer, size);
-  if (offset + size > node->length) {
-    node->length = offset + size;
+  ramfs_file_t *file = (ramfs_file_t *)node->device;
+  uint64_t freed = 0;
+  spinlock_acquire(&file->lock);
+
+  // Bytes past EOF in the last page must read as zeroes once the file grows
+  // over them again; a shared mapping may have written there.
+  uint64_t tail = new_len < node->length ? new_len : node->length;
+  uint32_t in_page = (uint32_t)(tail & (RAMFS_PAGE_SIZE - 1));
+  if (in_page) {
+    uint64_t phys = ramfs_map_lookup(file, (uint32_t)(tail / RAMFS_PAGE_SIZE));
+    if (phys)
+      memset(ramfs_page_data(phys) + in_page, 0, RAMFS_PAGE_SIZE - in_page);
   }
+  if (new_len < node->length)
+    freed = ramfs_map_trim(file, (new_len + RAMFS_PAGE_SIZE - 1) /
+                                     RAMFS_PAGE_SIZE);
 
-  return size;
+  node->length = new_len;
+  spinlock_release(&file->lock);
+  ramfs_uncharge(file->sb, freed);
+  return 0;
 }
 
-static int ramfs_truncate(vfs_node_t *node, uint32_t new_len) {
-  if (!node || node->flags != FS_FILE || !node->device)
-    return -1;
+#define RAMFS_PROT_WRITE 0x2
+#define RAMFS_PROT_EXEC 0x4
+#define RAMFS_MAP_SHARED 0x01
+#define RAMFS_MAP_FIXED 0x10
+
+// MAP_SHARED maps the file's own pages; stores through the mapping are what
+// read() returns and vice versa. MAP_PRIVATE maps them copy-on-write. Every
+// mapped page carries a reference for the mapping (FS_PAGE_REFS), so the
+// pages outlive a truncate or unlink until they are unmapped. Pages past
+// EOF are left to the demand-zero fault path.
+static uint64_t ramfs_mmap(vfs_node_t *node, uint64_t addr, uint64_t length,
+                           uint64_t prot, uint64_t flags, uint64_t offset) {
+  if (length == 0 || (offset & (RAMFS_PAGE_SIZE - 1)))
+    return (uint64_t)-1;
+  if ((node->flags & FS_TYPE_MASK) != FS_FILE || !node->device)
+    return (uint64_t)-1;
 
   ramfs_file_t *file = (ramfs_file_t *)node->device;
-  if (new_len == 0) {
-    if (file->data) {
-      kfree(file->data);
-      file->data = NULL;
-      file->capacity = 0;
+  bool shared = (flags & RAMFS_MAP_SHARED) != 0;
+  uint64_t aligned_len = (length + RAMFS_PAGE_SIZE - 1) &
+                         ~(uint64_t)(RAMFS_PAGE_SIZE - 1);
+  uint64_t vaddr = addr;
+  if (!(flags & RAMFS_MAP_FIXED) || vaddr == 0) {
+    vaddr = mm_alloc_mmap_region(aligned_len);
+  }
+  if (vaddr == 0) {
+    klog_puts("[RAMFS] mmap: region exhausted\n");
+    return (uint64_t)-1;
+  }
+
+  // Private mappings share the file's frames copy-on-write even without
+  // PROT_WRITE, so that a later mprotect() cannot open them for writing
+  uint64_t page_flags = PAGE_FLAG_PRESENT | PAGE_FLAG_USER;
+  if (!shared)
+    page_flags |= PAGE_FLAG_COW;
+  else if (prot & RAMFS_PROT_WRITE)
+    page_flags |= PAGE_FLAG_RW;
+  if (!(prot & RAMFS_PROT_EXEC))
+    page_flags |= PAGE_FLAG_NX;
+
+  uint64_t *pml4 = vmm_get_active_pml4();
+  uint64_t num_pages = aligned_len / RAMFS_PAGE_SIZE;
+  uint64_t i;
+  for (i = 0; i < num_pages; i++) {
+    uint64_t file_off = offset + i * RAMFS_PAGE_SIZE;
+    if (file_off >= node->length || file_off >= RAMFS_MAX_FILE_SIZE)
+      break;
+
+    uint64_t flags_here = page_flags;
+    uint64_t phys =
+        ramfs_get_page(file, (uint32_t)(file_off / RAMFS_PAGE_SIZE), shared);
+    if (!phys && !shared) {
+      // A hole in a private mapping needs no file page, just a zeroed one
+      phys = (uint64_t)pmm_alloc_page();
+      if (phys) {
+        memset(ramfs_page_data(phys), 0, RAMFS_PAGE_SIZE);
+        flags_here &= ~PAGE_FLAG_COW;
+        if (prot & RAMFS_PROT_WRITE)
+          flags_here |= PAGE_FLAG_RW;
+      }
     }
-    node->length = 0;
-    return 0;
+    if (!phys)
+      break;
+    if (!vmm_map_page(pml4, vaddr + i * RAMFS_PAGE_SIZE, phys, flags_here)) {
+      pmm_decref((void *)phys);
+      break;
+    }
+    vmm_flush_tlb(vaddr + i * RAMFS_PAGE_SIZE);
   }
 
-  if (new_len > file->capacity) {
-    uint32_t new_cap = new_len;
-    uint8_t *new_data = kmalloc(new_cap);
-    if (!new_data)
-      return -1; // ENOMEM
-    if (file->data) {
-      memcpy(new_data, file->data, node->length);
-      kfree(file->data);
+  if (i < num_pages && offset + i * RAMFS_PAGE_SIZE < node->length) {
+    // Out of space or memory: undo what was mapped
+    klog_puts("[RAMFS] mmap: out of pages\n");
+    struct tlb_batch tlb;
+    tlb_batch_init(&tlb, (uint64_t)pml4);
+    for (uint64_t j = 0; j < i; j++) {
+      uint64_t va = vaddr + j * RAMFS_PAGE_SIZE;
+      uint64_t phys = vmm_virt_to_phys(pml4, va) & PAGE_MASK;
+      vmm_unmap_page_batch(pml4, va, &tlb);
+      tlb_batch_free_frame(&tlb, phys);
     }
-    if (new_len > node->length)
-      memset(new_data + node->length, 0, new_len - node->length);
-    file->data = new_data;
-    file->capacity = new_cap;
-  } else if (new_len > node->length) {
-    memset(file->data + node->length, 0, new_len - node->length);
+    tlb_batch_finish(&tlb);
+    return (uint64_t)-1;
   }
 
-  node->length = new_len;
-  return 0;
+  if (shared)
+    __atomic_fetch_add(&stats.mapped, i, __ATOMIC_RELAXED);
+  return vaddr;
 }
 
-static struct dirent *ramfs_readdir(vfs_node_t *node, uint32_t index) {
+static void ramfs_fill_dirent(struct dirent *d, const char *name,
+                              vfs_node_t *node, uint64_t next) {
+  strncpy(d->name, name, 127);
+  d->name[127] = '\0';
+  d->ino = node->inode;
+  d->type = (node->flags & FS_MOUNTPOINT) ? FS_DIRECTORY
+                                          : node->flags & FS_TYPE_MASK;
+  d->next = next;
+}
+
+// Position 0 is ".", 1 is "..", and p >= 2 the first child whose seq is at
+// least p - 2. A sequential reader resumes from the child it stopped at
+// rather than walking the list from its head.
+static int ramfs_readdir(vfs_node_t *node, uint64_t *pos, struct dirent *buf,
+                         uint32_t count) {
   if (!node || !node->device)
-    return 0;
+    return -1;
   ramfs_dir_t *dir = (ramfs_dir_t *)node->device;
+  uint64_t p = *pos;
+  uint32_t n = 0;
 
-  // For standard compliance, the returned dirent is often dynamically allocated
-  // or statically buffered. For simplicity without a thread-local static, we
-  // allocate a temp dirent per call. Callers are normally responsible for
-  // providing a buffer, but our signature returns struct dirent*. Using a
-  // static inside the function is OK for non-preemptive mono-core currently.
-  static struct dirent d;
-  memset(&d, 0, sizeof(struct dirent));
-
-  if (index == 0) {
-    strcpy(d.name, ".");
-    d.ino = node->inode;
-    return &d;
+  if (p == 0 && n < count) {
+    ramfs_fill_dirent(&buf[n++], ".", node, 1);
+    p = 1;
+  }
+  if (p == 1 && n < count) {
+    // Technically wrong parent inode, but acceptable for basic ramfs
+    ramfs_fill_dirent(&buf[n++], "..", node, 2);
+    p = 2;
   }
-  if (index == 1) {
-    strcpy(d.name, "..");
-    d.ino = node->inode; // Technically wrong parent inode, but acceptable for
-                         // basic ramfs
-    return &d;
+  if (n == count) {
+    *pos = p;
+    return (int)n;
   }
 
-  index -= 2;
+  uint64_t want = p - 2;
   child_node_t *curr = dir->children;
-  for (uint32_t i = 0; i < index && curr; i++) {
+  if (dir->resume && dir->resume->seq <= want)
+    curr = dir->resume;
+  while (curr && curr->seq < want)
     curr = curr->next;
+
+  for (; curr && n < count; curr = curr->next) {
+    ramfs_fill_dirent(&buf[n++], curr->node->name, curr->node,
+                      (uint64_t)curr->seq + 3);
+    p = (uint64_t)curr->seq + 3;
+  }
+  dir->resume = curr;
+
+  *pos = p;
+  return (int)n;
+}
+
+// ── Directory index ─────────────────────────────────────────────────────────
+
+// FNV-1a, as in the dcache
+static uint32_t ramfs_name_hash(const char *name) {
+  uint32_t h = 2166136261u;
+  while (*name) {
+    h ^= (uint8_t)*name++;
+    h *= 16777619u;
   }
+  return h;
+}
 
-  if (curr) {
-    strcpy(d.name, curr->node->name);
-    d.ino = curr->node->inode;
-    return &d;
+static child_node_t *ramfs_dir_lookup(ramfs_dir_t *dir, const char *name) {
+  if (dir->nr_buckets == 0)
+    return NULL;
+  uint32_t hash = ramfs_name_hash(name);
+  child_node_t *cn = dir->buckets[hash & (dir->nr_buckets - 1)];
+  for (; cn; cn = cn->hash_next) {
+    if (cn->hash == hash && strcmp(cn->node->name, name) == 0)
+      return cn;
   }
+  return NULL;
+}
+
+static void ramfs_dir_hash_insert(ramfs_dir_t *dir, child_node_t *cn) {
+  child_node_t **bucket = &dir->buckets[cn->hash & (dir->nr_buckets - 1)];
+  cn->hash_next = *bucket;
+  *bucket = cn;
+}
 
-  return 0; // End of directory
+static void ramfs_dir_hash_remove(ramfs_dir_t *dir, child_node_t *cn) {
+  child_node_t **pp = &dir->buckets[cn->hash & (dir->nr_buckets - 1)];
+  while (*pp && *pp != cn)
+    pp = &(*pp)->hash_next;
+  if (*pp)
+    *pp = cn->hash_next;
+  cn->hash_next = NULL;
+}
+
+// Move the children to a table of nr buckets. On allocation failure the old
+// table stays, just with longer chains.
+static int ramfs_dir_rehash(ramfs_dir_t *dir, uint32_t nr) {
+  child_node_t **buckets = kmalloc(nr * sizeof(child_node_t *));
+  if (!buckets)
+    return -1;
+  memset(buckets, 0, nr * sizeof(child_node_t *));
+  if (dir->buckets)
+    kfree(dir->buckets);
+  dir->buckets = buckets;
+  dir->nr_buckets = nr;
+  for (child_node_t *cn = dir->children; cn; cn = cn->next)
+    ramfs_dir_hash_insert(dir, cn);
+  return 0;
 }
 
 static vfs_node_t *ramfs_finddir(vfs_node_t *node, char *name) {
@@ -159,19 +578,22 @@ static vfs_node_t *ramfs_finddir(vfs_node_t *node, char *name) {
     return node;
   }
 
-  child_node_t *curr = dir->children;
-  while (curr) {
-    if (strcmp(curr->node->name, name) == 0) {
-      return curr->node;
-    }
-    curr = curr->next;
-  }
+  child_node_t *cn = ramfs_dir_lookup(dir, name);
+  return cn ? cn->node : 0;
+}
 
-  return 0;
+static ramfs_dir_t *ramfs_dir_new(ramfs_sb_t *sb) {
+  ramfs_dir_t *d = kmalloc(sizeof(ramfs_dir_t));
+  if (!d)
+    return NULL;
+  memset(d, 0, sizeof(ramfs_dir_t));
+  d->sb = sb;
+  return d;
 }
 
 // Helper to construct a new node linked to ramfs standard APIs
-static vfs_node_t *ramfs_make_node(char *name, uint16_t perm, uint32_t type) {
+static vfs_node_t *ramfs_make_node(ramfs_sb_t *sb, char *name, uint16_t perm,
+                                   uint32_t type) {
   vfs_node_t *n = kmalloc(sizeof(vfs_node_t));
   if (!n)
     return 0;
@@ -188,19 +610,24 @@ static vfs_node_t *ramfs_make_node(char *name, uint16_t perm, uint32_t type) {
   n->ptr = 0;
 
   if (type == FS_DIRECTORY) {
-    ramfs_dir_t *d = kmalloc(sizeof(ramfs_dir_t));
-    d->children = 0;
-    n->device = d;
+    n->device = ramfs_dir_new(sb);
+    if (!n->device) {
+      kfree(n);
+      return 0;
+    }
     n->readdir = ramfs_readdir;
     n->finddir = ramfs_finddir;
   } else if (type == FS_FILE) {
-    ramfs_file_t *f = kmalloc(sizeof(ramfs_file_t));
-    f->data = 0;
-    f->capacity = 0;
-    n->device = f;
+    n->device = ramfs_file_new(sb);
+    if (!n->device) {
+      kfree(n);
+      return 0;
+    }
+    n->flags |= FS_PAGE_REFS;
     n->read = ramfs_read;
     n->write = ramfs_write;
     n->truncate = ramfs_truncate;
+    n->mmap = ramfs_mmap;
   }
   // Block devices would be populated via ramfs_mount_node
 
@@ -208,41 +635,80 @@ static vfs_node_t *ramfs_make_node(char *name, uint16_t perm, uint32_t type) {
 }
 
 // Internal helper to add node to dir
-static void ramfs_add_child(vfs_node_t *parent, vfs_node_t *child) {
+static int ramfs_add_child(vfs_node_t *parent, vfs_node_t *child) {
   ramfs_dir_t *dir = (ramfs_dir_t *)parent->device;
+  if (dir->nr_buckets == 0 && ramfs_dir_rehash(dir, RAMFS_HASH_MIN) != 0)
+    return -1;
   child_node_t *cn = kmalloc(sizeof(child_node_t));
+  if (!cn)
+    return -1;
   cn->node = child;
-  cn->next = dir->children;
-  dir->children = cn;
+  cn->seq = dir->next_seq++;
+  cn->hash = ramfs_name_hash(child->name);
+  cn->next = 0;
+  cn->prev = dir->tail;
+  if (dir->tail)
+    dir->tail->next = cn;
+  else
+    dir->children = cn;
+  dir->tail = cn;
+  ramfs_dir_hash_insert(dir, cn);
+
+  // Keep chains around two entries long
+  if (++dir->count > dir->nr_buckets * 2)
+    ramfs_dir_rehash(dir, dir->nr_buckets * 2);
+  return 0;
 }
 
-static int ramfs_create(vfs_node_t *node, char *name, uint16_t permission) {
-  if (!node || (node->flags & FS_TYPE_MASK) != FS_DIRECTORY)
-    return -1;
+static void ramfs_remove_child(ramfs_dir_t *dir, child_node_t *cn) {
+  ramfs_dir_hash_remove(dir, cn);
+  if (cn->prev)
+    cn->prev->next = cn->next;
+  else
+    dir->children = cn->next;
+  if (cn->next)
+    cn->next->prev = cn->prev;
+  else
+    dir->tail = cn->prev;
+  if (dir->resume == cn)
+    dir->resume = cn->next;
+  dir->count--;
+}
+
+// Create a node of the given type in a ramfs directory
+static vfs_node_t *ramfs_new_child(vfs_node_t *node, char *name,
+                                   uint16_t permission, uint32_t type) {
+  if (!node || (node->flags & FS_TYPE_MASK) != FS_DIRECTORY || !node->device)
+    return 0;
   if (ramfs_finddir(node, name) != 0)
-    return -1; // File exists
+    return 0; // Node exists
 
-  vfs_node_t *new_node = ramfs_make_node(name, permission, FS_FILE);
+  ramfs_dir_t *dir = (ramfs_dir_t *)node->device;
+  vfs_node_t *new_node = ramfs_make_node(dir->sb, name, permission, type);
   if (!new_node)
-    return -1;
+    return 0;
+  if (ramfs_add_child(node, new_node) != 0) {
+    if (new_node->device)
+      kfree(new_node->device);
+    kfree(new_node);
+    return 0;
+  }
+  return new_node;
+}
 
-  ramfs_add_child(node, new_node);
-  return 0;
+static int ramfs_create(vfs_node_t *node, char *name, uint16_t permission) {
+  return ramfs_new_child(node, name, permission, FS_FILE) ? 0 : -1;
 }
 
 static int ramfs_mknod(vfs_node_t *node, char *name, uint16_t permission,
                        uint32_t flags, void *device) {
-  if (!node || (node->flags & FS_TYPE_MASK) != FS_DIRECTORY)
-    return -1;
-  if (ramfs_finddir(node, name) != 0)
-    return -1; // Node exists
-
-  vfs_node_t *new_node = ramfs_make_node(name, permission, flags);
+  if ((flags & FS_TYPE_MASK) == FS_FILE ||
+      (flags & FS_TYPE_MASK) == FS_DIRECTORY)
+    return -1; // Those bring their own device structure
+  vfs_node_t *new_node = ramfs_new_child(node, name, permission, flags);
   if (!new_node)
     return -1;
-
   new_node->device = device;
-  ramfs_add_child(node, new_node);
   return 0;
 }
 
@@ -250,12 +716,7 @@ static int ramfs_unlink(vfs_node_t *node, char *name);
 static int ramfs_rename(vfs_node_t *node, char *old_name, char *new_name);
 
 static int ramfs_mkdir(vfs_node_t *node, char *name, uint16_t permission) {
-  if (!node || (node->flags & FS_TYPE_MASK) != FS_DIRECTORY)
-    return -1;
-  if (ramfs_finddir(node, name) != 0)
-    return -1; // Directory exists
-
-  vfs_node_t *new_node = ramfs_make_node(name, permission, FS_DIRECTORY);
+  vfs_node_t *new_node = ramfs_new_child(node, name, permission, FS_DIRECTORY);
   if (!new_node)
     return -1;
 
@@ -265,8 +726,6 @@ static int ramfs_mkdir(vfs_node_t *node, char *name, uint16_t permission) {
   new_node->unlink = ramfs_unlink;
   new_node->rename = ramfs_rename;
   new_node->mknod = ramfs_mknod;
-
-  ramfs_add_child(node, new_node);
   return 0;
 }
 
@@ -276,60 +735,49 @@ static int ramfs_unlink(vfs_node_t *node, char *name) {
     return -1;
 
   ramfs_dir_t *dir = (ramfs_dir_t *)node->device;
-  child_node_t *prev = 0;
-  child_node_t *curr = dir->children;
+  child_node_t *cn = ramfs_dir_lookup(dir, name);
+  if (!cn)
+    return -1; // Not found
 
-  while (curr) {
-    if (strcmp(curr->node->name, name) == 0) {
-      // Don't allow unlinking directories via unlink
-      if ((curr->node->flags & FS_TYPE_MASK) == FS_DIRECTORY)
-        return -1; // EISDIR
-
-      // Unlink from the list
-      if (prev)
-        prev->next = curr->next;
-      else
-        dir->children = curr->next;
-
-      // Free the file data if it's a ramfs file
-      if (curr->node->device && (curr->node->flags & FS_TYPE_MASK) == FS_FILE) {
-        ramfs_file_t *file = (ramfs_file_t *)curr->node->device;
-        if (file->data)
-          kfree(file->data);
-        kfree(file);
-      }
-      kfree(curr->node);
-      kfree(curr);
-      return 0;
-    }
-    prev = curr;
-    curr = curr->next;
-  }
-  return -1; // Not found
+  // Don't allow unlinking directories via unlink
+  if ((cn->node->flags & FS_TYPE_MASK) == FS_DIRECTORY)
+    return -1; // EISDIR
+
+  ramfs_remove_child(dir, cn);
+
+  // Free the file data if it's a ramfs file
+  if ((cn->node->flags & FS_TYPE_MASK) == FS_FILE)
+    ramfs_file_release(cn->node);
+  kfree(cn->node);
+  kfree(cn);
+  return 0;
 }
 
 // ── ramfs_rename: Rename a file within the same directory ────────────────────
 static int ramfs_rename(vfs_node_t *node, char *old_name, char *new_name) {
   if (!node || (node->flags & FS_TYPE_MASK) != FS_DIRECTORY || !node->device)
     return -1;
+  ramfs_dir_t *dir = (ramfs_dir_t *)node->device;
 
-  // Check that new_name doesn't already exist
-  if (ramfs_finddir(node, new_name) != 0) {
-    // If target exists, unlink it first (overwrite semantics per POSIX)
-    vfs_node_t *target = ramfs_finddir(node, new_name);
-    if ((target->flags & FS_TYPE_MASK) != FS_DIRECTORY) {
-      ramfs_unlink(node, new_name);
-    } else {
+  child_node_t *cn = ramfs_dir_lookup(dir, old_name);
+  if (!cn)
+    return -1; // Source not found
+
+  // If target exists, unlink it first (overwrite semantics per POSIX)
+  child_node_t *target = ramfs_dir_lookup(dir, new_name);
+  if (target == cn)
+    return 0;
+  if (target) {
+    if ((target->node->flags & FS_TYPE_MASK) == FS_DIRECTORY)
       return -1; // Can't overwrite a directory
-    }
+    ramfs_unlink(node, new_name);
   }
 
-  vfs_node_t *child = ramfs_finddir(node, old_name);
-  if (!child)
-    return -1; // Source not found
-
-  strncpy(child->name, new_name, 127);
-  child->name[127] = '\0';
+  ramfs_dir_hash_remove(dir, cn);
+  strncpy(cn->node->name, new_name, 127);
+  cn->node->name[127] = '\0';
+  cn->hash = ramfs_name_hash(cn->node->name);
+  ramfs_dir_hash_insert(dir, cn);
   return 0;
 }
 
@@ -338,7 +786,7 @@ static int ramfs_rename(vfs_node_t *node, char *old_name, char *new_name) {
 void ramfs_init(void) {
   next_inode = 1;
   // Create the root directory
-  vfs_node_t *root = ramfs_make_node("/", 0755, FS_DIRECTORY);
+  vfs_node_t *root = ramfs_make_node(&ramfs_root_sb, "/", 0755, FS_DIRECTORY);
   // Bind APIs
   root->create = ramfs_create;
   root->mkdir = ramfs_mkdir;
@@ -354,6 +802,26 @@ void ramfs_init(void) {
   ramfs_mkdir(fs_root, "tmp", 0777);
 }
 
+void *ramfs_file_alloc(void) { return ramfs_file_new(&ramfs_root_sb); }
+
+void ramfs_file_release(vfs_node_t *node) {
+  if (!node || !node->device)
+    return;
+  ramfs_file_t *file = (ramfs_file_t *)node->device;
+  spinlock_acquire(&file->lock);
+  uint64_t freed = ramfs_map_trim(file, 0);
+  spinlock_release(&file->lock);
+  ramfs_uncharge(file->sb, freed);
+  kfree(file);
+  node->device = NULL;
+}
+
+void ramfs_get_stats(struct ramfs_stats *out) {
+  out->pages = __atomic_load_n(&stats.pages, __ATOMIC_RELAXED);
+  out->mapped = __atomic_load_n(&stats.mapped, __ATOMIC_RELAXED);
+  out->limit_hits = __atomic_load_n(&stats.limit_hits, __ATOMIC_RELAXED);
+}
+
 void ramfs_mount_node(vfs_node_t *root, vfs_node_t *node) {
   if (!root || !node)
     return;
@@ -365,15 +833,12 @@ void ramfs_mount_node(vfs_node_t *root, vfs_node_t *node) {
 
   ramfs_add_child(root, node);
 }
-void ramfs_mount_on(vfs_node_t *node) {
-  if (!node)
-    return;
 
+static void ramfs_mount_on_sb(vfs_node_t *node, ramfs_sb_t *sb) {
   // Initialize a ramfs directory structure
-  ramfs_dir_t *dir = kmalloc(sizeof(ramfs_dir_t));
+  ramfs_dir_t *dir = ramfs_dir_new(sb);
   if (!dir)
     return;
-  memset(dir, 0, sizeof(ramfs_dir_t));
 
   // Transform the existing node into a ramfs directory
   node->device = dir;
@@ -390,29 +855,63 @@ void ramfs_mount_on(vfs_node_t *node) {
   node->mknod = ramfs_mknod;
 }
 
-void ramfs_mount_at(char *path) {
+void ramfs_mount_on(vfs_node_t *node) {
+  if (!node)
+    return;
+  ramfs_mount_on_sb(node, &ramfs_root_sb);
+}
+
+void ramfs_mount_at(char *path, uint64_t size_limit) {
+  char *name = path;
+  char *last_slash = 0;
+  for (char *p = path; *p; p++)
+    if (*p == '/')
+      last_slash = p;
+  if (last_slash)
+    name = last_slash + 1;
+
   vfs_node_t *mountpoint = vfs_resolve_path(path);
-  if (!mountpoint) {
-    // If it doesn't exist, try to create it in the root (legacy fallback)
-    if (fs_root && fs_root->mkdir) {
-      fs_root->mkdir(fs_root, path + (path[0] == '/' ? 1 : 0), 0755);
+  if (!mountpoint && last_slash) {
+    // If it doesn't exist, create it in its parent
+    char parent_path[128];
+    size_t len = (size_t)(last_slash - path);
+    if (len >= sizeof(parent_path))
+      return;
+    memcpy(parent_path, path, len);
+    parent_path[len] = '\0';
+    vfs_node_t *parent = len ? vfs_resolve_path(parent_path) : fs_root;
+    if (parent && parent->mkdir) {
+      vfs_mkdir(parent, name, 0755);
       mountpoint = vfs_resolve_path(path);
     }
   }
 
   if (mountpoint) {
+    ramfs_sb_t *sb = kmalloc(sizeof(ramfs_sb_t));
     vfs_node_t *ram_root = kmalloc(sizeof(vfs_node_t));
+    if (!sb || !ram_root) {
+      if (sb)
+        kfree(sb);
+      if (ram_root)
+        kfree(ram_root);
+      return;
+    }
+    sb->max_pages = size_limit / RAMFS_PAGE_SIZE;
+    sb->nr_pages = 0;
+    spinlock_init(&sb->lock);
+
     vfs_node_init(ram_root);
-    char *name = path;
-    char *last_slash = 0;
-    for (char *p = path; *p; p++)
-      if (*p == '/')
-        last_slash = p;
-    if (last_slash)
-      name = last_slash + 1;
     strncpy(ram_root->name, name, 127);
 
-    ramfs_mount_on(ram_root);
+    ramfs_mount_on_sb(ram_root, sb);
     vfs_mount(mountpoint, ram_root);
+
+    if (size_limit) {
+      klog_puts("[RAMFS] ");
+      klog_puts(path);
+      klog_puts(" limited to ");
+      klog_uint64(size_limit / 1024);
+      klog_puts(" KiB\n");
+    }
   }
 }
@@ -3,6 +3,13 @@
 
 #include "vfs.h"
 
+// tmpfs statistics (reported in /proc/vmstat)
+struct ramfs_stats {
+  uint64_t pages;      // Pages held by files and pipe buffers
+  uint64_t mapped;     // File pages handed to MAP_SHARED mappings
+  uint64_t limit_hits; // Page allocations refused by a mount's size limit
+};
+
 // Initialize the root ramfs and mount it to fs_root
 void ramfs_init(void);
 
@@ -10,12 +17,23 @@ void ramfs_init(void);
 // (Useful for mounting block devices into /dev early on)
 void ramfs_mount_node(vfs_node_t *root, vfs_node_t *node);
 void ramfs_mount_on(vfs_node_t *node);
-void ramfs_mount_at(char *path);
+
+// Mount a fresh instance at path, creating the directory if needed. Its
+// files may hold at most size_limit bytes of pages (0: no limit).
+void ramfs_mount_at(char *path, uint64_t size_limit);
 
 // Exposed ramfs read/write for kernel-internal pipe buffers
-uint32_t ramfs_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t ramfs_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                     uint8_t *buffer);
-uint32_t ramfs_write(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t ramfs_write(vfs_node_t *node, uint64_t offset, uint32_t size,
                      uint8_t *buffer);
 
+// File storage for such a buffer, to be set as node->device, and its
+// release: frees the pages and clears node->device.
+void *ramfs_file_alloc(void);
+void ramfs_file_release(vfs_node_t *node);
+
+// Snapshot the tmpfs statistics.
+void ramfs_get_stats(struct ramfs_stats *out);
+
 #endif
@@ -10,7 +10,7 @@ static inline uint64_t __random_rdtsc(void) {
   return ((uint64_t)hi << 32) | lo;
 }
 
-static uint32_t random_read(struct vfs_node *node, uint32_t offset,
+static uint32_t random_read(struct vfs_node *node, uint64_t offset,
                             uint32_t size, uint8_t *buffer) {
   (void)node;
   (void)offset;
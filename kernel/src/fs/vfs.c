@@ -1,6 +1,8 @@
 #include "vfs.h"
+#include "dcache.h"
 #include "../lib/string.h"
 #include "../mm/heap.h"
+#include "../mm/page_cache.h"
 
 vfs_node_t *fs_root = 0;
 
@@ -12,18 +14,25 @@ typedef struct vfs_mount_entry {
 
 static vfs_mount_entry_t *vfs_mount_list = NULL;
 
-uint32_t vfs_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t vfs_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                   uint8_t *buffer) {
+  if (node && node->readpage && (node->flags & FS_TYPE_MASK) == FS_FILE) {
+    return page_cache_read(node, offset, size, buffer);
+  }
   if (node && node->read) {
     return node->read(node, offset, size, buffer);
   }
   return 0;
 }
 
-uint32_t vfs_write(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t vfs_write(vfs_node_t *node, uint64_t offset, uint32_t size,
                    uint8_t *buffer) {
   if (node && node->write) {
     uint32_t written = node->write(node, offset, size, buffer);
+    // Filesystems with buffered writes keep the cache up to date themselves
+    if (written > 0 && node->readpage && !node->writepages) {
+      page_cache_write(node, offset, written, buffer);
+    }
     if (written > 0 && node->flags != FS_PIPE) {
       // Filter out common high-volume writes if needed, but for now log
       // klog_puts("[VFS] node write successful\n");
@@ -55,11 +64,12 @@ void vfs_close(vfs_node_t *node) {
   }
 }
 
-struct dirent *vfs_readdir(vfs_node_t *node, uint32_t index) {
+int vfs_readdir(vfs_node_t *node, uint64_t *pos, struct dirent *buf,
+                uint32_t count) {
   if ((node->flags & FS_TYPE_MASK) == FS_DIRECTORY && node->readdir) {
-    return node->readdir(node, index);
+    return node->readdir(node, pos, buf, count);
   }
-  return 0;
+  return -1;
 }
 
 vfs_node_t *vfs_finddir(vfs_node_t *node, char *name) {
@@ -92,28 +102,71 @@ vfs_node_t *vfs_finddir(vfs_node_t *node, char *name) {
 
 int vfs_create(vfs_node_t *node, char *name, uint16_t permission) {
   if ((node->flags & FS_TYPE_MASK) == FS_DIRECTORY && node->create) {
-    return node->create(node, name, permission);
+    int ret = node->create(node, name, permission);
+    dcache_invalidate(node, name);
+    return ret;
   }
   return -1;
 }
 
 int vfs_mkdir(vfs_node_t *node, char *name, uint16_t permission) {
   if ((node->flags & FS_TYPE_MASK) == FS_DIRECTORY && node->mkdir) {
-    return node->mkdir(node, name, permission);
+    int ret = node->mkdir(node, name, permission);
+    dcache_invalidate(node, name);
+    return ret;
   }
   return -1;
 }
 
+// Release a node finddir returned, including the inode reference it holds.
+static void vfs_put_victim(vfs_node_t *victim) {
+  if (victim->flags & FS_PERSISTENT)
+    return;
+  if (victim->close)
+    victim->close(victim);
+  kfree(victim);
+}
+
+// Drop the cached pages of the file that name refers to once it is gone.
+// Lookups return fresh nodes, so resolve the victim before removing it.
+static vfs_node_t *vfs_lookup_victim(vfs_node_t *dir, char *name) {
+  if (!dir->finddir)
+    return NULL;
+  vfs_node_t *victim = dir->finddir(dir, name);
+  if (victim && !victim->readpage) {
+    vfs_put_victim(victim);
+    return NULL;
+  }
+  return victim;
+}
+
+static void vfs_forget_victim(vfs_node_t *victim, int ret) {
+  if (!victim)
+    return;
+  if (ret == 0)
+    page_cache_invalidate(victim->device, victim->inode);
+  vfs_put_victim(victim);
+}
+
 int vfs_unlink(vfs_node_t *node, char *name) {
   if ((node->flags & FS_TYPE_MASK) == FS_DIRECTORY && node->unlink) {
-    return node->unlink(node, name);
+    vfs_node_t *victim = vfs_lookup_victim(node, name);
+    int ret = node->unlink(node, name);
+    dcache_invalidate(node, name);
+    vfs_forget_victim(victim, ret);
+    return ret;
   }
   return -1;
 }
 
 int vfs_rmdir(vfs_node_t *node, char *name) {
   if ((node->flags & FS_TYPE_MASK) == FS_DIRECTORY && node->rmdir) {
-    return node->rmdir(node, name);
+    int ret = node->rmdir(node, name);
+    // Entries below the directory are keyed by its inode number, which
+    // may be reused: drop the whole filesystem.
+    if (ret == 0 && node->revalidate)
+      dcache_invalidate_fs(node->device);
+    return ret;
   }
   return -1;
 }
@@ -127,14 +180,23 @@ int vfs_readlink(vfs_node_t *node, char *buf, uint32_t size) {
 
 int vfs_symlink(vfs_node_t *node, char *name, char *target) {
   if ((node->flags & FS_TYPE_MASK) == FS_DIRECTORY && node->symlink) {
-    return node->symlink(node, name, target);
+    int ret = node->symlink(node, name, target);
+    dcache_invalidate(node, name);
+    return ret;
   }
   return -1;
 }
 
 int vfs_rename(vfs_node_t *node, char *old_name, char *new_name) {
   if ((node->flags & FS_TYPE_MASK) == FS_DIRECTORY && node->rename) {
-    return node->rename(node, old_name, new_name);
+    // Renaming over an existing file releases its inode
+    vfs_node_t *victim = vfs_lookup_victim(node, new_name);
+    int ret = node->rename(node, old_name, new_name);
+    // A renamed directory changes its ".." and may replace another one
+    if (ret == 0 && node->revalidate)
+      dcache_invalidate_fs(node->device);
+    vfs_forget_victim(victim, ret);
+    return ret;
   }
   return -1;
 }
@@ -156,18 +218,35 @@ int vfs_chown(vfs_node_t *node, uint32_t uid, uint32_t gid) {
 int vfs_mknod(vfs_node_t *node, char *name, uint16_t permission, uint32_t flags,
               void *device) {
   if ((node->flags & FS_TYPE_MASK) == FS_DIRECTORY && node->mknod) {
-    return node->mknod(node, name, permission, flags, device);
+    int ret = node->mknod(node, name, permission, flags, device);
+    dcache_invalidate(node, name);
+    return ret;
   }
   return -1;
 }
 
-int vfs_truncate(vfs_node_t *node, uint32_t size) {
+int vfs_truncate(vfs_node_t *node, uint64_t size) {
   if (node && node->truncate) {
-    return node->truncate(node, size);
+    int ret = node->truncate(node, size);
+    if (ret == 0 && node->readpage) {
+      page_cache_truncate(node, size);
+    }
+    return ret;
   }
   return -1;
 }
 
+int vfs_fsync(vfs_node_t *node, bool datasync) {
+  if (!node)
+    return -1;
+  int ret = 0;
+  if (node->writepages && page_cache_fsync(node) != 0)
+    ret = -1;
+  if (node->fsync && node->fsync(node, datasync) != 0)
+    ret = -1;
+  return ret;
+}
+
 int vfs_poll(vfs_node_t *node, int events) {
   if (node && node->poll) {
     return node->poll(node, events);
@@ -182,25 +261,33 @@ int vfs_poll(vfs_node_t *node, int events) {
 
 #define MAX_SYMLINK_DEPTH 8
 
+// Let go of a node the walk no longer needs: the dentry reference of a
+// cached lookup, or the node itself if the lookup created it.
+static void vfs_walk_put(vfs_node_t *node, struct dentry *d, vfs_node_t *dir) {
+  if (d) {
+    dcache_put(d);
+    return;
+  }
+  if (node == fs_root || node == dir || (node->flags & FS_PERSISTENT))
+    return;
+  if (node->close)
+    node->close(node);
+  kfree(node);
+}
+
+// Components are looked up through the dentry cache. Intermediate
+// directories found there are used in place, so a warm walk allocates
+// nothing but the node it returns; the path is only copied once a symlink
+// has to be spliced into it.
 vfs_node_t *vfs_resolve_path_at(vfs_node_t *dir, const char *path) {
   if (!path || !fs_root)
     return 0;
 
-  char *path_buf = kmalloc(512);
-  if (!path_buf)
-    return 0;
-  strncpy(path_buf, path, 511);
-  path_buf[511] = '\0';
-
   vfs_node_t *current = (path[0] == '/') ? fs_root : (dir ? dir : fs_root);
+  struct dentry *current_d = NULL; // Holds current if it came from the dcache
+  char *path_buf = NULL;
   int symlink_depth = 0;
-  char *p = path_buf;
-
-  // Initial skip of root slashes
-  if (path_buf[0] == '/') {
-    while (*p == '/')
-      p++;
-  }
+  const char *p = path;
 
   while (*p) {
     char comp[128];
@@ -218,54 +305,37 @@ vfs_node_t *vfs_resolve_path_at(vfs_node_t *dir, const char *path) {
     }
     comp[i] = '\0';
 
-    vfs_node_t *next = vfs_finddir(current, comp);
+    struct dentry *next_d;
+    vfs_node_t *next = dcache_lookup(current, comp, &next_d);
     if (!next) {
-      if (current != fs_root && current != dir)
-        if (!(current->flags & FS_PERSISTENT))
-          kfree(current);
+      vfs_walk_put(current, current_d, dir);
       kfree(path_buf);
       return 0;
     }
 
     // Handle symlinks
     if ((next->flags & FS_TYPE_MASK) == FS_SYMLINK) {
-      if (++symlink_depth > MAX_SYMLINK_DEPTH) {
-        kfree(next);
-        if (current != fs_root && current != dir)
-          if (!(current->flags & FS_PERSISTENT))
-            kfree(current);
-        kfree(path_buf);
-        return 0;
-      }
-
       char link_target[256];
-      int len = vfs_readlink(next, link_target, 256);
-      kfree(next);
-
-      if (len < 0) {
-        if (current != fs_root && current != dir)
-          if (!(current->flags & FS_PERSISTENT))
-            kfree(current);
-        kfree(path_buf);
-        return 0;
-      }
+      int len = -1;
+      if (++symlink_depth <= MAX_SYMLINK_DEPTH)
+        len = vfs_readlink(next, link_target, 256);
+      vfs_walk_put(next, next_d, dir);
 
       // Construct new path: [link_target] + "/" + [remaining p]
-      char *next_path = kmalloc(512);
+      char *next_path = len >= 0 ? kmalloc(512) : NULL;
       if (!next_path) {
-        if (current != fs_root && current != dir)
-          if (!(current->flags & FS_PERSISTENT))
-            kfree(current);
+        vfs_walk_put(current, current_d, dir);
         kfree(path_buf);
         return 0;
       }
+      link_target[255] = '\0';
       strncpy(next_path, link_target, 511);
       next_path[511] = '\0';
 
       if (*p) {
         int cur_len = strlen(next_path);
         if (cur_len < 510) {
-          if (next_path[cur_len - 1] != '/') {
+          if (cur_len == 0 || next_path[cur_len - 1] != '/') {
             strcat(next_path, "/");
           }
           strncat(next_path, p, 511 - strlen(next_path));
@@ -273,18 +343,14 @@ vfs_node_t *vfs_resolve_path_at(vfs_node_t *dir, const char *path) {
       }
       next_path[511] = '\0';
 
-      // Update path_buf and p
-      strcpy(path_buf, next_path);
-      kfree(next_path);
+      kfree(path_buf);
+      path_buf = next_path;
       p = path_buf;
 
       if (path_buf[0] == '/') {
-        if (current != fs_root && current != dir)
-          if (!(current->flags & FS_PERSISTENT))
-            kfree(current);
+        vfs_walk_put(current, current_d, dir);
         current = fs_root;
-        while (*p == '/')
-          p++;
+        current_d = NULL;
       }
       // Continue loop with new path and same current (if relative) or root (if
       // absolute)
@@ -292,14 +358,18 @@ vfs_node_t *vfs_resolve_path_at(vfs_node_t *dir, const char *path) {
     }
 
     // Move to next directory component
-    if (current != fs_root && current != dir &&
-        !(current->flags & FS_PERSISTENT)) {
-      kfree(current);
-    }
+    vfs_walk_put(current, current_d, dir);
     current = next;
+    current_d = next_d;
   }
 
   kfree(path_buf);
+  if (current_d) {
+    // The caller gets a node of its own
+    vfs_node_t *res = dcache_clone(current_d);
+    dcache_put(current_d);
+    return res;
+  }
   return current;
 }
 
@@ -328,5 +398,8 @@ int vfs_mount(vfs_node_t *mountpoint, vfs_node_t *target) {
   mountpoint->flags |= FS_MOUNTPOINT | FS_PERSISTENT;
   mountpoint->ptr = target;
 
+  // Cached lookups may still return the covered directory
+  dcache_invalidate_all();
+
   return 0;
 }
@@ -3,6 +3,7 @@
 
 #include "../lib/list.h"
 #include "../lock/spinlock.h"
+#include "../mm/page_cache.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -17,6 +18,7 @@
 #define FS_MOUNTPOINT 0x08
 #define FS_EPOLL 0x09
 #define FS_PERSISTENT 0x10
+#define FS_PAGE_REFS 0x20 // mmap() maps frames the mapping holds a reference to
 #define FS_TYPE_MASK 0x0F
 
 // Poll Events
@@ -30,16 +32,24 @@ struct vfs_node;
 struct dirent {
   char name[128];
   uint32_t ino;
+  uint32_t type; // FS_* node type, 0 if the filesystem does not know
+  uint64_t next; // Position cookie just past this entry
 };
 
-typedef uint32_t (*read_type_t)(struct vfs_node *, uint32_t, uint32_t,
-                                uint8_t *);
-typedef uint32_t (*write_type_t)(struct vfs_node *, uint32_t, uint32_t,
-                                 uint8_t *);
+// File offsets and sizes are 64-bit throughout; a single transfer is at
+// most 4 GiB - 1 bytes.
+typedef uint32_t (*read_type_t)(struct vfs_node *, uint64_t offset,
+                                uint32_t size, uint8_t *);
+typedef uint32_t (*write_type_t)(struct vfs_node *, uint64_t offset,
+                                 uint32_t size, uint8_t *);
 typedef void (*open_type_t)(struct vfs_node *);
 typedef void (*close_type_t)(struct vfs_node *);
 typedef int (*ioctl_type_t)(struct vfs_node *, uint32_t request, uint64_t arg);
-typedef struct dirent *(*readdir_type_t)(struct vfs_node *, uint32_t);
+// Fill buf with up to count entries, starting at the position cookie *pos
+// (0: the first entry) and advancing it past the last one returned.
+// Returns the number of entries filled, 0 at the end, -1 on error.
+typedef int (*readdir_type_t)(struct vfs_node *, uint64_t *pos,
+                              struct dirent *buf, uint32_t count);
 typedef struct vfs_node *(*finddir_type_t)(struct vfs_node *, char *name);
 typedef int (*create_type_t)(struct vfs_node *, char *name,
                              uint16_t permission);
@@ -53,11 +63,21 @@ typedef int (*symlink_type_t)(struct vfs_node *, char *name, char *target);
 typedef int (*rename_type_t)(struct vfs_node *, char *old_name, char *new_name);
 typedef int (*chmod_type_t)(struct vfs_node *, uint16_t permission);
 typedef int (*chown_type_t)(struct vfs_node *, uint32_t uid, uint32_t gid);
-typedef int (*truncate_type_t)(struct vfs_node *, uint32_t);
+typedef int (*truncate_type_t)(struct vfs_node *, uint64_t size);
 typedef uint64_t (*mmap_type_t)(struct vfs_node *, uint64_t addr,
                                 uint64_t length, uint64_t prot, uint64_t flags,
                                 uint64_t offset);
 typedef int (*poll_type_t)(struct vfs_node *, int events);
+typedef int (*readpage_type_t)(struct vfs_node *, uint32_t index,
+                               uint8_t *page);
+typedef int (*readpages_type_t)(struct vfs_node *, uint32_t index, uint32_t nr,
+                                uint8_t **pages);
+typedef int (*writepages_type_t)(struct vfs_node *, uint32_t index,
+                                 uint32_t nr, uint8_t **pages);
+typedef int (*reserve_type_t)(struct vfs_node *, uint32_t index);
+typedef void (*unreserve_type_t)(struct vfs_node *, uint32_t nr);
+typedef int (*fsync_type_t)(struct vfs_node *, bool datasync);
+typedef int (*revalidate_type_t)(struct vfs_node *);
 
 typedef struct vfs_node {
   char name[128];
@@ -66,10 +86,11 @@ typedef struct vfs_node {
   uint32_t gid;
   uint32_t flags; // Node type
   uint32_t inode;
-  uint32_t length; // Size of file
+  uint64_t length; // Size of file
   uint32_t impl;   // Implementation-defined
   void *device;    // Optional binding to driver block device or ramfs specific
                    // struct
+  void *fs_inode;  // Filesystem in-core inode, referenced by the node
 
   uint32_t atime; // Access time
   uint32_t mtime; // Modification time
@@ -93,6 +114,16 @@ typedef struct vfs_node {
   chown_type_t chown;
   truncate_type_t truncate;
   mmap_type_t mmap;   // Device-specific mmap handler
+  readpage_type_t readpage; // Fill one 4 KiB page; enables the page cache
+  readpages_type_t readpages; // Optional: fill nr consecutive pages at once
+  writepages_type_t writepages; // Write nr consecutive dirty pages,
+                                // allocating blocks; enables buffered writes
+  reserve_type_t reserve;     // Reserve space for a page without blocks:
+                              // 1 reserved, 0 not needed, -1 no space
+  unreserve_type_t unreserve; // Release nr pages' reservations
+  fsync_type_t fsync;         // Optional: make the file's metadata durable
+  revalidate_type_t revalidate; // Optional: refresh attributes, non-zero if
+                                // the file is gone. Enables the dcache.
   poll_type_t poll;   // Device-specific poll handler
   ioctl_type_t ioctl; // Device-specific ioctl handler
   void *wait_queue;   // Pointer to wait_queue_t for poll() wakeups
@@ -102,18 +133,21 @@ typedef struct vfs_node {
 
   struct vfs_node *ptr; // Used by mountpoints and symlinks
   uint32_t refcount;    // Reference count for memory management
+
+  struct file_ra_state ra; // Readahead window of this open file
 } vfs_node_t;
 
 extern vfs_node_t *fs_root;
 
 // Standard API wrapper functions
-uint32_t vfs_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t vfs_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                   uint8_t *buffer);
-uint32_t vfs_write(vfs_node_t *node, uint32_t offset, uint32_t size,
+uint32_t vfs_write(vfs_node_t *node, uint64_t offset, uint32_t size,
                    uint8_t *buffer);
 void vfs_open(vfs_node_t *node);
 void vfs_close(vfs_node_t *node);
-struct dirent *vfs_readdir(vfs_node_t *node, uint32_t index);
+int vfs_readdir(vfs_node_t *node, uint64_t *pos, struct dirent *buf,
+                uint32_t count);
 vfs_node_t *vfs_finddir(vfs_node_t *node, char *name);
 vfs_node_t *vfs_resolve_path_at(vfs_node_t *dir, const char *path);
 vfs_node_t *vfs_resolve_path(const char *path);
@@ -126,7 +160,10 @@ int vfs_symlink(vfs_node_t *node, char *name, char *target);
 int vfs_rename(vfs_node_t *node, char *old_name, char *new_name);
 int vfs_chmod(vfs_node_t *node, uint16_t permission);
 int vfs_chown(vfs_node_t *node, uint32_t uid, uint32_t gid);
-int vfs_truncate(vfs_node_t *node, uint32_t size);
+int vfs_truncate(vfs_node_t *node, uint64_t size);
+// Write node's dirty pages and metadata (with datasync, only what is needed
+// to read the data back) to the disk. Returns 0 on success.
+int vfs_fsync(vfs_node_t *node, bool datasync);
 int vfs_mknod(vfs_node_t *node, char *name, uint16_t permission, uint32_t flags,
               void *device);
 int vfs_poll(vfs_node_t *node, int events);
@@ -35,6 +35,7 @@
 #include "drivers/usb/uhci.h"
 #include "drivers/usb/usb.h"
 #include "drivers/virtio/virtio.h"
+#include "drivers/virtio/virtio_blk.h"
 #include "drivers/virtio/virtio_gpu.h"
 #include "fb/framebuffer.h"
 #include "fs/ext2.h"
@@ -46,7 +47,10 @@
 #include "io/io.h"
 #include "mm/dma_alloc.h"
 #include "mm/heap.h"
+#include "mm/page_cache.h"
 #include "mm/pmm.h"
+#include "mm/reaper.h"
+#include "mm/tlb.h"
 #include "mm/shm.h"
 #include "mm/slab_cache.h"
 #include "mm/vmm.h"
@@ -357,6 +361,9 @@ void kmain_high_half(void) {
     // ── 5f. Switch ISR EOI routing to LAPIC ─────────────────────────────
     isr_set_apic_mode(true);
 
+    // ── 5g. Cross-CPU TLB shootdown IPIs ────────────────────────────────
+    tlb_init();
+
     // Re-enable interrupts — now handled through the APIC path
     __asm__ volatile("sti");
 
@@ -417,6 +424,9 @@ void kmain_high_half(void) {
   vfs_node_cache =
       kmem_cache_create("vfs_node", sizeof(vfs_node_t), 8, NULL, NULL);
 
+  // File page cache (sized from usable memory)
+  page_cache_init();
+
   // Initialize shared memory subsystem
   shm_init();
   evdev_init();
@@ -442,6 +452,9 @@ void kmain_high_half(void) {
   nvme_init();
   nvme_self_test();
 
+  virtio_blk_init();
+  virtio_blk_self_test();
+
   // ── Mount root filesystem ──
   struct block_device *boot_dev = NULL;
 
@@ -475,9 +488,11 @@ void kmain_high_half(void) {
 
 mount_success:
   klog_puts("[OK] Root filesystem mounted successfully.\n");
-  // Mount /dev and /tmp as in-memory filesystems
-  ramfs_mount_at("/dev");
-  ramfs_mount_at("/tmp");
+  // Mount /dev, /tmp and /dev/shm as in-memory filesystems; the latter two
+  // may fill at most half of RAM each
+  ramfs_mount_at("/dev", 0);
+  ramfs_mount_at("/tmp", pmm_get_usable_memory() / 2);
+  ramfs_mount_at("/dev/shm", pmm_get_usable_memory() / 2);
 
   // Re-populate /dev in the new root
   block_repopulate_devices();
@@ -506,6 +521,18 @@ mount_fail:
     sched_create_kernel_thread(net_thread_entry, cpu_get_info(3), true);
   }
 
+  // Address-space teardown threads (one per online CPU)
+  mm_reaper_init();
+
+  // Periodic writeback of dirty metadata buffers
+  block_cache_init();
+
+  // Background readahead of file pages
+  page_cache_start_readahead();
+
+  // Flusher threads for filesystems with buffered writes
+  page_cache_start_writeback();
+
   // ═══════════════════════════════════════════════════════════════════════
   //  Phase 7: Userland
   // ═══════════════════════════════════════════════════════════════════════
@@ -136,6 +136,17 @@ void *memcpy(void *dest, const void *src, size_t n) {
   return dest;
 }
 
+void *memmove(void *dest, const void *src, size_t n) {
+  unsigned char *d = dest;
+  const unsigned char *s = src;
+  if (d <= s || d >= s + n)
+    return memcpy(dest, src, n);
+  // Overlapping with dest above src: copy backwards
+  while (n--)
+    d[n] = s[n];
+  return dest;
+}
+
 int memcmp(const void *s1, const void *s2, size_t n) {
   const unsigned char *p1 = s1, *p2 = s2;
   while (n--) {
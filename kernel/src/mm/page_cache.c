@@ -0,0 +1,1498 @@
+#include "page_cache.h"
+#include "../apic/lapic_timer.h"
+#include "../console/klog.h"
+#include "../fs/vfs.h"
+#include "../lib/list.h"
+#include "../lib/string.h"
+#include "../lock/spinlock.h"
+#include "../sched/sched.h"
+#include "../sched/wait.h"
+#include "heap.h"
+#include "pmm.h"
+#include <stdbool.h>
+
+// ── Page cache ──────────────────────────────────────────────────────────────
+// File data is kept in 4 KiB PMM frames, grouped per inode. Each inode's
+// mapping is keyed by (filesystem mount, inode number) because VFS nodes are
+// created per lookup and do not outlive the open file; pages therefore
+// survive close() and are shared by every opener of the file.
+//
+// Pages of a mapping are indexed by file page number in a radix tree whose
+// height grows with the largest index. All cached pages sit on one global
+// LRU list; reclaim walks it from the cold end whenever the cache reaches
+// its size cap or the PMM runs low on free pages.
+//
+// Filesystems without a writepages op stay write-through: vfs_write() hits
+// the disk first and then copies the new data into any cached page. The
+// others buffer writes in dirty pages, which reclaim skips; they stay on
+// their mapping until the flusher, fsync() or sync writes them back.
+//
+// Readahead inserts its pages before reading them. Such a page is not
+// uptodate until the fill is done; readers that find it sleep on
+// pc_io_wait instead of issuing a second read of the same data.
+
+#define PC_RADIX_SHIFT 6
+#define PC_RADIX_SLOTS (1U << PC_RADIX_SHIFT)
+#define PC_RADIX_MASK (PC_RADIX_SLOTS - 1)
+#define PC_HASH_BUCKETS 256
+#define PC_RECLAIM_BATCH 32
+#define PC_RA_QUEUE 16          // Readahead windows waiting for the thread
+#define PC_RA_NO_MARKER 0xFFFFFFFFu
+#define PC_WB_MAX 8             // Filesystems with a flusher
+#define PC_WB_BATCH 64          // Pages per writepages() call
+#define PC_WB_CHUNK 1024        // Pages of one file per flusher visit
+#define PC_WB_GANG 16           // Pages per radix gang lookup
+
+struct pc_wb;
+
+struct pc_radix_node {
+  void *slots[PC_RADIX_SLOTS];
+  uint32_t count; // Non-NULL slots
+};
+
+struct pc_mapping {
+  void *fs;
+  uint32_t ino;
+  uint64_t size;      // File size as last seen through the VFS
+  uint64_t seq;       // pc_seq at the last write/truncate
+  uint32_t height;    // 0 = empty tree
+  struct pc_radix_node *root;
+  uint32_t nr_pages;
+  struct list_head pages;
+  struct pc_mapping *hash_next;
+
+  // Writeback state, set up by the first dirtied page
+  uint32_t nr_dirty;
+  uint64_t dirtied_ms;  // When the mapping last went from clean to dirty
+  uint64_t wb_pass;     // Flusher pass that last visited it
+  bool writeback;       // A writeback pass owns the mapping right now
+  vfs_node_t *wb_node;  // Private node that writepages() is called with
+  struct pc_wb *wb;
+  struct list_head dirty_list; // On wb->dirty while nr_dirty > 0
+};
+
+struct pc_page {
+  struct pc_mapping *mapping; // NULL once dropped from the cache
+  uint32_t index;
+  uint64_t phys;
+  uint32_t refs; // One for the cache, one per reader/writer copying
+  bool uptodate;  // Data valid; false while a readahead fill is in flight
+  bool readahead; // Marker: the reader getting here starts the next window
+  bool dirty;     // Newer than the disk
+  bool delalloc;  // Dirty without blocks: space reserved, not allocated
+  struct list_head lru;
+  struct list_head list; // mapping->pages
+};
+
+static spinlock_t pc_lock = SPINLOCK_INIT;
+static struct pc_mapping *pc_hash[PC_HASH_BUCKETS];
+static struct list_head pc_lru = {&pc_lru, &pc_lru};
+static uint64_t pc_seq = 0;
+static size_t pc_max_pages = 0;
+static size_t pc_low_free = 0;
+static struct page_cache_stats stats;
+static wait_queue_t pc_io_wait;
+
+// Readahead work. The thread reads through a private copy of the node so
+// that the opener may close it while the window is still queued.
+struct pc_ra_work {
+  vfs_node_t node;
+  uint32_t index;
+  uint32_t nr;
+  uint32_t marker;
+};
+
+static spinlock_t pc_ra_lock = SPINLOCK_INIT;
+static struct pc_ra_work pc_ra_queue[PC_RA_QUEUE];
+static uint32_t pc_ra_head = 0, pc_ra_tail = 0;
+static struct thread *pc_ra_thread = NULL;
+
+// A filesystem's flusher. Its dirty list and the table are under pc_lock.
+struct pc_wb {
+  void *fs;
+  const char *name;
+  page_cache_sync_fs_t sync_fs;
+  struct thread *thread;
+  struct list_head dirty; // Mappings with dirty pages, oldest first
+  uint64_t pass;
+  uint64_t last_sync_ms;
+};
+
+static struct pc_wb pc_wb_table[PC_WB_MAX];
+static uint32_t pc_wb_count = 0;
+static bool pc_wb_started = false;
+
+void page_cache_init(void) {
+  size_t usable = (size_t)(pmm_get_usable_memory() / PAGE_CACHE_SIZE);
+  pc_max_pages = usable / 2;
+  pc_low_free = usable / 32;
+  if (pc_low_free < 256)
+    pc_low_free = 256;
+  wait_queue_init(&pc_io_wait);
+
+  klog_puts("[PCACHE] Page cache limit ");
+  klog_uint64((uint64_t)pc_max_pages * (PAGE_CACHE_SIZE / 1024));
+  klog_puts(" KiB\n");
+}
+
+static inline uint8_t *pc_page_data(struct pc_page *p) {
+  return (uint8_t *)(p->phys + pmm_get_hhdm_offset());
+}
+
+static inline uint32_t pc_hash_key(void *fs, uint32_t ino) {
+  uint64_t k = (uint64_t)fs ^ ((uint64_t)ino * 0x9E3779B97F4A7C15ULL);
+  return (uint32_t)((k >> 32) ^ k) & (PC_HASH_BUCKETS - 1);
+}
+
+// ── Radix tree ──────────────────────────────────────────────────────────────
+
+static inline uint64_t pc_radix_capacity(uint32_t height) {
+  return 1ULL << (PC_RADIX_SHIFT * height);
+}
+
+static struct pc_page *pc_radix_lookup(struct pc_mapping *m, uint32_t index) {
+  if (m->height == 0 || index >= pc_radix_capacity(m->height))
+    return NULL;
+
+  struct pc_radix_node *n = m->root;
+  for (uint32_t h = m->height; h > 1 && n; h--)
+    n = n->slots[(index >> (PC_RADIX_SHIFT * (h - 1))) & PC_RADIX_MASK];
+  if (!n)
+    return NULL;
+  return n->slots[index & PC_RADIX_MASK];
+}
+
+static void pc_radix_prune(struct pc_mapping *m, uint32_t index);
+
+static struct pc_radix_node *pc_radix_node_alloc(void) {
+  struct pc_radix_node *n = kmalloc(sizeof(struct pc_radix_node));
+  if (n)
+    memset(n, 0, sizeof(*n));
+  return n;
+}
+
+static int pc_radix_insert(struct pc_mapping *m, uint32_t index,
+                           struct pc_page *page) {
+  if (!m->root) {
+    m->root = pc_radix_node_alloc();
+    if (!m->root)
+      return -1;
+    m->height = 1;
+  }
+
+  // Grow upwards until index fits; the old root becomes slot 0.
+  while (index >= pc_radix_capacity(m->height)) {
+    struct pc_radix_node *top = pc_radix_node_alloc();
+    if (!top)
+      return -1;
+    top->slots[0] = m->root;
+    top->count = 1;
+    m->root = top;
+    m->height++;
+  }
+
+  struct pc_radix_node *n = m->root;
+  for (uint32_t h = m->height; h > 1; h--) {
+    uint32_t slot = (index >> (PC_RADIX_SHIFT * (h - 1))) & PC_RADIX_MASK;
+    if (!n->slots[slot]) {
+      n->slots[slot] = pc_radix_node_alloc();
+      if (!n->slots[slot]) {
+        pc_radix_prune(m, index);
+        return -1;
+      }
+      n->count++;
+    }
+    n = n->slots[slot];
+  }
+
+  n->slots[index & PC_RADIX_MASK] = page;
+  n->count++;
+  return 0;
+}
+
+// Collect the nodes on index's path, root first. Returns how many exist.
+static uint32_t pc_radix_path(struct pc_mapping *m, uint32_t index,
+                              struct pc_radix_node **path, uint32_t *slots) {
+  struct pc_radix_node *n = m->root;
+  uint32_t depth = 0;
+  for (uint32_t h = m->height; h >= 1 && n; h--) {
+    path[depth] = n;
+    slots[depth] = (index >> (PC_RADIX_SHIFT * (h - 1))) & PC_RADIX_MASK;
+    n = (h > 1) ? n->slots[slots[depth]] : NULL;
+    depth++;
+  }
+  return depth;
+}
+
+// Free the nodes on index's path that no longer hold anything, bottom-up.
+static void pc_radix_prune(struct pc_mapping *m, uint32_t index) {
+  struct pc_radix_node *path[8];
+  uint32_t slots[8];
+  uint32_t depth = pc_radix_path(m, index, path, slots);
+
+  while (depth > 0) {
+    depth--;
+    if (path[depth]->count > 0)
+      return;
+    kfree(path[depth]);
+    if (depth == 0) {
+      m->root = NULL;
+      m->height = 0;
+    } else {
+      path[depth - 1]->slots[slots[depth - 1]] = NULL;
+      path[depth - 1]->count--;
+    }
+  }
+}
+
+static void pc_radix_delete(struct pc_mapping *m, uint32_t index) {
+  if (m->height == 0 || index >= pc_radix_capacity(m->height))
+    return;
+
+  struct pc_radix_node *path[8];
+  uint32_t slots[8];
+  uint32_t depth = pc_radix_path(m, index, path, slots);
+  if (depth != m->height)
+    return;
+
+  struct pc_radix_node *leaf = path[depth - 1];
+  if (!leaf->slots[slots[depth - 1]])
+    return;
+  leaf->slots[slots[depth - 1]] = NULL;
+  leaf->count--;
+  pc_radix_prune(m, index);
+}
+
+static uint32_t pc_radix_gang_node(struct pc_radix_node *n, uint32_t height,
+                                   uint64_t base, uint32_t start,
+                                   struct pc_page **out, uint32_t max) {
+  uint64_t span = pc_radix_capacity(height - 1);
+  uint32_t got = 0;
+  for (uint32_t i = 0; i < PC_RADIX_SLOTS && got < max; i++) {
+    uint64_t first = base + i * span;
+    if (!n->slots[i] || first + span <= start)
+      continue;
+    if (height == 1)
+      out[got++] = n->slots[i];
+    else
+      got += pc_radix_gang_node(n->slots[i], height - 1, first, start,
+                                out + got, max - got);
+  }
+  return got;
+}
+
+// Up to max cached pages with index >= start, in index order.
+static uint32_t pc_radix_gang(struct pc_mapping *m, uint32_t start,
+                              struct pc_page **out, uint32_t max) {
+  if (m->height == 0 || start >= pc_radix_capacity(m->height))
+    return 0;
+  return pc_radix_gang_node(m->root, m->height, 0, start, out, max);
+}
+
+// ── Mappings and pages (pc_lock held) ───────────────────────────────────────
+
+static struct pc_mapping *pc_mapping_find(void *fs, uint32_t ino) {
+  struct pc_mapping *m = pc_hash[pc_hash_key(fs, ino)];
+  while (m && (m->fs != fs || m->ino != ino))
+    m = m->hash_next;
+  return m;
+}
+
+static struct pc_mapping *pc_mapping_get(void *fs, uint32_t ino,
+                                         uint64_t size) {
+  struct pc_mapping *m = pc_mapping_find(fs, ino);
+  if (m)
+    return m;
+
+  m = kmalloc(sizeof(struct pc_mapping));
+  if (!m)
+    return NULL;
+  memset(m, 0, sizeof(*m));
+  m->fs = fs;
+  m->ino = ino;
+  m->size = size;
+  m->seq = ++pc_seq;
+  INIT_LIST_HEAD(&m->pages);
+
+  uint32_t b = pc_hash_key(fs, ino);
+  m->hash_next = pc_hash[b];
+  pc_hash[b] = m;
+  return m;
+}
+
+static void pc_mapping_unhash(struct pc_mapping *m) {
+  struct pc_mapping **pp = &pc_hash[pc_hash_key(m->fs, m->ino)];
+  while (*pp && *pp != m)
+    pp = &(*pp)->hash_next;
+  if (*pp)
+    *pp = m->hash_next;
+}
+
+static void pc_page_set_dirty(struct pc_page *p) {
+  struct pc_mapping *m = p->mapping;
+  if (p->dirty)
+    return;
+  p->dirty = true;
+  stats.dirty++;
+  if (m->nr_dirty++ == 0) {
+    m->dirtied_ms = lapic_timer_get_ms();
+    list_add_tail(&m->dirty_list, &m->wb->dirty);
+  }
+}
+
+static void pc_page_clear_dirty(struct pc_page *p) {
+  struct pc_mapping *m = p->mapping;
+  if (!p->dirty)
+    return;
+  p->dirty = false;
+  stats.dirty--;
+  if (--m->nr_dirty == 0)
+    list_del(&m->dirty_list);
+}
+
+// Private copy of an open file's node for writeback, which may happen long
+// after the opener closed it. Like dcache_clone(), the copy takes its own
+// in-core inode reference when the filesystem needs one.
+static vfs_node_t *pc_node_clone(vfs_node_t *src) {
+  vfs_node_t *node = kmalloc(sizeof(vfs_node_t));
+  if (!node)
+    return NULL;
+  memcpy(node, src, sizeof(vfs_node_t));
+  node->fs_inode = NULL;
+  node->refcount = 0;
+  INIT_LIST_HEAD(&node->ep_watchers);
+  spinlock_init(&node->ep_lock);
+  memset(&node->ra, 0, sizeof(node->ra));
+  return node;
+}
+
+// Closing may call into the filesystem: never under pc_lock.
+static void pc_node_put(vfs_node_t *node) {
+  if (!node)
+    return;
+  if (node->close)
+    node->close(node);
+  kfree(node);
+}
+
+// A mapping left clean gives up its writeback node. Returns the node for
+// pc_node_put() once pc_lock is dropped.
+static vfs_node_t *pc_mapping_put_node(struct pc_mapping *m) {
+  if (m->nr_dirty || m->writeback)
+    return NULL;
+  vfs_node_t *node = m->wb_node;
+  m->wb_node = NULL;
+  return node;
+}
+
+static void pc_page_release(struct pc_page *p) {
+  if (--p->refs > 0)
+    return;
+  pmm_free_page((void *)p->phys);
+  kfree(p);
+}
+
+// Drop the cache's reference. Readers still copying keep the frame alive.
+static void pc_page_remove(struct pc_page *p) {
+  struct pc_mapping *m = p->mapping;
+  pc_page_clear_dirty(p);
+  pc_radix_delete(m, p->index);
+  list_del(&p->list);
+  list_del(&p->lru);
+  m->nr_pages--;
+  stats.pages--;
+  p->mapping = NULL;
+  pc_page_release(p);
+}
+
+// Free a mapping that reclaim emptied, unless writeback still needs it.
+// Anyone holding it across an unlock looks it up again and compares seq,
+// which a re-created mapping starts above.
+static void pc_mapping_reap(struct pc_mapping *m) {
+  if (m->nr_pages || m->nr_dirty || m->writeback || m->wb_node)
+    return;
+  pc_mapping_unhash(m);
+  kfree(m);
+}
+
+static size_t pc_evict(size_t nr) {
+  size_t freed = 0;
+  struct list_head *pos = pc_lru.prev;
+  while (pos != &pc_lru && freed < nr) {
+    struct pc_page *p = list_entry(pos, struct pc_page, lru);
+    pos = pos->prev;
+    if (p->refs > 1 || p->dirty)
+      continue; // Being copied right now, or not written back yet
+    struct pc_mapping *m = p->mapping;
+    pc_page_remove(p);
+    pc_mapping_reap(m);
+    freed++;
+  }
+  stats.evictions += freed;
+  return freed;
+}
+
+// ── Lookup / fill ───────────────────────────────────────────────────────────
+
+static void pc_put(struct pc_page *p) {
+  spinlock_acquire(&pc_lock);
+  pc_page_release(p);
+  spinlock_release(&pc_lock);
+}
+
+// Wait once on pc_io_wait, which is woken when a fill or a writeback pass
+// ends. Called and returns with pc_lock held; callers recheck what they
+// were waiting for.
+static void pc_sleep(void) {
+  struct thread *self = sched_get_current();
+  if (!self || self->is_idle) {
+    spinlock_release(&pc_lock);
+    __asm__ volatile("pause");
+    spinlock_acquire(&pc_lock);
+    return;
+  }
+  // BLOCKED is published under pc_lock, which the filler needs to mark
+  // the page: its wakeup cannot be missed.
+  wait_queue_entry_t entry = {.thread = self, .next = NULL};
+  wait_queue_add(&pc_io_wait, &entry);
+  self->state = THREAD_BLOCKED;
+  spinlock_release(&pc_lock);
+  sched_yield();
+  wait_queue_remove(&pc_io_wait, &entry);
+  spinlock_acquire(&pc_lock);
+}
+
+// Sleep until the readahead fill of p (referenced by the caller) is over.
+// Called and returns with pc_lock held. False if the fill failed or the
+// page was dropped meanwhile.
+static bool pc_wait_page(struct pc_page *p) {
+  while (!p->uptodate && p->mapping)
+    pc_sleep();
+  return p->uptodate;
+}
+
+// Cached page index of node with a reference held, or NULL. Waits for a
+// fill in flight. *marker is set (and the page's marker cleared) if the
+// page starts the next readahead window.
+static struct pc_page *pc_lookup(vfs_node_t *node, uint32_t index,
+                                 bool *marker) {
+  spinlock_acquire(&pc_lock);
+  struct pc_mapping *m = pc_mapping_find(node->device, node->inode);
+  struct pc_page *p = m ? pc_radix_lookup(m, index) : NULL;
+  if (!p) {
+    spinlock_release(&pc_lock);
+    return NULL;
+  }
+  p->refs++;
+  list_del(&p->lru);
+  list_add(&p->lru, &pc_lru);
+  stats.hits++;
+  if (p->readahead && marker) {
+    p->readahead = false;
+    *marker = true;
+  }
+  if (!pc_wait_page(p)) {
+    pc_page_release(p);
+    p = NULL;
+  }
+  spinlock_release(&pc_lock);
+  return p;
+}
+
+// Return page index of node with a reference held, reading it on a miss.
+static struct pc_page *pc_get(vfs_node_t *node, uint32_t index) {
+  struct pc_page *p = pc_lookup(node, index, NULL);
+  if (p)
+    return p;
+
+  spinlock_acquire(&pc_lock);
+  struct pc_mapping *m = pc_mapping_get(node->device, node->inode,
+                                        node->length);
+  stats.misses++;
+  uint64_t seq = pc_seq;
+  if (stats.pages >= pc_max_pages || pmm_get_free_pages() < pc_low_free)
+    pc_evict(PC_RECLAIM_BATCH);
+  spinlock_release(&pc_lock);
+  if (!m)
+    return NULL;
+
+  p = kmalloc(sizeof(struct pc_page));
+  if (!p)
+    return NULL;
+  void *frame = pmm_alloc_page();
+  if (!frame) {
+    kfree(p);
+    return NULL;
+  }
+  p->mapping = NULL;
+  p->index = index;
+  p->phys = (uint64_t)frame;
+  p->refs = 1;
+  p->uptodate = true;
+  p->readahead = false;
+  p->dirty = false;
+  p->delalloc = false;
+
+  if (node->readpage(node, index, pc_page_data(p)) != 0) {
+    pmm_free_page(frame);
+    kfree(p);
+    return NULL;
+  }
+
+  spinlock_acquire(&pc_lock);
+  m = pc_mapping_find(node->device, node->inode);
+  if (!m || m->seq > seq) {
+    // Written, truncated or unlinked while we were reading: the data is
+    // good enough for this read but must not be cached.
+    spinlock_release(&pc_lock);
+    return p;
+  }
+
+  struct pc_page *raced = pc_radix_lookup(m, index);
+  if (raced) {
+    raced->refs++;
+    if (pc_wait_page(raced)) {
+      spinlock_release(&pc_lock);
+      pmm_free_page(frame);
+      kfree(p);
+      return raced;
+    }
+    pc_page_release(raced);
+    spinlock_release(&pc_lock);
+    return p; // Its fill failed; ours did not
+  }
+
+  if (pc_radix_insert(m, index, p) == 0) {
+    p->mapping = m;
+    p->refs++;
+    list_add(&p->list, &m->pages);
+    list_add(&p->lru, &pc_lru);
+    m->nr_pages++;
+    stats.pages++;
+  }
+  spinlock_release(&pc_lock);
+  return p;
+}
+
+// Mark the pages of a finished fill (pc_lock held) and drop the filler's
+// reference. Pages whose read failed, or whose file changed under the
+// read, leave the cache; their waiters fall back to pc_get().
+static void pc_fill_done(struct pc_page **pages, uint32_t nr, uint64_t seq,
+                         int err) {
+  for (uint32_t i = 0; i < nr; i++) {
+    struct pc_page *p = pages[i];
+    if (p->mapping) {
+      if (err || p->mapping->seq > seq) {
+        pc_page_remove(p);
+      } else {
+        p->uptodate = true;
+        stats.readahead++;
+      }
+    }
+    pc_page_release(p);
+  }
+}
+
+// Bring pages [index, index + nr) of node into the cache. Pages already
+// cached are skipped; every run of missing pages is inserted first (not
+// uptodate) and then read with one readpages() call, or one readpage() per
+// page. The page at marker, if it is read here, becomes the trigger for
+// the next window.
+static void pc_fill_range(vfs_node_t *node, uint32_t index, uint32_t nr,
+                          uint32_t marker) {
+  uint64_t end = (node->length + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+  if (index >= end)
+    return;
+  if (nr > end - index)
+    nr = end - index;
+  if (nr > PAGE_CACHE_RA_MAX_PAGES)
+    nr = PAGE_CACHE_RA_MAX_PAGES;
+
+  struct pc_page **pages = kmalloc(nr * sizeof(struct pc_page *));
+  uint8_t **bufs = kmalloc(nr * sizeof(uint8_t *));
+  if (!pages || !bufs)
+    goto out;
+
+  spinlock_acquire(&pc_lock);
+  struct pc_mapping *m = pc_mapping_get(node->device, node->inode,
+                                        node->length);
+  uint64_t seq = pc_seq;
+  if (stats.pages + nr > pc_max_pages ||
+      pmm_get_free_pages() < pc_low_free + nr)
+    pc_evict(nr > PC_RECLAIM_BATCH ? nr : PC_RECLAIM_BATCH);
+  spinlock_release(&pc_lock);
+  if (!m)
+    goto out;
+
+  uint32_t i = 0;
+  while (i < nr) {
+    // Collect the next run of pages not in the cache
+    uint32_t run = 0;
+    spinlock_acquire(&pc_lock);
+    if (pc_mapping_find(node->device, node->inode) != m || m->seq > seq) {
+      spinlock_release(&pc_lock);
+      break; // Changed under us: the rest is read on demand
+    }
+    while (i < nr && pc_radix_lookup(m, index + i))
+      i++;
+    spinlock_release(&pc_lock);
+
+    bool stop = false;
+    while (i + run < nr) {
+      struct pc_page *p = kmalloc(sizeof(struct pc_page));
+      void *frame = p ? pmm_alloc_page() : NULL;
+      if (!frame) {
+        kfree(p);
+        stop = true;
+        break;
+      }
+      p->mapping = NULL;
+      p->index = index + i + run;
+      p->phys = (uint64_t)frame;
+      p->refs = 1;
+      p->uptodate = false;
+      p->readahead = p->index == marker;
+      p->dirty = false;
+      p->delalloc = false;
+
+      spinlock_acquire(&pc_lock);
+      bool live = pc_mapping_find(node->device, node->inode) == m &&
+                  m->seq <= seq;
+      bool inserted = live && !pc_radix_lookup(m, p->index) &&
+                      pc_radix_insert(m, p->index, p) == 0;
+      if (inserted) {
+        p->mapping = m;
+        p->refs++;
+        list_add(&p->list, &m->pages);
+        list_add(&p->lru, &pc_lru);
+        m->nr_pages++;
+        stats.pages++;
+      }
+      spinlock_release(&pc_lock);
+      if (!inserted) {
+        pmm_free_page(frame);
+        kfree(p);
+        stop = !live;
+        break;
+      }
+      pages[run] = p;
+      bufs[run] = pc_page_data(p);
+      run++;
+    }
+    if (run == 0) {
+      if (stop)
+        break;
+      i++; // Cached by someone else since we looked
+      continue;
+    }
+
+    int err = 0;
+    if (node->readpages) {
+      err = node->readpages(node, index + i, run, bufs);
+    } else {
+      for (uint32_t j = 0; j < run && !err; j++)
+        err = node->readpage(node, index + i + j, bufs[j]);
+    }
+
+    spinlock_acquire(&pc_lock);
+    pc_fill_done(pages, run, seq, err);
+    spinlock_release(&pc_lock);
+    wait_queue_wake_all(&pc_io_wait);
+    i += run;
+  }
+
+out:
+  kfree(pages);
+  kfree(bufs);
+}
+
+// ── Readahead ───────────────────────────────────────────────────────────────
+
+static void pc_ra_thread_entry(void) {
+  static struct pc_ra_work work_buf;
+  struct pc_ra_work *work = &work_buf;
+  struct thread *self = sched_get_current();
+  while (1) {
+    spinlock_acquire(&pc_ra_lock);
+    if (pc_ra_head == pc_ra_tail) {
+      // Publish BLOCKED under the queue lock so pc_ra_submit() either sees
+      // it and wakes us, or we see its window on the next pass.
+      self->state = THREAD_BLOCKED;
+      spinlock_release(&pc_ra_lock);
+      sched_yield();
+      continue;
+    }
+    memcpy(work, &pc_ra_queue[pc_ra_head % PC_RA_QUEUE], sizeof(*work));
+    pc_ra_head++;
+    spinlock_release(&pc_ra_lock);
+
+    pc_fill_range(&work->node, work->index, work->nr, work->marker);
+  }
+}
+
+void page_cache_start_readahead(void) {
+  struct thread *t = sched_create_kernel_thread(pc_ra_thread_entry, NULL,
+                                                true);
+  if (!t) {
+    klog_puts("[PCACHE] Failed to start readahead thread\n");
+    return;
+  }
+  spinlock_acquire(&pc_ra_lock);
+  pc_ra_thread = t;
+  spinlock_release(&pc_ra_lock);
+}
+
+// Hand a window to the readahead thread. Readahead is only a hint: when the
+// queue is full the window is dropped and read on demand instead.
+static void pc_ra_submit(vfs_node_t *node, uint32_t index, uint32_t nr,
+                         uint32_t marker) {
+  spinlock_acquire(&pc_ra_lock);
+  if (!pc_ra_thread) {
+    spinlock_release(&pc_ra_lock);
+    pc_fill_range(node, index, nr, marker);
+    return;
+  }
+  if (pc_ra_tail - pc_ra_head < PC_RA_QUEUE) {
+    struct pc_ra_work *w = &pc_ra_queue[pc_ra_tail % PC_RA_QUEUE];
+    memcpy(&w->node, node, sizeof(vfs_node_t));
+    w->index = index;
+    w->nr = nr;
+    w->marker = marker;
+    pc_ra_tail++;
+    if (pc_ra_thread->state == THREAD_BLOCKED)
+      pc_ra_thread->state = THREAD_READY;
+  }
+  spinlock_release(&pc_ra_lock);
+}
+
+static uint32_t pc_ra_max(struct file_ra_state *ra) {
+  uint32_t max = ra->max_pages ? ra->max_pages : PAGE_CACHE_RA_DEFAULT_PAGES;
+  // One stream never gets more than an eighth of the cache
+  if (pc_max_pages && max > pc_max_pages / 8)
+    max = (uint32_t)(pc_max_pages / 8);
+  if (max < PAGE_CACHE_RA_MIN_PAGES)
+    max = PAGE_CACHE_RA_MIN_PAGES;
+  return max;
+}
+
+// First window for a read of req pages: a few times the request while it
+// is small compared to the cap.
+static uint32_t pc_ra_init_size(uint32_t req, uint32_t max) {
+  uint32_t size = PAGE_CACHE_RA_MIN_PAGES;
+  while (size < req && size < max)
+    size <<= 1;
+  if (size <= max / 32)
+    size *= 4;
+  else if (size <= max / 4)
+    size *= 2;
+  return size < max ? size : max;
+}
+
+static uint32_t pc_ra_next_size(uint32_t cur, uint32_t max) {
+  uint32_t size = cur < max / 16 ? cur * 4 : cur * 2;
+  return size < max ? size : max;
+}
+
+// Cache miss at index for a read of req pages. The pages asked for are read
+// now; in a sequential stream the rest of a new window goes to the thread.
+static void pc_ra_sync(vfs_node_t *node, struct file_ra_state *ra,
+                       uint32_t index, uint32_t req) {
+  uint32_t max = pc_ra_max(ra);
+  if (req > max)
+    req = max;
+
+  bool sequential = index == 0 || index == ra->prev_index ||
+                    index == ra->prev_index + 1;
+  if ((ra->flags & FILE_RA_RANDOM) || !sequential) {
+    ra->size = 0;
+    ra->async_size = 0;
+    pc_fill_range(node, index, req, PC_RA_NO_MARKER);
+    return;
+  }
+
+  ra->start = index;
+  ra->size = pc_ra_init_size(req, max);
+  ra->async_size = ra->size > req ? ra->size - req : ra->size;
+  uint32_t marker = ra->start + ra->size - ra->async_size;
+  if (marker == index) {
+    pc_fill_range(node, index, ra->size, marker);
+    return;
+  }
+  pc_fill_range(node, index, req, PC_RA_NO_MARKER);
+  pc_ra_submit(node, marker, ra->async_size, marker);
+}
+
+// The reader reached the marker page at index: queue the next window.
+static void pc_ra_async(vfs_node_t *node, struct file_ra_state *ra,
+                        uint32_t index, uint32_t req) {
+  if (ra->flags & FILE_RA_RANDOM)
+    return;
+  uint32_t max = pc_ra_max(ra);
+  if (ra->size && index == ra->start + ra->size - ra->async_size) {
+    ra->start += ra->size;
+    ra->size = pc_ra_next_size(ra->size, max);
+  } else {
+    // Another opener's marker, or a window we lost track of
+    ra->start = index + 1;
+    ra->size = pc_ra_init_size(req, max);
+  }
+  ra->async_size = ra->size;
+  pc_ra_submit(node, ra->start, ra->size, ra->start);
+}
+
+void page_cache_readahead(vfs_node_t *node, uint64_t offset, uint64_t len) {
+  if (!node || !node->readpage || offset >= node->length)
+    return;
+  if (len == 0 || len > node->length - offset)
+    len = node->length - offset;
+
+  uint32_t index = (uint32_t)(offset >> PAGE_CACHE_SHIFT);
+  uint32_t end = (uint32_t)((offset + len - 1) >> PAGE_CACHE_SHIFT);
+  // WILLNEED of a huge file must not flush the whole cache
+  uint32_t cap = (uint32_t)(pc_max_pages / 4);
+  if (end - index >= cap)
+    end = index + cap - 1;
+  while (index <= end) {
+    uint32_t nr = end - index + 1;
+    if (nr > PAGE_CACHE_RA_MAX_PAGES)
+      nr = PAGE_CACHE_RA_MAX_PAGES;
+    pc_ra_submit(node, index, nr, PC_RA_NO_MARKER);
+    index += nr;
+  }
+}
+
+// Drop the clean, unused pages of [offset, offset + len) (len 0: to EOF).
+static void pc_drop_range(vfs_node_t *node, uint64_t offset, uint64_t len) {
+  uint64_t first = offset >> PAGE_CACHE_SHIFT;
+  uint64_t last = len ? (offset + len - 1) >> PAGE_CACHE_SHIFT : 0xFFFFFFFFu;
+  spinlock_acquire(&pc_lock);
+  struct pc_mapping *m = pc_mapping_find(node->device, node->inode);
+  if (m) {
+    struct list_head *pos, *n;
+    list_for_each_safe(pos, n, &m->pages) {
+      struct pc_page *p = list_entry(pos, struct pc_page, list);
+      if (p->index >= first && p->index <= last && p->uptodate &&
+          !p->dirty && p->refs == 1)
+        pc_page_remove(p);
+    }
+    pc_mapping_reap(m);
+  }
+  spinlock_release(&pc_lock);
+}
+
+int page_cache_advise(vfs_node_t *node, uint64_t offset, uint64_t len,
+                      int advice) {
+  struct file_ra_state *ra = &node->ra;
+  switch (advice) {
+  case PAGE_CACHE_ADV_NORMAL:
+    ra->flags &= ~FILE_RA_RANDOM;
+    ra->max_pages = 0;
+    return 0;
+  case PAGE_CACHE_ADV_RANDOM:
+    ra->flags |= FILE_RA_RANDOM;
+    ra->size = 0;
+    return 0;
+  case PAGE_CACHE_ADV_SEQUENTIAL:
+    ra->flags &= ~FILE_RA_RANDOM;
+    ra->max_pages = PAGE_CACHE_RA_MAX_PAGES;
+    return 0;
+  case PAGE_CACHE_ADV_WILLNEED:
+    page_cache_readahead(node, offset, len);
+    return 0;
+  case PAGE_CACHE_ADV_DONTNEED:
+    if (node->readpage)
+      pc_drop_range(node, offset, len);
+    return 0;
+  case PAGE_CACHE_ADV_NOREUSE:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+uint32_t page_cache_read(vfs_node_t *node, uint64_t offset, uint32_t size,
+                         uint8_t *buffer) {
+  spinlock_acquire(&pc_lock);
+  struct pc_mapping *m = pc_mapping_get(node->device, node->inode,
+                                        node->length);
+  uint64_t file_size = m ? m->size : node->length;
+  spinlock_release(&pc_lock);
+
+  // Another opener may have grown the file; readpage() of filesystems that
+  // trust node->length must see the new size.
+  node->length = file_size;
+
+  if (offset >= file_size)
+    return 0;
+  if (size > file_size - offset)
+    size = file_size - offset;
+
+  struct file_ra_state *ra = &node->ra;
+  uint32_t last = (uint32_t)((offset + size - 1) >> PAGE_CACHE_SHIFT);
+  uint32_t done = 0;
+  while (done < size) {
+    uint64_t pos = offset + done;
+    uint32_t index = (uint32_t)(pos >> PAGE_CACHE_SHIFT);
+    uint32_t in_page = pos & (PAGE_CACHE_SIZE - 1);
+    uint32_t n = PAGE_CACHE_SIZE - in_page;
+    if (n > size - done)
+      n = size - done;
+
+    bool marker = false;
+    struct pc_page *p = pc_lookup(node, index, &marker);
+    if (!p) {
+      pc_ra_sync(node, ra, index, last - index + 1);
+      p = pc_lookup(node, index, &marker);
+    }
+    if (!p)
+      p = pc_get(node, index);
+    if (!p) {
+      // Out of memory: fall back to reading the rest straight through,
+      // once the disk has caught up with any dirty pages.
+      if (node->writepages)
+        page_cache_fsync(node);
+      return done + node->read(node, pos, size - done, buffer + done);
+    }
+    if (marker)
+      pc_ra_async(node, ra, index, last - index + 1);
+    memcpy(buffer + done, pc_page_data(p) + in_page, n);
+    pc_put(p);
+    done += n;
+  }
+  ra->prev_index = last;
+  return done;
+}
+
+void page_cache_write(vfs_node_t *node, uint64_t offset, uint32_t size,
+                      const uint8_t *buffer) {
+  uint32_t done = 0;
+  while (done < size) {
+    uint64_t pos = offset + done;
+    uint32_t in_page = pos & (PAGE_CACHE_SIZE - 1);
+    uint32_t n = PAGE_CACHE_SIZE - in_page;
+    if (n > size - done)
+      n = size - done;
+
+    spinlock_acquire(&pc_lock);
+    struct pc_mapping *m = pc_mapping_get(node->device, node->inode,
+                                          node->length);
+    struct pc_page *p = NULL;
+    if (m) {
+      m->size = node->length;
+      m->seq = ++pc_seq;
+      p = pc_radix_lookup(m, (uint32_t)(pos >> PAGE_CACHE_SHIFT));
+      if (p)
+        p->refs++;
+    }
+    spinlock_release(&pc_lock);
+
+    if (p) {
+      memcpy(pc_page_data(p) + in_page, buffer + done, n);
+      pc_put(p);
+    }
+    done += n;
+  }
+}
+
+// ── Writeback ───────────────────────────────────────────────────────────────
+
+static struct pc_wb *pc_wb_find(void *fs) {
+  for (uint32_t i = 0; i < pc_wb_count; i++) {
+    if (pc_wb_table[i].fs == fs)
+      return &pc_wb_table[i];
+  }
+  return NULL;
+}
+
+static uint64_t pc_dirty_limit(uint32_t ratio) {
+  return (uint64_t)pc_max_pages * ratio / 100;
+}
+
+// The next run of consecutive dirty pages at or after *cursor, at most max
+// long. *cursor moves past what was looked at. Returns the run length.
+static uint32_t pc_dirty_run(struct pc_mapping *m, uint32_t *cursor,
+                             struct pc_page **run, uint32_t max) {
+  struct pc_page *gang[PC_WB_GANG];
+  uint32_t nr = 0;
+  while (1) {
+    uint32_t got = pc_radix_gang(m, *cursor, gang, PC_WB_GANG);
+    if (got == 0)
+      return nr;
+    for (uint32_t i = 0; i < got; i++) {
+      struct pc_page *p = gang[i];
+      if (nr && (!p->dirty || p->index != run[nr - 1]->index + 1))
+        return nr;
+      *cursor = p->index + 1;
+      if (!p->dirty)
+        continue;
+      run[nr++] = p;
+      if (nr == max)
+        return nr;
+    }
+  }
+}
+
+// Write up to max dirty pages of inode ino on fs back, in index order and
+// in runs of consecutive pages. Passes over one mapping are serialized by
+// m->writeback, which truncate and invalidate wait for, so the mapping
+// stays valid while pc_lock is dropped for the I/O. A page is marked clean
+// before it is written: one dirtied again meanwhile is written next time.
+// Returns 0, or -1 if writepages() failed (those pages stay dirty).
+static int pc_writeback(void *fs, uint32_t ino, uint32_t max) {
+  struct pc_page *run[PC_WB_BATCH];
+  uint8_t *bufs[PC_WB_BATCH];
+  uint32_t cursor = 0, done = 0;
+  int ret = 0;
+
+  spinlock_acquire(&pc_lock);
+  struct pc_mapping *m;
+  while ((m = pc_mapping_find(fs, ino)) && m->writeback)
+    pc_sleep();
+  if (!m || m->nr_dirty == 0) {
+    spinlock_release(&pc_lock);
+    return 0;
+  }
+  m->writeback = true;
+  vfs_node_t *node = m->wb_node;
+
+  while (m->nr_dirty && done < max) {
+    uint32_t want = max - done < PC_WB_BATCH ? max - done : PC_WB_BATCH;
+    uint32_t nr = pc_dirty_run(m, &cursor, run, want);
+    if (nr == 0)
+      break;
+    for (uint32_t i = 0; i < nr; i++) {
+      run[i]->refs++;
+      pc_page_clear_dirty(run[i]);
+      bufs[i] = pc_page_data(run[i]);
+    }
+    spinlock_release(&pc_lock);
+
+    int err = node->writepages(node, run[0]->index, nr, bufs);
+
+    spinlock_acquire(&pc_lock);
+    uint32_t allocated = 0;
+    for (uint32_t i = 0; i < nr; i++) {
+      struct pc_page *p = run[i];
+      if (err) {
+        if (p->mapping)
+          pc_page_set_dirty(p);
+      } else if (p->delalloc) {
+        p->delalloc = false;
+        allocated++;
+      }
+      pc_page_release(p);
+    }
+    if (err) {
+      ret = -1;
+      break;
+    }
+    stats.writeback += nr;
+    done += nr;
+    if (allocated && node->unreserve) {
+      // The blocks exist now: give back what was held for them
+      spinlock_release(&pc_lock);
+      node->unreserve(node, allocated);
+      spinlock_acquire(&pc_lock);
+    }
+  }
+
+  m->writeback = false;
+  vfs_node_t *dead = pc_mapping_put_node(m);
+  spinlock_release(&pc_lock);
+  wait_queue_wake_all(&pc_io_wait);
+  pc_node_put(dead);
+  return ret;
+}
+
+// One flusher pass over wb's files: the expired ones, all of them while
+// dirty pages are over the background limit, or all of them for a sync.
+// Each file is visited at most once per pass, so a writer that keeps
+// dirtying one cannot hold the flusher there.
+static int pc_flush(struct pc_wb *wb, bool all) {
+  int ret = 0;
+  uint64_t now = lapic_timer_get_ms();
+
+  spinlock_acquire(&pc_lock);
+  uint64_t pass = ++wb->pass;
+  while (1) {
+    bool over = stats.dirty > pc_dirty_limit(PAGE_CACHE_DIRTY_BG_RATIO);
+    struct pc_mapping *victim = NULL;
+    struct list_head *pos;
+    list_for_each(pos, &wb->dirty) {
+      struct pc_mapping *m = list_entry(pos, struct pc_mapping, dirty_list);
+      if (m->wb_pass == pass)
+        continue;
+      if (all || over || m->dirtied_ms + PAGE_CACHE_DIRTY_EXPIRE_MS <= now) {
+        victim = m;
+        break;
+      }
+    }
+    if (!victim)
+      break;
+    victim->wb_pass = pass;
+    void *fs = victim->fs;
+    uint32_t ino = victim->ino;
+    spinlock_release(&pc_lock);
+
+    if (pc_writeback(fs, ino, all ? 0xFFFFFFFFu : PC_WB_CHUNK) != 0)
+      ret = -1;
+
+    spinlock_acquire(&pc_lock);
+  }
+  bool sync = all || wb->last_sync_ms + PAGE_CACHE_DIRTY_EXPIRE_MS <= now;
+  if (sync)
+    wb->last_sync_ms = now;
+  spinlock_release(&pc_lock);
+
+  // Inodes and allocation metadata the writeback changed follow the data
+  if (sync && wb->sync_fs && wb->sync_fs(wb->fs, all) != 0)
+    ret = -1;
+  return ret;
+}
+
+static void pc_flusher_entry(void) {
+  struct thread *self = sched_get_current();
+  struct pc_wb *wb = NULL;
+  spinlock_acquire(&pc_lock);
+  for (uint32_t i = 0; i < pc_wb_count; i++) {
+    if (pc_wb_table[i].thread == self)
+      wb = &pc_wb_table[i];
+  }
+  spinlock_release(&pc_lock);
+
+  while (1) {
+    self->wakeup_ticks = lapic_timer_get_ticks() + PAGE_CACHE_WRITEBACK_MS;
+    self->state = THREAD_BLOCKED;
+    sched_yield();
+    if (wb)
+      pc_flush(wb, false);
+  }
+}
+
+// Wake wb's flusher ahead of its timer.
+static void pc_wb_kick(struct pc_wb *wb) {
+  spinlock_acquire(&pc_lock);
+  struct thread *t = wb->thread;
+  if (t && t->state == THREAD_BLOCKED)
+    t->state = THREAD_READY;
+  spinlock_release(&pc_lock);
+}
+
+static void pc_wb_start(struct pc_wb *wb) {
+  // Not enqueued before wb->thread is set: the thread looks itself up
+  struct thread *t = sched_create_kernel_thread(pc_flusher_entry, NULL,
+                                                false);
+  if (!t) {
+    klog_puts("[PCACHE] Failed to start flusher for ");
+    klog_puts(wb->name);
+    klog_puts("\n");
+    return;
+  }
+  spinlock_acquire(&pc_lock);
+  wb->thread = t;
+  spinlock_release(&pc_lock);
+  sched_enqueue_thread(t, NULL);
+
+  klog_puts("[PCACHE] Flusher for ");
+  klog_puts(wb->name);
+  klog_puts(" every ");
+  klog_uint64(PAGE_CACHE_WRITEBACK_MS);
+  klog_puts(" ms\n");
+}
+
+int page_cache_register_fs(void *fs, const char *name,
+                           page_cache_sync_fs_t sync_fs) {
+  spinlock_acquire(&pc_lock);
+  if (pc_wb_find(fs)) {
+    spinlock_release(&pc_lock);
+    return 0;
+  }
+  if (pc_wb_count == PC_WB_MAX) {
+    spinlock_release(&pc_lock);
+    klog_puts("[PCACHE] No flusher slot left, writes stay synchronous\n");
+    return -1;
+  }
+  struct pc_wb *wb = &pc_wb_table[pc_wb_count];
+  memset(wb, 0, sizeof(*wb));
+  wb->fs = fs;
+  wb->name = name;
+  wb->sync_fs = sync_fs;
+  INIT_LIST_HEAD(&wb->dirty);
+  pc_wb_count++;
+  bool start = pc_wb_started;
+  spinlock_release(&pc_lock);
+
+  if (start)
+    pc_wb_start(wb);
+  return 0;
+}
+
+void page_cache_start_writeback(void) {
+  spinlock_acquire(&pc_lock);
+  pc_wb_started = true;
+  uint32_t count = pc_wb_count;
+  spinlock_release(&pc_lock);
+
+  for (uint32_t i = 0; i < count; i++)
+    pc_wb_start(&pc_wb_table[i]);
+}
+
+bool page_cache_is_writeback_fs(void *fs) {
+  spinlock_acquire(&pc_lock);
+  bool found = pc_wb_find(fs) != NULL;
+  spinlock_release(&pc_lock);
+  return found;
+}
+
+// Page index of node, referenced and uptodate, to be written into. A page
+// the write covers completely (whole), or one past EOF, is not read first.
+// NULL if memory runs out.
+static struct pc_page *pc_grab(vfs_node_t *node, uint32_t index,
+                               bool whole) {
+  struct pc_page *p = pc_lookup(node, index, NULL);
+  if (p)
+    return p;
+
+  spinlock_acquire(&pc_lock);
+  struct pc_mapping *m = pc_mapping_get(node->device, node->inode,
+                                        node->length);
+  uint64_t size = m ? m->size : node->length;
+  if (stats.pages >= pc_max_pages || pmm_get_free_pages() < pc_low_free)
+    pc_evict(PC_RECLAIM_BATCH);
+  spinlock_release(&pc_lock);
+  if (!m)
+    return NULL;
+
+  p = kmalloc(sizeof(struct pc_page));
+  void *frame = p ? pmm_alloc_page() : NULL;
+  if (!frame) {
+    kfree(p);
+    return NULL;
+  }
+  p->mapping = NULL;
+  p->index = index;
+  p->phys = (uint64_t)frame;
+  p->refs = 1;
+  p->uptodate = true;
+  p->readahead = false;
+  p->dirty = false;
+  p->delalloc = false;
+
+  if (whole || (uint64_t)index * PAGE_CACHE_SIZE >= size) {
+    memset(pc_page_data(p), 0, PAGE_CACHE_SIZE);
+  } else if (node->readpage(node, index, pc_page_data(p)) != 0) {
+    pmm_free_page(frame);
+    kfree(p);
+    return NULL;
+  }
+
+  spinlock_acquire(&pc_lock);
+  m = pc_mapping_get(node->device, node->inode, node->length);
+  struct pc_page *raced = m ? pc_radix_lookup(m, index) : NULL;
+  if (raced) {
+    raced->refs++;
+    if (!pc_wait_page(raced)) {
+      pc_page_release(raced);
+      raced = NULL;
+    }
+  }
+  bool inserted = !raced && m && pc_radix_insert(m, index, p) == 0;
+  if (inserted) {
+    p->mapping = m;
+    p->refs++;
+    list_add(&p->list, &m->pages);
+    list_add(&p->lru, &pc_lru);
+    m->nr_pages++;
+    stats.pages++;
+  }
+  spinlock_release(&pc_lock);
+  if (!inserted) {
+    pmm_free_page(frame);
+    kfree(p);
+    return raced;
+  }
+  return p;
+}
+
+// A writer that took dirty pages past the hard limit writes its own file
+// back before returning; past the background limit the flusher is woken.
+static void pc_balance_dirty(vfs_node_t *node, struct pc_wb *wb) {
+  spinlock_acquire(&pc_lock);
+  bool background = stats.dirty > pc_dirty_limit(PAGE_CACHE_DIRTY_BG_RATIO);
+  bool throttle = stats.dirty > pc_dirty_limit(PAGE_CACHE_DIRTY_RATIO);
+  if (throttle)
+    stats.throttled++;
+  spinlock_release(&pc_lock);
+
+  if (background)
+    pc_wb_kick(wb);
+  if (throttle)
+    pc_writeback(node->device, node->inode, PC_WB_CHUNK);
+}
+
+uint32_t page_cache_write_buffered(vfs_node_t *node, uint64_t offset,
+                                   uint32_t size, const uint8_t *buffer) {
+  if (!node->writepages || !node->reserve || !node->readpage || size == 0)
+    return 0;
+  spinlock_acquire(&pc_lock);
+  struct pc_wb *wb = pc_wb_find(node->device);
+  spinlock_release(&pc_lock);
+  if (!wb)
+    return 0;
+
+  uint32_t done = 0;
+  while (done < size) {
+    uint64_t pos = offset + done;
+    uint32_t index = (uint32_t)(pos >> PAGE_CACHE_SHIFT);
+    uint32_t in_page = pos & (PAGE_CACHE_SIZE - 1);
+    uint32_t n = PAGE_CACHE_SIZE - in_page;
+    if (n > size - done)
+      n = size - done;
+
+    struct pc_page *p = pc_grab(node, index, n == PAGE_CACHE_SIZE);
+    if (!p)
+      break;
+    // A clean page may have no blocks behind it: hold space for them. A
+    // dirty one already has either blocks or a reservation.
+    int reserved = 0;
+    if (!p->dirty) {
+      reserved = node->reserve(node, index);
+      if (reserved < 0) {
+        pc_put(p);
+        break; // Full: the caller's own write path reports it
+      }
+    }
+    memcpy(pc_page_data(p) + in_page, buffer + done, n);
+
+    spinlock_acquire(&pc_lock);
+    struct pc_mapping *m = p->mapping;
+    if (m && !m->wb_node)
+      m->wb_node = pc_node_clone(node);
+    bool ok = m && m->wb_node;
+    bool extra = reserved > 0 && (!ok || p->delalloc);
+    if (ok) {
+      m->wb = wb;
+      if (reserved > 0)
+        p->delalloc = true;
+      pc_page_set_dirty(p);
+      if (pos + n > m->size)
+        m->size = pos + n;
+      m->seq = ++pc_seq;
+    }
+    pc_page_release(p);
+    spinlock_release(&pc_lock);
+
+    if (extra)
+      node->unreserve(node, 1); // Dropped meanwhile, or raced with a writer
+    if (!ok)
+      break;
+    done += n;
+  }
+
+  if (done)
+    pc_balance_dirty(node, wb);
+  return done;
+}
+
+int page_cache_fsync(vfs_node_t *node) {
+  if (!node || !node->writepages)
+    return 0;
+  return pc_writeback(node->device, node->inode, 0xFFFFFFFFu);
+}
+
+int page_cache_sync(void *fs) {
+  int ret = 0;
+  for (uint32_t i = 0;; i++) {
+    spinlock_acquire(&pc_lock);
+    struct pc_wb *wb = i < pc_wb_count ? &pc_wb_table[i] : NULL;
+    spinlock_release(&pc_lock);
+    if (!wb)
+      break;
+    if (fs && wb->fs != fs)
+      continue;
+    if (pc_flush(wb, true) != 0)
+      ret = -1;
+  }
+  return ret;
+}
+
+void page_cache_truncate(vfs_node_t *node, uint64_t size) {
+  spinlock_acquire(&pc_lock);
+  struct pc_mapping *m;
+  while ((m = pc_mapping_find(node->device, node->inode)) && m->writeback)
+    pc_sleep();
+  if (!m)
+    m = pc_mapping_get(node->device, node->inode, size);
+  if (!m) {
+    spinlock_release(&pc_lock);
+    return;
+  }
+  m->size = size;
+  m->seq = ++pc_seq;
+
+  uint64_t keep = (size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+  uint32_t delalloc = 0;
+  struct list_head *pos, *n;
+  list_for_each_safe(pos, n, &m->pages) {
+    struct pc_page *p = list_entry(pos, struct pc_page, list);
+    if (p->index >= keep) {
+      if (p->delalloc) {
+        p->delalloc = false;
+        delalloc++;
+      }
+      pc_page_remove(p);
+    } else if (p->index == keep - 1 && (size & (PAGE_CACHE_SIZE - 1))) {
+      memset(pc_page_data(p) + (size & (PAGE_CACHE_SIZE - 1)), 0,
+             PAGE_CACHE_SIZE - (size & (PAGE_CACHE_SIZE - 1)));
+    }
+  }
+  vfs_node_t *dead = pc_mapping_put_node(m);
+  spinlock_release(&pc_lock);
+
+  if (delalloc && node->unreserve)
+    node->unreserve(node, delalloc);
+  pc_node_put(dead);
+}
+
+void page_cache_invalidate(void *fs, uint32_t ino) {
+  spinlock_acquire(&pc_lock);
+  struct pc_mapping *m;
+  while ((m = pc_mapping_find(fs, ino)) && m->writeback)
+    pc_sleep();
+  if (!m) {
+    spinlock_release(&pc_lock);
+    return;
+  }
+  // Bump the sequence so an in-flight fill does not re-create stale pages.
+  ++pc_seq;
+  uint32_t delalloc = 0;
+  while (!list_empty(&m->pages)) {
+    struct pc_page *p = list_first_entry(&m->pages, struct pc_page, list);
+    if (p->delalloc) {
+      p->delalloc = false;
+      delalloc++;
+    }
+    pc_page_remove(p);
+  }
+  vfs_node_t *node = m->wb_node;
+  pc_mapping_unhash(m);
+  kfree(m);
+  spinlock_release(&pc_lock);
+
+  if (node && delalloc && node->unreserve)
+    node->unreserve(node, delalloc);
+  pc_node_put(node);
+}
+
+size_t page_cache_shrink(size_t nr) {
+  spinlock_acquire(&pc_lock);
+  size_t freed = pc_evict(nr);
+  spinlock_release(&pc_lock);
+  return freed;
+}
+
+void page_cache_get_stats(struct page_cache_stats *out) {
+  spinlock_acquire(&pc_lock);
+  memcpy(out, &stats, sizeof(stats));
+  spinlock_release(&pc_lock);
+}
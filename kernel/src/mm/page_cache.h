@@ -0,0 +1,146 @@
+#ifndef MM_PAGE_CACHE_H
+#define MM_PAGE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct vfs_node;
+
+#define PAGE_CACHE_SIZE 4096
+#define PAGE_CACHE_SHIFT 12
+
+// Page cache statistics (reported in /proc/meminfo and /proc/vmstat)
+struct page_cache_stats {
+  uint64_t pages;     // Pages currently cached
+  uint64_t hits;      // Page lookups served from the cache
+  uint64_t misses;    // Page lookups that had to read the filesystem
+  uint64_t evictions; // Pages dropped by LRU reclaim
+  uint64_t readahead; // Pages brought in ahead of the reader
+  uint64_t dirty;     // Pages currently waiting for writeback
+  uint64_t writeback; // Pages written back to their filesystem
+  uint64_t throttled; // Writes that had to write back before returning
+};
+
+// ── Readahead ───────────────────────────────────────────────────────────────
+// Every open file (vfs_node) carries a window of pages that is read ahead of
+// a sequential reader. A cache miss in a sequential stream reads the pages
+// asked for plus the start of a window; when the reader reaches the marker
+// page of the window, the next one (twice as large, up to the cap) is
+// queued to the readahead thread and arrives while the reader consumes the
+// current one. Random access drops the window.
+
+#define PAGE_CACHE_RA_MIN_PAGES 4       // 16 KiB: first window
+#define PAGE_CACHE_RA_DEFAULT_PAGES 256 // 1 MiB cap
+#define PAGE_CACHE_RA_MAX_PAGES 512     // 2 MiB cap after FADV_SEQUENTIAL
+
+#define FILE_RA_RANDOM 0x1 // FADV_RANDOM: never read ahead
+
+struct file_ra_state {
+  uint32_t start;      // First page of the current window
+  uint32_t size;       // Window length in pages, 0 = no window
+  uint32_t async_size; // Pages of the window still ahead of the marker
+  uint32_t prev_index; // Last page of the previous read
+  uint32_t max_pages;  // Window cap, 0 = PAGE_CACHE_RA_DEFAULT_PAGES
+  uint32_t flags;      // FILE_RA_*
+};
+
+// posix_fadvise() / madvise() advice values (identical for 0-4)
+#define PAGE_CACHE_ADV_NORMAL 0
+#define PAGE_CACHE_ADV_RANDOM 1
+#define PAGE_CACHE_ADV_SEQUENTIAL 2
+#define PAGE_CACHE_ADV_WILLNEED 3
+#define PAGE_CACHE_ADV_DONTNEED 4
+#define PAGE_CACHE_ADV_NOREUSE 5
+
+// ── Writeback ───────────────────────────────────────────────────────────────
+// Filesystems with a writepages op and a registered flusher get buffered
+// writes: the data only dirties cached pages, and blocks for pages that had
+// none are reserved but not allocated. The flusher thread of the filesystem
+// writes a file back once its oldest dirty page has aged past the expiry,
+// or everything as soon as dirty pages pass the background ratio of the
+// cache; writepages() then allocates each run of new pages in one go. A
+// writer that pushes dirty pages past the hard ratio writes its own file
+// back before returning.
+
+#define PAGE_CACHE_DIRTY_EXPIRE_MS 5000 // Age at which dirty data is written
+#define PAGE_CACHE_WRITEBACK_MS 1000    // Flusher wakeup interval
+#define PAGE_CACHE_DIRTY_BG_RATIO 10    // % of the cache: background flush
+#define PAGE_CACHE_DIRTY_RATIO 20       // % of the cache: writers throttled
+
+// Push the filesystem's metadata (inodes, superblock) out; with wait, also
+// write it to the disk and flush the disk cache. Returns 0 on success.
+typedef int (*page_cache_sync_fs_t)(void *fs, bool wait);
+
+// Size the cache from the amount of usable memory. Call once the PMM is up.
+void page_cache_init(void);
+
+// Start the readahead thread. Until then readahead is done synchronously.
+void page_cache_start_readahead(void);
+
+// Start the flusher threads. Filesystems registered later get theirs
+// right away; until then dirty pages are only written by fsync() and sync.
+void page_cache_start_writeback(void);
+
+// Give fs (the node->device of its files) a flusher and buffered writes.
+// Returns 0, or -1 if the table of filesystems is full.
+int page_cache_register_fs(void *fs, const char *name,
+                           page_cache_sync_fs_t sync_fs);
+
+// True if fs was registered with page_cache_register_fs().
+bool page_cache_is_writeback_fs(void *fs);
+
+// Read through the cache. Only valid for nodes with a readpage op. Missing
+// pages are filled through the readahead window of node (see above).
+uint32_t page_cache_read(struct vfs_node *node, uint64_t offset, uint32_t size,
+                         uint8_t *buffer);
+
+// Queue [offset, offset + len) of node for reading in the background
+// (len 0: up to EOF). No-op for nodes without a readpage op.
+void page_cache_readahead(struct vfs_node *node, uint64_t offset,
+                          uint64_t len);
+
+// Apply posix_fadvise()-style advice to node's readahead window and cached
+// pages. Returns 0, or -1 for an unknown advice value.
+int page_cache_advise(struct vfs_node *node, uint64_t offset, uint64_t len,
+                      int advice);
+
+// The filesystem has written size bytes at offset (node->length already
+// updated): refresh any cached copy of that range.
+void page_cache_write(struct vfs_node *node, uint64_t offset, uint32_t size,
+                      const uint8_t *buffer);
+
+// Buffered write of size bytes at offset: copy them into cached pages and
+// mark those dirty. Returns how much was buffered, which is short when the
+// filesystem has no space to reserve or memory runs out; the caller writes
+// the rest itself. Returns 0 for nodes without writepages on a registered
+// filesystem. The caller updates node->length.
+uint32_t page_cache_write_buffered(struct vfs_node *node, uint64_t offset,
+                                   uint32_t size, const uint8_t *buffer);
+
+// Write every dirty page of node's file back and wait for it. Returns 0, or
+// -1 if the filesystem failed a write (the pages stay dirty).
+int page_cache_fsync(struct vfs_node *node);
+
+// Write back all dirty pages of fs (of every registered filesystem if NULL)
+// and sync their metadata. Returns 0, or -1 if anything failed.
+int page_cache_sync(void *fs);
+
+// The file was truncated to size: drop pages past the end and zero the tail
+// of the last one.
+void page_cache_truncate(struct vfs_node *node, uint64_t size);
+
+// Forget every cached page of inode ino on filesystem fs (unlink, rename
+// over an existing name). The inode number may be reused afterwards, so
+// dirty pages are discarded, not written. Filesystems that free the
+// inode's blocks call this before doing so.
+void page_cache_invalidate(void *fs, uint32_t ino);
+
+// Evict up to nr unreferenced clean pages from the cold end of the LRU. Returns
+// the number of pages freed.
+size_t page_cache_shrink(size_t nr);
+
+// Snapshot the page cache statistics.
+void page_cache_get_stats(struct page_cache_stats *out);
+
+#endif // MM_PAGE_CACHE_H
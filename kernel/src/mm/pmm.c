@@ -578,6 +578,36 @@ void pmm_decref(void *ptr) {
   spinlock_release(&pmm_lock);
 }
 
+// Drop one reference on each of count frames, taking pmm_lock and the buddy
+// zone lock once per call instead of once per frame. Used by bulk teardown.
+void pmm_free_page_batch(void **pages, size_t count) {
+  if (!pages || count == 0)
+    return;
+
+  size_t to_free = 0;
+  spinlock_acquire(&pmm_lock);
+  for (size_t i = 0; i < count; i++) {
+    uint64_t addr = (uint64_t)pages[i];
+    if (!addr || !pmm_is_managed(addr))
+      continue;
+    uint64_t pfn = addr / PAGE_SIZE;
+    if (refcounts[pfn - lowest_page] > 0) {
+      refcounts[pfn - lowest_page]--;
+      if (refcounts[pfn - lowest_page] == 0)
+        pages[to_free++] = pages[i]; // Compact in place: frames to release
+    }
+  }
+  spinlock_release(&pmm_lock);
+
+  if (to_free == 0)
+    return;
+
+  spinlock_acquire(&b_zone.lock);
+  for (size_t i = 0; i < to_free; i++)
+    buddy_free_internal((uint64_t)pages[i], 0);
+  spinlock_release(&b_zone.lock);
+}
+
 uint16_t pmm_get_ref(void *ptr) {
   if (!ptr)
     return 0;
@@ -26,6 +26,7 @@ void pmm_free_pages(void *ptr, size_t count);  // Free multiple pages
 void pmm_incref(void *ptr);                    // Increment reference count
 void pmm_decref(void *ptr);                    // Decrement reference count (frees if 0)
 uint16_t pmm_get_ref(void *ptr);               // Get current reference count
+void pmm_free_page_batch(void **pages, size_t count); // Decref many, one lock trip
 bool pmm_is_managed(uint64_t phys);            // Check if page is managed by PMM (RAM vs MMIO)
 
 // Compatibility aliases for existing code
@@ -0,0 +1,207 @@
+#include "reaper.h"
+#include "../console/klog.h"
+#include "../cpu/tsc.h"
+#include "../lib/string.h"
+#include "../lock/spinlock.h"
+#include "../sched/sched.h"
+#include "../smp/cpu.h"
+#include "heap.h"
+#include "vma.h"
+#include "vmm.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// ── Deferred address-space teardown ─────────────────────────────────────────
+// Freeing every frame and page table of a large process takes a long time.
+// Doing it on the exiting thread (or in the parent's wait4) stalls that CPU
+// and delays the zombie. Instead, the dead page-table tree is queued on a
+// per-CPU reaper kthread which releases frames to the PMM in batches.
+
+struct reap_work {
+  uint64_t cr3;
+  struct vma_list vmas;
+  uint64_t queued_tsc;
+  struct reap_work *next;
+};
+
+struct reaper_cpu {
+  spinlock_t lock;
+  struct reap_work *head;
+  struct reap_work *tail;
+  struct thread *thread;
+};
+
+static struct reaper_cpu reapers[MAX_CPUS];
+static bool reaper_running = false;
+
+static spinlock_t stats_lock = SPINLOCK_INIT;
+static struct mm_exit_stats stats;
+
+static uint64_t tsc_to_us(uint64_t cycles) {
+  uint64_t khz = tsc_get_freq_khz();
+  if (khz == 0)
+    return 0;
+  return cycles * 1000 / khz;
+}
+
+static void reaper_teardown(uint64_t cr3, struct vma_list *vmas,
+                            uint64_t queued_tsc) {
+  uint64_t start = rdtsc();
+  size_t pages = vmm_free_user_pages_vma(cr3, vmas);
+  vma_list_destroy(vmas);
+  uint64_t us = tsc_to_us(rdtsc() - start);
+
+  spinlock_acquire(&stats_lock);
+  stats.pages_freed += pages;
+  stats.teardown_us += us;
+  if (us > stats.teardown_max_us)
+    stats.teardown_max_us = us;
+  if (queued_tsc)
+    stats.queue_us += tsc_to_us(start - queued_tsc);
+  spinlock_release(&stats_lock);
+}
+
+static struct reaper_cpu *reaper_self(void) {
+  struct thread *self = sched_get_current();
+  for (uint32_t i = 0; i < MAX_CPUS; i++) {
+    if (reapers[i].thread == self)
+      return &reapers[i];
+  }
+  return NULL;
+}
+
+static void reaper_thread_entry(void) {
+  struct reaper_cpu *rc = reaper_self();
+  struct thread *self = sched_get_current();
+
+  while (1) {
+    if (!rc) {
+      // Not registered yet (we ran before mm_reaper_init stored us)
+      sched_yield();
+      rc = reaper_self();
+      continue;
+    }
+
+    spinlock_acquire(&rc->lock);
+    struct reap_work *work = rc->head;
+    rc->head = NULL;
+    rc->tail = NULL;
+    if (!work) {
+      // Publish BLOCKED under the queue lock so a concurrent enqueue either
+      // sees it and wakes us, or we see its work item on the next pass.
+      self->state = THREAD_BLOCKED;
+      spinlock_release(&rc->lock);
+      sched_yield();
+      continue;
+    }
+    spinlock_release(&rc->lock);
+
+    while (work) {
+      struct reap_work *next = work->next;
+      reaper_teardown(work->cr3, &work->vmas, work->queued_tsc);
+      kfree(work);
+      work = next;
+    }
+  }
+}
+
+void mm_reaper_init(void) {
+  for (uint32_t i = 0; i < MAX_CPUS; i++) {
+    spinlock_init(&reapers[i].lock);
+    reapers[i].head = NULL;
+    reapers[i].tail = NULL;
+    reapers[i].thread = NULL;
+  }
+
+  uint32_t started = 0;
+  for (uint32_t i = 0; i < cpu_get_count() && i < MAX_CPUS; i++) {
+    struct cpu_info *cpu = cpu_get_info(i);
+    if (!cpu || cpu->status == CPU_STATUS_OFFLINE)
+      continue;
+    struct thread *t = sched_create_kernel_thread(reaper_thread_entry, cpu,
+                                                  false);
+    if (!t)
+      continue;
+    reapers[i].thread = t;
+    sched_enqueue_thread(t, cpu);
+    started++;
+  }
+
+  reaper_running = started > 0;
+  klog_puts("[REAPER] Started ");
+  klog_uint64(started);
+  klog_puts(" address-space reaper thread(s)\n");
+}
+
+void mm_reaper_defer(uint64_t cr3, struct vma_list *vmas) {
+  if (cr3 == 0) {
+    vma_list_destroy(vmas);
+    return;
+  }
+
+  struct reap_work *work = NULL;
+  struct reaper_cpu *rc = NULL;
+  if (reaper_running) {
+    struct cpu_info *cpu = cpu_get_current();
+    if (cpu && cpu->cpu_id < MAX_CPUS && reapers[cpu->cpu_id].thread)
+      rc = &reapers[cpu->cpu_id];
+    else
+      rc = &reapers[0];
+    if (rc->thread)
+      work = kmalloc(sizeof(struct reap_work));
+  }
+
+  if (!work) {
+    // Early boot or OOM: tear down synchronously.
+    spinlock_acquire(&stats_lock);
+    stats.inline_teardowns++;
+    spinlock_release(&stats_lock);
+    reaper_teardown(cr3, vmas, 0);
+    return;
+  }
+
+  work->cr3 = cr3;
+  work->vmas = *vmas; // Take over the tree nodes
+  vma_list_init(vmas);
+  work->queued_tsc = rdtsc();
+  work->next = NULL;
+
+  spinlock_acquire(&stats_lock);
+  stats.deferred++;
+  spinlock_release(&stats_lock);
+
+  spinlock_acquire(&rc->lock);
+  if (rc->tail)
+    rc->tail->next = work;
+  else
+    rc->head = work;
+  rc->tail = work;
+  if (rc->thread->state == THREAD_BLOCKED)
+    rc->thread->state = THREAD_READY;
+  spinlock_release(&rc->lock);
+}
+
+void mm_release(struct mm_struct *mm, uint64_t cr3) {
+  if (!mm)
+    return;
+
+  spinlock_acquire(&mm->lock);
+  mm->ref_count--;
+  bool last = mm->ref_count == 0;
+  spinlock_release(&mm->lock);
+  if (!last)
+    return;
+
+  spinlock_acquire(&stats_lock);
+  stats.exits++;
+  spinlock_release(&stats_lock);
+
+  mm_reaper_defer(cr3, &mm->vmas);
+  kfree(mm);
+}
+
+void mm_reaper_get_stats(struct mm_exit_stats *out) {
+  spinlock_acquire(&stats_lock);
+  memcpy(out, &stats, sizeof(stats));
+  spinlock_release(&stats_lock);
+}
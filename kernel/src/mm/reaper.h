@@ -0,0 +1,36 @@
+#ifndef MM_REAPER_H
+#define MM_REAPER_H
+
+#include <stdint.h>
+
+struct mm_struct;
+
+// Exit-path statistics (reported in /proc/vmstat)
+struct mm_exit_stats {
+  uint64_t exits;            // Address spaces released on process exit
+  uint64_t deferred;         // Teardowns handed to a reaper thread
+  uint64_t inline_teardowns; // Teardowns done synchronously (no reaper yet)
+  uint64_t pages_freed;      // Frame references dropped by teardown
+  uint64_t teardown_us;      // Total time spent tearing down address spaces
+  uint64_t teardown_max_us;  // Longest single teardown
+  uint64_t queue_us;         // Total time work items waited in a reaper queue
+};
+
+// Spawn one reaper kernel thread per online CPU. Until this has run, teardown
+// falls back to freeing synchronously on the caller.
+void mm_reaper_init(void);
+
+// Drop one reference to mm. When it was the last, the page-table tree rooted
+// at cr3 and the VMA tree are queued on this CPU's reaper and the mm_struct
+// itself is freed. The caller must no longer be running on cr3.
+void mm_release(struct mm_struct *mm, uint64_t cr3);
+
+// Queue teardown of an address space that no thread references any more
+// (e.g. the old image after execve). Takes ownership of the VMA tree.
+struct vma_list;
+void mm_reaper_defer(uint64_t cr3, struct vma_list *vmas);
+
+// Snapshot the exit-path statistics.
+void mm_reaper_get_stats(struct mm_exit_stats *out);
+
+#endif // MM_REAPER_H
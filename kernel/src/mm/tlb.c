@@ -0,0 +1,309 @@
+#include "tlb.h"
+#include "../apic/lapic.h"
+#include "../console/klog.h"
+#include "../cpu/isr.h"
+#include "../cpu/tsc.h"
+#include "../lib/string.h"
+#include "../lock/spinlock.h"
+#include "../sched/sched.h"
+#include "../smp/cpu.h"
+#include "heap.h"
+#include "pmm.h"
+#include "vmm.h"
+
+// ── Cross-CPU TLB shootdown ─────────────────────────────────────────────────
+// invlpg only affects the executing CPU. When a PTE of an address space that
+// is live on other CPUs (threads sharing an mm) is removed or downgraded,
+// those CPUs must drop their copy as well before the old frame is reused.
+//
+// Each mm carries a mask of the CPUs that switched to it; loaded_cr3[] holds
+// what each CPU really runs right now. A shootdown targets the CPUs in the
+// mask that still have the same CR3 loaded — a CPU that moved to another
+// address space reloaded CR3 on the way and holds no stale entries (no
+// PCIDs). One request is in flight at a time; each target gets a single IPI
+// and the initiator spins until every target has acknowledged it.
+
+#define TLB_CHUNK_FRAMES ((4096 - 2 * sizeof(void *)) / sizeof(void *))
+
+struct tlb_frame_chunk {
+  struct tlb_frame_chunk *next;
+  size_t count;
+  void *frames[TLB_CHUNK_FRAMES];
+};
+
+struct tlb_request {
+  uint64_t cr3;
+  bool flush_all;
+  uint32_t nr_pages;
+  const uint64_t *pages;
+};
+
+static volatile uint64_t loaded_cr3[MAX_CPUS];
+static volatile bool tlb_pending[MAX_CPUS];
+static volatile uint32_t tlb_acks_left;
+static volatile bool tlb_busy = false;
+static struct tlb_request tlb_req;
+static bool tlb_ready = false;
+
+static spinlock_t stats_lock = SPINLOCK_INIT;
+static struct tlb_stats stats;
+
+static uint64_t tsc_to_ns(uint64_t cycles) {
+  uint64_t khz = tsc_get_freq_khz();
+  if (khz == 0)
+    return 0;
+  return cycles * 1000000ULL / khz;
+}
+
+// Run the pending request for this CPU, if any. Called from the IPI handler
+// and by CPUs spinning on the request slot with interrupts disabled, which
+// would otherwise never acknowledge the current initiator.
+static void tlb_service(uint32_t cpu_id) {
+  if (cpu_id >= MAX_CPUS || !__atomic_load_n(&tlb_pending[cpu_id],
+                                             __ATOMIC_ACQUIRE))
+    return;
+
+  uint64_t cr3;
+  __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+  if ((cr3 & PAGE_MASK) == tlb_req.cr3) {
+    if (tlb_req.flush_all) {
+      vmm_flush_tlb_all();
+    } else {
+      for (uint32_t i = 0; i < tlb_req.nr_pages; i++)
+        vmm_flush_tlb(tlb_req.pages[i]);
+    }
+  }
+  // Otherwise we switched away since the initiator looked; the CR3 load
+  // already discarded everything.
+
+  __atomic_store_n(&tlb_pending[cpu_id], false, __ATOMIC_RELEASE);
+  __atomic_fetch_sub(&tlb_acks_left, 1, __ATOMIC_RELEASE);
+}
+
+static void tlb_ipi_handler(struct registers *regs) {
+  (void)regs;
+  tlb_service(cpu_get_current()->cpu_id);
+}
+
+void tlb_init(void) {
+  register_interrupt_handler(TLB_SHOOTDOWN_VECTOR, tlb_ipi_handler);
+  tlb_ready = true;
+  klog_puts("[TLB] Shootdown IPI on vector ");
+  klog_uint64(TLB_SHOOTDOWN_VECTOR);
+  klog_puts("\n");
+}
+
+static void tlb_send_ipi(uint32_t apic_id) {
+  lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+  lapic_write(LAPIC_ICR_LOW, LAPIC_ICR_FIXED | TLB_SHOOTDOWN_VECTOR);
+  while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+    __asm__ volatile("pause");
+}
+
+// Candidate CPUs for cr3: the cpumask of the mm that owns it when that is
+// the caller's own (the common case), otherwise every CPU.
+static bool tlb_candidates(uint64_t cr3, uint64_t *mask) {
+  struct thread *t = sched_get_current();
+  if (t && t->mm && (t->cr3 & PAGE_MASK) == cr3) {
+    *mask = __atomic_load_n(&t->mm->cpu_mask, __ATOMIC_SEQ_CST);
+    return true;
+  }
+  *mask = ~0ULL;
+  return false;
+}
+
+static void tlb_shootdown(uint64_t cr3, bool flush_all, const uint64_t *pages,
+                          uint32_t nr_pages) {
+  cr3 &= PAGE_MASK;
+  if (!tlb_ready || cr3 == 0 || cpu_get_count() < 2)
+    return;
+
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags)::"memory");
+
+  struct cpu_info *self = cpu_get_current();
+  uint32_t self_id = self->cpu_id;
+
+  // Take the request slot. Whoever holds it may be waiting for us, so keep
+  // answering while we spin.
+  while (__atomic_test_and_set(&tlb_busy, __ATOMIC_ACQUIRE)) {
+    tlb_service(self_id);
+    __asm__ volatile("pause" ::: "memory");
+  }
+
+  // Our PTE writes must be visible before we sample who runs cr3; pairs with
+  // the store in tlb_switch_mm (a CPU we miss loads CR3 after our update).
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  uint64_t mask;
+  bool from_mm = tlb_candidates(cr3, &mask);
+  uint32_t ncpu = cpu_get_count();
+  uint64_t targets = 0;
+  uint32_t nr_targets = 0;
+  uint32_t skipped = 0;
+  for (uint32_t i = 0; i < ncpu && i < MAX_CPUS; i++) {
+    if (i == self_id || !(mask & (1ULL << i)))
+      continue;
+    if (__atomic_load_n(&loaded_cr3[i], __ATOMIC_SEQ_CST) != cr3) {
+      if (from_mm)
+        skipped++; // In the mask but now running another mm
+      continue;
+    }
+    targets |= 1ULL << i;
+    nr_targets++;
+  }
+
+  if (nr_targets == 0) {
+    __atomic_clear(&tlb_busy, __ATOMIC_RELEASE);
+    __asm__ volatile("push %0; popfq" ::"r"(flags) : "memory");
+    spinlock_acquire(&stats_lock);
+    stats.local_only++;
+    stats.skipped += skipped;
+    spinlock_release(&stats_lock);
+    return;
+  }
+
+  tlb_req.cr3 = cr3;
+  tlb_req.flush_all = flush_all || nr_pages > TLB_BATCH_MAX_PAGES;
+  tlb_req.pages = pages;
+  tlb_req.nr_pages = nr_pages;
+  tlb_acks_left = nr_targets;
+
+  uint64_t start = rdtsc();
+  for (uint32_t i = 0; i < ncpu && i < MAX_CPUS; i++) {
+    if (!(targets & (1ULL << i)))
+      continue;
+    struct cpu_info *cpu = cpu_get_info(i);
+    __atomic_store_n(&tlb_pending[i], true, __ATOMIC_RELEASE);
+    tlb_send_ipi(cpu->apic_id);
+  }
+
+  while (__atomic_load_n(&tlb_acks_left, __ATOMIC_ACQUIRE) != 0)
+    __asm__ volatile("pause" ::: "memory");
+  uint64_t ns = tsc_to_ns(rdtsc() - start);
+
+  bool full = tlb_req.flush_all;
+  __atomic_clear(&tlb_busy, __ATOMIC_RELEASE);
+  __asm__ volatile("push %0; popfq" ::"r"(flags) : "memory");
+
+  spinlock_acquire(&stats_lock);
+  stats.shootdowns++;
+  stats.ipis += nr_targets;
+  stats.skipped += skipped;
+  if (full)
+    stats.full_flushes++;
+  else
+    stats.pages += (uint64_t)nr_pages * nr_targets;
+  stats.ns_total += ns;
+  if (ns > stats.ns_max)
+    stats.ns_max = ns;
+  spinlock_release(&stats_lock);
+}
+
+// ── Batches ─────────────────────────────────────────────────────────────────
+
+void tlb_batch_init(struct tlb_batch *b, uint64_t cr3) {
+  b->cr3 = cr3 & PAGE_MASK;
+  b->flush_all = false;
+  b->nr_pages = 0;
+  b->nr_frames = 0;
+  b->chunks = NULL;
+  b->chunk_frames = 0;
+}
+
+void tlb_batch_add(struct tlb_batch *b, uint64_t va) {
+  if (b->flush_all)
+    return;
+  if (b->nr_pages == TLB_BATCH_MAX_PAGES) {
+    b->flush_all = true;
+    return;
+  }
+  b->pages[b->nr_pages++] = va & ~0xFFFULL;
+}
+
+void tlb_batch_add_all(struct tlb_batch *b) { b->flush_all = true; }
+
+void tlb_batch_reserve(struct tlb_batch *b, uint32_t n) {
+  if (b->nr_frames + n <= TLB_BATCH_INLINE_FRAMES)
+    return;
+
+  struct tlb_frame_chunk *c = b->chunks;
+  if (!c || c->count + b->nr_frames > TLB_CHUNK_FRAMES) {
+    c = kmalloc(sizeof(struct tlb_frame_chunk));
+    if (!c) {
+      // No memory to defer them: release now, as before batching existed.
+      pmm_free_page_batch(b->frames, b->nr_frames);
+      b->nr_frames = 0;
+      return;
+    }
+    c->count = 0;
+    c->next = b->chunks;
+    b->chunks = c;
+  }
+  memcpy(&c->frames[c->count], b->frames, b->nr_frames * sizeof(void *));
+  c->count += b->nr_frames;
+  b->chunk_frames += b->nr_frames;
+  b->nr_frames = 0;
+}
+
+void tlb_batch_free_frame(struct tlb_batch *b, uint64_t phys) {
+  if (b->nr_frames == TLB_BATCH_INLINE_FRAMES)
+    tlb_batch_reserve(b, 1);
+  b->frames[b->nr_frames++] = (void *)(phys & PAGE_MASK);
+}
+
+void tlb_batch_finish(struct tlb_batch *b) {
+  if (b->flush_all || b->nr_pages > 0)
+    tlb_shootdown(b->cr3, b->flush_all, b->pages, b->nr_pages);
+
+  // No CPU can reach the frames any more.
+  pmm_free_page_batch(b->frames, b->nr_frames);
+  struct tlb_frame_chunk *c = b->chunks;
+  while (c) {
+    struct tlb_frame_chunk *next = c->next;
+    pmm_free_page_batch(c->frames, c->count);
+    kfree(c);
+    c = next;
+  }
+
+  tlb_batch_init(b, b->cr3);
+}
+
+void tlb_shootdown_page(uint64_t cr3, uint64_t va) {
+  uint64_t page = va & ~0xFFFULL;
+  tlb_shootdown(cr3, false, &page, 1);
+}
+
+void tlb_shootdown_all(uint64_t cr3) { tlb_shootdown(cr3, true, NULL, 0); }
+
+// ── Address-space switches ──────────────────────────────────────────────────
+
+void tlb_switch_mm(struct cpu_info *cpu, struct mm_struct *prev,
+                   struct mm_struct *next, uint64_t cr3) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags)::"memory");
+
+  uint32_t id = cpu->cpu_id;
+  if (id < MAX_CPUS) {
+    uint64_t bit = 1ULL << id;
+    if (prev && prev != next)
+      __atomic_fetch_and(&prev->cpu_mask, ~bit, __ATOMIC_SEQ_CST);
+    if (next)
+      __atomic_fetch_or(&next->cpu_mask, bit, __ATOMIC_SEQ_CST);
+    // Publish before the CR3 load; see tlb_shootdown.
+    __atomic_store_n(&loaded_cr3[id], cr3 & PAGE_MASK, __ATOMIC_SEQ_CST);
+  }
+
+  uint64_t current_cr3;
+  __asm__ volatile("mov %%cr3, %0" : "=r"(current_cr3));
+  if (cr3 != current_cr3)
+    __asm__ volatile("mov %0, %%cr3" ::"r"(cr3) : "memory");
+
+  __asm__ volatile("push %0; popfq" ::"r"(flags) : "memory");
+}
+
+void tlb_get_stats(struct tlb_stats *out) {
+  spinlock_acquire(&stats_lock);
+  memcpy(out, &stats, sizeof(stats));
+  spinlock_release(&stats_lock);
+}
@@ -0,0 +1,107 @@
+#ifndef MM_TLB_H
+#define MM_TLB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct mm_struct;
+struct cpu_info;
+
+// IPI vector used to ask other CPUs to invalidate TLB entries.
+// Must not collide with LAPIC_TIMER_VECTOR (48), HPET (49/50) or the
+// spurious vector (0xFF).
+#define TLB_SHOOTDOWN_VECTOR 0xFD
+
+// A batch naming more pages than this is flushed with a CR3 reload instead
+// of one invlpg per page.
+#define TLB_BATCH_MAX_PAGES 32
+
+// Frames kept inline in a batch before spilling into heap-allocated chunks.
+#define TLB_BATCH_INLINE_FRAMES 16
+
+// Callers that may flush part-way through (e.g. munmap of a huge range)
+// should do so once this many frames are waiting.
+#define TLB_BATCH_FLUSH_FRAMES 2048
+
+struct tlb_frame_chunk;
+
+// ── Invalidation batch ──────────────────────────────────────────────────────
+// Collects every translation an operation removes or downgrades in one
+// address space, plus the frames (data pages and page tables) that must not
+// be reused until no CPU can still reach them through a stale TLB entry.
+//
+// The local CPU is flushed eagerly by the VMM as PTEs change; the batch only
+// drives remote CPUs. tlb_batch_finish() sends at most one IPI per CPU that
+// has the address space loaded, waits for every acknowledgement and only
+// then drops the frame references.
+//
+// tlb_batch_finish() must not be called while holding a spinlock that
+// another CPU may spin on (vmm_lock, mm->lock, ...): that CPU would have
+// interrupts disabled and could never acknowledge the IPI.
+struct tlb_batch {
+  uint64_t cr3; // Address space being modified (physical PML4)
+  bool flush_all;
+  uint32_t nr_pages;
+  uint64_t pages[TLB_BATCH_MAX_PAGES];
+  uint32_t nr_frames;
+  void *frames[TLB_BATCH_INLINE_FRAMES];
+  struct tlb_frame_chunk *chunks;
+  size_t chunk_frames; // Frames held in chunks
+};
+
+// Shootdown statistics (reported in /proc/vmstat)
+struct tlb_stats {
+  uint64_t shootdowns;   // Batches that needed at least one remote CPU
+  uint64_t ipis;         // IPIs sent (one per target CPU per shootdown)
+  uint64_t full_flushes; // Shootdowns that asked for a whole-TLB flush
+  uint64_t pages;        // Pages invalidated individually on remote CPUs
+  uint64_t skipped;      // CPUs in the mask that had moved to another mm
+  uint64_t local_only;   // Batches with no remote CPU to notify
+  uint64_t ns_total;     // Total time from first IPI to last acknowledgement
+  uint64_t ns_max;       // Slowest single shootdown
+};
+
+// Install the shootdown IPI handler. Call once the LAPIC is up.
+void tlb_init(void);
+
+void tlb_batch_init(struct tlb_batch *b, uint64_t cr3);
+
+// Record that the translation for va changed.
+void tlb_batch_add(struct tlb_batch *b, uint64_t va);
+
+// Record that the whole address space must be flushed (page tables freed or
+// swapped, many PTEs rewritten, ...).
+void tlb_batch_add_all(struct tlb_batch *b);
+
+// Make room for n more frames without allocating in tlb_batch_free_frame().
+// Must be called before taking vmm_lock: spilling to a chunk may kmalloc,
+// which can grow the heap and map pages.
+void tlb_batch_reserve(struct tlb_batch *b, uint32_t n);
+
+// Drop one reference to phys once the batch has been flushed. Only
+// allocates when no room was reserved.
+void tlb_batch_free_frame(struct tlb_batch *b, uint64_t phys);
+
+static inline size_t tlb_batch_pending_frames(const struct tlb_batch *b) {
+  return b->nr_frames + b->chunk_frames;
+}
+
+// Invalidate on every other CPU running b->cr3, then release the frames.
+// The batch is left empty and can be reused.
+void tlb_batch_finish(struct tlb_batch *b);
+
+// One-shot helpers for callers outside a batch.
+void tlb_shootdown_page(uint64_t cr3, uint64_t va);
+void tlb_shootdown_all(uint64_t cr3);
+
+// Load cr3 on this CPU and record that next now runs here (and prev, if
+// given and different, no longer does). Every CR3 switch must go through
+// this so that shootdowns can find the CPUs using an address space.
+void tlb_switch_mm(struct cpu_info *cpu, struct mm_struct *prev,
+                   struct mm_struct *next, uint64_t cr3);
+
+// Snapshot the shootdown statistics.
+void tlb_get_stats(struct tlb_stats *out);
+
+#endif // MM_TLB_H
@@ -348,25 +348,76 @@ struct vma *vma_find_overlap(struct vma_list *list, uint64_t start,
   return vma_find_overlap_recursive(list->root, start, end);
 }
 
-static struct vma *vma_find_growdown_recursive(struct vma *node, uint64_t cr2,
-                                               uint64_t max_limit) {
-  if (!node)
-    return NULL;
+static bool vma_range_has_flags_recursive(struct vma *node, uint64_t start,
+                                          uint64_t end, uint64_t flags) {
+  if (!node || node->max_end <= start)
+    return false;
 
-  if ((node->flags & MAP_GROWSDOWN) && cr2 < node->start &&
-      cr2 >= (node->end - max_limit))
-    return node;
+  if (node->start < end && node->end > start && (node->flags & flags))
+    return true;
+
+  if (vma_range_has_flags_recursive(node->left, start, end, flags))
+    return true;
+
+  // Everything to the right starts at or after node->start.
+  if (node->start >= end)
+    return false;
+  return vma_range_has_flags_recursive(node->right, start, end, flags);
+}
 
-  struct vma *res = vma_find_growdown_recursive(node->left, cr2, max_limit);
-  if (res)
-    return res;
+bool vma_range_has_flags(struct vma_list *list, uint64_t start, uint64_t end,
+                         uint64_t flags) {
+  return vma_range_has_flags_recursive(list->root, start, end, flags);
+}
 
-  return vma_find_growdown_recursive(node->right, cr2, max_limit);
+// The only VMA a fault at cr2 may grow is the first one above it, so a plain
+// BST successor walk is enough.
+static struct vma *vma_find_next(struct vma *node, uint64_t addr) {
+  struct vma *best = NULL;
+  while (node) {
+    if (node->start > addr) {
+      best = node;
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+  return best;
 }
 
 struct vma *vma_find_growdown(struct vma_list *list, uint64_t cr2,
                               uint64_t max_limit) {
-  return vma_find_growdown_recursive(list->root, cr2, max_limit);
+  struct vma *next = vma_find_next(list->root, cr2);
+  if (next && (next->flags & MAP_GROWSDOWN) && next->end - cr2 <= max_limit)
+    return next;
+  return NULL;
+}
+
+struct vma *vma_find_prev(struct vma_list *list, uint64_t addr) {
+  struct vma *node = list->root;
+  struct vma *best = NULL;
+  while (node) {
+    if (node->start < addr) {
+      best = node;
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+  return best;
+}
+
+int vma_expand_down(struct vma_list *list, struct vma *v, uint64_t new_start) {
+  if (new_start >= v->start)
+    return 0;
+  if (vma_find_overlap(list, new_start, v->start))
+    return -1;
+
+  // Every other node either lies entirely below new_start or starts at or
+  // above v->end, so the in-order position of v is unchanged. max_end only
+  // depends on end, which we don't touch.
+  v->start = new_start;
+  return 0;
 }
 
 static void clone_recursive(struct vma_list *dst, struct vma *node) {
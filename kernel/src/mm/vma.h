@@ -12,6 +12,10 @@
 #define MAP_ANONYMOUS 0x20
 #define MAP_GROWSDOWN 0x0100
 
+// Kernel-internal VMA flags, above the 32 bits of the user ABI
+#define VMA_PAGE_REFS 0x100000000ULL // Every mapped frame holds a reference
+                                     // owned by the mapping, shared or not
+
 // VMA structure - internally represents an AVL Interval Tree Node
 struct vma {
   uint64_t start;   // Start virtual address (page-aligned)
@@ -58,10 +62,23 @@ struct vma *vma_find(struct vma_list *list, uint64_t addr);
 struct vma *vma_find_overlap(struct vma_list *list, uint64_t start,
                              uint64_t end);
 
+// True if any VMA overlapping [start, end) has one of the given flags set.
+bool vma_range_has_flags(struct vma_list *list, uint64_t start, uint64_t end,
+                         uint64_t flags);
+
 // Find nearest GROWSDOWN VMA below cr2 within max_limit
 struct vma *vma_find_growdown(struct vma_list *list, uint64_t cr2,
                               uint64_t max_limit);
 
+// Find the VMA with the highest start address below addr (O(log n)).
+struct vma *vma_find_prev(struct vma_list *list, uint64_t addr);
+
+// Lower the start of an existing VMA in place (stack growth). The tree is
+// keyed on start and augmented on end, so moving start down into a free gap
+// keeps both the ordering and max_end valid without a remove/re-insert.
+// Returns 0 on success or -1 if [new_start, v->start) overlaps another VMA.
+int vma_expand_down(struct vma_list *list, struct vma *v, uint64_t new_start);
+
 // Scan tree to find the first linearly unmapped gap capable of fitting 'length'
 // cleanly.
 uint64_t vma_find_gap(struct vma_list *list, uint64_t length,
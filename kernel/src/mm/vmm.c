@@ -2,6 +2,7 @@
 #include "../console/klog.h"
 #include "../lib/string.h"
 #include "pmm.h"
+#include "tlb.h"
 #include "vma.h"
 #include <stddef.h>
 #include <stdint.h>
@@ -134,8 +135,83 @@ static uint64_t *get_next_level(uint64_t *current_level, size_t index,
   return new_table_virt;
 }
 
-bool vmm_map_page(uint64_t *pml4, uint64_t virtual_addr, uint64_t physical_addr,
-                  uint64_t flags) {
+// ── Shared leaf page tables ─────────────────────────────────────────────────
+// fork() hands the child the parent's leaf PTs by reference (refcounted in the
+// PMM) instead of copying them. While a PT is shared, each frame it maps holds
+// a single reference on behalf of all sharers, and the PD entries pointing at
+// it have RW cleared so the first write from either side faults.
+//
+// Before an address space modifies a PTE in such a table it takes a private
+// copy: every managed frame gains a reference for the copy and writable ones
+// become CoW in both tables. The last sharer simply reclaims the table.
+// Other CPUs running this address space may still cache the old PD entry, so
+// the change is recorded in tlb (if given) for a full remote flush.
+// Caller holds vmm_lock. Returns false on OOM.
+static bool vmm_unshare_pt(uint64_t *pd_virt, size_t pd_index,
+                           struct tlb_batch *tlb) {
+  uint64_t pde = pd_virt[pd_index];
+  if (!(pde & PAGE_FLAG_PT_SHARED) || (pde & PAGE_FLAG_PS))
+    return true;
+
+  uint64_t pt_phys = pde & PAGE_MASK;
+  if (pmm_get_ref((void *)pt_phys) <= 1) {
+    // Every other sharer has already copied or dropped it.
+    pd_virt[pd_index] = (pde & ~PAGE_FLAG_PT_SHARED) | PAGE_FLAG_RW;
+    vmm_flush_tlb_all();
+    if (tlb)
+      tlb_batch_add_all(tlb);
+    return true;
+  }
+
+  void *new_pt_phys = pmm_alloc();
+  if (!new_pt_phys)
+    return false;
+
+  uint64_t *src = (uint64_t *)PHYS_TO_VIRT(pt_phys);
+  uint64_t *dst = (uint64_t *)PHYS_TO_VIRT((uint64_t)new_pt_phys);
+  for (size_t i = 0; i < 512; i++) {
+    uint64_t entry = src[i];
+    if ((entry & PAGE_FLAG_PRESENT) && (entry & PAGE_FLAG_USER) &&
+        pmm_is_managed(entry & PAGE_MASK)) {
+      if (entry & PAGE_FLAG_RW) {
+        entry = (entry & ~PAGE_FLAG_RW) | PAGE_FLAG_COW;
+        src[i] = entry;
+      }
+      pmm_incref((void *)(entry & PAGE_MASK));
+    }
+    dst[i] = entry;
+  }
+
+  pd_virt[pd_index] = ((uint64_t)new_pt_phys & PAGE_MASK) |
+                      (pde & ~PAGE_MASK & ~PAGE_FLAG_PT_SHARED) | PAGE_FLAG_RW;
+  pmm_decref((void *)pt_phys);
+
+  // The whole 2 MiB window changed tables; drop any stale translations.
+  vmm_flush_tlb_all();
+  if (tlb)
+    tlb_batch_add_all(tlb);
+  return true;
+}
+
+// Drop an address space's reference to a shared PT during teardown. Returns
+// true if other sharers remain, in which case the PT and the frames it maps
+// must be left alone.
+static bool vmm_drop_shared_pt(uint64_t pde) {
+  if (!(pde & PAGE_FLAG_PT_SHARED))
+    return false;
+
+  uint64_t pt_phys = pde & PAGE_MASK;
+  spinlock_acquire(&vmm_lock);
+  bool shared = pmm_get_ref((void *)pt_phys) > 1;
+  if (shared)
+    pmm_decref((void *)pt_phys);
+  spinlock_release(&vmm_lock);
+  return shared;
+}
+
+bool vmm_map_page_batch(uint64_t *pml4, uint64_t virtual_addr,
+                        uint64_t physical_addr, uint64_t flags,
+                        struct tlb_batch *tlb) {
   spinlock_acquire(&vmm_lock);
   bool success = false;
 
@@ -171,6 +247,15 @@ bool vmm_map_page(uint64_t *pml4, uint64_t virtual_addr, uint64_t physical_addr,
   }
   pdpt_virt[pdpt_index] |= propagate_flags;
 
+  // A PT still shared with another address space must be made private
+  // before we write into it.
+  if (!vmm_unshare_pt(pd_virt, pd_index, tlb)) {
+    klog_puts("[VMM] Error: Failed to unshare PT for vaddr 0x");
+    klog_uint64(virtual_addr);
+    klog_puts("\n");
+    goto unlock;
+  }
+
   // Get PT (or create if missing)
   uint64_t *pt_virt = get_next_level(pd_virt, pd_index, true);
   if (!pt_virt) {
@@ -181,7 +266,10 @@ bool vmm_map_page(uint64_t *pml4, uint64_t virtual_addr, uint64_t physical_addr,
   }
   pd_virt[pd_index] |= propagate_flags;
 
-  // Set the page entry
+  // Set the page entry. Replacing a live translation must also reach other
+  // CPUs; a previously non-present entry cannot be cached anywhere.
+  if (tlb && (pt_virt[pt_index] & PAGE_FLAG_PRESENT))
+    tlb_batch_add(tlb, virtual_addr);
   pt_virt[pt_index] = (physical_addr & PAGE_MASK) | flags | PAGE_FLAG_PRESENT;
   vmm_flush_tlb(virtual_addr);
   success = true;
@@ -191,6 +279,20 @@ unlock:
   return success;
 }
 
+bool vmm_map_page(uint64_t *pml4, uint64_t virtual_addr, uint64_t physical_addr,
+                  uint64_t flags) {
+  // Kernel-half mappings keep their local-only flush: they are set up once
+  // and callers often hold locks that make waiting for IPIs unsafe.
+  if (virtual_addr > USER_SPACE_LIMIT)
+    return vmm_map_page_batch(pml4, virtual_addr, physical_addr, flags, NULL);
+
+  struct tlb_batch tlb;
+  tlb_batch_init(&tlb, (uint64_t)pml4);
+  bool ok = vmm_map_page_batch(pml4, virtual_addr, physical_addr, flags, &tlb);
+  tlb_batch_finish(&tlb);
+  return ok;
+}
+
 bool vmm_map_huge_page(uint64_t *pml4, uint64_t virtual_addr,
                        uint64_t physical_addr, uint64_t flags) {
   spinlock_acquire(&vmm_lock);
@@ -235,7 +337,20 @@ bool vmm_map_range(uint64_t *pml4, uint64_t virtual_addr,
   return true;
 }
 
-void vmm_free_empty_tables(uint64_t *pml4, uint64_t virtual_addr) {
+static void free_table(uint64_t phys, struct tlb_batch *tlb) {
+  if (tlb) {
+    tlb_batch_add_all(tlb);
+    tlb_batch_free_frame(tlb, phys);
+  } else {
+    pmm_free_page((void *)phys);
+  }
+}
+
+// With a batch, freed tables are handed to it (and a full flush requested,
+// since other CPUs may have cached the paging-structure entries) instead of
+// going straight back to the PMM.
+static void free_empty_tables(uint64_t *pml4, uint64_t virtual_addr,
+                              struct tlb_batch *tlb) {
   // Currently only called under vmm_lock
   size_t pml4_index = (virtual_addr >> 39) & 0x1FF;
   size_t pdpt_index = (virtual_addr >> 30) & 0x1FF;
@@ -274,7 +389,7 @@ void vmm_free_empty_tables(uint64_t *pml4, uint64_t virtual_addr) {
     // into the page we're about to free, then flush, then free.
     pd_virt[pd_index] = 0;
     vmm_flush_tlb(virtual_addr);
-    pmm_free_page((void *)pt_phys);
+    free_table(pt_phys, tlb);
 
     // Check if PD is empty
     bool pd_empty = true;
@@ -288,7 +403,7 @@ void vmm_free_empty_tables(uint64_t *pml4, uint64_t virtual_addr) {
     if (pd_empty) {
       pdpt_virt[pdpt_index] = 0;
       vmm_flush_tlb(virtual_addr);
-      pmm_free_page((void *)pd_phys);
+      free_table(pd_phys, tlb);
 
       // Check if PDPT is empty
       bool pdpt_empty = true;
@@ -302,13 +417,22 @@ void vmm_free_empty_tables(uint64_t *pml4, uint64_t virtual_addr) {
       if (pdpt_empty) {
         pml4_virt[pml4_index] = 0;
         vmm_flush_tlb(virtual_addr);
-        pmm_free_page((void *)pdpt_phys);
+        free_table(pdpt_phys, tlb);
       }
     }
   }
 }
 
-void vmm_unmap_page(uint64_t *pml4, uint64_t virtual_addr) {
+void vmm_free_empty_tables(uint64_t *pml4, uint64_t virtual_addr) {
+  free_empty_tables(pml4, virtual_addr, NULL);
+}
+
+void vmm_unmap_page_batch(uint64_t *pml4, uint64_t virtual_addr,
+                          struct tlb_batch *tlb) {
+  // Up to three tables can be freed below; make room while we may allocate.
+  if (tlb)
+    tlb_batch_reserve(tlb, 3);
+
   spinlock_acquire(&vmm_lock);
 
   size_t pml4_index = (virtual_addr >> 39) & 0x1FF;
@@ -343,9 +467,13 @@ void vmm_unmap_page(uint64_t *pml4, uint64_t virtual_addr) {
     // It's a 2MB page.
     goto unlock;
   }
-  uint64_t *pt_virt = (uint64_t *)PHYS_TO_VIRT(pd_entry & PAGE_MASK);
+  if (!vmm_unshare_pt(pd_virt, pd_index, tlb))
+    goto unlock;
+  uint64_t *pt_virt = (uint64_t *)PHYS_TO_VIRT(pd_virt[pd_index] & PAGE_MASK);
 
   // Now we're at the leaf PTE
+  if (tlb && (pt_virt[pt_index] & PAGE_FLAG_PRESENT))
+    tlb_batch_add(tlb, virtual_addr);
   pt_virt[pt_index] = 0;
   vmm_flush_tlb(virtual_addr);
 
@@ -356,13 +484,25 @@ void vmm_unmap_page(uint64_t *pml4, uint64_t virtual_addr) {
   // in every other process.
   if (pml4_index < 256 ||
       (pml4_index >= 256 && virtual_addr < KERNEL_HEAP_BASE)) {
-    vmm_free_empty_tables(pml4, virtual_addr);
+    free_empty_tables(pml4, virtual_addr, tlb);
   }
 
 unlock:
   spinlock_release(&vmm_lock);
 }
 
+void vmm_unmap_page(uint64_t *pml4, uint64_t virtual_addr) {
+  if (virtual_addr > USER_SPACE_LIMIT) {
+    vmm_unmap_page_batch(pml4, virtual_addr, NULL);
+    return;
+  }
+
+  struct tlb_batch tlb;
+  tlb_batch_init(&tlb, (uint64_t)pml4);
+  vmm_unmap_page_batch(pml4, virtual_addr, &tlb);
+  tlb_batch_finish(&tlb);
+}
+
 static void vmm_protect_table_recursive(uint64_t phys, int level) {
   if (level < 1)
     return;
@@ -450,6 +590,17 @@ uint64_t vmm_virt_to_phys(uint64_t *pml4_phys, uint64_t virtual_addr) {
   return (entry & PAGE_MASK) | (virtual_addr & 0xFFFULL);
 }
 
+bool vmm_pte_is_cow(uint64_t *pml4_phys, uint64_t virtual_addr) {
+  uint64_t *table = (uint64_t *)PHYS_TO_VIRT((uint64_t)pml4_phys);
+  for (int shift = 39; shift > 12; shift -= 9) {
+    uint64_t entry = table[(virtual_addr >> shift) & 0x1FF];
+    if (!(entry & PAGE_FLAG_PRESENT) || (entry & PAGE_FLAG_PS))
+      return false;
+    table = (uint64_t *)PHYS_TO_VIRT(entry & PAGE_MASK);
+  }
+  return (table[(virtual_addr >> 12) & 0x1FF] & PAGE_FLAG_COW) != 0;
+}
+
 // ── Deep-copy helper for page table cloning ─────────────────────────────────
 // Recursively clone page table levels.  At level 1 (leaf PT) we allocate
 // fresh physical pages and copy their content.  At higher levels we allocate
@@ -560,15 +711,49 @@ uint64_t vmm_clone_user_mappings(uint64_t *src_pml4_phys) {
   return (uint64_t)new_pml4_phys;
 }
 
-// Helper to check if a virtual address is in a shared VMA
-static bool is_shared_vma(struct vma_list *vmas, uint64_t vaddr) {
-  if (!vmas)
-    return false;
-  struct vma *vma = vma_find(vmas, vaddr);
-  if (vma && (vma->flags & MAP_SHARED)) {
-    return true;
+// Undo a partial clone_table_vma() after OOM: drop the references taken for
+// entries [0, end) of the new table and free it along with its subtables. A
+// PT shared with the new table goes back to being private (and writable) once
+// no other sharer is left, as vmm_unshare_pt() would do. Leaf entries the
+// clone made CoW stay that way; the fault path restores them on the next
+// write.
+static void clone_table_vma_undo(uint64_t *src_table_phys,
+                                 uint64_t *new_table_phys, int level,
+                                 size_t end, struct vma_list *vmas,
+                                 uint64_t base_addr) {
+  uint64_t *new_virt = (uint64_t *)PHYS_TO_VIRT((uint64_t)new_table_phys);
+  uint64_t *src_virt = (uint64_t *)PHYS_TO_VIRT((uint64_t)src_table_phys);
+
+  for (size_t i = 0; i < end; i++) {
+    if (!(new_virt[i] & PAGE_FLAG_PRESENT))
+      continue;
+
+    if (level == 1) {
+      uint64_t phys = new_virt[i] & PAGE_MASK;
+      struct vma *vma = vmas ? vma_find(vmas, base_addr | (i << 12)) : NULL;
+      bool ref = vma && (vma->flags & MAP_SHARED)
+                     ? (vma->flags & VMA_PAGE_REFS) != 0
+                     : pmm_is_managed(phys);
+      if (ref)
+        pmm_decref((void *)phys);
+      continue;
+    }
+
+    uint64_t child_base = base_addr | ((uint64_t)i << (12 + 9 * (level - 1)));
+    uint64_t pt_phys = src_virt[i] & PAGE_MASK;
+    if (level == 2 && (new_virt[i] & PAGE_MASK) == pt_phys) {
+      pmm_decref((void *)pt_phys);
+      if (pmm_get_ref((void *)pt_phys) <= 1)
+        src_virt[i] = (src_virt[i] & ~PAGE_FLAG_PT_SHARED) | PAGE_FLAG_RW;
+      continue;
+    }
+
+    clone_table_vma_undo((uint64_t *)pt_phys,
+                         (uint64_t *)(new_virt[i] & PAGE_MASK), level - 1, 512,
+                         vmas, child_base);
   }
-  return false;
+
+  pmm_free_page(new_table_phys);
 }
 
 // Clone table with VMA awareness - shared pages are not copied
@@ -598,8 +783,12 @@ static uint64_t *clone_table_vma(uint64_t *src_table_phys, int level,
       uint64_t page_vaddr = base_addr | (i << 12);
 
       // Check if this page is in a shared VMA
-      if (is_shared_vma(vmas, page_vaddr)) {
-        // Shared mapping: just copy the PTE (share the physical page)
+      struct vma *vma = vmas ? vma_find(vmas, page_vaddr) : NULL;
+      if (vma && (vma->flags & MAP_SHARED)) {
+        // Shared mapping: just copy the PTE (share the physical page). If
+        // the mapping owns a reference per frame, the child's copy does too.
+        if (vma->flags & VMA_PAGE_REFS)
+          pmm_incref((void *)(src_virt[i] & PAGE_MASK));
         new_virt[i] = src_virt[i];
       } else {
         // Private mapping: Use Copy-on-Write (CoW) if it's managed RAM.
@@ -613,7 +802,6 @@ static uint64_t *clone_table_vma(uint64_t *src_table_phys, int level,
           if (src_virt[i] & PAGE_FLAG_RW) {
             src_virt[i] &= ~PAGE_FLAG_RW;
             src_virt[i] |= PAGE_FLAG_COW;
-            vmm_flush_tlb(page_vaddr); // Update parent's TLB
           }
           pmm_incref((void *)phys);
         }
@@ -626,12 +814,27 @@ static uint64_t *clone_table_vma(uint64_t *src_table_phys, int level,
       int shift = 12 + 9 * (level - 1);
       child_base |= ((uint64_t)i << shift);
 
+      // Leaf PT with no MAP_SHARED mapping in its 2 MiB window: share it
+      // read-only instead of copying; whoever writes first unshares it.
+      if (level == 2 && !(src_virt[i] & PAGE_FLAG_PS) &&
+          (!vmas || !vma_range_has_flags(vmas, child_base,
+                                         child_base + (1ULL << 21),
+                                         MAP_SHARED))) {
+        src_virt[i] = (src_virt[i] & ~PAGE_FLAG_RW) | PAGE_FLAG_PT_SHARED;
+        pmm_incref((void *)(src_virt[i] & PAGE_MASK));
+        new_virt[i] = src_virt[i];
+        continue;
+      }
+
       // Recurse
       uint64_t *child_src_phys = (uint64_t *)(src_virt[i] & PAGE_MASK);
       uint64_t *child_new_phys =
           clone_table_vma(child_src_phys, level - 1, 0, 512, vmas, child_base);
-      if (!child_new_phys)
+      if (!child_new_phys) {
+        clone_table_vma_undo(src_table_phys, new_table_phys, level, i, vmas,
+                             base_addr);
         return NULL; // OOM
+      }
 
       // Preserve flags from original entry
       new_virt[i] =
@@ -679,7 +882,18 @@ uint64_t vmm_clone_user_mappings_vma(uint64_t *src_pml4_phys,
     uint64_t *child_new_phys =
         clone_table_vma(child_src_phys, 3, 0, 512, vmas, base_addr);
     if (!child_new_phys) {
+      for (size_t j = 0; j < i; j++) {
+        if (!(new_pml4_virt[j] & PAGE_FLAG_PRESENT))
+          continue;
+        uint64_t j_base = (uint64_t)j << 39;
+        clone_table_vma_undo((uint64_t *)(src_pml4_virt[j] & PAGE_MASK),
+                             (uint64_t *)(new_pml4_virt[j] & PAGE_MASK), 3, 512,
+                             vmas, j_base);
+      }
+      pmm_free_page(new_pml4_phys);
+      vmm_flush_tlb_all();
       spinlock_release(&vmm_lock);
+      tlb_shootdown_all((uint64_t)src_pml4_phys);
       return 0;
     }
 
@@ -693,7 +907,14 @@ uint64_t vmm_clone_user_mappings_vma(uint64_t *src_pml4_phys,
     new_pml4_virt[i] = src_pml4_virt[i];
   }
 
+  // The parent lost write access to everything CoW-marked or shared above;
+  // one full flush is far cheaper than an invlpg per page. Its other threads
+  // must flush too, or they could keep writing through stale RW entries into
+  // frames the child now shares.
+  vmm_flush_tlb_all();
+
   spinlock_release(&vmm_lock);
+  tlb_shootdown_all((uint64_t)src_pml4_phys);
   return (uint64_t)new_pml4_phys;
 }
 
@@ -723,24 +944,49 @@ uint64_t *vmm_create_pml4(void) {
   return (uint64_t *)new_pml4_phys;
 }
 
+// ── Batched frame release for teardown ─────────────────────────────────────
+// Tearing down an address space releases thousands of frames; going through
+// pmm_free_page() one at a time costs two lock round-trips each. Collect them
+// and hand them to the PMM in chunks instead.
+#define FREE_BATCH_SIZE 64
+
+struct free_batch {
+  void *pages[FREE_BATCH_SIZE];
+  size_t count;
+  size_t total;
+};
+
+static void free_batch_flush(struct free_batch *b) {
+  pmm_free_page_batch(b->pages, b->count);
+  b->count = 0;
+}
+
+static inline void free_batch_add(struct free_batch *b, uint64_t phys) {
+  b->pages[b->count++] = (void *)phys;
+  b->total++;
+  if (b->count == FREE_BATCH_SIZE)
+    free_batch_flush(b);
+}
+
 // ── Free all user-space pages and page tables for a given CR3 ───────────────
 // Walks PML4 entries 0-255 (user half), frees all mapped physical pages
 // and all intermediate page table pages, then frees the PML4 itself.
 // CRITICAL: Uses PAGE_MASK to strip NX/available bits from PTEs.
-void vmm_free_user_pages(uint64_t cr3) {
+size_t vmm_free_user_pages(uint64_t cr3) {
   if (cr3 == 0)
-    return;
+    return 0;
 
   // Safety: never free the active PML4
   uint64_t active_cr3;
   __asm__ volatile("mov %%cr3, %0" : "=r"(active_cr3));
   if (cr3 == (active_cr3 & PAGE_MASK)) {
     klog_puts("[VMM] WARNING: refusing to free active CR3!\n");
-    return;
+    return 0;
   }
 
   uint64_t hhdm = pmm_get_hhdm_offset();
   uint64_t *pml4_virt = (uint64_t *)(hhdm + cr3);
+  struct free_batch batch = {.count = 0, .total = 0};
 
   for (size_t i = 0; i < 256; i++) {
     if (!(pml4_virt[i] & PAGE_FLAG_PRESENT))
@@ -768,30 +1014,36 @@ void vmm_free_user_pages(uint64_t cr3) {
         if (pd_virt[k] & PAGE_FLAG_PS) {
           uint64_t huge_phys = pd_virt[k] & PAGE_MASK;
           for (size_t p = 0; p < 512; p++) {
-            pmm_free_page((void *)(huge_phys + p * 4096));
+            free_batch_add(&batch, huge_phys + p * 4096);
           }
           pd_virt[k] = 0;
           continue;
         }
 
+        // PT still shared since fork: the other sharers own its frames.
+        if (vmm_drop_shared_pt(pd_virt[k]))
+          continue;
+
         uint64_t pt_phys = pd_virt[k] & PAGE_MASK;
         uint64_t *pt_virt = (uint64_t *)(hhdm + pt_phys);
 
         for (size_t l = 0; l < 512; l++) {
           if (pt_virt[l] & PAGE_FLAG_PRESENT) {
             uint64_t page_phys = pt_virt[l] & PAGE_MASK;
-            pmm_free_page((void *)page_phys);
+            free_batch_add(&batch, page_phys);
           }
         }
-        pmm_free_page((void *)pt_phys);
+        free_batch_add(&batch, pt_phys);
       }
-      pmm_free_page((void *)pd_phys);
+      free_batch_add(&batch, pd_phys);
     }
-    pmm_free_page((void *)pdpt_phys);
+    free_batch_add(&batch, pdpt_phys);
   }
 
   // Free the PML4 page itself
-  pmm_free_page((void *)cr3);
+  free_batch_add(&batch, cr3);
+  free_batch_flush(&batch);
+  return batch.total;
 }
 
 // ── VMA-aware version: skip freeing MAP_SHARED physical pages ───────────────
@@ -799,27 +1051,27 @@ void vmm_free_user_pages(uint64_t cr3) {
 // frames belong to the hardware, not the process.  Blindly freeing them
 // would hand device memory back to PMM, where it gets overwritten by the
 // next zero-fill-on-demand fault.  This function checks each page against
-// the VMA tree and only frees private/anonymous frames.
-void vmm_free_user_pages_vma(uint64_t cr3, struct vma_list *vmas) {
+// the VMA tree and only frees private/anonymous frames, plus the references
+// held by VMA_PAGE_REFS mappings (e.g. tmpfs MAP_SHARED).
+size_t vmm_free_user_pages_vma(uint64_t cr3, struct vma_list *vmas) {
   if (cr3 == 0)
-    return;
+    return 0;
 
   // If no VMA info, fall back to the non-VMA-aware version
-  if (!vmas) {
-    vmm_free_user_pages(cr3);
-    return;
-  }
+  if (!vmas)
+    return vmm_free_user_pages(cr3);
 
   // Safety: never free the active PML4
   uint64_t active_cr3;
   __asm__ volatile("mov %%cr3, %0" : "=r"(active_cr3));
   if (cr3 == (active_cr3 & PAGE_MASK)) {
     klog_puts("[VMM] WARNING: refusing to free active CR3!\n");
-    return;
+    return 0;
   }
 
   uint64_t hhdm = pmm_get_hhdm_offset();
   uint64_t *pml4_virt = (uint64_t *)(hhdm + cr3);
+  struct free_batch batch = {.count = 0, .total = 0};
 
   for (size_t i = 0; i < 256; i++) {
     if (!(pml4_virt[i] & PAGE_FLAG_PRESENT))
@@ -853,12 +1105,16 @@ void vmm_free_user_pages_vma(uint64_t cr3, struct vma_list *vmas) {
           }
           uint64_t huge_phys = pd_virt[k] & PAGE_MASK;
           for (size_t p = 0; p < 512; p++) {
-            pmm_free_page((void *)(huge_phys + p * 4096));
+            free_batch_add(&batch, huge_phys + p * 4096);
           }
           pd_virt[k] = 0;
           continue;
         }
 
+        // PT still shared since fork: the other sharers own its frames.
+        if (vmm_drop_shared_pt(pd_virt[k]))
+          continue;
+
         uint64_t pt_phys = pd_virt[k] & PAGE_MASK;
         uint64_t *pt_virt = (uint64_t *)(hhdm + pt_phys);
 
@@ -869,25 +1125,28 @@ void vmm_free_user_pages_vma(uint64_t cr3, struct vma_list *vmas) {
 
             // Check if this page belongs to a MAP_SHARED VMA
             struct vma *v = vma_find(vmas, va);
-            if (v && (v->flags & MAP_SHARED)) {
+            if (v && (v->flags & MAP_SHARED) &&
+                !(v->flags & VMA_PAGE_REFS)) {
               // Shared/device mapping — do NOT free the physical frame.
               // Just clear the PTE so it's no longer mapped in this process.
               continue;
             }
 
             uint64_t page_phys = pt_virt[l] & PAGE_MASK;
-            pmm_free_page((void *)page_phys);
+            free_batch_add(&batch, page_phys);
           }
         }
-        pmm_free_page((void *)pt_phys);
+        free_batch_add(&batch, pt_phys);
       }
-      pmm_free_page((void *)pd_phys);
+      free_batch_add(&batch, pd_phys);
     }
-    pmm_free_page((void *)pdpt_phys);
+    free_batch_add(&batch, pdpt_phys);
   }
 
   // Free the PML4 page itself
-  pmm_free_page((void *)cr3);
+  free_batch_add(&batch, cr3);
+  free_batch_flush(&batch);
+  return batch.total;
 }
 
 #include "../sched/sched.h"
@@ -911,6 +1170,31 @@ static uint64_t dp_build_flags(uint64_t prot) {
   return flags;
 }
 
+// Maximum stack size for GROWSDOWN VMAs, from RLIMIT_STACK. Page-aligned and
+// capped so that "unlimited" cannot wrap the growth floor below zero.
+static uint64_t vmm_stack_limit(struct mm_struct *mm) {
+  uint64_t limit = mm->stack_rlim_cur;
+  if (limit > USER_SPACE_LIMIT / 2)
+    limit = USER_SPACE_LIMIT / 2;
+  limit &= ~0xFFFULL;
+  if (limit < 0x1000)
+    limit = 0x1000;
+  return limit;
+}
+
+// Private file pages are mapped COW even when read-only, so a COW fault
+// alone does not mean the write is allowed: the VMA must permit it.
+// Ranges without a VMA predate the tree and keep the old behaviour.
+static bool vmm_cow_write_allowed(struct mm_struct *mm, uint64_t addr) {
+  if (!mm)
+    return true;
+  spinlock_acquire(&mm->lock);
+  struct vma *vma = vma_find(&mm->vmas, addr);
+  bool ok = !vma || (vma->prot & PROT_WRITE);
+  spinlock_release(&mm->lock);
+  return ok;
+}
+
 int vmm_handle_page_fault(uint64_t cr2, uint64_t error_code,
                           struct registers *regs) {
   (void)regs;
@@ -955,20 +1239,42 @@ int vmm_handle_page_fault(uint64_t cr2, uint64_t error_code,
     if (pd[(virt >> 21) & 511] & PAGE_FLAG_PS)
       return -1; // No 2MB CoW (for now)
 
+    // Write into a PT still shared with another address space since fork:
+    // take a private copy first, then look at the PTE itself below.
+    // Sibling threads on other CPUs are told once we are done here.
+    struct tlb_batch tlb;
+    tlb_batch_init(&tlb, target_cr3);
+    if (pd[(virt >> 21) & 511] & PAGE_FLAG_PT_SHARED) {
+      spinlock_acquire(&vmm_lock);
+      bool unshared = vmm_unshare_pt(pd, (virt >> 21) & 511, &tlb);
+      spinlock_release(&vmm_lock);
+      if (!unshared)
+        return -1; // OOM
+      pt = (uint64_t *)PHYS_TO_VIRT(pd[(virt >> 21) & 511] & PAGE_MASK);
+    }
+
     uint64_t *pte = &pt[(virt >> 12) & 511];
-    if (!(*pte & PAGE_FLAG_PRESENT))
+    if (!(*pte & PAGE_FLAG_PRESENT)) {
+      tlb_batch_finish(&tlb);
       return -1;
+    }
 
     // Is this a COW page?
     if (*pte & PAGE_FLAG_COW) {
+      if (!vmm_cow_write_allowed(current->mm, virt)) {
+        tlb_batch_finish(&tlb);
+        return -1;
+      }
       uint64_t old_phys = *pte & PAGE_MASK;
       uint16_t refs = pmm_get_ref((void *)old_phys);
 
       if (refs > 1) {
         // Multiple processes share this page. Copy it.
         void *new_phys = pmm_alloc_page();
-        if (!new_phys)
+        if (!new_phys) {
+          tlb_batch_finish(&tlb);
           return -1; // OOM
+        }
 
         // Copy content
         memcpy(PHYS_TO_VIRT((uint64_t)new_phys), PHYS_TO_VIRT(old_phys),
@@ -978,8 +1284,10 @@ int vmm_handle_page_fault(uint64_t cr2, uint64_t error_code,
         *pte = ((uint64_t)new_phys & PAGE_MASK) |
                (*pte & ~PAGE_MASK & ~PAGE_FLAG_COW) | PAGE_FLAG_RW;
 
-        // Decrement refcount of the old page
-        pmm_decref((void *)old_phys);
+        // Other threads may still read the old frame through a cached
+        // translation; drop our reference only after they have let go.
+        tlb_batch_add(&tlb, virt);
+        tlb_batch_free_frame(&tlb, old_phys);
       } else {
         // We are the only owner (others exited or already copied it).
         // Just promote this page to Read-Write.
@@ -988,8 +1296,18 @@ int vmm_handle_page_fault(uint64_t cr2, uint64_t error_code,
       }
 
       vmm_flush_tlb(virt);
+      tlb_batch_finish(&tlb);
       return 0; // Fault handled!
     }
+    tlb_batch_finish(&tlb);
+
+    // Stale TLB entry: the tables already allow this write (e.g. another
+    // thread of this process unshared the PT after we cached it).
+    if (virt <= USER_SPACE_LIMIT && (*pte & PAGE_FLAG_RW) &&
+        (*pte & PAGE_FLAG_USER) && (pd[(virt >> 21) & 511] & PAGE_FLAG_RW)) {
+      vmm_flush_tlb(virt);
+      return 0;
+    }
   }
 
   // If the page was already PRESENT but NOT a COW fault, it's a real violation.
@@ -1005,35 +1323,39 @@ int vmm_handle_page_fault(uint64_t cr2, uint64_t error_code,
 
   // Look up the faulting address in the process's VMA tree.
   struct vma *vma = vma_find(&current->mm->vmas, cr2);
+  uint64_t grow_lo = 0; // lowest page fault-around may populate (0 = none)
   if (!vma) {
-    // Try stack growth: find a GROWSDOWN VMA above cr2 within 8MB
-    vma = vma_find_growdown(&current->mm->vmas, cr2, 8 * 1024 * 1024);
+    // Try stack growth: find a GROWSDOWN VMA above cr2 within RLIMIT_STACK
+    uint64_t limit = vmm_stack_limit(current->mm);
+    vma = vma_find_growdown(&current->mm->vmas, cr2, limit);
     if (vma) {
-      // Safely expand the stack: remove and re-add to maintain AVL tree
-      // integrity
-      uint64_t old_start = vma->start;
-      uint64_t old_end = vma->end;
-      uint64_t new_start = cr2 & ~0xFFFULL;
-      uint64_t prot = vma->prot;
-      uint64_t flags = vma->flags;
-      int fd = vma->fd;
-      uint64_t offset = vma->offset;
-
-      vma_remove(&current->mm->vmas, old_start, old_end);
-      if (vma_add(&current->mm->vmas, new_start, old_end, prot, flags, fd,
-                  offset) != 0) {
+      // Grow in chunks rather than page by page, but never past the rlimit
+      // or into the guard gap above the previous mapping.
+      uint64_t fault_page = cr2 & ~0xFFFULL;
+      uint64_t floor = vma->end > limit ? vma->end - limit : 0;
+      uint64_t new_start = fault_page;
+      if (vma->start - fault_page < STACK_GROW_CHUNK &&
+          vma->start >= STACK_GROW_CHUNK)
+        new_start = vma->start - STACK_GROW_CHUNK;
+      if (new_start < floor)
+        new_start = floor;
+
+      struct vma *prev = vma_find_prev(&current->mm->vmas, vma->start);
+      if (prev && new_start < prev->end + STACK_GUARD_GAP)
+        new_start = prev->end + STACK_GUARD_GAP;
+
+      // The tree is keyed on start, so the node can be extended in place.
+      if (new_start > fault_page ||
+          vma_expand_down(&current->mm->vmas, vma, new_start) != 0) {
         klog_puts("[VMM] Stack expansion failed (overlap?) for CR2=");
         klog_hex64(cr2);
         klog_puts("\n");
-        vma_add(&current->mm->vmas, old_start, old_end, prot, flags, fd,
-                offset);
         vma = NULL;
       } else {
-        // Node replaced, look it up again in the valid tree
-        vma = vma_find(&current->mm->vmas, cr2);
+        grow_lo = new_start;
       }
     } else {
-      // Log if address is outside the 8MB guard
+      // Log if address is outside the stack rlimit
       struct vma *potential =
           vma_find_growdown(&current->mm->vmas, cr2, 1024 * 1024 * 1024);
       if (potential) {
@@ -1135,6 +1457,32 @@ int vmm_handle_page_fault(uint64_t cr2, uint64_t error_code,
     return -1;
   }
 
+  // ── Stack fault-around ─────────────────────────────────────────────────
+  // A growth fault means the stack is descending; populate the pages just
+  // below it now instead of taking one fault per page. Best effort: on OOM
+  // we simply stop and let later faults fill the rest.
+  if (grow_lo) {
+    uint64_t fault_page = cr2 & ~0xFFFULL;
+    uint64_t lo = fault_page - (STACK_FAULT_AROUND - 1) * 0x1000ULL;
+    if (lo < grow_lo || lo > fault_page)
+      lo = grow_lo;
+    for (uint64_t va = fault_page; va > lo;) {
+      va -= 0x1000;
+      if (vmm_virt_to_phys((uint64_t *)target_cr3, va))
+        break;
+      void *extra = pmm_alloc_page();
+      if (!extra)
+        break;
+      uint64_t *extra_virt = (uint64_t *)PHYS_TO_VIRT((uint64_t)extra);
+      for (int i = 0; i < 512; i++)
+        extra_virt[i] = 0;
+      if (!vmm_map_page((uint64_t *)target_cr3, va, (uint64_t)extra, flags)) {
+        pmm_free_page(extra);
+        break;
+      }
+    }
+  }
+
   return 0; // successfully handled!
 }
 void vmm_map_signal_trampoline(uint64_t *pml4) {
@@ -1163,7 +1511,8 @@ bool vmm_is_user_addr_range_valid(uint64_t addr, size_t size) {
     spinlock_acquire(&current->mm->lock);
     struct vma *v = vma_find(&current->mm->vmas, page);
     if (!v) {
-      v = vma_find_growdown(&current->mm->vmas, page, 8 * 1024 * 1024);
+      v = vma_find_growdown(&current->mm->vmas, page,
+                            vmm_stack_limit(current->mm));
     }
 
     if (v) {
@@ -16,6 +16,10 @@
 #define PAGE_FLAG_PAT ((uint64_t)1 << 7)
 #define PAGE_FLAG_PS ((uint64_t)1 << 7)
 #define PAGE_FLAG_COW ((uint64_t)1 << 9)
+// PD-level software bit: the leaf PT below this entry is shared copy-on-write
+// with another address space (see vmm_clone_user_mappings_vma). RW is cleared
+// on such entries so that any write faults and unshares the PT first.
+#define PAGE_FLAG_PT_SHARED ((uint64_t)1 << 10)
 #define PAGE_FLAG_NX ((uint64_t)1 << 63)
 
 // Mask to extract the physical address from a page table entry.
@@ -32,15 +36,32 @@
 #define VMAP_BASE 0xFFFFC00000000000ULL
 #define KERNEL_HEAP_BASE 0xFFFFE00000000000ULL
 
+// Stack growth tuning: a GROWSDOWN VMA is extended by at least this much per
+// growth fault, and the pages just below the faulting one (up to
+// STACK_FAULT_AROUND in total) are populated eagerly since a descending stack
+// will touch them next. One page is always left unmapped between the stack
+// and the VMA below it as a guard.
+#define STACK_GROW_CHUNK (64 * 1024)
+#define STACK_FAULT_AROUND 16
+#define STACK_GUARD_GAP 0x1000
+
 // To retrieve the active top-level page directory from CR3
 uint64_t *vmm_get_active_pml4(void);
 
 // Given the active PML4 and a virtual address, map it to a physical frame
 // Returns true on success, false on failure (OOM allocating intermediate page
-// tables)
+// tables). For user addresses, other CPUs running pml4 are shot down before
+// returning if a live translation changed, so no spinlock may be held.
 bool vmm_map_page(uint64_t *pml4, uint64_t virtual_addr, uint64_t physical_addr,
                   uint64_t flags);
 
+// As vmm_map_page, but remote invalidations are collected in tlb for the
+// caller to issue with tlb_batch_finish() once its locks are dropped.
+struct tlb_batch;
+bool vmm_map_page_batch(uint64_t *pml4, uint64_t virtual_addr,
+                        uint64_t physical_addr, uint64_t flags,
+                        struct tlb_batch *tlb);
+
 // Maps a contiguous range of pages
 bool vmm_map_range(uint64_t *pml4, uint64_t virtual_addr,
                    uint64_t physical_addr, size_t pages, uint64_t flags);
@@ -49,9 +70,14 @@ bool vmm_map_range(uint64_t *pml4, uint64_t virtual_addr,
 bool vmm_map_huge_page(uint64_t *pml4, uint64_t virtual_addr,
                        uint64_t physical_addr, uint64_t flags);
 
-// Unmap a virtual page
+// Unmap a virtual page. Same shootdown rules as vmm_map_page.
 void vmm_unmap_page(uint64_t *pml4, uint64_t virtual_addr);
 
+// Batched unmap: the invalidation and any page tables freed on the way are
+// deferred to tlb. The frame that was mapped is left to the caller.
+void vmm_unmap_page_batch(uint64_t *pml4, uint64_t virtual_addr,
+                          struct tlb_batch *tlb);
+
 // Frees empty page tables (PT, PD, PDPT) upwards if they contain no valid
 // entries
 void vmm_free_empty_tables(uint64_t *pml4, uint64_t virtual_addr);
@@ -61,10 +87,19 @@ static inline void vmm_flush_tlb(uint64_t virtual_addr) {
   __asm__ volatile("invlpg (%0)" ::"r"(virtual_addr) : "memory");
 }
 
+// Flush all non-global TLB entries by reloading CR3
+static inline void vmm_flush_tlb_all(void) {
+  uint64_t cr3;
+  __asm__ volatile("mov %%cr3, %0\n\tmov %0, %%cr3" : "=r"(cr3)::"memory");
+}
+
 // Resolve a virtual address to its physical address using the given PML4.
 // Returns 0 if the mapping does not exist.
 uint64_t vmm_virt_to_phys(uint64_t *pml4, uint64_t virtual_addr);
 
+// True if virtual_addr is mapped by a 4 KiB PTE marked copy-on-write.
+bool vmm_pte_is_cow(uint64_t *pml4, uint64_t virtual_addr);
+
 // Clone all user-space page mappings (PML4 entries 0-255) from src_pml4
 // into a newly allocated PML4. Kernel higher-half entries (256-511) are
 // shallow-copied (shared). Each mapped user page gets a fresh physical
@@ -74,7 +109,9 @@ uint64_t vmm_clone_user_mappings(uint64_t *src_pml4_phys);
 
 // Clone user-space page mappings with VMA awareness.
 // Shared mappings (MAP_SHARED) share physical pages between parent and child.
-// Private mappings (MAP_PRIVATE) get deep-copied (child gets its own pages).
+// Private mappings are copy-on-write. Leaf page tables whose 2 MiB range holds
+// no MAP_SHARED VMA are not copied at all: parent and child reference the same
+// PT read-only until one of them writes into (or remaps) that range.
 // Returns the *physical* address of the new PML4, or 0 on failure.
 struct vma_list;
 uint64_t vmm_clone_user_mappings_vma(uint64_t *src_pml4_phys,
@@ -90,13 +127,14 @@ void vmm_init(void);
 void vmm_protect_active_tables(void);
 
 // Free all user-space page tables and mapped pages for a given PML4.
-// The PML4 physical page itself is also freed.
+// The PML4 physical page itself is also freed. Frames are released to the
+// PMM in batches; returns the number of frame references dropped.
 // Uses PAGE_MASK to properly strip NX/available bits from PTEs.
-void vmm_free_user_pages(uint64_t cr3);
+size_t vmm_free_user_pages(uint64_t cr3);
 
 // VMA-aware version: consults vmas to skip freeing physical pages
 // that belong to MAP_SHARED mappings (e.g. device MMIO like framebuffer).
-void vmm_free_user_pages_vma(uint64_t cr3, struct vma_list *vmas);
+size_t vmm_free_user_pages_vma(uint64_t cr3, struct vma_list *vmas);
 
 struct registers;
 
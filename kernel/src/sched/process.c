@@ -7,6 +7,7 @@
 #include "../lib/string.h"
 #include "../mm/heap.h"
 #include "../mm/pmm.h"
+#include "../mm/tlb.h"
 #include "../mm/vmm.h"
 #include "../smp/cpu.h"
 #include "../syscalls/syscall.h"
@@ -131,6 +132,11 @@ static bool do_elf_load(const char *path, uint64_t *pml4, uint64_t load_base,
     return false;
   }
 
+  // The whole image is about to be read: start it all in the background so
+  // the header and segment reads below find it in flight or cached, in
+  // large requests rather than a page at a time.
+  page_cache_readahead(file, 0, 0);
+
   // Read the ELF Header
   Elf64_Ehdr ehdr;
   if (vfs_read(file, 0, sizeof(Elf64_Ehdr), (uint8_t *)&ehdr) !=
@@ -666,7 +672,7 @@ bool process_exec_argv(const char **argv) {
   struct thread *current = sched_get_current();
   if (current && current->mm) {
     current->cr3 = (uint64_t)pml4;
-    __asm__ volatile("mov %0, %%cr3" ::"r"(current->cr3) : "memory");
+    tlb_switch_mm(cpu_get_current(), NULL, current->mm, current->cr3);
 
     // Destroy old VMA tree nodes before resetting
     extern void vma_list_destroy(struct vma_list * list);
@@ -8,6 +8,8 @@
 #include "../lock/spinlock.h"
 #include "../mm/heap.h"
 #include "../mm/pmm.h"
+#include "../mm/reaper.h"
+#include "../mm/tlb.h"
 #include "../mm/vmm.h"
 #include "../smp/cpu.h"
 
@@ -57,6 +59,8 @@ void sched_init(void) {
     if (idle_thread->mm) {
       memset(idle_thread->mm, 0, sizeof(struct mm_struct));
       vma_list_init(&idle_thread->mm->vmas);
+      idle_thread->mm->stack_rlim_cur = STACK_RLIMIT_DEFAULT;
+      idle_thread->mm->stack_rlim_max = RLIM_INFINITY;
       idle_thread->mm->ref_count = 1;
       spinlock_init(&idle_thread->mm->lock);
     }
@@ -75,11 +79,29 @@ void sched_init(void) {
   }
 }
 
+// ── vfork completion ────────────────────────────────────────────────────────
+// A CLONE_VFORK child runs on its parent's mm (and usually its stack) while
+// the parent sleeps in clone(). The parent is let go as soon as the child
+// stops using that address space: on a successful execve or however it
+// dies (exit, kill, OOM). It must happen before the child is marked DEAD,
+// since the parent checks the child's flag and a DEAD thread may be freed.
+void sched_vfork_release(struct thread *t) {
+  if (!t || !t->vfork_pending)
+    return;
+  t->vfork_pending = false;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (t->parent && t->parent->state == THREAD_BLOCKED) {
+    t->parent->wakeup_ticks = 0;
+    t->parent->state = THREAD_READY;
+  }
+}
+
 static void thread_exit(void) {
   // Current thread finished execution. Mark dead and yield.
   __asm__ volatile("cli");
   struct cpu_info *cpu = cpu_get_current();
   if (cpu->current_thread) {
+    sched_vfork_release(cpu->current_thread);
     cpu->current_thread->state = THREAD_DEAD;
   }
   // Infinite loop, yield will switch away
@@ -148,6 +170,8 @@ struct thread *sched_create_kernel_thread(void (*entry)(void),
   if (t->mm) {
     memset(t->mm, 0, sizeof(struct mm_struct));
     vma_list_init(&t->mm->vmas);
+    t->mm->stack_rlim_cur = STACK_RLIMIT_DEFAULT;
+    t->mm->stack_rlim_max = RLIM_INFINITY;
     t->mm->ref_count = 1;
     spinlock_init(&t->mm->lock);
   }
@@ -276,11 +300,7 @@ void sched_yield(void) {
     tss_set_rsp0(cpu->stack_top);
 
     uint64_t target_cr3 = next_t->cr3 ? next_t->cr3 : cpu->kernel_cr3;
-    uint64_t current_cr3;
-    __asm__ volatile("mov %%cr3, %0" : "=r"(current_cr3));
-    if (target_cr3 != current_cr3) {
-      __asm__ volatile("mov %0, %%cr3" ::"r"(target_cr3) : "memory");
-    }
+    tlb_switch_mm(cpu, prev->mm, next_t->mm, target_cr3);
 
     // Save current thread's TLS MSRs
     prev->fs_base = rdmsr(0xC0000100);
@@ -403,6 +423,7 @@ bool sched_terminate_thread(uint32_t tid) {
     if (curr) {
       do {
         if (curr->tid == tid && !curr->is_idle) {
+          sched_vfork_release(curr);
           curr->state = THREAD_DEAD;
           spinlock_release(&cpu->queue_lock);
           __asm__ volatile("sti");
@@ -584,26 +605,13 @@ void sched_reap_thread(struct thread *t) {
     t->fork_ctx = NULL;
   }
 
-  // 4. Free user page tables (CR3) and MM if last thread
+  // 4. Drop the MM reference (forked children already did so in exit). The
+  // page tables themselves are torn down by the reaper thread.
   if (t->mm) {
-    spinlock_acquire(&t->mm->lock);
-    t->mm->ref_count--;
-    if (t->mm->ref_count == 0) {
-      spinlock_release(&t->mm->lock);
-      klog_puts("[REAP] Last thread, freeing MM resources\n");
-      if (t->cr3) {
-        vmm_free_user_pages_vma(t->cr3, &t->mm->vmas);
-        t->cr3 = 0;
-      }
-      vma_list_destroy(&t->mm->vmas);
-      kfree(t->mm);
-    } else {
-      spinlock_release(&t->mm->lock);
-      klog_puts("[REAP] MM still shared, skipping CR3 free\n");
-      t->cr3 = 0; // Don't free for THIS thread
-    }
+    mm_release(t->mm, t->cr3);
     t->mm = NULL;
   }
+  t->cr3 = 0;
 
   // Deferred Free: Free any previously deferred dead threads.
   // By the time a new thread is being reaped, any previously dead threads
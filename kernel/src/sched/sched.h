@@ -9,18 +9,29 @@
 
 // Forward declaration for embedded wait queue entry
 struct wait_queue_entry;
+struct blk_plug;
 typedef struct wait_queue_entry wait_queue_entry_t;
 
 #include "../lock/spinlock.h"
 
+// Resource limits (Linux ABI). Only RLIMIT_STACK is enforced today.
+#define RLIMIT_STACK 3
+#define RLIM_NLIMITS 16
+#define RLIM_INFINITY (~0ULL)
+#define STACK_RLIMIT_DEFAULT (8ULL * 1024 * 1024)
+
 // Shared memory management structure for 1:1 threads
 struct mm_struct {
   struct vma_list vmas;    // Virtual memory areas
   uint64_t brk_base;       // Base of the heap
   uint64_t brk_current;    // Current end of the heap
   uint64_t mmap_next_addr; // Bump-pointer for anonymous mmap
+  uint64_t stack_rlim_cur; // RLIMIT_STACK soft limit (bytes)
+  uint64_t stack_rlim_max; // RLIMIT_STACK hard limit (bytes)
   int ref_count;           // Reference count for sharing across threads
   spinlock_t lock;         // Lock for thread-safe MM state updates
+  // CPUs that switched to this mm and may cache its translations (mm/tlb.c)
+  volatile uint64_t cpu_mask;
 };
 
 #define MAX_FDS 256
@@ -105,6 +116,7 @@ struct thread {
   void *fork_ctx;               // Saved register state for child entry
   bool is_main_session;    // True if this is the primary user session (Bash)
   uint64_t clone_flags;    // Flags passed to clone()
+  volatile bool vfork_pending; // CLONE_VFORK: parent waits for exec/exit
   struct thread *parent;   // Pointer to parent thread (for wait4)
   struct thread *children; // Head of children list
   struct thread *sibling_next; // Link to next sibling in parent's children list
@@ -136,6 +148,9 @@ struct thread {
   // Using stack-allocated entries is unsafe because the stack frame becomes
   // invalid when the thread is descheduled, leading to corrupted wait queues
   struct wait_queue_entry *wq_entry_next; // For multi-wait (epoll)
+
+  struct blk_plug *plug; // Block I/O held back by blk_start_plug()
+  void *journal_info;    // Open ext3 journal handle (fs/ext3.c)
 };
 
 void sched_init(void);
@@ -165,6 +180,9 @@ void sched_reap_thread(struct thread *t);
 // Reparent children to init
 void sched_reparent_children(struct thread *parent);
 
+// Wake a parent sleeping in vfork() once t no longer uses its address space
+void sched_vfork_release(struct thread *t);
+
 int alloc_fd(struct thread *t);
 
 // Userspace Management
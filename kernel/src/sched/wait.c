@@ -72,3 +72,45 @@ void wait_queue_wake_one(wait_queue_t *wq) {
   }
   spinlock_release(&wq->lock);
 }
+
+void completion_init(completion_t *c) {
+  spinlock_init(&c->lock);
+  c->done = false;
+  c->waiter = NULL;
+}
+
+void complete(completion_t *c) {
+  spinlock_acquire(&c->lock);
+  c->done = true;
+  struct thread *t = c->waiter;
+  if (t && t->state == THREAD_BLOCKED) {
+    t->state = THREAD_READY;
+    t->wakeup_ticks = 0;
+  }
+  spinlock_release(&c->lock);
+}
+
+void wait_for_completion(completion_t *c) {
+  struct thread *self = sched_get_current();
+  while (1) {
+    spinlock_acquire(&c->lock);
+    if (c->done) {
+      c->waiter = NULL;
+      spinlock_release(&c->lock);
+      return;
+    }
+    if (!self || self->is_idle) {
+      // Early boot or the idle thread: nothing else may run in our place,
+      // the IRQ will set done.
+      spinlock_release(&c->lock);
+      __asm__ volatile("pause");
+      continue;
+    }
+    // Publish BLOCKED under the lock so complete() either sees it and wakes
+    // us, or we see done on the next pass.
+    c->waiter = self;
+    self->state = THREAD_BLOCKED;
+    spinlock_release(&c->lock);
+    sched_yield();
+  }
+}
@@ -2,6 +2,7 @@
 #define SCHED_WAIT_H
 
 #include "../lock/spinlock.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 struct thread;
@@ -22,4 +23,16 @@ void wait_queue_remove(wait_queue_t *wq, wait_queue_entry_t *entry);
 void wait_queue_wake_all(wait_queue_t *wq);
 void wait_queue_wake_one(wait_queue_t *wq);
 
+// One-shot event with a single sleeper (e.g. the submitter of an I/O).
+// complete() may be called from IRQ context.
+typedef struct completion {
+  spinlock_t lock;
+  volatile bool done;
+  struct thread *waiter;
+} completion_t;
+
+void completion_init(completion_t *c);
+void complete(completion_t *c);
+void wait_for_completion(completion_t *c);
+
 #endif
\ No newline at end of file
@@ -1438,11 +1438,14 @@ static void execute_command(char *cmd) {
       console_puts(path);
       console_puts("': Not a directory\n");
     } else {
-      struct dirent *d;
-      uint32_t i = 0;
-      while ((d = vfs_readdir(dir, i++)) != 0) {
-        console_puts(d->name);
-        console_puts("  ");
+      struct dirent d[8];
+      uint64_t pos = 0;
+      int n;
+      while ((n = vfs_readdir(dir, &pos, d, 8)) > 0) {
+        for (int i = 0; i < n; i++) {
+          console_puts(d[i].name);
+          console_puts("  ");
+        }
       }
       console_puts("\n");
     }
@@ -567,7 +567,7 @@ int epoll_close_fd(int fd) {
 // ── Epoll VFS Operations
 // ───────────────────────────────────────────────────────
 
-uint32_t epoll_vfs_read(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t epoll_vfs_read(struct vfs_node *node, uint64_t offset, uint32_t size,
                         uint8_t *buffer) {
   (void)node;
   (void)offset;
@@ -577,7 +577,7 @@ uint32_t epoll_vfs_read(struct vfs_node *node, uint32_t offset, uint32_t size,
   return 0;
 }
 
-uint32_t epoll_vfs_write(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t epoll_vfs_write(struct vfs_node *node, uint64_t offset, uint32_t size,
                          uint8_t *buffer) {
   (void)node;
   (void)offset;
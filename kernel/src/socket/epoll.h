@@ -140,9 +140,9 @@ int epoll_close_fd(int fd);
 
 // ── VFS Integration
 // ──────────────────────────────────────────────────────────
-uint32_t epoll_vfs_read(struct vfs_node *node, uint32_t offset, 
+uint32_t epoll_vfs_read(struct vfs_node *node, uint64_t offset, 
                         uint32_t size, uint8_t *buffer);
-uint32_t epoll_vfs_write(struct vfs_node *node, uint32_t offset, 
+uint32_t epoll_vfs_write(struct vfs_node *node, uint64_t offset, 
                          uint32_t size, uint8_t *buffer);
 void epoll_vfs_open(struct vfs_node *node);
 void epoll_vfs_close(struct vfs_node *node);
@@ -504,7 +504,7 @@ int socket_close_fd(int fd) {
 // ── Socket VFS Operations
 // ──────────────────────────────────────────────────────
 
-uint32_t socket_vfs_read(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t socket_vfs_read(struct vfs_node *node, uint64_t offset, uint32_t size,
                          uint8_t *buffer) {
   (void)offset; // Sockets don't use offset
 
@@ -519,7 +519,7 @@ uint32_t socket_vfs_read(struct vfs_node *node, uint32_t offset, uint32_t size,
   return (uint32_t)ret;
 }
 
-uint32_t socket_vfs_write(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t socket_vfs_write(struct vfs_node *node, uint64_t offset, uint32_t size,
                           uint8_t *buffer) {
   (void)offset; // Sockets don't use offset
 
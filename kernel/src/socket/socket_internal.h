@@ -120,9 +120,9 @@ void socket_wake(socket_t *sock);
 // ───────────────────────────────────────────────────── These integrate sockets
 // with the VFS
 
-uint32_t socket_vfs_read(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t socket_vfs_read(struct vfs_node *node, uint64_t offset, uint32_t size,
                          uint8_t *buffer);
-uint32_t socket_vfs_write(struct vfs_node *node, uint32_t offset, uint32_t size,
+uint32_t socket_vfs_write(struct vfs_node *node, uint64_t offset, uint32_t size,
                           uint8_t *buffer);
 void socket_vfs_open(struct vfs_node *node);
 void socket_vfs_close(struct vfs_node *node);
@@ -3,6 +3,7 @@
 #include "../console/console.h"
 #include "../console/klog.h"
 #include "../drivers/audio/sb16.h"
+#include "../drivers/storage/block.h"
 #include "../drivers/timer/pit.h"
 #include "../fb/framebuffer.h"
 #include "../font/font.h"
@@ -26,10 +27,9 @@ static inline bool is_user_ptr(uint64_t addr) {
   return addr != 0 && addr <= USER_ADDR_MAX;
 }
 
-typedef struct {
-  uint8_t *data;
-  uint32_t capacity;
-} ramfs_file_t;
+// Largest transfer of one read()/write() call; longer ones return short,
+// as on Linux. Keeps the byte count of a VFS op within its uint32_t.
+#define MAX_RW_COUNT 0x7FFFF000ULL
 
 #define TCGETS 0x5401
 #define TCSETS 0x5402
@@ -405,8 +405,12 @@ static uint64_t do_sys_open(int dirfd, const char *path, uint64_t flags,
     }
   }
 
-  if ((flags & O_TRUNC) && node->flags == FS_FILE)
-    node->length = 0;
+  // Truncate through the VFS so the on-disk size and the page cache agree
+  if ((flags & O_TRUNC) && (node->flags & FS_TYPE_MASK) == FS_FILE &&
+      node->length != 0) {
+    if (vfs_truncate(node, 0) != 0)
+      node->length = 0;
+  }
 
 open_done:
   klog_puts("[SYSCALL] open_done BEFORE: fd=");
@@ -513,6 +517,8 @@ static uint64_t sys_read(uint64_t fd, uint64_t buf, uint64_t count, uint64_t a3,
     return (uint64_t)-9; // EBADF
 
   vfs_node_t *node = t->fds[fd];
+  if (count > MAX_RW_COUNT)
+    count = MAX_RW_COUNT;
   int32_t bytes_read =
       (int32_t)vfs_read(node, t->fd_offsets[fd], count, (uint8_t *)buf);
 
@@ -537,12 +543,81 @@ static uint64_t sys_ftruncate(uint64_t fd, uint64_t length, uint64_t a2,
   if (!node || (node->flags & FS_TYPE_MASK) != FS_FILE)
     return (uint64_t)-1; // EPERM
 
-  if (vfs_truncate(node, (uint32_t)length) == 0) {
+  if ((int64_t)length < 0)
+    return (uint64_t)-22; // EINVAL
+  if (vfs_truncate(node, length) == 0) {
     return 0;
   }
   return (uint64_t)-1;
 }
 
+// ── fsync / fdatasync / sync / syncfs ───────────────────────────────────────
+// Buffered writes sit in dirty page-cache pages and the buffer cache until
+// the flusher gets to them; these push them to the disk now.
+
+static uint64_t fsync_common(uint64_t fd, bool datasync) {
+  struct thread *t = sched_get_current();
+  if (!t || fd >= MAX_FDS || !t->fds[fd])
+    return (uint64_t)-9; // EBADF
+  if (vfs_fsync(t->fds[fd], datasync) != 0)
+    return (uint64_t)-5; // EIO
+  return 0;
+}
+
+static uint64_t sys_fsync(uint64_t fd, uint64_t a1, uint64_t a2, uint64_t a3,
+                          uint64_t a4, uint64_t a5) {
+  (void)a1;
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  return fsync_common(fd, false);
+}
+
+static uint64_t sys_fdatasync(uint64_t fd, uint64_t a1, uint64_t a2,
+                              uint64_t a3, uint64_t a4, uint64_t a5) {
+  (void)a1;
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  return fsync_common(fd, true);
+}
+
+static uint64_t sys_sync(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3,
+                         uint64_t a4, uint64_t a5) {
+  (void)a0;
+  (void)a1;
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  page_cache_sync(NULL);
+  block_sync(NULL);
+  return 0; // sync() cannot fail
+}
+
+static uint64_t sys_syncfs(uint64_t fd, uint64_t a1, uint64_t a2, uint64_t a3,
+                           uint64_t a4, uint64_t a5) {
+  (void)a1;
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  struct thread *t = sched_get_current();
+  if (!t || fd >= MAX_FDS || !t->fds[fd])
+    return (uint64_t)-9; // EBADF
+
+  // Filesystems without a flusher have nothing but the buffer cache to sync
+  void *fs = t->fds[fd]->device;
+  int err;
+  if (fs && page_cache_is_writeback_fs(fs))
+    err = page_cache_sync(fs);
+  else
+    err = block_sync(NULL);
+  return err ? (uint64_t)-5 : 0; // EIO
+}
+
 // ── fd_write ─────────────────────────────────────────────────────────────────
 // For fd 0/1/2 (stdout / stderr) we use console_write_batch() so that each
 // write() syscall results in exactly ONE framebuffer blit.  This kills the
@@ -553,6 +628,8 @@ static int64_t fd_write(int fd, const void *buf, size_t count) {
     return -9; // EBADF
 
   vfs_node_t *node = t->fds[fd];
+  if (count > MAX_RW_COUNT)
+    count = MAX_RW_COUNT;
 
   int32_t bytes_written =
       (int32_t)vfs_write(node, t->fd_offsets[fd], count, (uint8_t *)buf);
@@ -828,7 +905,7 @@ static uint64_t sys_lseek(uint64_t fd, uint64_t offset, uint64_t whence,
   if (new_offset < 0)
     return (uint64_t)-22;
 
-  t->fd_offsets[fd] = (uint32_t)new_offset;
+  t->fd_offsets[fd] = (uint64_t)new_offset;
   return (uint64_t)new_offset;
 }
 
@@ -962,18 +1039,34 @@ static void fill_kstat(struct kstat *ks, vfs_node_t *node) {
   ks->__unused[2] = 0;
 }
 
-// ── sys_stat: stat(path, statbuf) ────────────────────────────────────────────
+// ── sys_fadvise64: tune the readahead window of an open file ────────────────
 static uint64_t sys_fadvise64(uint64_t fd, uint64_t offset, uint64_t len,
                               uint64_t advice, uint64_t a4, uint64_t a5) {
-  (void)fd;
-  (void)offset;
-  (void)len;
-  (void)advice;
   (void)a4;
   (void)a5;
+  struct thread *t = sched_get_current();
+  if (!t || fd >= MAX_FDS || !t->fds[fd])
+    return (uint64_t)-9; // EBADF
+
+  vfs_node_t *node = t->fds[fd];
+  if ((node->flags & FS_TYPE_MASK) == FS_PIPE ||
+      (node->flags & FS_TYPE_MASK) == FS_SOCKET)
+    return (uint64_t)-29; // ESPIPE
+  if ((int64_t)len < 0 || advice > PAGE_CACHE_ADV_NOREUSE)
+    return (uint64_t)-22; // EINVAL
+
+  // Files outside the page cache accept the advice and ignore it
+  if (!node->readpage)
+    return 0;
+  if (offset >= node->length)
+    offset = node->length;
+  if (len > node->length - offset)
+    len = 0; // Up to EOF
+  page_cache_advise(node, offset, len, (int)advice);
   return 0;
 }
 
+// ── sys_stat: stat(path, statbuf) ────────────────────────────────────────────
 static uint64_t sys_stat(uint64_t path_ptr, uint64_t statbuf_ptr, uint64_t a2,
                          uint64_t a3, uint64_t a4, uint64_t a5) {
   (void)a2;
@@ -1167,12 +1260,42 @@ struct linux_dirent64 {
 #define DT_LNK 10
 #define DT_SOCK 12
 
-// getdents64(fd, dirp, count) - read directory entries
-static uint64_t sys_getdents64(uint64_t fd, uint64_t dirp, uint64_t count,
-                               uint64_t a3, uint64_t a4, uint64_t a5) {
-  (void)a3;
-  (void)a4;
-  (void)a5;
+struct linux_dirent {
+  uint64_t d_ino;
+  uint64_t d_off;
+  uint16_t d_reclen;
+  char d_name[];
+};
+
+#define GETDENTS_BATCH 16 // Entries fetched from the filesystem at once
+
+static uint8_t dirent_dt_type(uint32_t type) {
+  switch (type) {
+  case FS_FILE:
+    return DT_REG;
+  case FS_DIRECTORY:
+    return DT_DIR;
+  case FS_CHARDEV:
+    return DT_CHR;
+  case FS_BLOCKDEV:
+    return DT_BLK;
+  case FS_PIPE:
+    return DT_FIFO;
+  case FS_SYMLINK:
+    return DT_LNK;
+  case FS_SOCKET:
+    return DT_SOCK;
+  default:
+    return DT_UNKNOWN;
+  }
+}
+
+// Copy directory entries of fd into the user buffer, in the linux_dirent64
+// layout if wide, else the old linux_dirent one. The file offset holds the
+// filesystem's position cookie, so each call continues where the previous
+// one stopped instead of counting entries from the start of the directory.
+static uint64_t getdents_common(uint64_t fd, uint64_t dirp, uint64_t count,
+                                bool wide) {
   struct thread *t = sched_get_current();
   if (!t || fd >= MAX_FDS || !t->fds[fd])
     return (uint64_t)-9; // EBADF
@@ -1182,114 +1305,88 @@ static uint64_t sys_getdents64(uint64_t fd, uint64_t dirp, uint64_t count,
     return (uint64_t)-20; // ENOTDIR
 
   uint8_t *buf = (uint8_t *)dirp;
-  if (!buf)
-    return (uint64_t)-14; // EFAULT
-  if (!is_user_ptr((uint64_t)buf))
+  if (!buf || !vmm_is_user_addr_range_valid(dirp, count))
     return (uint64_t)-14; // EFAULT
 
-  size_t written = 0;
-  uint32_t index = t->fd_offsets[fd]; // Start from saved position
-
-  while (1) {
-    struct dirent *de = vfs_readdir(node, index);
-    if (!de)
-      break; // No more entries
-
-    size_t name_len = strlen(de->name);
-    size_t entry_size = sizeof(struct linux_dirent64) + name_len + 1;
-    entry_size = (entry_size + 7) & ~7; // Align to 8 bytes
-
-    if (written + entry_size > count) {
-      // Buffer full - return what we have, don't advance index
-      break;
-    }
+  struct dirent *ents = kmalloc(GETDENTS_BATCH * sizeof(struct dirent));
+  if (!ents)
+    return (uint64_t)-12; // ENOMEM
 
-    struct linux_dirent64 *entry = (struct linux_dirent64 *)(buf + written);
-    entry->d_ino = de->ino;
-    entry->d_off = (uint64_t)(index + 1);
-    entry->d_reclen = (uint16_t)entry_size;
-
-    // Determine file type from VFS node
-    vfs_node_t *child = vfs_finddir(node, de->name);
-    if (child) {
-      switch (child->flags & FS_TYPE_MASK) {
-      case FS_FILE:
-        entry->d_type = DT_REG;
-        break;
-      case FS_DIRECTORY:
-        entry->d_type = DT_DIR;
-        break;
-      case FS_CHARDEV:
-        entry->d_type = DT_CHR;
-        break;
-      case FS_BLOCKDEV:
-        entry->d_type = DT_BLK;
-        break;
-      case FS_SYMLINK:
-        entry->d_type = DT_LNK;
-        break;
-      default:
-        entry->d_type = DT_UNKNOWN;
+  size_t written = 0;
+  uint64_t pos = t->fd_offsets[fd]; // Start from saved position
+  bool full = false;
+  int err = 0;
+
+  while (!full) {
+    uint64_t batch_pos = pos;
+    int n = vfs_readdir(node, &batch_pos, ents, GETDENTS_BATCH);
+    if (n < 0)
+      err = -5; // EIO
+    if (n <= 0)
+      break; // Error or no more entries
+
+    for (int i = 0; i < n; i++) {
+      struct dirent *de = &ents[i];
+      size_t name_len = strlen(de->name);
+      size_t entry_size = wide
+                              ? sizeof(struct linux_dirent64) + name_len + 1
+                              : 8 + 8 + 2 + name_len + 2;
+      entry_size = (entry_size + 7) & ~7; // Align to 8 bytes
+
+      if (written + entry_size > count) {
+        // Buffer full - the next call resumes at this entry
+        full = true;
         break;
       }
-    } else {
-      entry->d_type = DT_UNKNOWN;
-    }
 
-    strcpy(entry->d_name, de->name);
-    written += entry_size;
-    index++;
+      if (wide) {
+        struct linux_dirent64 *entry =
+            (struct linux_dirent64 *)(buf + written);
+        entry->d_ino = de->ino;
+        entry->d_off = de->next;
+        entry->d_reclen = (uint16_t)entry_size;
+        entry->d_type = dirent_dt_type(de->type);
+        strcpy(entry->d_name, de->name);
+      } else {
+        struct linux_dirent *entry = (struct linux_dirent *)(buf + written);
+        entry->d_ino = de->ino;
+        entry->d_off = de->next;
+        entry->d_reclen = (uint16_t)entry_size;
+        strcpy(entry->d_name, de->name);
+        buf[written + entry_size - 1] = dirent_dt_type(de->type);
+      }
+      written += entry_size;
+      pos = de->next;
+    }
   }
+  kfree(ents);
+
+  if (written == 0 && full)
+    return (uint64_t)-22; // EINVAL: the next entry does not fit
+  if (written == 0 && err)
+    return (uint64_t)(int64_t)err;
 
   // Update saved position for next call
-  t->fd_offsets[fd] = index;
+  t->fd_offsets[fd] = pos;
 
   return written;
 }
 
-struct linux_dirent {
-  uint64_t d_ino;
-  uint64_t d_off;
-  uint16_t d_reclen;
-  char d_name[];
-};
+// getdents64(fd, dirp, count) - read directory entries
+static uint64_t sys_getdents64(uint64_t fd, uint64_t dirp, uint64_t count,
+                               uint64_t a3, uint64_t a4, uint64_t a5) {
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  return getdents_common(fd, dirp, count, true);
+}
 
 static uint64_t sys_getdents(uint64_t fd, uint64_t dirp, uint64_t count,
                              uint64_t a3, uint64_t a4, uint64_t a5) {
   (void)a3;
   (void)a4;
   (void)a5;
-  struct thread *t = sched_get_current();
-  if (!t || fd >= MAX_FDS || !t->fds[fd])
-    return (uint64_t)-9;
-  vfs_node_t *node = t->fds[fd];
-  if ((node->flags & FS_TYPE_MASK) != FS_DIRECTORY)
-    return (uint64_t)-20;
-  uint8_t *buf = (uint8_t *)dirp;
-  if (!buf || !vmm_is_user_addr_range_valid(dirp, count))
-    return (uint64_t)-14;
-  size_t written = 0;
-  uint32_t index = t->fd_offsets[fd];
-  while (1) {
-    struct dirent *de = vfs_readdir(node, index);
-    if (!de)
-      break;
-    size_t name_len = strlen(de->name);
-    size_t entry_size = 8 + 8 + 2 + name_len + 2;
-    entry_size = (entry_size + 7) & ~7;
-    if (written + entry_size > count)
-      break;
-    struct linux_dirent *entry = (struct linux_dirent *)(buf + written);
-    entry->d_ino = de->ino;
-    entry->d_off = (uint64_t)(index + 1);
-    entry->d_reclen = (uint16_t)entry_size;
-    strcpy(entry->d_name, de->name);
-    buf[written + entry_size - 1] = 0; // DT_UNKNOWN
-    written += entry_size;
-    index++;
-  }
-  t->fd_offsets[fd] = index;
-  return written;
+  return getdents_common(fd, dirp, count, false);
 }
 
 // Simple xorshift64 PRNG state
@@ -1622,6 +1719,8 @@ static uint64_t sys_readv(uint64_t fd, uint64_t iov_u, uint64_t iovcnt,
       return (uint64_t)-9; // EBADF
 
     vfs_node_t *node = t->fds[fd];
+    if (len > MAX_RW_COUNT)
+      len = MAX_RW_COUNT;
     int32_t bytes_read =
         (int32_t)vfs_read(node, t->fd_offsets[fd], len, (uint8_t *)base);
 
@@ -1654,7 +1753,7 @@ typedef struct {
   spinlock_t lock;
 } eventfd_ctx_t;
 
-static uint32_t eventfd_read(vfs_node_t *node, uint32_t offset, uint32_t size,
+static uint32_t eventfd_read(vfs_node_t *node, uint64_t offset, uint32_t size,
                              uint8_t *buffer) {
   (void)offset;
   if (size < 8)
@@ -1682,7 +1781,7 @@ static uint32_t eventfd_read(vfs_node_t *node, uint32_t offset, uint32_t size,
   return 8;
 }
 
-static uint32_t eventfd_write(vfs_node_t *node, uint32_t offset, uint32_t size,
+static uint32_t eventfd_write(vfs_node_t *node, uint64_t offset, uint32_t size,
                               uint8_t *buffer) {
   (void)offset;
   if (size < 8)
@@ -1770,17 +1869,7 @@ static uint64_t sys_eventfd2(uint64_t initval, uint64_t flags, uint64_t a2,
   return fd;
 }
 
-static void pipe_close(vfs_node_t *node) {
-  if (!node || !node->device)
-    return;
-  ramfs_file_t *file = (ramfs_file_t *)node->device;
-  if (file->data) {
-    kfree(file->data);
-    file->data = NULL;
-  }
-  kfree(file);
-  node->device = NULL;
-}
+static void pipe_close(vfs_node_t *node) { ramfs_file_release(node); }
 
 // ── sys_pipe2: pipe2(pipefd, flags) — syscall 293 ────────────────────────────
 static uint64_t sys_pipe2(uint64_t pipefd_ptr, uint64_t flags, uint64_t a2,
@@ -1818,14 +1907,12 @@ static uint64_t sys_pipe2(uint64_t pipefd_ptr, uint64_t flags, uint64_t a2,
   }
   vfs_node_init(pipe_node);
 
-  ramfs_file_t *pipe_buf = kmalloc(sizeof(ramfs_file_t));
+  void *pipe_buf = ramfs_file_alloc();
   if (!pipe_buf) {
     kfree(pipe_node);
     t->fds[fd_read] = NULL;
     return (uint64_t)-12;
   }
-  pipe_buf->data = NULL;
-  pipe_buf->capacity = 0;
 
   pipe_node->flags = FS_FILE;
   pipe_node->device = pipe_buf;
@@ -2507,11 +2594,11 @@ static uint64_t sys_link(uint64_t oldpath_ptr, uint64_t newpath_ptr,
   vfs_node_t *dst = vfs_finddir(parent, file_name);
   if (dst && src->length > 0) {
     uint8_t buf[512];
-    uint32_t offset = 0;
+    uint64_t offset = 0;
     while (offset < src->length) {
-      uint32_t chunk = src->length - offset;
-      if (chunk > sizeof(buf))
-        chunk = sizeof(buf);
+      uint32_t chunk = sizeof(buf);
+      if (chunk > src->length - offset)
+        chunk = src->length - offset;
       uint32_t rd = vfs_read(src, offset, chunk, buf);
       if (rd == 0)
         break;
@@ -2805,6 +2892,10 @@ void syscall_register_io(void) {
   syscall_register(SYS_MKDIRAT, sys_mkdirat);
   syscall_register(SYS_UNLINKAT, sys_unlinkat);
   syscall_register(SYS_FTRUNCATE, sys_ftruncate);
+  syscall_register(SYS_FSYNC, sys_fsync);
+  syscall_register(SYS_FDATASYNC, sys_fdatasync);
+  syscall_register(SYS_SYNC, sys_sync);
+  syscall_register(SYS_SYNCFS, sys_syncfs);
   syscall_register(SYS_FCNTL, sys_fcntl);
   syscall_register(SYS_STAT, sys_stat);
   syscall_register(SYS_FSTAT, sys_fstat);
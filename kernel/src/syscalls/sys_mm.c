@@ -3,6 +3,7 @@
 #include "../fs/vfs.h"
 #include "../lib/string.h"
 #include "../mm/pmm.h"
+#include "../mm/tlb.h"
 #include "../mm/vma.h"
 #include "../mm/vmm.h"
 #include "../sched/sched.h"
@@ -22,6 +23,11 @@
 
 #define MAP_FAILED ((uint64_t)-1)
 
+#define MADV_NORMAL 0
+#define MADV_RANDOM 1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED 3
+
 // ── Errno constants ──────────────────────────────────────────────────────────
 #define E_INVAL ((uint64_t)-22)
 #define E_NOMEM ((uint64_t)-12)
@@ -64,23 +70,29 @@ static uint64_t build_page_flags(uint64_t prot) {
 // ════════════════════════════════════════════════════════════════════════════
 
 static void safe_unmap_and_free(uint64_t *pml4, uint64_t va, uint64_t phys,
-                                bool free_phys, const char *ctx) {
+                                bool free_phys, struct tlb_batch *tlb,
+                                const char *ctx) {
   (void)ctx;
-  // Step 1: remove the PTE.  After this the frame is unreachable via this VA.
-  vmm_unmap_page(pml4, va);
+  // Step 1: remove the PTE.  After this the frame is unreachable via this VA
+  // on this CPU; other CPUs are flushed when the batch is finished.
+  vmm_unmap_page_batch(pml4, va, tlb);
 
-  // Step 2: only now is it safe to recycle the frame.
+  // Step 2: recycle the frame, but only once the batch has been flushed.
   if (free_phys && phys != 0) {
-    pmm_free((void *)phys);
+    tlb_batch_free_frame(tlb, phys);
   }
 }
 
 // teardown_range:
-//   Unmap [base, base+len) and free anonymous private frames.
-//   Used by both MAP_FIXED pre-teardown and munmap proper.
+//   Unmap [base, base+len) and free anonymous private frames, and drop the
+//   references of mappings that hold one per frame (VMA_PAGE_REFS).
+//   Used by MAP_FIXED pre-teardown, munmap proper, brk and mremap.
 //   Does NOT touch the VMA list — callers manage that themselves.
+//   Frames are released by tlb_batch_finish(tlb), which the caller issues
+//   after dropping mm->lock.
 static void teardown_range(uint64_t *pml4, struct thread *t, uint64_t base,
-                           uint64_t len, const char *ctx) {
+                           uint64_t len, struct tlb_batch *tlb,
+                           const char *ctx) {
   uint64_t end = base + len;
 
   for (uint64_t va = base; va < end; va += PAGE_SIZE) {
@@ -90,17 +102,34 @@ static void teardown_range(uint64_t *pml4, struct thread *t, uint64_t base,
 
     phys = PAGE_ALIGN_DOWN(phys); // Strip low flag bits VMM may leave set.
 
-    // Only free frames we own: anonymous private mappings.
+    // Only free frames we own: anonymous private mappings and mappings
+    // holding a reference per frame.
     bool free_phys = false;
     if (t && t->mm) {
       struct vma *v = vma_find(&t->mm->vmas, va);
-      if (v && v->fd == -1 && (v->flags & MAP_PRIVATE) &&
-          (v->flags & MAP_ANONYMOUS)) {
+      if (v && ((v->fd == -1 && (v->flags & MAP_PRIVATE) &&
+                 (v->flags & MAP_ANONYMOUS)) ||
+                (v->flags & VMA_PAGE_REFS))) {
         free_phys = true;
       }
     }
 
-    safe_unmap_and_free(pml4, va, phys, free_phys, ctx);
+    safe_unmap_and_free(pml4, va, phys, free_phys, tlb, ctx);
+  }
+}
+
+// teardown_range for callers holding no locks: the range is processed in
+// slices with one shootdown each, so the deferred frame list stays bounded
+// even for very large unmaps.
+static void teardown_range_sync(uint64_t *pml4, struct thread *t,
+                                uint64_t base, uint64_t len, const char *ctx) {
+  const uint64_t slice = (uint64_t)TLB_BATCH_FLUSH_FRAMES * PAGE_SIZE;
+  struct tlb_batch tlb;
+  tlb_batch_init(&tlb, (uint64_t)pml4);
+  for (uint64_t off = 0; off < len; off += slice) {
+    uint64_t n = len - off < slice ? len - off : slice;
+    teardown_range(pml4, t, base + off, n, &tlb, ctx);
+    tlb_batch_finish(&tlb);
   }
 }
 
@@ -126,6 +155,8 @@ uint64_t sys_mmap(uint64_t addr, uint64_t length, uint64_t prot, uint64_t flags,
   */
 
   // ── Validate flags ───────────────────────────────────────────────────────
+  // The ABI passes an int; the bits above are kernel-internal VMA flags.
+  flags &= 0xFFFFFFFFULL;
   bool is_shared = (flags & MAP_SHARED) != 0;
   bool is_private = (flags & MAP_PRIVATE) != 0;
 
@@ -168,8 +199,8 @@ uint64_t sys_mmap(uint64_t addr, uint64_t length, uint64_t prot, uint64_t flags,
     klog_uint64(vaddr + aligned_len);
     klog_puts(")\n");
 
-    teardown_range(pml4, current_thread, vaddr, aligned_len,
-                   "MAP_FIXED teardown");
+    teardown_range_sync(pml4, current_thread, vaddr, aligned_len,
+                        "MAP_FIXED teardown");
     if (current_thread && current_thread->mm) {
       spinlock_acquire(&current_thread->mm->lock);
       vma_remove(&current_thread->mm->vmas, vaddr, vaddr + aligned_len);
@@ -213,10 +244,15 @@ uint64_t sys_mmap(uint64_t addr, uint64_t length, uint64_t prot, uint64_t flags,
     if (result == MAP_FAILED || result == (uint64_t)-1)
       return MAP_FAILED;
 
+    uint64_t vma_flags = flags;
+    if (node->flags & FS_PAGE_REFS)
+      vma_flags |= VMA_PAGE_REFS;
+
     if (current_thread && current_thread->mm) {
       spinlock_acquire(&current_thread->mm->lock);
-      int vma_idx = vma_add(&current_thread->mm->vmas, result,
-                            result + aligned_len, prot, flags, (int)fd, offset);
+      int vma_idx =
+          vma_add(&current_thread->mm->vmas, result, result + aligned_len,
+                  prot, vma_flags, (int)fd, offset);
       spinlock_release(&current_thread->mm->lock);
       if (vma_idx < 0) {
         klog_puts("[MMAP] Warning: failed to register VMA for file mapping\n");
@@ -332,7 +368,7 @@ uint64_t sys_munmap(uint64_t addr, uint64_t length, uint64_t a2, uint64_t a3,
   // ── Unmap and free ───────────────────────────────────────────────────────
   // teardown_range handles the unmap-before-free ordering and guards.
   // It consults the VMA list to decide whether each frame is owned by us.
-  teardown_range(pml4, current, addr, aligned_len, "sys_munmap");
+  teardown_range_sync(pml4, current, addr, aligned_len, "sys_munmap");
 
   // ── Remove VMAs ──────────────────────────────────────────────────────────
   spinlock_acquire(&current->mm->lock);
@@ -382,6 +418,8 @@ static uint64_t sys_brk(uint64_t addr, uint64_t a1, uint64_t a2, uint64_t a3,
   }
 
   uint64_t *pml4 = vmm_get_active_pml4();
+  struct tlb_batch tlb;
+  tlb_batch_init(&tlb, (uint64_t)pml4);
 
   if (addr > current->mm->brk_current) {
     uint64_t old_end = PAGE_ALIGN_UP(current->mm->brk_current);
@@ -402,7 +440,7 @@ static uint64_t sys_brk(uint64_t addr, uint64_t a1, uint64_t a2, uint64_t a3,
       uint64_t phys = vmm_virt_to_phys(pml4, page);
       if (phys != 0) {
         phys = PAGE_ALIGN_DOWN(phys);
-        safe_unmap_and_free(pml4, page, phys, true, "sys_brk shrink");
+        safe_unmap_and_free(pml4, page, phys, true, &tlb, "sys_brk shrink");
       }
     }
 
@@ -412,12 +450,13 @@ static uint64_t sys_brk(uint64_t addr, uint64_t a1, uint64_t a2, uint64_t a3,
 
   uint64_t ret = current->mm->brk_current;
   spinlock_release(&current->mm->lock);
+  tlb_batch_finish(&tlb);
 
   return ret;
 }
 
 // ════════════════════════════════════════════════════════════════════════════
-// sys_mprotect  (unchanged from original — included for completeness)
+// sys_mprotect
 // Linux ABI: mprotect(addr, len, prot)
 // ════════════════════════════════════════════════════════════════════════════
 static uint64_t sys_mprotect(uint64_t addr, uint64_t len, uint64_t prot,
@@ -438,6 +477,11 @@ static uint64_t sys_mprotect(uint64_t addr, uint64_t len, uint64_t prot,
   if (!current)
     return E_INVAL;
 
+  // Every rewritten PTE goes into one batch: a single IPI per CPU running
+  // this mm (or a full flush for large ranges) once mm->lock is dropped.
+  struct tlb_batch tlb;
+  tlb_batch_init(&tlb, (uint64_t)pml4);
+
   spinlock_acquire(&current->mm->lock);
 
   for (uint64_t va = addr; va < addr + aligned_len; va += PAGE_SIZE) {
@@ -445,10 +489,25 @@ static uint64_t sys_mprotect(uint64_t addr, uint64_t len, uint64_t prot,
     if (phys == 0)
       continue;
 
+    // A private page must not become writable while its frame is shared
+    // with a file or a forked child: it stays (or becomes) COW and the write
+    // fault copies it. Sharing is judged after the unmap, which unshares a
+    // page table still shared since fork and takes the child's reference.
     uint64_t new_flags = build_page_flags(prot);
-    vmm_unmap_page(pml4, va);
-    if (!vmm_map_page(pml4, va, PAGE_ALIGN_DOWN(phys), new_flags)) {
+    bool cow = vmm_pte_is_cow(pml4, va);
+    vmm_unmap_page_batch(pml4, va, &tlb);
+    uint64_t frame = PAGE_ALIGN_DOWN(phys);
+    if (new_flags & PAGE_FLAG_RW) {
+      struct vma *vma = vma_find(&current->mm->vmas, va);
+      bool private_map = !vma || !(vma->flags & MAP_SHARED);
+      if (cow || (private_map && pmm_is_managed(frame) &&
+                  pmm_get_ref((void *)frame) > 1))
+        new_flags = (new_flags & ~PAGE_FLAG_RW) | PAGE_FLAG_COW;
+    }
+    if (!vmm_map_page_batch(pml4, va, frame, new_flags,
+                            &tlb)) {
       spinlock_release(&current->mm->lock);
+      tlb_batch_finish(&tlb);
       return E_NOMEM;
     }
   }
@@ -459,6 +518,7 @@ static uint64_t sys_mprotect(uint64_t addr, uint64_t len, uint64_t prot,
   vma_merge_adjacent(&current->mm->vmas);
 
   spinlock_release(&current->mm->lock);
+  tlb_batch_finish(&tlb);
 
   return 0;
 }
@@ -496,6 +556,8 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
   uint64_t aligned_old = PAGE_ALIGN_UP(old_size);
   uint64_t aligned_new = PAGE_ALIGN_UP(new_size);
   uint64_t *pml4 = vmm_get_active_pml4();
+  struct tlb_batch tlb;
+  tlb_batch_init(&tlb, (uint64_t)pml4);
 
   spinlock_acquire(&current->mm->lock);
 
@@ -504,10 +566,12 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
     if (aligned_new < aligned_old) {
       uint64_t trim_base = old_addr + aligned_new;
       uint64_t trim_len = aligned_old - aligned_new;
-      teardown_range(pml4, current, trim_base, trim_len, "mremap shrink");
+      teardown_range(pml4, current, trim_base, trim_len, &tlb,
+                     "mremap shrink");
       vma_remove(&current->mm->vmas, trim_base, trim_base + trim_len);
     }
     spinlock_release(&current->mm->lock);
+    tlb_batch_finish(&tlb);
     return old_addr;
   }
 
@@ -535,6 +599,7 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
   struct vma *orig_vma = vma_find(&current->mm->vmas, old_addr);
   if (!orig_vma) {
     spinlock_release(&current->mm->lock);
+    tlb_batch_finish(&tlb);
     return MAP_FAILED;
   }
   uint64_t prot = orig_vma->prot;
@@ -547,11 +612,13 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
       void *phys = pmm_alloc();
       if (!phys) {
         spinlock_release(&current->mm->lock);
+        tlb_batch_finish(&tlb);
         return MAP_FAILED; // OOM — leave partial state; not ideal but safe.
       }
-      if (!vmm_map_page(pml4, va, (uint64_t)phys, page_flags)) {
+      if (!vmm_map_page_batch(pml4, va, (uint64_t)phys, page_flags, &tlb)) {
         pmm_free(phys);
         spinlock_release(&current->mm->lock);
+        tlb_batch_finish(&tlb);
         return MAP_FAILED;
       }
       void *kva = (void *)((uint64_t)phys + HHDM_OFFSET);
@@ -562,6 +629,7 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
     vma_add(&current->mm->vmas, old_addr, old_addr + aligned_new, prot,
             vma_flags, -1, 0);
     spinlock_release(&current->mm->lock);
+    tlb_batch_finish(&tlb);
     return old_addr;
   }
 
@@ -569,6 +637,7 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
   // copy old data, and unmap the old region.
   if (!(flags & MREMAP_MAYMOVE)) {
     spinlock_release(&current->mm->lock);
+    tlb_batch_finish(&tlb);
     return MAP_FAILED;
   }
 
@@ -576,6 +645,7 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
                                    MMAP_REGION_BASE, MMAP_REGION_LIMIT);
   if (new_addr == 0 || new_addr + aligned_new > MMAP_REGION_LIMIT) {
     spinlock_release(&current->mm->lock);
+    tlb_batch_finish(&tlb);
     return MAP_FAILED;
   }
 
@@ -584,12 +654,14 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
     void *phys = pmm_alloc();
     if (!phys) {
       spinlock_release(&current->mm->lock);
+      tlb_batch_finish(&tlb);
       return MAP_FAILED;
     }
-    if (!vmm_map_page(pml4, new_addr + i * PAGE_SIZE, (uint64_t)phys,
-                      page_flags)) {
+    if (!vmm_map_page_batch(pml4, new_addr + i * PAGE_SIZE, (uint64_t)phys,
+                            page_flags, &tlb)) {
       pmm_free(phys);
       spinlock_release(&current->mm->lock);
+      tlb_batch_finish(&tlb);
       return MAP_FAILED;
     }
     void *kva = (void *)((uint64_t)phys + HHDM_OFFSET);
@@ -608,7 +680,7 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
   }
 
   // Tear down old mapping.
-  teardown_range(pml4, current, old_addr, aligned_old, "mremap move");
+  teardown_range(pml4, current, old_addr, aligned_old, &tlb, "mremap move");
   vma_remove(&current->mm->vmas, old_addr, old_addr + aligned_old);
 
   // Register new VMA.
@@ -619,18 +691,53 @@ static uint64_t sys_mremap(uint64_t old_addr, uint64_t old_size,
       MAX(current->mm->mmap_next_addr, new_addr + aligned_new);
 
   spinlock_release(&current->mm->lock);
+  tlb_batch_finish(&tlb);
   return new_addr;
 }
 
+// Readahead advice on file mappings is passed to the page cache of the
+// mapped file; everything else is accepted and ignored.
 static uint64_t sys_madvise(uint64_t addr, uint64_t len, uint64_t advice,
                             uint64_t a3, uint64_t a4, uint64_t a5) {
-  (void)addr;
-  (void)len;
-  (void)advice;
   (void)a3;
   (void)a4;
   (void)a5;
-  return 0; // Success stub
+  if (addr & (PAGE_SIZE - 1))
+    return E_INVAL;
+  if (advice != MADV_NORMAL && advice != MADV_RANDOM &&
+      advice != MADV_SEQUENTIAL && advice != MADV_WILLNEED)
+    return 0;
+
+  struct thread *current = sched_get_current();
+  if (!current || !current->mm)
+    return 0;
+
+  uint64_t end = addr + PAGE_ALIGN_UP(len);
+  while (addr < end) {
+    spinlock_acquire(&current->mm->lock);
+    struct vma *v = vma_find(&current->mm->vmas, addr);
+    uint64_t vstart = 0, vend = 0, voff = 0;
+    int fd = -1;
+    if (v) {
+      vstart = v->start;
+      vend = v->end;
+      voff = v->offset;
+      fd = v->fd;
+    }
+    spinlock_release(&current->mm->lock);
+    if (!v)
+      return E_NOMEM; // Unmapped hole, like Linux
+
+    uint64_t chunk_end = vend < end ? vend : end;
+    if (fd >= 0 && fd < MAX_FDS && current->fds[fd] &&
+        current->fds[fd]->readpage) {
+      uint64_t off = voff + (addr - vstart);
+      page_cache_advise(current->fds[fd], off, chunk_end - addr,
+                        (int)advice);
+    }
+    addr = chunk_end;
+  }
+  return 0;
 }
 
 // ════════════════════════════════════════════════════════════════════════════
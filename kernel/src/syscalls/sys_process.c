@@ -7,6 +7,8 @@
 #include "../lib/string.h"
 #include "../mm/heap.h"
 #include "../mm/pmm.h"
+#include "../mm/reaper.h"
+#include "../mm/tlb.h"
 #include "../mm/vma.h"
 #include "../mm/vmm.h"
 #include "../sched/sched.h"
@@ -90,6 +92,7 @@ void process_do_exit(uint64_t status) __attribute__((noreturn));
 void process_do_exit(uint64_t status) {
   struct thread *current = sched_get_current();
   if (current) {
+    sched_vfork_release(current);
     sched_reparent_children(current);
   }
 
@@ -136,11 +139,19 @@ void process_do_exit(uint64_t status) {
     // shared mm_struct and page tables once the thread is reaped.
     if (current->cr3) {
       struct cpu_info *cpu = cpu_get_current();
-      __asm__ volatile("mov %0, %%cr3" ::"r"(cpu->kernel_cr3) : "memory");
+      tlb_switch_mm(cpu, current->mm, NULL, cpu->kernel_cr3);
     }
   }
 
   if (current && current->is_forked_child) {
+    // Hand the address space to the reaper now rather than in the parent's
+    // wait4: we are already off this CR3, and a zombie needs no memory.
+    struct mm_struct *mm = current->mm;
+    uint64_t cr3 = current->cr3;
+    current->mm = NULL;
+    current->cr3 = 0;
+    mm_release(mm, cr3);
+
     current->exit_status = (int)status;
     current->state = THREAD_ZOMBIE;
 
@@ -421,13 +432,45 @@ static uint64_t sys_execve(struct syscall_regs *regs) {
   struct thread *current = sched_get_current();
   uint64_t old_cr3 = current->cr3;
 
-  // Save the old VMA list before destroying it — we need it to
-  // identify MAP_SHARED pages when freeing the old address space.
-  struct vma_list old_vmas = current->mm->vmas;
-  vma_list_init(&current->mm->vmas); // Reset to empty for the new program
+  // A CLONE_VM child (vfork, posix_spawn) is still running on its parent's
+  // address space. Give it a fresh mm instead of tearing the shared one
+  // down; the other users keep the old page tables and VMAs.
+  struct mm_struct *old_mm = current->mm;
+  spinlock_acquire(&old_mm->lock);
+  bool mm_shared = old_mm->ref_count > 1;
+  spinlock_release(&old_mm->lock);
+
+  struct vma_list old_vmas;
+  vma_list_init(&old_vmas);
+  if (mm_shared) {
+    struct mm_struct *new_mm = kmalloc(sizeof(struct mm_struct));
+    if (!new_mm) {
+      kfree(path);
+      for (int i = 0; i < argc; i++)
+        kfree(k_argv[i]);
+      kfree(k_argv);
+      for (int i = 0; i < envc; i++)
+        kfree(k_envp[i]);
+      kfree(k_envp);
+      vmm_free_user_pages((uint64_t)new_pml4);
+      return (uint64_t)-12;
+    }
+    memset(new_mm, 0, sizeof(struct mm_struct));
+    vma_list_init(&new_mm->vmas);
+    new_mm->stack_rlim_cur = old_mm->stack_rlim_cur;
+    new_mm->stack_rlim_max = old_mm->stack_rlim_max;
+    new_mm->ref_count = 1;
+    spinlock_init(&new_mm->lock);
+    current->mm = new_mm;
+  } else {
+    // Save the old VMA list before destroying it — we need it to
+    // identify MAP_SHARED pages when freeing the old address space.
+    old_vmas = current->mm->vmas;
+    vma_list_init(&current->mm->vmas); // Reset to empty for the new program
+  }
 
   current->cr3 = (uint64_t)new_pml4;
-  __asm__ volatile("mov %0, %%cr3" ::"r"(current->cr3) : "memory");
+  tlb_switch_mm(cpu_get_current(), old_mm, current->mm, current->cr3);
 
   // Reset memory management state for the new program
   mm_reset_mmap_state(current);
@@ -444,9 +487,15 @@ static uint64_t sys_execve(struct syscall_regs *regs) {
     klog_puts("[EXECVE] Failed to load ELF\n");
     // Revert CR3
     current->cr3 = old_cr3;
-    __asm__ volatile("mov %0, %%cr3" ::"r"(current->cr3) : "memory");
-    // Restore old VMA list
-    current->mm->vmas = old_vmas;
+    tlb_switch_mm(cpu_get_current(), current->mm, old_mm, current->cr3);
+    // Restore old mm / VMA list
+    if (mm_shared) {
+      vma_list_destroy(&current->mm->vmas);
+      kfree(current->mm);
+      current->mm = old_mm;
+    } else {
+      current->mm->vmas = old_vmas;
+    }
     kfree(path);
     for (int i = 0; i < argc; i++)
       kfree(k_argv[i]);
@@ -471,14 +520,16 @@ static uint64_t sys_execve(struct syscall_regs *regs) {
   klog_uint64(actual_entry);
   klog_puts("\n");
 
-  // Free the old address space (from fork) now that the new one is loaded.
-  // We've already switched CR3, so this is safe.
-  // Use the saved old_vmas to avoid freeing MAP_SHARED device pages.
-  if (old_cr3 != 0) {
-    vmm_free_user_pages_vma(old_cr3, &old_vmas);
+  if (mm_shared) {
+    // Drop our reference to the borrowed mm and let a vfork parent resume.
+    mm_release(old_mm, old_cr3);
+    sched_vfork_release(current);
+  } else {
+    // Free the old address space (from fork) now that the new one is loaded.
+    // We've already switched CR3, so this is safe. The reaper consumes the
+    // saved old_vmas to avoid freeing MAP_SHARED device pages.
+    mm_reaper_defer(old_cr3, &old_vmas);
   }
-  // Now destroy the old VMA tree nodes
-  vma_list_destroy(&old_vmas);
 
   // Cleanup kernel-side copies
   for (int i = 0; i < argc; i++)
@@ -516,7 +567,7 @@ static void fork_child_entry(void) {
   klog_puts(" entering userspace\n");
 
   // Switch to the child's cloned address space
-  __asm__ volatile("mov %0, %%cr3" ::"r"(self->cr3) : "memory");
+  tlb_switch_mm(cpu_get_current(), NULL, self->mm, self->cr3);
 
   // Set TSS rsp0 so interrupts and syscalls from Ring 3 use this CPU's
   // kernel stack.
@@ -605,11 +656,15 @@ uint64_t sys_fork(struct syscall_regs *regs) {
     // 7. Clone memory state
     child->mm = kmalloc(sizeof(struct mm_struct));
     if (child->mm) {
+      // Zeroed so that cpu_mask starts empty: tlb.c sends shootdowns to it
+      memset(child->mm, 0, sizeof(struct mm_struct));
       vma_list_init(&child->mm->vmas);
       vma_list_clone(&child->mm->vmas, &parent->mm->vmas);
       child->mm->brk_base = parent->mm->brk_base;
       child->mm->brk_current = parent->mm->brk_current;
       child->mm->mmap_next_addr = parent->mm->mmap_next_addr;
+      child->mm->stack_rlim_cur = parent->mm->stack_rlim_cur;
+      child->mm->stack_rlim_max = parent->mm->stack_rlim_max;
       child->mm->ref_count = 1;
       spinlock_init(&child->mm->lock);
     }
@@ -639,13 +694,9 @@ uint64_t sys_fork(struct syscall_regs *regs) {
 }
 
 // ── sys_clone ───────────────────────────────────────────────────────────────
-static uint64_t sys_clone(struct syscall_regs *regs) {
-  uint64_t flags = regs->rdi;
-  uint64_t child_stack = regs->rsi;
-  uint64_t ptid = regs->rdx;
-  uint64_t ctid = regs->r10;
-  uint64_t newtls = regs->r8;
-
+static uint64_t do_clone(struct syscall_regs *regs, uint64_t flags,
+                         uint64_t child_stack, uint64_t ptid, uint64_t ctid,
+                         uint64_t newtls) {
   klog_puts("[CLONE] flags=");
   klog_uint64(flags);
   klog_puts(" stack=");
@@ -680,12 +731,17 @@ static uint64_t sys_clone(struct syscall_regs *regs) {
     // Deep copy MM state
     child_mm = kmalloc(sizeof(struct mm_struct));
     if (child_mm) {
+      memset(child_mm, 0, sizeof(struct mm_struct)); // cpu_mask too
       vma_list_init(&child_mm->vmas);
+      child_mm->stack_rlim_cur = STACK_RLIMIT_DEFAULT;
+      child_mm->stack_rlim_max = RLIM_INFINITY;
       if (parent->mm) {
         vma_list_clone(&child_mm->vmas, &parent->mm->vmas);
         child_mm->brk_base = parent->mm->brk_base;
         child_mm->brk_current = parent->mm->brk_current;
         child_mm->mmap_next_addr = parent->mm->mmap_next_addr;
+        child_mm->stack_rlim_cur = parent->mm->stack_rlim_cur;
+        child_mm->stack_rlim_max = parent->mm->stack_rlim_max;
       }
       child_mm->ref_count = 1;
       spinlock_init(&child_mm->lock);
@@ -803,11 +859,39 @@ static uint64_t sys_clone(struct syscall_regs *regs) {
   // children list. Adding it again here would create a circular list and
   // cause wait4 to hang or double-reap.
 
+  // CLONE_VFORK: the child borrows our address space, so we must not touch
+  // it (or return onto a stack the child may be using) until the child has
+  // exec'd or exited. The child cannot be reaped before we wake: only we can
+  // wait4 for it.
+  if (flags & CLONE_VFORK)
+    child->vfork_pending = true;
+
   sched_enqueue_thread(child, cpu_get_current());
 
+  while (child->vfork_pending) {
+    parent->state = THREAD_BLOCKED;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!child->vfork_pending) {
+      parent->state = THREAD_RUNNING;
+      break;
+    }
+    sched_yield();
+  }
+
   return child->tid;
 }
 
+static uint64_t sys_clone(struct syscall_regs *regs) {
+  return do_clone(regs, regs->rdi, regs->rsi, regs->rdx, regs->r10, regs->r8);
+}
+
+// ── sys_vfork ───────────────────────────────────────────────────────────────
+// Equivalent to clone(CLONE_VM | CLONE_VFORK | SIGCHLD): no address space
+// copy at all, the child runs on the parent's mm until it execs or exits.
+static uint64_t sys_vfork(struct syscall_regs *regs) {
+  return do_clone(regs, CLONE_VM | CLONE_VFORK | SIGCHLD, 0, 0, 0, 0);
+}
+
 // ── sys_uname ─────────────────────────────────────────────────────────────
 struct utsname {
   char sysname[65];
@@ -1111,6 +1195,104 @@ static uint64_t sys_setitimer(uint64_t which, uint64_t new_val_ptr,
   return 0;
 }
 
+// ── Resource limits ─────────────────────────────────────────────────────────
+// Only RLIMIT_STACK is backed by real state (it bounds GROWSDOWN stack
+// growth in the page-fault handler); every other resource reports
+// RLIM_INFINITY and silently accepts new values.
+struct rlimit64 {
+  uint64_t rlim_cur;
+  uint64_t rlim_max;
+};
+
+static uint64_t do_prlimit(struct thread *t, uint64_t resource,
+                           uint64_t new_ptr, uint64_t old_ptr) {
+  if (resource >= RLIM_NLIMITS)
+    return (uint64_t)-22; // EINVAL
+  if (new_ptr &&
+      !vmm_is_user_addr_range_valid(new_ptr, sizeof(struct rlimit64)))
+    return (uint64_t)-14; // EFAULT
+  if (old_ptr &&
+      !vmm_is_user_addr_range_valid(old_ptr, sizeof(struct rlimit64)))
+    return (uint64_t)-14; // EFAULT
+
+  struct rlimit64 nl = {0, 0};
+  if (new_ptr) {
+    nl = *(struct rlimit64 *)new_ptr;
+    if (nl.rlim_cur > nl.rlim_max)
+      return (uint64_t)-22; // EINVAL
+  }
+
+  if (resource != RLIMIT_STACK || !t->mm) {
+    if (old_ptr) {
+      struct rlimit64 *ol = (struct rlimit64 *)old_ptr;
+      ol->rlim_cur = RLIM_INFINITY;
+      ol->rlim_max = RLIM_INFINITY;
+    }
+    return 0;
+  }
+
+  struct mm_struct *mm = t->mm;
+  spinlock_acquire(&mm->lock);
+  struct rlimit64 old = {mm->stack_rlim_cur, mm->stack_rlim_max};
+  if (new_ptr) {
+    if (nl.rlim_max > mm->stack_rlim_max && t->euid != 0) {
+      spinlock_release(&mm->lock);
+      return (uint64_t)-1; // EPERM
+    }
+    mm->stack_rlim_cur = nl.rlim_cur;
+    mm->stack_rlim_max = nl.rlim_max;
+  }
+  spinlock_release(&mm->lock);
+
+  if (old_ptr)
+    *(struct rlimit64 *)old_ptr = old;
+  return 0;
+}
+
+static uint64_t sys_getrlimit(uint64_t resource, uint64_t rlim_ptr,
+                              uint64_t a2, uint64_t a3, uint64_t a4,
+                              uint64_t a5) {
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  struct thread *t = sched_get_current();
+  if (!t)
+    return (uint64_t)-3; // ESRCH
+  if (!rlim_ptr)
+    return (uint64_t)-14; // EFAULT
+  return do_prlimit(t, resource, 0, rlim_ptr);
+}
+
+static uint64_t sys_setrlimit(uint64_t resource, uint64_t rlim_ptr,
+                              uint64_t a2, uint64_t a3, uint64_t a4,
+                              uint64_t a5) {
+  (void)a2;
+  (void)a3;
+  (void)a4;
+  (void)a5;
+  struct thread *t = sched_get_current();
+  if (!t)
+    return (uint64_t)-3; // ESRCH
+  if (!rlim_ptr)
+    return (uint64_t)-14; // EFAULT
+  return do_prlimit(t, resource, rlim_ptr, 0);
+}
+
+static uint64_t sys_prlimit64(uint64_t pid, uint64_t resource,
+                              uint64_t new_ptr, uint64_t old_ptr, uint64_t a4,
+                              uint64_t a5) {
+  (void)a4;
+  (void)a5;
+  struct thread *t = sched_get_current();
+  if (!t)
+    return (uint64_t)-3; // ESRCH
+  // Limits live in the mm, so only the caller's own process is reachable.
+  if ((int)pid != 0 && (uint32_t)pid != t->tid)
+    return (uint64_t)-3; // ESRCH
+  return do_prlimit(t, resource, new_ptr, old_ptr);
+}
+
 // ── Registration ────────────────────────────────────────────────────────────
 static uint64_t sys_sched_yield(uint64_t a0, uint64_t a1, uint64_t a2,
                                 uint64_t a3, uint64_t a4, uint64_t a5) {
@@ -1138,6 +1320,7 @@ void syscall_register_process(void) {
   syscall_register(SYS_SETITIMER, sys_setitimer);
   syscall_register_raw(SYS_FORK, sys_fork);
   syscall_register_raw(SYS_CLONE, sys_clone);
+  syscall_register_raw(SYS_VFORK, sys_vfork);
   syscall_register_raw(SYS_EXECVE, sys_execve);
   syscall_register_raw(SYS_UMASK, sys_umask);
   syscall_register_raw(SYS_GETUID, sys_getuid);
@@ -1156,4 +1339,7 @@ void syscall_register_process(void) {
   syscall_register_raw(SYS_SETUID, sys_setuid);
   syscall_register_raw(SYS_SETGID, sys_setgid);
   syscall_register(SYS_SCHED_YIELD, sys_sched_yield);
+  syscall_register(SYS_GETRLIMIT, sys_getrlimit);
+  syscall_register(SYS_SETRLIMIT, sys_setrlimit);
+  syscall_register(SYS_PRLIMIT64, sys_prlimit64);
 }
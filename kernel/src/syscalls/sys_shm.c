@@ -11,6 +11,7 @@
 #include "../lock/spinlock.h"
 #include "../mm/pmm.h"
 #include "../mm/shm.h"
+#include "../mm/tlb.h"
 #include "../mm/vma.h"
 #include "../mm/vmm.h"
 #include "../sched/sched.h"
@@ -156,6 +157,25 @@ int64_t sys_shmget(uint64_t key, uint64_t size, uint64_t shmflg, uint64_t a3,
   return (int64_t)id;
 }
 
+// Drop one attach (shm_lock held). If the segment was marked for
+// destruction and this was the last attach, free it.
+static void shm_put_locked(struct shm_segment *seg) {
+  if (seg->nattch > 0)
+    seg->nattch--;
+  if (seg->marked_destroy && seg->nattch == 0) {
+    for (uint32_t i = 0; i < seg->num_pages; i++) {
+      // Only free if refcount is 0 (all detached)
+      if (pmm_get_ref((void *)seg->phys_pages[i]) == 0) {
+        pmm_free_page((void *)seg->phys_pages[i]);
+      }
+    }
+    seg->active = false;
+    klog_puts("[SHM] Segment destroyed (deferred): shmid=");
+    klog_uint64(seg->shmid);
+    klog_puts("\n");
+  }
+}
+
 // ── sys_shmat ───────────────────────────────────────────────────────────────
 
 #define SHM_MMAP_REGION_BASE 0x7E0000000000ULL
@@ -218,25 +238,38 @@ int64_t sys_shmat(uint64_t shmid, uint64_t shmaddr, uint64_t shmflg,
     }
   }
 
-  // Map each page of the segment
+  // Pin the segment and its pages, then map them with shm_lock dropped:
+  // vmm_map_page() may have to send a TLB shootdown and wait for it.
+  for (uint32_t i = 0; i < seg->num_pages; i++)
+    pmm_incref((void *)seg->phys_pages[i]);
+  seg->nattch++;
+  uint32_t num_pages = seg->num_pages;
+  uint64_t *phys_pages = seg->phys_pages;
+  spinlock_release(&shm_lock);
+
   uint64_t *pml4 = vmm_get_active_pml4();
   uint64_t flags = PAGE_FLAG_PRESENT | PAGE_FLAG_USER;
   if (!(shmflg & SHM_RDONLY)) {
     flags |= PAGE_FLAG_RW;
   }
 
-  for (uint32_t i = 0; i < seg->num_pages; i++) {
-    uint64_t phys = seg->phys_pages[i];
-    if (!vmm_map_page(pml4, vaddr + i * PAGE_SIZE, phys, flags)) {
-      // Rollback mapped pages
-      for (uint32_t j = 0; j < i; j++) {
-        vmm_unmap_page(pml4, vaddr + j * PAGE_SIZE);
-      }
-      spinlock_release(&shm_lock);
-      return -12; // ENOMEM
+  for (uint32_t i = 0; i < num_pages; i++) {
+    if (vmm_map_page(pml4, vaddr + i * PAGE_SIZE, phys_pages[i], flags))
+      continue;
+    // Rollback: mapped pages are released once other CPUs are flushed
+    struct tlb_batch tlb;
+    tlb_batch_init(&tlb, (uint64_t)pml4);
+    for (uint32_t j = 0; j < i; j++) {
+      vmm_unmap_page_batch(pml4, vaddr + j * PAGE_SIZE, &tlb);
+      tlb_batch_free_frame(&tlb, phys_pages[j]);
     }
-    // Increment refcount so page isn't freed on process exit
-    pmm_incref((void *)phys);
+    tlb_batch_finish(&tlb);
+    for (uint32_t j = i; j < num_pages; j++)
+      pmm_decref((void *)phys_pages[j]);
+    spinlock_acquire(&shm_lock);
+    shm_put_locked(seg);
+    spinlock_release(&shm_lock);
+    return -12; // ENOMEM
   }
 
   // Register VMA as MAP_SHARED. We avoid MAP_ANONYMOUS because this is backed 
@@ -250,9 +283,8 @@ int64_t sys_shmat(uint64_t shmid, uint64_t shmaddr, uint64_t shmflg,
             MAP_SHARED, -1, 0);
   }
 
-  seg->nattch++;
+  spinlock_acquire(&shm_lock);
   seg->last_pid = t->tid;
-
   spinlock_release(&shm_lock);
 
   klog_puts("[SHM] Attached shmid=");
@@ -313,14 +345,16 @@ int64_t sys_shmdt(uint64_t shmaddr, uint64_t a1, uint64_t a2, uint64_t a3,
     }
   }
 
-  // Unmap pages and decrement refcounts
+  // Unmap pages and decrement refcounts (after the shootdown, below)
+  struct tlb_batch tlb;
+  tlb_batch_init(&tlb, (uint64_t)pml4);
   for (uint32_t i = 0; i < num_pages; i++) {
     uint64_t va = shmaddr + i * PAGE_SIZE;
     uint64_t phys = vmm_virt_to_phys(pml4, va);
     if (phys) {
       phys &= 0x000FFFFFFFFFF000ULL;
-      vmm_unmap_page(pml4, va);
-      pmm_decref((void *)phys);
+      vmm_unmap_page_batch(pml4, va, &tlb);
+      tlb_batch_free_frame(&tlb, phys);
     }
   }
 
@@ -330,26 +364,12 @@ int64_t sys_shmdt(uint64_t shmaddr, uint64_t a1, uint64_t a2, uint64_t a3,
   }
 
   if (seg) {
-    if (seg->nattch > 0)
-      seg->nattch--;
+    shm_put_locked(seg);
     seg->last_pid = t->tid;
-
-    // If marked for destruction and no more attaches, free the segment
-    if (seg->marked_destroy && seg->nattch == 0) {
-      for (uint32_t i = 0; i < seg->num_pages; i++) {
-        // Only free if refcount is 0 (all detached)
-        if (pmm_get_ref((void *)seg->phys_pages[i]) == 0) {
-          pmm_free_page((void *)seg->phys_pages[i]);
-        }
-      }
-      seg->active = false;
-      klog_puts("[SHM] Segment destroyed (deferred): shmid=");
-      klog_uint64(seg->shmid);
-      klog_puts("\n");
-    }
   }
 
   spinlock_release(&shm_lock);
+  tlb_batch_finish(&tlb);
 
   klog_puts("[SHM] Detached at ");
   klog_uint64(shmaddr);
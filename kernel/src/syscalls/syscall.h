@@ -62,6 +62,7 @@
 #define SYS_GETSOCKOPT 55
 #define SYS_CLONE 56
 #define SYS_FORK 57
+#define SYS_VFORK 58
 #define SYS_EXECVE 59
 #define SYS_EXIT 60
 #define SYS_WAIT4 61
@@ -69,6 +70,8 @@
 #define SYS_UNAME 63
 #define SYS_SHMDT 67
 #define SYS_FCNTL 72
+#define SYS_FSYNC 74
+#define SYS_FDATASYNC 75
 #define SYS_FTRUNCATE 77
 #define SYS_GETCWD 79
 #define SYS_CHDIR 80
@@ -84,6 +87,7 @@
 #define SYS_CHOWN 92
 #define SYS_UMASK 95
 #define SYS_GETTIMEOFDAY 96
+#define SYS_GETRLIMIT 97
 #define SYS_GETUID 102
 #define SYS_GETGID 104
 #define SYS_SETUID 105
@@ -104,6 +108,8 @@
 #define SYS_MLOCK 149
 #define SYS_PRCTL 157
 #define SYS_ARCH_PRCTL 158
+#define SYS_SETRLIMIT 160
+#define SYS_SYNC 162
 #define SYS_SIGPROCMASK 186
 #define SYS_TGKILL 200
 #define SYS_FUTEX 202
@@ -131,6 +137,8 @@
 #define SYS_EVENTFD2 290
 #define SYS_EPOLL_CREATE1 291
 #define SYS_PIPE2 293
+#define SYS_PRLIMIT64 302
+#define SYS_SYNCFS 306
 #define SYS_GETRANDOM 318
 #define SYS_MEMBARRIER 324
 #define SYS_STATX 332
@@ -0,0 +1,37 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Helpers shared by the test_* benchmarks.
+
+// Monotonic time in nanoseconds.
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Value of one /proc/vmstat counter, 0 if it is missing.
+static inline uint64_t vmstat_value(const char *key) {
+    FILE *f = fopen("/proc/vmstat", "r");
+    if (!f)
+        return 0;
+    char line[128];
+    uint64_t val = 0;
+    size_t len = strlen(key);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, key, len) == 0 && line[len] == ' ') {
+            val = strtoull(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return val;
+}
+
+#endif
@@ -0,0 +1,135 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// stat() at the bottom of a deep path, to show what the dcache saves.
+//
+// Builds a DEPTH-deep directory chain, then times repeated stat() of the
+// file at its bottom and of a name that does not exist there (negative
+// lookups). The first call walks the disk, the rest should be served by
+// the dcache; the dcache_* counters from /proc/vmstat are printed to show
+// it. Finally the cache is checked for staleness: the file is removed,
+// recreated and renamed, and stat() must follow every change.
+
+#define BASE "/dcache_test"
+#define DEPTH 8
+#define DEFAULT_ITERS 20000
+
+static int make_file(const char *path, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    char buf[64];
+    memset(buf, 'd', sizeof(buf));
+    size_t done = 0;
+    while (done < size) {
+        size_t n = size - done < sizeof(buf) ? size - done : sizeof(buf);
+        if (write(fd, buf, n) != (ssize_t)n)
+            break;
+        done += n;
+    }
+    close(fd);
+    return done == size ? 0 : -1;
+}
+
+// Time iters stat() calls of path. want_ok: whether the file should exist.
+static int stat_pass(const char *name, const char *path, int iters,
+                     int want_ok) {
+    struct stat st;
+    uint64_t hit0 = vmstat_value("dcache_hit");
+    uint64_t neg0 = vmstat_value("dcache_negative_hit");
+    uint64_t miss0 = vmstat_value("dcache_miss");
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < iters; i++) {
+        if ((stat(path, &st) == 0) != want_ok) {
+            printf("  %-22s FAILED at iteration %d\n", name, i);
+            return -1;
+        }
+    }
+    uint64_t ns = now_ns() - start;
+
+    printf("  %-22s %6llu ns/call  (hit +%llu, negative +%llu, miss +%llu)\n",
+           name, (unsigned long long)(ns / (uint64_t)iters),
+           (unsigned long long)(vmstat_value("dcache_hit") - hit0),
+           (unsigned long long)(vmstat_value("dcache_negative_hit") - neg0),
+           (unsigned long long)(vmstat_value("dcache_miss") - miss0));
+    return 0;
+}
+
+static int expect_size(const char *path, off_t size) {
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return size < 0 ? 0 : -1;
+    return st.st_size == size ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    int iters = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERS;
+    if (iters <= 0)
+        iters = DEFAULT_ITERS;
+
+    char dir[256];
+    strcpy(dir, BASE);
+    mkdir(dir, 0755);
+    for (int i = 0; i < DEPTH; i++) {
+        size_t len = strlen(dir);
+        snprintf(dir + len, sizeof(dir) - len, "/level%d", i);
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            printf("[DCACHE] cannot create %s\n", dir);
+            return 1;
+        }
+    }
+
+    char file[300], missing[300], renamed[300];
+    snprintf(file, sizeof(file), "%s/leaf", dir);
+    snprintf(missing, sizeof(missing), "%s/missing", dir);
+    snprintf(renamed, sizeof(renamed), "%s/leaf.moved", dir);
+    unlink(renamed);
+    if (make_file(file, 100) != 0) {
+        printf("[DCACHE] cannot create %s\n", file);
+        return 1;
+    }
+
+    printf("[DCACHE] %d x stat() at depth %d\n", iters, DEPTH + 2);
+    int errors = 0;
+    if (stat_pass("existing file", file, iters, 1) != 0)
+        errors++;
+    if (stat_pass("missing file", missing, iters, 0) != 0)
+        errors++;
+
+    // Every namespace change must be visible through the cache
+    if (unlink(file) != 0 || expect_size(file, -1) != 0) {
+        printf("  unlink: stale entry\n");
+        errors++;
+    }
+    if (make_file(file, 200) != 0 || expect_size(file, 200) != 0) {
+        printf("  create: stale entry\n");
+        errors++;
+    }
+    if (make_file(file, 300) != 0 || expect_size(file, 300) != 0) {
+        printf("  rewrite: stale size\n");
+        errors++;
+    }
+    if (rename(file, renamed) != 0 || expect_size(file, -1) != 0 ||
+        expect_size(renamed, 300) != 0) {
+        printf("  rename: stale entry\n");
+        errors++;
+    }
+    unlink(renamed);
+
+    printf("[DCACHE] nr_dentry %llu\n",
+           (unsigned long long)vmstat_value("nr_dentry"));
+    if (errors) {
+        printf("[DCACHE] FAIL: %d check(s) failed\n", errors);
+        return 1;
+    }
+    printf("[DCACHE] PASS\n");
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// One ext2 directory with thousands of names (htree).
+//
+// Creates NR_FILES empty files in one directory and prints the create and
+// stat() cost of each quarter. With a linear directory both grow with the
+// number of entries already there; with the index they should stay flat.
+// Then every third file is removed and every name is looked up again to
+// check that the index follows the removals.
+
+#define DIR_PATH "/dir_index_test"
+#define DEFAULT_FILES 20000
+
+static void file_name(char *buf, size_t len, int i) {
+    snprintf(buf, len, DIR_PATH "/entry_%07d.dat", i);
+}
+
+int main(int argc, char **argv) {
+    int nr = argc > 1 ? atoi(argv[1]) : DEFAULT_FILES;
+    if (nr < 4)
+        nr = DEFAULT_FILES;
+
+    if (mkdir(DIR_PATH, 0755) != 0 && errno != EEXIST) {
+        printf("[DIR-INDEX] cannot create " DIR_PATH "\n");
+        return 1;
+    }
+
+    printf("[DIR-INDEX] %d files in one directory\n", nr);
+    char path[128];
+    struct stat st;
+    int errors = 0;
+    int quarter = nr / 4;
+    for (int q = 0; q < 4; q++) {
+        int first = q * quarter;
+        int last = q == 3 ? nr : first + quarter;
+
+        uint64_t start = now_ns();
+        for (int i = first; i < last; i++) {
+            file_name(path, sizeof(path), i);
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                if (errors++ < 5)
+                    printf("  create %s failed\n", path);
+                continue;
+            }
+            close(fd);
+        }
+        uint64_t create_ns = now_ns() - start;
+
+        start = now_ns();
+        for (int i = first; i < last; i++) {
+            file_name(path, sizeof(path), i);
+            if (stat(path, &st) != 0 && errors++ < 5)
+                printf("  stat %s failed\n", path);
+        }
+        uint64_t stat_ns = now_ns() - start;
+
+        int n = last - first;
+        printf("  entries %6d-%6d: create %7llu ns, stat %7llu ns\n", first,
+               last - 1, (unsigned long long)(create_ns / (uint64_t)n),
+               (unsigned long long)(stat_ns / (uint64_t)n));
+    }
+
+    for (int i = 0; i < nr; i += 3) {
+        file_name(path, sizeof(path), i);
+        if (unlink(path) != 0 && errors++ < 5)
+            printf("  unlink %s failed\n", path);
+    }
+    for (int i = 0; i < nr; i++) {
+        file_name(path, sizeof(path), i);
+        int want = i % 3 != 0;
+        if ((stat(path, &st) == 0) != want && errors++ < 5)
+            printf("  %s: expected %s\n", path, want ? "present" : "absent");
+    }
+    for (int i = 0; i < nr; i++) {
+        file_name(path, sizeof(path), i);
+        unlink(path);
+    }
+    rmdir(DIR_PATH);
+
+    if (errors) {
+        printf("[DIR-INDEX] FAIL: %d error(s)\n", errors);
+        return 1;
+    }
+    printf("[DIR-INDEX] PASS\n");
+    return 0;
+}
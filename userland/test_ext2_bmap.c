@@ -0,0 +1,126 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// What mapping file blocks to disk blocks costs in ext2.
+//
+// Writes a SIZE_MB file (large enough to need double-indirect blocks with
+// 1 KiB blocks), then reads it back sequentially and at random offsets.
+// Each pass prints its throughput and how many buffer-cache lookups it
+// caused per MiB: with the per-inode extent runs a sequential pass should
+// no longer touch the indirect blocks once per data block. The data read
+// back is checked against what was written.
+
+#define PATH "/bmap_test.bin"
+#define DEFAULT_SIZE_MB 24
+#define CHUNK 4096
+#define RANDOM_READS 4096
+
+static uint64_t bcache_lookups(void) {
+    return vmstat_value("bcache_hit") + vmstat_value("bcache_miss");
+}
+
+static void fill(char *buf, uint64_t chunk) {
+    for (int i = 0; i < CHUNK; i++)
+        buf[i] = (char)(chunk * 7 + i);
+}
+
+static int write_file(uint64_t size) {
+    int fd = open(PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    char buf[CHUNK];
+    for (uint64_t c = 0; c < size / CHUNK; c++) {
+        fill(buf, c);
+        if (write(fd, buf, CHUNK) != CHUNK) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static void report(const char *name, uint64_t bytes, uint64_t ns,
+                   uint64_t lookups) {
+    uint64_t mib = bytes >> 20 ? bytes >> 20 : 1;
+    uint64_t kib_s = ns ? bytes * 1000000000ULL / ns / 1024 : 0;
+    printf("  %-12s %8llu KiB/s  %6llu bcache lookups/MiB\n", name,
+           (unsigned long long)kib_s, (unsigned long long)(lookups / mib));
+}
+
+static int read_pass(int fd, uint64_t size) {
+    char buf[CHUNK], want[CHUNK];
+    uint64_t lk = bcache_lookups();
+    uint64_t start = now_ns();
+    for (uint64_t c = 0; c < size / CHUNK; c++) {
+        if (pread(fd, buf, CHUNK, (off_t)(c * CHUNK)) != CHUNK)
+            return -1;
+        fill(want, c);
+        if (memcmp(buf, want, CHUNK) != 0) {
+            printf("  mismatch at chunk %llu\n", (unsigned long long)c);
+            return -1;
+        }
+    }
+    report("sequential", size, now_ns() - start, bcache_lookups() - lk);
+    return 0;
+}
+
+static int random_pass(int fd, uint64_t size) {
+    char buf[CHUNK], want[CHUNK];
+    uint64_t chunks = size / CHUNK;
+    uint32_t seed = 12345;
+    uint64_t lk = bcache_lookups();
+    uint64_t start = now_ns();
+    for (int i = 0; i < RANDOM_READS; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint64_t c = (seed >> 8) % chunks;
+        if (pread(fd, buf, CHUNK, (off_t)(c * CHUNK)) != CHUNK)
+            return -1;
+        fill(want, c);
+        if (memcmp(buf, want, CHUNK) != 0) {
+            printf("  mismatch at chunk %llu\n", (unsigned long long)c);
+            return -1;
+        }
+    }
+    report("random", (uint64_t)RANDOM_READS * CHUNK, now_ns() - start,
+           bcache_lookups() - lk);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint64_t size = (uint64_t)(argc > 1 ? atoi(argv[1]) : DEFAULT_SIZE_MB) << 20;
+    if (size == 0)
+        size = (uint64_t)DEFAULT_SIZE_MB << 20;
+
+    printf("[EXT2-BMAP] %llu MiB file\n", (unsigned long long)(size >> 20));
+    if (write_file(size) != 0) {
+        printf("[EXT2-BMAP] FAIL: cannot write %s\n", PATH);
+        return 1;
+    }
+    int fd = open(PATH, O_RDONLY);
+    if (fd < 0) {
+        printf("[EXT2-BMAP] FAIL: cannot open %s\n", PATH);
+        return 1;
+    }
+
+    int errors = 0;
+    if (read_pass(fd, size) != 0)
+        errors++;
+    if (random_pass(fd, size) != 0)
+        errors++;
+    close(fd);
+    unlink(PATH);
+
+    if (errors) {
+        printf("[EXT2-BMAP] FAIL: %d pass(es) failed\n", errors);
+        return 1;
+    }
+    printf("[EXT2-BMAP] PASS\n");
+    return 0;
+}
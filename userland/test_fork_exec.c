@@ -0,0 +1,212 @@
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// fork, vfork and posix_spawn from a parent with a large address space.
+//
+// The parent first populates a large private anonymous mapping so that fork
+// has a realistic amount of page-table state to duplicate (think bash or an
+// X client), then measures:
+//   1. fork + immediate _exit in the child
+//   2. fork + execve("/bin/hello") in the child
+//   3. fork + child writing one byte per 2 MiB (forces PT unsharing + CoW)
+//   4. vfork + execve and posix_spawn (no address space copy at all)
+// and finally checks that parent and child memory stayed isolated.
+
+#define PAGE_SIZE 4096
+#define DEFAULT_MB 64
+#define ITERATIONS 50
+#define EXEC_PATH "/bin/hello"
+
+static void report(const char *name, uint64_t total_ns, int iters) {
+    uint64_t avg = total_ns / (uint64_t)iters;
+    printf("  %-28s avg %4llu.%03llu ms  (%d iterations)\n", name,
+           (unsigned long long)(avg / 1000000ULL),
+           (unsigned long long)((avg / 1000ULL) % 1000ULL), iters);
+}
+
+static int wait_child(pid_t pid) {
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0) {
+        perror("waitpid");
+        return -1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("[FORKEXEC] child %d failed (status 0x%x)\n", pid, status);
+        return -1;
+    }
+    return 0;
+}
+
+extern char **environ;
+
+int main(int argc, char **argv) {
+    size_t mb = DEFAULT_MB;
+    if (argc > 1)
+        mb = (size_t)atoi(argv[1]);
+    if (mb == 0)
+        mb = DEFAULT_MB;
+    size_t size = mb * 1024 * 1024;
+
+    printf("[FORKEXEC] Populating %zu MiB private anonymous mapping...\n", mb);
+    uint8_t *buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    for (size_t off = 0; off < size; off += PAGE_SIZE)
+        buf[off] = (uint8_t)(off >> 12);
+
+    printf("[FORKEXEC] Results:\n");
+
+    // 1. fork + _exit
+    uint64_t total = 0;
+    for (int i = 0; i < ITERATIONS; i++) {
+        uint64_t t0 = now_ns();
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0)
+            _exit(0);
+        if (wait_child(pid) < 0)
+            return 1;
+        total += now_ns() - t0;
+    }
+    report("fork + _exit", total, ITERATIONS);
+
+    // 2. fork + execve
+    total = 0;
+    for (int i = 0; i < ITERATIONS; i++) {
+        uint64_t t0 = now_ns();
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) {
+                dup2(devnull, 1);
+                close(devnull);
+            }
+            char *child_argv[] = {EXEC_PATH, NULL};
+            char *child_envp[] = {NULL};
+            execve(EXEC_PATH, child_argv, child_envp);
+            _exit(127);
+        }
+        if (wait_child(pid) < 0)
+            return 1;
+        total += now_ns() - t0;
+    }
+    report("fork + execve(" EXEC_PATH ")", total, ITERATIONS);
+
+    // 3. fork + sparse child writes (one per 2 MiB page table)
+    total = 0;
+    for (int i = 0; i < ITERATIONS / 5; i++) {
+        uint64_t t0 = now_ns();
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            for (size_t off = 0; off < size; off += 2 * 1024 * 1024)
+                buf[off] = 0xEE;
+            _exit(0);
+        }
+        if (wait_child(pid) < 0)
+            return 1;
+        total += now_ns() - t0;
+    }
+    report("fork + write per 2 MiB", total, ITERATIONS / 5);
+
+    // 4. vfork + execve: the parent is suspended until the child execs
+    total = 0;
+    for (int i = 0; i < ITERATIONS; i++) {
+        uint64_t t0 = now_ns();
+        pid_t pid = vfork();
+        if (pid < 0) {
+            perror("vfork");
+            return 1;
+        }
+        if (pid == 0) {
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) {
+                dup2(devnull, 1);
+                close(devnull);
+            }
+            char *child_argv[] = {EXEC_PATH, NULL};
+            char *child_envp[] = {NULL};
+            execve(EXEC_PATH, child_argv, child_envp);
+            _exit(127);
+        }
+        if (wait_child(pid) < 0)
+            return 1;
+        total += now_ns() - t0;
+    }
+    report("vfork + execve(" EXEC_PATH ")", total, ITERATIONS);
+
+    // 5. posix_spawn (musl uses clone(CLONE_VM | CLONE_VFORK))
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+    total = 0;
+    for (int i = 0; i < ITERATIONS; i++) {
+        uint64_t t0 = now_ns();
+        pid_t pid;
+        char *child_argv[] = {EXEC_PATH, NULL};
+        int err = posix_spawn(&pid, EXEC_PATH, &fa, NULL, child_argv, environ);
+        if (err != 0) {
+            printf("[FORKEXEC] posix_spawn failed: %d\n", err);
+            return 1;
+        }
+        if (wait_child(pid) < 0)
+            return 1;
+        total += now_ns() - t0;
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    report("posix_spawn(" EXEC_PATH ")", total, ITERATIONS);
+
+    // 6. Isolation check: the child sees the parent's data, and the child's
+    // writes must not leak back into the parent.
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        for (size_t off = 0; off < size; off += PAGE_SIZE) {
+            if (buf[off] != (uint8_t)(off >> 12)) {
+                printf("[FORKEXEC] FAILURE: child saw 0x%02x at offset %zu\n",
+                       buf[off], off);
+                _exit(1);
+            }
+        }
+        for (size_t off = 0; off < size; off += PAGE_SIZE)
+            buf[off] = 0x5A;
+        _exit(0);
+    }
+    if (wait_child(pid) < 0)
+        return 1;
+    for (size_t off = 0; off < size; off += PAGE_SIZE) {
+        if (buf[off] != (uint8_t)(off >> 12)) {
+            printf("[FORKEXEC] FAILURE: parent saw 0x%02x at offset %zu\n",
+                   buf[off], off);
+            return 1;
+        }
+    }
+
+    munmap(buf, size);
+    printf("[FORKEXEC] SUCCESS\n");
+    return 0;
+}
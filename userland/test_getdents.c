@@ -0,0 +1,196 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// getdents64() over a directory that keeps growing.
+//
+// Fills a directory with DEFAULT_FILES entries and lists it with
+// getdents64() after every quarter. With readdir restarting at the first
+// entry for every name a listing cost O(n^2) and each quarter took longer
+// per entry than the last; with position cookies the time per entry should
+// stay flat. A small buffer forces many resumes; the listing must still
+// return every name exactly once with the right d_type, and unlinking
+// entries in the middle of a listing must not make it skip the others.
+
+#define BASE "/getdents_test"
+#define DEFAULT_FILES 10000
+#define SMALL_BUF 256
+#define LARGE_BUF 32768
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// List BASE with bufsize-byte getdents64 calls. Counts the regular files,
+// and checks that every fileN with N < nfiles shows up exactly once.
+static int list_pass(int nfiles, size_t bufsize, uint8_t *seen, int *calls) {
+    int fd = open(BASE, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    char *buf = malloc(bufsize);
+    memset(seen, 0, (size_t)nfiles);
+    int files = 0;
+    *calls = 0;
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, bufsize);
+        if (n < 0) {
+            files = -1;
+            break;
+        }
+        if (n == 0)
+            break;
+        (*calls)++;
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            int idx;
+            if (sscanf(d->d_name, "file%d", &idx) == 1) {
+                if (d->d_type != DT_REG || idx < 0 || idx >= nfiles ||
+                    seen[idx]++) {
+                    printf("  bad entry %s (type %d)\n", d->d_name,
+                           d->d_type);
+                    files = -1;
+                }
+                if (files >= 0)
+                    files++;
+            } else if (strcmp(d->d_name, ".") != 0 &&
+                       strcmp(d->d_name, "..") != 0 &&
+                       strcmp(d->d_name, "subdir") != 0) {
+                printf("  unexpected entry %s\n", d->d_name);
+                files = -1;
+            } else if (d->d_type != DT_DIR) {
+                printf("  %s is not DT_DIR\n", d->d_name);
+                files = -1;
+            }
+            off += d->d_reclen;
+        }
+        if (files < 0)
+            break;
+    }
+    free(buf);
+    close(fd);
+    return files;
+}
+
+static int make_files(int from, int to) {
+    char path[64];
+    for (int i = from; i < to; i++) {
+        snprintf(path, sizeof(path), BASE "/file%d", i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return -1;
+        close(fd);
+    }
+    return 0;
+}
+
+// Unlink every other file while a listing is half done; the remaining
+// files must all still be returned.
+static int unlink_during_listing(int nfiles) {
+    int fd = open(BASE, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    char buf[SMALL_BUF];
+    uint8_t *seen = calloc((size_t)nfiles, 1);
+    int half = 0, errors = 0;
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            int idx;
+            if (sscanf(d->d_name, "file%d", &idx) == 1 && idx >= 0 &&
+                idx < nfiles)
+                seen[idx] = 1;
+            off += d->d_reclen;
+        }
+        if (!half) {
+            half = 1;
+            char path[64];
+            for (int i = 1; i < nfiles; i += 2) {
+                snprintf(path, sizeof(path), BASE "/file%d", i);
+                if (!seen[i])
+                    unlink(path);
+                seen[i] = 1; // Either listed already or gone
+            }
+        }
+    }
+    close(fd);
+    for (int i = 0; i < nfiles; i += 2)
+        if (!seen[i] && errors++ < 5)
+            printf("  file%d skipped\n", i);
+    free(seen);
+    return errors ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    int nfiles = argc > 1 ? atoi(argv[1]) : DEFAULT_FILES;
+    if (nfiles <= 0)
+        nfiles = DEFAULT_FILES;
+
+    mkdir(BASE, 0755);
+    mkdir(BASE "/subdir", 0755);
+    uint8_t *seen = malloc((size_t)nfiles);
+    int errors = 0, calls;
+
+    printf("[GETDENTS] listing while growing to %d entries\n", nfiles);
+    for (int q = 1; q <= 4; q++) {
+        int upto = nfiles / 4 * q;
+        if (q == 4)
+            upto = nfiles;
+        if (make_files(nfiles / 4 * (q - 1), upto) != 0) {
+            printf("  create failed\n");
+            errors++;
+            break;
+        }
+        uint64_t start = now_ns();
+        int got = list_pass(upto, LARGE_BUF, seen, &calls);
+        uint64_t ns = now_ns() - start;
+        printf("  %6d entries: %8llu us  %5llu ns/entry  (%d calls)\n", upto,
+               (unsigned long long)(ns / 1000),
+               (unsigned long long)(ns / (uint64_t)upto), calls);
+        if (got != upto) {
+            printf("  expected %d files, listed %d\n", upto, got);
+            errors++;
+        }
+    }
+
+    printf("[GETDENTS] %d-byte buffer\n", SMALL_BUF);
+    uint64_t start = now_ns();
+    int got = list_pass(nfiles, SMALL_BUF, seen, &calls);
+    uint64_t ns = now_ns() - start;
+    printf("  %6d entries: %8llu us  (%d calls)\n", got,
+           (unsigned long long)(ns / 1000), calls);
+    if (got != nfiles)
+        errors++;
+
+    printf("[GETDENTS] unlink during a listing\n");
+    if (unlink_during_listing(nfiles) != 0)
+        errors++;
+
+    char path[64];
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), BASE "/file%d", i);
+        unlink(path);
+    }
+    rmdir(BASE "/subdir");
+    rmdir(BASE);
+    free(seen);
+
+    if (errors) {
+        printf("[GETDENTS] FAIL: %d check(s) failed\n", errors);
+        return 1;
+    }
+    printf("[GETDENTS] PASS\n");
+    return 0;
+}
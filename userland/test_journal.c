@@ -0,0 +1,135 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// Namespace operations and fsync on ext3.
+//
+// 1. Namespace: DEFAULT_FILES empty files are created, renamed and
+//    unlinked. With a journal that wrote and checkpointed every operation
+//    synchronously each one cost several disk writes; with handles batched
+//    into transactions the rates should come close to those of ext2.
+// 2. fsync: a small file is rewritten and fsync()ed FSYNCS times. Every
+//    fsync forces one commit and waits for it, nothing more.
+// The jbd_* counters from /proc/vmstat show how many handles each commit
+// carried. On a filesystem without a journal they stay at zero.
+
+#define BASE "/journal_test"
+#define DEFAULT_FILES 2000
+#define FSYNCS 200
+
+static void report(const char *name, int ops, uint64_t ns) {
+    uint64_t rate = ns ? (uint64_t)ops * 1000000000ULL / ns : 0;
+    printf("  %-8s %6d ops  %8llu ops/s  (%llu ms)\n", name, ops,
+           (unsigned long long)rate, (unsigned long long)(ns / 1000000));
+}
+
+static int namespace_pass(int nfiles) {
+    char path[64], moved[64];
+    uint64_t start = now_ns();
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), BASE "/file%d", i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return -1;
+        close(fd);
+    }
+    report("create", nfiles, now_ns() - start);
+
+    start = now_ns();
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), BASE "/file%d", i);
+        snprintf(moved, sizeof(moved), BASE "/moved%d", i);
+        if (rename(path, moved) != 0)
+            return -1;
+    }
+    report("rename", nfiles, now_ns() - start);
+
+    start = now_ns();
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(moved, sizeof(moved), BASE "/moved%d", i);
+        if (unlink(moved) != 0)
+            return -1;
+    }
+    report("unlink", nfiles, now_ns() - start);
+
+    struct stat st;
+    snprintf(moved, sizeof(moved), BASE "/moved%d", nfiles / 2);
+    return stat(moved, &st) == 0 ? -1 : 0;
+}
+
+static int fsync_pass(void) {
+    int fd = open(BASE "/log.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    char line[64];
+    uint64_t start = now_ns();
+    for (int i = 0; i < FSYNCS; i++) {
+        int len = snprintf(line, sizeof(line), "record %d\n", i);
+        if (write(fd, line, (size_t)len) != len || fsync(fd) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    report("fsync", FSYNCS, now_ns() - start);
+    close(fd);
+
+    // The records must all be there
+    FILE *f = fopen(BASE "/log.txt", "r");
+    if (!f)
+        return -1;
+    int n = 0;
+    while (fgets(line, sizeof(line), f)) {
+        int idx;
+        if (sscanf(line, "record %d", &idx) != 1 || idx != n)
+            break;
+        n++;
+    }
+    fclose(f);
+    unlink(BASE "/log.txt");
+    return n == FSYNCS ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    int nfiles = argc > 1 ? atoi(argv[1]) : DEFAULT_FILES;
+    if (nfiles <= 0)
+        nfiles = DEFAULT_FILES;
+
+    mkdir(BASE, 0755);
+    int errors = 0;
+    uint64_t commits0 = vmstat_value("jbd_commits");
+    uint64_t handles0 = vmstat_value("jbd_handles");
+    uint64_t logged0 = vmstat_value("jbd_logged_blocks");
+    uint64_t cp0 = vmstat_value("jbd_checkpoints");
+
+    printf("[JOURNAL] create/rename/unlink of %d files\n", nfiles);
+    if (namespace_pass(nfiles) != 0) {
+        printf("  FAILED\n");
+        errors++;
+    }
+
+    printf("[JOURNAL] %d x write+fsync\n", FSYNCS);
+    if (fsync_pass() != 0) {
+        printf("  FAILED\n");
+        errors++;
+    }
+    rmdir(BASE);
+
+    printf("[JOURNAL] %llu commits, %llu handles, %llu blocks logged, "
+           "%llu checkpoints\n",
+           (unsigned long long)(vmstat_value("jbd_commits") - commits0),
+           (unsigned long long)(vmstat_value("jbd_handles") - handles0),
+           (unsigned long long)(vmstat_value("jbd_logged_blocks") - logged0),
+           (unsigned long long)(vmstat_value("jbd_checkpoints") - cp0));
+
+    if (errors) {
+        printf("[JOURNAL] FAIL: %d pass(es) failed\n", errors);
+        return 1;
+    }
+    printf("[JOURNAL] PASS\n");
+    return 0;
+}
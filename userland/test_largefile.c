@@ -0,0 +1,137 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+
+// Files past 4 GiB.
+//
+// A sparse file gets a few blocks written past 4 GiB: at the start, across
+// the 4 GiB boundary and at 5 GiB. With 32-bit file offsets the writes
+// wrapped around to the start of the file and the size came back modulo
+// 4 GiB; now every block must read back at its own offset, the holes in
+// between as zeroes, and fstat()/SEEK_END/ftruncate() must see the full
+// 64-bit size. Only the written blocks (and their indirect blocks) take
+// disk space.
+
+#define PATH "/largefile_test.bin"
+#define CHUNK 4096
+#define GIB (1024ULL * 1024 * 1024)
+
+static const uint64_t offsets[] = {
+    0,
+    4 * GIB - CHUNK / 2, // Straddles 4 GiB
+    5 * GIB + 123,
+};
+#define NR_OFFSETS (int)(sizeof(offsets) / sizeof(offsets[0]))
+
+static void fill(uint8_t *buf, int k) {
+    for (int i = 0; i < CHUNK; i++)
+        buf[i] = (uint8_t)(k * 31 + i * 7 + 1);
+}
+
+static int write_at(int fd, uint64_t off, const uint8_t *buf, size_t len) {
+    if (lseek(fd, (off_t)off, SEEK_SET) != (off_t)off)
+        return -1;
+    return write(fd, buf, len) == (ssize_t)len ? 0 : -1;
+}
+
+static int read_at(int fd, uint64_t off, uint8_t *buf, size_t len) {
+    if (lseek(fd, (off_t)off, SEEK_SET) != (off_t)off)
+        return -1;
+    return read(fd, buf, len) == (ssize_t)len ? 0 : -1;
+}
+
+static int check_size(int fd, uint64_t want, const char *what) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != want) {
+        printf("  %s: size %llu, expected %llu\n", what,
+               (unsigned long long)st.st_size, (unsigned long long)want);
+        return -1;
+    }
+    off_t end = lseek(fd, 0, SEEK_END);
+    if ((uint64_t)end != want) {
+        printf("  %s: SEEK_END at %lld\n", what, (long long)end);
+        return -1;
+    }
+    return 0;
+}
+
+int main(void) {
+    static uint8_t buf[CHUNK], back[CHUNK];
+    int errors = 0;
+
+    int fd = open(PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("[LARGEFILE] FAIL: cannot create " PATH "\n");
+        return 1;
+    }
+
+    printf("[LARGEFILE] writing %d blocks up to %llu GiB\n", NR_OFFSETS,
+           (unsigned long long)(offsets[NR_OFFSETS - 1] / GIB));
+    for (int k = 0; k < NR_OFFSETS; k++) {
+        fill(buf, k);
+        if (write_at(fd, offsets[k], buf, CHUNK) != 0) {
+            printf("  write at %llu failed\n", (unsigned long long)offsets[k]);
+            errors++;
+        }
+    }
+    uint64_t size = offsets[NR_OFFSETS - 1] + CHUNK;
+    if (check_size(fd, size, "after writes") != 0)
+        errors++;
+    close(fd);
+
+    // Read back through a fresh descriptor
+    fd = open(PATH, O_RDWR);
+    if (fd < 0) {
+        printf("[LARGEFILE] FAIL: cannot reopen " PATH "\n");
+        unlink(PATH);
+        return 1;
+    }
+    printf("[LARGEFILE] reading back\n");
+    for (int k = 0; k < NR_OFFSETS; k++) {
+        fill(buf, k);
+        memset(back, 0, sizeof(back));
+        if (read_at(fd, offsets[k], back, CHUNK) != 0 ||
+            memcmp(buf, back, CHUNK) != 0) {
+            printf("  block at %llu differs\n", (unsigned long long)offsets[k]);
+            errors++;
+        }
+    }
+    memset(back, 0xAA, sizeof(back));
+    if (read_at(fd, 2 * GIB, back, CHUNK) != 0 || back[0] || back[CHUNK - 1]) {
+        printf("  hole at 2 GiB is not zero\n");
+        errors++;
+    }
+    if (read(fd, back, CHUNK) != CHUNK) {
+        printf("  read continuing past 2 GiB failed\n");
+        errors++;
+    }
+    if (check_size(fd, size, "reopened") != 0)
+        errors++;
+
+    printf("[LARGEFILE] ftruncate to 4 GiB + 5\n");
+    if (ftruncate(fd, (off_t)(4 * GIB + 5)) != 0) {
+        printf("  ftruncate failed\n");
+        errors++;
+    } else {
+        if (check_size(fd, 4 * GIB + 5, "truncated") != 0)
+            errors++;
+        if (lseek(fd, (off_t)(4 * GIB), SEEK_SET) != (off_t)(4 * GIB) ||
+            read(fd, back, CHUNK) != 5) {
+            printf("  read at the new EOF is not 5 bytes\n");
+            errors++;
+        }
+    }
+    close(fd);
+    unlink(PATH);
+
+    if (errors) {
+        printf("[LARGEFILE] FAIL: %d check(s) failed\n", errors);
+        return 1;
+    }
+    printf("[LARGEFILE] PASS\n");
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// 4 KiB random reads from NVMe with a growing number of readers.
+//
+// Forks 1, 2, 4, ... up to MAX_JOBS readers (like fio's numjobs); each does
+// random 4 KiB reads from the raw device for RUN_SECONDS and reports its
+// operation count over a pipe. With one hardware queue per CPU the total
+// should grow with the number of readers until the device saturates, where
+// a single shared queue flattens out early. /proc/diskstats is printed at
+// the end to show merges and in-flight accounting.
+
+#define DEFAULT_DEV "/dev/nvme0"
+#define BLOCK_SIZE 4096
+#define RUN_SECONDS 3
+#define MAX_JOBS 16
+#define DEFAULT_SPAN_MB 64
+
+// xorshift64: cheap, different stream per child
+static uint64_t next_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void run_reader(const char *path, uint64_t blocks, int id, int out_fd) {
+    uint64_t ops = 0;
+    int fd = open(path, O_RDONLY);
+    char *buf = malloc(BLOCK_SIZE);
+    if (fd >= 0 && buf) {
+        uint64_t seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(id + 1);
+        uint64_t end = now_ns() + RUN_SECONDS * 1000000000ULL;
+        while (now_ns() < end) {
+            off_t off = (off_t)(next_rand(&seed) % blocks) * BLOCK_SIZE;
+            if (lseek(fd, off, SEEK_SET) != off)
+                break;
+            if (read(fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+                break;
+            ops++;
+        }
+    }
+    if (write(out_fd, &ops, sizeof(ops)) != sizeof(ops))
+        _exit(1);
+    _exit(fd >= 0 ? 0 : 1);
+}
+
+static int run_level(const char *path, uint64_t blocks, int jobs,
+                     uint64_t *total_ops) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    for (int i = 0; i < jobs; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return -1;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            run_reader(path, blocks, i, fds[1]);
+        }
+    }
+    close(fds[1]);
+
+    int failed = 0;
+    *total_ops = 0;
+    for (int i = 0; i < jobs; i++) {
+        uint64_t ops = 0;
+        if (read(fds[0], &ops, sizeof(ops)) == sizeof(ops))
+            *total_ops += ops;
+        int status = 0;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+            failed++;
+    }
+    close(fds[0]);
+    return failed ? -1 : 0;
+}
+
+static void dump_diskstats(void) {
+    FILE *f = fopen("/proc/diskstats", "r");
+    if (!f)
+        return;
+    char line[256];
+    printf("\n/proc/diskstats:\n");
+    while (fgets(line, sizeof(line), f))
+        printf("  %s", line);
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DEFAULT_DEV;
+    int max_jobs = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN) * 2;
+    if (max_jobs < 1)
+        max_jobs = 1;
+    if (max_jobs > MAX_JOBS)
+        max_jobs = MAX_JOBS;
+
+    uint64_t span = (uint64_t)DEFAULT_SPAN_MB * 1024 * 1024;
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size >= BLOCK_SIZE)
+        span = (uint64_t)st.st_size;
+    uint64_t blocks = span / BLOCK_SIZE;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("[NVME-IOPS] cannot open %s\n", path);
+        return 1;
+    }
+    close(fd);
+
+    printf("[NVME-IOPS] %s: random %d-byte reads over %llu MiB, %d s per level\n",
+           path, BLOCK_SIZE, (unsigned long long)(span >> 20), RUN_SECONDS);
+
+    int errors = 0;
+    for (int jobs = 1; jobs <= max_jobs; jobs *= 2) {
+        uint64_t ops = 0;
+        if (run_level(path, blocks, jobs, &ops) != 0)
+            errors++;
+        uint64_t iops = ops / RUN_SECONDS;
+        printf("  %2d job(s): %8llu IOPS  %6llu KiB/s\n", jobs,
+               (unsigned long long)iops,
+               (unsigned long long)(iops * BLOCK_SIZE / 1024));
+    }
+
+    dump_diskstats();
+    if (errors) {
+        printf("[NVME-IOPS] FAIL: %d level(s) had reader errors\n", errors);
+        return 1;
+    }
+    printf("[NVME-IOPS] PASS\n");
+    return 0;
+}
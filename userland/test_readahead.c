@@ -0,0 +1,170 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// Sequential reads from a cold page cache.
+//
+// 1. Cold-cache "cat": a large file is read front to back in 4 KiB chunks
+//    after its pages were dropped with POSIX_FADV_DONTNEED, once with
+//    readahead disabled (POSIX_FADV_RANDOM), once with the default window
+//    and once with POSIX_FADV_SEQUENTIAL (2 MiB window).
+// 2. Shell startup: "bash -c true" is timed with bash's pages dropped
+//    (cold) and again with them cached (warm). The ELF loader reads the
+//    whole image ahead, so the cold start should no longer be a chain of
+//    single-page reads.
+//
+// pgcache_readahead from /proc/vmstat is printed to show the pages that
+// arrived ahead of the reader.
+
+#define DEFAULT_FILE "/ra_test.bin"
+#define DEFAULT_SIZE_MB 32
+#define CHUNK 4096
+#define SHELL "/bin/bash"
+#define SHELL_RUNS 5
+
+static int drop_cache(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    int err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return err ? -1 : 0;
+}
+
+static int make_file(const char *path, uint64_t size) {
+    struct stat st;
+    if (stat(path, &st) == 0 && (uint64_t)st.st_size >= size)
+        return 0;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    char *buf = malloc(65536);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+    for (size_t i = 0; i < 65536; i++)
+        buf[i] = (char)(i * 31 + 7);
+    uint64_t done = 0;
+    while (done < size) {
+        if (write(fd, buf, 65536) != 65536)
+            break;
+        done += 65536;
+    }
+    free(buf);
+    close(fd);
+    return done >= size ? 0 : -1;
+}
+
+// Read path sequentially with the given advice (-1: none).
+static int cat_pass(const char *path, int advice, uint64_t *bytes_out,
+                    uint64_t *ns_out) {
+    if (drop_cache(path) != 0)
+        return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (advice >= 0)
+        posix_fadvise(fd, 0, 0, advice);
+
+    char buf[CHUNK];
+    uint64_t done = 0;
+    uint64_t start = now_ns();
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        done += (uint64_t)n;
+    *ns_out = now_ns() - start;
+    *bytes_out = done;
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+static int shell_pass(uint64_t *ns_out) {
+    uint64_t start = now_ns();
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        execl(SHELL, SHELL, "-c", "true", (char *)NULL);
+        _exit(127);
+    }
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0)
+        return -1;
+    *ns_out = now_ns() - start;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DEFAULT_FILE;
+    uint64_t size = (uint64_t)(argc > 2 ? atoi(argv[2]) : DEFAULT_SIZE_MB) << 20;
+    if (size == 0)
+        size = (uint64_t)DEFAULT_SIZE_MB << 20;
+
+    if (make_file(path, size) != 0) {
+        printf("[READAHEAD] cannot create %s\n", path);
+        return 1;
+    }
+
+    static const struct {
+        const char *name;
+        int advice;
+    } modes[] = {
+        { "no readahead (FADV_RANDOM)", POSIX_FADV_RANDOM },
+        { "default window", -1 },
+        { "FADV_SEQUENTIAL", POSIX_FADV_SEQUENTIAL },
+    };
+
+    printf("[READAHEAD] cold-cache sequential read of %s\n", path);
+    int errors = 0;
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        uint64_t ra_before = vmstat_value("pgcache_readahead");
+        uint64_t bytes = 0, ns = 0;
+        if (cat_pass(path, modes[i].advice, &bytes, &ns) != 0) {
+            printf("  %-28s FAILED\n", modes[i].name);
+            errors++;
+            continue;
+        }
+        uint64_t kib_s = ns ? bytes * 1000000000ULL / ns / 1024 : 0;
+        printf("  %-28s %8llu KiB/s  (%llu ms, %llu pages read ahead)\n",
+               modes[i].name, (unsigned long long)kib_s,
+               (unsigned long long)(ns / 1000000),
+               (unsigned long long)(vmstat_value("pgcache_readahead") - ra_before));
+    }
+
+    if (access(SHELL, X_OK) == 0) {
+        printf("[READAHEAD] %s -c true startup\n", SHELL);
+        uint64_t cold = 0, warm = 0, ns = 0;
+        if (drop_cache(SHELL) != 0 || shell_pass(&cold) != 0) {
+            printf("  cold: FAILED\n");
+            errors++;
+        } else {
+            for (int i = 0; i < SHELL_RUNS; i++) {
+                if (shell_pass(&ns) != 0) {
+                    errors++;
+                    break;
+                }
+                warm += ns;
+            }
+            printf("  cold: %6llu us\n", (unsigned long long)(cold / 1000));
+            printf("  warm: %6llu us (average of %d)\n",
+                   (unsigned long long)(warm / SHELL_RUNS / 1000), SHELL_RUNS);
+        }
+    } else {
+        printf("[READAHEAD] %s not installed, skipping startup timing\n", SHELL);
+    }
+
+    if (errors) {
+        printf("[READAHEAD] FAIL: %d pass(es) failed\n", errors);
+        return 1;
+    }
+    printf("[READAHEAD] PASS\n");
+    return 0;
+}
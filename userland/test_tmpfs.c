@@ -0,0 +1,283 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// tmpfs under /tmp: speed, holes, lookups and mmap.
+//
+// 1. Write: a file in /tmp grows to SIZE_MB in 64 KiB writes. With the
+//    old ramfs every growth reallocated and copied the whole file on the
+//    kernel heap, so later quarters slowed down; pages in a radix tree
+//    keep the rate flat. The data must read back intact.
+// 2. Sparse: a block written at 1 GiB must leave a hole that reads as
+//    zeroes and takes no pages (nr_shmem in /proc/vmstat).
+// 3. Lookup: DEFAULT_FILES files are created and stat()ed by name, which
+//    walked the whole child list per lookup before directories were hashed.
+// 4. mmap: stores through a MAP_SHARED mapping must be seen by read() and
+//    write()s by the mapping, since both use the file's own pages.
+// 5. Private mmap: stores through a MAP_PRIVATE mapping, including one made
+//    writable later by mprotect(), must leave the file unchanged.
+
+#define BASE "/tmp/tmpfs_test"
+#define DEFAULT_SIZE_MB 64
+#define DEFAULT_FILES 5000
+#define CHUNK 65536
+#define GIB (1024ULL * 1024 * 1024)
+
+static int write_pass(uint64_t size) {
+    static uint8_t buf[CHUNK], back[CHUNK];
+    int fd = open(BASE "/big.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    uint64_t quarter = size / 4, done = 0;
+    for (int q = 0; q < 4; q++) {
+        uint64_t start = now_ns();
+        uint64_t end = done + quarter;
+        while (done < end) {
+            for (int i = 0; i < CHUNK; i += 512)
+                buf[i] = (uint8_t)(done / CHUNK + i);
+            if (write(fd, buf, CHUNK) != CHUNK) {
+                close(fd);
+                return -1;
+            }
+            done += CHUNK;
+        }
+        uint64_t ns = now_ns() - start;
+        uint64_t kib_s = ns ? quarter * 1000000000ULL / ns / 1024 : 0;
+        printf("  quarter %d: %8llu KiB/s  (%llu ms)\n", q + 1,
+               (unsigned long long)kib_s, (unsigned long long)(ns / 1000000));
+    }
+
+    int errors = 0;
+    lseek(fd, 0, SEEK_SET);
+    for (uint64_t off = 0; off < done; off += CHUNK) {
+        if (read(fd, back, CHUNK) != CHUNK) {
+            errors++;
+            break;
+        }
+        for (int i = 0; i < CHUNK; i += 512)
+            if (back[i] != (uint8_t)(off / CHUNK + i) && errors++ < 5)
+                printf("  byte %llu differs\n",
+                       (unsigned long long)(off + (uint64_t)i));
+    }
+    close(fd);
+    unlink(BASE "/big.bin");
+    return errors ? -1 : 0;
+}
+
+static int sparse_pass(void) {
+    char buf[4096], back[4096];
+    memset(buf, 'S', sizeof(buf));
+    uint64_t before = vmstat_value("nr_shmem");
+
+    int fd = open(BASE "/sparse.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    int errors = 0;
+    if (lseek(fd, (off_t)GIB, SEEK_SET) != (off_t)GIB ||
+        write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf))
+        errors++;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != GIB + sizeof(buf))
+        errors++;
+    uint64_t used = vmstat_value("nr_shmem") - before;
+    printf("  1 GiB + 4 KiB file holds %llu page(s)\n",
+           (unsigned long long)used);
+    if (used > 1)
+        errors++;
+
+    memset(back, 'X', sizeof(back));
+    if (lseek(fd, (off_t)(GIB / 2), SEEK_SET) != (off_t)(GIB / 2) ||
+        read(fd, back, sizeof(back)) != (ssize_t)sizeof(back) || back[0] ||
+        back[sizeof(back) - 1]) {
+        printf("  hole does not read as zeroes\n");
+        errors++;
+    }
+    if (lseek(fd, (off_t)GIB, SEEK_SET) != (off_t)GIB ||
+        read(fd, back, sizeof(back)) != (ssize_t)sizeof(back) ||
+        memcmp(buf, back, sizeof(buf)) != 0) {
+        printf("  block at 1 GiB differs\n");
+        errors++;
+    }
+    close(fd);
+    unlink(BASE "/sparse.bin");
+    return errors ? -1 : 0;
+}
+
+static int lookup_pass(int nfiles) {
+    char path[64];
+    uint64_t start = now_ns();
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), BASE "/file%d", i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return -1;
+        close(fd);
+    }
+    uint64_t create_ns = now_ns() - start;
+
+    int errors = 0;
+    struct stat st;
+    start = now_ns();
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), BASE "/file%d", (i * 7919) % nfiles);
+        if (stat(path, &st) != 0)
+            errors++;
+    }
+    uint64_t stat_ns = now_ns() - start;
+    printf("  create %llu ns/file, stat %llu ns/file\n",
+           (unsigned long long)(create_ns / (uint64_t)nfiles),
+           (unsigned long long)(stat_ns / (uint64_t)nfiles));
+
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), BASE "/file%d", i);
+        if (unlink(path) != 0)
+            errors++;
+    }
+    if (stat(BASE "/file0", &st) == 0)
+        errors++;
+    return errors ? -1 : 0;
+}
+
+static int mmap_pass(void) {
+    const size_t len = 4 * 4096;
+    char buf[64];
+    int fd = open(BASE "/map.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)len) != 0)
+        return -1;
+
+    char *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    int errors = 0;
+
+    // Store through the mapping, read through the file
+    strcpy(p + 4096 + 10, "through the mapping");
+    if (lseek(fd, 4096 + 10, SEEK_SET) != 4096 + 10 ||
+        read(fd, buf, 19) != 19 ||
+        memcmp(buf, "through the mapping", 19) != 0) {
+        printf("  read() does not see the mapping's store\n");
+        errors++;
+    }
+
+    // Write through the file, load through the mapping
+    if (lseek(fd, 3 * 4096, SEEK_SET) != 3 * 4096 ||
+        write(fd, "through write", 13) != 13 ||
+        memcmp(p + 3 * 4096, "through write", 13) != 0) {
+        printf("  the mapping does not see write()\n");
+        errors++;
+    }
+
+    munmap(p, len);
+    close(fd);
+    unlink(BASE "/map.bin");
+    return errors ? -1 : 0;
+}
+
+static int private_pass(void) {
+    const size_t len = 2 * 4096;
+    char buf[16];
+    int fd = open(BASE "/priv.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, "file contents", 13) != 13 ||
+        ftruncate(fd, (off_t)len) != 0)
+        return -1;
+
+    char *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    char *q = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED || q == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    int errors = 0;
+
+    memcpy(p, "private store", 13);
+    if (mprotect(q, len, PROT_READ | PROT_WRITE) != 0) {
+        printf("  mprotect failed\n");
+        errors++;
+    } else {
+        memcpy(q + 4096, "after mprotect", 14);
+    }
+    if (memcmp(p, "private store", 13) != 0 ||
+        memcmp(q, "file contents", 13) != 0) {
+        printf("  the mappings do not see their own pages\n");
+        errors++;
+    }
+
+    char zero[14] = {0};
+    if (lseek(fd, 0, SEEK_SET) != 0 || read(fd, buf, 13) != 13 ||
+        memcmp(buf, "file contents", 13) != 0 ||
+        lseek(fd, 4096, SEEK_SET) != 4096 || read(fd, buf, 14) != 14 ||
+        memcmp(buf, zero, 14) != 0) {
+        printf("  a private store reached the file\n");
+        errors++;
+    }
+
+    munmap(p, len);
+    munmap(q, len);
+    close(fd);
+    unlink(BASE "/priv.bin");
+    return errors ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    uint64_t size = (uint64_t)(argc > 1 ? atoi(argv[1]) : DEFAULT_SIZE_MB)
+                    << 20;
+    if (size == 0)
+        size = (uint64_t)DEFAULT_SIZE_MB << 20;
+
+    mkdir(BASE, 0755);
+    int errors = 0;
+
+    printf("[TMPFS] writing %llu MiB in %d-byte writes\n",
+           (unsigned long long)(size >> 20), CHUNK);
+    if (write_pass(size) != 0) {
+        printf("  FAILED\n");
+        errors++;
+    }
+
+    printf("[TMPFS] sparse file\n");
+    if (sparse_pass() != 0) {
+        printf("  FAILED\n");
+        errors++;
+    }
+
+    printf("[TMPFS] %d files in one directory\n", DEFAULT_FILES);
+    if (lookup_pass(DEFAULT_FILES) != 0) {
+        printf("  FAILED\n");
+        errors++;
+    }
+
+    printf("[TMPFS] MAP_SHARED mapping\n");
+    if (mmap_pass() != 0) {
+        printf("  FAILED\n");
+        errors++;
+    }
+
+    printf("[TMPFS] MAP_PRIVATE mapping\n");
+    if (private_pass() != 0) {
+        printf("  FAILED\n");
+        errors++;
+    }
+    rmdir(BASE);
+
+    printf("[TMPFS] nr_shmem %llu, shmem_mapped %llu, shmem_limit_hits "
+           "%llu\n",
+           (unsigned long long)vmstat_value("nr_shmem"),
+           (unsigned long long)vmstat_value("shmem_mapped"),
+           (unsigned long long)vmstat_value("shmem_limit_hits"));
+
+    if (errors) {
+        printf("[TMPFS] FAIL: %d pass(es) failed\n", errors);
+        return 1;
+    }
+    printf("[TMPFS] PASS\n");
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "bench.h"
+
+// Buffered writes, delayed allocation and the fsync family.
+//
+// Two files grow in alternating CHUNK-byte writes. With writes allocating
+// and writing block by block the writer paid for every block and the two
+// files ended up interleaved on disk; with delayed allocation the writes
+// only dirty the page cache and the flusher (or fsync) allocates each file
+// contiguously. The Dirty line of /proc/meminfo and the nr_dirty and
+// pgcache_* counters of /proc/vmstat show the page cache doing the work.
+// Every flavour of fsync/fdatasync/sync/syncfs must succeed and leave no
+// dirty pages behind, and the data must read back intact.
+
+#define BASE "/writeback_test"
+#define DEFAULT_SIZE_MB 8
+#define CHUNK 4096
+
+static void print_dirty(const char *when) {
+    FILE *f = fopen("/proc/meminfo", "r");
+    char line[128];
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "Dirty:", 6) == 0) {
+                line[strcspn(line, "\n")] = 0;
+                printf("  %-14s %s\n", when, line);
+                break;
+            }
+        }
+        fclose(f);
+    }
+}
+
+static void fill(char *buf, int file, uint64_t off) {
+    for (int i = 0; i < CHUNK; i++)
+        buf[i] = (char)((off + (uint64_t)i) * 7 + (uint64_t)file * 31);
+}
+
+static int interleaved_pass(int fds[2], uint64_t size) {
+    char buf[CHUNK];
+    uint64_t wb0 = vmstat_value("pgcache_writeback");
+    uint64_t thr0 = vmstat_value("pgcache_throttled");
+
+    uint64_t start = now_ns();
+    for (uint64_t off = 0; off < size; off += CHUNK) {
+        for (int f = 0; f < 2; f++) {
+            fill(buf, f, off);
+            if (write(fds[f], buf, CHUNK) != CHUNK)
+                return -1;
+        }
+    }
+    uint64_t ns = now_ns() - start;
+    uint64_t kib_s = ns ? size * 2 * 1000000000ULL / ns / 1024 : 0;
+    printf("  buffered: %8llu KiB/s  (%llu ms)\n", (unsigned long long)kib_s,
+           (unsigned long long)(ns / 1000000));
+    print_dirty("after writes");
+    printf("  nr_dirty %llu, writeback +%llu, throttled +%llu\n",
+           (unsigned long long)vmstat_value("nr_dirty"),
+           (unsigned long long)(vmstat_value("pgcache_writeback") - wb0),
+           (unsigned long long)(vmstat_value("pgcache_throttled") - thr0));
+    return 0;
+}
+
+// Dirty the first page of file f again (same contents) and flush it with the given syscall.
+static int sync_pass(const char *name, int fds[2], int f, long nr,
+                     int arg) {
+    char buf[CHUNK];
+    fill(buf, f, 0);
+    int fd = fds[f];
+    if (pwrite(fd, buf, CHUNK, 0) != CHUNK)
+        return -1;
+    uint64_t start = now_ns();
+    long ret = arg ? syscall(nr, fd) : syscall(nr);
+    uint64_t ns = now_ns() - start;
+    printf("  %-10s %8llu us  (ret %ld)\n", name,
+           (unsigned long long)(ns / 1000), ret);
+    return ret == 0 ? 0 : -1;
+}
+
+static int verify(const char *path, int file, uint64_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    char buf[CHUNK], want[CHUNK];
+    int ok = 0;
+    for (uint64_t off = 0; off < size; off += CHUNK) {
+        fill(want, file, off);
+        if (read(fd, buf, CHUNK) != CHUNK || memcmp(buf, want, CHUNK) != 0) {
+            printf("  %s: mismatch at %llu\n", path,
+                   (unsigned long long)off);
+            ok = -1;
+            break;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    uint64_t size = (uint64_t)(argc > 1 ? atoi(argv[1]) : DEFAULT_SIZE_MB) << 20;
+    if (size == 0)
+        size = (uint64_t)DEFAULT_SIZE_MB << 20;
+
+    mkdir(BASE, 0755);
+    const char *paths[2] = {BASE "/a.bin", BASE "/b.bin"};
+    int fds[2];
+    for (int f = 0; f < 2; f++) {
+        fds[f] = open(paths[f], O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fds[f] < 0) {
+            printf("[WRITEBACK] cannot create %s\n", paths[f]);
+            return 1;
+        }
+    }
+    int errors = 0;
+
+    printf("[WRITEBACK] 2 files x %llu MiB in alternating %d-byte writes\n",
+           (unsigned long long)(size >> 20), CHUNK);
+    if (interleaved_pass(fds, size) != 0) {
+        printf("  write FAILED\n");
+        errors++;
+    }
+
+    printf("[WRITEBACK] flushing\n");
+    if (sync_pass("fsync", fds, 0, SYS_fsync, 1) != 0)
+        errors++;
+    if (sync_pass("fdatasync", fds, 1, SYS_fdatasync, 1) != 0)
+        errors++;
+    if (sync_pass("syncfs", fds, 0, SYS_syncfs, 1) != 0)
+        errors++;
+    if (sync_pass("sync", fds, 1, SYS_sync, 0) != 0)
+        errors++;
+    print_dirty("after sync");
+    for (int f = 0; f < 2; f++)
+        close(fds[f]);
+
+    for (int f = 0; f < 2; f++)
+        if (verify(paths[f], f, size) != 0)
+            errors++;
+    for (int f = 0; f < 2; f++)
+        unlink(paths[f]);
+    rmdir(BASE);
+
+    if (errors) {
+        printf("[WRITEBACK] FAIL: %d check(s) failed\n", errors);
+        return 1;
+    }
+    printf("[WRITEBACK] PASS\n");
+    return 0;
+}